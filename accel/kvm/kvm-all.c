@@ -36,6 +36,7 @@
 #include "exec/ram_addr.h"
 #include "exec/address-spaces.h"
 #include "qemu/event_notifier.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "hw/irq.h"
 
@@ -66,6 +67,7 @@
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
+    uint32_t kvm_fetch_index;
     QLIST_ENTRY(KVMParkedVcpu) node;
 };
 
@@ -97,12 +99,21 @@ struct KVMState
 #ifdef KVM_CAP_IRQ_ROUTING
     struct kvm_irq_routing *irq_routes;
     int nr_allocated_irq_routes;
+    /* irq_routes differs from the table last given to KVM */
+    bool irq_routes_dirty;
     unsigned long *used_gsi_bitmap;
     unsigned int gsi_count;
     QTAILQ_HEAD(msi_hashtab, KVMMSIRoute) msi_hashtab[KVM_MSI_HASHTAB_SIZE];
 #endif
     KVMMemoryListener memory_listener;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
+    /* Listeners by address space id, to find the slots of dirty ring
+     * entries; x86 uses one for SMM as well as the normal one.  */
+    KVMMemoryListener *as_listeners[2];
+    /* Entries in each vCPU's dirty ring, or 0 to use dirty bitmaps */
+    uint32_t kvm_dirty_ring_size;
+    uint32_t kvm_dirty_ring_bytes;
+    QemuThread kvm_dirty_ring_reaper;
 };
 
 KVMState *kvm_state;
@@ -181,7 +192,8 @@ static KVMSlot *kvm_lookup_matching_slot(KVMMemoryListener *kml,
     for (i = 0; i < s->nr_slots; i++) {
         KVMSlot *mem = &kml->slots[i];
 
-        if (start_addr == mem->start_addr && size == mem->memory_size) {
+        if (start_addr == mem->start_addr && size == mem->memory_size &&
+            !mem->deferred_mr) {
             return mem;
         }
     }
@@ -251,6 +263,8 @@ static int kvm_set_user_memory_region(KVMMemoryListener *kml, KVMSlot *slot)
     return kvm_vm_ioctl(s, KVM_SET_USER_MEMORY_REGION, &mem);
 }
 
+static uint32_t kvm_dirty_ring_reap(KVMState *s);
+
 int kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -272,16 +286,28 @@ int kvm_destroy_vcpu(CPUState *cpu)
         goto err;
     }
 
+    if (cpu->kvm_dirty_gfns) {
+        /* Collect what the vCPU dirtied before its ring goes away */
+        kvm_dirty_ring_reap(s);
+        ret = munmap(cpu->kvm_dirty_gfns, s->kvm_dirty_ring_bytes);
+        if (ret < 0) {
+            goto err;
+        }
+        cpu->kvm_dirty_gfns = NULL;
+    }
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
+    vcpu->kvm_fetch_index = cpu->kvm_fetch_index;
     QLIST_INSERT_HEAD(&kvm_state->kvm_parked_vcpus, vcpu, node);
 err:
     return ret;
 }
 
-static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
+static int kvm_get_vcpu(KVMState *s, CPUState *cs)
 {
+    unsigned long vcpu_id = kvm_arch_vcpu_id(cs);
     struct KVMParkedVcpu *cpu;
 
     QLIST_FOREACH(cpu, &s->kvm_parked_vcpus, node) {
@@ -290,11 +316,14 @@ static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
 
             QLIST_REMOVE(cpu, node);
             kvm_fd = cpu->kvm_fd;
+            /* The kernel's position in the dirty ring lives with the fd */
+            cs->kvm_fetch_index = cpu->kvm_fetch_index;
             g_free(cpu);
             return kvm_fd;
         }
     }
 
+    cs->kvm_fetch_index = 0;
     return kvm_vm_ioctl(s, KVM_CREATE_VCPU, (void *)vcpu_id);
 }
 
@@ -306,7 +335,7 @@ int kvm_init_vcpu(CPUState *cpu)
 
     DPRINTF("kvm_init_vcpu\n");
 
-    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu));
+    ret = kvm_get_vcpu(s, cpu);
     if (ret < 0) {
         DPRINTF("kvm_create_vcpu failed\n");
         goto err;
@@ -336,6 +365,19 @@ int kvm_init_vcpu(CPUState *cpu)
             (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
     }
 
+    if (s->kvm_dirty_ring_size) {
+        cpu->kvm_dirty_gfns = mmap(NULL, s->kvm_dirty_ring_bytes,
+                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                   cpu->kvm_fd,
+                                   PAGE_SIZE * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            cpu->kvm_dirty_gfns = NULL;
+            ret = -errno;
+            DPRINTF("mmap'ing vcpu dirty ring failed\n");
+            goto err;
+        }
+    }
+
     ret = kvm_arch_init_vcpu(cpu);
 err:
     return ret;
@@ -443,6 +485,126 @@ static int kvm_get_dirty_pages_log_range(MemoryRegionSection *section,
 
 #define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
 
+/*
+ * Dirty ring: instead of per-slot bitmaps, each vCPU pushes the GFNs it
+ * dirties into a ring shared with userspace.  Entries are harvested in
+ * order, flagged for reset, and KVM_RESET_DIRTY_RINGS then write-protects
+ * the harvested pages again, so the cost of a sync is proportional to the
+ * number of pages dirtied rather than to the size of the guest.
+ */
+
+/* Called with the BQL held */
+static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
+                                     uint32_t slot_id, uint64_t offset)
+{
+    KVMMemoryListener *kml;
+    KVMSlot *mem;
+
+    if (as_id >= ARRAY_SIZE(s->as_listeners) || slot_id >= s->nr_slots) {
+        return;
+    }
+    kml = s->as_listeners[as_id];
+    if (!kml) {
+        return;
+    }
+
+    /* The slot may have been deleted since the page was dirtied */
+    mem = &kml->slots[slot_id];
+    if (offset >= mem->memory_size / getpagesize()) {
+        return;
+    }
+
+    cpu_physical_memory_set_dirty_range(mem->ram_start_offset +
+                                        offset * getpagesize(),
+                                        getpagesize(),
+                                        tcg_enabled() ? DIRTY_CLIENTS_ALL
+                                                      : DIRTY_CLIENTS_NOCODE);
+}
+
+/* Called with the BQL held */
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+{
+    struct kvm_dirty_gfn *cur;
+    uint32_t count = 0;
+
+    for (;;) {
+        cur = &cpu->kvm_dirty_gfns[cpu->kvm_fetch_index &
+                                   (s->kvm_dirty_ring_size - 1)];
+        if (!(atomic_load_acquire(&cur->flags) & KVM_DIRTY_GFN_F_DIRTY)) {
+            break;
+        }
+        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
+                                 cur->offset);
+        atomic_store_release(&cur->flags, KVM_DIRTY_GFN_F_RESET);
+        cpu->kvm_fetch_index++;
+        count++;
+    }
+
+    return count;
+}
+
+/* Harvest the dirty rings of all vCPUs.  Called with the BQL held.  */
+static uint32_t kvm_dirty_ring_reap(KVMState *s)
+{
+    CPUState *cpu;
+    uint32_t total = 0;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->kvm_dirty_gfns) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+    }
+
+    if (total) {
+        if (kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS) < 0) {
+            fprintf(stderr, "%s: KVM_RESET_DIRTY_RINGS failed: %s\n",
+                    __func__, strerror(errno));
+            abort();
+        }
+    }
+
+    return total;
+}
+
+static void do_kvm_dirty_ring_kick(CPUState *cpu, run_on_cpu_data arg)
+{
+    /* Nothing to do, the vCPU left KVM_RUN to get here */
+}
+
+/*
+ * Make every vCPU exit to userspace, so that entries the processor still
+ * buffers (e.g. in the Intel PML log) reach the rings, then reap them all.
+ */
+static void kvm_dirty_ring_flush(KVMState *s)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        run_on_cpu(cpu, do_kvm_dirty_ring_kick, RUN_ON_CPU_NULL);
+    }
+    kvm_dirty_ring_reap(s);
+}
+
+/*
+ * Reap the rings regularly even when nobody syncs the dirty log, so that
+ * vCPUs rarely have to stop with a full ring.
+ */
+static void *kvm_dirty_ring_reaper_thread(void *opaque)
+{
+    KVMState *s = opaque;
+
+    rcu_register_thread();
+    for (;;) {
+        sleep(1);
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap(s);
+        qemu_mutex_unlock_iothread();
+    }
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
 /**
  * kvm_physical_sync_dirty_bitmap - Grab dirty bitmap from kernel space
  * This function updates qemu's dirty bitmap using
@@ -460,6 +622,12 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
     KVMSlot *mem;
     hwaddr start_addr, size;
 
+    if (s->kvm_dirty_ring_size) {
+        /* KVM_GET_DIRTY_LOG is not available with dirty rings */
+        kvm_dirty_ring_reap(s);
+        return 0;
+    }
+
     size = kvm_align_section(section, &start_addr);
     if (size) {
         mem = kvm_lookup_matching_slot(kml, start_addr, size);
@@ -686,11 +854,69 @@ kvm_check_extension_list(KVMState *s, const KVMCapabilityInfo *list)
     return NULL;
 }
 
+static void kvm_slot_delete(KVMMemoryListener *kml, KVMSlot *mem)
+{
+    int err;
+
+    mem->memory_size = 0;
+    err = kvm_set_user_memory_region(kml, mem);
+    if (err) {
+        fprintf(stderr, "%s: error unregistering slot: %s\n",
+                __func__, strerror(-err));
+        abort();
+    }
+}
+
+/* Delete the deferred slots that overlap [start_addr, start_addr + size) */
+static void kvm_flush_deferred_slots(KVMMemoryListener *kml,
+                                     hwaddr start_addr, hwaddr size)
+{
+    KVMState *s = kvm_state;
+    int i;
+
+    for (i = 0; i < s->nr_slots; i++) {
+        KVMSlot *mem = &kml->slots[i];
+        MemoryRegion *mr = mem->deferred_mr;
+
+        if (mr && mem->start_addr <= start_addr + (size - 1) &&
+            start_addr <= mem->start_addr + (mem->memory_size - 1)) {
+            mem->deferred_mr = NULL;
+            kvm_slot_delete(kml, mem);
+            memory_region_unref(mr);
+        }
+    }
+}
+
+/*
+ * Find a deferred slot that maps the same host memory with the same size,
+ * so that it can be updated in place.  KVM moves a slot to a new guest
+ * address or changes its flags atomically, except for KVM_MEM_READONLY.
+ */
+static KVMSlot *kvm_take_deferred_slot(KVMMemoryListener *kml, void *ram,
+                                       hwaddr size, int flags)
+{
+    KVMState *s = kvm_state;
+    int i;
+
+    for (i = 0; i < s->nr_slots; i++) {
+        KVMSlot *mem = &kml->slots[i];
+
+        if (mem->deferred_mr && mem->ram == ram && mem->memory_size == size &&
+            !((mem->flags ^ flags) & KVM_MEM_READONLY)) {
+            memory_region_unref(mem->deferred_mr);
+            mem->deferred_mr = NULL;
+            return mem;
+        }
+    }
+
+    return NULL;
+}
+
 static void kvm_set_phys_mem(KVMMemoryListener *kml,
                              MemoryRegionSection *section, bool add)
 {
     KVMSlot *mem;
-    int err;
+    int err, flags;
     MemoryRegion *mr = section->mr;
     bool writeable = !mr->readonly && !mr->rom_device;
     hwaddr start_addr, size;
@@ -724,23 +950,33 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             kvm_physical_sync_dirty_bitmap(kml, section);
         }
 
-        /* unregister the slot */
-        mem->memory_size = 0;
-        err = kvm_set_user_memory_region(kml, mem);
-        if (err) {
-            fprintf(stderr, "%s: error unregistering slot: %s\n",
-                    __func__, strerror(-err));
-            abort();
-        }
+        /* Keep the slot until the end of the transaction, in case the
+         * same memory shows up again at the same or another address;
+         * vCPUs then never fault on it in between.  */
+        memory_region_ref(mr);
+        mem->deferred_mr = mr;
         return;
     }
 
-    /* register the new slot */
-    mem = kvm_alloc_slot(kml);
-    mem->memory_size = size;
+    flags = kvm_mem_flags(mr);
+    mem = kvm_take_deferred_slot(kml, ram, size, flags);
+    if (mem) {
+        if (mem->start_addr == start_addr && mem->flags == flags) {
+            return;
+        }
+    } else {
+        /* register the new slot */
+        mem = kvm_alloc_slot(kml);
+        mem->memory_size = size;
+        mem->ram = ram;
+    }
+    /* KVM refuses overlapping slots, so drop the stale ones first */
+    kvm_flush_deferred_slots(kml, start_addr, size);
     mem->start_addr = start_addr;
-    mem->ram = ram;
-    mem->flags = kvm_mem_flags(mr);
+    mem->ram_start_offset = memory_region_get_ram_addr(mr) +
+                            section->offset_within_region +
+                            (start_addr - section->offset_within_address_space);
+    mem->flags = flags;
 
     err = kvm_set_user_memory_region(kml, mem);
     if (err) {
@@ -780,6 +1016,18 @@ static void kvm_log_sync(MemoryListener *listener,
     }
 }
 
+static void kvm_region_commit(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+
+    kvm_flush_deferred_slots(kml, 0, (hwaddr)-1);
+}
+
+static void kvm_log_sync_global(MemoryListener *listener)
+{
+    kvm_dirty_ring_flush(kvm_state);
+}
+
 static void kvm_mem_ioeventfd_add(MemoryListener *listener,
                                   MemoryRegionSection *section,
                                   bool match_data, uint64_t data,
@@ -867,11 +1115,21 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
 
     kml->listener.region_add = kvm_region_add;
     kml->listener.region_del = kvm_region_del;
+    kml->listener.commit = kvm_region_commit;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
-    kml->listener.log_sync = kvm_log_sync;
+    if (!s->kvm_dirty_ring_size) {
+        kml->listener.log_sync = kvm_log_sync;
+    } else if (as_id == 0) {
+        /* One flush covers the rings of all address spaces */
+        kml->listener.log_sync_global = kvm_log_sync_global;
+    }
     kml->listener.priority = 10;
 
+    if (as_id < ARRAY_SIZE(s->as_listeners)) {
+        s->as_listeners[as_id] = kml;
+    }
+
     memory_listener_register(&kml->listener, as);
 }
 
@@ -928,6 +1186,7 @@ void kvm_init_irq_routing(KVMState *s)
 
     s->irq_routes = g_malloc0(sizeof(*s->irq_routes));
     s->nr_allocated_irq_routes = 0;
+    s->irq_routes_dirty = true;
 
     if (!kvm_direct_msi_allowed) {
         for (i = 0; i < KVM_MSI_HASHTAB_SIZE; i++) {
@@ -950,10 +1209,20 @@ void kvm_irqchip_commit_routes(KVMState *s)
         return;
     }
 
+    /*
+     * KVM_SET_GSI_ROUTING replaces the whole table and waits for an RCU
+     * grace period in the kernel, so skip it when no route changed.
+     * MSI-X and IOAPIC updates often rewrite a route with its old value.
+     */
+    if (!s->irq_routes_dirty) {
+        return;
+    }
+
     s->irq_routes->flags = 0;
     trace_kvm_irqchip_commit_routes();
     ret = kvm_vm_ioctl(s, KVM_SET_GSI_ROUTING, s->irq_routes);
     assert(ret == 0);
+    s->irq_routes_dirty = false;
 }
 
 static void kvm_add_routing_entry(KVMState *s,
@@ -976,6 +1245,7 @@ static void kvm_add_routing_entry(KVMState *s,
     new = &s->irq_routes->entries[n];
 
     *new = *entry;
+    s->irq_routes_dirty = true;
 
     set_gsi(s, entry->gsi);
 }
@@ -997,6 +1267,7 @@ static int kvm_update_routing_entry(KVMState *s,
         }
 
         *entry = *new_entry;
+        s->irq_routes_dirty = true;
 
         return 0;
     }
@@ -1032,6 +1303,7 @@ void kvm_irqchip_release_virq(KVMState *s, int virq)
         if (e->gsi == virq) {
             s->irq_routes->nr--;
             *e = s->irq_routes->entries[s->irq_routes->nr];
+            s->irq_routes_dirty = true;
         }
     }
     clear_gsi(s, virq);
@@ -1634,6 +1906,33 @@ static int kvm_init(MachineState *ms)
     kvm_ioeventfd_any_length_allowed =
         (kvm_check_extension(s, KVM_CAP_IOEVENTFD_ANY_LENGTH) > 0);
 
+    s->kvm_dirty_ring_size = machine_kvm_dirty_ring_size(ms);
+    if (s->kvm_dirty_ring_size) {
+        uint64_t ring_bytes = (uint64_t)s->kvm_dirty_ring_size *
+                              sizeof(struct kvm_dirty_gfn);
+        int max_bytes = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+
+        if (!KVM_DIRTY_LOG_PAGE_OFFSET || max_bytes <= 0) {
+            fprintf(stderr, "KVM does not support dirty rings\n");
+            ret = -EINVAL;
+            goto err;
+        }
+        if (ring_bytes > max_bytes) {
+            fprintf(stderr, "KVM dirty ring size %" PRIu32 " too big "
+                    "(maximum is %zu)\n", s->kvm_dirty_ring_size,
+                    max_bytes / sizeof(struct kvm_dirty_gfn));
+            ret = -EINVAL;
+            goto err;
+        }
+        ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+        if (ret) {
+            fprintf(stderr, "Enabling the KVM dirty ring failed: %s\n",
+                    strerror(-ret));
+            goto err;
+        }
+        s->kvm_dirty_ring_bytes = ring_bytes;
+    }
+
     kvm_state = s;
 
     ret = kvm_arch_init(ms, s);
@@ -1661,6 +1960,12 @@ static int kvm_init(MachineState *ms)
 
     s->sync_mmu = !!kvm_vm_check_extension(kvm_state, KVM_CAP_SYNC_MMU);
 
+    if (s->kvm_dirty_ring_size) {
+        qemu_thread_create(&s->kvm_dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+
     return 0;
 
 err:
@@ -1695,6 +2000,76 @@ static void kvm_handle_io(uint16_t port, MemTxAttrs attrs, void *data, int direc
     }
 }
 
+/* Exit reasons past the end of these arrays are not counted */
+#define KVM_EXIT_STATS_MAX 32
+
+static Stat64 kvm_exit_count[KVM_EXIT_STATS_MAX];
+static Stat64 kvm_exit_time_ns[KVM_EXIT_STATS_MAX];
+
+static const char *const kvm_exit_reason_names[KVM_EXIT_STATS_MAX] = {
+    [KVM_EXIT_UNKNOWN] = "unknown",
+    [KVM_EXIT_EXCEPTION] = "exception",
+    [KVM_EXIT_IO] = "io",
+    [KVM_EXIT_HYPERCALL] = "hypercall",
+    [KVM_EXIT_DEBUG] = "debug",
+    [KVM_EXIT_HLT] = "hlt",
+    [KVM_EXIT_MMIO] = "mmio",
+    [KVM_EXIT_IRQ_WINDOW_OPEN] = "irq-window-open",
+    [KVM_EXIT_SHUTDOWN] = "shutdown",
+    [KVM_EXIT_FAIL_ENTRY] = "fail-entry",
+    [KVM_EXIT_INTR] = "intr",
+    [KVM_EXIT_SET_TPR] = "set-tpr",
+    [KVM_EXIT_TPR_ACCESS] = "tpr-access",
+    [KVM_EXIT_S390_SIEIC] = "s390-sieic",
+    [KVM_EXIT_S390_RESET] = "s390-reset",
+    [KVM_EXIT_DCR] = "dcr",
+    [KVM_EXIT_NMI] = "nmi",
+    [KVM_EXIT_INTERNAL_ERROR] = "internal-error",
+    [KVM_EXIT_OSI] = "osi",
+    [KVM_EXIT_PAPR_HCALL] = "papr-hcall",
+    [KVM_EXIT_S390_UCONTROL] = "s390-ucontrol",
+    [KVM_EXIT_WATCHDOG] = "watchdog",
+    [KVM_EXIT_S390_TSCH] = "s390-tsch",
+    [KVM_EXIT_EPR] = "epr",
+    [KVM_EXIT_SYSTEM_EVENT] = "system-event",
+    [KVM_EXIT_S390_STSI] = "s390-stsi",
+    [KVM_EXIT_IOAPIC_EOI] = "ioapic-eoi",
+    [KVM_EXIT_HYPERV] = "hyperv",
+    [KVM_EXIT_DIRTY_RING_FULL] = "dirty-ring-full",
+};
+
+static void kvm_account_exit(uint32_t reason, int64_t start_ns)
+{
+    if (reason < KVM_EXIT_STATS_MAX) {
+        stat64_add(&kvm_exit_count[reason], 1);
+        stat64_add(&kvm_exit_time_ns[reason], get_clock() - start_ns);
+    }
+}
+
+ExitReasonStatsList *kvm_exit_stats(void)
+{
+    ExitReasonStatsList *head = NULL, *entry;
+    uint64_t count;
+    int i;
+
+    for (i = KVM_EXIT_STATS_MAX - 1; i >= 0; i--) {
+        count = stat64_get(&kvm_exit_count[i]);
+        if (!count) {
+            continue;
+        }
+        entry = g_new0(ExitReasonStatsList, 1);
+        entry->value = g_new0(ExitReasonStats, 1);
+        entry->value->reason = kvm_exit_reason_names[i] ?
+                               g_strdup(kvm_exit_reason_names[i]) :
+                               g_strdup_printf("exit-%d", i);
+        entry->value->count = count;
+        entry->value->time_ns = stat64_get(&kvm_exit_time_ns[i]);
+        entry->next = head;
+        head = entry;
+    }
+    return head;
+}
+
 static int kvm_handle_internal_error(CPUState *cpu, struct kvm_run *run)
 {
     fprintf(stderr, "KVM internal error. Suberror: %d\n",
@@ -1853,6 +2228,7 @@ int kvm_cpu_exec(CPUState *cpu)
 {
     struct kvm_run *run = cpu->kvm_run;
     int ret, run_ret;
+    int64_t exit_start_ns;
 
     DPRINTF("kvm_cpu_exec()\n");
 
@@ -1924,6 +2300,7 @@ int kvm_cpu_exec(CPUState *cpu)
         }
 
         trace_kvm_run_exit(cpu->cpu_index, run->exit_reason);
+        exit_start_ns = get_clock();
         switch (run->exit_reason) {
         case KVM_EXIT_IO:
             DPRINTF("handle_io\n");
@@ -1962,6 +2339,13 @@ int kvm_cpu_exec(CPUState *cpu)
         case KVM_EXIT_INTERNAL_ERROR:
             ret = kvm_handle_internal_error(cpu, run);
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            DPRINTF("dirty ring full\n");
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_reap(kvm_state);
+            qemu_mutex_unlock_iothread();
+            ret = 0;
+            break;
         case KVM_EXIT_SYSTEM_EVENT:
             switch (run->system_event.type) {
             case KVM_SYSTEM_EVENT_SHUTDOWN:
@@ -1990,6 +2374,7 @@ int kvm_cpu_exec(CPUState *cpu)
             ret = kvm_arch_handle_exit(cpu, run);
             break;
         }
+        kvm_account_exit(run->exit_reason, exit_start_ns);
     } while (ret == 0);
 
     cpu_exec_end(cpu);
@@ -151,6 +151,11 @@ bool kvm_has_free_slot(MachineState *ms)
     return false;
 }
 
+ExitReasonStatsList *kvm_exit_stats(void)
+{
+    return NULL;
+}
+
 void kvm_init_cpu_signals(CPUState *cpu)
 {
     abort();
@@ -32,6 +32,8 @@
 #include "exec/log.h"
 #include "exec/helper-proto.h"
 #include "qemu/atomic.h"
+#include "qemu/timer.h"
+#include "exec/tb-hash.h"
 
 /* DEBUG defines, enable DEBUG_TLB_LOG to log to the CPU_LOG_MMU target */
 /* #define DEBUG_TLB */
@@ -92,6 +94,191 @@ static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
     }
 }
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* Length of the window over which TLB use is measured before shrinking */
+#define TLB_WINDOW_NS (100 * SCALE_MS)
+
+static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
+                             size_t max_entries)
+{
+    desc->window_begin_ns = ns;
+    desc->window_max_entries = max_entries;
+}
+
+static void tlb_dyn_init(CPUArchState *env)
+{
+    int64_t now = get_clock_realtime();
+    int i;
+
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        size_t n_entries = 1 << CPU_TLB_DYN_DEFAULT_BITS;
+
+        tlb_window_reset(&env->tlb_desc[i], now, 0);
+        env->tlb_desc[i].n_used_entries = 0;
+        env->tlb_mask[i] = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
+        env->tlb_table[i] = g_new(CPUTLBEntry, n_entries);
+        env->iotlb[i] = g_new(CPUIOTLBEntry, n_entries);
+        memset(env->tlb_table[i], -1, n_entries * sizeof(CPUTLBEntry));
+    }
+}
+
+/**
+ * tlb_mmu_resize - resize a TLB on a flush, based on its recent use
+ * @env: CPU that owns the TLB
+ * @mmu_idx: MMU index of the TLB
+ *
+ * Called from the owning vCPU, before the TLB is flushed.
+ *
+ * The use rate is the maximum number of entries seen in use during the
+ * current window, divided by the size of the TLB.  If it goes above 70%
+ * the TLB doubles in size right away; if it stays under 30% for a whole
+ * window, it shrinks to the smallest power of two that would keep the rate
+ * under 70%.  Growing eagerly but shrinking lazily avoids resizing back and
+ * forth for guests that flush often, e.g. on every context switch.
+ *
+ * Since this can change both the size and the location of the table, code
+ * that can cause a flush (such as tlb_fill) must recompute any TLB index or
+ * entry pointer it holds.
+ */
+static void tlb_mmu_resize(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_desc[mmu_idx];
+    size_t old_size = tlb_n_entries(env, mmu_idx);
+    size_t rate;
+    size_t new_size = old_size;
+    int64_t now = get_clock_realtime();
+    bool window_expired = now > desc->window_begin_ns + TLB_WINDOW_NS;
+
+    if (desc->n_used_entries > desc->window_max_entries) {
+        desc->window_max_entries = desc->n_used_entries;
+    }
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > 70) {
+        new_size = MIN(old_size << 1, 1 << CPU_TLB_DYN_MAX_BITS);
+    } else if (rate < 30 && window_expired) {
+        size_t ceil = pow2ceil(desc->window_max_entries);
+        size_t expected_rate = desc->window_max_entries * 100 / ceil;
+
+        /*
+         * Avoid undersizing when the max number of entries seen is just
+         * below a power of two: 1023 entries in a 1024-entry TLB would
+         * double it again on the next flush.  So keep the expected rate
+         * below 70%; since we double the size, the lowest rate we can
+         * expect is 35%, still within the 30-70% range we are happy with.
+         */
+        if (expected_rate > 70) {
+            ceil *= 2;
+        }
+        new_size = MAX(ceil, 1 << CPU_TLB_DYN_MIN_BITS);
+    }
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            tlb_window_reset(desc, now, desc->n_used_entries);
+        }
+        return;
+    }
+
+    tlb_debug("mmu_idx %d: %zu -> %zu entries\n", mmu_idx, old_size, new_size);
+
+    qemu_spin_lock(&env->tlb_lock);
+    g_free(env->tlb_table[mmu_idx]);
+    g_free(env->iotlb[mmu_idx]);
+
+    tlb_window_reset(desc, now, 0);
+    /* desc->n_used_entries is cleared by the caller */
+    env->tlb_mask[mmu_idx] = (new_size - 1) << CPU_TLB_ENTRY_BITS;
+    env->tlb_table[mmu_idx] = g_try_new(CPUTLBEntry, new_size);
+    env->iotlb[mmu_idx] = g_try_new(CPUIOTLBEntry, new_size);
+    /*
+     * If the allocations fail, try smaller sizes.  We just freed some
+     * memory, so going back to half of new_size has a good chance of
+     * working.  Increased memory pressure elsewhere in the system might
+     * cause the allocations to fail though, so we progressively reduce
+     * the allocation size, aborting if we cannot even allocate the
+     * smallest TLB we support.
+     */
+    while (env->tlb_table[mmu_idx] == NULL || env->iotlb[mmu_idx] == NULL) {
+        if (new_size == (1 << CPU_TLB_DYN_MIN_BITS)) {
+            error_report("%s: %s", __func__, strerror(errno));
+            abort();
+        }
+        new_size = MAX(new_size >> 1, 1 << CPU_TLB_DYN_MIN_BITS);
+        env->tlb_mask[mmu_idx] = (new_size - 1) << CPU_TLB_ENTRY_BITS;
+
+        g_free(env->tlb_table[mmu_idx]);
+        g_free(env->iotlb[mmu_idx]);
+        env->tlb_table[mmu_idx] = g_try_new(CPUTLBEntry, new_size);
+        env->iotlb[mmu_idx] = g_try_new(CPUIOTLBEntry, new_size);
+    }
+    qemu_spin_unlock(&env->tlb_lock);
+}
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
+static inline void tlb_n_used_entries_inc(CPUArchState *env, int mmu_idx)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    env->tlb_desc[mmu_idx].n_used_entries++;
+#endif
+}
+
+static inline void tlb_n_used_entries_dec(CPUArchState *env, int mmu_idx)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    env->tlb_desc[mmu_idx].n_used_entries--;
+#endif
+}
+
+void tlb_init(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int i;
+
+    qemu_spin_init(&env->tlb_lock);
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        env->tlb_large_page_addr[i] = -1;
+        env->tlb_large_page_mask[i] = 0;
+    }
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    tlb_dyn_init(env);
+#endif
+}
+
+void tlb_destroy(CPUState *cpu)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    CPUArchState *env = cpu->env_ptr;
+    int i;
+
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        g_free(env->tlb_table[i]);
+        g_free(env->iotlb[i]);
+        env->tlb_table[i] = NULL;
+        env->iotlb[i] = NULL;
+    }
+#endif
+}
+
+static void tlb_flush_one_mmuidx(CPUArchState *env, int mmu_idx)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    tlb_mmu_resize(env, mmu_idx);
+    env->tlb_desc[mmu_idx].n_used_entries = 0;
+#endif
+    memset(env->tlb_table[mmu_idx], -1,
+           tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry));
+    memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+    env->tlb_large_page_addr[mmu_idx] = -1;
+    env->tlb_large_page_mask[mmu_idx] = 0;
+}
+
+static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
+{
+    return te->addr_read == -1 && te->addr_write == -1 &&
+           te->addr_code == -1;
+}
+
 size_t tlb_flush_count(void)
 {
     CPUState *cpu;
@@ -113,6 +300,7 @@ size_t tlb_flush_count(void)
 static void tlb_flush_nocheck(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
 
     /* The QOM tests will trigger tlb_flushes without setting up TCG
      * so we bug out here in that case.
@@ -125,17 +313,12 @@ static void tlb_flush_nocheck(CPUState *cpu)
     atomic_set(&env->tlb_flush_count, env->tlb_flush_count + 1);
     tlb_debug("(count: %zu)\n", tlb_flush_count());
 
-    tb_lock();
-
-    memset(env->tlb_table, -1, sizeof(env->tlb_table));
-    memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_flush_one_mmuidx(env, mmu_idx);
+    }
     cpu_tb_jmp_cache_clear(cpu);
 
     env->vtlb_index = 0;
-    env->tlb_flush_addr = -1;
-    env->tlb_flush_mask = 0;
-
-    tb_unlock();
 
     atomic_mb_set(&cpu->pending_tlb_flush, 0);
 }
@@ -180,8 +363,6 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 
     assert_cpu_is_self(cpu);
 
-    tb_lock();
-
     tlb_debug("start: mmu_idx:0x%04lx\n", mmu_idx_bitmask);
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
@@ -189,16 +370,13 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
         if (test_bit(mmu_idx, &mmu_idx_bitmask)) {
             tlb_debug("%d\n", mmu_idx);
 
-            memset(env->tlb_table[mmu_idx], -1, sizeof(env->tlb_table[0]));
-            memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+            tlb_flush_one_mmuidx(env, mmu_idx);
         }
     }
 
     cpu_tb_jmp_cache_clear(cpu);
 
     tlb_debug("done\n");
-
-    tb_unlock();
 }
 
 void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
@@ -245,7 +423,8 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
 
 
 
-static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
+/* Return true if the entry was flushed */
+static inline bool tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
     if (addr == (tlb_entry->addr_read &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
@@ -254,45 +433,136 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
         addr == (tlb_entry->addr_code &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
         memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
     }
+    return false;
 }
 
-static void tlb_flush_page_async_work(CPUState *cpu, run_on_cpu_data data)
+/* Flush @addr from the main TLB of @mmu_idx, keeping its use count */
+static inline void tlb_flush_main_entry(CPUArchState *env, int mmu_idx,
+                                        target_ulong addr)
 {
-    CPUArchState *env = cpu->env_ptr;
-    target_ulong addr = (target_ulong) data.target_ptr;
-    int i;
-    int mmu_idx;
+    if (tlb_flush_entry(tlb_entry(env, mmu_idx, addr), addr)) {
+        tlb_n_used_entries_dec(env, mmu_idx);
+    }
+}
 
-    assert_cpu_is_self(cpu);
+/* Flush @page from the victim TLB of @mmu_idx */
+static inline void tlb_flush_vtlb_page(CPUArchState *env, int mmu_idx,
+                                       target_ulong page)
+{
+    int k;
 
-    tlb_debug("page :" TARGET_FMT_lx "\n", addr);
+    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], page);
+    }
+}
 
-    /* Check if we need to flush due to large pages.  */
-    if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
-        tlb_debug("forcing full flush ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  env->tlb_flush_addr, env->tlb_flush_mask);
+/* Return true if [@addr, @last] intersects the large pages of @mmu_idx */
+static inline bool tlb_hits_large_page(CPUArchState *env, int mmu_idx,
+                                       target_ulong addr, target_ulong last)
+{
+    target_ulong lp_addr = env->tlb_large_page_addr[mmu_idx];
+    target_ulong lp_mask = env->tlb_large_page_mask[mmu_idx];
 
-        tlb_flush(cpu);
-        return;
+    if (lp_addr == (target_ulong)-1) {
+        return false;
     }
+    return addr <= (lp_addr | ~lp_mask) && last >= lp_addr;
+}
 
-    addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+/*
+ * Flush the pages in [@addr, @last] from the TLB of @mmu_idx; @addr must be
+ * page aligned.  If the range intersects the large pages of @mmu_idx, or
+ * has at least as many pages as the TLB has entries, flush the whole TLB
+ * of @mmu_idx instead and return true.
+ */
+static bool tlb_flush_range_mmuidx(CPUArchState *env, int mmu_idx,
+                                   target_ulong addr, target_ulong last)
+{
+    target_ulong n_pages = ((last - addr) >> TARGET_PAGE_BITS) + 1;
+    target_ulong i;
+
+    if (tlb_hits_large_page(env, mmu_idx, addr, last)) {
+        tlb_debug("forcing full flush of mmu_idx %d ("
+                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n", mmu_idx,
+                  env->tlb_large_page_addr[mmu_idx],
+                  env->tlb_large_page_mask[mmu_idx]);
+        tlb_flush_one_mmuidx(env, mmu_idx);
+        return true;
+    }
+    if (n_pages >= tlb_n_entries(env, mmu_idx)) {
+        tlb_flush_one_mmuidx(env, mmu_idx);
+        return true;
     }
+    for (i = 0; i < n_pages; i++) {
+        target_ulong page = addr + (i << TARGET_PAGE_BITS);
+
+        tlb_flush_main_entry(env, mmu_idx, page);
+        tlb_flush_vtlb_page(env, mmu_idx, page);
+    }
+    return false;
+}
+
+static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
+                                              target_ulong addr,
+                                              target_ulong last,
+                                              uint16_t idxmap)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong n_pages = ((last - addr) >> TARGET_PAGE_BITS) + 1;
+    bool full = false;
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("range:" TARGET_FMT_lx "-" TARGET_FMT_lx " mmu_idx:0x%" PRIx16
+              "\n", addr, last, idxmap);
 
-    /* check whether there are entries that need to be flushed in the vtlb */
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
+        if (idxmap & (1 << mmu_idx)) {
+            full |= tlb_flush_range_mmuidx(env, mmu_idx, addr, last);
         }
     }
 
-    tb_flush_jmp_cache(cpu, addr);
+    /*
+     * tb_flush_jmp_cache clears 2 * TB_JMP_PAGE_SIZE entries per page, so
+     * past a few pages clearing the whole jump cache is cheaper.  We also
+     * have to clear it all if a large page was flushed, since we do not
+     * know which pages it covered.
+     */
+    if (full || n_pages > TB_JMP_CACHE_SIZE / (2 * TB_JMP_PAGE_SIZE)) {
+        cpu_tb_jmp_cache_clear(cpu);
+    } else {
+        target_ulong i;
+
+        for (i = 0; i < n_pages; i++) {
+            tb_flush_jmp_cache(cpu, addr + (i << TARGET_PAGE_BITS));
+        }
+    }
+}
+
+typedef struct {
+    target_ulong addr;
+    target_ulong last;
+    uint16_t idxmap;
+} TLBFlushRangeData;
+
+static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
+                                              run_on_cpu_data data)
+{
+    TLBFlushRangeData *d = data.host_ptr;
+
+    tlb_flush_range_by_mmuidx_async_0(cpu, d->addr, d->last, d->idxmap);
+    g_free(d);
+}
+
+static void tlb_flush_page_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    target_ulong addr = (target_ulong) data.target_ptr & TARGET_PAGE_MASK;
+
+    tlb_flush_range_by_mmuidx_async_0(cpu, addr, addr + TARGET_PAGE_SIZE - 1,
+                                      ALL_MMUIDX_BITS);
 }
 
 void tlb_flush_page(CPUState *cpu, target_ulong addr)
@@ -315,54 +585,12 @@ QEMU_BUILD_BUG_ON(NB_MMU_MODES > TARGET_PAGE_BITS_MIN);
 static void tlb_flush_page_by_mmuidx_async_work(CPUState *cpu,
                                                 run_on_cpu_data data)
 {
-    CPUArchState *env = cpu->env_ptr;
     target_ulong addr_and_mmuidx = (target_ulong) data.target_ptr;
     target_ulong addr = addr_and_mmuidx & TARGET_PAGE_MASK;
-    unsigned long mmu_idx_bitmap = addr_and_mmuidx & ALL_MMUIDX_BITS;
-    int page = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    int mmu_idx;
-    int i;
-
-    assert_cpu_is_self(cpu);
-
-    tlb_debug("page:%d addr:"TARGET_FMT_lx" mmu_idx:0x%lx\n",
-              page, addr, mmu_idx_bitmap);
+    uint16_t idxmap = addr_and_mmuidx & ALL_MMUIDX_BITS;
 
-    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        if (test_bit(mmu_idx, &mmu_idx_bitmap)) {
-            tlb_flush_entry(&env->tlb_table[mmu_idx][page], addr);
-
-            /* check whether there are vltb entries that need to be flushed */
-            for (i = 0; i < CPU_VTLB_SIZE; i++) {
-                tlb_flush_entry(&env->tlb_v_table[mmu_idx][i], addr);
-            }
-        }
-    }
-
-    tb_flush_jmp_cache(cpu, addr);
-}
-
-static void tlb_check_page_and_flush_by_mmuidx_async_work(CPUState *cpu,
-                                                          run_on_cpu_data data)
-{
-    CPUArchState *env = cpu->env_ptr;
-    target_ulong addr_and_mmuidx = (target_ulong) data.target_ptr;
-    target_ulong addr = addr_and_mmuidx & TARGET_PAGE_MASK;
-    unsigned long mmu_idx_bitmap = addr_and_mmuidx & ALL_MMUIDX_BITS;
-
-    tlb_debug("addr:"TARGET_FMT_lx" mmu_idx: %04lx\n", addr, mmu_idx_bitmap);
-
-    /* Check if we need to flush due to large pages.  */
-    if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
-        tlb_debug("forced full flush ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  env->tlb_flush_addr, env->tlb_flush_mask);
-
-        tlb_flush_by_mmuidx_async_work(cpu,
-                                       RUN_ON_CPU_HOST_INT(mmu_idx_bitmap));
-    } else {
-        tlb_flush_page_by_mmuidx_async_work(cpu, data);
-    }
+    tlb_flush_range_by_mmuidx_async_0(cpu, addr, addr + TARGET_PAGE_SIZE - 1,
+                                      idxmap);
 }
 
 void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
@@ -376,10 +604,10 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
     addr_and_mmu_idx |= idxmap;
 
     if (!qemu_cpu_is_self(cpu)) {
-        async_run_on_cpu(cpu, tlb_check_page_and_flush_by_mmuidx_async_work,
+        async_run_on_cpu(cpu, tlb_flush_page_by_mmuidx_async_work,
                          RUN_ON_CPU_TARGET_PTR(addr_and_mmu_idx));
     } else {
-        tlb_check_page_and_flush_by_mmuidx_async_work(
+        tlb_flush_page_by_mmuidx_async_work(
             cpu, RUN_ON_CPU_TARGET_PTR(addr_and_mmu_idx));
     }
 }
@@ -387,7 +615,7 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, uint16_t idxmap)
 void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
                                        uint16_t idxmap)
 {
-    const run_on_cpu_func fn = tlb_check_page_and_flush_by_mmuidx_async_work;
+    const run_on_cpu_func fn = tlb_flush_page_by_mmuidx_async_work;
     target_ulong addr_and_mmu_idx;
 
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
@@ -404,7 +632,7 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                                             target_ulong addr,
                                                             uint16_t idxmap)
 {
-    const run_on_cpu_func fn = tlb_check_page_and_flush_by_mmuidx_async_work;
+    const run_on_cpu_func fn = tlb_flush_page_by_mmuidx_async_work;
     target_ulong addr_and_mmu_idx;
 
     tlb_debug("addr: "TARGET_FMT_lx" mmu_idx:%"PRIx16"\n", addr, idxmap);
@@ -417,6 +645,81 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_TARGET_PTR(addr_and_mmu_idx));
 }
 
+static bool tlb_flush_range_prepare(TLBFlushRangeData *d, target_ulong addr,
+                                    target_ulong len, uint16_t idxmap)
+{
+    if (len == 0) {
+        return false;
+    }
+    d->addr = addr & TARGET_PAGE_MASK;
+    d->last = addr + (len - 1);
+    d->idxmap = idxmap;
+    tlb_debug("addr: "TARGET_FMT_lx" len: "TARGET_FMT_lx" mmu_idx:%" PRIx16
+              "\n", addr, len, idxmap);
+    return true;
+}
+
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    if (!tlb_flush_range_prepare(&d, addr, len, idxmap)) {
+        return;
+    }
+    if (qemu_cpu_is_self(cpu)) {
+        tlb_flush_range_by_mmuidx_async_0(cpu, d.addr, d.last, d.idxmap);
+    } else {
+        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
+                         RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+    }
+}
+
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len)
+{
+    tlb_flush_range_by_mmuidx(cpu, addr, len, ALL_MMUIDX_BITS);
+}
+
+static void tlb_flush_range_others(CPUState *src_cpu,
+                                   const TLBFlushRangeData *d)
+{
+    CPUState *dst_cpu;
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
+                             RUN_ON_CPU_HOST_PTR(g_memdup(d, sizeof(*d))));
+        }
+    }
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                        target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    if (!tlb_flush_range_prepare(&d, addr, len, idxmap)) {
+        return;
+    }
+    tlb_flush_range_others(src_cpu, &d);
+    tlb_flush_range_by_mmuidx_async_0(src_cpu, d.addr, d.last, d.idxmap);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                               target_ulong addr,
+                                               target_ulong len,
+                                               uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    if (!tlb_flush_range_prepare(&d, addr, len, idxmap)) {
+        return;
+    }
+    tlb_flush_range_others(src_cpu, &d);
+    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
+                          RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+}
+
 void tlb_flush_page_all_cpus(CPUState *src, target_ulong addr)
 {
     const run_on_cpu_func fn = tlb_flush_page_async_work;
@@ -525,7 +828,8 @@ static inline void copy_tlb_helper(CPUTLBEntry *d, CPUTLBEntry *s,
 /* This is a cross vCPU call (i.e. another vCPU resetting the flags of
  * the target vCPU). As such care needs to be taken that we don't
  * dangerously race with another vCPU update. The only thing actually
- * updated is the target TLB entry ->addr_write flags.
+ * updated is the target TLB entry ->addr_write flags.  tlb_lock keeps
+ * the target vCPU from resizing its TLB under our feet.
  */
 void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
 {
@@ -534,10 +838,12 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
     int mmu_idx;
 
     env = cpu->env_ptr;
+    qemu_spin_lock(&env->tlb_lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         unsigned int i;
+        unsigned int n = tlb_n_entries(env, mmu_idx);
 
-        for (i = 0; i < CPU_TLB_SIZE; i++) {
+        for (i = 0; i < n; i++) {
             tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                   start1, length);
         }
@@ -547,6 +853,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                   start1, length);
         }
     }
+    qemu_spin_unlock(&env->tlb_lock);
 }
 
 static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
@@ -561,15 +868,13 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i;
     int mmu_idx;
 
     assert_cpu_is_self(cpu);
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        tlb_set_dirty1(tlb_entry(env, mmu_idx, vaddr), vaddr);
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
@@ -581,26 +886,28 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, target_ulong vaddr,
-                               target_ulong size)
+   large pages and trigger a flush of the MMU mode's TLB if these are
+   invalidated.  */
+static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
+                               target_ulong vaddr, target_ulong size)
 {
+    target_ulong lp_addr = env->tlb_large_page_addr[mmu_idx];
     target_ulong mask = ~(size - 1);
 
-    if (env->tlb_flush_addr == (target_ulong)-1) {
-        env->tlb_flush_addr = vaddr & mask;
-        env->tlb_flush_mask = mask;
+    if (lp_addr == (target_ulong)-1) {
+        env->tlb_large_page_addr[mmu_idx] = vaddr & mask;
+        env->tlb_large_page_mask[mmu_idx] = mask;
         return;
     }
     /* Extend the existing region to include the new page.
        This is a compromise between unnecessary flushes and the cost
        of maintaining a full variable size TLB.  */
-    mask &= env->tlb_flush_mask;
-    while (((env->tlb_flush_addr ^ vaddr) & mask) != 0) {
+    mask &= env->tlb_large_page_mask[mmu_idx];
+    while (((lp_addr ^ vaddr) & mask) != 0) {
         mask <<= 1;
     }
-    env->tlb_flush_addr &= mask;
-    env->tlb_flush_mask = mask;
+    env->tlb_large_page_addr[mmu_idx] = lp_addr & mask;
+    env->tlb_large_page_mask[mmu_idx] = mask;
 }
 
 /* Add a new TLB entry. At most one entry for a given virtual address
@@ -628,7 +935,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     assert_cpu_is_self(cpu);
     assert(size >= TARGET_PAGE_SIZE);
     if (size != TARGET_PAGE_SIZE) {
-        tlb_add_large_page(env, vaddr, size);
+        tlb_add_large_page(env, mmu_idx, vaddr, size);
     }
 
     sz = size;
@@ -653,8 +960,8 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr, paddr, xlat,
                                             prot, &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    te = &env->tlb_table[mmu_idx][index];
+    index = tlb_index(env, mmu_idx, vaddr);
+    te = tlb_entry(env, mmu_idx, vaddr);
     /* do not discard the translation in te, evict it into a victim tlb */
     tv = &env->tlb_v_table[mmu_idx][vidx];
 
@@ -699,6 +1006,11 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
         }
     }
 
+    /* te was copied to the victim TLB above, so test the victim copy */
+    if (tlb_entry_is_empty(tv)) {
+        tlb_n_used_entries_inc(env, mmu_idx);
+    }
+
     /* Pairs with flag setting in tlb_reset_dirty_range */
     copy_tlb_helper(te, &tn, true);
     /* atomic_mb_set(&te->addr_write, write_address); */
@@ -843,6 +1155,9 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             /* Found entry in victim tlb, swap tlb and iotlb.  */
             CPUTLBEntry tmptlb, *tlb = &env->tlb_table[mmu_idx][index];
 
+            if (tlb_entry_is_empty(tlb)) {
+                tlb_n_used_entries_inc(env, mmu_idx);
+            }
             copy_tlb_helper(&tmptlb, tlb, false);
             copy_tlb_helper(tlb, vtlb, true);
             copy_tlb_helper(vtlb, &tmptlb, true);
@@ -875,12 +1190,13 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr)
     CPUIOTLBEntry *iotlbentry;
     hwaddr physaddr;
 
-    index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env, true);
+    index = tlb_index(env, mmu_idx, addr);
     if (unlikely(env->tlb_table[mmu_idx][index].addr_code !=
                  (addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK)))) {
         if (!VICTIM_TLB_HIT(addr_read, addr)) {
             tlb_fill(ENV_GET_CPU(env), addr, MMU_INST_FETCH, mmu_idx, 0);
+            index = tlb_index(env, mmu_idx, addr);
         }
     }
     iotlbentry = &env->iotlb[mmu_idx][index];
@@ -931,7 +1247,7 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr)
 void probe_write(CPUArchState *env, target_ulong addr, int mmu_idx,
                  uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
 
     if ((addr & TARGET_PAGE_MASK)
@@ -950,8 +1266,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
                                NotDirtyInfo *ndi)
 {
     size_t mmu_idx = get_mmuidx(oi);
-    size_t index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    CPUTLBEntry *tlbe = &env->tlb_table[mmu_idx][index];
+    size_t index = tlb_index(env, mmu_idx, addr);
+    CPUTLBEntry *tlbe = tlb_entry(env, mmu_idx, addr);
     target_ulong tlb_addr = tlbe->addr_write;
     TCGMemOp mop = get_memop(oi);
     int a_bits = get_alignment_bits(mop);
@@ -982,6 +1298,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
         != (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
         if (!VICTIM_TLB_HIT(addr_write, addr)) {
             tlb_fill(ENV_GET_CPU(env), addr, MMU_DATA_STORE, mmu_idx, retaddr);
+            index = tlb_index(env, mmu_idx, addr);
+            tlbe = tlb_entry(env, mmu_idx, addr);
         }
         tlb_addr = tlbe->addr_write & ~TLB_INVALID_MASK;
     }
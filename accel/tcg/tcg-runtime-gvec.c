@@ -0,0 +1,142 @@
+/*
+ * Generic vectorized operation runtime
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "cpu.h"
+#include "exec/helper-proto.h"
+#include "tcg-gvec-desc.h"
+
+/*
+ * These helpers are called when an operation is too large to be expanded
+ * inline, or has no inline expansion for the element size.  They work on
+ * whole elements in host order, which is what the translators store in
+ * their register files, and then zero the bytes between the operation size
+ * and the maximum size.
+ */
+
+static inline void clear_high(void *d, intptr_t oprsz, uint32_t desc)
+{
+    intptr_t maxsz = simd_maxsz(desc);
+
+    if (unlikely(maxsz > oprsz)) {
+        memset(d + oprsz, 0, maxsz - oprsz);
+    }
+}
+
+#define DO_GVEC_3(NAME, TYPE, OP)                                       \
+void HELPER(NAME)(void *d, void *a, void *b, uint32_t desc)             \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i < oprsz; i += sizeof(TYPE)) {                         \
+        TYPE aa = *(TYPE *)(a + i);                                     \
+        TYPE bb = *(TYPE *)(b + i);                                     \
+        *(TYPE *)(d + i) = OP;                                          \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+#define DO_GVEC_2(NAME, TYPE, OP)                                       \
+void HELPER(NAME)(void *d, void *a, uint32_t desc)                      \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i < oprsz; i += sizeof(TYPE)) {                         \
+        TYPE aa = *(TYPE *)(a + i);                                     \
+        *(TYPE *)(d + i) = OP;                                          \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+/* The shift count is in the data field of the descriptor */
+#define DO_GVEC_2I(NAME, TYPE, OP)                                      \
+void HELPER(NAME)(void *d, void *a, uint32_t desc)                      \
+{                                                                       \
+    intptr_t oprsz = simd_oprsz(desc);                                  \
+    int shift = simd_data(desc);                                        \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i < oprsz; i += sizeof(TYPE)) {                         \
+        TYPE aa = *(TYPE *)(a + i);                                     \
+        *(TYPE *)(d + i) = OP;                                          \
+    }                                                                   \
+    clear_high(d, oprsz, desc);                                         \
+}
+
+DO_GVEC_3(gvec_add8, uint8_t, aa + bb)
+DO_GVEC_3(gvec_add16, uint16_t, aa + bb)
+DO_GVEC_3(gvec_add32, uint32_t, aa + bb)
+DO_GVEC_3(gvec_add64, uint64_t, aa + bb)
+
+DO_GVEC_3(gvec_sub8, uint8_t, aa - bb)
+DO_GVEC_3(gvec_sub16, uint16_t, aa - bb)
+DO_GVEC_3(gvec_sub32, uint32_t, aa - bb)
+DO_GVEC_3(gvec_sub64, uint64_t, aa - bb)
+
+DO_GVEC_2(gvec_neg8, uint8_t, -aa)
+DO_GVEC_2(gvec_neg16, uint16_t, -aa)
+DO_GVEC_2(gvec_neg32, uint32_t, -aa)
+DO_GVEC_2(gvec_neg64, uint64_t, -aa)
+
+DO_GVEC_2(gvec_mov, uint64_t, aa)
+DO_GVEC_2(gvec_not, uint64_t, ~aa)
+DO_GVEC_3(gvec_and, uint64_t, aa & bb)
+DO_GVEC_3(gvec_or, uint64_t, aa | bb)
+DO_GVEC_3(gvec_xor, uint64_t, aa ^ bb)
+DO_GVEC_3(gvec_andc, uint64_t, aa & ~bb)
+DO_GVEC_3(gvec_orc, uint64_t, aa | ~bb)
+
+DO_GVEC_2I(gvec_shl8i, uint8_t, aa << shift)
+DO_GVEC_2I(gvec_shl16i, uint16_t, aa << shift)
+DO_GVEC_2I(gvec_shl32i, uint32_t, aa << shift)
+DO_GVEC_2I(gvec_shl64i, uint64_t, aa << shift)
+
+DO_GVEC_2I(gvec_shr8i, uint8_t, aa >> shift)
+DO_GVEC_2I(gvec_shr16i, uint16_t, aa >> shift)
+DO_GVEC_2I(gvec_shr32i, uint32_t, aa >> shift)
+DO_GVEC_2I(gvec_shr64i, uint64_t, aa >> shift)
+
+DO_GVEC_2I(gvec_sar8i, int8_t, aa >> shift)
+DO_GVEC_2I(gvec_sar16i, int16_t, aa >> shift)
+DO_GVEC_2I(gvec_sar32i, int32_t, aa >> shift)
+DO_GVEC_2I(gvec_sar64i, int64_t, aa >> shift)
+
+/* Comparisons set all bits of an element if true and clear them if not */
+#define DO_GVEC_CMP(NAME, TYPE, OP)                                     \
+    DO_GVEC_3(NAME, TYPE, -(TYPE)(aa OP bb))
+
+#define DO_GVEC_CMP_ALL(NAME, OP)                                       \
+    DO_GVEC_CMP(glue(NAME, 8), uint8_t, OP)                             \
+    DO_GVEC_CMP(glue(NAME, 16), uint16_t, OP)                           \
+    DO_GVEC_CMP(glue(NAME, 32), uint32_t, OP)                           \
+    DO_GVEC_CMP(glue(NAME, 64), uint64_t, OP)
+
+#define DO_GVEC_SCMP_ALL(NAME, OP)                                      \
+    DO_GVEC_CMP(glue(NAME, 8), int8_t, OP)                              \
+    DO_GVEC_CMP(glue(NAME, 16), int16_t, OP)                            \
+    DO_GVEC_CMP(glue(NAME, 32), int32_t, OP)                            \
+    DO_GVEC_CMP(glue(NAME, 64), int64_t, OP)
+
+DO_GVEC_CMP_ALL(gvec_eq, ==)
+DO_GVEC_CMP_ALL(gvec_ne, !=)
+DO_GVEC_SCMP_ALL(gvec_lt, <)
+DO_GVEC_SCMP_ALL(gvec_le, <=)
+DO_GVEC_CMP_ALL(gvec_ltu, <)
+DO_GVEC_CMP_ALL(gvec_leu, <=)
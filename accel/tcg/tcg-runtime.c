@@ -28,6 +28,7 @@
 #include "exec/cpu_ldst.h"
 #include "exec/exec-all.h"
 #include "exec/tb-lookup.h"
+#include "exec/translator.h"
 #include "disas/disas.h"
 #include "exec/log.h"
 
@@ -167,3 +168,10 @@ void HELPER(exit_atomic)(CPUArchState *env)
 {
     cpu_loop_exit_atomic(ENV_GET_CPU(env), GETPC());
 }
+
+void HELPER(translator_call)(CPUArchState *env, void *fn, void *opaque)
+{
+    TranslatorInstrumentCB cb = fn;
+
+    cb(ENV_GET_CPU(env), opaque);
+}
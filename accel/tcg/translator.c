@@ -14,6 +14,7 @@
 #include "tcg/tcg.h"
 #include "tcg/tcg-op.h"
 #include "exec/exec-all.h"
+#include "exec/helper-gen.h"
 #include "exec/gen-icount.h"
 #include "exec/log.h"
 #include "exec/translator.h"
@@ -31,6 +32,73 @@ void translator_loop_temp_check(DisasContextBase *db)
     }
 }
 
+#define TRANSLATOR_MAX_INSTRUMENT 4
+
+typedef struct TranslatorInstrument {
+    const TranslatorInstrumentOps *ops;
+    void *opaque;
+} TranslatorInstrument;
+
+static TranslatorInstrument instrument[TRANSLATOR_MAX_INSTRUMENT];
+static int nb_instrument;
+
+void translator_instrument_register(const TranslatorInstrumentOps *ops,
+                                    void *opaque)
+{
+    assert(nb_instrument < TRANSLATOR_MAX_INSTRUMENT);
+    instrument[nb_instrument].ops = ops;
+    instrument[nb_instrument].opaque = opaque;
+    nb_instrument++;
+}
+
+void translator_gen_inline_add(uint64_t *counter, int64_t val)
+{
+    TCGv_ptr ptr = tcg_const_ptr(counter);
+    TCGv_i64 tmp = tcg_temp_new_i64();
+
+    tcg_gen_ld_i64(tmp, ptr, 0);
+    tcg_gen_addi_i64(tmp, tmp, val);
+    tcg_gen_st_i64(tmp, ptr, 0);
+
+    tcg_temp_free_i64(tmp);
+    tcg_temp_free_ptr(ptr);
+}
+
+void translator_gen_call(TranslatorInstrumentCB fn, void *opaque)
+{
+    TCGv_ptr f = tcg_const_ptr(fn);
+    TCGv_ptr o = tcg_const_ptr(opaque);
+
+    gen_helper_translator_call(cpu_env, f, o);
+
+    tcg_temp_free_ptr(o);
+    tcg_temp_free_ptr(f);
+}
+
+static void translator_instrument_tb_start(DisasContextBase *db,
+                                           CPUState *cpu)
+{
+    int i;
+
+    for (i = 0; i < nb_instrument; i++) {
+        if (instrument[i].ops->tb_start) {
+            instrument[i].ops->tb_start(db, cpu, instrument[i].opaque);
+        }
+    }
+}
+
+static void translator_instrument_insn_start(DisasContextBase *db,
+                                             CPUState *cpu)
+{
+    int i;
+
+    for (i = 0; i < nb_instrument; i++) {
+        if (instrument[i].ops->insn_start) {
+            instrument[i].ops->insn_start(db, cpu, instrument[i].opaque);
+        }
+    }
+}
+
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb)
 {
@@ -66,11 +134,17 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     gen_tb_start(db->tb);
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+    if (unlikely(nb_instrument)) {
+        translator_instrument_tb_start(db, cpu);
+    }
 
     while (true) {
         db->num_insns++;
         ops->insn_start(db, cpu);
         tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
+        if (unlikely(nb_instrument)) {
+            translator_instrument_insn_start(db, cpu);
+        }
 
         /* Pass breakpoint hits to target for further processing */
         if (unlikely(!QTAILQ_EMPTY(&cpu->breakpoints))) {
@@ -1006,6 +1006,7 @@ int audio_pcm_sw_write (SWVoiceOut *sw, void *buf, int size)
 {
     int hwsamples, samples, isamp, osamp, wpos, live, dead, left, swlim, blck;
     int ret = 0, pos = 0, total = 0;
+    bool silent = false;
 
     if (!sw) {
         return size;
@@ -1035,7 +1036,9 @@ int audio_pcm_sw_write (SWVoiceOut *sw, void *buf, int size)
     if (swlim) {
         sw->conv (sw->buf, buf, swlim);
 
-        if (!(sw->hw->ctl_caps & VOICE_VOLUME_CAP)) {
+        /* Idle guests keep streaming zeroes; don't mix them in */
+        silent = mixeng_is_silent (sw->buf, swlim);
+        if (!silent && !(sw->hw->ctl_caps & VOICE_VOLUME_CAP)) {
             mixeng_volume (sw->buf, swlim, &sw->vol);
         }
     }
@@ -1049,7 +1052,7 @@ int audio_pcm_sw_write (SWVoiceOut *sw, void *buf, int size)
         }
         isamp = swlim;
         osamp = blck;
-        st_rate_flow_mix (
+        (silent ? st_rate_flow_mix_silence : st_rate_flow_mix) (
             sw->rate,
             sw->buf + pos,
             sw->hw->mix_buf + wpos,
@@ -26,6 +26,7 @@
 #include "qemu-common.h"
 #include "qemu/bswap.h"
 #include "qemu/error-report.h"
+#include "qemu/cutils.h"
 #include "audio.h"
 
 #define AUDIO_CAP "mixeng"
@@ -370,6 +371,30 @@ void *st_rate_start (int inrate, int outrate)
 #define OP(a, b) a = b
 #include "rate_template.h"
 
+/* Only moves the resampler position; the interpolated output is unused */
+static void st_rate_advance (void *opaque, struct st_sample *ibuf,
+                             struct st_sample *obuf, int *isamp, int *osamp);
+#define NAME st_rate_advance
+#define OP(a, b) (void) (b)
+#include "rate_template.h"
+
+/*
+ * Same as st_rate_flow_mix for a silent ibuf (see mixeng_is_silent), but
+ * without touching obuf, since mixing in zeroes would not change it.
+ */
+void st_rate_flow_mix_silence (void *opaque, struct st_sample *ibuf,
+                               struct st_sample *obuf, int *isamp, int *osamp)
+{
+    struct rate *rate = opaque;
+
+    if (rate->ilast.l || rate->ilast.r) {
+        /* The first outputs still interpolate from the last real sample */
+        st_rate_flow_mix (opaque, ibuf, obuf, isamp, osamp);
+        return;
+    }
+    st_rate_advance (opaque, ibuf, obuf, isamp, osamp);
+}
+
 void st_rate_stop (void *opaque)
 {
     g_free (opaque);
@@ -380,6 +405,11 @@ void mixeng_clear (struct st_sample *buf, int len)
     memset (buf, 0, len * sizeof (struct st_sample));
 }
 
+bool mixeng_is_silent (const struct st_sample *buf, int len)
+{
+    return buffer_is_zero (buf, len * sizeof (struct st_sample));
+}
+
 void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
 {
     if (vol->mute) {
@@ -387,6 +417,10 @@ void mixeng_volume (struct st_sample *buf, int len, struct mixeng_volume *vol)
         return;
     }
 
+    if (vol->l == nominal_volume.l && vol->r == nominal_volume.r) {
+        return;
+    }
+
     while (len--) {
 #ifdef FLOAT_MIXENG
         buf->l = buf->l * vol->l;
@@ -27,6 +27,9 @@
 #include "qapi/error.h"
 #include "standard-headers/linux/virtio_crypto.h"
 #include "crypto/cipher.h"
+#include "block/thread-pool.h"
+#include "qemu/main-loop.h"
+#include "qemu/error-report.h"
 
 
 /**
@@ -46,9 +49,25 @@ typedef struct CryptoDevBackendBuiltinSession {
     QCryptoCipher *cipher;
     uint8_t direction; /* encryption or decryption */
     uint8_t type; /* cipher? hash? aead? */
+    /*
+     * Held by the session table and by each operation in flight, so
+     * that closing a session does not free the cipher under a worker.
+     * Only changed in the main loop.
+     */
+    unsigned int refcnt;
+    /* Serializes the operations on @cipher, which keeps the IV */
+    QemuMutex lock;
     QTAILQ_ENTRY(CryptoDevBackendBuiltinSession) next;
 } CryptoDevBackendBuiltinSession;
 
+typedef struct CryptoDevBackendBuiltinOp {
+    CryptoDevBackendBuiltinSession *sess;
+    CryptoDevBackendSymOpInfo *op_info;
+    CryptoDevCompletionFunc *cb;
+    void *opaque;
+    Error *err;
+} CryptoDevBackendBuiltinOp;
+
 /* Max number of symmetric sessions */
 #define MAX_NUM_SESSIONS 256
 
@@ -237,6 +256,8 @@ static int cryptodev_builtin_create_cipher_session(
     sess->cipher = cipher;
     sess->direction = sess_info->direction;
     sess->type = sess_info->op_type;
+    sess->refcnt = 1;
+    qemu_mutex_init(&sess->lock);
 
     builtin->sessions[index] = sess;
 
@@ -274,6 +295,18 @@ static int64_t cryptodev_builtin_sym_create_session(
     return session_id;
 }
 
+static void cryptodev_builtin_session_unref(
+           CryptoDevBackendBuiltinSession *sess)
+{
+    if (--sess->refcnt > 0) {
+        return;
+    }
+
+    qcrypto_cipher_free(sess->cipher);
+    qemu_mutex_destroy(&sess->lock);
+    g_free(sess);
+}
+
 static int cryptodev_builtin_sym_close_session(
            CryptoDevBackend *backend,
            uint64_t session_id,
@@ -289,21 +322,62 @@ static int cryptodev_builtin_sym_close_session(
         return -1;
     }
 
-    qcrypto_cipher_free(builtin->sessions[session_id]->cipher);
-    g_free(builtin->sessions[session_id]);
+    cryptodev_builtin_session_unref(builtin->sessions[session_id]);
     builtin->sessions[session_id] = NULL;
     return 0;
 }
 
+/* Runs in a worker thread of the main loop's thread pool */
+static int cryptodev_builtin_sym_op_func(void *opaque)
+{
+    CryptoDevBackendBuiltinOp *op = opaque;
+    CryptoDevBackendBuiltinSession *sess = op->sess;
+    CryptoDevBackendSymOpInfo *op_info = op->op_info;
+    int ret;
+
+    qemu_mutex_lock(&sess->lock);
+
+    if (op_info->iv_len > 0 &&
+        qcrypto_cipher_setiv(sess->cipher, op_info->iv,
+                             op_info->iv_len, &op->err) < 0) {
+        ret = -1;
+    } else if (sess->direction == VIRTIO_CRYPTO_OP_ENCRYPT) {
+        ret = qcrypto_cipher_encrypt(sess->cipher, op_info->src,
+                                     op_info->dst, op_info->src_len,
+                                     &op->err);
+    } else {
+        ret = qcrypto_cipher_decrypt(sess->cipher, op_info->src,
+                                     op_info->dst, op_info->src_len,
+                                     &op->err);
+    }
+
+    qemu_mutex_unlock(&sess->lock);
+
+    return ret < 0 ? -VIRTIO_CRYPTO_ERR : VIRTIO_CRYPTO_OK;
+}
+
+static void cryptodev_builtin_sym_op_done(void *opaque, int ret)
+{
+    CryptoDevBackendBuiltinOp *op = opaque;
+
+    if (op->err) {
+        error_report_err(op->err);
+    }
+    cryptodev_builtin_session_unref(op->sess);
+    op->cb(op->opaque, ret);
+    g_free(op);
+}
+
 static int cryptodev_builtin_sym_operation(
                  CryptoDevBackend *backend,
                  CryptoDevBackendSymOpInfo *op_info,
-                 uint32_t queue_index, Error **errp)
+                 uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb, void *opaque,
+                 Error **errp)
 {
     CryptoDevBackendBuiltin *builtin =
                       CRYPTODEV_BACKEND_BUILTIN(backend);
-    CryptoDevBackendBuiltinSession *sess;
-    int ret;
+    CryptoDevBackendBuiltinOp *op;
 
     if (op_info->session_id >= MAX_NUM_SESSIONS ||
               builtin->sessions[op_info->session_id] == NULL) {
@@ -318,30 +392,22 @@ static int cryptodev_builtin_sym_operation(
         return -VIRTIO_CRYPTO_NOTSUPP;
     }
 
-    sess = builtin->sessions[op_info->session_id];
-
-    if (op_info->iv_len > 0) {
-        ret = qcrypto_cipher_setiv(sess->cipher, op_info->iv,
-                                   op_info->iv_len, errp);
-        if (ret < 0) {
-            return -VIRTIO_CRYPTO_ERR;
-        }
-    }
-
-    if (sess->direction == VIRTIO_CRYPTO_OP_ENCRYPT) {
-        ret = qcrypto_cipher_encrypt(sess->cipher, op_info->src,
-                                     op_info->dst, op_info->src_len, errp);
-        if (ret < 0) {
-            return -VIRTIO_CRYPTO_ERR;
-        }
-    } else {
-        ret = qcrypto_cipher_decrypt(sess->cipher, op_info->src,
-                                     op_info->dst, op_info->src_len, errp);
-        if (ret < 0) {
-            return -VIRTIO_CRYPTO_ERR;
-        }
-    }
-    return VIRTIO_CRYPTO_OK;
+    /*
+     * Run the cipher in the thread pool, so that requests on different
+     * sessions are processed in parallel and the main loop is free to
+     * pop more requests meanwhile.
+     */
+    op = g_new0(CryptoDevBackendBuiltinOp, 1);
+    op->sess = builtin->sessions[op_info->session_id];
+    op->sess->refcnt++;
+    op->op_info = op_info;
+    op->cb = cb;
+    op->opaque = opaque;
+
+    thread_pool_submit_aio(aio_get_thread_pool(qemu_get_aio_context()),
+                           cryptodev_builtin_sym_op_func, op,
+                           cryptodev_builtin_sym_op_done, op);
+    return 0;
 }
 
 static void cryptodev_builtin_cleanup(
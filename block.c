@@ -76,6 +76,9 @@ static BlockDriverState *bdrv_open_inherit(const char *filename,
 /* If non-zero, use only whitelisted block drivers */
 static int use_bdrv_whitelist;
 
+/* Bumped whenever the graph or the data of a backing file changes */
+static unsigned backing_generation;
+
 #ifdef _WIN32
 static int is_windows_drive_prefix(const char *filename)
 {
@@ -322,11 +325,13 @@ BlockDriverState *bdrv_new(void)
     }
     notifier_with_return_list_init(&bs->before_write_notifiers);
     qemu_co_mutex_init(&bs->reqs_lock);
+    qemu_co_queue_init(&bs->untracked_queue);
     qemu_mutex_init(&bs->dirty_bitmap_mutex);
     bs->refcnt = 1;
     bs->aio_context = qemu_get_aio_context();
 
     qemu_co_queue_init(&bs->flush_queue);
+    qemu_co_queue_init(&bs->discard_queue);
 
     QTAILQ_INSERT_TAIL(&all_bdrv_states, bs, bs_list);
 
@@ -2013,6 +2018,7 @@ static void bdrv_replace_child_noperm(BdrvChild *child,
     }
 
     child->bs = new_bs;
+    bdrv_backing_generation_bump();
 
     if (new_bs) {
         QLIST_INSERT_HEAD(&new_bs->parents, child, next_parent);
@@ -3661,6 +3667,7 @@ int bdrv_truncate(BdrvChild *child, int64_t offset, PreallocMode prealloc,
     bdrv_dirty_bitmap_truncate(bs, offset);
     bdrv_parent_cb_resize(bs);
     atomic_inc(&bs->write_gen);
+    bdrv_backing_data_changed(bs);
     return ret;
 }
 
@@ -3943,6 +3950,37 @@ const char *bdrv_get_parent_name(const BlockDriverState *bs)
     return NULL;
 }
 
+/*
+ * Return the current backing generation.  Drivers that remember which node
+ * of their backing chain holds the data for some range (see qcow2) must
+ * forget everything they learnt under an older generation.
+ */
+unsigned bdrv_backing_generation(void)
+{
+    return atomic_read(&backing_generation);
+}
+
+void bdrv_backing_generation_bump(void)
+{
+    atomic_inc(&backing_generation);
+}
+
+/*
+ * Called after the data of @bs changed.  This only matters if @bs is the
+ * backing file of some other node.
+ */
+void bdrv_backing_data_changed(BlockDriverState *bs)
+{
+    BdrvChild *c;
+
+    QLIST_FOREACH(c, &bs->parents, next_parent) {
+        if (c->role == &child_backing) {
+            bdrv_backing_generation_bump();
+            return;
+        }
+    }
+}
+
 /* TODO check what callers really want: bs->node_name or blk_name() */
 const char *bdrv_get_device_name(const BlockDriverState *bs)
 {
@@ -4229,6 +4267,9 @@ void bdrv_invalidate_cache(BlockDriverState *bs, Error **errp)
         return;
     }
 
+    /* Another process may have modified the image while we were inactive */
+    bdrv_backing_generation_bump();
+
     QLIST_FOREACH(child, &bs->children, next) {
         bdrv_invalidate_cache(child->bs, &local_err);
         if (local_err) {
@@ -70,7 +70,10 @@ void block_acct_add_interval(BlockAcctStats *stats, unsigned interval_length)
     for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
         timed_average_init(&s->latency[i], clock_type,
                            (uint64_t) interval_length * NANOSECONDS_PER_SECOND);
+        log_histogram_reset(&s->latency_hist[i]);
     }
+    s->hist_expiration = qemu_clock_get_ns(clock_type) +
+                         (int64_t) interval_length * NANOSECONDS_PER_SECOND;
     qemu_mutex_unlock(&stats->lock);
 }
 
@@ -94,6 +97,26 @@ void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
     cookie->type = type;
 }
 
+/*
+ * Starts a new interval for the latency histograms of @s if the current one
+ * is over.  Must be called with the stats lock held.
+ */
+static void block_acct_hist_check_expiration(BlockAcctTimedStats *s,
+                                             int64_t now)
+{
+    int64_t length = (int64_t) s->interval_length * NANOSECONDS_PER_SECOND;
+    unsigned i;
+
+    if (now < s->hist_expiration) {
+        return;
+    }
+
+    for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
+        log_histogram_reset(&s->latency_hist[i]);
+    }
+    s->hist_expiration = now + length;
+}
+
 static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                  bool failed)
 {
@@ -107,25 +130,27 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
 
     assert(cookie->type < BLOCK_MAX_IOTYPE);
 
-    qemu_mutex_lock(&stats->lock);
-
     if (failed) {
-        stats->failed_ops[cookie->type]++;
+        stat64_add(&stats->failed_ops[cookie->type], 1);
     } else {
-        stats->nr_bytes[cookie->type] += cookie->bytes;
-        stats->nr_ops[cookie->type]++;
+        stat64_add(&stats->nr_bytes[cookie->type], cookie->bytes);
+        stat64_add(&stats->nr_ops[cookie->type], 1);
     }
 
     if (!failed || stats->account_failed) {
-        stats->total_time_ns[cookie->type] += latency_ns;
-        stats->last_access_time_ns = time_ns;
+        stat64_add(&stats->total_time_ns[cookie->type], latency_ns);
+        stat64_max(&stats->last_access_time_ns, time_ns);
+
+        qemu_mutex_lock(&stats->lock);
+        log_histogram_account(&stats->latency_hist[cookie->type], latency_ns);
 
         QSLIST_FOREACH(s, &stats->intervals, entries) {
             timed_average_account(&s->latency[cookie->type], latency_ns);
+            block_acct_hist_check_expiration(s, time_ns);
+            log_histogram_account(&s->latency_hist[cookie->type], latency_ns);
         }
+        qemu_mutex_unlock(&stats->lock);
     }
-
-    qemu_mutex_unlock(&stats->lock);
 }
 
 void block_acct_done(BlockAcctStats *stats, BlockAcctCookie *cookie)
@@ -146,13 +171,11 @@ void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type)
      * not.  The reason is that invalid requests are accounted during their
      * submission, therefore there's no actual I/O involved.
      */
-    qemu_mutex_lock(&stats->lock);
-    stats->invalid_ops[type]++;
+    stat64_add(&stats->invalid_ops[type], 1);
 
     if (stats->account_invalid) {
-        stats->last_access_time_ns = qemu_clock_get_ns(clock_type);
+        stat64_max(&stats->last_access_time_ns, qemu_clock_get_ns(clock_type));
     }
-    qemu_mutex_unlock(&stats->lock);
 }
 
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
@@ -160,14 +183,13 @@ void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
 {
     assert(type < BLOCK_MAX_IOTYPE);
 
-    qemu_mutex_lock(&stats->lock);
-    stats->merged[type] += num_requests;
-    qemu_mutex_unlock(&stats->lock);
+    stat64_add(&stats->merged[type], num_requests);
 }
 
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats)
 {
-    return qemu_clock_get_ns(clock_type) - stats->last_access_time_ns;
+    return qemu_clock_get_ns(clock_type) -
+           stat64_get(&stats->last_access_time_ns);
 }
 
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
@@ -183,3 +205,48 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 
     return (double) sum / elapsed;
 }
+
+/**
+ * block_acct_latency_percentiles:
+ * @stats: the accounting statistics of a device
+ * @timed_stats: the interval to use, or NULL for all requests since the
+ *               statistics were created
+ * @type: the type of requests
+ * @percentiles: array of @n percentiles to compute, from 0 to 100
+ * @values: array of @n latencies in nanoseconds, filled in on success
+ * @n: the number of percentiles
+ *
+ * Returns false if no request of @type has been accounted (in the current
+ * interval, if @timed_stats is given).
+ */
+bool block_acct_latency_percentiles(BlockAcctStats *stats,
+                                    BlockAcctTimedStats *timed_stats,
+                                    enum BlockAcctType type,
+                                    const double *percentiles,
+                                    uint64_t *values, int n)
+{
+    LogHistogram *hist;
+    bool ret = false;
+    int i;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    qemu_mutex_lock(&stats->lock);
+    if (timed_stats) {
+        block_acct_hist_check_expiration(timed_stats,
+                                         qemu_clock_get_ns(clock_type));
+        hist = &timed_stats->latency_hist[type];
+    } else {
+        hist = &stats->latency_hist[type];
+    }
+
+    if (log_histogram_count(hist)) {
+        for (i = 0; i < n; i++) {
+            values[i] = log_histogram_percentile(hist, percentiles[i]);
+        }
+        ret = true;
+    }
+    qemu_mutex_unlock(&stats->lock);
+
+    return ret;
+}
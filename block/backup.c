@@ -27,6 +27,8 @@
 #include "qemu/error-report.h"
 
 #define BACKUP_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BACKUP_MAX_COPY_BYTES (1 << 20)
+#define BACKUP_MAX_TASKS 8
 #define SLICE_TIME 100000000ULL /* ns */
 
 typedef struct BackupBlockJob {
@@ -41,13 +43,31 @@ typedef struct BackupBlockJob {
     CoRwlock flush_rwlock;
     uint64_t bytes_read;
     int64_t cluster_size;
+    /* Upper bound for a single read/write pair, a multiple of cluster_size */
+    int64_t max_copy_bytes;
     bool compress;
+    /* Cleared once offloading the copy has failed */
+    bool use_copy_range;
     NotifierWithReturn before_write;
     QLIST_HEAD(, CowRequest) inflight_reqs;
 
     HBitmap *copy_bitmap;
+
+    /* Copy tasks started by the job coroutine */
+    int nb_tasks;
+    bool waiting_for_task;
+    /* First error reported by a task, cleared when it has been handled */
+    int task_ret;
+    bool task_error_is_read;
+    int64_t task_error_offset;
 } BackupBlockJob;
 
+typedef struct BackupTask {
+    BackupBlockJob *job;
+    int64_t offset;
+    int64_t bytes;
+} BackupTask;
+
 /* See if in-flight requests overlap and wait for them to complete */
 static void coroutine_fn wait_for_overlapping_requests(BackupBlockJob *job,
                                                        int64_t start,
@@ -97,6 +117,7 @@ static int coroutine_fn backup_do_cow(BackupBlockJob *job,
     void *bounce_buffer = NULL;
     int ret = 0;
     int64_t start, end; /* bytes */
+    int64_t cluster, nb_clusters, next_zero;
     int n; /* bytes */
 
     qemu_co_rwlock_rdlock(&job->flush_rwlock);
@@ -109,19 +130,41 @@ static int coroutine_fn backup_do_cow(BackupBlockJob *job,
     wait_for_overlapping_requests(job, start, end);
     cow_request_begin(&cow_request, job, start, end);
 
-    for (; start < end; start += job->cluster_size) {
-        if (!hbitmap_get(job->copy_bitmap, start / job->cluster_size)) {
+    for (; start < end; start += nb_clusters * job->cluster_size) {
+        cluster = start / job->cluster_size;
+        if (!hbitmap_get(job->copy_bitmap, cluster)) {
             trace_backup_do_cow_skip(job, start);
+            nb_clusters = 1;
             continue; /* already copied */
         }
-        hbitmap_reset(job->copy_bitmap, start / job->cluster_size, 1);
 
-        trace_backup_do_cow_process(job, start);
+        /* Copy the whole run of clusters that still need it at once */
+        nb_clusters = MIN(end - start, job->max_copy_bytes) / job->cluster_size;
+        next_zero = hbitmap_next_zero(job->copy_bitmap, cluster);
+        if (next_zero >= 0) {
+            nb_clusters = MIN(nb_clusters, next_zero - cluster);
+        }
+        hbitmap_reset(job->copy_bitmap, cluster, nb_clusters);
+
+        n = MIN(nb_clusters * job->cluster_size, job->common.len - start);
+
+        trace_backup_do_cow_process(job, start, n);
 
-        n = MIN(job->cluster_size, job->common.len - start);
+        /* Copying from the write notifier must not wait for serialising
+         * requests, which bdrv_co_copy_range() would do */
+        if (job->use_copy_range && !is_write_notifier) {
+            ret = blk_co_copy_range(blk, start, job->target, start, n, 0);
+            if (ret >= 0) {
+                goto progress;
+            }
+            /* Copy through the bounce buffer from now on, which also reports
+             * whether errors happened during the read or the write */
+            job->use_copy_range = false;
+        }
 
         if (!bounce_buffer) {
-            bounce_buffer = blk_blockalign(blk, job->cluster_size);
+            bounce_buffer = blk_blockalign(blk, MIN(end - start,
+                                                    job->max_copy_bytes));
         }
         iov.iov_base = bounce_buffer;
         iov.iov_len = n;
@@ -134,7 +177,7 @@ static int coroutine_fn backup_do_cow(BackupBlockJob *job,
             if (error_is_read) {
                 *error_is_read = true;
             }
-            hbitmap_set(job->copy_bitmap, start / job->cluster_size, 1);
+            hbitmap_set(job->copy_bitmap, cluster, nb_clusters);
             goto out;
         }
 
@@ -151,10 +194,11 @@ static int coroutine_fn backup_do_cow(BackupBlockJob *job,
             if (error_is_read) {
                 *error_is_read = false;
             }
-            hbitmap_set(job->copy_bitmap, start / job->cluster_size, 1);
+            hbitmap_set(job->copy_bitmap, cluster, nb_clusters);
             goto out;
         }
 
+progress:
         /* Publish progress, guest I/O counts as progress too.  Note that the
          * offset field is an opaque progress value, it is not a disk offset.
          */
@@ -360,32 +404,212 @@ static bool coroutine_fn yield_and_check(BackupBlockJob *job)
     return false;
 }
 
-static int coroutine_fn backup_run_incremental(BackupBlockJob *job)
+static void coroutine_fn backup_task_entry(void *opaque)
 {
-    int ret;
+    BackupTask *task = opaque;
+    BackupBlockJob *job = task->job;
     bool error_is_read;
-    int64_t cluster;
+    int ret;
+
+    ret = backup_do_cow(job, task->offset, task->bytes, &error_is_read, false);
+    if (ret < 0) {
+        if (job->task_ret == 0 || task->offset < job->task_error_offset) {
+            job->task_ret = ret;
+            job->task_error_is_read = error_is_read;
+            job->task_error_offset = task->offset;
+        }
+    }
+
+    trace_backup_task_end(job, task->offset, task->bytes, ret);
+    g_free(task);
+
+    job->nb_tasks--;
+    if (job->waiting_for_task) {
+        job->waiting_for_task = false;
+        aio_co_wake(job->common.co);
+    }
+}
+
+/* Wait until one of the copy tasks has finished */
+static void coroutine_fn backup_wait_for_task(BackupBlockJob *job)
+{
+    assert(job->nb_tasks > 0);
+    job->waiting_for_task = true;
+    qemu_coroutine_yield();
+    assert(!job->waiting_for_task);
+}
+
+static void coroutine_fn backup_wait_for_all_tasks(BackupBlockJob *job)
+{
+    while (job->nb_tasks > 0) {
+        backup_wait_for_task(job);
+    }
+}
+
+/* Copy [offset, offset + bytes) in a new coroutine, waiting for a free slot
+ * first.  Errors are collected in job->task_ret. */
+static void coroutine_fn backup_start_task(BackupBlockJob *job,
+                                           int64_t offset, int64_t bytes)
+{
+    BackupTask *task;
+    Coroutine *co;
+
+    while (job->nb_tasks >= BACKUP_MAX_TASKS) {
+        backup_wait_for_task(job);
+    }
+
+    task = g_new(BackupTask, 1);
+    *task = (BackupTask) {
+        .job    = job,
+        .offset = offset,
+        .bytes  = bytes,
+    };
+
+    trace_backup_task_start(job, offset, bytes);
+
+    job->nb_tasks++;
+    co = qemu_coroutine_create(backup_task_entry, task);
+    qemu_coroutine_enter(co);
+}
+
+/* Returns 1 if any part of the cluster at @offset is allocated in the top
+ * image, 0 if it is not and a negative errno on failure */
+static int coroutine_fn backup_cluster_is_allocated(BackupBlockJob *job,
+                                                    int64_t offset)
+{
+    BlockDriverState *bs = blk_bs(job->common.blk);
+    int64_t i, n;
+    int ret = 0;
+
+    for (i = 0; i < job->cluster_size;) {
+        /* bdrv_is_allocated() only returns true/false based
+         * on the first set of sectors it comes across that
+         * are are all in the same state.
+         * For that reason we must verify each sector in the
+         * backup cluster length.  We end up copying more than
+         * needed but at some point that is always the case. */
+        ret = bdrv_is_allocated(bs, offset + i, job->cluster_size - i, &n);
+        i += n;
+
+        if (ret || n == 0) {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Find the next area starting at or after *offset that has to be copied
+ * and store it in *offset and *bytes.  *bytes may be set to 0 with *offset
+ * advanced past a skipped area, so that the caller gets a chance to yield.
+ */
+static int coroutine_fn backup_next_extent(BackupBlockJob *job,
+                                           int64_t *offset, int64_t *bytes)
+{
+    int64_t max_bytes = MIN(job->max_copy_bytes, job->common.len - *offset);
+    int64_t cluster, next_zero;
     HBitmapIter hbi;
+    int ret;
 
-    hbitmap_iter_init(&hbi, job->copy_bitmap, 0);
-    while ((cluster = hbitmap_iter_next(&hbi)) != -1) {
-        do {
-            if (yield_and_check(job)) {
-                return 0;
-            }
-            ret = backup_do_cow(job, cluster * job->cluster_size,
-                                job->cluster_size, &error_is_read, false);
-            if (ret < 0 && backup_error_action(job, error_is_read, -ret) ==
-                           BLOCK_ERROR_ACTION_REPORT)
-            {
+    switch (job->sync_mode) {
+    case MIRROR_SYNC_MODE_INCREMENTAL:
+        hbitmap_iter_init(&hbi, job->copy_bitmap,
+                          *offset / job->cluster_size);
+        cluster = hbitmap_iter_next(&hbi);
+        if (cluster == -1) {
+            *offset = job->common.len;
+            *bytes = 0;
+            break;
+        }
+        *offset = cluster * job->cluster_size;
+        *bytes = MIN(job->max_copy_bytes, job->common.len - *offset);
+        next_zero = hbitmap_next_zero(job->copy_bitmap, cluster);
+        if (next_zero >= 0) {
+            *bytes = MIN(*bytes, (next_zero - cluster) * job->cluster_size);
+        }
+        break;
+
+    case MIRROR_SYNC_MODE_TOP:
+        /* Skip clusters that are completely in the backing file and merge
+         * the allocated ones */
+        for (*bytes = 0; *bytes < max_bytes; *bytes += job->cluster_size) {
+            ret = backup_cluster_is_allocated(job, *offset + *bytes);
+            if (ret < 0 && *bytes == 0) {
                 return ret;
+            } else if (ret <= 0) {
+                break;
             }
-        } while (ret < 0);
+        }
+        if (*bytes == 0) {
+            *offset += job->cluster_size;
+        }
+        *bytes = MIN(*bytes, max_bytes);
+        break;
+
+    case MIRROR_SYNC_MODE_FULL:
+        *bytes = max_bytes;
+        break;
+
+    default:
+        abort();
     }
 
     return 0;
 }
 
+/* Copy everything that sync=full, sync=top or sync=incremental cover */
+static int coroutine_fn backup_loop(BackupBlockJob *job)
+{
+    int64_t offset = 0;
+    int64_t bytes;
+    bool error_is_read;
+    int ret;
+
+    for (;;) {
+        if (yield_and_check(job)) {
+            ret = 0;
+            break;
+        }
+
+        if (job->task_ret < 0) {
+            /* Let the other tasks settle and resume at the first failure */
+            backup_wait_for_all_tasks(job);
+            ret = job->task_ret;
+            error_is_read = job->task_error_is_read;
+            offset = job->task_error_offset;
+            job->task_ret = 0;
+        } else if (offset >= job->common.len) {
+            if (job->nb_tasks == 0) {
+                ret = 0;
+                break;
+            }
+            backup_wait_for_task(job);
+            continue;
+        } else {
+            ret = backup_next_extent(job, &offset, &bytes);
+            error_is_read = true;
+            if (ret == 0) {
+                if (bytes > 0) {
+                    backup_start_task(job, offset, bytes);
+                    offset += bytes;
+                }
+                continue;
+            }
+        }
+
+        /* Depending on error action, fail now or retry */
+        if (backup_error_action(job, error_is_read, -ret) ==
+            BLOCK_ERROR_ACTION_REPORT)
+        {
+            break;
+        }
+    }
+
+    backup_wait_for_all_tasks(job);
+    return ret;
+}
+
 /* init copy_bitmap from sync_bitmap */
 static void backup_incremental_init_copy_bitmap(BackupBlockJob *job)
 {
@@ -431,12 +655,20 @@ static void coroutine_fn backup_run(void *opaque)
     BackupBlockJob *job = opaque;
     BackupCompleteData *data;
     BlockDriverState *bs = blk_bs(job->common.blk);
-    int64_t offset, nb_clusters;
+    int64_t nb_clusters;
     int ret = 0;
 
     QLIST_INIT(&job->inflight_reqs);
     qemu_co_rwlock_init(&job->flush_rwlock);
 
+    /* Compressed writes must cover exactly one cluster */
+    if (job->compress) {
+        job->max_copy_bytes = job->cluster_size;
+    } else {
+        job->max_copy_bytes = QEMU_ALIGN_UP(BACKUP_MAX_COPY_BYTES,
+                                            job->cluster_size);
+    }
+
     nb_clusters = DIV_ROUND_UP(job->common.len, job->cluster_size);
     job->copy_bitmap = hbitmap_alloc(nb_clusters, 0);
     if (job->sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) {
@@ -457,68 +689,8 @@ static void coroutine_fn backup_run(void *opaque)
              * notify callback service CoW requests. */
             block_job_yield(&job->common);
         }
-    } else if (job->sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) {
-        ret = backup_run_incremental(job);
     } else {
-        /* Both FULL and TOP SYNC_MODE's require copying.. */
-        for (offset = 0; offset < job->common.len;
-             offset += job->cluster_size) {
-            bool error_is_read;
-            int alloced = 0;
-
-            if (yield_and_check(job)) {
-                break;
-            }
-
-            if (job->sync_mode == MIRROR_SYNC_MODE_TOP) {
-                int i;
-                int64_t n;
-
-                /* Check to see if these blocks are already in the
-                 * backing file. */
-
-                for (i = 0; i < job->cluster_size;) {
-                    /* bdrv_is_allocated() only returns true/false based
-                     * on the first set of sectors it comes across that
-                     * are are all in the same state.
-                     * For that reason we must verify each sector in the
-                     * backup cluster length.  We end up copying more than
-                     * needed but at some point that is always the case. */
-                    alloced =
-                        bdrv_is_allocated(bs, offset + i,
-                                          job->cluster_size - i, &n);
-                    i += n;
-
-                    if (alloced || n == 0) {
-                        break;
-                    }
-                }
-
-                /* If the above loop never found any sectors that are in
-                 * the topmost image, skip this backup. */
-                if (alloced == 0) {
-                    continue;
-                }
-            }
-            /* FULL sync mode we copy the whole drive. */
-            if (alloced < 0) {
-                ret = alloced;
-            } else {
-                ret = backup_do_cow(job, offset, job->cluster_size,
-                                    &error_is_read, false);
-            }
-            if (ret < 0) {
-                /* Depending on error action, fail now or retry cluster */
-                BlockErrorAction action =
-                    backup_error_action(job, error_is_read, -ret);
-                if (action == BLOCK_ERROR_ACTION_REPORT) {
-                    break;
-                } else {
-                    offset -= job->cluster_size;
-                    continue;
-                }
-            }
-        }
+        ret = backup_loop(job);
     }
 
     notifier_with_return_remove(&job->before_write);
@@ -645,6 +817,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     job->sync_bitmap = sync_mode == MIRROR_SYNC_MODE_INCREMENTAL ?
                        sync_bitmap : NULL;
     job->compress = compress;
+    job->use_copy_range = !compress;
 
     /* If there is no backing file on the target, we cannot rely on COW if our
      * backup cluster size is smaller than the target cluster size. Even for
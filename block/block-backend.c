@@ -1497,6 +1497,46 @@ int blk_co_pdiscard(BlockBackend *blk, int64_t offset, int bytes)
     return bdrv_co_pdiscard(blk_bs(blk), offset, bytes);
 }
 
+int coroutine_fn blk_co_sendfile(BlockBackend *blk, int64_t offset,
+                                 int bytes, int fd,
+                                 struct iovec *hdr_iov, unsigned int hdr_niov)
+{
+    int ret;
+
+    ret = blk_check_byte_request(blk, offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* The throttling would be accounted twice if the caller has to fall
+     * back to blk_co_preadv() */
+    if (blk->public.throttle_group_member.throttle_state) {
+        return -ENOTSUP;
+    }
+
+    return bdrv_co_sendfile(blk->root, offset, bytes, fd, hdr_iov, hdr_niov);
+}
+
+int coroutine_fn blk_co_copy_range(BlockBackend *blk_in, int64_t off_in,
+                                   BlockBackend *blk_out, int64_t off_out,
+                                   int bytes, BdrvRequestFlags flags)
+{
+    int ret;
+
+    ret = blk_check_byte_request(blk_in, off_in, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = blk_check_byte_request(blk_out, off_out, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return bdrv_co_copy_range(blk_in->root, off_in,
+                              blk_out->root, off_out,
+                              bytes, flags);
+}
+
 int blk_co_flush(BlockBackend *blk)
 {
     if (!blk_is_available(blk)) {
@@ -29,6 +29,9 @@ enum {
      * contiguous regions of the image is efficient.
      */
     COMMIT_BUFFER_SIZE = 512 * 1024, /* in bytes */
+
+    /* Number of copy requests that may be in flight at the same time */
+    COMMIT_MAX_TASKS = 8,
 };
 
 #define SLICE_TIME 100000000ULL /* ns */
@@ -42,33 +45,121 @@ typedef struct CommitBlockJob {
     BlockdevOnError on_error;
     int base_flags;
     char *backing_file_str;
+    /* Cleared once offloading the copy has failed */
+    bool use_copy_range;
+
+    int nb_tasks;
+    bool waiting_for_task;
+    /* First failed copy request, cleared when it has been handled */
+    int task_ret;
+    int64_t task_error_offset;
 } CommitBlockJob;
 
-static int coroutine_fn commit_populate(BlockBackend *bs, BlockBackend *base,
-                                        int64_t offset, uint64_t bytes,
-                                        void *buf)
+typedef struct CommitTask {
+    CommitBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} CommitTask;
+
+static int coroutine_fn commit_populate(CommitBlockJob *s,
+                                        int64_t offset, uint64_t bytes)
 {
     int ret = 0;
     QEMUIOVector qiov;
-    struct iovec iov = {
-        .iov_base = buf,
-        .iov_len = bytes,
-    };
+    struct iovec iov;
 
     assert(bytes < SIZE_MAX);
+
+    if (s->use_copy_range) {
+        ret = blk_co_copy_range(s->top, offset, s->base, offset, bytes, 0);
+        if (ret >= 0) {
+            return 0;
+        }
+        /* Copy through a bounce buffer from now on */
+        s->use_copy_range = false;
+    }
+
+    iov.iov_base = blk_blockalign(s->top, bytes);
+    iov.iov_len = bytes;
     qemu_iovec_init_external(&qiov, &iov, 1);
 
-    ret = blk_co_preadv(bs, offset, qiov.size, &qiov, 0);
+    ret = blk_co_preadv(s->top, offset, qiov.size, &qiov, 0);
     if (ret < 0) {
-        return ret;
+        goto out;
     }
 
-    ret = blk_co_pwritev(base, offset, qiov.size, &qiov, 0);
+    ret = blk_co_pwritev(s->base, offset, qiov.size, &qiov, 0);
     if (ret < 0) {
-        return ret;
+        goto out;
+    }
+
+    ret = 0;
+out:
+    qemu_vfree(iov.iov_base);
+    return ret;
+}
+
+static void coroutine_fn commit_task_entry(void *opaque)
+{
+    CommitTask *task = opaque;
+    CommitBlockJob *s = task->s;
+    int ret;
+
+    ret = commit_populate(s, task->offset, task->bytes);
+    if (ret < 0) {
+        if (s->task_ret == 0 || task->offset < s->task_error_offset) {
+            s->task_ret = ret;
+            s->task_error_offset = task->offset;
+        }
+    } else {
+        /* Publish progress */
+        s->common.offset += task->bytes;
     }
+    g_free(task);
 
-    return 0;
+    s->nb_tasks--;
+    if (s->waiting_for_task) {
+        s->waiting_for_task = false;
+        aio_co_wake(s->common.co);
+    }
+}
+
+/* Wait until one of the copy requests has finished */
+static void coroutine_fn commit_wait_for_task(CommitBlockJob *s)
+{
+    assert(s->nb_tasks > 0);
+    s->waiting_for_task = true;
+    qemu_coroutine_yield();
+    assert(!s->waiting_for_task);
+}
+
+static void coroutine_fn commit_wait_for_all_tasks(CommitBlockJob *s)
+{
+    while (s->nb_tasks > 0) {
+        commit_wait_for_task(s);
+    }
+}
+
+static void coroutine_fn commit_start_task(CommitBlockJob *s, int64_t offset,
+                                           int64_t bytes)
+{
+    CommitTask *task;
+    Coroutine *co;
+
+    while (s->nb_tasks >= COMMIT_MAX_TASKS) {
+        commit_wait_for_task(s);
+    }
+
+    task = g_new(CommitTask, 1);
+    *task = (CommitTask) {
+        .s      = s,
+        .offset = offset,
+        .bytes  = bytes,
+    };
+
+    s->nb_tasks++;
+    co = qemu_coroutine_create(commit_task_entry, task);
+    qemu_coroutine_enter(co);
 }
 
 typedef struct {
@@ -144,8 +235,6 @@ static void coroutine_fn commit_run(void *opaque)
     uint64_t delay_ns = 0;
     int ret = 0;
     int64_t n = 0; /* bytes */
-    void *buf = NULL;
-    int bytes_written = 0;
     int64_t base_len;
 
     ret = s->common.len = blk_getlength(s->top);
@@ -166,9 +255,7 @@ static void coroutine_fn commit_run(void *opaque)
         }
     }
 
-    buf = blk_blockalign(s->top, COMMIT_BUFFER_SIZE);
-
-    for (offset = 0; offset < s->common.len; offset += n) {
+    for (offset = 0; ; offset += n) {
         bool copy;
 
         /* Note that even when no rate limit is applied we need to yield
@@ -178,14 +265,38 @@ static void coroutine_fn commit_run(void *opaque)
         if (block_job_is_cancelled(&s->common)) {
             break;
         }
-        /* Copy if allocated above the base */
-        ret = bdrv_is_allocated_above(blk_bs(s->top), blk_bs(s->base),
-                                      offset, COMMIT_BUFFER_SIZE, &n);
-        copy = (ret == 1);
-        trace_commit_one_iteration(s, offset, n, ret);
-        if (copy) {
-            ret = commit_populate(s->top, s->base, offset, n, buf);
-            bytes_written += n;
+
+        n = 0;
+        if (s->task_ret < 0) {
+            /* Let the other requests settle and handle the first failure */
+            commit_wait_for_all_tasks(s);
+            ret = s->task_ret;
+            s->task_ret = 0;
+            offset = s->task_error_offset;
+        } else if (offset >= s->common.len) {
+            if (s->nb_tasks == 0) {
+                break;
+            }
+            commit_wait_for_task(s);
+            continue;
+        } else {
+            /* Copy if allocated above the base, skip unallocated areas at
+             * once */
+            ret = bdrv_is_allocated_above(blk_bs(s->top), blk_bs(s->base),
+                                          offset, s->common.len - offset, &n);
+            copy = (ret == 1);
+            if (copy) {
+                n = MIN(n, COMMIT_BUFFER_SIZE);
+            }
+            trace_commit_one_iteration(s, offset, n, ret);
+            if (copy) {
+                /* Progress is published when the request has completed */
+                commit_start_task(s, offset, n);
+                if (s->common.speed) {
+                    delay_ns = ratelimit_calculate_delay(&s->limit, n);
+                }
+                continue;
+            }
         }
         if (ret < 0) {
             BlockErrorAction action =
@@ -199,16 +310,12 @@ static void coroutine_fn commit_run(void *opaque)
         }
         /* Publish progress */
         s->common.offset += n;
-
-        if (copy && s->common.speed) {
-            delay_ns = ratelimit_calculate_delay(&s->limit, n);
-        }
     }
 
     ret = 0;
 
 out:
-    qemu_vfree(buf);
+    commit_wait_for_all_tasks(s);
 
     data = g_malloc(sizeof(*data));
     data->ret = ret;
@@ -378,6 +485,7 @@ void commit_start(const char *job_id, BlockDriverState *bs,
     s->base_flags = orig_base_flags;
     s->backing_file_str = g_strdup(backing_file_str);
     s->on_error = on_error;
+    s->use_copy_range = true;
 
     trace_commit_start(bs, base, top, s);
     block_job_start(&s->common);
@@ -21,6 +21,7 @@
 #include "qemu/osdep.h"
 
 #include "block/block_int.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -29,10 +30,19 @@
 #include "qapi/error.h"
 #include "block/crypto.h"
 
+/*
+ * Number of requests that can encrypt or decrypt their data in the
+ * thread pool at the same time; each of them needs its own cipher.
+ */
+#define BLOCK_CRYPTO_MAX_THREADS 4
+
 typedef struct BlockCrypto BlockCrypto;
 
 struct BlockCrypto {
     QCryptoBlock *block;
+
+    int nb_threads;
+    CoQueue thread_task_queue;
 };
 
 
@@ -303,6 +313,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
+                                       BLOCK_CRYPTO_MAX_THREADS,
                                        errp);
 
     if (!crypto->block) {
@@ -311,6 +322,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
     }
 
     bs->encrypted = true;
+    qemu_co_queue_init(&crypto->thread_task_queue);
 
     ret = 0;
  cleanup:
@@ -389,6 +401,63 @@ static void block_crypto_close(BlockDriverState *bs)
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+typedef struct BlockCryptoTask {
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    bool encrypt;
+} BlockCryptoTask;
+
+static int block_crypto_thread_func(void *opaque)
+{
+    BlockCryptoTask *task = opaque;
+    int ret;
+
+    if (task->encrypt) {
+        ret = qcrypto_block_encrypt(task->block, task->offset,
+                                    task->buf, task->len, NULL);
+    } else {
+        ret = qcrypto_block_decrypt(task->block, task->offset,
+                                    task->buf, task->len, NULL);
+    }
+
+    return ret < 0 ? -EIO : 0;
+}
+
+/*
+ * Encrypt or decrypt @buf in a worker thread, so that the AioContext
+ * can keep submitting and completing other requests meanwhile.
+ */
+static int coroutine_fn block_crypto_co_crypt(BlockDriverState *bs,
+                                              uint64_t offset,
+                                              uint8_t *buf, size_t len,
+                                              bool encrypt)
+{
+    BlockCrypto *crypto = bs->opaque;
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    BlockCryptoTask task = {
+        .block = crypto->block,
+        .offset = offset,
+        .buf = buf,
+        .len = len,
+        .encrypt = encrypt,
+    };
+    int ret;
+
+    while (crypto->nb_threads >= BLOCK_CRYPTO_MAX_THREADS) {
+        qemu_co_queue_wait(&crypto->thread_task_queue, NULL);
+    }
+
+    crypto->nb_threads++;
+    ret = thread_pool_submit_co(pool, block_crypto_thread_func, &task);
+    crypto->nb_threads--;
+
+    qemu_co_queue_next(&crypto->thread_task_queue);
+
+    return ret;
+}
+
 static coroutine_fn int
 block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                        QEMUIOVector *qiov, int flags)
@@ -432,9 +501,9 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_crypt(bs, offset + bytes_done,
+                                    cipher_data, cur_bytes, false);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -488,9 +557,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_crypt(bs, offset + bytes_done,
+                                    cipher_data, cur_bytes, true);
+        if (ret < 0) {
             goto cleanup;
         }
 
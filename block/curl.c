@@ -117,6 +117,7 @@ typedef struct CURLState
     CURL *curl;
     QLIST_HEAD(, CURLSocket) sockets;
     char *orig_buf;
+    size_t buf_alloc;
     uint64_t buf_start;
     size_t buf_off;
     size_t buf_len;
@@ -524,6 +525,18 @@ static int curl_init_state(BDRVCURLState *s, CURLState *state)
         curl_easy_setopt(state->curl, CURLOPT_REDIR_PROTOCOLS, PROTOCOLS);
 #endif
 
+        /* Ask for HTTP/2 over TLS, and have new transfers wait for an
+         * existing connection to be usable for multiplexing rather than
+         * opening one connection per state.
+         */
+#if LIBCURL_VERSION_NUM >= 0x072f00
+        curl_easy_setopt(state->curl, CURLOPT_HTTP_VERSION,
+                         (long)CURL_HTTP_VERSION_2TLS);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+        curl_easy_setopt(state->curl, CURLOPT_PIPEWAIT, 1L);
+#endif
+
 #ifdef DEBUG_VERBOSE
         curl_easy_setopt(state->curl, CURLOPT_VERBOSE, 1);
 #endif
@@ -587,6 +600,7 @@ static void curl_detach_aio_context(BlockDriverState *bs)
         }
         g_free(s->states[i].orig_buf);
         s->states[i].orig_buf = NULL;
+        s->states[i].buf_alloc = 0;
     }
     if (s->multi) {
         curl_multi_cleanup(s->multi);
@@ -610,6 +624,10 @@ static void curl_attach_aio_context(BlockDriverState *bs,
     s->multi = curl_multi_init();
     s->aio_context = new_context;
     curl_multi_setopt(s->multi, CURLMOPT_SOCKETFUNCTION, curl_sock_cb);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    /* All states share the connection cache of the multi handle */
+    curl_multi_setopt(s->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 #ifdef NEED_CURL_TIMER_CALLBACK
     curl_multi_setopt(s->multi, CURLMOPT_TIMERDATA, s);
     curl_multi_setopt(s->multi, CURLMOPT_TIMERFUNCTION, curl_timer_cb);
@@ -904,11 +922,15 @@ static void curl_setup_preadv(BlockDriverState *bs, CURLAIOCB *acb)
     acb->end = MIN(acb->bytes, s->len - start);
 
     state->buf_off = 0;
-    g_free(state->orig_buf);
     state->buf_start = start;
     state->buf_len = MIN(acb->end + s->readahead_size, s->len - start);
     end = start + state->buf_len - 1;
-    state->orig_buf = g_try_malloc(state->buf_len);
+    /* Most requests fit in the previous readahead buffer, so keep it */
+    if (state->buf_len > state->buf_alloc) {
+        g_free(state->orig_buf);
+        state->orig_buf = g_try_malloc(state->buf_len);
+        state->buf_alloc = state->orig_buf ? state->buf_len : 0;
+    }
     if (state->buf_len && state->orig_buf == NULL) {
         curl_clean_state(state);
         acb->ret = -ENOMEM;
@@ -55,6 +55,9 @@ struct BdrvDirtyBitmap {
     bool autoload;              /* For persistent bitmaps: bitmap must be
                                    autoloaded on image opening */
     bool persistent;            /* bitmap must be saved to owner disk image */
+    bool qmp_locked;            /* Bitmap is in use by an internal user, such
+                                   as an NBD export, and may not be modified
+                                   or removed through QMP */
     QLIST_ENTRY(BdrvDirtyBitmap) list;
 };
 
@@ -170,6 +173,20 @@ void bdrv_release_meta_dirty_bitmap(BdrvDirtyBitmap *bitmap)
     qemu_mutex_unlock(bitmap->mutex);
 }
 
+bool bdrv_dirty_bitmap_has_meta(const BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->meta != NULL;
+}
+
+void bdrv_dirty_bitmap_reset_meta(BdrvDirtyBitmap *bitmap,
+                                  int64_t offset, int64_t bytes)
+{
+    assert(bitmap->meta);
+    qemu_mutex_lock(bitmap->mutex);
+    hbitmap_reset(bitmap->meta, offset, bytes);
+    qemu_mutex_unlock(bitmap->mutex);
+}
+
 int64_t bdrv_dirty_bitmap_size(const BdrvDirtyBitmap *bitmap)
 {
     return bitmap->size;
@@ -186,6 +203,20 @@ bool bdrv_dirty_bitmap_frozen(BdrvDirtyBitmap *bitmap)
     return bitmap->successor;
 }
 
+/* Called with BQL taken.  */
+void bdrv_dirty_bitmap_set_qmp_locked(BdrvDirtyBitmap *bitmap, bool qmp_locked)
+{
+    qemu_mutex_lock(bitmap->mutex);
+    bitmap->qmp_locked = qmp_locked;
+    qemu_mutex_unlock(bitmap->mutex);
+}
+
+/* Called with BQL taken.  */
+bool bdrv_dirty_bitmap_qmp_locked(BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->qmp_locked;
+}
+
 /* Called with BQL taken.  */
 bool bdrv_dirty_bitmap_enabled(BdrvDirtyBitmap *bitmap)
 {
@@ -197,6 +228,8 @@ DirtyBitmapStatus bdrv_dirty_bitmap_status(BdrvDirtyBitmap *bitmap)
 {
     if (bdrv_dirty_bitmap_frozen(bitmap)) {
         return DIRTY_BITMAP_STATUS_FROZEN;
+    } else if (bdrv_dirty_bitmap_qmp_locked(bitmap)) {
+        return DIRTY_BITMAP_STATUS_LOCKED;
     } else if (!bdrv_dirty_bitmap_enabled(bitmap)) {
         return DIRTY_BITMAP_STATUS_DISABLED;
     } else {
@@ -220,6 +253,11 @@ int bdrv_dirty_bitmap_create_successor(BlockDriverState *bs,
                    "currently frozen");
         return -1;
     }
+    if (bdrv_dirty_bitmap_qmp_locked(bitmap)) {
+        error_setg(errp, "Cannot create a successor for a bitmap that is "
+                   "currently locked");
+        return -1;
+    }
     assert(!bitmap->successor);
 
     /* Create an anonymous successor */
@@ -329,8 +367,10 @@ static void bdrv_do_release_matching_dirty_bitmap(
         if ((!bitmap || bm == bitmap) && (!cond || cond(bm))) {
             assert(!bm->active_iterators);
             assert(!bdrv_dirty_bitmap_frozen(bm));
-            assert(!bm->meta);
             QLIST_REMOVE(bm, list);
+            if (bm->meta) {
+                hbitmap_free_meta(bm->bitmap);
+            }
             hbitmap_free(bm->bitmap);
             g_free(bm->name);
             g_free(bm);
@@ -542,6 +582,14 @@ void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap **out)
     bdrv_dirty_bitmap_lock(bitmap);
     if (!out) {
         hbitmap_reset_all(bitmap->bitmap);
+    } else if (bitmap->meta) {
+        /* The meta bitmap is attached to the HBitmap, so keep that one and
+         * make the backup a copy */
+        HBitmap *backup = hbitmap_alloc(bitmap->size,
+                                        hbitmap_granularity(bitmap->bitmap));
+        hbitmap_merge(backup, bitmap->bitmap);
+        hbitmap_reset_all(bitmap->bitmap);
+        *out = backup;
     } else {
         HBitmap *backup = bitmap->bitmap;
         bitmap->bitmap = hbitmap_alloc(bitmap->size,
@@ -556,6 +604,12 @@ void bdrv_undo_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap *in)
     HBitmap *tmp = bitmap->bitmap;
     assert(bdrv_dirty_bitmap_enabled(bitmap));
     assert(!bdrv_dirty_bitmap_readonly(bitmap));
+    if (bitmap->meta) {
+        hbitmap_reset_all(tmp);
+        hbitmap_merge(tmp, in);
+        hbitmap_free(in);
+        return;
+    }
     bitmap->bitmap = in;
     hbitmap_free(tmp);
 }
@@ -56,6 +56,11 @@
 #ifdef __linux__
 #include <sys/ioctl.h>
 #include <sys/param.h>
+#include <sys/syscall.h>
+#ifdef CONFIG_SENDFILE
+#include <poll.h>
+#include <sys/sendfile.h>
+#endif
 #include <linux/cdrom.h>
 #include <linux/fd.h>
 #include <linux/fs.h>
@@ -155,11 +160,15 @@ typedef struct BDRVRawState {
     bool has_write_zeroes:1;
     bool discard_zeroes:1;
     bool use_linux_aio:1;
+    bool use_linux_io_uring:1;
     bool page_cache_inconsistent:1;
     bool has_fallocate;
     bool needs_alignment;
 
     PRManager *pr_mgr;
+
+    /* SG_IO requests submitted with write() and not read back yet */
+    int sg_inflight;
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -182,6 +191,9 @@ typedef struct RawPosixAIOData {
 #define aio_ioctl_cmd   aio_nbytes /* for QEMU_AIO_IOCTL */
     off_t aio_offset;
     int aio_type;
+    /* Destination for QEMU_AIO_COPY_RANGE, socket for QEMU_AIO_SENDFILE */
+    int aio_fd2;
+    off_t aio_offset2;
 } RawPosixAIOData;
 
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
@@ -400,7 +412,7 @@ static QemuOptsList raw_runtime_opts = {
         {
             .name = "aio",
             .type = QEMU_OPT_STRING,
-            .help = "host AIO implementation (threads, native)",
+            .help = "host AIO implementation (threads, native, io_uring)",
         },
         {
             .name = "locking",
@@ -445,9 +457,13 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         goto fail;
     }
 
-    aio_default = (bdrv_flags & BDRV_O_NATIVE_AIO)
-                  ? BLOCKDEV_AIO_OPTIONS_NATIVE
-                  : BLOCKDEV_AIO_OPTIONS_THREADS;
+    if (bdrv_flags & BDRV_O_NATIVE_AIO) {
+        aio_default = BLOCKDEV_AIO_OPTIONS_NATIVE;
+    } else if (bdrv_flags & BDRV_O_IO_URING) {
+        aio_default = BLOCKDEV_AIO_OPTIONS_IO_URING;
+    } else {
+        aio_default = BLOCKDEV_AIO_OPTIONS_THREADS;
+    }
     aio = qapi_enum_parse(&BlockdevAioOptions_lookup,
                           qemu_opt_get(opts, "aio"),
                           aio_default, &local_err);
@@ -457,6 +473,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         goto fail;
     }
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
+    s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
 
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
@@ -544,6 +561,23 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
+#ifdef CONFIG_LINUX_IO_URING
+    /* Unlike Linux AIO, io_uring works for buffered I/O too */
+    if (s->use_linux_io_uring &&
+        !aio_setup_linux_io_uring(bdrv_get_aio_context(bs), errp)) {
+        error_prepend(errp, "Unable to use io_uring: ");
+        ret = -EINVAL;
+        goto fail;
+    }
+#else
+    if (s->use_linux_io_uring) {
+        error_setg(errp, "aio=io_uring was specified, but is not supported "
+                         "in this build.");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif /* !defined(CONFIG_LINUX_IO_URING) */
+
     s->has_discard = true;
     s->has_write_zeroes = true;
     bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP;
@@ -1188,6 +1222,132 @@ static ssize_t handle_aiocb_rw_linear(RawPosixAIOData *aiocb, char *buf)
     return offset;
 }
 
+typedef struct RawBounceSegment {
+    size_t offset;      /* position in the request */
+    size_t len;
+} RawBounceSegment;
+
+/*
+ * Performs a misaligned request with preadv/pwritev, bouncing only the parts
+ * of the request that are not aligned in memory.  Each guest buffer is used
+ * directly from the first aligned address in it for as many whole alignment
+ * units as it covers; the bytes in between go through an aligned bounce
+ * buffer in whole alignment units.
+ *
+ * Returns -ENOTSUP if this is not possible or would not save anything, in
+ * which case the caller bounces the whole request.
+ */
+static ssize_t handle_aiocb_rw_partial_bounce(RawPosixAIOData *aiocb)
+{
+    size_t align = bdrv_min_mem_align(aiocb->bs);
+    int max_iov = MIN(2 * aiocb->aio_niov + 1, IOV_MAX);
+    struct iovec *iov = g_new(struct iovec, max_iov);
+    RawBounceSegment *seg = g_new(RawBounceSegment, max_iov);
+    struct iovec *orig_iov = aiocb->aio_iov;
+    int orig_niov = aiocb->aio_niov;
+    size_t pos = 0, iov_offset = 0, bounce_bytes = 0;
+    int niov = 0, nseg = 0, i = 0, j;
+    bool last_bounced = false;
+    char *buf = NULL, *p;
+    ssize_t ret = -ENOTSUP;
+
+    if (!preadv_present || aiocb->aio_nbytes % align) {
+        goto out;
+    }
+
+    /* Split the request into directly used and bounced segments */
+    while (pos < aiocb->aio_nbytes) {
+        char *base = (char *)orig_iov[i].iov_base + iov_offset;
+        size_t avail = orig_iov[i].iov_len - iov_offset;
+        size_t take;
+
+        if (avail == 0) {
+            i++;
+            iov_offset = 0;
+            continue;
+        }
+
+        if (((uintptr_t)base & (align - 1)) == 0 && avail >= align) {
+            take = QEMU_ALIGN_DOWN(avail, align);
+            if (niov == max_iov) {
+                goto out;
+            }
+            iov[niov++] = (struct iovec) { .iov_base = base, .iov_len = take };
+            last_bounced = false;
+        } else {
+            take = align;
+            if (last_bounced) {
+                iov[niov - 1].iov_len += take;
+                seg[nseg - 1].len += take;
+            } else {
+                if (niov == max_iov) {
+                    goto out;
+                }
+                iov[niov++] = (struct iovec) { .iov_base = NULL,
+                                               .iov_len = take };
+                seg[nseg++] = (RawBounceSegment) { .offset = pos,
+                                                   .len = take };
+                last_bounced = true;
+            }
+            bounce_bytes += take;
+        }
+
+        /* Advance by take bytes, possibly over several guest buffers */
+        pos += take;
+        iov_offset += take;
+        while (i < orig_niov && iov_offset >= orig_iov[i].iov_len) {
+            iov_offset -= orig_iov[i].iov_len;
+            i++;
+        }
+    }
+
+    if (bounce_bytes == aiocb->aio_nbytes) {
+        goto out;
+    }
+
+    buf = qemu_try_blockalign(aiocb->bs, bounce_bytes);
+    if (buf == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    p = buf;
+    for (j = 0, i = 0; i < niov; i++) {
+        if (iov[i].iov_base == NULL) {
+            iov[i].iov_base = p;
+            if (aiocb->aio_type & QEMU_AIO_WRITE) {
+                iov_to_buf(orig_iov, orig_niov, seg[j].offset, p, seg[j].len);
+            }
+            p += seg[j++].len;
+        }
+    }
+
+    aiocb->aio_iov = iov;
+    aiocb->aio_niov = niov;
+    ret = handle_aiocb_rw_vector(aiocb);
+    aiocb->aio_iov = orig_iov;
+    aiocb->aio_niov = orig_niov;
+
+    if (ret != aiocb->aio_nbytes) {
+        /* Let the caller retry with the fully bounced path */
+        ret = ret < 0 && ret != -ENOSYS ? ret : -ENOTSUP;
+        goto out;
+    }
+
+    if (!(aiocb->aio_type & QEMU_AIO_WRITE)) {
+        for (p = buf, j = 0; j < nseg; j++) {
+            iov_from_buf(orig_iov, orig_niov, seg[j].offset, p, seg[j].len);
+            p += seg[j].len;
+        }
+    }
+
+out:
+    qemu_vfree(buf);
+    g_free(seg);
+    g_free(iov);
+    return ret;
+}
+
 static ssize_t handle_aiocb_rw(RawPosixAIOData *aiocb)
 {
     ssize_t nbytes;
@@ -1223,6 +1383,13 @@ static ssize_t handle_aiocb_rw(RawPosixAIOData *aiocb)
          */
     }
 
+    if (aiocb->aio_type & QEMU_AIO_MISALIGNED) {
+        nbytes = handle_aiocb_rw_partial_bounce(aiocb);
+        if (nbytes != -ENOTSUP) {
+            return nbytes;
+        }
+    }
+
     /*
      * Ok, we have to do it the hard way, copy all segments into
      * a single aligned buffer.
@@ -1458,6 +1625,136 @@ static ssize_t handle_aiocb_discard(RawPosixAIOData *aiocb)
     return ret;
 }
 
+#ifndef CONFIG_COPY_FILE_RANGE
+static off_t copy_file_range(int in_fd, off_t *in_off, int out_fd,
+                             off_t *out_off, size_t len, unsigned int flags)
+{
+#ifdef __NR_copy_file_range
+    return syscall(__NR_copy_file_range, in_fd, in_off, out_fd,
+                   out_off, len, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+#endif
+
+static ssize_t handle_aiocb_copy_range(RawPosixAIOData *aiocb)
+{
+    uint64_t bytes = aiocb->aio_nbytes;
+    off_t in_off = aiocb->aio_offset;
+    off_t out_off = aiocb->aio_offset2;
+
+#ifdef FICLONERANGE
+    /* Share the extents if the filesystem supports it */
+    struct file_clone_range range = {
+        .src_fd         = aiocb->aio_fildes,
+        .src_offset     = in_off,
+        .src_length     = bytes,
+        .dest_offset    = out_off,
+    };
+
+    if (ioctl(aiocb->aio_fd2, FICLONERANGE, &range) == 0) {
+        return 0;
+    }
+#endif
+
+    while (bytes) {
+        ssize_t ret = copy_file_range(aiocb->aio_fildes, &in_off,
+                                      aiocb->aio_fd2, &out_off,
+                                      bytes, 0);
+        if (ret == 0) {
+            /* No progress (e.g. beyond EOF), let the caller fall back */
+            return -ENOTSUP;
+        } else if (ret < 0) {
+            switch (errno) {
+            case EINTR:
+                continue;
+            case ENOSYS:
+            case EXDEV:     /* different filesystems on older kernels */
+            case EINVAL:    /* e.g. not a regular file */
+            case EBADF:     /* e.g. O_APPEND */
+                return -ENOTSUP;
+            default:
+                return translate_err(-errno);
+            }
+        }
+        bytes -= ret;
+    }
+    return 0;
+}
+
+#ifdef CONFIG_SENDFILE
+/* The socket is non-blocking because the main loop also uses it, but the
+ * worker thread may as well sleep until there is room in the send buffer */
+static int sendfile_wait_writable(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    int ret;
+
+    do {
+        ret = poll(&pfd, 1, -1);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -errno : 0;
+}
+
+static ssize_t handle_aiocb_sendfile(RawPosixAIOData *aiocb)
+{
+    struct iovec *iov = aiocb->aio_iov;
+    unsigned int niov = aiocb->aio_niov;
+    off_t offset = aiocb->aio_offset;
+    size_t bytes = aiocb->aio_nbytes;
+    int sock = aiocb->aio_fd2;
+    ssize_t ret;
+
+    /* MSG_MORE lets the kernel put the header and the data in the same
+     * segments */
+    while (niov) {
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = niov };
+
+        ret = sendmsg(sock, &msg, MSG_MORE);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN) {
+                ret = sendfile_wait_writable(sock);
+                if (ret < 0) {
+                    return ret;
+                }
+                continue;
+            }
+            return -errno;
+        }
+        iov_discard_front(&iov, &niov, ret);
+    }
+
+    while (bytes) {
+        ret = sendfile(sock, aiocb->aio_fildes, &offset, bytes);
+        if (ret == 0) {
+            /* Past the end of the file: send zeroes, as aio_worker() does
+             * for short reads */
+            static const uint8_t zeroes[4096];
+            ret = send(sock, zeroes, MIN(bytes, sizeof(zeroes)), MSG_MORE);
+        }
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN) {
+                ret = sendfile_wait_writable(sock);
+                if (ret < 0) {
+                    return ret;
+                }
+                continue;
+            }
+            return -errno;
+        }
+        bytes -= ret;
+    }
+    return 0;
+}
+#endif
+
 static int aio_worker(void *arg)
 {
     RawPosixAIOData *aiocb = arg;
@@ -1498,6 +1795,14 @@ static int aio_worker(void *arg)
     case QEMU_AIO_WRITE_ZEROES:
         ret = handle_aiocb_write_zeroes(aiocb);
         break;
+    case QEMU_AIO_COPY_RANGE:
+        ret = handle_aiocb_copy_range(aiocb);
+        break;
+#ifdef CONFIG_SENDFILE
+    case QEMU_AIO_SENDFILE:
+        ret = handle_aiocb_sendfile(aiocb);
+        break;
+#endif
     default:
         fprintf(stderr, "invalid aio request (0x%x)\n", aiocb->aio_type);
         ret = -EINVAL;
@@ -1508,9 +1813,10 @@ static int aio_worker(void *arg)
     return ret;
 }
 
-static int paio_submit_co(BlockDriverState *bs, int fd,
-                          int64_t offset, QEMUIOVector *qiov,
-                          int bytes, int type)
+static int paio_submit_co_full(BlockDriverState *bs, int fd,
+                               int64_t offset, int fd2, int64_t offset2,
+                               QEMUIOVector *qiov,
+                               int bytes, int type)
 {
     RawPosixAIOData *acb = g_new(RawPosixAIOData, 1);
     ThreadPool *pool;
@@ -1522,17 +1828,28 @@ static int paio_submit_co(BlockDriverState *bs, int fd,
     acb->aio_nbytes = bytes;
     acb->aio_offset = offset;
 
+    acb->aio_fd2 = fd2;
+    acb->aio_offset2 = offset2;
+
     if (qiov) {
         acb->aio_iov = qiov->iov;
         acb->aio_niov = qiov->niov;
-        assert(qiov->size == bytes);
+        /* For QEMU_AIO_SENDFILE, qiov is the header sent before the data */
+        assert(qiov->size == bytes || type == QEMU_AIO_SENDFILE);
     }
 
     trace_paio_submit_co(offset, bytes, type);
-    pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    pool = aio_get_thread_pool(qemu_get_current_aio_context());
     return thread_pool_submit_co(pool, aio_worker, acb);
 }
 
+static inline int paio_submit_co(BlockDriverState *bs, int fd,
+                                 int64_t offset, QEMUIOVector *qiov,
+                                 int bytes, int type)
+{
+    return paio_submit_co_full(bs, fd, offset, -1, 0, qiov, bytes, type);
+}
+
 static BlockAIOCB *paio_submit(BlockDriverState *bs, int fd,
         int64_t offset, QEMUIOVector *qiov, int bytes,
         BlockCompletionFunc *cb, void *opaque, int type)
@@ -1558,10 +1875,28 @@ static BlockAIOCB *paio_submit(BlockDriverState *bs, int fd,
     return thread_pool_submit_aio(pool, aio_worker, acb, cb, opaque);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Requests go to the ring of the AioContext they are issued from.  Returns
+ * NULL if io_uring is not used or that AioContext has no ring, in which case
+ * the thread pool handles the request.
+ */
+static LuringState *raw_get_io_uring(BDRVRawState *s)
+{
+    if (!s->use_linux_io_uring) {
+        return NULL;
+    }
+    return aio_get_linux_io_uring(qemu_get_current_aio_context());
+}
+#endif
+
 static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
                                    uint64_t bytes, QEMUIOVector *qiov, int type)
 {
     BDRVRawState *s = bs->opaque;
+#ifdef CONFIG_LINUX_IO_URING
+    LuringState *luring = raw_get_io_uring(s);
+#endif
 
     if (fd_open(bs) < 0)
         return -EIO;
@@ -1572,16 +1907,20 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, uint64_t offset,
      * If this is the case tell the low-level driver that it needs
      * to copy the buffer.
      */
-    if (s->needs_alignment) {
-        if (!bdrv_qiov_is_aligned(bs, qiov)) {
-            type |= QEMU_AIO_MISALIGNED;
+    if (s->needs_alignment && !bdrv_qiov_is_aligned(bs, qiov)) {
+        type |= QEMU_AIO_MISALIGNED;
+#ifdef CONFIG_LINUX_IO_URING
+    } else if (luring) {
+        assert(qiov->size == bytes);
+        return luring_co_submit(bs, luring, s->fd, offset, qiov, type);
+#endif
 #ifdef CONFIG_LINUX_AIO
-        } else if (s->use_linux_aio) {
-            LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
-            assert(qiov->size == bytes);
-            return laio_co_submit(bs, aio, s->fd, offset, qiov, type);
+    } else if (s->use_linux_aio) {
+        /* Only opened with O_DIRECT, so s->needs_alignment is set */
+        LinuxAioState *aio = aio_get_linux_aio(qemu_get_current_aio_context());
+        assert(qiov->size == bytes);
+        return laio_co_submit(bs, aio, s->fd, offset, qiov, type);
 #endif
-        }
     }
 
     return paio_submit_co(bs, s->fd, offset, qiov, bytes, type);
@@ -1604,35 +1943,90 @@ static int coroutine_fn raw_co_pwritev(BlockDriverState *bs, uint64_t offset,
 
 static void raw_aio_plug(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_linux_aio) {
-        LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
+        LinuxAioState *aio = aio_get_linux_aio(qemu_get_current_aio_context());
         laio_io_plug(bs, aio);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        LuringState *luring = raw_get_io_uring(s);
+        if (luring) {
+            luring_io_plug(bs, luring);
+        }
+    }
+#endif
 }
 
 static void raw_aio_unplug(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_linux_aio) {
-        LinuxAioState *aio = aio_get_linux_aio(bdrv_get_aio_context(bs));
+        LinuxAioState *aio = aio_get_linux_aio(qemu_get_current_aio_context());
         laio_io_unplug(bs, aio);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        LuringState *luring = raw_get_io_uring(s);
+        if (luring) {
+            luring_io_unplug(bs, luring);
+        }
+    }
+#endif
 }
 
-static BlockAIOCB *raw_aio_flush(BlockDriverState *bs,
-        BlockCompletionFunc *cb, void *opaque)
+static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
+#ifdef CONFIG_LINUX_IO_URING
+    LuringState *luring = raw_get_io_uring(s);
+#endif
+    int ret;
 
-    if (fd_open(bs) < 0)
-        return NULL;
+    ret = fd_open(bs);
+    if (ret < 0) {
+        return ret;
+    }
 
-    return paio_submit(bs, s->fd, 0, NULL, 0, cb, opaque, QEMU_AIO_FLUSH);
+#ifdef CONFIG_LINUX_IO_URING
+    if (luring) {
+        /* Same rules as in handle_aiocb_flush() */
+        if (s->page_cache_inconsistent) {
+            return -EIO;
+        }
+        ret = luring_co_submit(bs, luring, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        if (ret < 0 && (s->open_flags & O_DIRECT) == 0) {
+            s->page_cache_inconsistent = true;
+        }
+        return ret;
+    }
+#endif
+
+    return paio_submit_co(bs, s->fd, 0, NULL, 0, QEMU_AIO_FLUSH);
+}
+
+static void raw_aio_attach_aio_context(BlockDriverState *bs,
+                                       AioContext *new_context)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    BDRVRawState *s = bs->opaque;
+    if (s->use_linux_io_uring) {
+        Error *local_err = NULL;
+        if (!aio_setup_linux_io_uring(new_context, &local_err)) {
+            error_reportf_err(local_err, "Unable to use linux io_uring, "
+                                         "falling back to thread pool: ");
+            s->use_linux_io_uring = false;
+        }
+    }
+#endif
 }
 
 static void raw_close(BlockDriverState *bs)
@@ -1649,6 +2043,101 @@ static void raw_close(BlockDriverState *bs)
     }
 }
 
+/* Zeroes are written by up to this many threads, each getting at least one
+ * chunk of the file */
+#define RAW_PREALLOC_MAX_THREADS    4
+#define RAW_PREALLOC_CHUNK_SIZE     (1 << 30)
+#define RAW_PREALLOC_BUF_SIZE       (1 << 20)
+
+typedef struct RawPreallocWorker {
+    QemuThread thread;
+    int fd;
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+} RawPreallocWorker;
+
+static void *raw_prealloc_worker(void *opaque)
+{
+    RawPreallocWorker *w = opaque;
+    size_t buf_size = ROUND_UP(MIN(w->bytes, RAW_PREALLOC_BUF_SIZE),
+                               qemu_real_host_page_size);
+    /* Aligned in case the file is opened with O_DIRECT */
+    void *buf = qemu_memalign(qemu_real_host_page_size, buf_size);
+    ssize_t n;
+
+    memset(buf, 0, buf_size);
+
+    while (w->bytes > 0) {
+        n = pwrite(w->fd, buf, MIN(w->bytes, RAW_PREALLOC_BUF_SIZE),
+                   w->offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            w->ret = -errno;
+            break;
+        }
+        w->offset += n;
+        w->bytes -= n;
+    }
+
+    qemu_vfree(buf);
+    return NULL;
+}
+
+/*
+ * Writes zeroes to [@offset, @offset + @bytes) of @fd.  Large ranges are split
+ * between several threads because a single synchronous writer rarely keeps
+ * the storage busy.
+ *
+ * Returns: 0 on success, -errno on failure.
+ */
+static int raw_prealloc_write_zeroes(int fd, int64_t offset, int64_t bytes)
+{
+    RawPreallocWorker workers[RAW_PREALLOC_MAX_THREADS];
+    int64_t chunk;
+    int i, n;
+    int ret = 0;
+
+    if (bytes <= 0) {
+        return 0;
+    }
+
+    n = MIN(RAW_PREALLOC_MAX_THREADS,
+            DIV_ROUND_UP(bytes, RAW_PREALLOC_CHUNK_SIZE));
+    if (n <= 1) {
+        workers[0] = (RawPreallocWorker) {
+            .fd     = fd,
+            .offset = offset,
+            .bytes  = bytes,
+        };
+        raw_prealloc_worker(&workers[0]);
+        return workers[0].ret;
+    }
+
+    chunk = ROUND_UP(DIV_ROUND_UP(bytes, n), RAW_PREALLOC_BUF_SIZE);
+    for (i = 0; i < n; i++) {
+        workers[i] = (RawPreallocWorker) {
+            .fd     = fd,
+            .offset = offset + i * chunk,
+            .bytes  = MIN(chunk, bytes - i * chunk),
+        };
+        qemu_thread_create(&workers[i].thread, "raw-prealloc",
+                           raw_prealloc_worker, &workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    for (i = 0; i < n; i++) {
+        qemu_thread_join(&workers[i].thread);
+        if (workers[i].ret < 0 && ret == 0) {
+            ret = workers[i].ret;
+        }
+    }
+
+    return ret;
+}
+
 /**
  * Truncates the given regular file @fd to @offset and, when growing, fills the
  * new space according to @prealloc.
@@ -1660,7 +2149,6 @@ static int raw_regular_truncate(int fd, int64_t offset, PreallocMode prealloc,
 {
     int result = 0;
     int64_t current_length = 0;
-    char *buf = NULL;
     struct stat st;
 
     if (fstat(fd, &st) < 0) {
@@ -1693,8 +2181,6 @@ static int raw_regular_truncate(int fd, int64_t offset, PreallocMode prealloc,
 #endif
     case PREALLOC_MODE_FULL:
     {
-        int64_t num = 0, left = offset - current_length;
-
         /*
          * Knowing the final size from the beginning could allow the file
          * system driver to do less allocations and possibly avoid
@@ -1706,35 +2192,18 @@ static int raw_regular_truncate(int fd, int64_t offset, PreallocMode prealloc,
             goto out;
         }
 
-        buf = g_malloc0(65536);
-
-        result = lseek(fd, current_length, SEEK_SET);
+        result = raw_prealloc_write_zeroes(fd, current_length,
+                                           offset - current_length);
         if (result < 0) {
-            result = -errno;
             error_setg_errno(errp, -result,
-                             "Failed to seek to the old end of file");
+                             "Could not write zeros for preallocation");
             goto out;
         }
 
-        while (left > 0) {
-            num = MIN(left, 65536);
-            result = write(fd, buf, num);
-            if (result < 0) {
-                result = -errno;
-                error_setg_errno(errp, -result,
-                                 "Could not write zeros for preallocation");
-                goto out;
-            }
-            left -= result;
-        }
-        if (result >= 0) {
-            result = fsync(fd);
-            if (result < 0) {
-                result = -errno;
-                error_setg_errno(errp, -result,
-                                 "Could not flush file to disk");
-                goto out;
-            }
+        result = fsync(fd);
+        if (result < 0) {
+            result = -errno;
+            error_setg_errno(errp, -result, "Could not flush file to disk");
         }
         goto out;
     }
@@ -1759,7 +2228,6 @@ out:
         }
     }
 
-    g_free(buf);
     return result;
 }
 
@@ -2215,6 +2683,66 @@ static int coroutine_fn raw_co_pwrite_zeroes(
     return -ENOTSUP;
 }
 
+static int coroutine_fn raw_co_copy_range_from(BlockDriverState *bs,
+                                               BdrvChild *src,
+                                               uint64_t src_offset,
+                                               BdrvChild *dst,
+                                               uint64_t dst_offset,
+                                               uint64_t bytes,
+                                               BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_to(src, src_offset, dst, dst_offset, bytes,
+                                 flags);
+}
+
+static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
+                                             BdrvChild *src,
+                                             uint64_t src_offset,
+                                             BdrvChild *dst,
+                                             uint64_t dst_offset,
+                                             uint64_t bytes,
+                                             BdrvRequestFlags flags)
+{
+    BDRVRawState *s = bs->opaque;
+    BDRVRawState *src_s;
+
+    assert(dst->bs == bs);
+    if (src->bs->drv->bdrv_co_copy_range_to != raw_co_copy_range_to) {
+        return -ENOTSUP;
+    }
+
+    src_s = src->bs->opaque;
+    if (fd_open(src->bs) < 0 || fd_open(dst->bs) < 0) {
+        return -EIO;
+    }
+    return paio_submit_co_full(bs, src_s->fd, src_offset, s->fd, dst_offset,
+                               NULL, bytes, QEMU_AIO_COPY_RANGE);
+}
+
+#ifdef CONFIG_SENDFILE
+static int coroutine_fn raw_co_sendfile(BlockDriverState *bs,
+                                        uint64_t offset, uint64_t bytes,
+                                        int fd, struct iovec *hdr_iov,
+                                        unsigned int hdr_niov)
+{
+    BDRVRawState *s = bs->opaque;
+    QEMUIOVector hdr;
+
+    /* sendfile() goes through the page cache, which cache.direct=on is
+     * meant to bypass */
+    if (s->open_flags & O_DIRECT) {
+        return -ENOTSUP;
+    }
+    if (fd_open(bs) < 0) {
+        return -EIO;
+    }
+
+    qemu_iovec_init_external(&hdr, hdr_iov, hdr_niov);
+    return paio_submit_co_full(bs, s->fd, offset, fd, 0, &hdr, bytes,
+                               QEMU_AIO_SENDFILE);
+}
+#endif
+
 static int raw_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
     BDRVRawState *s = bs->opaque;
@@ -2285,9 +2813,15 @@ BlockDriver bdrv_file = {
 
     .bdrv_co_preadv         = raw_co_preadv,
     .bdrv_co_pwritev        = raw_co_pwritev,
-    .bdrv_aio_flush = raw_aio_flush,
+    .bdrv_co_flush_to_disk = raw_co_flush_to_disk,
     .bdrv_aio_pdiscard = raw_aio_pdiscard,
+    .bdrv_co_copy_range_from = raw_co_copy_range_from,
+    .bdrv_co_copy_range_to  = raw_co_copy_range_to,
+#ifdef CONFIG_SENDFILE
+    .bdrv_co_sendfile = raw_co_sendfile,
+#endif
     .bdrv_refresh_limits = raw_refresh_limits,
+    .bdrv_attach_aio_context = raw_aio_attach_aio_context,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
 
@@ -2607,6 +3141,91 @@ hdev_open_Mac_error:
 
 #if defined(__linux__)
 
+/*
+ * On sg character devices SG_IO does not need a worker thread: the
+ * header can be queued with write() and the completed request collected
+ * with read() once the file descriptor becomes readable (the sg v3
+ * asynchronous interface).  usr_ptr is what ties a completion back to its
+ * request; the caller's value is restored before completing.
+ */
+typedef struct RawSgAIOCB {
+    BlockAIOCB common;
+    struct sg_io_hdr *io_hdr;
+    void *usr_ptr;
+} RawSgAIOCB;
+
+static const AIOCBInfo raw_sg_aiocb_info = {
+    .aiocb_size = sizeof(RawSgAIOCB),
+};
+
+static void raw_sg_read_cb(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVRawState *s = bs->opaque;
+    struct sg_io_hdr hdr;
+    struct sg_io_hdr *io_hdr;
+    RawSgAIOCB *acb;
+    ssize_t len;
+
+    do {
+        len = read(s->fd, &hdr, sizeof(hdr));
+    } while (len < 0 && errno == EINTR);
+    if (len != sizeof(hdr)) {
+        return;
+    }
+
+    acb = hdr.usr_ptr;
+    io_hdr = acb->io_hdr;
+    io_hdr->status = hdr.status;
+    io_hdr->masked_status = hdr.masked_status;
+    io_hdr->msg_status = hdr.msg_status;
+    io_hdr->sb_len_wr = hdr.sb_len_wr;
+    io_hdr->host_status = hdr.host_status;
+    io_hdr->driver_status = hdr.driver_status;
+    io_hdr->resid = hdr.resid;
+    io_hdr->duration = hdr.duration;
+    io_hdr->info = hdr.info;
+    io_hdr->usr_ptr = acb->usr_ptr;
+
+    if (--s->sg_inflight == 0) {
+        aio_set_fd_handler(bdrv_get_aio_context(bs), s->fd, false,
+                           NULL, NULL, NULL, NULL);
+    }
+
+    acb->common.cb(acb->common.opaque, 0);
+    qemu_aio_unref(acb);
+}
+
+static BlockAIOCB *raw_sg_aio_submit(BlockDriverState *bs,
+                                     struct sg_io_hdr *io_hdr,
+                                     BlockCompletionFunc *cb, void *opaque)
+{
+    BDRVRawState *s = bs->opaque;
+    RawSgAIOCB *acb;
+    ssize_t len;
+
+    acb = qemu_aio_get(&raw_sg_aiocb_info, bs, cb, opaque);
+    acb->io_hdr = io_hdr;
+    acb->usr_ptr = io_hdr->usr_ptr;
+    io_hdr->usr_ptr = acb;
+
+    do {
+        len = write(s->fd, io_hdr, sizeof(*io_hdr));
+    } while (len < 0 && errno == EINTR);
+    if (len != sizeof(*io_hdr)) {
+        /* Queue full or not accepted; let the caller use SG_IO instead */
+        io_hdr->usr_ptr = acb->usr_ptr;
+        qemu_aio_unref(acb);
+        return NULL;
+    }
+
+    if (s->sg_inflight++ == 0) {
+        aio_set_fd_handler(bdrv_get_aio_context(bs), s->fd, false,
+                           raw_sg_read_cb, NULL, NULL, bs);
+    }
+    return &acb->common;
+}
+
 static BlockAIOCB *hdev_aio_ioctl(BlockDriverState *bs,
         unsigned long int req, void *buf,
         BlockCompletionFunc *cb, void *opaque)
@@ -2627,6 +3246,13 @@ static BlockAIOCB *hdev_aio_ioctl(BlockDriverState *bs,
         }
     }
 
+    if (req == SG_IO && bs->sg) {
+        BlockAIOCB *sg_acb = raw_sg_aio_submit(bs, buf, cb, opaque);
+        if (sg_acb) {
+            return sg_acb;
+        }
+    }
+
     acb = g_new(RawPosixAIOData, 1);
     acb->bs = bs;
     acb->aio_type = QEMU_AIO_IOCTL;
@@ -2762,9 +3388,10 @@ static BlockDriver bdrv_host_device = {
 
     .bdrv_co_preadv         = raw_co_preadv,
     .bdrv_co_pwritev        = raw_co_pwritev,
-    .bdrv_aio_flush	= raw_aio_flush,
+    .bdrv_co_flush_to_disk = raw_co_flush_to_disk,
     .bdrv_aio_pdiscard   = hdev_aio_pdiscard,
     .bdrv_refresh_limits = raw_refresh_limits,
+    .bdrv_attach_aio_context = raw_aio_attach_aio_context,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
 
@@ -2884,8 +3511,9 @@ static BlockDriver bdrv_host_cdrom = {
 
     .bdrv_co_preadv         = raw_co_preadv,
     .bdrv_co_pwritev        = raw_co_pwritev,
-    .bdrv_aio_flush	= raw_aio_flush,
+    .bdrv_co_flush_to_disk = raw_co_flush_to_disk,
     .bdrv_refresh_limits = raw_refresh_limits,
+    .bdrv_attach_aio_context = raw_aio_attach_aio_context,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
 
@@ -3014,8 +3642,9 @@ static BlockDriver bdrv_host_cdrom = {
 
     .bdrv_co_preadv         = raw_co_preadv,
     .bdrv_co_pwritev        = raw_co_pwritev,
-    .bdrv_aio_flush	= raw_aio_flush,
+    .bdrv_co_flush_to_disk = raw_co_flush_to_disk,
     .bdrv_refresh_limits = raw_refresh_limits,
+    .bdrv_attach_aio_context = raw_aio_attach_aio_context,
     .bdrv_io_plug = raw_aio_plug,
     .bdrv_io_unplug = raw_aio_unplug,
 
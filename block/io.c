@@ -481,26 +481,51 @@ void bdrv_drain_all(void)
  *
  * This function should be called when a tracked request is completing.
  */
-static void tracked_request_end(BdrvTrackedRequest *req)
+static void coroutine_fn tracked_request_end(BdrvTrackedRequest *req)
 {
+    BlockDriverState *bs = req->bs;
+
     if (req->serialising) {
-        atomic_dec(&req->bs->serialising_in_flight);
+        atomic_dec(&bs->serialising_in_flight);
+    }
+
+    if (!req->tracked) {
+        /* Wake up a request that waits for the untracked ones to drain */
+        if (atomic_fetch_dec(&bs->untracked_in_flight) == 1 &&
+            atomic_read(&bs->may_serialise_in_flight))
+        {
+            qemu_co_mutex_lock(&bs->reqs_lock);
+            qemu_co_queue_restart_all(&bs->untracked_queue);
+            qemu_co_mutex_unlock(&bs->reqs_lock);
+        }
+        return;
     }
 
-    qemu_co_mutex_lock(&req->bs->reqs_lock);
+    qemu_co_mutex_lock(&bs->reqs_lock);
     QLIST_REMOVE(req, list);
     qemu_co_queue_restart_all(&req->wait_queue);
-    qemu_co_mutex_unlock(&req->bs->reqs_lock);
+    qemu_co_mutex_unlock(&bs->reqs_lock);
+
+    if (req->may_serialise) {
+        atomic_dec(&bs->may_serialise_in_flight);
+    }
 }
 
 /**
  * Add an active request to the tracked requests list
+ *
+ * Only requests that can become serialising (@may_serialise) ever need to
+ * look at the list.  As long as none of them is in flight, requests are not
+ * put on the list at all, which saves taking reqs_lock twice per request.  A
+ * request that may serialise makes all later requests use the list and waits
+ * for those that skipped it to complete before it goes on.
  */
-static void tracked_request_begin(BdrvTrackedRequest *req,
-                                  BlockDriverState *bs,
-                                  int64_t offset,
-                                  unsigned int bytes,
-                                  enum BdrvTrackedRequestType type)
+static void coroutine_fn tracked_request_begin(BdrvTrackedRequest *req,
+                                               BlockDriverState *bs,
+                                               int64_t offset,
+                                               unsigned int bytes,
+                                               enum BdrvTrackedRequestType type,
+                                               bool may_serialise)
 {
     *req = (BdrvTrackedRequest){
         .bs = bs,
@@ -511,11 +536,31 @@ static void tracked_request_begin(BdrvTrackedRequest *req,
         .serialising    = false,
         .overlap_offset = offset,
         .overlap_bytes  = bytes,
+        .may_serialise  = may_serialise,
     };
 
     qemu_co_queue_init(&req->wait_queue);
 
+    if (!may_serialise && !atomic_read(&bs->may_serialise_in_flight)) {
+        /* Pairs with the check of untracked_in_flight below */
+        atomic_inc(&bs->untracked_in_flight);
+        if (!atomic_read(&bs->may_serialise_in_flight)) {
+            return;
+        }
+        atomic_dec(&bs->untracked_in_flight);
+    }
+
+    req->tracked = true;
+    if (may_serialise) {
+        atomic_inc(&bs->may_serialise_in_flight);
+    }
+
     qemu_co_mutex_lock(&bs->reqs_lock);
+    if (may_serialise) {
+        while (atomic_read(&bs->untracked_in_flight)) {
+            qemu_co_queue_wait(&bs->untracked_queue, &bs->reqs_lock);
+        }
+    }
     QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
     qemu_co_mutex_unlock(&bs->reqs_lock);
 }
@@ -526,6 +571,7 @@ static void mark_request_serialising(BdrvTrackedRequest *req, uint64_t align)
     unsigned int overlap_bytes = ROUND_UP(req->offset + req->bytes, align)
                                - overlap_offset;
 
+    assert(req->may_serialise);
     if (!req->serialising) {
         atomic_inc(&req->bs->serialising_in_flight);
         req->serialising = true;
@@ -1327,7 +1373,8 @@ int coroutine_fn bdrv_co_preadv(BdrvChild *child,
         bytes = ROUND_UP(bytes, align);
     }
 
-    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ);
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ,
+                          flags & BDRV_REQ_COPY_ON_READ);
     ret = bdrv_aligned_preadv(child, &req, offset, bytes, align,
                               use_local_qiov ? &local_qiov : qiov,
                               flags);
@@ -1562,6 +1609,7 @@ static int coroutine_fn bdrv_aligned_pwritev(BdrvChild *child,
 
     atomic_inc(&bs->write_gen);
     bdrv_set_dirty(bs, offset, bytes);
+    bdrv_backing_data_changed(bs);
 
     stat64_max(&bs->wr_highest_offset, offset + bytes);
 
@@ -1699,7 +1747,8 @@ int coroutine_fn bdrv_co_pwritev(BdrvChild *child,
      * Pad qiov with the read parts and be sure to have a tracked request not
      * only for bdrv_aligned_pwritev, but also for the reads of the RMW cycle.
      */
-    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_WRITE);
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_WRITE,
+                          (offset | bytes) & (align - 1));
 
     if (!qiov) {
         ret = bdrv_co_do_zero_pwritev(child, offset, bytes, flags, &req);
@@ -2564,8 +2613,17 @@ static void coroutine_fn bdrv_pdiscard_co_entry(void *opaque)
     rwco->ret = bdrv_co_pdiscard(rwco->bs, rwco->offset, rwco->bytes);
 }
 
-int coroutine_fn bdrv_co_pdiscard(BlockDriverState *bs, int64_t offset,
-                                  int bytes)
+/* Adjacent discards merged while another discard is in flight */
+typedef struct BdrvDiscardBatch {
+    int64_t offset;
+    int64_t bytes;
+    int ret;
+    bool done;
+    CoQueue waiters;
+} BdrvDiscardBatch;
+
+static int coroutine_fn bdrv_co_do_pdiscard(BlockDriverState *bs,
+                                            int64_t offset, int bytes)
 {
     BdrvTrackedRequest req;
     int max_pdiscard, ret;
@@ -2607,7 +2665,7 @@ int coroutine_fn bdrv_co_pdiscard(BlockDriverState *bs, int64_t offset,
     tail = (offset + bytes) % align;
 
     bdrv_inc_in_flight(bs);
-    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_DISCARD);
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_DISCARD, false);
 
     ret = notifier_with_return_list_notify(&bs->before_write_notifiers, &req);
     if (ret < 0) {
@@ -2677,11 +2735,95 @@ int coroutine_fn bdrv_co_pdiscard(BlockDriverState *bs, int64_t offset,
 out:
     atomic_inc(&bs->write_gen);
     bdrv_set_dirty(bs, req.offset, req.bytes);
+    bdrv_backing_data_changed(bs);
     tracked_request_end(&req);
     bdrv_dec_in_flight(bs);
     return ret;
 }
 
+/*
+ * Guests that trim a file system send large numbers of small, mostly
+ * adjacent discards, and for image formats each of them means a metadata
+ * update.  If a discard is already in flight, a new one is not sent at once:
+ * it opens a batch that adjacent discards arriving in the meantime are merged
+ * into, and the whole batch is sent as one request when a discard completes.
+ * All requests of a batch complete together, when the merged request does.
+ *
+ * Only one batch is open at a time; discards that cannot be merged into it
+ * are sent immediately, so an idle node adds no latency.
+ */
+int coroutine_fn bdrv_co_pdiscard(BlockDriverState *bs, int64_t offset,
+                                  int bytes)
+{
+    BdrvDiscardBatch batch, *b;
+    bool leader = false;
+    int64_t start, end;
+    int ret;
+
+    if (!bs->drv || !(bs->open_flags & BDRV_O_UNMAP)) {
+        return bdrv_co_do_pdiscard(bs, offset, bytes);
+    }
+
+    ret = bdrv_check_byte_request(bs, offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    bdrv_inc_in_flight(bs);
+    qemu_co_mutex_lock(&bs->reqs_lock);
+
+    b = bs->discard_batch;
+    if (b) {
+        start = MIN(b->offset, offset);
+        end = MAX(b->offset + b->bytes, offset + bytes);
+        if (offset <= b->offset + b->bytes && offset + bytes >= b->offset &&
+            end - start <= BDRV_REQUEST_MAX_BYTES)
+        {
+            b->offset = start;
+            b->bytes = end - start;
+            while (!b->done) {
+                qemu_co_queue_wait(&b->waiters, &bs->reqs_lock);
+            }
+            ret = b->ret;
+            qemu_co_mutex_unlock(&bs->reqs_lock);
+            bdrv_dec_in_flight(bs);
+            return ret;
+        }
+    } else if (bs->discards_in_flight > 0) {
+        batch = (BdrvDiscardBatch) {
+            .offset = offset,
+            .bytes  = bytes,
+        };
+        qemu_co_queue_init(&batch.waiters);
+        bs->discard_batch = &batch;
+        leader = true;
+
+        qemu_co_queue_wait(&bs->discard_queue, &bs->reqs_lock);
+
+        bs->discard_batch = NULL;
+        offset = batch.offset;
+        bytes = batch.bytes;
+    }
+
+    bs->discards_in_flight++;
+    qemu_co_mutex_unlock(&bs->reqs_lock);
+
+    ret = bdrv_co_do_pdiscard(bs, offset, bytes);
+
+    qemu_co_mutex_lock(&bs->reqs_lock);
+    bs->discards_in_flight--;
+    if (leader) {
+        batch.ret = ret;
+        batch.done = true;
+        qemu_co_queue_restart_all(&batch.waiters);
+    }
+    qemu_co_queue_next(&bs->discard_queue);
+    qemu_co_mutex_unlock(&bs->reqs_lock);
+
+    bdrv_dec_in_flight(bs);
+    return ret;
+}
+
 int bdrv_pdiscard(BlockDriverState *bs, int64_t offset, int bytes)
 {
     Coroutine *co;
@@ -2825,3 +2967,174 @@ void bdrv_io_unplug(BlockDriverState *bs)
         bdrv_io_unplug(child->bs);
     }
 }
+
+static int coroutine_fn bdrv_co_copy_range_internal(BdrvChild *src,
+                                                    uint64_t src_offset,
+                                                    BdrvChild *dst,
+                                                    uint64_t dst_offset,
+                                                    uint64_t bytes,
+                                                    BdrvRequestFlags flags,
+                                                    bool recurse_src)
+{
+    BlockDriverState *src_bs, *dst_bs;
+    BdrvTrackedRequest req;
+    int ret;
+
+    if (!dst || !dst->bs || !dst->bs->drv) {
+        return -ENOMEDIUM;
+    }
+    dst_bs = dst->bs;
+
+    ret = bdrv_check_byte_request(dst_bs, dst_offset, bytes);
+    if (ret < 0) {
+        return ret;
+    } else if (dst_bs->read_only || bdrv_has_readonly_bitmaps(dst_bs)) {
+        return -EPERM;
+    }
+    assert(!(dst_bs->open_flags & BDRV_O_INACTIVE));
+
+    if (flags & BDRV_REQ_ZERO_WRITE) {
+        return bdrv_co_pwrite_zeroes(dst, dst_offset, bytes, flags);
+    }
+
+    if (!src || !src->bs || !src->bs->drv) {
+        return -ENOMEDIUM;
+    }
+    src_bs = src->bs;
+
+    ret = bdrv_check_byte_request(src_bs, src_offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (!src_bs->drv->bdrv_co_copy_range_from ||
+        !dst_bs->drv->bdrv_co_copy_range_to ||
+        src_bs->encrypted || dst_bs->encrypted) {
+        return -ENOTSUP;
+    }
+
+    /* Unaligned requests would need read-modify-write, leave them to the
+     * regular I/O path */
+    if (!QEMU_IS_ALIGNED(src_offset | bytes, src_bs->bl.request_alignment) ||
+        !QEMU_IS_ALIGNED(dst_offset | bytes, dst_bs->bl.request_alignment)) {
+        return -ENOTSUP;
+    }
+
+    if (recurse_src) {
+        bdrv_inc_in_flight(src_bs);
+        tracked_request_begin(&req, src_bs, src_offset, bytes,
+                              BDRV_TRACKED_READ, false);
+        wait_serialising_requests(&req);
+
+        ret = src_bs->drv->bdrv_co_copy_range_from(src_bs, src, src_offset,
+                                                   dst, dst_offset, bytes,
+                                                   flags);
+
+        tracked_request_end(&req);
+        bdrv_dec_in_flight(src_bs);
+    } else {
+        assert(dst->perm & BLK_PERM_WRITE);
+
+        bdrv_inc_in_flight(dst_bs);
+        tracked_request_begin(&req, dst_bs, dst_offset, bytes,
+                              BDRV_TRACKED_WRITE, false);
+        wait_serialising_requests(&req);
+
+        ret = notifier_with_return_list_notify(&dst_bs->before_write_notifiers,
+                                               &req);
+        if (ret == 0) {
+            ret = dst_bs->drv->bdrv_co_copy_range_to(dst_bs, src, src_offset,
+                                                     dst, dst_offset, bytes,
+                                                     flags);
+        }
+
+        atomic_inc(&dst_bs->write_gen);
+        bdrv_set_dirty(dst_bs, dst_offset, bytes);
+        stat64_max(&dst_bs->wr_highest_offset, dst_offset + bytes);
+
+        tracked_request_end(&req);
+        bdrv_dec_in_flight(dst_bs);
+    }
+
+    return ret;
+}
+
+/* Copy range from @src to @dst.
+ *
+ * See the comment of bdrv_co_copy_range for the parameter and return value
+ * semantics. */
+int coroutine_fn bdrv_co_copy_range_from(BdrvChild *src, uint64_t src_offset,
+                                         BdrvChild *dst, uint64_t dst_offset,
+                                         uint64_t bytes,
+                                         BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_internal(src, src_offset, dst, dst_offset,
+                                       bytes, flags, true);
+}
+
+/* Copy range from @src to @dst.
+ *
+ * See the comment of bdrv_co_copy_range for the parameter and return value
+ * semantics. */
+int coroutine_fn bdrv_co_copy_range_to(BdrvChild *src, uint64_t src_offset,
+                                       BdrvChild *dst, uint64_t dst_offset,
+                                       uint64_t bytes, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_internal(src, src_offset, dst, dst_offset,
+                                       bytes, flags, false);
+}
+
+int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
+                                    BdrvChild *dst, uint64_t dst_offset,
+                                    uint64_t bytes, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_from(src, src_offset,
+                                   dst, dst_offset,
+                                   bytes, flags);
+}
+
+int coroutine_fn bdrv_co_sendfile(BdrvChild *child, uint64_t offset,
+                                  uint64_t bytes, int fd,
+                                  struct iovec *hdr_iov,
+                                  unsigned int hdr_niov)
+{
+    BlockDriverState *bs = child->bs;
+    BdrvTrackedRequest req;
+    int64_t total_bytes;
+    int ret;
+
+    if (!bs || !bs->drv) {
+        return -ENOMEDIUM;
+    }
+
+    ret = bdrv_check_byte_request(bs, offset, bytes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Copy-on-read, encryption and unaligned requests all need the data in
+     * a buffer */
+    if (!bs->drv->bdrv_co_sendfile || bs->encrypted ||
+        atomic_read(&bs->copy_on_read) ||
+        !QEMU_IS_ALIGNED(offset | bytes, bs->bl.request_alignment)) {
+        return -ENOTSUP;
+    }
+
+    /* Leave the zero-filling past the end of the image to
+     * bdrv_aligned_preadv() */
+    total_bytes = bdrv_getlength(bs);
+    if (total_bytes < 0 || offset + bytes > total_bytes) {
+        return -ENOTSUP;
+    }
+
+    bdrv_inc_in_flight(bs);
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ, false);
+    wait_serialising_requests(&req);
+
+    ret = bs->drv->bdrv_co_sendfile(bs, offset, bytes, fd, hdr_iov, hdr_niov);
+
+    tracked_request_end(&req);
+    bdrv_dec_in_flight(bs);
+
+    return ret;
+}
@@ -0,0 +1,391 @@
+/*
+ * Linux io_uring support.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include <liburing.h>
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "qemu/queue.h"
+#include "block/block.h"
+#include "block/raw-aio.h"
+#include "qemu/coroutine.h"
+#include "qapi/error.h"
+
+/*
+ * Size of the submission queue (per AioContext).
+ *
+ * The kernel sizes the completion queue at twice this, so as long as no more
+ * than this many requests are in flight completions cannot overflow.
+ */
+#define MAX_ENTRIES 128
+
+typedef struct LuringAIOCB {
+    Coroutine *co;
+    struct io_uring_sqe sqeq;
+    ssize_t ret;
+    QEMUIOVector *qiov;
+    bool is_read;
+    QSIMPLEQ_ENTRY(LuringAIOCB) next;
+
+    /*
+     * Buffered I/O can complete reads partially.  The rest of such a request
+     * is resubmitted with a shortened copy of the original qiov.
+     */
+    int total_read;
+    QEMUIOVector resubmit_qiov;
+} LuringAIOCB;
+
+typedef struct LuringQueue {
+    int plugged;
+    unsigned int in_queue;
+    unsigned int in_flight;
+    bool blocked;
+    QSIMPLEQ_HEAD(, LuringAIOCB) submit_queue;
+} LuringQueue;
+
+struct LuringState {
+    AioContext *aio_context;
+
+    struct io_uring ring;
+
+    /* io queue for submit at batch.  Protected by AioContext lock. */
+    LuringQueue io_q;
+
+    /* I/O completion processing.  Only runs in I/O thread.  */
+    QEMUBH *completion_bh;
+};
+
+static void ioq_submit(LuringState *s);
+
+/*
+ * Put a request back on the submission queue, it is submitted again with the
+ * next batch.
+ */
+static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
+{
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+}
+
+/*
+ * Resubmit the part of a read request that could not be completed yet.
+ * @nread is the number of bytes the last submission did read.
+ */
+static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
+                                       int nread)
+{
+    QEMUIOVector *resubmit_qiov = &luringcb->resubmit_qiov;
+    size_t remaining;
+
+    luringcb->total_read += nread;
+    remaining = luringcb->qiov->size - luringcb->total_read;
+
+    if (resubmit_qiov->iov == NULL) {
+        qemu_iovec_init(resubmit_qiov, luringcb->qiov->niov);
+    } else {
+        qemu_iovec_reset(resubmit_qiov);
+    }
+    qemu_iovec_concat(resubmit_qiov, luringcb->qiov, luringcb->total_read,
+                      remaining);
+
+    luringcb->sqeq.off += nread;
+    luringcb->sqeq.addr = (uintptr_t) resubmit_qiov->iov;
+    luringcb->sqeq.len = resubmit_qiov->niov;
+
+    luring_resubmit(s, luringcb);
+}
+
+/*
+ * Completes a request: translates the result into the return value of
+ * luring_co_submit() and wakes up the coroutine that submitted it, unless the
+ * request has to be submitted again.
+ */
+static void luring_process_completion(LuringState *s, LuringAIOCB *luringcb,
+                                      int ret)
+{
+    /* total_read is non-zero only for resubmitted read requests */
+    int total_bytes = ret + luringcb->total_read;
+
+    if (ret < 0) {
+        if (ret == -EINTR || ret == -EAGAIN) {
+            luring_resubmit(s, luringcb);
+            return;
+        }
+    } else if (!luringcb->qiov) {
+        /* Flush */
+        ret = 0;
+    } else if (total_bytes == luringcb->qiov->size) {
+        ret = 0;
+    } else if (luringcb->is_read) {
+        if (ret > 0) {
+            luring_resubmit_short_read(s, luringcb, ret);
+            return;
+        }
+        /* Reading nothing means EOF, pad with zeros. */
+        qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
+                          luringcb->qiov->size - total_bytes);
+        ret = 0;
+    } else {
+        ret = -ENOSPC;
+    }
+
+    luringcb->ret = ret;
+    if (luringcb->resubmit_qiov.iov) {
+        qemu_iovec_destroy(&luringcb->resubmit_qiov);
+    }
+
+    /* If the coroutine is already entered it must be in ioq_submit() and
+     * will notice luringcb->ret has been filled in when it eventually runs
+     * later.  Coroutines cannot be entered recursively so avoid doing
+     * that!
+     */
+    if (!qemu_coroutine_entered(luringcb->co)) {
+        aio_co_wake(luringcb->co);
+    }
+}
+
+/**
+ * luring_process_completions:
+ * @s: AIO state
+ *
+ * Fetches completed I/O requests and wakes up their coroutines.
+ *
+ * Like qemu_laio_process_completions(), this supports nested event loops:
+ * completions are consumed from the ring one by one, and the completion BH
+ * stays scheduled while we are processing them so that a nested aio_poll()
+ * picks up the remaining ones.
+ */
+static void luring_process_completions(LuringState *s)
+{
+    struct io_uring_cqe *cqe;
+
+    /* Reschedule so nested event loops see currently pending completions */
+    qemu_bh_schedule(s->completion_bh);
+
+    while (io_uring_peek_cqe(&s->ring, &cqe) == 0 && cqe) {
+        LuringAIOCB *luringcb = io_uring_cqe_get_data(cqe);
+        int ret = cqe->res;
+
+        io_uring_cqe_seen(&s->ring, cqe);
+
+        /* Change counters one-by-one because we can be nested. */
+        s->io_q.in_flight--;
+        luring_process_completion(s, luringcb, ret);
+    }
+
+    /* Requests that were queued again are submitted from the BH unless the
+     * queue is plugged, in which case unplugging submits them. */
+    if (!s->io_q.in_queue || s->io_q.plugged) {
+        qemu_bh_cancel(s->completion_bh);
+    }
+}
+
+static void luring_process_completions_and_submit(LuringState *s)
+{
+    luring_process_completions(s);
+
+    aio_context_acquire(s->aio_context);
+    if (!s->io_q.plugged && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+    aio_context_release(s->aio_context);
+}
+
+static void qemu_luring_completion_bh(void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_process_completions_and_submit(s);
+}
+
+static void qemu_luring_completion_cb(void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_process_completions_and_submit(s);
+}
+
+static bool qemu_luring_poll_cb(void *opaque)
+{
+    LuringState *s = opaque;
+
+    if (!io_uring_cq_ready(&s->ring)) {
+        return false;
+    }
+
+    luring_process_completions_and_submit(s);
+    return true;
+}
+
+static void ioq_init(LuringQueue *io_q)
+{
+    QSIMPLEQ_INIT(&io_q->submit_queue);
+    io_q->plugged = 0;
+    io_q->in_queue = 0;
+    io_q->in_flight = 0;
+    io_q->blocked = false;
+}
+
+/*
+ * Moves as many queued requests as the ring takes into it and submits them
+ * with a single system call.  Requests that are moved into the ring but not
+ * accepted by the kernel stay there and are submitted with the next call.
+ */
+static void ioq_submit(LuringState *s)
+{
+    LuringAIOCB *luringcb;
+    int ret;
+
+    while (s->io_q.in_queue > 0 && s->io_q.in_flight < MAX_ENTRIES) {
+        unsigned int len = 0;
+
+        while ((luringcb = QSIMPLEQ_FIRST(&s->io_q.submit_queue)) &&
+               s->io_q.in_flight + len < MAX_ENTRIES) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&s->ring);
+
+            if (!sqe) {
+                break;
+            }
+            *sqe = luringcb->sqeq;
+            QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+            len++;
+        }
+
+        do {
+            ret = io_uring_submit(&s->ring);
+        } while (ret == -EINTR);
+        if (ret <= 0) {
+            /* Out of kernel resources, retry when something completes */
+            break;
+        }
+
+        s->io_q.in_flight += ret;
+        s->io_q.in_queue  -= ret;
+    }
+    s->io_q.blocked = (s->io_q.in_queue > 0);
+
+    if (s->io_q.in_flight) {
+        /* We can try to complete something just right away if there are
+         * still requests in-flight. */
+        luring_process_completions(s);
+    } else if (s->io_q.blocked) {
+        /* Nothing will complete to trigger another attempt */
+        qemu_bh_schedule(s->completion_bh);
+    }
+}
+
+void luring_io_plug(BlockDriverState *bs, LuringState *s)
+{
+    s->io_q.plugged++;
+}
+
+void luring_io_unplug(BlockDriverState *bs, LuringState *s)
+{
+    assert(s->io_q.plugged);
+    if (--s->io_q.plugged == 0 &&
+        !s->io_q.blocked && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+}
+
+static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
+                            uint64_t offset, int type)
+{
+    struct io_uring_sqe *sqe = &luringcb->sqeq;
+
+    switch (type) {
+    case QEMU_AIO_WRITE:
+        io_uring_prep_writev(sqe, fd, luringcb->qiov->iov,
+                             luringcb->qiov->niov, offset);
+        break;
+    case QEMU_AIO_READ:
+        io_uring_prep_readv(sqe, fd, luringcb->qiov->iov,
+                            luringcb->qiov->niov, offset);
+        break;
+    case QEMU_AIO_FLUSH:
+        io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        return -EIO;
+    }
+    io_uring_sqe_set_data(sqe, luringcb);
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+    if (!s->io_q.blocked &&
+        (!s->io_q.plugged ||
+         s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES)) {
+        ioq_submit(s);
+    }
+
+    return 0;
+}
+
+int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type)
+{
+    int ret;
+    LuringAIOCB luringcb = {
+        .co         = qemu_coroutine_self(),
+        .ret        = -EINPROGRESS,
+        .qiov       = qiov,
+        .is_read    = (type == QEMU_AIO_READ),
+    };
+
+    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (luringcb.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return luringcb.ret;
+}
+
+void luring_detach_aio_context(LuringState *s, AioContext *old_context)
+{
+    aio_set_fd_handler(old_context, s->ring.ring_fd, false,
+                       NULL, NULL, NULL, s);
+    qemu_bh_delete(s->completion_bh);
+    s->aio_context = NULL;
+}
+
+void luring_attach_aio_context(LuringState *s, AioContext *new_context)
+{
+    s->aio_context = new_context;
+    s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
+    aio_set_fd_handler(s->aio_context, s->ring.ring_fd, false,
+                       qemu_luring_completion_cb, NULL,
+                       qemu_luring_poll_cb, s);
+}
+
+LuringState *luring_init(Error **errp)
+{
+    LuringState *s;
+    int rc;
+
+    s = g_new0(LuringState, 1);
+    rc = io_uring_queue_init(MAX_ENTRIES, &s->ring, 0);
+    if (rc < 0) {
+        error_setg_errno(errp, -rc, "Failed to set up io_uring");
+        g_free(s);
+        return NULL;
+    }
+
+    ioq_init(&s->io_q);
+
+    return s;
+}
+
+void luring_cleanup(LuringState *s)
+{
+    io_uring_queue_exit(&s->ring);
+    g_free(s);
+}
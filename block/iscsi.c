@@ -53,14 +53,29 @@ QEMU_BUILD_BUG_ON((int)SCSI_XFER_NONE != (int)ISCSI_XFER_NONE);
 #include <scsi/sg.h>
 #endif
 
+#define ISCSI_MAX_SESSIONS 16
+
+/* One login to the LUN; reads and writes are spread over all of them */
+typedef struct IscsiSession {
+    struct IscsiLun *iscsilun;
+    struct iscsi_context *iscsi;
+    int events;
+    /* Number of reads and writes submitted through this session */
+    unsigned in_flight;
+    bool request_timed_out;
+} IscsiSession;
+
 typedef struct IscsiLun {
+    /* Context of the first session, used for everything but reads and
+     * writes */
     struct iscsi_context *iscsi;
+    IscsiSession sessions[ISCSI_MAX_SESSIONS];
+    int nb_sessions;
     AioContext *aio_context;
     int lun;
     enum scsi_inquiry_peripheral_device_type type;
     int block_size;
     uint64_t num_blocks;
-    int events;
     QEMUTimer *nop_timer;
     QEMUTimer *event_timer;
     QemuMutex mutex;
@@ -91,7 +106,6 @@ typedef struct IscsiLun {
     bool lbprz;
     bool dpofua;
     bool has_write_same;
-    bool request_timed_out;
 } IscsiLun;
 
 typedef struct IscsiTask {
@@ -102,6 +116,7 @@ typedef struct IscsiTask {
     struct scsi_task *task;
     Coroutine *co;
     IscsiLun *iscsilun;
+    IscsiSession *session;
     QEMUTimer retry_timer;
     int err_code;
     char *err_str;
@@ -250,7 +265,7 @@ iscsi_co_generic_cb(struct iscsi_context *iscsi, int status,
                     /* make sure the request is rescheduled AFTER the
                      * reconnect is initiated */
                     retry_time = EVENT_INTERVAL * 2;
-                    iTask->iscsilun->request_timed_out = true;
+                    iTask->session->request_timed_out = true;
                 }
                 error_report("iSCSI Busy/TaskSetFull/TimeOut"
                              " (retry #%u in %u ms): %s",
@@ -283,9 +298,32 @@ static void iscsi_co_init_iscsitask(IscsiLun *iscsilun, struct IscsiTask *iTask)
     *iTask = (struct IscsiTask) {
         .co         = qemu_coroutine_self(),
         .iscsilun   = iscsilun,
+        .session    = &iscsilun->sessions[0],
     };
 }
 
+/* Called with QemuMutex held.  Picks the session with the fewest reads and
+ * writes in flight. */
+static IscsiSession *iscsi_session_get(IscsiLun *iscsilun)
+{
+    IscsiSession *session = &iscsilun->sessions[0];
+    int i;
+
+    for (i = 1; i < iscsilun->nb_sessions; i++) {
+        if (iscsilun->sessions[i].in_flight < session->in_flight) {
+            session = &iscsilun->sessions[i];
+        }
+    }
+
+    session->in_flight++;
+    return session;
+}
+
+static void iscsi_session_put(IscsiSession *session)
+{
+    session->in_flight--;
+}
+
 static void
 iscsi_abort_task_cb(struct iscsi_context *iscsi, int status, void *command_data,
                     void *private_data)
@@ -325,30 +363,41 @@ static void iscsi_process_write(void *arg);
 static void
 iscsi_set_events(IscsiLun *iscsilun)
 {
-    struct iscsi_context *iscsi = iscsilun->iscsi;
-    int ev = iscsi_which_events(iscsi);
-
-    if (ev != iscsilun->events) {
-        aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(iscsi),
-                           false,
-                           (ev & POLLIN) ? iscsi_process_read : NULL,
-                           (ev & POLLOUT) ? iscsi_process_write : NULL,
-                           NULL,
-                           iscsilun);
-        iscsilun->events = ev;
+    IscsiSession *session;
+    int i, ev;
+
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        session = &iscsilun->sessions[i];
+        ev = iscsi_which_events(session->iscsi);
+        if (ev != session->events) {
+            aio_set_fd_handler(iscsilun->aio_context,
+                               iscsi_get_fd(session->iscsi),
+                               false,
+                               (ev & POLLIN) ? iscsi_process_read : NULL,
+                               (ev & POLLOUT) ? iscsi_process_write : NULL,
+                               NULL,
+                               session);
+            session->events = ev;
+        }
     }
 }
 
 static void iscsi_timed_check_events(void *opaque)
 {
     IscsiLun *iscsilun = opaque;
+    IscsiSession *session;
+    int i;
+
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        session = &iscsilun->sessions[i];
 
-    /* check for timed out requests */
-    iscsi_service(iscsilun->iscsi, 0);
+        /* check for timed out requests */
+        iscsi_service(session->iscsi, 0);
 
-    if (iscsilun->request_timed_out) {
-        iscsilun->request_timed_out = false;
-        iscsi_reconnect(iscsilun->iscsi);
+        if (session->request_timed_out) {
+            session->request_timed_out = false;
+            iscsi_reconnect(session->iscsi);
+        }
     }
 
     /* newer versions of libiscsi may return zero events. Ensure we are able
@@ -362,11 +411,11 @@ static void iscsi_timed_check_events(void *opaque)
 static void
 iscsi_process_read(void *arg)
 {
-    IscsiLun *iscsilun = arg;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    IscsiSession *session = arg;
+    IscsiLun *iscsilun = session->iscsilun;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    iscsi_service(iscsi, POLLIN);
+    iscsi_service(session->iscsi, POLLIN);
     iscsi_set_events(iscsilun);
     qemu_mutex_unlock(&iscsilun->mutex);
 }
@@ -374,11 +423,11 @@ iscsi_process_read(void *arg)
 static void
 iscsi_process_write(void *arg)
 {
-    IscsiLun *iscsilun = arg;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    IscsiSession *session = arg;
+    IscsiLun *iscsilun = session->iscsilun;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    iscsi_service(iscsi, POLLOUT);
+    iscsi_service(session->iscsi, POLLOUT);
     iscsi_set_events(iscsilun);
     qemu_mutex_unlock(&iscsilun->mutex);
 }
@@ -555,6 +604,7 @@ iscsi_co_writev_flags(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
                       QEMUIOVector *iov, int flags)
 {
     IscsiLun *iscsilun = bs->opaque;
+    IscsiSession *session;
     struct IscsiTask iTask;
     uint64_t lba;
     uint32_t num_sectors;
@@ -576,36 +626,38 @@ iscsi_co_writev_flags(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
     num_sectors = sector_qemu2lun(nb_sectors, iscsilun);
     iscsi_co_init_iscsitask(iscsilun, &iTask);
     qemu_mutex_lock(&iscsilun->mutex);
+    session = iscsi_session_get(iscsilun);
+    iTask.session = session;
 retry:
     if (iscsilun->use_16_for_rw) {
 #if LIBISCSI_API_VERSION >= (20160603)
-        iTask.task = iscsi_write16_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write16_iov_task(session->iscsi, iscsilun->lun, lba,
                                             NULL, num_sectors * iscsilun->block_size,
                                             iscsilun->block_size, 0, 0, fua, 0, 0,
                                             iscsi_co_generic_cb, &iTask,
                                             (struct scsi_iovec *)iov->iov, iov->niov);
     } else {
-        iTask.task = iscsi_write10_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write10_iov_task(session->iscsi, iscsilun->lun, lba,
                                             NULL, num_sectors * iscsilun->block_size,
                                             iscsilun->block_size, 0, 0, fua, 0, 0,
                                             iscsi_co_generic_cb, &iTask,
                                             (struct scsi_iovec *)iov->iov, iov->niov);
     }
 #else
-        iTask.task = iscsi_write16_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write16_task(session->iscsi, iscsilun->lun, lba,
                                         NULL, num_sectors * iscsilun->block_size,
                                         iscsilun->block_size, 0, 0, fua, 0, 0,
                                         iscsi_co_generic_cb, &iTask);
     } else {
-        iTask.task = iscsi_write10_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_write10_task(session->iscsi, iscsilun->lun, lba,
                                         NULL, num_sectors * iscsilun->block_size,
                                         iscsilun->block_size, 0, 0, fua, 0, 0,
                                         iscsi_co_generic_cb, &iTask);
     }
 #endif
     if (iTask.task == NULL) {
-        qemu_mutex_unlock(&iscsilun->mutex);
-        return -ENOMEM;
+        r = -ENOMEM;
+        goto out_unlock;
     }
 #if LIBISCSI_API_VERSION < (20160603)
     scsi_task_set_iov_out(iTask.task, (struct scsi_iovec *) iov->iov,
@@ -639,6 +691,7 @@ retry:
     iscsi_allocmap_set_allocated(iscsilun, sector_num, nb_sectors);
 
 out_unlock:
+    iscsi_session_put(session);
     qemu_mutex_unlock(&iscsilun->mutex);
     g_free(iTask.err_str);
     return r;
@@ -762,6 +815,7 @@ static int coroutine_fn iscsi_co_readv(BlockDriverState *bs,
                                        QEMUIOVector *iov)
 {
     IscsiLun *iscsilun = bs->opaque;
+    IscsiSession *session;
     struct IscsiTask iTask;
     uint64_t lba;
     uint32_t num_sectors;
@@ -811,16 +865,18 @@ static int coroutine_fn iscsi_co_readv(BlockDriverState *bs,
 
     iscsi_co_init_iscsitask(iscsilun, &iTask);
     qemu_mutex_lock(&iscsilun->mutex);
+    session = iscsi_session_get(iscsilun);
+    iTask.session = session;
 retry:
     if (iscsilun->use_16_for_rw) {
 #if LIBISCSI_API_VERSION >= (20160603)
-        iTask.task = iscsi_read16_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read16_iov_task(session->iscsi, iscsilun->lun, lba,
                                            num_sectors * iscsilun->block_size,
                                            iscsilun->block_size, 0, 0, 0, 0, 0,
                                            iscsi_co_generic_cb, &iTask,
                                            (struct scsi_iovec *)iov->iov, iov->niov);
     } else {
-        iTask.task = iscsi_read10_iov_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read10_iov_task(session->iscsi, iscsilun->lun, lba,
                                            num_sectors * iscsilun->block_size,
                                            iscsilun->block_size,
                                            0, 0, 0, 0, 0,
@@ -828,12 +884,12 @@ retry:
                                            (struct scsi_iovec *)iov->iov, iov->niov);
     }
 #else
-        iTask.task = iscsi_read16_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read16_task(session->iscsi, iscsilun->lun, lba,
                                        num_sectors * iscsilun->block_size,
                                        iscsilun->block_size, 0, 0, 0, 0, 0,
                                        iscsi_co_generic_cb, &iTask);
     } else {
-        iTask.task = iscsi_read10_task(iscsilun->iscsi, iscsilun->lun, lba,
+        iTask.task = iscsi_read10_task(session->iscsi, iscsilun->lun, lba,
                                        num_sectors * iscsilun->block_size,
                                        iscsilun->block_size,
                                        0, 0, 0, 0, 0,
@@ -841,8 +897,8 @@ retry:
     }
 #endif
     if (iTask.task == NULL) {
-        qemu_mutex_unlock(&iscsilun->mutex);
-        return -ENOMEM;
+        r = -ENOMEM;
+        goto out_unlock;
     }
 #if LIBISCSI_API_VERSION < (20160603)
     scsi_task_set_iov_in(iTask.task, (struct scsi_iovec *) iov->iov, iov->niov);
@@ -870,6 +926,8 @@ retry:
         r = iTask.err_code;
     }
 
+out_unlock:
+    iscsi_session_put(session);
     qemu_mutex_unlock(&iscsilun->mutex);
     g_free(iTask.err_str);
     return r;
@@ -1365,14 +1423,21 @@ static char *get_initiator_name(QemuOpts *opts)
 static void iscsi_nop_timed_event(void *opaque)
 {
     IscsiLun *iscsilun = opaque;
+    IscsiSession *session;
+    int i;
 
     qemu_mutex_lock(&iscsilun->mutex);
-    if (iscsi_get_nops_in_flight(iscsilun->iscsi) >= MAX_NOP_FAILURES) {
-        error_report("iSCSI: NOP timeout. Reconnecting...");
-        iscsilun->request_timed_out = true;
-    } else if (iscsi_nop_out_async(iscsilun->iscsi, NULL, NULL, 0, NULL) != 0) {
-        error_report("iSCSI: failed to sent NOP-Out. Disabling NOP messages.");
-        goto out;
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        session = &iscsilun->sessions[i];
+        if (iscsi_get_nops_in_flight(session->iscsi) >= MAX_NOP_FAILURES) {
+            error_report("iSCSI: NOP timeout. Reconnecting...");
+            session->request_timed_out = true;
+        } else if (iscsi_nop_out_async(session->iscsi, NULL, NULL, 0,
+                                       NULL) != 0) {
+            error_report("iSCSI: failed to sent NOP-Out. "
+                         "Disabling NOP messages.");
+            goto out;
+        }
     }
 
     timer_mod(iscsilun->nop_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + NOP_INTERVAL);
@@ -1493,10 +1558,14 @@ fail_with_err:
 static void iscsi_detach_aio_context(BlockDriverState *bs)
 {
     IscsiLun *iscsilun = bs->opaque;
+    int i;
 
-    aio_set_fd_handler(iscsilun->aio_context, iscsi_get_fd(iscsilun->iscsi),
-                       false, NULL, NULL, NULL, NULL);
-    iscsilun->events = 0;
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        aio_set_fd_handler(iscsilun->aio_context,
+                           iscsi_get_fd(iscsilun->sessions[i].iscsi),
+                           false, NULL, NULL, NULL, NULL);
+        iscsilun->sessions[i].events = 0;
+    }
 
     if (iscsilun->nop_timer) {
         timer_del(iscsilun->nop_timer);
@@ -1721,6 +1790,14 @@ static QemuOptsList runtime_opts = {
             .name = "timeout",
             .type = QEMU_OPT_NUMBER,
         },
+        {
+            .name = "sessions",
+            .type = QEMU_OPT_NUMBER,
+        },
+        {
+            .name = "portals",
+            .type = QEMU_OPT_STRING,
+        },
         {
             .name = "filename",
             .type = QEMU_OPT_STRING,
@@ -1729,6 +1806,97 @@ static QemuOptsList runtime_opts = {
     },
 };
 
+/*
+ * Creates a context for a new session to @portal, configured from @opts, and
+ * logs in to @lun.  @opts must have been validated by iscsi_open().
+ */
+static int iscsi_session_connect(QemuOpts *opts, const char *initiator_name,
+                                 const char *portal, int lun,
+                                 struct iscsi_context **piscsi, Error **errp)
+{
+    struct iscsi_context *iscsi;
+    Error *local_err = NULL;
+    int ret, timeout;
+
+    iscsi = iscsi_create_context(initiator_name);
+    if (iscsi == NULL) {
+        error_setg(errp, "iSCSI: Failed to create iSCSI context.");
+        return -ENOMEM;
+    }
+#if LIBISCSI_API_VERSION >= (20160603)
+    if (iscsi_init_transport(iscsi,
+                             strcmp(qemu_opt_get(opts, "transport"), "iser")
+                             ? TCP_TRANSPORT : ISER_TRANSPORT)) {
+        error_setg(errp, ("Error initializing transport."));
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif
+    if (iscsi_set_targetname(iscsi, qemu_opt_get(opts, "target"))) {
+        error_setg(errp, "iSCSI: Failed to set target name.");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    /* check if we got CHAP username/password via the options */
+    apply_chap(iscsi, opts, &local_err);
+    if (local_err != NULL) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    if (iscsi_set_session_type(iscsi, ISCSI_SESSION_NORMAL) != 0) {
+        error_setg(errp, "iSCSI: Failed to set session type to normal.");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    /* check if we got HEADER_DIGEST via the options */
+    apply_header_digest(iscsi, opts, &local_err);
+    if (local_err != NULL) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    /* timeout handling is broken in libiscsi before 1.15.0 */
+    timeout = qemu_opt_get_number(opts, "timeout", 0);
+#if LIBISCSI_API_VERSION >= 20150621
+    iscsi_set_timeout(iscsi, timeout);
+#else
+    if (timeout) {
+        error_report("iSCSI: ignoring timeout value for libiscsi <1.15.0");
+    }
+#endif
+
+    /* Sessions of the same initiator must have distinct ISIDs, or logging in
+     * again would reinstate (and so drop) the previous session */
+    iscsi_set_isid_random(iscsi, g_random_int(), 0);
+
+    if (iscsi_full_connect_sync(iscsi, portal, lun) != 0) {
+        error_setg(errp, "iSCSI: Failed to connect to LUN : %s",
+            iscsi_get_error(iscsi));
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    *piscsi = iscsi;
+    return 0;
+
+fail:
+    iscsi_destroy_context(iscsi);
+    return ret;
+}
+
+static void iscsi_session_close(struct iscsi_context *iscsi)
+{
+    if (iscsi_is_logged_in(iscsi)) {
+        iscsi_logout_sync(iscsi);
+    }
+    iscsi_destroy_context(iscsi);
+}
+
 static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
                       Error **errp)
 {
@@ -1741,10 +1909,8 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
     QemuOpts *opts;
     Error *local_err = NULL;
     const char *transport_name, *portal, *target, *filename;
-#if LIBISCSI_API_VERSION >= (20160603)
-    enum iscsi_transport_type transport;
-#endif
-    int i, ret = 0, timeout = 0, lun;
+    char **portals = NULL;
+    int i, ret = 0, lun, nb_portals, nb_sessions;
 
     /* If we are given a filename, parse the filename, with precedence given to
      * filename encoded options */
@@ -1780,13 +1946,11 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
         goto out;
     }
 
+    /* The transport is set up by iscsi_session_connect() */
     if (!strcmp(transport_name, "tcp")) {
+        /* TCP is what older libiscsi versions always use */
 #if LIBISCSI_API_VERSION >= (20160603)
-        transport = TCP_TRANSPORT;
     } else if (!strcmp(transport_name, "iser")) {
-        transport = ISER_TRANSPORT;
-#else
-        /* TCP is what older libiscsi versions always use */
 #endif
     } else {
         error_setg(errp, "Unknown transport: %s", transport_name);
@@ -1794,69 +1958,37 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
         goto out;
     }
 
-    memset(iscsilun, 0, sizeof(IscsiLun));
-
-    initiator_name = get_initiator_name(opts);
-
-    iscsi = iscsi_create_context(initiator_name);
-    if (iscsi == NULL) {
-        error_setg(errp, "iSCSI: Failed to create iSCSI context.");
-        ret = -ENOMEM;
-        goto out;
-    }
-#if LIBISCSI_API_VERSION >= (20160603)
-    if (iscsi_init_transport(iscsi, transport)) {
-        error_setg(errp, ("Error initializing transport."));
-        ret = -EINVAL;
-        goto out;
-    }
-#endif
-    if (iscsi_set_targetname(iscsi, target)) {
-        error_setg(errp, "iSCSI: Failed to set target name.");
-        ret = -EINVAL;
-        goto out;
-    }
-
-    /* check if we got CHAP username/password via the options */
-    apply_chap(iscsi, opts, &local_err);
-    if (local_err != NULL) {
-        error_propagate(errp, local_err);
-        ret = -EINVAL;
-        goto out;
+    /* Additional sessions are spread round-robin over @portal and @portals */
+    nb_portals = 1;
+    if (qemu_opt_get(opts, "portals")) {
+        portals = g_strsplit(qemu_opt_get(opts, "portals"), ",", 0);
+        nb_portals += g_strv_length(portals);
     }
-
-    if (iscsi_set_session_type(iscsi, ISCSI_SESSION_NORMAL) != 0) {
-        error_setg(errp, "iSCSI: Failed to set session type to normal.");
+    nb_sessions = qemu_opt_get_number(opts, "sessions",
+                                      MIN(nb_portals, ISCSI_MAX_SESSIONS));
+    if (nb_sessions < 1 || nb_sessions > ISCSI_MAX_SESSIONS) {
+        error_setg(errp, "iSCSI: sessions must be between 1 and %d",
+                   ISCSI_MAX_SESSIONS);
         ret = -EINVAL;
         goto out;
     }
 
-    /* check if we got HEADER_DIGEST via the options */
-    apply_header_digest(iscsi, opts, &local_err);
-    if (local_err != NULL) {
-        error_propagate(errp, local_err);
-        ret = -EINVAL;
-        goto out;
-    }
+    memset(iscsilun, 0, sizeof(IscsiLun));
 
-    /* timeout handling is broken in libiscsi before 1.15.0 */
-    timeout = qemu_opt_get_number(opts, "timeout", 0);
-#if LIBISCSI_API_VERSION >= 20150621
-    iscsi_set_timeout(iscsi, timeout);
-#else
-    if (timeout) {
-        error_report("iSCSI: ignoring timeout value for libiscsi <1.15.0");
-    }
-#endif
+    initiator_name = get_initiator_name(opts);
 
-    if (iscsi_full_connect_sync(iscsi, portal, lun) != 0) {
-        error_setg(errp, "iSCSI: Failed to connect to LUN : %s",
-            iscsi_get_error(iscsi));
-        ret = -EINVAL;
+    ret = iscsi_session_connect(opts, initiator_name, portal, lun, &iscsi,
+                                errp);
+    if (ret < 0) {
         goto out;
     }
 
     iscsilun->iscsi = iscsi;
+    iscsilun->sessions[0] = (IscsiSession) {
+        .iscsilun   = iscsilun,
+        .iscsi      = iscsi,
+    };
+    iscsilun->nb_sessions = 1;
     iscsilun->aio_context = bdrv_get_aio_context(bs);
     iscsilun->lun = lun;
     iscsilun->has_write_same = true;
@@ -1944,6 +2076,22 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
     scsi_free_scsi_task(task);
     task = NULL;
 
+    for (i = 1; i < nb_sessions; i++) {
+        IscsiSession *session = &iscsilun->sessions[i];
+        int p = i % nb_portals;
+
+        *session = (IscsiSession) {
+            .iscsilun   = iscsilun,
+        };
+        ret = iscsi_session_connect(opts, initiator_name,
+                                    p ? portals[p - 1] : portal, lun,
+                                    &session->iscsi, errp);
+        if (ret < 0) {
+            goto out;
+        }
+        iscsilun->nb_sessions++;
+    }
+
     qemu_mutex_init(&iscsilun->mutex);
     iscsi_attach_aio_context(bs, iscsilun->aio_context);
 
@@ -1962,16 +2110,17 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
 out:
     qemu_opts_del(opts);
     g_free(initiator_name);
+    g_strfreev(portals);
     if (task != NULL) {
         scsi_free_scsi_task(task);
     }
 
     if (ret) {
+        for (i = 1; i < iscsilun->nb_sessions; i++) {
+            iscsi_session_close(iscsilun->sessions[i].iscsi);
+        }
         if (iscsi != NULL) {
-            if (iscsi_is_logged_in(iscsi)) {
-                iscsi_logout_sync(iscsi);
-            }
-            iscsi_destroy_context(iscsi);
+            iscsi_session_close(iscsi);
         }
         memset(iscsilun, 0, sizeof(IscsiLun));
     }
@@ -1982,13 +2131,12 @@ exit:
 static void iscsi_close(BlockDriverState *bs)
 {
     IscsiLun *iscsilun = bs->opaque;
-    struct iscsi_context *iscsi = iscsilun->iscsi;
+    int i;
 
     iscsi_detach_aio_context(bs);
-    if (iscsi_is_logged_in(iscsi)) {
-        iscsi_logout_sync(iscsi);
+    for (i = 0; i < iscsilun->nb_sessions; i++) {
+        iscsi_session_close(iscsilun->sessions[i].iscsi);
     }
-    iscsi_destroy_context(iscsi);
     g_free(iscsilun->zeroblock);
     iscsi_allocmap_free(iscsilun);
     qemu_mutex_destroy(&iscsilun->mutex);
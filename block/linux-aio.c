@@ -28,6 +28,19 @@
  */
 #define MAX_EVENTS 128
 
+/*
+ * Adaptive batching.
+ *
+ * When the queue is unplugged while at least BATCH_MIN_IN_FLIGHT requests
+ * are in flight, the requests queued while it was plugged are not submitted
+ * right away.  Completions arrive often enough at such a queue depth that
+ * the next one submits them together with whatever else got queued in the
+ * meantime, which saves io_submit() calls.  BATCH_DEADLINE_NS bounds the
+ * additional latency if no completion comes in before.
+ */
+#define BATCH_MIN_IN_FLIGHT 16
+#define BATCH_DEADLINE_NS   (50 * SCALE_US)
+
 struct qemu_laiocb {
     BlockAIOCB common;
     Coroutine *co;
@@ -61,6 +74,9 @@ struct LinuxAioState {
     QEMUBH *completion_bh;
     int event_idx;
     int event_max;
+
+    /* Submits deferred requests when no completion did it before */
+    QEMUTimer *submit_timer;
 };
 
 static void ioq_submit(LinuxAioState *s);
@@ -242,6 +258,18 @@ static void qemu_laio_process_completions_and_submit(LinuxAioState *s)
     aio_context_release(s->aio_context);
 }
 
+static void qemu_laio_submit_timer_cb(void *opaque)
+{
+    LinuxAioState *s = opaque;
+
+    aio_context_acquire(s->aio_context);
+    if (!s->io_q.plugged && !s->io_q.blocked &&
+        !QSIMPLEQ_EMPTY(&s->io_q.pending)) {
+        ioq_submit(s);
+    }
+    aio_context_release(s->aio_context);
+}
+
 static void qemu_laio_completion_bh(void *opaque)
 {
     LinuxAioState *s = opaque;
@@ -312,6 +340,8 @@ static void ioq_submit(LinuxAioState *s)
     struct iocb *iocbs[MAX_EVENTS];
     QSIMPLEQ_HEAD(, qemu_laiocb) completed;
 
+    timer_del(s->submit_timer);
+
     do {
         if (s->io_q.in_flight >= MAX_EVENTS) {
             break;
@@ -367,10 +397,22 @@ void laio_io_plug(BlockDriverState *bs, LinuxAioState *s)
 void laio_io_unplug(BlockDriverState *bs, LinuxAioState *s)
 {
     assert(s->io_q.plugged);
-    if (--s->io_q.plugged == 0 &&
-        !s->io_q.blocked && !QSIMPLEQ_EMPTY(&s->io_q.pending)) {
-        ioq_submit(s);
+    if (--s->io_q.plugged || s->io_q.blocked ||
+        QSIMPLEQ_EMPTY(&s->io_q.pending)) {
+        return;
     }
+
+    if (s->io_q.in_flight >= BATCH_MIN_IN_FLIGHT) {
+        /* Leave it to the next completion, see BATCH_MIN_IN_FLIGHT */
+        if (!timer_pending(s->submit_timer)) {
+            timer_mod(s->submit_timer,
+                      qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+                      BATCH_DEADLINE_NS);
+        }
+        return;
+    }
+
+    ioq_submit(s);
 }
 
 static int laio_do_submit(int fd, struct qemu_laiocb *laiocb, off_t offset,
@@ -458,6 +500,9 @@ void laio_detach_aio_context(LinuxAioState *s, AioContext *old_context)
 {
     aio_set_event_notifier(old_context, &s->e, false, NULL, NULL);
     qemu_bh_delete(s->completion_bh);
+    timer_del(s->submit_timer);
+    timer_free(s->submit_timer);
+    s->submit_timer = NULL;
     s->aio_context = NULL;
 }
 
@@ -465,6 +510,8 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context)
 {
     s->aio_context = new_context;
     s->completion_bh = aio_bh_new(new_context, qemu_laio_completion_bh, s);
+    s->submit_timer = aio_timer_new(new_context, QEMU_CLOCK_REALTIME, SCALE_NS,
+                                    qemu_laio_submit_timer_cb, s);
     aio_set_event_notifier(new_context, &s->e, false,
                            qemu_laio_completion_cb,
                            qemu_laio_poll_cb);
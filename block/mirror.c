@@ -27,6 +27,12 @@
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/* Copy requests are made larger while they complete faster than
+ * LATENCY_LOW, and smaller when they take longer than LATENCY_HIGH */
+#define MIRROR_LATENCY_LOW_NS    10000000LL /* ns */
+#define MIRROR_LATENCY_HIGH_NS  100000000LL /* ns */
+#define MIN_IO_BYTES (64 * 1024)
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -65,6 +71,11 @@ typedef struct MirrorBlockJob {
 
     uint64_t last_pause_ns;
     unsigned long *in_flight_bitmap;
+    /* Chunks copied in the current and in the previous pass over the
+     * dirty bitmap */
+    unsigned long *copied_bitmap;
+    unsigned long *hot_bitmap;
+    int64_t max_io_bytes;
     int in_flight;
     int64_t bytes_in_flight;
     int ret;
@@ -73,13 +84,27 @@ typedef struct MirrorBlockJob {
     int target_cluster_size;
     int max_iov;
     bool initial_zeroing_ongoing;
+
+    MirrorCopyMode copy_mode;
+    /* Set while the state that active writes use is valid */
+    bool active_write_ready;
+    int active_writes_in_flight;
+    /* Active writes waiting for overlapping background operations */
+    CoQueue ops_done;
+    int ops_done_waiters;
 } MirrorBlockJob;
 
+typedef struct MirrorBDSOpaque {
+    MirrorBlockJob *job;
+} MirrorBDSOpaque;
+
 typedef struct MirrorOp {
     MirrorBlockJob *s;
     QEMUIOVector qiov;
     int64_t offset;
     uint64_t bytes;
+    /* Submission time of copy operations, 0 for zero writes and discards */
+    int64_t start_ns;
 } MirrorOp;
 
 static BlockErrorAction mirror_error_action(MirrorBlockJob *s, bool read,
@@ -95,6 +120,34 @@ static BlockErrorAction mirror_error_action(MirrorBlockJob *s, bool read,
     }
 }
 
+/* Adapt the size of copy requests to the latency of completed ones.  Large
+ * requests make more progress per operation, but on a slow or busy target
+ * they hold buffers for a long time and leave less room for parallelism. */
+static void mirror_adapt_io_bytes(MirrorBlockJob *s, MirrorOp *op)
+{
+    int64_t latency_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - op->start_ns;
+    int64_t max_io_bytes = s->max_io_bytes;
+
+    /* Requests that were cut short by the end of a dirty extent say little
+     * about how the target copes with max_io_bytes */
+    if (op->bytes < max_io_bytes / 2) {
+        return;
+    }
+
+    if (latency_ns < MIRROR_LATENCY_LOW_NS) {
+        max_io_bytes = MIN(max_io_bytes * 2,
+                           MAX(s->buf_size / 4, MAX_IO_BYTES));
+    } else if (latency_ns > MIRROR_LATENCY_HIGH_NS) {
+        max_io_bytes = MAX(max_io_bytes / 2,
+                           MAX(s->granularity, MIN_IO_BYTES));
+    }
+
+    if (max_io_bytes != s->max_io_bytes) {
+        trace_mirror_adapt_io_bytes(s, latency_ns, max_io_bytes);
+        s->max_io_bytes = max_io_bytes;
+    }
+}
+
 static void mirror_iteration_done(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -117,6 +170,9 @@ static void mirror_iteration_done(MirrorOp *op, int ret)
     nb_chunks = DIV_ROUND_UP(op->bytes, s->granularity);
     bitmap_clear(s->in_flight_bitmap, chunk_num, nb_chunks);
     if (ret >= 0) {
+        if (op->start_ns) {
+            mirror_adapt_io_bytes(s, op);
+        }
         if (s->cow_bitmap) {
             bitmap_set(s->cow_bitmap, chunk_num, nb_chunks);
         }
@@ -127,6 +183,14 @@ static void mirror_iteration_done(MirrorOp *op, int ret)
     qemu_iovec_destroy(&op->qiov);
     g_free(op);
 
+    /* Each waiter checks again for conflicts and may queue up again, so
+     * only wake up those that were already waiting */
+    for (i = s->ops_done_waiters; i > 0; i--) {
+        if (!qemu_co_enter_next(&s->ops_done)) {
+            break;
+        }
+    }
+
     if (s->waiting_for_io) {
         qemu_coroutine_enter(s->common.co);
     }
@@ -272,6 +336,7 @@ static uint64_t mirror_do_read(MirrorBlockJob *s, int64_t offset,
     op->s = s;
     op->offset = offset;
     op->bytes = bytes;
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
     /* Now make a QEMUIOVector taking enough granularity-sized chunks
      * from s->buf_free.
@@ -321,6 +386,19 @@ static void mirror_do_zero_or_discard(MirrorBlockJob *s,
     }
 }
 
+/* Called when the dirty bitmap iterator wraps around.  Chunks that were
+ * copied in the pass that just ended and are dirty again are being
+ * rewritten by the guest; copying them right away is likely to be wasted,
+ * so the next pass leaves them for last. */
+static void mirror_start_pass(MirrorBlockJob *s)
+{
+    unsigned long *hot_bitmap = s->copied_bitmap;
+
+    s->copied_bitmap = s->hot_bitmap;
+    s->hot_bitmap = hot_bitmap;
+    bitmap_zero(s->copied_bitmap, DIV_ROUND_UP(s->bdev_length, s->granularity));
+}
+
 static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
 {
     BlockDriverState *source = s->source;
@@ -329,15 +407,28 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int64_t max_io_bytes = s->max_io_bytes;
+    /* Hot chunks are only postponed until the end of the pass, and not at
+     * all when the job is about to finish */
+    bool skip_hot = !s->should_complete && !block_job_is_cancelled(&s->common);
+    bool wrapped = false;
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
-    offset = bdrv_dirty_iter_next(s->dbi);
-    if (offset < 0) {
-        bdrv_set_dirty_iter(s->dbi, 0);
+    for (;;) {
         offset = bdrv_dirty_iter_next(s->dbi);
-        trace_mirror_restart_iter(s, bdrv_get_dirty_count(s->dirty_bitmap));
-        assert(offset >= 0);
+        if (offset < 0) {
+            assert(!wrapped);
+            mirror_start_pass(s);
+            bdrv_set_dirty_iter(s->dbi, 0);
+            trace_mirror_restart_iter(s, bdrv_get_dirty_count(s->dirty_bitmap));
+            wrapped = true;
+            continue;
+        }
+        if (wrapped || !skip_hot ||
+            !test_bit(offset / s->granularity, s->hot_bitmap)) {
+            break;
+        }
+        trace_mirror_skip_hot(s, offset);
     }
     bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
 
@@ -383,6 +474,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     bdrv_dirty_bitmap_unlock(s->dirty_bitmap);
 
     bitmap_set(s->in_flight_bitmap, offset / s->granularity, nb_chunks);
+    bitmap_set(s->copied_bitmap, offset / s->granularity, nb_chunks);
     while (nb_chunks > 0 && offset < s->bdev_length) {
         int ret;
         int64_t io_bytes;
@@ -456,6 +548,78 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     return delay_ns;
 }
 
+/* Wait until no background operation overlaps [offset, offset + bytes) */
+static void coroutine_fn mirror_wait_on_conflicts(MirrorBlockJob *s,
+                                                  int64_t offset,
+                                                  uint64_t bytes)
+{
+    int64_t start_chunk = offset / s->granularity;
+    int64_t end_chunk = DIV_ROUND_UP(offset + bytes, s->granularity);
+
+    while (find_next_bit(s->in_flight_bitmap, end_chunk, start_chunk) <
+           end_chunk) {
+        s->ops_done_waiters++;
+        qemu_co_queue_wait(&s->ops_done, NULL);
+        s->ops_done_waiters--;
+    }
+}
+
+/* In write-blocking mode, copy a guest write that has just completed on the
+ * source to the target, so that it does not leave dirty data behind.
+ * Background operations that cover the same area could otherwise overwrite
+ * the new data with what they read before, so wait for them first. */
+static void coroutine_fn mirror_active_write(MirrorBlockJob *s, bool zero,
+                                             int64_t offset, uint64_t bytes,
+                                             QEMUIOVector *qiov, int flags)
+{
+    int64_t chunk_start, chunk_end;
+    int ret;
+
+    /* A partial cluster would need COW from the source first, leave it to
+     * the background copy */
+    if (s->cow_bitmap &&
+        !QEMU_IS_ALIGNED(offset | bytes, s->target_cluster_size)) {
+        return;
+    }
+
+    s->active_writes_in_flight++;
+    mirror_wait_on_conflicts(s, offset, bytes);
+
+    /* Only chunks that are written as a whole become clean */
+    chunk_start = QEMU_ALIGN_UP(offset, s->granularity);
+    chunk_end = offset + bytes == s->bdev_length ? s->bdev_length :
+                QEMU_ALIGN_DOWN(offset + bytes, s->granularity);
+    if (chunk_end > chunk_start) {
+        bdrv_reset_dirty_bitmap(s->dirty_bitmap, chunk_start,
+                                chunk_end - chunk_start);
+    }
+
+    trace_mirror_active_write(s, offset, bytes, zero);
+    if (zero) {
+        ret = blk_co_pwrite_zeroes(s->target, offset, bytes, flags);
+    } else {
+        ret = blk_co_pwritev(s->target, offset, bytes, qiov, flags);
+    }
+
+    if (ret < 0) {
+        BlockErrorAction action;
+
+        bdrv_set_dirty_bitmap(s->dirty_bitmap, offset, bytes);
+        action = mirror_error_action(s, false, -ret);
+        if (action == BLOCK_ERROR_ACTION_REPORT && s->ret >= 0) {
+            s->ret = ret;
+        }
+    } else if (s->cow_bitmap) {
+        bitmap_set(s->cow_bitmap, offset / s->granularity,
+                   bytes / s->granularity);
+    }
+
+    s->active_writes_in_flight--;
+    if (s->waiting_for_io) {
+        qemu_coroutine_enter(s->common.co);
+    }
+}
+
 static void mirror_free_init(MirrorBlockJob *s)
 {
     int granularity = s->granularity;
@@ -496,8 +660,12 @@ static void mirror_exit(BlockJob *job, void *opaque)
     BlockDriverState *src = s->source;
     BlockDriverState *target_bs = blk_bs(s->target);
     BlockDriverState *mirror_top_bs = s->mirror_top_bs;
+    MirrorBDSOpaque *bs_opaque = mirror_top_bs->opaque;
     Error *local_err = NULL;
 
+    /* Guest writes must not look at the job any more */
+    bs_opaque->job = NULL;
+
     bdrv_release_dirty_bitmap(src, s->dirty_bitmap);
 
     /* Make sure that the source BDS doesn't go away before we called
@@ -742,6 +910,8 @@ static void coroutine_fn mirror_run(void *opaque)
 
     length = DIV_ROUND_UP(s->bdev_length, s->granularity);
     s->in_flight_bitmap = bitmap_new(length);
+    s->copied_bitmap = bitmap_new(length);
+    s->hot_bitmap = bitmap_new(length);
 
     /* If we have no backing file yet in the destination, we cannot let
      * the destination do COW.  Instead, we copy sectors around the
@@ -760,6 +930,8 @@ static void coroutine_fn mirror_run(void *opaque)
         s->cow_bitmap = bitmap_new(length);
     }
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
+    s->max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    s->active_write_ready = true;
 
     s->buf = qemu_try_blockalign(bs, s->buf_size);
     if (s->buf == NULL) {
@@ -882,6 +1054,12 @@ static void coroutine_fn mirror_run(void *opaque)
     }
 
 immediate_exit:
+    /* Active writes use the bitmaps freed below */
+    s->active_write_ready = false;
+    while (s->active_writes_in_flight > 0) {
+        mirror_wait_for_io(s);
+    }
+
     if (s->in_flight > 0) {
         /* We get here only if something went wrong.  Either the job failed,
          * or it was cancelled prematurely so that we do not guarantee that
@@ -896,6 +1074,8 @@ immediate_exit:
     qemu_vfree(s->buf);
     g_free(s->cow_bitmap);
     g_free(s->in_flight_bitmap);
+    g_free(s->copied_bitmap);
+    g_free(s->hot_bitmap);
     bdrv_dirty_iter_free(s->dbi);
 
     data = g_malloc(sizeof(*data));
@@ -1027,10 +1207,28 @@ static int coroutine_fn bdrv_mirror_top_preadv(BlockDriverState *bs,
     return bdrv_co_preadv(bs->backing, offset, bytes, qiov, flags);
 }
 
+/* Whether a guest write that completed on the source must be copied to the
+ * target right away */
+static bool bdrv_mirror_top_copy_to_target(BlockDriverState *bs)
+{
+    MirrorBDSOpaque *s = bs->opaque;
+
+    return s->job && s->job->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING &&
+           s->job->active_write_ready && s->job->ret >= 0;
+}
+
 static int coroutine_fn bdrv_mirror_top_pwritev(BlockDriverState *bs,
     uint64_t offset, uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
-    return bdrv_co_pwritev(bs->backing, offset, bytes, qiov, flags);
+    MirrorBDSOpaque *s = bs->opaque;
+    int ret;
+
+    ret = bdrv_co_pwritev(bs->backing, offset, bytes, qiov, flags);
+    if (ret >= 0 && bdrv_mirror_top_copy_to_target(bs)) {
+        mirror_active_write(s->job, false, offset, bytes, qiov,
+                            flags & BDRV_REQ_FUA);
+    }
+    return ret;
 }
 
 static int coroutine_fn bdrv_mirror_top_flush(BlockDriverState *bs)
@@ -1045,9 +1243,18 @@ static int coroutine_fn bdrv_mirror_top_flush(BlockDriverState *bs)
 static int coroutine_fn bdrv_mirror_top_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int bytes, BdrvRequestFlags flags)
 {
-    return bdrv_co_pwrite_zeroes(bs->backing, offset, bytes, flags);
+    MirrorBDSOpaque *s = bs->opaque;
+    int ret;
+
+    ret = bdrv_co_pwrite_zeroes(bs->backing, offset, bytes, flags);
+    if (ret >= 0 && bdrv_mirror_top_copy_to_target(bs)) {
+        mirror_active_write(s->job, true, offset, bytes, NULL, flags);
+    }
+    return ret;
 }
 
+/* Discarded data may read back as anything, so it is left to the background
+ * copy even in write-blocking mode */
 static int coroutine_fn bdrv_mirror_top_pdiscard(BlockDriverState *bs,
     int64_t offset, int bytes)
 {
@@ -1089,6 +1296,7 @@ static void bdrv_mirror_top_child_perm(BlockDriverState *bs, BdrvChild *c,
  * from its backing file and that allows writes on the backing file chain. */
 static BlockDriver bdrv_mirror_top = {
     .format_name                = "mirror_top",
+    .instance_size              = sizeof(MirrorBDSOpaque),
     .bdrv_co_preadv             = bdrv_mirror_top_preadv,
     .bdrv_co_pwritev            = bdrv_mirror_top_pwritev,
     .bdrv_co_pwrite_zeroes      = bdrv_mirror_top_pwrite_zeroes,
@@ -1113,10 +1321,11 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
                              const BlockJobDriver *driver,
                              bool is_none_mode, BlockDriverState *base,
                              bool auto_complete, const char *filter_node_name,
-                             bool is_mirror,
+                             bool is_mirror, MirrorCopyMode copy_mode,
                              Error **errp)
 {
     MirrorBlockJob *s;
+    MirrorBDSOpaque *bs_opaque;
     BlockDriverState *mirror_top_bs;
     bool target_graph_mod;
     bool target_is_backing;
@@ -1179,6 +1388,8 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
 
     s->source = bs;
     s->mirror_top_bs = mirror_top_bs;
+    s->copy_mode = copy_mode;
+    qemu_co_queue_init(&s->ops_done);
 
     /* No resize for the target either; while the mirror is still running, a
      * consistent read isn't necessarily possible. We could possibly allow
@@ -1250,6 +1461,9 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
         }
     }
 
+    bs_opaque = mirror_top_bs->opaque;
+    bs_opaque->job = s;
+
     trace_mirror_start(bs, s, opaque);
     block_job_start(&s->common);
     return;
@@ -1278,7 +1492,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
-                  bool unmap, const char *filter_node_name, Error **errp)
+                  bool unmap, const char *filter_node_name,
+                  MirrorCopyMode copy_mode, Error **errp)
 {
     bool is_none_mode;
     BlockDriverState *base;
@@ -1293,7 +1508,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                      speed, granularity, buf_size, backing_mode,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
-                     filter_node_name, true, errp);
+                     filter_node_name, true, copy_mode, errp);
 }
 
 void commit_active_start(const char *job_id, BlockDriverState *bs,
@@ -1316,7 +1531,8 @@ void commit_active_start(const char *job_id, BlockDriverState *bs,
                      MIRROR_LEAVE_BACKING_CHAIN,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
-                     filter_node_name, false, &local_err);
+                     filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
+                     &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         goto error_restore_flags;
@@ -47,10 +47,8 @@ static void nbd_recv_coroutines_wake_all(NBDClientSession *s)
     }
 }
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_teardown_connection(NBDClientSession *client)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
-
     if (!client->ioc) { /* Already closed */
         return;
     }
@@ -59,9 +57,9 @@ static void nbd_teardown_connection(BlockDriverState *bs)
     qio_channel_shutdown(client->ioc,
                          QIO_CHANNEL_SHUTDOWN_BOTH,
                          NULL);
-    BDRV_POLL_WHILE(bs, client->read_reply_co);
+    BDRV_POLL_WHILE(client->bs, client->read_reply_co);
 
-    nbd_client_detach_aio_context(bs);
+    qio_channel_detach_aio_context(QIO_CHANNEL(client->ioc));
     object_unref(OBJECT(client->sioc));
     client->sioc = NULL;
     object_unref(OBJECT(client->ioc));
@@ -118,11 +116,30 @@ static coroutine_fn void nbd_read_reply_entry(void *opaque)
     s->read_reply_co = NULL;
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+/* nbd_client_pick_session
+ * Choose the connection for a new request.  With a single connection
+ * this is always the main session; otherwise take the one with the
+ * fewest requests in flight, so that the requests of a busy device are
+ * striped over all sockets and their reply coroutines. */
+static NBDClientSession *nbd_client_pick_session(BlockDriverState *bs)
+{
+    int nb_sessions;
+    NBDClientSession *sessions = nbd_get_client_sessions(bs, &nb_sessions);
+    NBDClientSession *best = &sessions[0];
+    int i;
+
+    for (i = 1; i < nb_sessions && best->in_flight; i++) {
+        if (sessions[i].in_flight < best->in_flight) {
+            best = &sessions[i];
+        }
+    }
+    return best;
+}
+
+static int nbd_co_send_request(NBDClientSession *s,
                                NBDRequest *request,
                                QEMUIOVector *qiov)
 {
-    NBDClientSession *s = nbd_get_client_session(bs);
     int rc, i;
 
     qemu_co_mutex_lock(&s->send_mutex);
@@ -228,6 +245,46 @@ static int nbd_parse_offset_hole_payload(NBDStructuredReplyChunk *chunk,
     return 0;
 }
 
+/* nbd_parse_blockstatus_payload
+ * support only one extent in reply and only for
+ * base:allocation context
+ */
+static int nbd_parse_blockstatus_payload(NBDClientSession *client,
+                                         NBDStructuredReplyChunk *chunk,
+                                         uint8_t *payload, uint64_t orig_length,
+                                         NBDExtent *extent, Error **errp)
+{
+    uint32_t context_id;
+
+    /* We asked for NBD_CMD_FLAG_REQ_ONE, so the server must send exactly
+     * one extent */
+    if (chunk->length != sizeof(context_id) + sizeof(*extent)) {
+        error_setg(errp, "Protocol error: invalid payload for "
+                         "NBD_REPLY_TYPE_BLOCK_STATUS");
+        return -EINVAL;
+    }
+
+    context_id = payload_advance32(&payload);
+    if (client->info.meta_base_allocation_id != context_id) {
+        error_setg(errp, "Protocol error: unexpected context id %" PRIu32
+                   " for NBD_REPLY_TYPE_BLOCK_STATUS, when negotiated "
+                   "context id is %" PRIu32, context_id,
+                   client->info.meta_base_allocation_id);
+        return -EINVAL;
+    }
+
+    extent->length = payload_advance32(&payload);
+    extent->flags = payload_advance32(&payload);
+
+    if (extent->length == 0 || extent->length > orig_length) {
+        error_setg(errp, "Protocol error: server sent status chunk with "
+                   "invalid length");
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
 /* nbd_parse_error_payload
  * on success @errp contains message describing nbd error reply
  */
@@ -640,12 +697,74 @@ static int nbd_co_receive_cmdread_reply(NBDClientSession *s, uint64_t handle,
     return iter.ret;
 }
 
-static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
+static int nbd_co_receive_blockstatus_reply(NBDClientSession *s,
+                                            uint64_t handle, uint64_t length,
+                                            NBDExtent *extent, Error **errp)
+{
+    NBDReplyChunkIter iter;
+    NBDReply reply;
+    void *payload = NULL;
+    Error *local_err = NULL;
+    bool received = false;
+
+    assert(!extent->length);
+    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, s->info.structured_reply,
+                            NULL, &reply, &payload)
+    {
+        int ret;
+        NBDStructuredReplyChunk *chunk = &reply.structured;
+
+        assert(nbd_reply_is_structured(&reply));
+
+        switch (chunk->type) {
+        case NBD_REPLY_TYPE_BLOCK_STATUS:
+            if (received) {
+                s->quit = true;
+                error_setg(&local_err, "Several BLOCK_STATUS chunks in reply");
+                nbd_iter_error(&iter, true, -EINVAL, &local_err);
+            }
+            received = true;
+
+            ret = nbd_parse_blockstatus_payload(s, &reply.structured,
+                                                payload, length, extent,
+                                                &local_err);
+            if (ret < 0) {
+                s->quit = true;
+                nbd_iter_error(&iter, true, ret, &local_err);
+            }
+            break;
+        default:
+            if (!nbd_reply_type_is_error(chunk->type)) {
+                /* not allowed reply type */
+                s->quit = true;
+                error_setg(&local_err,
+                           "Unexpected reply type: %d (%s) "
+                           "for CMD_BLOCK_STATUS",
+                           chunk->type, nbd_reply_type_lookup(chunk->type));
+                nbd_iter_error(&iter, true, -EINVAL, &local_err);
+            }
+        }
+
+        g_free(payload);
+        payload = NULL;
+    }
+
+    if (!extent->length && !iter.err) {
+        error_setg(&iter.err,
+                   "Server did not reply with any status extents");
+        if (!iter.ret) {
+            iter.ret = -EIO;
+        }
+    }
+    error_propagate(errp, iter.err);
+    return iter.ret;
+}
+
+static int nbd_co_request(NBDClientSession *client, NBDRequest *request,
                           QEMUIOVector *write_qiov)
 {
     int ret;
     Error *local_err = NULL;
-    NBDClientSession *client = nbd_get_client_session(bs);
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -654,7 +773,7 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     } else {
         assert(request->type != NBD_CMD_WRITE);
     }
-    ret = nbd_co_send_request(bs, request, write_qiov);
+    ret = nbd_co_send_request(client, request, write_qiov);
     if (ret < 0) {
         return ret;
     }
@@ -671,7 +790,7 @@ int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
 {
     int ret;
     Error *local_err = NULL;
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *client = nbd_client_pick_session(bs);
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -684,7 +803,7 @@ int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
-    ret = nbd_co_send_request(bs, &request, NULL);
+    ret = nbd_co_send_request(client, &request, NULL);
     if (ret < 0) {
         return ret;
     }
@@ -700,7 +819,7 @@ int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
 int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
                           uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *client = nbd_client_pick_session(bs);
     NBDRequest request = {
         .type = NBD_CMD_WRITE,
         .from = offset,
@@ -718,13 +837,13 @@ int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, qiov);
+    return nbd_co_request(client, &request, qiov);
 }
 
 int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
                                 int bytes, BdrvRequestFlags flags)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *client = nbd_client_pick_session(bs);
     NBDRequest request = {
         .type = NBD_CMD_WRITE_ZEROES,
         .from = offset,
@@ -747,12 +866,14 @@ int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(client, &request, NULL);
 }
 
 int nbd_client_co_flush(BlockDriverState *bs)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
+    /* With several connections the server promised NBD_FLAG_CAN_MULTI_CONN,
+     * so a flush on any of them covers the writes completed on all. */
+    NBDClientSession *client = nbd_client_pick_session(bs);
     NBDRequest request = { .type = NBD_CMD_FLUSH };
 
     if (!(client->info.flags & NBD_FLAG_SEND_FLUSH)) {
@@ -762,12 +883,12 @@ int nbd_client_co_flush(BlockDriverState *bs)
     request.from = 0;
     request.len = 0;
 
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(client, &request, NULL);
 }
 
 int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset, int bytes)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *client = nbd_client_pick_session(bs);
     NBDRequest request = {
         .type = NBD_CMD_TRIM,
         .from = offset,
@@ -779,45 +900,120 @@ int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset, int bytes)
         return 0;
     }
 
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(client, &request, NULL);
+}
+
+int64_t coroutine_fn nbd_client_co_get_block_status(BlockDriverState *bs,
+                                                    int64_t sector_num,
+                                                    int nb_sectors, int *pnum,
+                                                    BlockDriverState **file)
+{
+    int64_t ret;
+    NBDExtent extent = { 0 };
+    NBDClientSession *client = nbd_client_pick_session(bs);
+    Error *local_err = NULL;
+    uint64_t offset = sector_num * BDRV_SECTOR_SIZE;
+    uint32_t align = MAX(bs->bl.request_alignment, BDRV_SECTOR_SIZE);
+    uint32_t length;
+    NBDRequest request = {
+        .type = NBD_CMD_BLOCK_STATUS,
+        .from = offset,
+        .flags = NBD_CMD_FLAG_REQ_ONE,
+    };
+
+    *file = bs;
+    if (!client->info.base_allocation) {
+        *pnum = nb_sectors;
+        return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID | offset;
+    }
+
+    length = MIN((uint64_t)nb_sectors * BDRV_SECTOR_SIZE,
+                 QEMU_ALIGN_DOWN(INT_MAX, align));
+    request.len = MIN(length, client->info.size - offset);
+
+    ret = nbd_co_send_request(client, &request, NULL);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = nbd_co_receive_blockstatus_reply(client, request.handle, request.len,
+                                           &extent, &local_err);
+    if (local_err) {
+        error_report_err(local_err);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* The block layer wants an aligned answer.  A server is free to
+     * report a status change at any byte, though; treat an extent that
+     * is too short to be rounded down as data, which is always safe. */
+    if (extent.length < align) {
+        *pnum = align >> BDRV_SECTOR_BITS;
+        return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID | offset;
+    }
+    *pnum = QEMU_ALIGN_DOWN(extent.length, align) >> BDRV_SECTOR_BITS;
+
+    return (extent.flags & NBD_STATE_HOLE ? 0 : BDRV_BLOCK_DATA) |
+           (extent.flags & NBD_STATE_ZERO ? BDRV_BLOCK_ZERO : 0) |
+           BDRV_BLOCK_OFFSET_VALID | offset;
 }
 
 void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
-    qio_channel_detach_aio_context(QIO_CHANNEL(client->ioc));
+    int i, nb_sessions;
+    NBDClientSession *sessions = nbd_get_client_sessions(bs, &nb_sessions);
+
+    for (i = 0; i < nb_sessions; i++) {
+        qio_channel_detach_aio_context(QIO_CHANNEL(sessions[i].ioc));
+    }
 }
 
 void nbd_client_attach_aio_context(BlockDriverState *bs,
                                    AioContext *new_context)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
-    qio_channel_attach_aio_context(QIO_CHANNEL(client->ioc), new_context);
-    aio_co_schedule(new_context, client->read_reply_co);
+    int i, nb_sessions;
+    NBDClientSession *sessions = nbd_get_client_sessions(bs, &nb_sessions);
+
+    for (i = 0; i < nb_sessions; i++) {
+        qio_channel_attach_aio_context(QIO_CHANNEL(sessions[i].ioc),
+                                       new_context);
+        aio_co_schedule(new_context, sessions[i].read_reply_co);
+    }
 }
 
 void nbd_client_close(BlockDriverState *bs)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
+    int i, nb_sessions;
+    NBDClientSession *sessions = nbd_get_client_sessions(bs, &nb_sessions);
     NBDRequest request = { .type = NBD_CMD_DISC };
 
-    if (client->ioc == NULL) {
-        return;
-    }
+    for (i = 0; i < nb_sessions; i++) {
+        NBDClientSession *client = &sessions[i];
 
-    nbd_send_request(client->ioc, &request);
+        if (client->ioc == NULL) {
+            continue;
+        }
+
+        nbd_send_request(client->ioc, &request);
 
-    nbd_teardown_connection(bs);
+        nbd_teardown_connection(client);
+    }
 }
 
+/* nbd_client_init
+ * Negotiate over @sioc and start the reply coroutine of @client, which
+ * is one of the sessions of @bs.  The first session determines the
+ * properties of the export; any further one must agree with it. */
 int nbd_client_init(BlockDriverState *bs,
+                    NBDClientSession *client,
                     QIOChannelSocket *sioc,
                     const char *export,
                     QCryptoTLSCreds *tlscreds,
                     const char *hostname,
                     Error **errp)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *primary = nbd_get_client_session(bs);
     int ret;
 
     /* NBD handshake */
@@ -826,6 +1022,7 @@ int nbd_client_init(BlockDriverState *bs,
 
     client->info.request_sizes = true;
     client->info.structured_reply = true;
+    client->info.base_allocation = true;
     ret = nbd_receive_negotiate(QIO_CHANNEL(sioc), export,
                                 tlscreds, hostname,
                                 &client->ioc, &client->info, errp);
@@ -833,6 +1030,19 @@ int nbd_client_init(BlockDriverState *bs,
         logout("Failed to negotiate with the NBD server\n");
         return ret;
     }
+    if (client != primary &&
+        (client->info.size != primary->info.size ||
+         client->info.flags != primary->info.flags ||
+         client->info.structured_reply != primary->info.structured_reply ||
+         client->info.base_allocation != primary->info.base_allocation)) {
+        error_setg(errp, "NBD server changed the export properties between "
+                   "connections");
+        if (client->ioc) {
+            object_unref(OBJECT(client->ioc));
+            client->ioc = NULL;
+        }
+        return -EINVAL;
+    }
     if (client->info.flags & NBD_FLAG_READ_ONLY &&
         !bdrv_is_read_only(bs)) {
         error_setg(errp,
@@ -852,6 +1062,7 @@ int nbd_client_init(BlockDriverState *bs,
 
     qemu_co_mutex_init(&client->send_mutex);
     qemu_co_queue_init(&client->free_sema);
+    client->bs = bs;
     client->sioc = sioc;
     object_ref(OBJECT(client->sioc));
 
@@ -864,7 +1075,9 @@ int nbd_client_init(BlockDriverState *bs,
      * kick the reply mechanism.  */
     qio_channel_set_blocking(QIO_CHANNEL(sioc), false, NULL);
     client->read_reply_co = qemu_coroutine_create(nbd_read_reply_entry, client);
-    nbd_client_attach_aio_context(bs, bdrv_get_aio_context(bs));
+    qio_channel_attach_aio_context(QIO_CHANNEL(client->ioc),
+                                   bdrv_get_aio_context(bs));
+    aio_co_schedule(bdrv_get_aio_context(bs), client->read_reply_co);
 
     logout("Established connection with NBD server\n");
     return 0;
@@ -17,6 +17,9 @@
 
 #define MAX_NBD_REQUESTS    16
 
+/* Maximum number of sockets connected to the server for one node */
+#define NBD_MAX_CONNECTIONS 16
+
 typedef struct {
     Coroutine *coroutine;
     uint64_t offset;        /* original offset of the request */
@@ -36,11 +39,16 @@ typedef struct NBDClientSession {
     NBDClientRequest requests[MAX_NBD_REQUESTS];
     NBDReply reply;
     bool quit;
+
+    BlockDriverState *bs;
 } NBDClientSession;
 
 NBDClientSession *nbd_get_client_session(BlockDriverState *bs);
+NBDClientSession *nbd_get_client_sessions(BlockDriverState *bs,
+                                          int *nb_sessions);
 
 int nbd_client_init(BlockDriverState *bs,
+                    NBDClientSession *client,
                     QIOChannelSocket *sock,
                     const char *export_name,
                     QCryptoTLSCreds *tlscreds,
@@ -56,6 +64,10 @@ int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
                                 int bytes, BdrvRequestFlags flags);
 int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
                          uint64_t bytes, QEMUIOVector *qiov, int flags);
+int64_t coroutine_fn nbd_client_co_get_block_status(BlockDriverState *bs,
+                                                    int64_t sector_num,
+                                                    int nb_sectors, int *pnum,
+                                                    BlockDriverState **file);
 
 void nbd_client_detach_aio_context(BlockDriverState *bs);
 void nbd_client_attach_aio_context(BlockDriverState *bs,
@@ -39,11 +39,15 @@
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qstring.h"
 #include "qemu/cutils.h"
+#include "qemu/error-report.h"
 
 #define EN_OPTSTR ":exportname="
 
 typedef struct BDRVNBDState {
-    NBDClientSession client;
+    /* client[0] is the main session; the others are only used when the
+     * server allows several connections to the export */
+    NBDClientSession client[NBD_MAX_CONNECTIONS];
+    int connections;
 
     /* For nbd_refresh_filename() */
     SocketAddress *saddr;
@@ -302,7 +306,15 @@ done:
 NBDClientSession *nbd_get_client_session(BlockDriverState *bs)
 {
     BDRVNBDState *s = bs->opaque;
-    return &s->client;
+    return &s->client[0];
+}
+
+NBDClientSession *nbd_get_client_sessions(BlockDriverState *bs,
+                                          int *nb_sessions)
+{
+    BDRVNBDState *s = bs->opaque;
+    *nb_sessions = s->connections;
+    return s->client;
 }
 
 static QIOChannelSocket *nbd_establish_connection(SocketAddress *saddr,
@@ -388,6 +400,12 @@ static QemuOptsList nbd_runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "ID of the TLS credentials to use",
         },
+        {
+            .name = "connections",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of sockets to stripe requests over "
+                    "(default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -401,6 +419,8 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     QIOChannelSocket *sioc = NULL;
     QCryptoTLSCreds *tlscreds = NULL;
     const char *hostname = NULL;
+    uint64_t connections;
+    int i;
     int ret = -EINVAL;
 
     opts = qemu_opts_create(&nbd_runtime_opts, NULL, 0, &error_abort);
@@ -423,6 +443,13 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
 
     s->export = g_strdup(qemu_opt_get(opts, "export"));
 
+    connections = qemu_opt_get_number(opts, "connections", 1);
+    if (connections < 1 || connections > NBD_MAX_CONNECTIONS) {
+        error_setg(errp, "connections must be between 1 and %d",
+                   NBD_MAX_CONNECTIONS);
+        goto error;
+    }
+
     s->tlscredsid = g_strdup(qemu_opt_get(opts, "tls-creds"));
     if (s->tlscredsid) {
         tlscreds = nbd_get_tls_creds(s->tlscredsid, errp);
@@ -438,18 +465,36 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         hostname = s->saddr->u.inet.host;
     }
 
-    /* establish TCP connection, return error if it fails
-     * TODO: Configurable retry-until-timeout behaviour.
-     */
-    sioc = nbd_establish_connection(s->saddr, errp);
-    if (!sioc) {
-        ret = -ECONNREFUSED;
-        goto error;
+    for (i = 0; i < connections; i++) {
+        /* establish TCP connection, return error if it fails
+         * TODO: Configurable retry-until-timeout behaviour.
+         */
+        sioc = nbd_establish_connection(s->saddr, errp);
+        if (!sioc) {
+            ret = -ECONNREFUSED;
+            goto error;
+        }
+
+        /* NBD handshake */
+        ret = nbd_client_init(bs, &s->client[i], sioc, s->export,
+                              tlscreds, hostname, errp);
+        object_unref(OBJECT(sioc));
+        sioc = NULL;
+        if (ret < 0) {
+            goto error;
+        }
+        s->connections++;
+
+        /* Only a server that keeps all its connections coherent may be
+         * used by several of them at once */
+        if (i == 0 && connections > 1 &&
+            !(s->client[0].info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+            warn_report("NBD server does not support multiple connections "
+                        "to this export, using only one");
+            break;
+        }
     }
 
-    /* NBD handshake */
-    ret = nbd_client_init(bs, sioc, s->export,
-                          tlscreds, hostname, errp);
  error:
     if (sioc) {
         object_unref(OBJECT(sioc));
@@ -458,6 +503,8 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
         object_unref(OBJECT(tlscreds));
     }
     if (ret < 0) {
+        nbd_client_close(bs);
+        s->connections = 0;
         qapi_free_SocketAddress(s->saddr);
         g_free(s->export);
         g_free(s->tlscredsid);
@@ -501,7 +548,7 @@ static int64_t nbd_getlength(BlockDriverState *bs)
 {
     BDRVNBDState *s = bs->opaque;
 
-    return s->client.info.size;
+    return s->client[0].info.size;
 }
 
 static void nbd_detach_aio_context(BlockDriverState *bs)
@@ -561,6 +608,9 @@ static void nbd_refresh_filename(BlockDriverState *bs, QDict *options)
     if (s->tlscredsid) {
         qdict_put_str(opts, "tls-creds", s->tlscredsid);
     }
+    if (s->connections > 1) {
+        qdict_put_int(opts, "connections", s->connections);
+    }
 
     qdict_flatten(opts);
     bs->full_open_options = opts;
@@ -578,6 +628,7 @@ static BlockDriver bdrv_nbd = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_co_get_block_status   = nbd_client_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -597,6 +648,7 @@ static BlockDriver bdrv_nbd_tcp = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_co_get_block_status   = nbd_client_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -616,6 +668,7 @@ static BlockDriver bdrv_nbd_unix = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_co_get_block_status   = nbd_client_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -28,6 +28,7 @@
 #include "block/throttle-groups.h"
 #include "block/write-threshold.h"
 #include "qmp-commands.h"
+#include "qapi-event.h"
 #include "qapi-visit.h"
 #include "qapi/qobject-output-visitor.h"
 #include "qapi/qmp/types.h"
@@ -389,33 +390,58 @@ static void bdrv_query_info(BlockBackend *blk, BlockInfo **p_info,
     qapi_free_BlockInfo(info);
 }
 
+/* Returns NULL if no request of @type has been accounted */
+static BlockLatencyPercentiles *
+bdrv_query_latency_percentiles(BlockAcctStats *stats, BlockAcctTimedStats *ts,
+                               enum BlockAcctType type)
+{
+    static const double percentiles[] = { 50, 99, 99.9 };
+    uint64_t values[ARRAY_SIZE(percentiles)];
+    BlockLatencyPercentiles *p;
+
+    if (!block_acct_latency_percentiles(stats, ts, type, percentiles, values,
+                                        ARRAY_SIZE(percentiles))) {
+        return NULL;
+    }
+
+    p = g_new0(BlockLatencyPercentiles, 1);
+    p->p50 = values[0];
+    p->p99 = values[1];
+    p->p999 = values[2];
+    return p;
+}
+
 static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
 {
     BlockAcctStats *stats = blk_get_stats(blk);
     BlockAcctTimedStats *ts = NULL;
 
-    ds->rd_bytes = stats->nr_bytes[BLOCK_ACCT_READ];
-    ds->wr_bytes = stats->nr_bytes[BLOCK_ACCT_WRITE];
-    ds->rd_operations = stats->nr_ops[BLOCK_ACCT_READ];
-    ds->wr_operations = stats->nr_ops[BLOCK_ACCT_WRITE];
+    ds->rd_bytes = stat64_get(&stats->nr_bytes[BLOCK_ACCT_READ]);
+    ds->wr_bytes = stat64_get(&stats->nr_bytes[BLOCK_ACCT_WRITE]);
+    ds->rd_operations = stat64_get(&stats->nr_ops[BLOCK_ACCT_READ]);
+    ds->wr_operations = stat64_get(&stats->nr_ops[BLOCK_ACCT_WRITE]);
 
-    ds->failed_rd_operations = stats->failed_ops[BLOCK_ACCT_READ];
-    ds->failed_wr_operations = stats->failed_ops[BLOCK_ACCT_WRITE];
-    ds->failed_flush_operations = stats->failed_ops[BLOCK_ACCT_FLUSH];
+    ds->failed_rd_operations = stat64_get(&stats->failed_ops[BLOCK_ACCT_READ]);
+    ds->failed_wr_operations = stat64_get(&stats->failed_ops[BLOCK_ACCT_WRITE]);
+    ds->failed_flush_operations =
+        stat64_get(&stats->failed_ops[BLOCK_ACCT_FLUSH]);
 
-    ds->invalid_rd_operations = stats->invalid_ops[BLOCK_ACCT_READ];
-    ds->invalid_wr_operations = stats->invalid_ops[BLOCK_ACCT_WRITE];
+    ds->invalid_rd_operations =
+        stat64_get(&stats->invalid_ops[BLOCK_ACCT_READ]);
+    ds->invalid_wr_operations =
+        stat64_get(&stats->invalid_ops[BLOCK_ACCT_WRITE]);
     ds->invalid_flush_operations =
-        stats->invalid_ops[BLOCK_ACCT_FLUSH];
+        stat64_get(&stats->invalid_ops[BLOCK_ACCT_FLUSH]);
 
-    ds->rd_merged = stats->merged[BLOCK_ACCT_READ];
-    ds->wr_merged = stats->merged[BLOCK_ACCT_WRITE];
-    ds->flush_operations = stats->nr_ops[BLOCK_ACCT_FLUSH];
-    ds->wr_total_time_ns = stats->total_time_ns[BLOCK_ACCT_WRITE];
-    ds->rd_total_time_ns = stats->total_time_ns[BLOCK_ACCT_READ];
-    ds->flush_total_time_ns = stats->total_time_ns[BLOCK_ACCT_FLUSH];
+    ds->rd_merged = stat64_get(&stats->merged[BLOCK_ACCT_READ]);
+    ds->wr_merged = stat64_get(&stats->merged[BLOCK_ACCT_WRITE]);
+    ds->flush_operations = stat64_get(&stats->nr_ops[BLOCK_ACCT_FLUSH]);
+    ds->wr_total_time_ns = stat64_get(&stats->total_time_ns[BLOCK_ACCT_WRITE]);
+    ds->rd_total_time_ns = stat64_get(&stats->total_time_ns[BLOCK_ACCT_READ]);
+    ds->flush_total_time_ns =
+        stat64_get(&stats->total_time_ns[BLOCK_ACCT_FLUSH]);
 
-    ds->has_idle_time_ns = stats->last_access_time_ns > 0;
+    ds->has_idle_time_ns = stat64_get(&stats->last_access_time_ns) > 0;
     if (ds->has_idle_time_ns) {
         ds->idle_time_ns = block_acct_idle_time_ns(stats);
     }
@@ -423,6 +449,16 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
     ds->account_invalid = stats->account_invalid;
     ds->account_failed = stats->account_failed;
 
+    ds->rd_latency_percentiles =
+        bdrv_query_latency_percentiles(stats, NULL, BLOCK_ACCT_READ);
+    ds->has_rd_latency_percentiles = !!ds->rd_latency_percentiles;
+    ds->wr_latency_percentiles =
+        bdrv_query_latency_percentiles(stats, NULL, BLOCK_ACCT_WRITE);
+    ds->has_wr_latency_percentiles = !!ds->wr_latency_percentiles;
+    ds->flush_latency_percentiles =
+        bdrv_query_latency_percentiles(stats, NULL, BLOCK_ACCT_FLUSH);
+    ds->has_flush_latency_percentiles = !!ds->flush_latency_percentiles;
+
     while ((ts = block_acct_interval_next(stats, ts))) {
         BlockDeviceTimedStatsList *timed_stats =
             g_malloc0(sizeof(*timed_stats));
@@ -453,6 +489,19 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
             block_acct_queue_depth(ts, BLOCK_ACCT_READ);
         dev_stats->avg_wr_queue_depth =
             block_acct_queue_depth(ts, BLOCK_ACCT_WRITE);
+
+        dev_stats->rd_latency_percentiles =
+            bdrv_query_latency_percentiles(stats, ts, BLOCK_ACCT_READ);
+        dev_stats->has_rd_latency_percentiles =
+            !!dev_stats->rd_latency_percentiles;
+        dev_stats->wr_latency_percentiles =
+            bdrv_query_latency_percentiles(stats, ts, BLOCK_ACCT_WRITE);
+        dev_stats->has_wr_latency_percentiles =
+            !!dev_stats->wr_latency_percentiles;
+        dev_stats->flush_latency_percentiles =
+            bdrv_query_latency_percentiles(stats, ts, BLOCK_ACCT_FLUSH);
+        dev_stats->has_flush_latency_percentiles =
+            !!dev_stats->flush_latency_percentiles;
     }
 }
 
@@ -568,6 +617,115 @@ BlockStatsList *qmp_query_blockstats(bool has_query_nodes,
     return head;
 }
 
+typedef struct BlockStatsSnapshot {
+    uint64_t rd_bytes;
+    uint64_t wr_bytes;
+    uint64_t rd_operations;
+    uint64_t wr_operations;
+    uint64_t flush_operations;
+} BlockStatsSnapshot;
+
+static QEMUTimer *block_stats_timer;
+static int64_t block_stats_period;
+/* Counters reported in the last event, indexed by BlockBackend name */
+static GHashTable *block_stats_last;
+
+static void block_stats_snapshot(BlockBackend *blk, BlockStatsSnapshot *snap)
+{
+    BlockAcctStats *stats = blk_get_stats(blk);
+
+    snap->rd_bytes = stat64_get(&stats->nr_bytes[BLOCK_ACCT_READ]);
+    snap->wr_bytes = stat64_get(&stats->nr_bytes[BLOCK_ACCT_WRITE]);
+    snap->rd_operations = stat64_get(&stats->nr_ops[BLOCK_ACCT_READ]);
+    snap->wr_operations = stat64_get(&stats->nr_ops[BLOCK_ACCT_WRITE]);
+    snap->flush_operations = stat64_get(&stats->nr_ops[BLOCK_ACCT_FLUSH]);
+}
+
+static void block_stats_timer_cb(void *opaque)
+{
+    BlockStatsDeltaList *head = NULL, **p_next = &head;
+    BlockBackend *blk;
+
+    /* The counters are Stat64, so no AioContext needs to be acquired */
+    for (blk = blk_next(NULL); blk; blk = blk_next(blk)) {
+        const char *name = blk_name(blk);
+        BlockStatsSnapshot cur, *last;
+        BlockStatsDeltaList *info;
+
+        if (!*name) {
+            continue;
+        }
+
+        block_stats_snapshot(blk, &cur);
+        last = g_hash_table_lookup(block_stats_last, name);
+        if (!last) {
+            last = g_new0(BlockStatsSnapshot, 1);
+            g_hash_table_insert(block_stats_last, g_strdup(name), last);
+        }
+        if (!memcmp(&cur, last, sizeof(cur))) {
+            continue;
+        }
+        if (cur.rd_operations < last->rd_operations ||
+            cur.wr_operations < last->wr_operations ||
+            cur.flush_operations < last->flush_operations) {
+            /* A new device took over the name, report it from scratch */
+            memset(last, 0, sizeof(*last));
+        }
+
+        info = g_malloc0(sizeof(*info));
+        info->value = g_malloc0(sizeof(*info->value));
+        info->value->device = g_strdup(name);
+        info->value->rd_bytes = cur.rd_bytes - last->rd_bytes;
+        info->value->wr_bytes = cur.wr_bytes - last->wr_bytes;
+        info->value->rd_operations = cur.rd_operations - last->rd_operations;
+        info->value->wr_operations = cur.wr_operations - last->wr_operations;
+        info->value->flush_operations =
+            cur.flush_operations - last->flush_operations;
+        *last = cur;
+
+        *p_next = info;
+        p_next = &info->next;
+    }
+
+    if (head) {
+        qapi_event_send_block_stats(block_stats_period, head, &error_abort);
+        qapi_free_BlockStatsDeltaList(head);
+    }
+
+    timer_mod(block_stats_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + block_stats_period);
+}
+
+void qmp_block_stats_subscribe(int64_t period, Error **errp)
+{
+    if (period != 0 && period < 100) {
+        error_setg(errp, "Parameter 'period' must be 0 or at least 100");
+        return;
+    }
+
+    if (block_stats_last) {
+        g_hash_table_destroy(block_stats_last);
+        block_stats_last = NULL;
+    }
+    block_stats_period = period;
+
+    if (!period) {
+        if (block_stats_timer) {
+            timer_del(block_stats_timer);
+        }
+        return;
+    }
+
+    if (!block_stats_timer) {
+        block_stats_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                         block_stats_timer_cb, NULL);
+    }
+    block_stats_last = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             g_free, g_free);
+    timer_mod(block_stats_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + period);
+}
+
 #define NB_SUFFIXES 4
 
 static char *get_human_readable_size(char *buf, int buf_size, int64_t size)
@@ -87,6 +87,7 @@ typedef struct Qcow2Bitmap {
     char *name;
 
     BdrvDirtyBitmap *dirty_bitmap;
+    bool update_in_place; /* only write what changed since the last store */
 
     QSIMPLEQ_ENTRY(Qcow2Bitmap) entry;
 } Qcow2Bitmap;
@@ -920,6 +921,41 @@ fail:
     return ret;
 }
 
+/* track_bitmap_changes()
+ * The content of @bitmap matches the image now.  From here on, record which
+ * of its clusters in the image become outdated, so that the next store can
+ * update only those.
+ */
+static void track_bitmap_changes(BlockDriverState *bs, BdrvDirtyBitmap *bitmap)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (bdrv_dirty_bitmap_has_meta(bitmap)) {
+        bdrv_dirty_bitmap_reset_meta(bitmap, 0,
+                                     bdrv_dirty_bitmap_size(bitmap));
+    } else {
+        bdrv_create_meta_dirty_bitmap(bitmap, s->cluster_size);
+    }
+}
+
+/* can_update_in_place()
+ * Whether the bitmap data of @bm in the image can be brought up to date with
+ * @bitmap by writing only the clusters that changed.
+ */
+static bool can_update_in_place(BlockDriverState *bs, Qcow2Bitmap *bm,
+                                BdrvDirtyBitmap *bitmap)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
+
+    return bdrv_dirty_bitmap_has_meta(bitmap) &&
+           (bm->flags & BME_FLAG_IN_USE) && bm->table.offset != 0 &&
+           bm->granularity_bits ==
+           ctz32(bdrv_dirty_bitmap_granularity(bitmap)) &&
+           bm->table.size == size_to_clusters(s,
+               bdrv_dirty_bitmap_serialization_size(bitmap, 0, bm_size));
+}
+
 /* for g_slist_foreach for GSList of BdrvDirtyBitmap* elements */
 static void release_dirty_bitmap_helper(gpointer bitmap,
                                         gpointer bs)
@@ -968,6 +1004,7 @@ bool qcow2_load_autoloading_dirty_bitmaps(BlockDriverState *bs, Error **errp)
 
             bdrv_dirty_bitmap_set_persistance(bitmap, true);
             bdrv_dirty_bitmap_set_autoload(bitmap, true);
+            track_bitmap_changes(bs, bitmap);
             bm->flags |= BME_FLAG_IN_USE;
             created_dirty_bitmaps =
                     g_slist_append(created_dirty_bitmaps, bitmap);
@@ -1166,6 +1203,159 @@ fail:
     return NULL;
 }
 
+/* update_bitmap_in_place()
+ * Write the clusters of bm->dirty_bitmap that changed since it was last
+ * loaded or stored over the bitmap data of @bm in the image, and update its
+ * bitmap table in place.  This is only safe while @bm is marked in use in the
+ * image, because the old data is not kept.
+ */
+static int update_bitmap_in_place(BlockDriverState *bs, Qcow2Bitmap *bm,
+                                  Error **errp)
+{
+    int ret;
+    BDRVQcow2State *s = bs->opaque;
+    BdrvDirtyBitmap *bitmap = bm->dirty_bitmap;
+    const char *bm_name = bdrv_dirty_bitmap_name(bitmap);
+    uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
+    uint32_t tb_size = bm->table.size;
+    uint64_t *tb = NULL, *old_tb;
+    bool tb_changed = false, tb_written = false;
+    BdrvDirtyBitmapIter *dbi;
+    uint8_t *buf;
+    int64_t offset;
+    uint64_t limit;
+    uint32_t i;
+
+    ret = bitmap_table_load(bs, &bm->table, &tb);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read bitmap table of bitmap "
+                         "'%s'", bm_name);
+        return ret;
+    }
+    old_tb = g_memdup(tb, tb_size * sizeof(tb[0]));
+
+    dbi = bdrv_dirty_meta_iter_new(bitmap);
+    buf = g_malloc(s->cluster_size);
+    limit = bytes_covered_by_bitmap_cluster(s, bitmap);
+
+    while ((offset = bdrv_dirty_iter_next(dbi)) >= 0) {
+        uint64_t cluster = offset / limit;
+        uint64_t end, write_size, data_offset;
+
+        offset = QEMU_ALIGN_DOWN(offset, limit);
+        end = MIN(bm_size, offset + limit);
+        write_size = bdrv_dirty_bitmap_serialization_size(bitmap, offset,
+                                                          end - offset);
+        assert(write_size <= s->cluster_size);
+
+        /* Changes made while this cluster is written out are caught by the
+         * next store */
+        bdrv_dirty_bitmap_reset_meta(bitmap, offset, end - offset);
+        bdrv_dirty_bitmap_serialize_part(bitmap, buf, offset, end - offset);
+        if (write_size < s->cluster_size) {
+            memset(buf + write_size, 0, s->cluster_size - write_size);
+        }
+
+        if (buffer_is_zero(buf, s->cluster_size)) {
+            if (tb[cluster] != 0) {
+                tb[cluster] = 0;
+                tb_changed = true;
+            }
+        } else {
+            data_offset = tb[cluster] & BME_TABLE_ENTRY_OFFSET_MASK;
+            if (data_offset == 0) {
+                int64_t off = qcow2_alloc_clusters(bs, s->cluster_size);
+                if (off < 0) {
+                    error_setg_errno(errp, -off, "Failed to allocate clusters "
+                                     "for bitmap '%s'", bm_name);
+                    ret = off;
+                    goto fail;
+                }
+                data_offset = off;
+                tb[cluster] = off;
+                tb_changed = true;
+            }
+
+            ret = qcow2_pre_write_overlap_check(bs, 0, data_offset,
+                                                s->cluster_size);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "Qcow2 overlap check failed");
+                goto fail;
+            }
+
+            ret = bdrv_pwrite(bs->file, data_offset, buf, s->cluster_size);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "Failed to write bitmap '%s' to "
+                                 "file", bm_name);
+                goto fail;
+            }
+        }
+
+        if (end >= bm_size) {
+            break;
+        }
+
+        bdrv_set_dirty_iter(dbi, end);
+    }
+
+    if (tb_changed) {
+        ret = qcow2_pre_write_overlap_check(bs, 0, bm->table.offset,
+                                            tb_size * sizeof(tb[0]));
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Qcow2 overlap check failed");
+            goto fail;
+        }
+
+        bitmap_table_to_be(tb, tb_size);
+        tb_written = true;
+        ret = bdrv_pwrite(bs->file, bm->table.offset, tb,
+                          tb_size * sizeof(tb[0]));
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to write bitmap '%s' to "
+                             "file", bm_name);
+            goto fail;
+        }
+
+        /* Clusters that are dropped from the table may only be reused once
+         * the table no longer points to them */
+        ret = bdrv_flush(bs->file->bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to flush bitmap '%s'",
+                             bm_name);
+            goto fail;
+        }
+
+        for (i = 0; i < tb_size; i++) {
+            uint64_t old_offset = old_tb[i] & BME_TABLE_ENTRY_OFFSET_MASK;
+            if (old_offset && !(be64_to_cpu(tb[i]) &
+                                BME_TABLE_ENTRY_OFFSET_MASK)) {
+                qcow2_free_clusters(bs, old_offset, s->cluster_size,
+                                    QCOW2_DISCARD_OTHER);
+            }
+        }
+    }
+
+    ret = 0;
+
+fail:
+    if (ret < 0 && !tb_written) {
+        /* Drop the clusters that only the in-memory table refers to */
+        for (i = 0; i < tb_size; i++) {
+            uint64_t new_offset = tb[i] & BME_TABLE_ENTRY_OFFSET_MASK;
+            if (new_offset && !(old_tb[i] & BME_TABLE_ENTRY_OFFSET_MASK)) {
+                qcow2_free_clusters(bs, new_offset, s->cluster_size,
+                                    QCOW2_DISCARD_OTHER);
+            }
+        }
+    }
+    bdrv_dirty_iter_free(dbi);
+    g_free(buf);
+    g_free(old_tb);
+    g_free(tb);
+
+    return ret;
+}
+
 /* store_bitmap()
  * Store bm->dirty_bitmap to qcow2.
  * Set bm->table_offset and bm->table_size accordingly.
@@ -1262,6 +1452,9 @@ void qcow2_remove_persistent_dirty_bitmap(BlockDriverState *bs,
         return;
     }
 
+    /* A checkpoint may be writing to the clusters that are freed below */
+    qcow2_wait_bitmap_checkpoint(bs);
+
     bm_list = bitmap_list_load(bs, s->bitmap_directory_offset,
                                s->bitmap_directory_size, errp);
     if (bm_list == NULL) {
@@ -1364,10 +1557,14 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
                            name);
                 goto fail;
             }
-            tb = g_memdup(&bm->table, sizeof(bm->table));
-            bm->table.offset = 0;
-            bm->table.size = 0;
-            QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            if (can_update_in_place(bs, bm, bitmap)) {
+                bm->update_in_place = true;
+            } else {
+                tb = g_memdup(&bm->table, sizeof(bm->table));
+                bm->table.offset = 0;
+                bm->table.size = 0;
+                QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            }
         }
         bm->flags = bdrv_dirty_bitmap_get_autoload(bitmap) ? BME_FLAG_AUTO : 0;
         bm->granularity_bits = ctz32(bdrv_dirty_bitmap_granularity(bitmap));
@@ -1380,7 +1577,11 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
             continue;
         }
 
-        ret = store_bitmap(bs, bm, errp);
+        if (bm->update_in_place) {
+            ret = update_bitmap_in_place(bs, bm, errp);
+        } else {
+            ret = store_bitmap(bs, bm, errp);
+        }
         if (ret < 0) {
             goto fail;
         }
@@ -1399,16 +1600,33 @@ void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
         g_free(tb);
     }
 
+    QSIMPLEQ_FOREACH(bm, bm_list, entry) {
+        if (bm->dirty_bitmap != NULL && !bm->update_in_place) {
+            track_bitmap_changes(bs, bm->dirty_bitmap);
+        }
+    }
+
     bitmap_list_free(bm_list);
     return;
 
 fail:
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
-        if (bm->dirty_bitmap == NULL || bm->table.offset == 0) {
+        if (bm->dirty_bitmap == NULL) {
             continue;
         }
 
-        free_bitmap_clusters(bs, &bm->table);
+        if (bm->update_in_place) {
+            /* The image still refers to this table, whose content is now
+             * unknown; the next store must write the bitmap from scratch */
+            if (bdrv_dirty_bitmap_has_meta(bm->dirty_bitmap)) {
+                bdrv_release_meta_dirty_bitmap(bm->dirty_bitmap);
+            }
+            continue;
+        }
+
+        if (bm->table.offset != 0) {
+            free_bitmap_clusters(bs, &bm->table);
+        }
     }
 
     QSIMPLEQ_FOREACH_SAFE(tb, &drop_tables, entry, tb_next) {
@@ -1418,6 +1636,55 @@ fail:
     bitmap_list_free(bm_list);
 }
 
+/* qcow2_checkpoint_persistent_dirty_bitmaps()
+ * Write what changed in the persistent bitmaps that are in use to the image,
+ * so that storing them later only has to write the changes made since.  The
+ * bitmaps remain marked in use, so this does not make them consistent in the
+ * image.  Must be called in coroutine context with s->lock held.
+ */
+void coroutine_fn qcow2_checkpoint_persistent_dirty_bitmaps(
+    BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2BitmapList *bm_list;
+    Qcow2Bitmap *bm;
+    Error *local_err = NULL;
+
+    if (s->nb_bitmaps == 0 || !can_write(bs)) {
+        return;
+    }
+
+    bm_list = bitmap_list_load(bs, s->bitmap_directory_offset,
+                               s->bitmap_directory_size, &local_err);
+    if (bm_list == NULL) {
+        warn_report_err(local_err);
+        return;
+    }
+
+    QSIMPLEQ_FOREACH(bm, bm_list, entry) {
+        BdrvDirtyBitmap *bitmap = bdrv_find_dirty_bitmap(bs, bm->name);
+
+        if (bitmap == NULL || !bdrv_dirty_bitmap_get_persistance(bitmap) ||
+            bdrv_dirty_bitmap_readonly(bitmap) ||
+            bdrv_dirty_bitmap_frozen(bitmap) ||
+            !can_update_in_place(bs, bm, bitmap) ||
+            bdrv_get_meta_dirty_count(bitmap) == 0)
+        {
+            continue;
+        }
+
+        bm->dirty_bitmap = bitmap;
+        if (update_bitmap_in_place(bs, bm, &local_err) < 0) {
+            warn_reportf_err(local_err, "Could not checkpoint bitmap '%s': ",
+                             bm->name);
+            local_err = NULL;
+            bdrv_release_meta_dirty_bitmap(bitmap);
+        }
+    }
+
+    bitmap_list_free(bm_list);
+}
+
 int qcow2_reopen_bitmaps_ro(BlockDriverState *bs, Error **errp)
 {
     BdrvDirtyBitmap *bitmap;
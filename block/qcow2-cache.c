@@ -25,40 +25,148 @@
 #include "qemu/osdep.h"
 #include "block/block_int.h"
 #include "qemu-common.h"
+#include "qemu/queue.h"
 #include "qcow2.h"
 #include "trace.h"
 
+/*
+ * Tables are looked up through a hash table indexed by offset, and
+ * replaced following the 2Q policy: a table that is loaded goes to the
+ * "cold" FIFO queue, and only once it has been evicted from there and is
+ * loaded again soon after (its offset is still in the "ghost" list of
+ * recently evicted tables) does it go to the "hot" LRU queue.  A scan of
+ * many tables that are used once, like a sequential read of the image,
+ * therefore only replaces the cold tables.
+ */
+
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    bool     hot;
+    QTAILQ_ENTRY(Qcow2CachedTable) next;
 } Qcow2CachedTable;
 
+typedef QTAILQ_HEAD(, Qcow2CachedTable) Qcow2CachedTableQueue;
+
 struct Qcow2Cache {
     Qcow2CachedTable       *entries;
     struct Qcow2Cache      *depends;
     int                     size;
+    int                     table_size;
     bool                    depends_on_flush;
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /* offset -> Qcow2CachedTable, for the entries with an offset */
+    GHashTable             *index;
+    Qcow2CachedTableQueue   cold;
+    Qcow2CachedTableQueue   hot;
+    int                     nb_cold;
+
+    /* Offsets of the tables last evicted from the cold queue, in a ring */
+    int64_t                *ghosts;
+    int                     nb_ghosts;
+    int                     next_ghost;
+    GHashTable             *ghost_index;
 };
 
+/* The cold queue takes a quarter of the cache, the ghost list covers half */
+#define QCOW2_CACHE_COLD_DIVISOR  4
+#define QCOW2_CACHE_GHOST_DIVISOR 2
+
+static void qcow2_cache_entry_dequeue(Qcow2Cache *c, Qcow2CachedTable *t)
+{
+    if (t->hot) {
+        QTAILQ_REMOVE(&c->hot, t, next);
+    } else {
+        QTAILQ_REMOVE(&c->cold, t, next);
+        c->nb_cold--;
+    }
+}
+
+/* Queue @t at the tail of its queue, or at the head of the cold queue if it
+ * is empty, so that it is the first to be reused */
+static void qcow2_cache_entry_enqueue(Qcow2Cache *c, Qcow2CachedTable *t,
+                                      bool hot)
+{
+    t->hot = hot;
+    if (hot) {
+        QTAILQ_INSERT_TAIL(&c->hot, t, next);
+    } else {
+        if (t->offset) {
+            QTAILQ_INSERT_TAIL(&c->cold, t, next);
+        } else {
+            QTAILQ_INSERT_HEAD(&c->cold, t, next);
+        }
+        c->nb_cold++;
+    }
+}
+
+/* Forget the table in entry @t, which must not be in use */
+static void qcow2_cache_entry_reset(Qcow2Cache *c, Qcow2CachedTable *t)
+{
+    if (t->offset) {
+        g_hash_table_remove(c->index, &t->offset);
+    }
+    qcow2_cache_entry_dequeue(c, t);
+    t->offset = 0;
+    t->lru_counter = 0;
+    qcow2_cache_entry_enqueue(c, t, false);
+}
+
+static void qcow2_cache_add_ghost(Qcow2Cache *c, int64_t offset)
+{
+    int64_t *ghost = &c->ghosts[c->next_ghost];
+
+    if (*ghost) {
+        g_hash_table_remove(c->ghost_index, ghost);
+    }
+    *ghost = offset;
+    g_hash_table_add(c->ghost_index, ghost);
+    c->next_ghost = (c->next_ghost + 1) % c->nb_ghosts;
+}
+
+/* Returns true (and forgets it) if @offset was evicted from the cold
+ * queue recently */
+static bool qcow2_cache_take_ghost(Qcow2Cache *c, int64_t offset)
+{
+    gpointer ghost;
+
+    if (!g_hash_table_lookup_extended(c->ghost_index, &offset, &ghost, NULL)) {
+        return false;
+    }
+    g_hash_table_remove(c->ghost_index, ghost);
+    *(int64_t *) ghost = 0;
+    return true;
+}
+
+static Qcow2CachedTable *qcow2_cache_find_victim(Qcow2CachedTableQueue *q)
+{
+    Qcow2CachedTable *t;
+
+    QTAILQ_FOREACH(t, q, next) {
+        if (t->ref == 0) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
 static inline void *qcow2_cache_get_table_addr(BlockDriverState *bs,
                     Qcow2Cache *c, int table)
 {
-    BDRVQcow2State *s = bs->opaque;
-    return (uint8_t *) c->table_array + (size_t) table * s->cluster_size;
+    return (uint8_t *) c->table_array + (size_t) table * c->table_size;
 }
 
 static inline int qcow2_cache_get_table_idx(BlockDriverState *bs,
                   Qcow2Cache *c, void *table)
 {
-    BDRVQcow2State *s = bs->opaque;
     ptrdiff_t table_offset = (uint8_t *) table - (uint8_t *) c->table_array;
-    int idx = table_offset / s->cluster_size;
-    assert(idx >= 0 && idx < c->size && table_offset % s->cluster_size == 0);
+    int idx = table_offset / c->table_size;
+    assert(idx >= 0 && idx < c->size && table_offset % c->table_size == 0);
     return idx;
 }
 
@@ -79,10 +187,9 @@ static void qcow2_cache_table_release(BlockDriverState *bs, Qcow2Cache *c,
 {
 /* Using MADV_DONTNEED to discard memory is a Linux-specific feature */
 #ifdef CONFIG_LINUX
-    BDRVQcow2State *s = bs->opaque;
     void *t = qcow2_cache_get_table_addr(bs, c, i);
     int align = getpagesize();
-    size_t mem_size = (size_t) s->cluster_size * num_tables;
+    size_t mem_size = (size_t) c->table_size * num_tables;
     size_t offset = QEMU_ALIGN_UP((uintptr_t) t, align) - (uintptr_t) t;
     size_t length = QEMU_ALIGN_DOWN(mem_size - offset, align);
     if (mem_size > offset && length > 0) {
@@ -111,8 +218,7 @@ void qcow2_cache_clean_unused(BlockDriverState *bs, Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_entry_reset(c, &c->entries[i]);
             i++;
             to_clean++;
         }
@@ -125,22 +231,41 @@ void qcow2_cache_clean_unused(BlockDriverState *bs, Qcow2Cache *c)
     c->cache_clean_lru_counter = c->lru_counter;
 }
 
-Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables)
+Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
+                               unsigned table_size)
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
+
+    assert(num_tables > 0);
+    assert(is_power_of_2(table_size));
+    assert(table_size >= (1 << MIN_CLUSTER_BITS));
+    assert(table_size <= s->cluster_size);
 
     c = g_new0(Qcow2Cache, 1);
     c->size = num_tables;
+    c->table_size = table_size;
     c->entries = g_try_new0(Qcow2CachedTable, num_tables);
     c->table_array = qemu_try_blockalign(bs->file->bs,
-                                         (size_t) num_tables * s->cluster_size);
+                                         (size_t) num_tables * c->table_size);
+    c->nb_ghosts = MAX(1, num_tables / QCOW2_CACHE_GHOST_DIVISOR);
+    c->ghosts = g_try_new0(int64_t, c->nb_ghosts);
 
-    if (!c->entries || !c->table_array) {
+    if (!c->entries || !c->table_array || !c->ghosts) {
         qemu_vfree(c->table_array);
         g_free(c->entries);
+        g_free(c->ghosts);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    c->index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    c->ghost_index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&c->cold);
+    QTAILQ_INIT(&c->hot);
+    for (i = 0; i < num_tables; i++) {
+        qcow2_cache_entry_enqueue(c, &c->entries[i], false);
     }
 
     return c;
@@ -154,8 +279,11 @@ int qcow2_cache_destroy(BlockDriverState *bs, Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
     }
 
+    g_hash_table_destroy(c->index);
+    g_hash_table_destroy(c->ghost_index);
     qemu_vfree(c->table_array);
     g_free(c->entries);
+    g_free(c->ghosts);
     g_free(c);
 
     return 0;
@@ -203,13 +331,13 @@ static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
 
     if (c == s->refcount_block_cache) {
         ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_REFCOUNT_BLOCK,
-                c->entries[i].offset, s->cluster_size);
+                c->entries[i].offset, c->table_size);
     } else if (c == s->l2_table_cache) {
         ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_ACTIVE_L2,
-                c->entries[i].offset, s->cluster_size);
+                c->entries[i].offset, c->table_size);
     } else {
         ret = qcow2_pre_write_overlap_check(bs, 0,
-                c->entries[i].offset, s->cluster_size);
+                c->entries[i].offset, c->table_size);
     }
 
     if (ret < 0) {
@@ -223,7 +351,7 @@ static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
     }
 
     ret = bdrv_pwrite(bs->file, c->entries[i].offset,
-                      qcow2_cache_get_table_addr(bs, c, i), s->cluster_size);
+                      qcow2_cache_get_table_addr(bs, c, i), c->table_size);
     if (ret < 0) {
         return ret;
     }
@@ -305,12 +433,14 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
+        qcow2_cache_entry_reset(c, &c->entries[i]);
     }
 
     qcow2_cache_table_release(bs, c, 0, c->size);
 
+    g_hash_table_remove_all(c->ghost_index);
+    memset(c->ghosts, 0, c->nb_ghosts * sizeof(c->ghosts[0]));
+    c->next_ghost = 0;
     c->lru_counter = 0;
 
     return 0;
@@ -320,18 +450,18 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     uint64_t offset, void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CachedTable *t;
+    int64_t key = offset;
+    bool hot;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
     trace_qcow2_cache_get(qemu_coroutine_self(), c == s->l2_table_cache,
                           offset, read_from_disk);
 
-    if (offset_into_cluster(s, offset)) {
+    if (!QEMU_IS_ALIGNED(offset, c->table_size)) {
         qcow2_signal_corruption(bs, true, -1, -1, "Cannot get entry from %s "
                                 "cache: Offset %#" PRIx64 " is unaligned",
                                 qcow2_cache_get_name(s, c), offset);
@@ -339,29 +469,32 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / s->cluster_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    t = g_hash_table_lookup(c->index, &key);
+    if (t) {
+        i = t - c->entries;
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    /* Keep the cold queue at its share of the cache, unless all the hot
+     * tables are in use */
+    t = NULL;
+    if (c->nb_cold <= MAX(1, c->size / QCOW2_CACHE_COLD_DIVISOR)) {
+        t = qcow2_cache_find_victim(&c->hot);
+    }
+    if (!t) {
+        t = qcow2_cache_find_victim(&c->cold);
+    }
+    if (!t) {
+        t = qcow2_cache_find_victim(&c->hot);
+    }
+    if (!t) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    i = t - c->entries;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -370,9 +503,14 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         return ret;
     }
 
+    if (t->offset && !t->hot) {
+        qcow2_cache_add_ghost(c, t->offset);
+    }
+    hot = qcow2_cache_take_ghost(c, offset);
+    qcow2_cache_entry_reset(c, t);
+
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -380,13 +518,16 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
         ret = bdrv_pread(bs->file, offset,
                          qcow2_cache_get_table_addr(bs, c, i),
-                         s->cluster_size);
+                         c->table_size);
         if (ret < 0) {
             return ret;
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_entry_dequeue(c, t);
+    t->offset = offset;
+    g_hash_table_insert(c->index, &t->offset, t);
+    qcow2_cache_entry_enqueue(c, t, hot);
 
     /* And return the right table */
 found:
@@ -419,7 +560,14 @@ void qcow2_cache_put(BlockDriverState *bs, Qcow2Cache *c, void **table)
     *table = NULL;
 
     if (c->entries[i].ref == 0) {
-        c->entries[i].lru_counter = ++c->lru_counter;
+        Qcow2CachedTable *t = &c->entries[i];
+
+        t->lru_counter = ++c->lru_counter;
+        /* The hot queue is LRU, the cold one FIFO */
+        if (t->hot) {
+            qcow2_cache_entry_dequeue(c, t);
+            qcow2_cache_entry_enqueue(c, t, true);
+        }
     }
 
     assert(c->entries[i].ref >= 0);
@@ -436,14 +584,10 @@ void qcow2_cache_entry_mark_dirty(BlockDriverState *bs, Qcow2Cache *c,
 void *qcow2_cache_is_table_offset(BlockDriverState *bs, Qcow2Cache *c,
                                   uint64_t offset)
 {
-    int i;
+    int64_t key = offset;
+    Qcow2CachedTable *t = g_hash_table_lookup(c->index, &key);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(bs, c, i);
-        }
-    }
-    return NULL;
+    return t ? qcow2_cache_get_table_addr(bs, c, t - c->entries) : NULL;
 }
 
 void qcow2_cache_discard(BlockDriverState *bs, Qcow2Cache *c, void *table)
@@ -452,8 +596,7 @@ void qcow2_cache_discard(BlockDriverState *bs, Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_entry_reset(c, &c->entries[i]);
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(bs, c, i, 1);
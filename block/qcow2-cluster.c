@@ -24,11 +24,15 @@
 
 #include "qemu/osdep.h"
 #include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 #include "qapi/error.h"
 #include "qemu-common.h"
 #include "block/block_int.h"
 #include "block/qcow2.h"
+#include "block/thread-pool.h"
 #include "qemu/bswap.h"
 #include "trace.h"
 
@@ -196,20 +200,27 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
 /*
  * l2_load
  *
- * Loads a L2 table into memory. If the table is in the cache, the cache
- * is used; otherwise the L2 table is loaded from the image file.
+ * @bs: The BlockDriverState
+ * @offset: A guest offset, used to calculate what slice of the L2
+ *          table to load.
+ * @l2_offset: Offset to the L2 table in the image file.
+ * @l2_slice: Location to store the pointer to the L2 slice.
+ *
+ * Loads the L2 slice that contains the entry for @offset into memory.
+ * If the slice is in the cache, the cache is used; otherwise the slice
+ * is loaded from the image file.
  *
- * Returns a pointer to the L2 table on success, or NULL if the read from
- * the image file failed.
+ * Returns 0 on success, -errno in failure case
  */
-
-static int l2_load(BlockDriverState *bs, uint64_t l2_offset,
-    uint64_t **l2_table)
+static int l2_load(BlockDriverState *bs, uint64_t offset,
+                   uint64_t l2_offset, uint64_t **l2_slice)
 {
     BDRVQcow2State *s = bs->opaque;
+    int start_of_slice = l2_entry_size(s) *
+        (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
 
-    return qcow2_cache_get(bs, s->l2_table_cache, l2_offset,
-                           (void **)l2_table);
+    return qcow2_cache_get(bs, s->l2_table_cache, l2_offset + start_of_slice,
+                           (void **)l2_slice);
 }
 
 /*
@@ -256,13 +267,16 @@ int qcow2_write_l1_entry(BlockDriverState *bs, int l1_index)
  * table) copy the contents of the old L2 table into the newly allocated one.
  * Otherwise the new table is initialized with zeros.
  *
+ * The new table goes through the cache one slice at a time; the caller
+ * loads the slice it needs afterwards.
  */
 
-static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
+static int l2_allocate(BlockDriverState *bs, int l1_index)
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t old_l2_offset;
-    uint64_t *l2_table = NULL;
+    uint64_t *l2_slice = NULL;
+    unsigned slice, slice_size2, n_slices;
     int64_t l2_offset;
     int ret;
 
@@ -272,7 +286,7 @@ static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
 
     /* allocate a new l2 entry */
 
-    l2_offset = qcow2_alloc_clusters(bs, s->l2_size * sizeof(uint64_t));
+    l2_offset = qcow2_alloc_clusters(bs, s->l2_size * l2_entry_size(s));
     if (l2_offset < 0) {
         ret = l2_offset;
         goto fail;
@@ -291,41 +305,49 @@ static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
         goto fail;
     }
 
-    /* allocate a new entry in the l2 cache */
+    /* allocate a new entry in the l2 cache for each slice */
+
+    slice_size2 = s->l2_slice_size * l2_entry_size(s);
+    n_slices = s->cluster_size / slice_size2;
 
     trace_qcow2_l2_allocate_get_empty(bs, l1_index);
-    ret = qcow2_cache_get_empty(bs, s->l2_table_cache, l2_offset, (void**) table);
-    if (ret < 0) {
-        goto fail;
-    }
+    for (slice = 0; slice < n_slices; slice++) {
+        ret = qcow2_cache_get_empty(bs, s->l2_table_cache,
+                                    l2_offset + slice * slice_size2,
+                                    (void **) &l2_slice);
+        if (ret < 0) {
+            goto fail;
+        }
 
-    l2_table = *table;
+        if ((old_l2_offset & L1E_OFFSET_MASK) == 0) {
+            /* if there was no old l2 table, clear the new slice */
+            memset(l2_slice, 0, slice_size2);
+        } else {
+            uint64_t *old_slice;
+            uint64_t old_l2_slice_offset =
+                (old_l2_offset & L1E_OFFSET_MASK) + slice * slice_size2;
+
+            /* if there was an old l2 table, read a slice from the disk */
+            BLKDBG_EVENT(bs->file, BLKDBG_L2_ALLOC_COW_READ);
+            ret = qcow2_cache_get(bs, s->l2_table_cache, old_l2_slice_offset,
+                                  (void **) &old_slice);
+            if (ret < 0) {
+                goto fail;
+            }
 
-    if ((old_l2_offset & L1E_OFFSET_MASK) == 0) {
-        /* if there was no old l2 table, clear the new table */
-        memset(l2_table, 0, s->l2_size * sizeof(uint64_t));
-    } else {
-        uint64_t* old_table;
+            memcpy(l2_slice, old_slice, slice_size2);
 
-        /* if there was an old l2 table, read it from the disk */
-        BLKDBG_EVENT(bs->file, BLKDBG_L2_ALLOC_COW_READ);
-        ret = qcow2_cache_get(bs, s->l2_table_cache,
-            old_l2_offset & L1E_OFFSET_MASK,
-            (void**) &old_table);
-        if (ret < 0) {
-            goto fail;
+            qcow2_cache_put(bs, s->l2_table_cache, (void **) &old_slice);
         }
 
-        memcpy(l2_table, old_table, s->cluster_size);
+        /* write the l2 slice to the file */
+        BLKDBG_EVENT(bs->file, BLKDBG_L2_ALLOC_WRITE);
 
-        qcow2_cache_put(bs, s->l2_table_cache, (void **) &old_table);
+        trace_qcow2_l2_allocate_write_l2(bs, l1_index);
+        qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache, l2_slice);
+        qcow2_cache_put(bs, s->l2_table_cache, (void **) &l2_slice);
     }
 
-    /* write the l2 table to the file */
-    BLKDBG_EVENT(bs->file, BLKDBG_L2_ALLOC_WRITE);
-
-    trace_qcow2_l2_allocate_write_l2(bs, l1_index);
-    qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache, l2_table);
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret < 0) {
         goto fail;
@@ -339,18 +361,17 @@ static int l2_allocate(BlockDriverState *bs, int l1_index, uint64_t **table)
         goto fail;
     }
 
-    *table = l2_table;
     trace_qcow2_l2_allocate_done(bs, l1_index, 0);
     return 0;
 
 fail:
     trace_qcow2_l2_allocate_done(bs, l1_index, ret);
-    if (l2_table != NULL) {
-        qcow2_cache_put(bs, s->l2_table_cache, (void**) table);
+    if (l2_slice != NULL) {
+        qcow2_cache_put(bs, s->l2_table_cache, (void **) &l2_slice);
     }
     s->l1_table[l1_index] = old_l2_offset;
     if (l2_offset > 0) {
-        qcow2_free_clusters(bs, l2_offset, s->l2_size * sizeof(uint64_t),
+        qcow2_free_clusters(bs, l2_offset, s->l2_size * l2_entry_size(s),
                             QCOW2_DISCARD_ALWAYS);
     }
     return ret;
@@ -363,13 +384,13 @@ fail:
  * as contiguous. (This allows it, for example, to stop at the first compressed
  * cluster which may require a different handling)
  */
-static int count_contiguous_clusters(int nb_clusters, int cluster_size,
-        uint64_t *l2_table, uint64_t stop_flags)
+static int count_contiguous_clusters(BDRVQcow2State *s, int nb_clusters,
+        uint64_t *l2_table, int l2_index, uint64_t stop_flags)
 {
     int i;
     QCow2ClusterType first_cluster_type;
     uint64_t mask = stop_flags | L2E_OFFSET_MASK | QCOW_OFLAG_COMPRESSED;
-    uint64_t first_entry = be64_to_cpu(l2_table[0]);
+    uint64_t first_entry = get_l2_entry(s, l2_table, l2_index);
     uint64_t offset = first_entry & mask;
 
     if (!offset) {
@@ -382,8 +403,8 @@ static int count_contiguous_clusters(int nb_clusters, int cluster_size,
            first_cluster_type == QCOW2_CLUSTER_ZERO_ALLOC);
 
     for (i = 0; i < nb_clusters; i++) {
-        uint64_t l2_entry = be64_to_cpu(l2_table[i]) & mask;
-        if (offset + (uint64_t) i * cluster_size != l2_entry) {
+        uint64_t l2_entry = get_l2_entry(s, l2_table, l2_index + i) & mask;
+        if (offset + (uint64_t) i * s->cluster_size != l2_entry) {
             break;
         }
     }
@@ -395,8 +416,10 @@ static int count_contiguous_clusters(int nb_clusters, int cluster_size,
  * Checks how many consecutive unallocated clusters in a given L2
  * table have the same cluster type.
  */
-static int count_contiguous_clusters_unallocated(int nb_clusters,
+static int count_contiguous_clusters_unallocated(BDRVQcow2State *s,
+                                                 int nb_clusters,
                                                  uint64_t *l2_table,
+                                                 int l2_index,
                                                  QCow2ClusterType wanted_type)
 {
     int i;
@@ -404,7 +427,7 @@ static int count_contiguous_clusters_unallocated(int nb_clusters,
     assert(wanted_type == QCOW2_CLUSTER_ZERO_PLAIN ||
            wanted_type == QCOW2_CLUSTER_UNALLOCATED);
     for (i = 0; i < nb_clusters; i++) {
-        uint64_t entry = be64_to_cpu(l2_table[i]);
+        uint64_t entry = get_l2_entry(s, l2_table, l2_index + i);
         QCow2ClusterType type = qcow2_get_cluster_type(entry);
 
         if (type != wanted_type) {
@@ -415,6 +438,87 @@ static int count_contiguous_clusters_unallocated(int nb_clusters,
     return i;
 }
 
+/*
+ * Returns the type of subcluster @sc_index of an extended L2 entry, or
+ * -EIO if its bits in @l2_bitmap are invalid.
+ */
+static int get_subcluster_type(uint64_t l2_entry, uint64_t l2_bitmap,
+                               int sc_index)
+{
+    bool sc_alloc = l2_bitmap & QCOW_OFLAG_SUB_ALLOC(sc_index);
+    bool sc_zero = l2_bitmap & QCOW_OFLAG_SUB_ZERO(sc_index);
+    bool host_alloc = l2_entry & L2E_OFFSET_MASK;
+
+    if (l2_entry & QCOW_OFLAG_COMPRESSED) {
+        return l2_bitmap ? -EIO : QCOW2_CLUSTER_COMPRESSED;
+    } else if (sc_alloc && sc_zero) {
+        return -EIO;
+    } else if (sc_alloc) {
+        return host_alloc ? QCOW2_CLUSTER_NORMAL : -EIO;
+    } else if (sc_zero) {
+        return host_alloc ? QCOW2_CLUSTER_ZERO_ALLOC : QCOW2_CLUSTER_ZERO_PLAIN;
+    } else {
+        return QCOW2_CLUSTER_UNALLOCATED;
+    }
+}
+
+/*
+ * For images with extended L2 entries: returns the type of subcluster
+ * @sc_index of the cluster at @l2_index, and stores in *bytes the number of
+ * bytes, counted from the start of that cluster, up to the end of the run
+ * of subclusters with the same type (and for allocated ones, contiguous in
+ * the image file) that starts there.  At most @nb_clusters clusters are
+ * looked at, compressed clusters are always returned one by one.
+ *
+ * Returns -EIO if the L2 bitmap of the first cluster is corrupted.
+ */
+static int count_contiguous_subclusters(BlockDriverState *bs, int nb_clusters,
+                                        unsigned int sc_index,
+                                        uint64_t *l2_table, int l2_index,
+                                        uint64_t *bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t l2_entry = get_l2_entry(s, l2_table, l2_index);
+    uint64_t l2_bitmap = get_l2_bitmap(s, l2_table, l2_index);
+    uint64_t expected_offset = l2_entry & L2E_OFFSET_MASK;
+    int type, first_type, i, sc = sc_index;
+
+    first_type = get_subcluster_type(l2_entry, l2_bitmap, sc);
+    if (first_type < 0) {
+        qcow2_signal_corruption(bs, true, -1, -1, "Invalid L2 bitmap %#"
+                                PRIx64 " (L2 index: %#x)", l2_bitmap,
+                                l2_index);
+        return -EIO;
+    } else if (first_type == QCOW2_CLUSTER_COMPRESSED) {
+        *bytes = s->cluster_size;
+        return first_type;
+    }
+
+    for (i = 0; i < nb_clusters; i++, sc = 0) {
+        if (i > 0) {
+            l2_entry = get_l2_entry(s, l2_table, l2_index + i);
+            l2_bitmap = get_l2_bitmap(s, l2_table, l2_index + i);
+            expected_offset += s->cluster_size;
+        }
+        for (; sc < s->subclusters_per_cluster; sc++) {
+            type = get_subcluster_type(l2_entry, l2_bitmap, sc);
+            if (type != first_type) {
+                goto out;
+            }
+            if ((type == QCOW2_CLUSTER_NORMAL ||
+                 type == QCOW2_CLUSTER_ZERO_ALLOC) &&
+                (l2_entry & L2E_OFFSET_MASK) != expected_offset) {
+                goto out;
+            }
+        }
+    }
+
+out:
+    *bytes = ((uint64_t) i << s->cluster_bits) +
+             ((uint64_t) sc << s->subcluster_bits);
+    return first_type;
+}
+
 static int coroutine_fn do_perform_cow_read(BlockDriverState *bs,
                                             uint64_t src_cluster_offset,
                                             unsigned offset_in_cluster,
@@ -529,9 +633,11 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
     l1_bits = s->l2_bits + s->cluster_bits;
 
     /* compute how many bytes there are between the start of the cluster
-     * containing offset and the end of the l1 entry */
-    bytes_available = (1ULL << l1_bits) - (offset & ((1ULL << l1_bits) - 1))
-                    + offset_in_cluster;
+     * containing offset and the end of the l2 slice that contains
+     * the entry pointing to it */
+    bytes_available =
+        ((uint64_t) (s->l2_slice_size - offset_to_l2_slice_index(s, offset)))
+        << s->cluster_bits;
 
     if (bytes_needed > bytes_available) {
         bytes_needed = bytes_available;
@@ -560,17 +666,17 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
         return -EIO;
     }
 
-    /* load the l2 table in memory */
+    /* load the l2 slice in memory */
 
-    ret = l2_load(bs, l2_offset, &l2_table);
+    ret = l2_load(bs, offset, l2_offset, &l2_table);
     if (ret < 0) {
         return ret;
     }
 
     /* find the cluster offset for the given disk offset */
 
-    l2_index = offset_to_l2_index(s, offset);
-    *cluster_offset = be64_to_cpu(l2_table[l2_index]);
+    l2_index = offset_to_l2_slice_index(s, offset);
+    *cluster_offset = get_l2_entry(s, l2_table, l2_index);
 
     nb_clusters = size_to_clusters(s, bytes_needed);
     /* bytes_needed <= *bytes + offset_in_cluster, both of which are unsigned
@@ -578,7 +684,19 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
      * true */
     assert(nb_clusters <= INT_MAX);
 
-    type = qcow2_get_cluster_type(*cluster_offset);
+    if (has_subclusters(s)) {
+        /* This sets bytes_available itself, c is not used */
+        ret = count_contiguous_subclusters(bs, nb_clusters,
+                                           offset_to_sc_index(s, offset),
+                                           l2_table, l2_index,
+                                           &bytes_available);
+        if (ret < 0) {
+            goto fail;
+        }
+        type = ret;
+    } else {
+        type = qcow2_get_cluster_type(*cluster_offset);
+    }
     if (s->qcow_version < 3 && (type == QCOW2_CLUSTER_ZERO_PLAIN ||
                                 type == QCOW2_CLUSTER_ZERO_ALLOC)) {
         qcow2_signal_corruption(bs, true, -1, -1, "Zero cluster entry found"
@@ -587,24 +705,29 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
         ret = -EIO;
         goto fail;
     }
+    c = 1;
     switch (type) {
     case QCOW2_CLUSTER_COMPRESSED:
         /* Compressed clusters can only be processed one by one */
-        c = 1;
         *cluster_offset &= L2E_COMPRESSED_OFFSET_SIZE_MASK;
         break;
     case QCOW2_CLUSTER_ZERO_PLAIN:
     case QCOW2_CLUSTER_UNALLOCATED:
         /* how many empty clusters ? */
-        c = count_contiguous_clusters_unallocated(nb_clusters,
-                                                  &l2_table[l2_index], type);
+        if (!has_subclusters(s)) {
+            c = count_contiguous_clusters_unallocated(s, nb_clusters,
+                                                      l2_table, l2_index,
+                                                      type);
+        }
         *cluster_offset = 0;
         break;
     case QCOW2_CLUSTER_ZERO_ALLOC:
     case QCOW2_CLUSTER_NORMAL:
         /* how many allocated clusters ? */
-        c = count_contiguous_clusters(nb_clusters, s->cluster_size,
-                                      &l2_table[l2_index], QCOW_OFLAG_ZERO);
+        if (!has_subclusters(s)) {
+            c = count_contiguous_clusters(s, nb_clusters, l2_table, l2_index,
+                                          QCOW_OFLAG_ZERO);
+        }
         *cluster_offset &= L2E_OFFSET_MASK;
         if (offset_into_cluster(s, *cluster_offset)) {
             qcow2_signal_corruption(bs, true, -1, -1,
@@ -622,7 +745,9 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
 
     qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
 
-    bytes_available = (int64_t)c * s->cluster_size;
+    if (!has_subclusters(s)) {
+        bytes_available = (int64_t)c * s->cluster_size;
+    }
 
 out:
     if (bytes_available > bytes_needed) {
@@ -646,10 +771,10 @@ fail:
  * get_cluster_table
  *
  * for a given disk offset, load (and allocate if needed)
- * the l2 table.
+ * the l2 slice that contains its entry.
  *
- * the l2 table offset in the qcow2 file and the cluster index
- * in the l2 table are given to the caller.
+ * the l2 slice and the cluster index in that slice are given to the
+ * caller.
  *
  * Returns 0 on success, -errno in failure case
  */
@@ -684,29 +809,33 @@ static int get_cluster_table(BlockDriverState *bs, uint64_t offset,
 
     /* seek the l2 table of the given l2 offset */
 
-    if (s->l1_table[l1_index] & QCOW_OFLAG_COPIED) {
-        /* load the l2 table in memory */
-        ret = l2_load(bs, l2_offset, &l2_table);
-        if (ret < 0) {
-            return ret;
-        }
-    } else {
+    if (!(s->l1_table[l1_index] & QCOW_OFLAG_COPIED)) {
         /* First allocate a new L2 table (and do COW if needed) */
-        ret = l2_allocate(bs, l1_index, &l2_table);
+        ret = l2_allocate(bs, l1_index);
         if (ret < 0) {
             return ret;
         }
 
         /* Then decrease the refcount of the old table */
         if (l2_offset) {
-            qcow2_free_clusters(bs, l2_offset, s->l2_size * sizeof(uint64_t),
+            qcow2_free_clusters(bs, l2_offset, s->l2_size * l2_entry_size(s),
                                 QCOW2_DISCARD_OTHER);
         }
+
+        /* Get the offset of the newly-allocated l2 table */
+        l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+        assert(offset_into_cluster(s, l2_offset) == 0);
+    }
+
+    /* load the l2 slice in memory */
+    ret = l2_load(bs, offset, l2_offset, &l2_table);
+    if (ret < 0) {
+        return ret;
     }
 
     /* find the cluster offset for the given disk offset */
 
-    l2_index = offset_to_l2_index(s, offset);
+    l2_index = offset_to_l2_slice_index(s, offset);
 
     *new_l2_table = l2_table;
     *new_l2_index = l2_index;
@@ -744,7 +873,7 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
 
     /* Compression can't overwrite anything. Fail if the cluster was already
      * allocated. */
-    cluster_offset = be64_to_cpu(l2_table[l2_index]);
+    cluster_offset = get_l2_entry(s, l2_table, l2_index);
     if (cluster_offset & L2E_OFFSET_MASK) {
         qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
         return 0;
@@ -768,7 +897,10 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
 
     BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE_COMPRESSED);
     qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache, l2_table);
-    l2_table[l2_index] = cpu_to_be64(cluster_offset);
+    set_l2_entry(s, l2_table, l2_index, cluster_offset);
+    if (has_subclusters(s)) {
+        set_l2_bitmap(s, l2_table, l2_index, 0);
+    }
     qcow2_cache_put(bs, s->l2_table_cache, (void **) &l2_table);
 
     return cluster_offset;
@@ -904,6 +1036,37 @@ fail:
     return ret;
 }
 
+/*
+ * Returns the L2 bitmap of cluster @i of the allocation @m once it is
+ * linked: the subclusters written by the request and its COW regions are
+ * allocated, the others keep their state from @l2_bitmap.
+ */
+static uint64_t l2meta_get_l2_bitmap(BDRVQcow2State *s, QCowL2Meta *m, int i,
+                                     uint64_t l2_bitmap)
+{
+    uint64_t cluster_start = (uint64_t) i << s->cluster_bits;
+    uint64_t start = m->cow_start.offset;
+    uint64_t end = m->cow_end.offset + m->cow_end.nb_bytes;
+    int first_sc, last_sc;
+
+    if (start == end) {
+        /* Preallocation, without any guest data */
+        start = 0;
+        end = (uint64_t) m->nb_clusters << s->cluster_bits;
+    }
+
+    start = MAX(start, cluster_start) - cluster_start;
+    end = MIN(end, cluster_start + s->cluster_size) - cluster_start;
+    assert(start < end);
+
+    first_sc = start >> s->subcluster_bits;
+    last_sc = DIV_ROUND_UP(end, s->subcluster_size);
+
+    l2_bitmap |= QCOW_OFLAG_SUB_ALLOC_RANGE(first_sc, last_sc);
+    l2_bitmap &= ~QCOW_OFLAG_SUB_ZERO_RANGE(first_sc, last_sc);
+    return l2_bitmap;
+}
+
 int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -930,7 +1093,7 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
     if (s->use_lazy_refcounts) {
         qcow2_mark_dirty(bs);
     }
-    if (qcow2_need_accurate_refcounts(s)) {
+    if (qcow2_need_accurate_refcounts(s) && !m->from_alloc_extent) {
         qcow2_cache_set_dependency(bs, s->l2_table_cache,
                                    s->refcount_block_cache);
     }
@@ -941,7 +1104,7 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
     }
     qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache, l2_table);
 
-    assert(l2_index + m->nb_clusters <= s->l2_size);
+    assert(l2_index + m->nb_clusters <= s->l2_slice_size);
     for (i = 0; i < m->nb_clusters; i++) {
         /* if two concurrent writes happen to the same unallocated cluster
          * each write allocates separate cluster and writes data concurrently.
@@ -949,12 +1112,28 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
          * cluster the second one has to do RMW (which is done above by
          * perform_cow()), update l2 table with its cluster pointer and free
          * old cluster. This is what this loop does */
-        if (l2_table[l2_index + i] != 0) {
-            old_cluster[j++] = l2_table[l2_index + i];
+        uint64_t old_entry = get_l2_entry(s, l2_table, l2_index + i);
+
+        if (old_entry != 0) {
+            old_cluster[j++] = old_entry;
         }
 
-        l2_table[l2_index + i] = cpu_to_be64((cluster_offset +
-                    (i << s->cluster_bits)) | QCOW_OFLAG_COPIED);
+        set_l2_entry(s, l2_table, l2_index + i, (cluster_offset +
+                     (i << s->cluster_bits)) | QCOW_OFLAG_COPIED);
+
+        if (has_subclusters(s)) {
+            /* Subclusters that the write doesn't cover keep their state
+             * unless the old cluster is replaced: in that case, the COW
+             * regions cover the whole cluster */
+            uint64_t l2_bitmap = 0;
+
+            if (m->keep_old_clusters ||
+                !(old_entry & (L2E_OFFSET_MASK | QCOW_OFLAG_COMPRESSED))) {
+                l2_bitmap = get_l2_bitmap(s, l2_table, l2_index + i);
+            }
+            set_l2_bitmap(s, l2_table, l2_index + i,
+                          l2meta_get_l2_bitmap(s, m, i, l2_bitmap));
+        }
      }
 
 
@@ -968,7 +1147,7 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
      */
     if (!m->keep_old_clusters && j != 0) {
         for (i = 0; i < j; i++) {
-            qcow2_free_any_clusters(bs, be64_to_cpu(old_cluster[i]), 1,
+            qcow2_free_any_clusters(bs, old_cluster[i], 1,
                                     QCOW2_DISCARD_NEVER);
         }
     }
@@ -990,9 +1169,16 @@ static int count_cow_clusters(BDRVQcow2State *s, int nb_clusters,
     int i;
 
     for (i = 0; i < nb_clusters; i++) {
-        uint64_t l2_entry = be64_to_cpu(l2_table[l2_index + i]);
+        uint64_t l2_entry = get_l2_entry(s, l2_table, l2_index + i);
         QCow2ClusterType cluster_type = qcow2_get_cluster_type(l2_entry);
 
+        /* Writes to unallocated subclusters of such a cluster are done in
+         * place by handle_alloc() */
+        if (has_subclusters(s) && cluster_type != QCOW2_CLUSTER_COMPRESSED &&
+            (l2_entry & L2E_OFFSET_MASK) && (l2_entry & QCOW_OFLAG_COPIED)) {
+            goto out;
+        }
+
         switch(cluster_type) {
         case QCOW2_CLUSTER_NORMAL:
             if (l2_entry & QCOW_OFLAG_COPIED) {
@@ -1042,12 +1228,22 @@ static int handle_dependencies(BlockDriverState *bs, uint64_t guest_offset,
         uint64_t old_start = l2meta_cow_start(old_alloc);
         uint64_t old_end = l2meta_cow_end(old_alloc);
 
+        if (has_subclusters(s)) {
+            /* COW regions only cover the subclusters that need it, but two
+             * allocations in the same cluster must still be serialized so
+             * that the L2 bitmap of the second includes the first */
+            start = start_of_cluster(s, start);
+            end = ROUND_UP(end, s->cluster_size);
+            old_start = start_of_cluster(s, old_start);
+            old_end = ROUND_UP(old_end, s->cluster_size);
+        }
+
         if (end <= old_start || start >= old_end) {
             /* No intersection */
         } else {
             if (start < old_start) {
                 /* Stop at the start of a running allocation */
-                bytes = old_start - start;
+                bytes = old_start - guest_offset;
             } else {
                 bytes = 0;
             }
@@ -1081,7 +1277,8 @@ static int handle_dependencies(BlockDriverState *bs, uint64_t guest_offset,
  * Checks how many already allocated clusters that don't require a copy on
  * write there are at the given guest_offset (up to *bytes). If
  * *host_offset is not zero, only physically contiguous clusters beginning at
- * this host offset are counted.
+ * this host offset are counted. With extended L2 entries, only the
+ * allocated subclusters of these clusters are counted.
  *
  * Note that guest_offset may not be cluster aligned. In this case, the
  * returned *host_offset points to exact byte referenced by guest_offset and
@@ -1108,6 +1305,7 @@ static int handle_copied(BlockDriverState *bs, uint64_t guest_offset,
     uint64_t *l2_table;
     uint64_t nb_clusters;
     unsigned int keep_clusters;
+    uint64_t keep_bytes;
     int ret;
 
     trace_qcow2_handle_copied(qemu_coroutine_self(), guest_offset, *host_offset,
@@ -1117,14 +1315,14 @@ static int handle_copied(BlockDriverState *bs, uint64_t guest_offset,
                                 == offset_into_cluster(s, *host_offset));
 
     /*
-     * Calculate the number of clusters to look for. We stop at L2 table
+     * Calculate the number of clusters to look for. We stop at L2 slice
      * boundaries to keep things simple.
      */
     nb_clusters =
         size_to_clusters(s, offset_into_cluster(s, guest_offset) + *bytes);
 
-    l2_index = offset_to_l2_index(s, guest_offset);
-    nb_clusters = MIN(nb_clusters, s->l2_size - l2_index);
+    l2_index = offset_to_l2_slice_index(s, guest_offset);
+    nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
 
     /* Find L2 entry for the first involved cluster */
@@ -1133,7 +1331,7 @@ static int handle_copied(BlockDriverState *bs, uint64_t guest_offset,
         return ret;
     }
 
-    cluster_offset = be64_to_cpu(l2_table[l2_index]);
+    cluster_offset = get_l2_entry(s, l2_table, l2_index);
 
     /* Check how many clusters are already allocated and don't need COW */
     if (qcow2_get_cluster_type(cluster_offset) == QCOW2_CLUSTER_NORMAL
@@ -1160,14 +1358,28 @@ static int handle_copied(BlockDriverState *bs, uint64_t guest_offset,
 
         /* We keep all QCOW_OFLAG_COPIED clusters */
         keep_clusters =
-            count_contiguous_clusters(nb_clusters, s->cluster_size,
-                                      &l2_table[l2_index],
+            count_contiguous_clusters(s, nb_clusters, l2_table, l2_index,
                                       QCOW_OFLAG_COPIED | QCOW_OFLAG_ZERO);
         assert(keep_clusters <= nb_clusters);
+        keep_bytes = keep_clusters * s->cluster_size;
+
+        if (has_subclusters(s)) {
+            int sc_index = offset_to_sc_index(s, guest_offset);
+
+            /* ...but only their allocated subclusters */
+            ret = count_contiguous_subclusters(bs, keep_clusters, sc_index,
+                                               l2_table, l2_index,
+                                               &keep_bytes);
+            if (ret < 0) {
+                goto out;
+            } else if (ret != QCOW2_CLUSTER_NORMAL) {
+                ret = 0;
+                goto out;
+            }
+        }
 
         *bytes = MIN(*bytes,
-                 keep_clusters * s->cluster_size
-                 - offset_into_cluster(s, guest_offset));
+                 keep_bytes - offset_into_cluster(s, guest_offset));
 
         ret = 1;
     } else {
@@ -1207,14 +1419,103 @@ out:
  * function has been waiting for another request and the allocation must be
  * restarted, but the whole request should not be failed.
  */
+/*
+ * Frees the clusters of the allocation extent that have not been handed out
+ * yet. This must be done before anything that expects all allocated clusters
+ * to be referenced, like closing or checking the image.
+ */
+void qcow2_release_alloc_extent(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->alloc_extent_bytes) {
+        qcow2_free_clusters(bs, s->alloc_extent_offset, s->alloc_extent_bytes,
+                            QCOW2_DISCARD_NEVER);
+        s->alloc_extent_bytes = 0;
+    }
+}
+
+/*
+ * Takes clusters from the allocation extent, allocating a new extent first if
+ * the old one is used up. Only the refcount update of the whole extent needs
+ * a flush, so clusters taken from it can be linked into the L2 tables without
+ * any refcount write.
+ *
+ * If *host_offset is non-zero, clusters are only taken if they start there.
+ *
+ * Returns 1 if *nb_clusters (possibly decreased) clusters were taken at
+ * *host_offset, 0 if the clusters must be allocated the usual way, and -errno
+ * on error.
+ */
+static int alloc_from_extent(BlockDriverState *bs, uint64_t *host_offset,
+                             uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t extent_clusters = s->alloc_extent_size >> s->cluster_bits;
+    int ret;
+
+    if (s->alloc_extent_bytes == 0) {
+        if (*host_offset == 0) {
+            int64_t offset;
+
+            extent_clusters = MAX(extent_clusters, *nb_clusters);
+            offset = qcow2_alloc_clusters(bs,
+                                          extent_clusters << s->cluster_bits);
+            if (offset < 0) {
+                return offset;
+            }
+            s->alloc_extent_offset = offset;
+        } else {
+            /* Continue a contiguous allocation where the old extent ended */
+            int64_t n = qcow2_alloc_clusters_at(bs, *host_offset,
+                                                extent_clusters);
+            if (n <= 0) {
+                return n;
+            }
+            extent_clusters = n;
+            s->alloc_extent_offset = *host_offset;
+        }
+        s->alloc_extent_bytes = extent_clusters << s->cluster_bits;
+
+        ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+        if (ret < 0) {
+            qcow2_release_alloc_extent(bs);
+            return ret;
+        }
+    }
+
+    if (*host_offset != 0 && *host_offset != s->alloc_extent_offset) {
+        return 0;
+    }
+
+    *host_offset = s->alloc_extent_offset;
+    *nb_clusters = MIN(*nb_clusters, s->alloc_extent_bytes >> s->cluster_bits);
+    s->alloc_extent_offset += *nb_clusters << s->cluster_bits;
+    s->alloc_extent_bytes -= *nb_clusters << s->cluster_bits;
+
+    return 1;
+}
+
 static int do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
-                                   uint64_t *host_offset, uint64_t *nb_clusters)
+                                   uint64_t *host_offset, uint64_t *nb_clusters,
+                                   bool *from_alloc_extent)
 {
     BDRVQcow2State *s = bs->opaque;
 
     trace_qcow2_do_alloc_clusters_offset(qemu_coroutine_self(), guest_offset,
                                          *host_offset, *nb_clusters);
 
+    *from_alloc_extent = false;
+    if (s->alloc_extent_size) {
+        int ret = alloc_from_extent(bs, host_offset, nb_clusters);
+        if (ret < 0) {
+            return ret;
+        } else if (ret > 0) {
+            *from_alloc_extent = true;
+            return 0;
+        }
+    }
+
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
     if (*host_offset == 0) {
@@ -1265,6 +1566,8 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
     uint64_t nb_clusters;
     int ret;
     bool keep_old_clusters = false;
+    bool from_alloc_extent = false;
+    bool cow_start_full = true, cow_end_full = true;
 
     uint64_t alloc_cluster_offset = 0;
 
@@ -1273,14 +1576,14 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
     assert(*bytes > 0);
 
     /*
-     * Calculate the number of clusters to look for. We stop at L2 table
+     * Calculate the number of clusters to look for. We stop at L2 slice
      * boundaries to keep things simple.
      */
     nb_clusters =
         size_to_clusters(s, offset_into_cluster(s, guest_offset) + *bytes);
 
-    l2_index = offset_to_l2_index(s, guest_offset);
-    nb_clusters = MIN(nb_clusters, s->l2_size - l2_index);
+    l2_index = offset_to_l2_slice_index(s, guest_offset);
+    nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
 
     /* Find L2 entry for the first involved cluster */
@@ -1289,10 +1592,24 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
         return ret;
     }
 
-    entry = be64_to_cpu(l2_table[l2_index]);
+    entry = get_l2_entry(s, l2_table, l2_index);
+
+    if (has_subclusters(s) && !(entry & QCOW_OFLAG_COMPRESSED) &&
+        (entry & L2E_OFFSET_MASK) && (entry & QCOW_OFLAG_COPIED)) {
+        /* The subclusters of this cluster that handle_copied() didn't take
+         * are unallocated; write them in place, one cluster at a time */
+        if (*host_offset &&
+            start_of_cluster(s, *host_offset) != (entry & L2E_OFFSET_MASK)) {
+            qcow2_cache_put(bs, s->l2_table_cache, (void **) &l2_table);
+            *bytes = 0;
+            return 0;
+        }
 
-    /* For the moment, overwrite compressed clusters one by one */
-    if (entry & QCOW_OFLAG_COMPRESSED) {
+        nb_clusters = 1;
+        alloc_cluster_offset = entry & L2E_OFFSET_MASK;
+        keep_old_clusters = true;
+    } else if (entry & QCOW_OFLAG_COMPRESSED) {
+        /* For the moment, overwrite compressed clusters one by one */
         nb_clusters = 1;
     } else {
         nb_clusters = count_cow_clusters(s, nb_clusters, l2_table, l2_index);
@@ -1303,7 +1620,21 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
      * wrong with our code. */
     assert(nb_clusters > 0);
 
-    if (qcow2_get_cluster_type(entry) == QCOW2_CLUSTER_ZERO_ALLOC &&
+    /* The data of a replaced cluster must be copied whole; otherwise, COW is
+     * only needed for the subclusters that the write covers partially */
+    if (has_subclusters(s)) {
+        uint64_t last_entry = get_l2_entry(s, l2_table,
+                                           l2_index + nb_clusters - 1);
+
+        cow_start_full = !keep_old_clusters &&
+                         (entry & (L2E_OFFSET_MASK | QCOW_OFLAG_COMPRESSED));
+        cow_end_full = !keep_old_clusters &&
+                       (last_entry & (L2E_OFFSET_MASK |
+                                      QCOW_OFLAG_COMPRESSED));
+    }
+
+    if (!keep_old_clusters &&
+        qcow2_get_cluster_type(entry) == QCOW2_CLUSTER_ZERO_ALLOC &&
         (entry & QCOW_OFLAG_COPIED) &&
         (!*host_offset ||
          start_of_cluster(s, *host_offset) == (entry & L2E_OFFSET_MASK)))
@@ -1323,8 +1654,8 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
          * would be fine, too, but count_cow_clusters() above has limited
          * nb_clusters already to a range of COW clusters */
         preallocated_nb_clusters =
-            count_contiguous_clusters(nb_clusters, s->cluster_size,
-                                      &l2_table[l2_index], QCOW_OFLAG_COPIED);
+            count_contiguous_clusters(s, nb_clusters, l2_table, l2_index,
+                                      QCOW_OFLAG_COPIED);
         assert(preallocated_nb_clusters > 0);
 
         nb_clusters = preallocated_nb_clusters;
@@ -1341,7 +1672,7 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
         /* Allocate, if necessary at a given offset in the image file */
         alloc_cluster_offset = start_of_cluster(s, *host_offset);
         ret = do_alloc_cluster_offset(bs, guest_offset, &alloc_cluster_offset,
-                                      &nb_clusters);
+                                      &nb_clusters, &from_alloc_extent);
         if (ret < 0) {
             goto fail;
         }
@@ -1381,8 +1712,18 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
     uint64_t requested_bytes = *bytes + offset_into_cluster(s, guest_offset);
     int avail_bytes = MIN(INT_MAX, nb_clusters << s->cluster_bits);
     int nb_bytes = MIN(requested_bytes, avail_bytes);
+    int cow_start_from = 0, cow_end_to = avail_bytes;
     QCowL2Meta *old_m = *m;
 
+    if (!cow_start_full) {
+        cow_start_from = QEMU_ALIGN_DOWN(offset_into_cluster(s, guest_offset),
+                                         s->subcluster_size);
+    }
+    if (!cow_end_full) {
+        cow_end_to = MIN(avail_bytes, QEMU_ALIGN_UP(nb_bytes,
+                                                    s->subcluster_size));
+    }
+
     *m = g_malloc0(sizeof(**m));
 
     **m = (QCowL2Meta) {
@@ -1393,14 +1734,16 @@ static int handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
         .nb_clusters    = nb_clusters,
 
         .keep_old_clusters  = keep_old_clusters,
+        .from_alloc_extent  = from_alloc_extent,
 
         .cow_start = {
-            .offset     = 0,
-            .nb_bytes   = offset_into_cluster(s, guest_offset),
+            .offset     = cow_start_from,
+            .nb_bytes   = offset_into_cluster(s, guest_offset)
+                          - cow_start_from,
         },
         .cow_end = {
             .offset     = nb_bytes,
-            .nb_bytes   = avail_bytes - nb_bytes,
+            .nb_bytes   = cow_end_to - nb_bytes,
         },
     };
     qemu_co_queue_init(&(*m)->dependent_requests);
@@ -1545,12 +1888,65 @@ again:
     return 0;
 }
 
-static int decompress_buffer(uint8_t *out_buf, int out_buf_size,
+#ifdef CONFIG_ZSTD
+static int zstd_decompress_buffer(uint8_t *out_buf, int out_buf_size,
+                                  const uint8_t *buf, int buf_size)
+{
+    ZSTD_DStream *zds;
+    ZSTD_inBuffer in = { .src = buf, .size = buf_size };
+    ZSTD_outBuffer out = { .dst = out_buf, .size = out_buf_size };
+    size_t zret;
+    int ret = -1;
+
+    zds = ZSTD_createDStream();
+    if (!zds) {
+        return -1;
+    }
+    zret = ZSTD_initDStream(zds);
+    if (ZSTD_isError(zret)) {
+        goto out;
+    }
+
+    /* @buf is padded up to a sector, so stop at the end of the frame */
+    while (true) {
+        zret = ZSTD_decompressStream(zds, &out, &in);
+        if (ZSTD_isError(zret)) {
+            break;
+        }
+        if (zret == 0) {
+            ret = out.pos == out.size ? 0 : -1;
+            break;
+        }
+        if (in.pos == in.size || out.pos == out.size) {
+            break;
+        }
+    }
+
+out:
+    ZSTD_freeDStream(zds);
+    return ret;
+}
+#endif
+
+static int decompress_buffer(Qcow2CompressionType type,
+                             uint8_t *out_buf, int out_buf_size,
                              const uint8_t *buf, int buf_size)
 {
     z_stream strm1, *strm = &strm1;
     int ret, out_len;
 
+    switch (type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        break;
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD:
+        return zstd_decompress_buffer(out_buf, out_buf_size, buf, buf_size);
+#endif
+    default:
+        /* refused by qcow2_open() */
+        g_assert_not_reached();
+    }
+
     memset(strm, 0, sizeof(*strm));
 
     strm->next_in = (uint8_t *)buf;
@@ -1572,52 +1968,227 @@ static int decompress_buffer(uint8_t *out_buf, int out_buf_size,
     return 0;
 }
 
-int qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset)
+typedef struct Qcow2DecompressData {
+    Qcow2CompressionType type;
+    uint8_t *dest;
+    int dest_size;
+    const uint8_t *src;
+    int src_size;
+    int ret;
+} Qcow2DecompressData;
+
+static int qcow2_decompress_pool_func(void *opaque)
+{
+    Qcow2DecompressData *data = opaque;
+
+    data->ret = decompress_buffer(data->type, data->dest, data->dest_size,
+                                  data->src, data->src_size);
+
+    return 0;
+}
+
+void qcow2_compressed_cache_init(BDRVQcow2State *s)
+{
+    int i;
+
+    for (i = 0; i < QCOW2_COMPRESSED_CACHE_SIZE; i++) {
+        s->compressed_cache[i].offset = -1;
+    }
+    qemu_co_queue_init(&s->compressed_cache_queue);
+}
+
+/*
+ * Called when clusters may have been freed and reused: the cached data
+ * could belong to an old compressed cluster at the same host offset.
+ */
+void qcow2_compressed_cache_invalidate(BDRVQcow2State *s)
+{
+    int i;
+
+    for (i = 0; i < QCOW2_COMPRESSED_CACHE_SIZE; i++) {
+        if (s->compressed_cache[i].loading) {
+            s->compressed_cache[i].stale = true;
+        } else {
+            s->compressed_cache[i].offset = -1;
+        }
+    }
+}
+
+void qcow2_compressed_cache_free(BDRVQcow2State *s)
+{
+    int i;
+
+    for (i = 0; i < QCOW2_COMPRESSED_CACHE_SIZE; i++) {
+        g_free(s->compressed_cache[i].data);
+        s->compressed_cache[i].data = NULL;
+        s->compressed_cache[i].offset = -1;
+    }
+}
+
+static Qcow2CompressedCacheEntry *
+compressed_cache_lookup(BDRVQcow2State *s, uint64_t coffset)
+{
+    int i;
+
+    for (i = 0; i < QCOW2_COMPRESSED_CACHE_SIZE; i++) {
+        if (s->compressed_cache[i].offset == coffset &&
+            !s->compressed_cache[i].stale) {
+            return &s->compressed_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/* Returns the least recently used entry that isn't loading, if any */
+static Qcow2CompressedCacheEntry *
+compressed_cache_victim(BDRVQcow2State *s)
+{
+    Qcow2CompressedCacheEntry *victim = NULL;
+    int i;
+
+    for (i = 0; i < QCOW2_COMPRESSED_CACHE_SIZE; i++) {
+        Qcow2CompressedCacheEntry *e = &s->compressed_cache[i];
+
+        if (e->loading) {
+            continue;
+        }
+        if (e->offset == -1) {
+            return e;
+        }
+        if (!victim || e->lru_counter < victim->lru_counter) {
+            victim = e;
+        }
+    }
+    return victim;
+}
+
+/*
+ * Reads and decompresses the cluster into @e, with s->lock dropped and
+ * the decompression done in the thread pool, so that readers of other
+ * clusters go on meanwhile.
+ */
+static int coroutine_fn compressed_cache_load(BlockDriverState *bs,
+                                              Qcow2CompressedCacheEntry *e,
+                                              uint64_t cluster_offset)
 {
     BDRVQcow2State *s = bs->opaque;
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    Qcow2DecompressData arg;
+    QEMUIOVector qiov;
+    struct iovec iov;
     int ret, csize, nb_csectors, sector_offset;
     uint64_t coffset;
+    uint8_t *buf;
 
     coffset = cluster_offset & s->cluster_offset_mask;
-    if (s->cluster_cache_offset != coffset) {
-        nb_csectors = ((cluster_offset >> s->csize_shift) & s->csize_mask) + 1;
-        sector_offset = coffset & 511;
-        csize = nb_csectors * 512 - sector_offset;
-
-        /* Allocate buffers on first decompress operation, most images are
-         * uncompressed and the memory overhead can be avoided.  The buffers
-         * are freed in .bdrv_close().
-         */
-        if (!s->cluster_data) {
-            /* one more sector for decompressed data alignment */
-            s->cluster_data = qemu_try_blockalign(bs->file->bs,
-                    QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size + 512);
-            if (!s->cluster_data) {
-                return -ENOMEM;
-            }
+    nb_csectors = ((cluster_offset >> s->csize_shift) & s->csize_mask) + 1;
+    sector_offset = coffset & 511;
+    csize = nb_csectors * 512 - sector_offset;
+
+    buf = qemu_try_blockalign(bs->file->bs, nb_csectors * 512);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    iov.iov_base = buf;
+    iov.iov_len = nb_csectors * 512;
+    qemu_iovec_init_external(&qiov, &iov, 1);
+
+    qemu_co_mutex_unlock(&s->lock);
+
+    BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_co_preadv(bs->file, coffset - sector_offset, iov.iov_len,
+                         &qiov, 0);
+    if (ret >= 0) {
+        arg = (Qcow2DecompressData) {
+            .type = s->compression_type,
+            .dest = e->data,
+            .dest_size = s->cluster_size,
+            .src = buf + sector_offset,
+            .src_size = csize,
+        };
+        thread_pool_submit_co(pool, qcow2_decompress_pool_func, &arg);
+        ret = arg.ret < 0 ? -EIO : 0;
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+
+    qemu_vfree(buf);
+    return ret;
+}
+
+/*
+ * qcow2_co_read_compressed()
+ *
+ * Copies @bytes of the compressed cluster at @cluster_offset (its L2
+ * entry) to @qiov, going through the decompressed cluster cache.
+ *
+ * Called with s->lock held, which is dropped on cache misses.
+ */
+int coroutine_fn qcow2_co_read_compressed(BlockDriverState *bs,
+                                          uint64_t cluster_offset,
+                                          int offset_in_cluster,
+                                          QEMUIOVector *qiov, size_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressedCacheEntry *e;
+    uint64_t coffset;
+    int ret;
+
+    coffset = cluster_offset & s->cluster_offset_mask;
+
+    while (true) {
+        e = compressed_cache_lookup(s, coffset);
+        if (e && !e->loading) {
+            e->lru_counter = ++s->compressed_cache_lru_counter;
+            qemu_iovec_from_buf(qiov, 0, e->data + offset_in_cluster, bytes);
+            return 0;
         }
-        if (!s->cluster_cache) {
-            s->cluster_cache = g_malloc(s->cluster_size);
+        if (!e) {
+            e = compressed_cache_victim(s);
+            if (e) {
+                break;
+            }
         }
+        /* Wait for the cluster to be loaded by someone else, or for an
+         * entry to be available */
+        qemu_co_queue_wait(&s->compressed_cache_queue, &s->lock);
+    }
 
-        BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
-        ret = bdrv_read(bs->file, coffset >> 9, s->cluster_data,
-                        nb_csectors);
-        if (ret < 0) {
-            return ret;
-        }
-        if (decompress_buffer(s->cluster_cache, s->cluster_size,
-                              s->cluster_data + sector_offset, csize) < 0) {
-            return -EIO;
+    /* Allocate buffers on first decompress operation, most images are
+     * uncompressed and the memory overhead can be avoided.  The buffers
+     * are freed in .bdrv_close().
+     */
+    if (!e->data) {
+        e->data = g_try_malloc(s->cluster_size);
+        if (!e->data) {
+            return -ENOMEM;
         }
-        s->cluster_cache_offset = coffset;
     }
-    return 0;
+
+    e->offset = coffset;
+    e->loading = true;
+    e->stale = false;
+
+    ret = compressed_cache_load(bs, e, cluster_offset);
+
+    e->loading = false;
+    if (ret >= 0) {
+        e->lru_counter = ++s->compressed_cache_lru_counter;
+        qemu_iovec_from_buf(qiov, 0, e->data + offset_in_cluster, bytes);
+    }
+    if (ret < 0 || e->stale) {
+        e->offset = -1;
+        e->stale = false;
+    }
+    qemu_co_queue_restart_all(&s->compressed_cache_queue);
+
+    return ret;
 }
 
 /*
  * This discards as many clusters of nb_clusters as possible at once (i.e.
- * all clusters in the same L2 table) and returns the number of discarded
+ * all clusters in the same L2 slice) and returns the number of discarded
  * clusters.
  */
 static int discard_single_l2(BlockDriverState *bs, uint64_t offset,
@@ -1635,14 +2206,14 @@ static int discard_single_l2(BlockDriverState *bs, uint64_t offset,
         return ret;
     }
 
-    /* Limit nb_clusters to one L2 table */
-    nb_clusters = MIN(nb_clusters, s->l2_size - l2_index);
+    /* Limit nb_clusters to one L2 slice */
+    nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
 
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_l2_entry;
 
-        old_l2_entry = be64_to_cpu(l2_table[l2_index + i]);
+        old_l2_entry = get_l2_entry(s, l2_table, l2_index + i);
 
         /*
          * If full_discard is false, make sure that a discarded area reads back
@@ -1657,9 +2228,15 @@ static int discard_single_l2(BlockDriverState *bs, uint64_t offset,
          * If full_discard is true, the sector should not read back as zeroes,
          * but rather fall through to the backing file.
          */
-        switch (qcow2_get_cluster_type(old_l2_entry)) {
+        switch (qcow2_get_l2_cluster_type(s, l2_table, l2_index + i)) {
         case QCOW2_CLUSTER_UNALLOCATED:
-            if (full_discard || !bs->backing) {
+            if (full_discard) {
+                /* Some of its subclusters may still read as zeros */
+                if (!has_subclusters(s) ||
+                    !get_l2_bitmap(s, l2_table, l2_index + i)) {
+                    continue;
+                }
+            } else if (!bs->backing) {
                 continue;
             }
             break;
@@ -1681,10 +2258,14 @@ static int discard_single_l2(BlockDriverState *bs, uint64_t offset,
 
         /* First remove L2 entries */
         qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache, l2_table);
-        if (!full_discard && s->qcow_version >= 3) {
-            l2_table[l2_index + i] = cpu_to_be64(QCOW_OFLAG_ZERO);
+        if (has_subclusters(s)) {
+            set_l2_entry(s, l2_table, l2_index + i, 0);
+            set_l2_bitmap(s, l2_table, l2_index + i,
+                          full_discard ? 0 : QCOW_L2_BITMAP_ALL_ZEROES);
+        } else if (!full_discard && s->qcow_version >= 3) {
+            set_l2_entry(s, l2_table, l2_index + i, QCOW_OFLAG_ZERO);
         } else {
-            l2_table[l2_index + i] = cpu_to_be64(0);
+            set_l2_entry(s, l2_table, l2_index + i, 0);
         }
 
         /* Then decrease the refcount */
@@ -1756,21 +2337,21 @@ static int zero_single_l2(BlockDriverState *bs, uint64_t offset,
         return ret;
     }
 
-    /* Limit nb_clusters to one L2 table */
-    nb_clusters = MIN(nb_clusters, s->l2_size - l2_index);
+    /* Limit nb_clusters to one L2 slice */
+    nb_clusters = MIN(nb_clusters, s->l2_slice_size - l2_index);
     assert(nb_clusters <= INT_MAX);
 
     for (i = 0; i < nb_clusters; i++) {
         uint64_t old_offset;
         QCow2ClusterType cluster_type;
 
-        old_offset = be64_to_cpu(l2_table[l2_index + i]);
+        old_offset = get_l2_entry(s, l2_table, l2_index + i);
 
         /*
          * Minimize L2 changes if the cluster already reads back as
          * zeroes with correct allocation.
          */
-        cluster_type = qcow2_get_cluster_type(old_offset);
+        cluster_type = qcow2_get_l2_cluster_type(s, l2_table, l2_index + i);
         if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN ||
             (cluster_type == QCOW2_CLUSTER_ZERO_ALLOC && !unmap)) {
             continue;
@@ -1778,10 +2359,20 @@ static int zero_single_l2(BlockDriverState *bs, uint64_t offset,
 
         qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache, l2_table);
         if (cluster_type == QCOW2_CLUSTER_COMPRESSED || unmap) {
-            l2_table[l2_index + i] = cpu_to_be64(QCOW_OFLAG_ZERO);
+            if (has_subclusters(s)) {
+                set_l2_entry(s, l2_table, l2_index + i, 0);
+                set_l2_bitmap(s, l2_table, l2_index + i,
+                              QCOW_L2_BITMAP_ALL_ZEROES);
+            } else {
+                set_l2_entry(s, l2_table, l2_index + i, QCOW_OFLAG_ZERO);
+            }
             qcow2_free_any_clusters(bs, old_offset, 1, QCOW2_DISCARD_REQUEST);
+        } else if (has_subclusters(s)) {
+            set_l2_bitmap(s, l2_table, l2_index + i,
+                          QCOW_L2_BITMAP_ALL_ZEROES);
         } else {
-            l2_table[l2_index + i] |= cpu_to_be64(QCOW_OFLAG_ZERO);
+            set_l2_entry(s, l2_table, l2_index + i,
+                         old_offset | QCOW_OFLAG_ZERO);
         }
     }
 
@@ -1849,22 +2440,25 @@ static int expand_zero_clusters_in_l1(BlockDriverState *bs, uint64_t *l1_table,
 {
     BDRVQcow2State *s = bs->opaque;
     bool is_active_l1 = (l1_table == s->l1_table);
-    uint64_t *l2_table = NULL;
+    uint64_t *l2_slice = NULL;
+    unsigned slice, slice_size2, n_slices;
     int ret;
     int i, j;
 
+    slice_size2 = s->l2_slice_size * l2_entry_size(s);
+    n_slices = s->cluster_size / slice_size2;
+
     if (!is_active_l1) {
         /* inactive L2 tables require a buffer to be stored in when loading
          * them from disk */
-        l2_table = qemu_try_blockalign(bs->file->bs, s->cluster_size);
-        if (l2_table == NULL) {
+        l2_slice = qemu_try_blockalign(bs->file->bs, slice_size2);
+        if (l2_slice == NULL) {
             return -ENOMEM;
         }
     }
 
     for (i = 0; i < l1_size; i++) {
         uint64_t l2_offset = l1_table[i] & L1E_OFFSET_MASK;
-        bool l2_dirty = false;
         uint64_t l2_refcount;
 
         if (!l2_offset) {
@@ -1884,124 +2478,133 @@ static int expand_zero_clusters_in_l1(BlockDriverState *bs, uint64_t *l1_table,
             goto fail;
         }
 
-        if (is_active_l1) {
-            /* get active L2 tables from cache */
-            ret = qcow2_cache_get(bs, s->l2_table_cache, l2_offset,
-                    (void **)&l2_table);
-        } else {
-            /* load inactive L2 tables from disk */
-            ret = bdrv_read(bs->file, l2_offset / BDRV_SECTOR_SIZE,
-                            (void *)l2_table, s->cluster_sectors);
-        }
-        if (ret < 0) {
-            goto fail;
-        }
-
         ret = qcow2_get_refcount(bs, l2_offset >> s->cluster_bits,
                                  &l2_refcount);
         if (ret < 0) {
             goto fail;
         }
 
-        for (j = 0; j < s->l2_size; j++) {
-            uint64_t l2_entry = be64_to_cpu(l2_table[j]);
-            int64_t offset = l2_entry & L2E_OFFSET_MASK;
-            QCow2ClusterType cluster_type = qcow2_get_cluster_type(l2_entry);
+        for (slice = 0; slice < n_slices; slice++) {
+            uint64_t slice_offset = l2_offset + slice * slice_size2;
+            bool l2_dirty = false;
 
-            if (cluster_type != QCOW2_CLUSTER_ZERO_PLAIN &&
-                cluster_type != QCOW2_CLUSTER_ZERO_ALLOC) {
-                continue;
+            if (is_active_l1) {
+                /* get active L2 tables from cache */
+                ret = qcow2_cache_get(bs, s->l2_table_cache, slice_offset,
+                                      (void **)&l2_slice);
+            } else {
+                /* load inactive L2 tables from disk */
+                ret = bdrv_pread(bs->file, slice_offset, l2_slice,
+                                 slice_size2);
+            }
+            if (ret < 0) {
+                goto fail;
             }
 
-            if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN) {
-                if (!bs->backing) {
-                    /* not backed; therefore we can simply deallocate the
-                     * cluster */
-                    l2_table[j] = 0;
-                    l2_dirty = true;
+            for (j = 0; j < s->l2_slice_size; j++) {
+                uint64_t l2_entry = be64_to_cpu(l2_slice[j]);
+                int64_t offset = l2_entry & L2E_OFFSET_MASK;
+                QCow2ClusterType cluster_type =
+                    qcow2_get_cluster_type(l2_entry);
+
+                if (cluster_type != QCOW2_CLUSTER_ZERO_PLAIN &&
+                    cluster_type != QCOW2_CLUSTER_ZERO_ALLOC) {
                     continue;
                 }
 
-                offset = qcow2_alloc_clusters(bs, s->cluster_size);
-                if (offset < 0) {
-                    ret = offset;
-                    goto fail;
-                }
+                if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN) {
+                    if (!bs->backing) {
+                        /* not backed; therefore we can simply deallocate the
+                         * cluster */
+                        l2_slice[j] = 0;
+                        l2_dirty = true;
+                        continue;
+                    }
 
-                if (l2_refcount > 1) {
-                    /* For shared L2 tables, set the refcount accordingly (it is
-                     * already 1 and needs to be l2_refcount) */
-                    ret = qcow2_update_cluster_refcount(bs,
-                            offset >> s->cluster_bits,
-                            refcount_diff(1, l2_refcount), false,
-                            QCOW2_DISCARD_OTHER);
-                    if (ret < 0) {
-                        qcow2_free_clusters(bs, offset, s->cluster_size,
-                                            QCOW2_DISCARD_OTHER);
+                    offset = qcow2_alloc_clusters(bs, s->cluster_size);
+                    if (offset < 0) {
+                        ret = offset;
                         goto fail;
                     }
+
+                    if (l2_refcount > 1) {
+                        /* For shared L2 tables, set the refcount accordingly
+                         * (it is already 1 and needs to be l2_refcount) */
+                        ret = qcow2_update_cluster_refcount(bs,
+                                offset >> s->cluster_bits,
+                                refcount_diff(1, l2_refcount), false,
+                                QCOW2_DISCARD_OTHER);
+                        if (ret < 0) {
+                            qcow2_free_clusters(bs, offset, s->cluster_size,
+                                                QCOW2_DISCARD_OTHER);
+                            goto fail;
+                        }
+                    }
                 }
-            }
 
-            if (offset_into_cluster(s, offset)) {
-                qcow2_signal_corruption(bs, true, -1, -1,
-                                        "Cluster allocation offset "
-                                        "%#" PRIx64 " unaligned (L2 offset: %#"
-                                        PRIx64 ", L2 index: %#x)", offset,
-                                        l2_offset, j);
-                if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN) {
-                    qcow2_free_clusters(bs, offset, s->cluster_size,
-                                        QCOW2_DISCARD_ALWAYS);
+                if (offset_into_cluster(s, offset)) {
+                    int l2_index = slice * s->l2_slice_size + j;
+                    qcow2_signal_corruption(bs, true, -1, -1,
+                                            "Cluster allocation offset "
+                                            "%#" PRIx64 " unaligned (L2 offset:"
+                                            " %#" PRIx64 ", L2 index: %#x)",
+                                            offset, l2_offset, l2_index);
+                    if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN) {
+                        qcow2_free_clusters(bs, offset, s->cluster_size,
+                                            QCOW2_DISCARD_ALWAYS);
+                    }
+                    ret = -EIO;
+                    goto fail;
                 }
-                ret = -EIO;
-                goto fail;
-            }
 
-            ret = qcow2_pre_write_overlap_check(bs, 0, offset, s->cluster_size);
-            if (ret < 0) {
-                if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN) {
-                    qcow2_free_clusters(bs, offset, s->cluster_size,
-                                        QCOW2_DISCARD_ALWAYS);
+                ret = qcow2_pre_write_overlap_check(bs, 0, offset,
+                                                    s->cluster_size);
+                if (ret < 0) {
+                    if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN) {
+                        qcow2_free_clusters(bs, offset, s->cluster_size,
+                                            QCOW2_DISCARD_ALWAYS);
+                    }
+                    goto fail;
                 }
-                goto fail;
-            }
 
-            ret = bdrv_pwrite_zeroes(bs->file, offset, s->cluster_size, 0);
-            if (ret < 0) {
-                if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN) {
-                    qcow2_free_clusters(bs, offset, s->cluster_size,
-                                        QCOW2_DISCARD_ALWAYS);
+                ret = bdrv_pwrite_zeroes(bs->file, offset, s->cluster_size, 0);
+                if (ret < 0) {
+                    if (cluster_type == QCOW2_CLUSTER_ZERO_PLAIN) {
+                        qcow2_free_clusters(bs, offset, s->cluster_size,
+                                            QCOW2_DISCARD_ALWAYS);
+                    }
+                    goto fail;
                 }
-                goto fail;
-            }
 
-            if (l2_refcount == 1) {
-                l2_table[j] = cpu_to_be64(offset | QCOW_OFLAG_COPIED);
-            } else {
-                l2_table[j] = cpu_to_be64(offset);
+                if (l2_refcount == 1) {
+                    l2_slice[j] = cpu_to_be64(offset | QCOW_OFLAG_COPIED);
+                } else {
+                    l2_slice[j] = cpu_to_be64(offset);
+                }
+                l2_dirty = true;
             }
-            l2_dirty = true;
-        }
 
-        if (is_active_l1) {
-            if (l2_dirty) {
-                qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache, l2_table);
-                qcow2_cache_depends_on_flush(s->l2_table_cache);
-            }
-            qcow2_cache_put(bs, s->l2_table_cache, (void **) &l2_table);
-        } else {
-            if (l2_dirty) {
-                ret = qcow2_pre_write_overlap_check(bs,
-                        QCOW2_OL_INACTIVE_L2 | QCOW2_OL_ACTIVE_L2, l2_offset,
-                        s->cluster_size);
-                if (ret < 0) {
-                    goto fail;
+            if (is_active_l1) {
+                if (l2_dirty) {
+                    qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache,
+                                                 l2_slice);
+                    qcow2_cache_depends_on_flush(s->l2_table_cache);
                 }
+                qcow2_cache_put(bs, s->l2_table_cache, (void **) &l2_slice);
+            } else {
+                if (l2_dirty) {
+                    ret = qcow2_pre_write_overlap_check(bs,
+                            QCOW2_OL_INACTIVE_L2 | QCOW2_OL_ACTIVE_L2,
+                            slice_offset, slice_size2);
+                    if (ret < 0) {
+                        goto fail;
+                    }
 
-                ret = bdrv_write(bs->file, l2_offset / BDRV_SECTOR_SIZE,
-                                 (void *)l2_table, s->cluster_sectors);
-                if (ret < 0) {
-                    goto fail;
+                    ret = bdrv_pwrite(bs->file, slice_offset,
+                                      l2_slice, slice_size2);
+                    if (ret < 0) {
+                        goto fail;
+                    }
                 }
             }
         }
@@ -2015,11 +2618,11 @@ static int expand_zero_clusters_in_l1(BlockDriverState *bs, uint64_t *l1_table,
     ret = 0;
 
 fail:
-    if (l2_table) {
+    if (l2_slice) {
         if (!is_active_l1) {
-            qemu_vfree(l2_table);
+            qemu_vfree(l2_slice);
         } else {
-            qcow2_cache_put(bs, s->l2_table_cache, (void **) &l2_table);
+            qcow2_cache_put(bs, s->l2_table_cache, (void **) &l2_slice);
         }
     }
     return ret;
@@ -2041,6 +2644,9 @@ int qcow2_expand_zero_clusters(BlockDriverState *bs,
     int ret;
     int i, j;
 
+    /* Only needed for downgrading, which extended L2 entries prevent */
+    assert(!has_subclusters(s));
+
     if (status_cb) {
         l1_entries = s->l1_size;
         for (i = 0; i < s->nb_snapshots; i++) {
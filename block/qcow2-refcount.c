@@ -871,17 +871,26 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
 
         if (refcount == 0) {
             void *table;
+            int64_t slice_offset;
+            unsigned slice_size2;
 
             table = qcow2_cache_is_table_offset(bs, s->refcount_block_cache,
-                                                offset);
+                                                cluster_offset);
             if (table != NULL) {
                 qcow2_cache_put(bs, s->refcount_block_cache, &refcount_block);
                 qcow2_cache_discard(bs, s->refcount_block_cache, table);
             }
 
-            table = qcow2_cache_is_table_offset(bs, s->l2_table_cache, offset);
-            if (table != NULL) {
-                qcow2_cache_discard(bs, s->l2_table_cache, table);
+            /* An L2 table may be cached as several slices */
+            slice_size2 = s->l2_slice_size * l2_entry_size(s);
+            for (slice_offset = cluster_offset;
+                 slice_offset < cluster_offset + s->cluster_size;
+                 slice_offset += slice_size2) {
+                table = qcow2_cache_is_table_offset(bs, s->l2_table_cache,
+                                                    slice_offset);
+                if (table != NULL) {
+                    qcow2_cache_discard(bs, s->l2_table_cache, table);
+                }
             }
 
             if (s->discard_passthrough[type]) {
@@ -1187,6 +1196,7 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     uint64_t *l1_table, *l2_table, l2_offset, entry, l1_size2, refcount;
     bool l1_allocated = false;
     int64_t old_entry, old_l2_offset;
+    unsigned slice, slice_size2, n_slices;
     int i, j, l1_modified = 0, nb_csectors;
     int ret;
 
@@ -1195,6 +1205,8 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     l2_table = NULL;
     l1_table = NULL;
     l1_size2 = l1_size * sizeof(uint64_t);
+    slice_size2 = s->l2_slice_size * l2_entry_size(s);
+    n_slices = s->cluster_size / slice_size2;
 
     s->cache_discards = true;
 
@@ -1237,91 +1249,94 @@ int qcow2_update_snapshot_refcount(BlockDriverState *bs,
                 goto fail;
             }
 
-            ret = qcow2_cache_get(bs, s->l2_table_cache, l2_offset,
-                (void**) &l2_table);
-            if (ret < 0) {
-                goto fail;
-            }
+            for (slice = 0; slice < n_slices; slice++) {
+                ret = qcow2_cache_get(bs, s->l2_table_cache,
+                                      l2_offset + slice * slice_size2,
+                                      (void **) &l2_table);
+                if (ret < 0) {
+                    goto fail;
+                }
 
-            for (j = 0; j < s->l2_size; j++) {
-                uint64_t cluster_index;
-                uint64_t offset;
-
-                entry = be64_to_cpu(l2_table[j]);
-                old_entry = entry;
-                entry &= ~QCOW_OFLAG_COPIED;
-                offset = entry & L2E_OFFSET_MASK;
-
-                switch (qcow2_get_cluster_type(entry)) {
-                case QCOW2_CLUSTER_COMPRESSED:
-                    nb_csectors = ((entry >> s->csize_shift) &
-                                   s->csize_mask) + 1;
-                    if (addend != 0) {
-                        ret = update_refcount(bs,
-                                (entry & s->cluster_offset_mask) & ~511,
-                                nb_csectors * 512, abs(addend), addend < 0,
-                                QCOW2_DISCARD_SNAPSHOT);
-                        if (ret < 0) {
+                for (j = 0; j < s->l2_slice_size; j++) {
+                    uint64_t cluster_index;
+                    uint64_t offset;
+
+                    entry = get_l2_entry(s, l2_table, j);
+                    old_entry = entry;
+                    entry &= ~QCOW_OFLAG_COPIED;
+                    offset = entry & L2E_OFFSET_MASK;
+
+                    switch (qcow2_get_cluster_type(entry)) {
+                    case QCOW2_CLUSTER_COMPRESSED:
+                        nb_csectors = ((entry >> s->csize_shift) &
+                                       s->csize_mask) + 1;
+                        if (addend != 0) {
+                            ret = update_refcount(bs,
+                                    (entry & s->cluster_offset_mask) & ~511,
+                                    nb_csectors * 512, abs(addend), addend < 0,
+                                    QCOW2_DISCARD_SNAPSHOT);
+                            if (ret < 0) {
+                                goto fail;
+                            }
+                        }
+                        /* compressed clusters are never modified */
+                        refcount = 2;
+                        break;
+
+                    case QCOW2_CLUSTER_NORMAL:
+                    case QCOW2_CLUSTER_ZERO_ALLOC:
+                        if (offset_into_cluster(s, offset)) {
+                            qcow2_signal_corruption(bs, true, -1, -1,
+                                "Cluster allocation offset %#" PRIx64
+                                " unaligned (L2 offset: %#" PRIx64
+                                ", L2 index: %#x)", offset, l2_offset,
+                                slice * s->l2_slice_size + j);
+                            ret = -EIO;
                             goto fail;
                         }
-                    }
-                    /* compressed clusters are never modified */
-                    refcount = 2;
-                    break;
-
-                case QCOW2_CLUSTER_NORMAL:
-                case QCOW2_CLUSTER_ZERO_ALLOC:
-                    if (offset_into_cluster(s, offset)) {
-                        qcow2_signal_corruption(bs, true, -1, -1, "Cluster "
-                                                "allocation offset %#" PRIx64
-                                                " unaligned (L2 offset: %#"
-                                                PRIx64 ", L2 index: %#x)",
-                                                offset, l2_offset, j);
-                        ret = -EIO;
-                        goto fail;
-                    }
 
-                    cluster_index = offset >> s->cluster_bits;
-                    assert(cluster_index);
-                    if (addend != 0) {
-                        ret = qcow2_update_cluster_refcount(bs,
-                                    cluster_index, abs(addend), addend < 0,
-                                    QCOW2_DISCARD_SNAPSHOT);
+                        cluster_index = offset >> s->cluster_bits;
+                        assert(cluster_index);
+                        if (addend != 0) {
+                            ret = qcow2_update_cluster_refcount(bs,
+                                        cluster_index, abs(addend), addend < 0,
+                                        QCOW2_DISCARD_SNAPSHOT);
+                            if (ret < 0) {
+                                goto fail;
+                            }
+                        }
+
+                        ret = qcow2_get_refcount(bs, cluster_index, &refcount);
                         if (ret < 0) {
                             goto fail;
                         }
-                    }
+                        break;
 
-                    ret = qcow2_get_refcount(bs, cluster_index, &refcount);
-                    if (ret < 0) {
-                        goto fail;
-                    }
-                    break;
-
-                case QCOW2_CLUSTER_ZERO_PLAIN:
-                case QCOW2_CLUSTER_UNALLOCATED:
-                    refcount = 0;
-                    break;
+                    case QCOW2_CLUSTER_ZERO_PLAIN:
+                    case QCOW2_CLUSTER_UNALLOCATED:
+                        refcount = 0;
+                        break;
 
-                default:
-                    abort();
-                }
+                    default:
+                        abort();
+                    }
 
-                if (refcount == 1) {
-                    entry |= QCOW_OFLAG_COPIED;
-                }
-                if (entry != old_entry) {
-                    if (addend > 0) {
-                        qcow2_cache_set_dependency(bs, s->l2_table_cache,
-                            s->refcount_block_cache);
+                    if (refcount == 1) {
+                        entry |= QCOW_OFLAG_COPIED;
+                    }
+                    if (entry != old_entry) {
+                        if (addend > 0) {
+                            qcow2_cache_set_dependency(bs, s->l2_table_cache,
+                                s->refcount_block_cache);
+                        }
+                        set_l2_entry(s, l2_table, j, entry);
+                        qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache,
+                                                     l2_table);
                     }
-                    l2_table[j] = cpu_to_be64(entry);
-                    qcow2_cache_entry_mark_dirty(bs, s->l2_table_cache,
-                                                 l2_table);
                 }
-            }
 
-            qcow2_cache_put(bs, s->l2_table_cache, (void **) &l2_table);
+                qcow2_cache_put(bs, s->l2_table_cache, (void **) &l2_table);
+            }
 
             if (addend != 0) {
                 ret = qcow2_update_cluster_refcount(bs, l2_offset >>
@@ -1497,38 +1512,150 @@ enum {
     CHECK_FRAG_INFO = 0x2,      /* update BlockFragInfo counters */
 };
 
+/*
+ * The image check reads this many L2 tables at the same time, so that it
+ * is not bound by the latency of single requests
+ */
+#define QCOW2_CHECK_MAX_READS 16
+
+typedef struct Qcow2CheckRead {
+    BdrvChild *file;
+    uint64_t offset;
+    void *buf;
+    unsigned bytes;
+    int ret;
+} Qcow2CheckRead;
+
+static void coroutine_fn check_read_entry(void *opaque)
+{
+    Qcow2CheckRead *r = opaque;
+    QEMUIOVector qiov;
+    struct iovec iov = {
+        .iov_base = r->buf,
+        .iov_len = r->bytes,
+    };
+
+    qemu_iovec_init_external(&qiov, &iov, 1);
+    r->ret = bdrv_co_preadv(r->file, r->offset, r->bytes, &qiov, 0);
+}
+
+static bool check_reads_pending(Qcow2CheckRead *reads, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (reads[i].ret == -EINPROGRESS) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Reads the tables described by reads[0..n-1] from the image file with all
+ * requests in flight at the same time. The result of each read is stored in
+ * its ret field.
+ */
+static void check_read_tables(BlockDriverState *bs, Qcow2CheckRead *reads,
+                              int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        reads[i].file = bs->file;
+        reads[i].ret = -EINPROGRESS;
+    }
+
+    if (qemu_in_coroutine()) {
+        /* There is nothing to poll from here, read one table after the
+         * other */
+        for (i = 0; i < n; i++) {
+            check_read_entry(&reads[i]);
+        }
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        Coroutine *co = qemu_coroutine_create(check_read_entry, &reads[i]);
+        bdrv_coroutine_enter(bs->file->bs, co);
+    }
+    BDRV_POLL_WHILE(bs->file->bs, check_reads_pending(reads, n));
+}
+
+/* Allocates the buffers for QCOW2_CHECK_MAX_READS L2 tables */
+static Qcow2CheckRead *check_alloc_l2_reads(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CheckRead *reads = g_new0(Qcow2CheckRead, QCOW2_CHECK_MAX_READS);
+    int i;
+
+    for (i = 0; i < QCOW2_CHECK_MAX_READS; i++) {
+        reads[i].bytes = s->l2_size * l2_entry_size(s);
+        reads[i].buf = qemu_try_blockalign(bs->file->bs, reads[i].bytes);
+        if (reads[i].buf == NULL) {
+            while (i-- > 0) {
+                qemu_vfree(reads[i].buf);
+            }
+            g_free(reads);
+            return NULL;
+        }
+    }
+    return reads;
+}
+
+static void check_free_l2_reads(Qcow2CheckRead *reads)
+{
+    int i;
+
+    if (reads == NULL) {
+        return;
+    }
+    for (i = 0; i < QCOW2_CHECK_MAX_READS; i++) {
+        qemu_vfree(reads[i].buf);
+    }
+    g_free(reads);
+}
+
 /*
  * Increases the refcount in the given refcount table for the all clusters
- * referenced in the L2 table. While doing so, performs some checks on L2
- * entries.
+ * referenced in the L2 table, which the caller has read from the image.
+ * While doing so, performs some checks on L2 entries.
  *
  * Returns the number of errors found by the checks or -errno if an internal
  * error occurred.
  */
 static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                               void **refcount_table,
-                              int64_t *refcount_table_size, int64_t l2_offset,
-                              int flags)
+                              int64_t *refcount_table_size,
+                              uint64_t *l2_table, int flags)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l2_table, l2_entry;
+    uint64_t l2_entry;
     uint64_t next_contiguous_offset = 0;
-    int i, l2_size, nb_csectors, ret;
-
-    /* Read L2 table from disk */
-    l2_size = s->l2_size * sizeof(uint64_t);
-    l2_table = g_malloc(l2_size);
-
-    ret = bdrv_pread(bs->file, l2_offset, l2_table, l2_size);
-    if (ret < 0) {
-        fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
-        res->check_errors++;
-        goto fail;
-    }
+    int i, nb_csectors, ret;
 
     /* Do the actual checks */
     for(i = 0; i < s->l2_size; i++) {
-        l2_entry = be64_to_cpu(l2_table[i]);
+        l2_entry = get_l2_entry(s, l2_table, i);
+
+        if (has_subclusters(s)) {
+            uint64_t l2_bitmap = get_l2_bitmap(s, l2_table, i);
+            uint64_t sc_alloc = l2_bitmap & QCOW_L2_BITMAP_ALL_ALLOC;
+            bool invalid;
+
+            if (l2_entry & QCOW_OFLAG_COMPRESSED) {
+                invalid = l2_bitmap != 0;
+            } else {
+                invalid = (sc_alloc & (l2_bitmap >> 32)) ||
+                          (sc_alloc && !(l2_entry & L2E_OFFSET_MASK));
+            }
+            if (invalid) {
+                fprintf(stderr, "ERROR: L2 entry %#" PRIx64 " has an invalid "
+                        "subcluster bitmap %#" PRIx64 "\n",
+                        l2_entry, l2_bitmap);
+                res->corruptions++;
+            }
+        }
 
         switch (qcow2_get_cluster_type(l2_entry)) {
         case QCOW2_CLUSTER_COMPRESSED:
@@ -1549,7 +1676,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                                            refcount_table, refcount_table_size,
                                            l2_entry & ~511, nb_csectors * 512);
             if (ret < 0) {
-                goto fail;
+                return ret;
             }
 
             if (flags & CHECK_FRAG_INFO) {
@@ -1584,7 +1711,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
                                            refcount_table, refcount_table_size,
                                            offset, s->cluster_size);
             if (ret < 0) {
-                goto fail;
+                return ret;
             }
 
             /* Correct offsets are cluster aligned */
@@ -1605,12 +1732,7 @@ static int check_refcounts_l2(BlockDriverState *bs, BdrvCheckResult *res,
         }
     }
 
-    g_free(l2_table);
     return 0;
-
-fail:
-    g_free(l2_table);
-    return ret;
 }
 
 /*
@@ -1630,7 +1752,8 @@ static int check_refcounts_l1(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t *l1_table = NULL, l2_offset, l1_size2;
-    int i, ret;
+    Qcow2CheckRead *reads = NULL;
+    int i, j, n, ret;
 
     l1_size2 = l1_size * sizeof(uint64_t);
 
@@ -1659,12 +1782,27 @@ static int check_refcounts_l1(BlockDriverState *bs,
             be64_to_cpus(&l1_table[i]);
     }
 
-    /* Do the actual checks */
-    for(i = 0; i < l1_size; i++) {
-        l2_offset = l1_table[i];
-        if (l2_offset) {
+    reads = check_alloc_l2_reads(bs);
+    if (reads == NULL) {
+        ret = -ENOMEM;
+        res->check_errors++;
+        goto fail;
+    }
+
+    /* Do the actual checks, reading the next L2 tables in one go */
+    i = 0;
+    while (i < l1_size) {
+        for (n = 0; i < l1_size && n < QCOW2_CHECK_MAX_READS; i++) {
+            if (l1_table[i]) {
+                reads[n++].offset = l1_table[i] & L1E_OFFSET_MASK;
+            }
+        }
+
+        check_read_tables(bs, reads, n);
+
+        for (j = 0; j < n; j++) {
             /* Mark L2 table as used */
-            l2_offset &= L1E_OFFSET_MASK;
+            l2_offset = reads[j].offset;
             ret = qcow2_inc_refcounts_imrt(bs, res,
                                            refcount_table, refcount_table_size,
                                            l2_offset, s->cluster_size);
@@ -1679,133 +1817,172 @@ static int check_refcounts_l1(BlockDriverState *bs,
                 res->corruptions++;
             }
 
+            if (reads[j].ret < 0) {
+                fprintf(stderr, "ERROR: I/O error in check_refcounts_l2\n");
+                res->check_errors++;
+                ret = reads[j].ret;
+                goto fail;
+            }
+
             /* Process and check L2 entries */
             ret = check_refcounts_l2(bs, res, refcount_table,
-                                     refcount_table_size, l2_offset, flags);
+                                     refcount_table_size, reads[j].buf,
+                                     flags);
             if (ret < 0) {
                 goto fail;
             }
         }
     }
+    check_free_l2_reads(reads);
     g_free(l1_table);
     return 0;
 
 fail:
+    check_free_l2_reads(reads);
     g_free(l1_table);
     return ret;
 }
 
-/*
- * Checks the OFLAG_COPIED flag for all L1 and L2 entries.
- *
- * This function does not print an error message nor does it increment
- * check_errors if qcow2_get_refcount fails (this is because such an error will
- * have been already detected and sufficiently signaled by the calling function
- * (qcow2_check_refcounts) by the time this function is called).
- */
-static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
-                              BdrvCheckMode fix)
+static int check_oflag_copied_l2(BlockDriverState *bs, BdrvCheckResult *res,
+                                 BdrvCheckMode fix, int l1_index,
+                                 uint64_t *l2_table)
 {
     BDRVQcow2State *s = bs->opaque;
-    uint64_t *l2_table = qemu_blockalign(bs, s->cluster_size);
-    int ret;
+    uint64_t l1_entry = s->l1_table[l1_index];
+    uint64_t l2_offset = l1_entry & L1E_OFFSET_MASK;
+    bool l2_dirty = false;
     uint64_t refcount;
-    int i, j;
-
-    for (i = 0; i < s->l1_size; i++) {
-        uint64_t l1_entry = s->l1_table[i];
-        uint64_t l2_offset = l1_entry & L1E_OFFSET_MASK;
-        bool l2_dirty = false;
+    int ret;
+    int j;
 
-        if (!l2_offset) {
-            continue;
+    ret = qcow2_get_refcount(bs, l2_offset >> s->cluster_bits, &refcount);
+    if (ret < 0) {
+        /* don't print message nor increment check_errors */
+        return 0;
+    }
+    if ((refcount == 1) != ((l1_entry & QCOW_OFLAG_COPIED) != 0)) {
+        fprintf(stderr, "%s OFLAG_COPIED L2 cluster: l1_index=%d "
+                "l1_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
+                fix & BDRV_FIX_ERRORS ? "Repairing" :
+                                        "ERROR",
+                l1_index, l1_entry, refcount);
+        if (fix & BDRV_FIX_ERRORS) {
+            s->l1_table[l1_index] = refcount == 1
+                                  ? l1_entry |  QCOW_OFLAG_COPIED
+                                  : l1_entry & ~QCOW_OFLAG_COPIED;
+            ret = qcow2_write_l1_entry(bs, l1_index);
+            if (ret < 0) {
+                res->check_errors++;
+                return ret;
+            }
+            res->corruptions_fixed++;
+        } else {
+            res->corruptions++;
         }
+    }
 
-        ret = qcow2_get_refcount(bs, l2_offset >> s->cluster_bits,
-                                 &refcount);
-        if (ret < 0) {
-            /* don't print message nor increment check_errors */
-            continue;
-        }
-        if ((refcount == 1) != ((l1_entry & QCOW_OFLAG_COPIED) != 0)) {
-            fprintf(stderr, "%s OFLAG_COPIED L2 cluster: l1_index=%d "
-                    "l1_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
-                    fix & BDRV_FIX_ERRORS ? "Repairing" :
-                                            "ERROR",
-                    i, l1_entry, refcount);
-            if (fix & BDRV_FIX_ERRORS) {
-                s->l1_table[i] = refcount == 1
-                               ? l1_entry |  QCOW_OFLAG_COPIED
-                               : l1_entry & ~QCOW_OFLAG_COPIED;
-                ret = qcow2_write_l1_entry(bs, i);
-                if (ret < 0) {
-                    res->check_errors++;
-                    goto fail;
+    for (j = 0; j < s->l2_size; j++) {
+        uint64_t l2_entry = get_l2_entry(s, l2_table, j);
+        uint64_t data_offset = l2_entry & L2E_OFFSET_MASK;
+        QCow2ClusterType cluster_type = qcow2_get_cluster_type(l2_entry);
+
+        if (cluster_type == QCOW2_CLUSTER_NORMAL ||
+            cluster_type == QCOW2_CLUSTER_ZERO_ALLOC) {
+            ret = qcow2_get_refcount(bs,
+                                     data_offset >> s->cluster_bits,
+                                     &refcount);
+            if (ret < 0) {
+                /* don't print message nor increment check_errors */
+                continue;
+            }
+            if ((refcount == 1) != ((l2_entry & QCOW_OFLAG_COPIED) != 0)) {
+                fprintf(stderr, "%s OFLAG_COPIED data cluster: "
+                        "l2_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
+                        fix & BDRV_FIX_ERRORS ? "Repairing" :
+                                                "ERROR",
+                        l2_entry, refcount);
+                if (fix & BDRV_FIX_ERRORS) {
+                    set_l2_entry(s, l2_table, j, refcount == 1
+                                 ? l2_entry |  QCOW_OFLAG_COPIED
+                                 : l2_entry & ~QCOW_OFLAG_COPIED);
+                    l2_dirty = true;
+                    res->corruptions_fixed++;
+                } else {
+                    res->corruptions++;
                 }
-                res->corruptions_fixed++;
-            } else {
-                res->corruptions++;
             }
         }
+    }
+
+    if (l2_dirty) {
+        ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_ACTIVE_L2,
+                                            l2_offset, s->cluster_size);
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: Could not write L2 table; metadata "
+                    "overlap check failed: %s\n", strerror(-ret));
+            res->check_errors++;
+            return ret;
+        }
 
-        ret = bdrv_pread(bs->file, l2_offset, l2_table,
-                         s->l2_size * sizeof(uint64_t));
+        ret = bdrv_pwrite(bs->file, l2_offset, l2_table,
+                          s->cluster_size);
         if (ret < 0) {
-            fprintf(stderr, "ERROR: Could not read L2 table: %s\n",
+            fprintf(stderr, "ERROR: Could not write L2 table: %s\n",
                     strerror(-ret));
             res->check_errors++;
-            goto fail;
+            return ret;
         }
+    }
 
-        for (j = 0; j < s->l2_size; j++) {
-            uint64_t l2_entry = be64_to_cpu(l2_table[j]);
-            uint64_t data_offset = l2_entry & L2E_OFFSET_MASK;
-            QCow2ClusterType cluster_type = qcow2_get_cluster_type(l2_entry);
+    return 0;
+}
 
-            if (cluster_type == QCOW2_CLUSTER_NORMAL ||
-                cluster_type == QCOW2_CLUSTER_ZERO_ALLOC) {
-                ret = qcow2_get_refcount(bs,
-                                         data_offset >> s->cluster_bits,
-                                         &refcount);
-                if (ret < 0) {
-                    /* don't print message nor increment check_errors */
-                    continue;
-                }
-                if ((refcount == 1) != ((l2_entry & QCOW_OFLAG_COPIED) != 0)) {
-                    fprintf(stderr, "%s OFLAG_COPIED data cluster: "
-                            "l2_entry=%" PRIx64 " refcount=%" PRIu64 "\n",
-                            fix & BDRV_FIX_ERRORS ? "Repairing" :
-                                                    "ERROR",
-                            l2_entry, refcount);
-                    if (fix & BDRV_FIX_ERRORS) {
-                        l2_table[j] = cpu_to_be64(refcount == 1
-                                    ? l2_entry |  QCOW_OFLAG_COPIED
-                                    : l2_entry & ~QCOW_OFLAG_COPIED);
-                        l2_dirty = true;
-                        res->corruptions_fixed++;
-                    } else {
-                        res->corruptions++;
-                    }
-                }
+/*
+ * Checks the OFLAG_COPIED flag for all L1 and L2 entries.
+ *
+ * This function does not print an error message nor does it increment
+ * check_errors if qcow2_get_refcount fails (this is because such an error will
+ * have been already detected and sufficiently signaled by the calling function
+ * (qcow2_check_refcounts) by the time this function is called).
+ */
+static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
+                              BdrvCheckMode fix)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CheckRead *reads;
+    int l1_index[QCOW2_CHECK_MAX_READS];
+    int ret;
+    int i, j, n;
+
+    reads = check_alloc_l2_reads(bs);
+    if (reads == NULL) {
+        res->check_errors++;
+        return -ENOMEM;
+    }
+
+    i = 0;
+    while (i < s->l1_size) {
+        for (n = 0; i < s->l1_size && n < QCOW2_CHECK_MAX_READS; i++) {
+            if (s->l1_table[i] & L1E_OFFSET_MASK) {
+                l1_index[n] = i;
+                reads[n++].offset = s->l1_table[i] & L1E_OFFSET_MASK;
             }
         }
 
-        if (l2_dirty) {
-            ret = qcow2_pre_write_overlap_check(bs, QCOW2_OL_ACTIVE_L2,
-                                                l2_offset, s->cluster_size);
-            if (ret < 0) {
-                fprintf(stderr, "ERROR: Could not write L2 table; metadata "
-                        "overlap check failed: %s\n", strerror(-ret));
+        check_read_tables(bs, reads, n);
+
+        for (j = 0; j < n; j++) {
+            if (reads[j].ret < 0) {
+                ret = reads[j].ret;
+                fprintf(stderr, "ERROR: Could not read L2 table: %s\n",
+                        strerror(-ret));
                 res->check_errors++;
                 goto fail;
             }
 
-            ret = bdrv_pwrite(bs->file, l2_offset, l2_table,
-                              s->cluster_size);
+            ret = check_oflag_copied_l2(bs, res, fix, l1_index[j],
+                                        reads[j].buf);
             if (ret < 0) {
-                fprintf(stderr, "ERROR: Could not write L2 table: %s\n",
-                        strerror(-ret));
-                res->check_errors++;
                 goto fail;
             }
         }
@@ -1814,7 +1991,7 @@ static int check_oflag_copied(BlockDriverState *bs, BdrvCheckResult *res,
     ret = 0;
 
 fail:
-    qemu_vfree(l2_table);
+    check_free_l2_reads(reads);
     return ret;
 }
 
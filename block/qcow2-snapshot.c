@@ -349,6 +349,11 @@ int qcow2_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
     uint64_t *l1_table = NULL;
     int64_t l1_table_offset;
 
+    if (has_data_file(s)) {
+        /* The guest data is not under our control, so it can't be frozen */
+        return -ENOTSUP;
+    }
+
     if (s->nb_snapshots >= QCOW_MAX_SNAPSHOTS) {
         return -EFBIG;
     }
@@ -26,6 +26,9 @@
 #include "sysemu/block-backend.h"
 #include "qemu/module.h"
 #include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #include "block/qcow2.h"
 #include "qemu/error-report.h"
 #include "qapi/qmp/qerror.h"
@@ -39,6 +42,7 @@
 #include "qapi/opts-visitor.h"
 #include "qapi-visit.h"
 #include "block/crypto.h"
+#include "block/thread-pool.h"
 
 /*
   Differences with QCOW:
@@ -67,6 +71,8 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_FEATURE_TABLE 0x6803f857
 #define  QCOW2_EXT_MAGIC_CRYPTO_HEADER 0x0537be77
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
+#define  QCOW2_EXT_MAGIC_COMPRESSION_TYPE 0x5a2c7f31
+#define  QCOW2_EXT_MAGIC_DATA_FILE 0x44415441
 
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -179,6 +185,7 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
     uint64_t offset;
     int ret;
     Qcow2BitmapHeaderExt bitmaps_ext;
+    Qcow2CompressionTypeExt compression_ext;
 
     if (need_update_header != NULL) {
         *need_update_header = false;
@@ -288,12 +295,65 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            qcow2_crypto_hdr_read_func,
-                                           bs, cflags, errp);
+                                           bs, cflags, 1, errp);
             if (!s->crypto) {
                 return -EINVAL;
             }
         }   break;
 
+        case QCOW2_EXT_MAGIC_COMPRESSION_TYPE:
+            if (ext.len != sizeof(compression_ext)) {
+                error_setg(errp, "compression_type_ext: Invalid extension "
+                           "length %" PRIu32, ext.len);
+                return -EINVAL;
+            }
+
+            ret = bdrv_pread(bs->file, offset, &compression_ext, ext.len);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "compression_type_ext: "
+                                 "Could not read ext header");
+                return ret;
+            }
+
+            switch (compression_ext.compression_type) {
+            case QCOW2_COMPRESSION_TYPE_ZLIB:
+                break;
+            case QCOW2_COMPRESSION_TYPE_ZSTD:
+#ifdef CONFIG_ZSTD
+                break;
+#else
+                error_setg(errp, "qcow2: zstd compression is not supported "
+                           "by this build");
+                return -ENOTSUP;
+#endif
+            default:
+                error_setg(errp, "qcow2: Unknown compression type %u",
+                           compression_ext.compression_type);
+                return -ENOTSUP;
+            }
+            s->compression_type = compression_ext.compression_type;
+            break;
+
+        case QCOW2_EXT_MAGIC_DATA_FILE:
+            if (ext.len == 0 || ext.len > 1023) {
+                error_setg(errp, "data_file_ext: Invalid extension length %"
+                           PRIu32, ext.len);
+                return -EINVAL;
+            }
+
+            g_free(s->image_data_file);
+            s->image_data_file = g_malloc0(ext.len + 1);
+            ret = bdrv_pread(bs->file, offset, s->image_data_file, ext.len);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "data_file_ext: "
+                                 "Could not read data file name");
+                return ret;
+            }
+#ifdef DEBUG_EXT
+            printf("Qcow2: Got data file extension %s\n", s->image_data_file);
+#endif
+            break;
+
         case QCOW2_EXT_MAGIC_BITMAPS:
             if (ext.len != sizeof(bitmaps_ext)) {
                 error_setg_errno(errp, -ret, "bitmaps_ext: "
@@ -536,7 +596,11 @@ int qcow2_mark_consistent(BlockDriverState *bs)
 static int qcow2_check(BlockDriverState *bs, BdrvCheckResult *result,
                        BdrvCheckMode fix)
 {
-    int ret = qcow2_check_refcounts(bs, result, fix);
+    int ret;
+
+    qcow2_release_alloc_extent(bs);
+
+    ret = qcow2_check_refcounts(bs, result, fix);
     if (ret < 0) {
         return ret;
     }
@@ -665,6 +729,11 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_SIZE,
             .help = "Maximum L2 table cache size",
         },
+        {
+            .name = QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of each entry in the L2 cache",
+        },
         {
             .name = QCOW2_OPT_REFCOUNT_CACHE_SIZE,
             .type = QEMU_OPT_SIZE,
@@ -675,6 +744,18 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_EXTENT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Allocate host clusters in runs of this size "
+                    "(0 = disabled)",
+        },
+        {
+            .name = QCOW2_OPT_BITMAP_CHECKPOINT_INTERVAL,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Write changes of persistent bitmaps to the image after "
+                    "this time (in seconds)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -724,19 +805,85 @@ static void cache_clean_timer_del(BlockDriverState *bs)
     }
 }
 
+static void coroutine_fn bitmap_checkpoint_co(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+
+    qemu_co_mutex_lock(&s->lock);
+    qcow2_checkpoint_persistent_dirty_bitmaps(bs);
+    qemu_co_mutex_unlock(&s->lock);
+
+    s->bitmap_checkpoint_running = false;
+    bdrv_dec_in_flight(bs);
+}
+
+static void bitmap_checkpoint_timer_cb(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->bitmap_checkpoint_running && !atomic_read(&bs->quiesce_counter)) {
+        Coroutine *co = qemu_coroutine_create(bitmap_checkpoint_co, bs);
+
+        /* Counted as a request so that draining waits for it */
+        s->bitmap_checkpoint_running = true;
+        bdrv_inc_in_flight(bs);
+        bdrv_coroutine_enter(bs, co);
+    }
+    timer_mod(s->bitmap_checkpoint_timer,
+              qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL) +
+              (int64_t) s->bitmap_checkpoint_interval * 1000);
+}
+
+static void bitmap_checkpoint_timer_init(BlockDriverState *bs,
+                                         AioContext *context)
+{
+    BDRVQcow2State *s = bs->opaque;
+    if (s->bitmap_checkpoint_interval > 0) {
+        s->bitmap_checkpoint_timer =
+            aio_timer_new(context, QEMU_CLOCK_VIRTUAL, SCALE_MS,
+                          bitmap_checkpoint_timer_cb, bs);
+        timer_mod(s->bitmap_checkpoint_timer,
+                  qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL) +
+                  (int64_t) s->bitmap_checkpoint_interval * 1000);
+    }
+}
+
+static void bitmap_checkpoint_timer_del(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    if (s->bitmap_checkpoint_timer) {
+        timer_del(s->bitmap_checkpoint_timer);
+        timer_free(s->bitmap_checkpoint_timer);
+        s->bitmap_checkpoint_timer = NULL;
+    }
+}
+
+/* Wait until a bitmap checkpoint that is in progress has finished */
+void qcow2_wait_bitmap_checkpoint(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    BDRV_POLL_WHILE(bs, s->bitmap_checkpoint_running);
+}
+
 static void qcow2_detach_aio_context(BlockDriverState *bs)
 {
     cache_clean_timer_del(bs);
+    bitmap_checkpoint_timer_del(bs);
 }
 
 static void qcow2_attach_aio_context(BlockDriverState *bs,
                                      AioContext *new_context)
 {
     cache_clean_timer_init(bs, new_context);
+    bitmap_checkpoint_timer_init(bs, new_context);
 }
 
 static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
                              uint64_t *l2_cache_size,
+                             uint64_t *l2_cache_entry_size,
                              uint64_t *refcount_cache_size, Error **errp)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -752,6 +899,9 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     *refcount_cache_size = qemu_opt_get_size(opts,
                                              QCOW2_OPT_REFCOUNT_CACHE_SIZE, 0);
 
+    *l2_cache_entry_size = qemu_opt_get_size(
+        opts, QCOW2_OPT_L2_CACHE_ENTRY_SIZE, s->cluster_size);
+
     if (combined_cache_size_set) {
         if (l2_cache_size_set && refcount_cache_size_set) {
             error_setg(errp, QCOW2_OPT_CACHE_SIZE ", " QCOW2_OPT_L2_CACHE_SIZE
@@ -792,15 +942,27 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
                                  / DEFAULT_L2_REFCOUNT_SIZE_RATIO;
         }
     }
+
+    if (*l2_cache_entry_size < (1 << MIN_CLUSTER_BITS) ||
+        *l2_cache_entry_size > s->cluster_size ||
+        !is_power_of_2(*l2_cache_entry_size)) {
+        error_setg(errp, "L2 cache entry size must be a power of two "
+                   "between %d and the cluster size (%d)",
+                   1 << MIN_CLUSTER_BITS, s->cluster_size);
+        return;
+    }
 }
 
 typedef struct Qcow2ReopenState {
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
+    int l2_slice_size; /* Number of entries in a slice of the L2 table */
     bool use_lazy_refcounts;
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    uint64_t alloc_extent_size;
+    uint64_t bitmap_checkpoint_interval;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -813,7 +975,7 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     QemuOpts *opts = NULL;
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
-    uint64_t l2_cache_size, refcount_cache_size;
+    uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -832,15 +994,15 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
     }
 
     /* get L2 table/refcount block cache size from command line options */
-    read_cache_sizes(bs, opts, &l2_cache_size, &refcount_cache_size,
-                     &local_err);
+    read_cache_sizes(bs, opts, &l2_cache_size, &l2_cache_entry_size,
+                     &refcount_cache_size, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         ret = -EINVAL;
         goto fail;
     }
 
-    l2_cache_size /= s->cluster_size;
+    l2_cache_size /= l2_cache_entry_size;
     if (l2_cache_size < MIN_L2_CACHE_SIZE) {
         l2_cache_size = MIN_L2_CACHE_SIZE;
     }
@@ -878,8 +1040,11 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         }
     }
 
-    r->l2_table_cache = qcow2_cache_create(bs, l2_cache_size);
-    r->refcount_block_cache = qcow2_cache_create(bs, refcount_cache_size);
+    r->l2_slice_size = l2_cache_entry_size / l2_entry_size(s);
+    r->l2_table_cache = qcow2_cache_create(bs, l2_cache_size,
+                                           l2_cache_entry_size);
+    r->refcount_block_cache = qcow2_cache_create(bs, refcount_cache_size,
+                                                 s->cluster_size);
     if (r->l2_table_cache == NULL || r->refcount_block_cache == NULL) {
         error_setg(errp, "Could not allocate metadata caches");
         ret = -ENOMEM;
@@ -904,6 +1069,26 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->alloc_extent_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_EXTENT_SIZE,
+                          s->alloc_extent_size);
+    if (r->alloc_extent_size > QCOW2_MAX_ALLOC_EXTENT_SIZE) {
+        error_setg(errp, QCOW2_OPT_ALLOC_EXTENT_SIZE " may not exceed %d",
+                   QCOW2_MAX_ALLOC_EXTENT_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->alloc_extent_size = ROUND_UP(r->alloc_extent_size, s->cluster_size);
+
+    r->bitmap_checkpoint_interval =
+        qemu_opt_get_number(opts, QCOW2_OPT_BITMAP_CHECKPOINT_INTERVAL,
+                            s->bitmap_checkpoint_interval);
+    if (r->bitmap_checkpoint_interval > UINT_MAX) {
+        error_setg(errp, "Bitmap checkpoint interval too big");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1041,6 +1226,7 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     }
     s->l2_table_cache = r->l2_table_cache;
     s->refcount_block_cache = r->refcount_block_cache;
+    s->l2_slice_size = r->l2_slice_size;
 
     s->overlap_check = r->overlap_check;
     s->use_lazy_refcounts = r->use_lazy_refcounts;
@@ -1055,6 +1241,17 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    if (s->alloc_extent_size != r->alloc_extent_size) {
+        qcow2_release_alloc_extent(bs);
+        s->alloc_extent_size = r->alloc_extent_size;
+    }
+
+    if (s->bitmap_checkpoint_interval != r->bitmap_checkpoint_interval) {
+        bitmap_checkpoint_timer_del(bs);
+        s->bitmap_checkpoint_interval = r->bitmap_checkpoint_interval;
+        bitmap_checkpoint_timer_init(bs, bdrv_get_aio_context(bs));
+    }
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1263,7 +1460,19 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         bs->encrypted = true;
     }
 
-    s->l2_bits = s->cluster_bits - 3; /* L2 is always one cluster */
+    if (has_subclusters(s) && s->cluster_bits < MIN_EXTL2_CLUSTER_BITS) {
+        error_setg(errp, "Extended L2 entries need a cluster size of at "
+                   "least %d bytes", 1 << MIN_EXTL2_CLUSTER_BITS);
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->subclusters_per_cluster =
+        has_subclusters(s) ? QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER : 1;
+    s->subcluster_size = s->cluster_size / s->subclusters_per_cluster;
+    s->subcluster_bits = ctz32(s->subcluster_size);
+
+    /* L2 is always one cluster */
+    s->l2_bits = s->cluster_bits - ctz32(l2_entry_size(s));
     s->l2_size = 1 << s->l2_bits;
     /* 2^(s->refcount_order - 3) is the refcount width in bytes */
     s->refcount_block_bits = s->cluster_bits - (s->refcount_order - 3);
@@ -1369,7 +1578,7 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
-    s->cluster_cache_offset = -1;
+    qcow2_compressed_cache_init(s);
     s->flags = flags;
 
     ret = qcow2_refcount_init(bs);
@@ -1389,6 +1598,53 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
+    if (!!(s->incompatible_features & QCOW2_INCOMPAT_COMPRESSION) !=
+        (s->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB)) {
+        error_setg(errp, "qcow2: The compression type extension does not "
+                   "match the compression feature bit");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    if (has_data_file(s)) {
+        if (!s->image_data_file) {
+            error_setg(errp, "qcow2: Missing data file header extension");
+            ret = -EINVAL;
+            goto fail;
+        }
+        if (header.backing_file_offset || s->crypt_method_header) {
+            error_setg(errp, "qcow2: Images with an external data file can "
+                       "have neither a backing file nor encryption");
+            ret = -EINVAL;
+            goto fail;
+        }
+
+        /* qcow2_invalidate_cache() keeps the data file open */
+        if (!s->data_file) {
+            s->data_file = bdrv_open_child(NULL, options, "data-file", bs,
+                                           &child_file, true, &local_err);
+            if (local_err) {
+                error_propagate(errp, local_err);
+                ret = -EINVAL;
+                goto fail;
+            }
+        }
+        if (!s->data_file) {
+            s->data_file = bdrv_open_child(s->image_data_file, options,
+                                           "data-file", bs, &child_file,
+                                           false, errp);
+            if (!s->data_file) {
+                ret = -EINVAL;
+                goto fail;
+            }
+        }
+    } else if (s->image_data_file) {
+        error_setg(errp, "qcow2: Data file header extension without the "
+                   "data file feature bit");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* qcow2_read_extension may have set up the crypto context
      * if the crypt method needs a header region, some methods
      * don't need header extensions, so must check here
@@ -1400,7 +1656,7 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
                 cflags |= QCRYPTO_BLOCK_OPEN_NO_IO;
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
-                                           NULL, NULL, cflags, errp);
+                                           NULL, NULL, cflags, 1, errp);
             if (!s->crypto) {
                 ret = -EINVAL;
                 goto fail;
@@ -1469,6 +1725,7 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 
     /* Initialise locks */
     qemu_co_mutex_init(&s->lock);
+    qemu_co_queue_init(&s->compress_wait_queue);
     bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP;
 
     /* Repair image if dirty */
@@ -1495,6 +1752,12 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     return ret;
 
  fail:
+    if (s->data_file) {
+        bdrv_unref_child(bs, s->data_file);
+        s->data_file = NULL;
+    }
+    g_free(s->image_data_file);
+    s->image_data_file = NULL;
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
     qcow2_free_snapshots(bs);
@@ -1503,6 +1766,7 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
     cache_clean_timer_del(bs);
+    bitmap_checkpoint_timer_del(bs);
     if (s->l2_table_cache) {
         qcow2_cache_destroy(bs, s->l2_table_cache);
     }
@@ -1560,6 +1824,8 @@ static int qcow2_reopen_prepare(BDRVReopenState *state,
             goto fail;
         }
 
+        qcow2_release_alloc_extent(state->bs);
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -1646,6 +1912,14 @@ static int64_t coroutine_fn qcow2_co_get_block_status(BlockDriverState *bs,
     unsigned int bytes;
     int64_t status = 0;
 
+    if (has_data_file(s)) {
+        /* Guest offsets map 1:1 to the data file */
+        *pnum = nb_sectors;
+        *file = s->data_file->bs;
+        return BDRV_BLOCK_RAW | BDRV_BLOCK_OFFSET_VALID |
+               (sector_num << BDRV_SECTOR_BITS);
+    }
+
     bytes = MIN(INT_MAX, nb_sectors * BDRV_SECTOR_SIZE);
     qemu_co_mutex_lock(&s->lock);
     ret = qcow2_get_cluster_offset(bs, sector_num << BDRV_SECTOR_BITS, &bytes,
@@ -1672,6 +1946,145 @@ static int64_t coroutine_fn qcow2_co_get_block_status(BlockDriverState *bs,
     return status;
 }
 
+static BdrvChild *qcow2_backing_owner_get(BDRVQcow2State *s,
+                                          uint64_t cluster, unsigned gen)
+{
+    Qcow2BackingOwner *e;
+
+    if (!s->backing_owners) {
+        return NULL;
+    }
+
+    e = &s->backing_owners[cluster % QCOW2_BACKING_OWNERS];
+    if (e->child && e->cluster == cluster && e->generation == gen) {
+        return e->child;
+    }
+    return NULL;
+}
+
+static void qcow2_backing_owner_set(BDRVQcow2State *s, uint64_t cluster,
+                                    BdrvChild *child, unsigned gen)
+{
+    Qcow2BackingOwner *e;
+
+    if (!s->backing_owners) {
+        s->backing_owners = g_new0(Qcow2BackingOwner, QCOW2_BACKING_OWNERS);
+    }
+
+    e = &s->backing_owners[cluster % QCOW2_BACKING_OWNERS];
+    e->cluster = cluster;
+    e->child = child;
+    e->generation = gen;
+}
+
+/*
+ * Find the node in the backing chain of @bs that holds the data for
+ * [@offset, @offset + *@bytes), which must be unallocated in @bs.  Returns the
+ * child through which that node is read and reduces *@bytes to the length for
+ * which the answer is valid.
+ *
+ * Reading from the owner directly is equivalent to falling through all the
+ * layers above it because none of them has the range allocated.  The answer
+ * stays valid until the backing generation changes: discarding in the top
+ * layer only means that it is consulted again, and anything else that could
+ * change the answer (graph changes, writes and truncation of backing nodes)
+ * bumps the generation.
+ */
+static coroutine_fn BdrvChild *qcow2_find_backing_owner(BlockDriverState *bs,
+                                                        uint64_t offset,
+                                                        uint64_t *bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    unsigned gen = bdrv_backing_generation();
+    uint64_t start = start_of_cluster(s, offset);
+    uint64_t end = offset + *bytes;
+    uint64_t image_end = bs->total_sectors * BDRV_SECTOR_SIZE;
+    uint64_t cached_end, next;
+    BdrvChild *child;
+    int64_t len, pnum;
+    int ret;
+
+    child = qcow2_backing_owner_get(s, offset >> s->cluster_bits, gen);
+    if (child) {
+        for (next = start + s->cluster_size; next < end;
+             next += s->cluster_size)
+        {
+            if (qcow2_backing_owner_get(s, next >> s->cluster_bits, gen) !=
+                child)
+            {
+                break;
+            }
+        }
+        *bytes = MIN(next, end) - offset;
+        return child;
+    }
+
+    /* Nothing to skip with a single backing file */
+    if (!bs->backing->bs->backing) {
+        return bs->backing;
+    }
+
+    /* Look up whole clusters so that the result can be cached */
+    len = MIN(ROUND_UP(end, s->cluster_size), image_end) - start;
+    child = bs->backing;
+    for (;;) {
+        if (!child->bs->drv) {
+            return bs->backing;
+        }
+        ret = bdrv_is_allocated(child->bs, start, len, &pnum);
+        if (ret < 0 || pnum <= offset - start) {
+            return bs->backing;
+        }
+        len = pnum;
+        /* Don't bypass filters, they may do more than just pass data on */
+        if (ret || !child->bs->backing || child->bs->drv->is_filter) {
+            break;
+        }
+        child = child->bs->backing;
+    }
+
+    cached_end = start + len;
+    if (cached_end != image_end) {
+        cached_end = start_of_cluster(s, cached_end);
+    }
+    for (next = start; next < cached_end; next += s->cluster_size) {
+        qcow2_backing_owner_set(s, next >> s->cluster_bits, child, gen);
+    }
+
+    *bytes = MIN(start + len, end) - offset;
+    return child;
+}
+
+static coroutine_fn int qcow2_co_read_backing(BlockDriverState *bs,
+                                              uint64_t offset, uint64_t bytes,
+                                              QEMUIOVector *qiov)
+{
+    QEMUIOVector local_qiov;
+    uint64_t bytes_done = 0;
+    uint64_t cur_bytes;
+    BdrvChild *child;
+    int ret = 0;
+
+    qemu_iovec_init(&local_qiov, qiov->niov);
+
+    while (bytes_done < bytes) {
+        cur_bytes = bytes - bytes_done;
+        child = qcow2_find_backing_owner(bs, offset + bytes_done, &cur_bytes);
+
+        qemu_iovec_reset(&local_qiov);
+        qemu_iovec_concat(&local_qiov, qiov, bytes_done, cur_bytes);
+        ret = bdrv_co_preadv(child, offset + bytes_done, cur_bytes,
+                             &local_qiov, 0);
+        if (ret < 0) {
+            break;
+        }
+        bytes_done += cur_bytes;
+    }
+
+    qemu_iovec_destroy(&local_qiov);
+    return ret;
+}
+
 static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
                                         uint64_t bytes, QEMUIOVector *qiov,
                                         int flags)
@@ -1685,6 +2098,10 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
     QEMUIOVector hd_qiov;
     uint8_t *cluster_data = NULL;
 
+    if (has_data_file(s)) {
+        return bdrv_co_preadv(s->data_file, offset, bytes, qiov, flags);
+    }
+
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
     qemu_co_mutex_lock(&s->lock);
@@ -1714,8 +2131,7 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             if (bs->backing) {
                 BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
                 qemu_co_mutex_unlock(&s->lock);
-                ret = bdrv_co_preadv(bs->backing, offset, cur_bytes,
-                                     &hd_qiov, 0);
+                ret = qcow2_co_read_backing(bs, offset, cur_bytes, &hd_qiov);
                 qemu_co_mutex_lock(&s->lock);
                 if (ret < 0) {
                     goto fail;
@@ -1732,15 +2148,12 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             break;
 
         case QCOW2_CLUSTER_COMPRESSED:
-            /* add AIO support for compressed blocks ? */
-            ret = qcow2_decompress_cluster(bs, cluster_offset);
+            ret = qcow2_co_read_compressed(bs, cluster_offset,
+                                           offset_in_cluster,
+                                           &hd_qiov, cur_bytes);
             if (ret < 0) {
                 goto fail;
             }
-
-            qemu_iovec_from_buf(&hd_qiov, 0,
-                                s->cluster_cache + offset_in_cluster,
-                                cur_bytes);
             break;
 
         case QCOW2_CLUSTER_NORMAL:
@@ -1858,6 +2271,43 @@ static bool merge_cow(uint64_t offset, unsigned bytes,
     return false;
 }
 
+/*
+ * Completes the cluster allocations in @l2meta: links the clusters into the
+ * L2 tables unless @link_l2 is false (because the data could not be written)
+ * and wakes up requests waiting for them.  Must be called with s->lock held.
+ */
+static int qcow2_handle_l2meta(BlockDriverState *bs, QCowL2Meta **pl2meta,
+                               bool link_l2)
+{
+    int ret = 0;
+    QCowL2Meta *l2meta = *pl2meta;
+
+    while (l2meta != NULL) {
+        QCowL2Meta *next;
+
+        if (link_l2) {
+            ret = qcow2_alloc_cluster_link_l2(bs, l2meta);
+            if (ret < 0) {
+                goto out;
+            }
+        }
+
+        /* Take the request off the list of running requests */
+        if (l2meta->nb_clusters != 0) {
+            QLIST_REMOVE(l2meta, next_in_flight);
+        }
+
+        qemu_co_queue_restart_all(&l2meta->dependent_requests);
+
+        next = l2meta->next;
+        g_free(l2meta);
+        l2meta = next;
+    }
+out:
+    *pl2meta = l2meta;
+    return ret;
+}
+
 static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                          uint64_t bytes, QEMUIOVector *qiov,
                                          int flags)
@@ -1874,12 +2324,18 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
 
     trace_qcow2_writev_start_req(qemu_coroutine_self(), offset, bytes);
 
-    qemu_iovec_init(&hd_qiov, qiov->niov);
+    if (has_data_file(s)) {
+        /* No metadata ever changes for guest writes */
+        return bdrv_co_pwritev(s->data_file, offset, bytes, qiov, flags);
+    }
 
-    s->cluster_cache_offset = -1; /* disable compressed cache */
+    qemu_iovec_init(&hd_qiov, qiov->niov);
 
     qemu_co_mutex_lock(&s->lock);
 
+    /* the write may reuse the space of a compressed cluster */
+    qcow2_compressed_cache_invalidate(s);
+
     while (bytes != 0) {
 
         l2meta = NULL;
@@ -1958,24 +2414,9 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
             }
         }
 
-        while (l2meta != NULL) {
-            QCowL2Meta *next;
-
-            ret = qcow2_alloc_cluster_link_l2(bs, l2meta);
-            if (ret < 0) {
-                goto fail;
-            }
-
-            /* Take the request off the list of running requests */
-            if (l2meta->nb_clusters != 0) {
-                QLIST_REMOVE(l2meta, next_in_flight);
-            }
-
-            qemu_co_queue_restart_all(&l2meta->dependent_requests);
-
-            next = l2meta->next;
-            g_free(l2meta);
-            l2meta = next;
+        ret = qcow2_handle_l2meta(bs, &l2meta, true);
+        if (ret < 0) {
+            goto fail;
         }
 
         bytes -= cur_bytes;
@@ -1986,18 +2427,7 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
     ret = 0;
 
 fail:
-    while (l2meta != NULL) {
-        QCowL2Meta *next;
-
-        if (l2meta->nb_clusters != 0) {
-            QLIST_REMOVE(l2meta, next_in_flight);
-        }
-        qemu_co_queue_restart_all(&l2meta->dependent_requests);
-
-        next = l2meta->next;
-        g_free(l2meta);
-        l2meta = next;
-    }
+    qcow2_handle_l2meta(bs, &l2meta, false);
 
     qemu_co_mutex_unlock(&s->lock);
 
@@ -2014,6 +2444,10 @@ static int qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    qcow2_release_alloc_extent(bs);
+
+    bitmap_checkpoint_timer_del(bs);
+    qcow2_wait_bitmap_checkpoint(bs);
     qcow2_store_persistent_dirty_bitmaps(bs, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2055,6 +2489,7 @@ static void qcow2_close(BlockDriverState *bs)
     }
 
     cache_clean_timer_del(bs);
+    bitmap_checkpoint_timer_del(bs);
     qcow2_cache_destroy(bs, s->l2_table_cache);
     qcow2_cache_destroy(bs, s->refcount_block_cache);
 
@@ -2066,9 +2501,10 @@ static void qcow2_close(BlockDriverState *bs)
 
     g_free(s->image_backing_file);
     g_free(s->image_backing_format);
+    g_free(s->image_data_file);
+    g_free(s->backing_owners);
 
-    g_free(s->cluster_cache);
-    qemu_vfree(s->cluster_data);
+    qcow2_compressed_cache_free(s);
     qcow2_refcount_close(bs);
     qcow2_free_snapshots(bs);
 }
@@ -2078,6 +2514,7 @@ static void qcow2_invalidate_cache(BlockDriverState *bs, Error **errp)
     BDRVQcow2State *s = bs->opaque;
     int flags = s->flags;
     QCryptoBlock *crypto = NULL;
+    BdrvChild *data_file;
     QDict *options;
     Error *local_err = NULL;
     int ret;
@@ -2089,10 +2526,12 @@ static void qcow2_invalidate_cache(BlockDriverState *bs, Error **errp)
 
     crypto = s->crypto;
     s->crypto = NULL;
+    data_file = s->data_file;
 
     qcow2_close(bs);
 
     memset(s, 0, sizeof(BDRVQcow2State));
+    s->data_file = data_file;
     options = qdict_clone_shallow(bs->options);
 
     flags &= ~BDRV_O_INACTIVE;
@@ -2251,6 +2690,33 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /* Compression type header extension */
+    if (s->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+        Qcow2CompressionTypeExt compression_ext = {
+            .compression_type = s->compression_type,
+        };
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_COMPRESSION_TYPE,
+                             &compression_ext, sizeof(compression_ext),
+                             buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
+    /* External data file header extension */
+    if (s->image_data_file) {
+        ret = header_ext_add(buf, QCOW2_EXT_MAGIC_DATA_FILE,
+                             s->image_data_file, strlen(s->image_data_file),
+                             buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+        buf += ret;
+        buflen -= ret;
+    }
+
     /* Feature table */
     if (s->qcow_version >= 3) {
         Qcow2Feature features[] = {
@@ -2265,11 +2731,26 @@ int qcow2_update_header(BlockDriverState *bs)
                 .name = "corrupt bit",
             },
             {
-                .type = QCOW2_FEAT_TYPE_COMPATIBLE,
-                .bit  = QCOW2_COMPAT_LAZY_REFCOUNTS_BITNR,
-                .name = "lazy refcounts",
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_COMPRESSION_BITNR,
+                .name = "compression type",
             },
-        };
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_EXTL2_BITNR,
+                .name = "extended L2 entries",
+            },
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_DATA_FILE_BITNR,
+                .name = "external data file",
+            },
+            {
+                .type = QCOW2_FEAT_TYPE_COMPATIBLE,
+                .bit  = QCOW2_COMPAT_LAZY_REFCOUNTS_BITNR,
+                .name = "lazy refcounts",
+            },
+        };
 
         ret = header_ext_add(buf, QCOW2_EXT_MAGIC_FEATURE_TABLE,
                              features, sizeof(features), buflen);
@@ -2356,6 +2837,10 @@ static int qcow2_change_backing_file(BlockDriverState *bs,
         return -EINVAL;
     }
 
+    if (backing_file && has_data_file(s)) {
+        return -ENOTSUP;
+    }
+
     pstrcpy(bs->backing_file, sizeof(bs->backing_file), backing_file ?: "");
     pstrcpy(bs->backing_format, sizeof(bs->backing_format), backing_fmt ?: "");
 
@@ -2597,28 +3082,31 @@ int64_t qcow2_refcount_metadata_size(int64_t clusters, size_t cluster_size,
  * @total_size: virtual disk size in bytes
  * @cluster_size: cluster size in bytes
  * @refcount_order: refcount bits power-of-2 exponent
+ * @extended_l2: true if the image has extended L2 entries
  *
  * Returns: Total number of bytes required for the fully allocated image
  * (including metadata).
  */
 static int64_t qcow2_calc_prealloc_size(int64_t total_size,
                                         size_t cluster_size,
-                                        int refcount_order)
+                                        int refcount_order,
+                                        bool extended_l2)
 {
     int64_t meta_size = 0;
     uint64_t nl1e, nl2e;
     int64_t aligned_total_size = align_offset(total_size, cluster_size);
+    size_t l2e_size = extended_l2 ? 2 * sizeof(uint64_t) : sizeof(uint64_t);
 
     /* header: 1 cluster */
     meta_size += cluster_size;
 
     /* total size of L2 tables */
     nl2e = aligned_total_size / cluster_size;
-    nl2e = align_offset(nl2e, cluster_size / sizeof(uint64_t));
-    meta_size += nl2e * sizeof(uint64_t);
+    nl2e = align_offset(nl2e, cluster_size / l2e_size);
+    meta_size += nl2e * l2e_size;
 
     /* total size of L1 tables */
-    nl1e = nl2e * sizeof(uint64_t) / cluster_size;
+    nl1e = nl2e * l2e_size / cluster_size;
     nl1e = align_offset(nl1e, cluster_size / sizeof(uint64_t));
     meta_size += nl1e * sizeof(uint64_t);
 
@@ -2694,7 +3182,10 @@ static int qcow2_create2(const char *filename, int64_t total_size,
                          const char *backing_file, const char *backing_format,
                          int flags, size_t cluster_size, PreallocMode prealloc,
                          QemuOpts *opts, int version, int refcount_order,
-                         const char *encryptfmt, Error **errp)
+                         const char *encryptfmt,
+                         Qcow2CompressionType compression_type,
+                         bool extended_l2, const char *data_file,
+                         Error **errp)
 {
     QDict *options;
 
@@ -2718,7 +3209,8 @@ static int qcow2_create2(const char *filename, int64_t total_size,
 
     if (prealloc == PREALLOC_MODE_FULL || prealloc == PREALLOC_MODE_FALLOC) {
         int64_t prealloc_size =
-            qcow2_calc_prealloc_size(total_size, cluster_size, refcount_order);
+            qcow2_calc_prealloc_size(total_size, cluster_size, refcount_order,
+                                     extended_l2);
         qemu_opt_set_number(opts, BLOCK_OPT_SIZE, prealloc_size, &error_abort);
         qemu_opt_set(opts, BLOCK_OPT_PREALLOC, PreallocMode_str(prealloc),
                      &error_abort);
@@ -2730,6 +3222,16 @@ static int qcow2_create2(const char *filename, int64_t total_size,
         return ret;
     }
 
+    if (data_file) {
+        /* The data file is raw, so it simply has the virtual disk size */
+        qemu_opt_set_number(opts, BLOCK_OPT_SIZE, total_size, &error_abort);
+        ret = bdrv_create_file(data_file, opts, &local_err);
+        if (ret < 0) {
+            error_propagate(errp, local_err);
+            return ret;
+        }
+    }
+
     blk = blk_new_open(filename, NULL, NULL,
                        BDRV_O_RDWR | BDRV_O_RESIZE | BDRV_O_PROTOCOL,
                        &local_err);
@@ -2764,6 +3266,12 @@ static int qcow2_create2(const char *filename, int64_t total_size,
             cpu_to_be64(QCOW2_COMPAT_LAZY_REFCOUNTS);
     }
 
+    /* The L2 table layout must be known when the image is opened below */
+    if (extended_l2) {
+        header->incompatible_features |=
+            cpu_to_be64(QCOW2_INCOMPAT_EXTL2);
+    }
+
     ret = blk_pwrite(blk, 0, header, cluster_size, 0);
     g_free(header);
     if (ret < 0) {
@@ -2812,6 +3320,13 @@ static int qcow2_create2(const char *filename, int64_t total_size,
         abort();
     }
 
+    if (compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+        BDRVQcow2State *s = blk_bs(blk)->opaque;
+
+        s->compression_type = compression_type;
+        s->incompatible_features |= QCOW2_INCOMPAT_COMPRESSION;
+    }
+
     /* Create a full header (including things like feature table) */
     ret = qcow2_update_header(blk_bs(blk));
     if (ret < 0) {
@@ -2853,6 +3368,20 @@ static int qcow2_create2(const char *filename, int64_t total_size,
         }
     }
 
+    /* Switching to the data file last keeps the steps above on the metadata
+     * paths; the reopen below then checks that the data file can be opened */
+    if (data_file) {
+        BDRVQcow2State *s = blk_bs(blk)->opaque;
+
+        s->image_data_file = g_strdup(data_file);
+        s->incompatible_features |= QCOW2_INCOMPAT_DATA_FILE;
+        ret = qcow2_update_header(blk_bs(blk));
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not update qcow2 header");
+            goto out;
+        }
+    }
+
     blk_unref(blk);
     blk = NULL;
 
@@ -2894,6 +3423,9 @@ static int qcow2_create(const char *filename, QemuOpts *opts, Error **errp)
     uint64_t refcount_bits;
     int refcount_order;
     char *encryptfmt = NULL;
+    char *data_file = NULL;
+    Qcow2CompressionType compression_type;
+    bool extended_l2;
     Error *local_err = NULL;
     int ret;
 
@@ -2962,15 +3494,80 @@ static int qcow2_create(const char *filename, QemuOpts *opts, Error **errp)
 
     refcount_order = ctz32(refcount_bits);
 
+    g_free(buf);
+    buf = qemu_opt_get_del(opts, BLOCK_OPT_COMPRESSION_TYPE);
+    compression_type = qapi_enum_parse(&Qcow2CompressionType_lookup, buf,
+                                       QCOW2_COMPRESSION_TYPE_ZLIB,
+                                       &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto finish;
+    }
+
+    if (compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+        if (version < 3) {
+            error_setg(errp, "Compression types other than zlib require "
+                       "compatibility level 1.1 or above (use compat=1.1 or "
+                       "greater)");
+            ret = -EINVAL;
+            goto finish;
+        }
+#ifndef CONFIG_ZSTD
+        if (compression_type == QCOW2_COMPRESSION_TYPE_ZSTD) {
+            error_setg(errp, "zstd compression is not supported by this "
+                       "build");
+            ret = -ENOTSUP;
+            goto finish;
+        }
+#endif
+    }
+
+    extended_l2 = qemu_opt_get_bool_del(opts, BLOCK_OPT_EXTL2, false);
+    if (extended_l2) {
+        if (version < 3) {
+            error_setg(errp, "Extended L2 entries are only supported with "
+                       "compatibility level 1.1 and above (use compat=1.1 or "
+                       "greater)");
+            ret = -EINVAL;
+            goto finish;
+        }
+        if (cluster_size < (1 << MIN_EXTL2_CLUSTER_BITS)) {
+            error_setg(errp, "Extended L2 entries need a cluster size of at "
+                       "least %d bytes", 1 << MIN_EXTL2_CLUSTER_BITS);
+            ret = -EINVAL;
+            goto finish;
+        }
+    }
+
+    data_file = qemu_opt_get_del(opts, BLOCK_OPT_DATA_FILE);
+    if (data_file) {
+        if (version < 3) {
+            error_setg(errp, "External data files are only supported with "
+                       "compatibility level 1.1 and above (use compat=1.1 "
+                       "or greater)");
+            ret = -EINVAL;
+            goto finish;
+        }
+        if (backing_file || encryptfmt || prealloc != PREALLOC_MODE_OFF) {
+            error_setg(errp, "An external data file cannot be combined with "
+                       "a backing file, encryption or preallocation");
+            ret = -EINVAL;
+            goto finish;
+        }
+    }
+
     ret = qcow2_create2(filename, size, backing_file, backing_fmt, flags,
                         cluster_size, prealloc, opts, version, refcount_order,
-                        encryptfmt, &local_err);
+                        encryptfmt, compression_type, extended_l2, data_file,
+                        &local_err);
     error_propagate(errp, local_err);
 
 finish:
     g_free(backing_file);
     g_free(backing_fmt);
     g_free(encryptfmt);
+    g_free(data_file);
     g_free(buf);
     return ret;
 }
@@ -3003,6 +3600,10 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
     uint32_t tail = (offset + bytes) % s->cluster_size;
 
     trace_qcow2_pwrite_zeroes_start_req(qemu_coroutine_self(), offset, bytes);
+    if (has_data_file(s)) {
+        return bdrv_co_pwrite_zeroes(s->data_file, offset, bytes, flags);
+    }
+
     if (offset + bytes == bs->total_sectors * BDRV_SECTOR_SIZE) {
         tail = 0;
     }
@@ -3051,6 +3652,10 @@ static coroutine_fn int qcow2_co_pdiscard(BlockDriverState *bs,
     int ret;
     BDRVQcow2State *s = bs->opaque;
 
+    if (has_data_file(s)) {
+        return bdrv_co_pdiscard(s->data_file->bs, offset, bytes);
+    }
+
     if (!QEMU_IS_ALIGNED(offset | bytes, s->cluster_size)) {
         assert(bytes < s->cluster_size);
         /* Ignore partial clusters, except for the special case of the
@@ -3068,6 +3673,172 @@ static coroutine_fn int qcow2_co_pdiscard(BlockDriverState *bs,
     return ret;
 }
 
+static int coroutine_fn
+qcow2_co_copy_range_from(BlockDriverState *bs,
+                         BdrvChild *src, uint64_t src_offset,
+                         BdrvChild *dst, uint64_t dst_offset,
+                         uint64_t bytes, BdrvRequestFlags flags)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+    unsigned int cur_bytes; /* number of bytes in current iteration */
+    BdrvChild *child = NULL;
+    BdrvRequestFlags cur_flags;
+
+    assert(!bs->encrypted);
+
+    if (has_data_file(s)) {
+        return bdrv_co_copy_range_from(s->data_file, src_offset,
+                                       dst, dst_offset, bytes, flags);
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+
+    while (bytes != 0) {
+        uint64_t copy_offset = 0;
+
+        /* prepare next request */
+        cur_bytes = MIN(bytes, INT_MAX);
+        cur_flags = flags;
+
+        ret = qcow2_get_cluster_offset(bs, src_offset, &cur_bytes,
+                                       &copy_offset);
+        if (ret < 0) {
+            goto out;
+        }
+
+        switch (ret) {
+        case QCOW2_CLUSTER_UNALLOCATED:
+            if (bs->backing && bs->backing->bs) {
+                int64_t backing_length = bdrv_getlength(bs->backing->bs);
+                if (src_offset >= backing_length) {
+                    cur_flags |= BDRV_REQ_ZERO_WRITE;
+                } else {
+                    child = bs->backing;
+                    cur_bytes = MIN(cur_bytes, backing_length - src_offset);
+                    copy_offset = src_offset;
+                }
+            } else {
+                cur_flags |= BDRV_REQ_ZERO_WRITE;
+            }
+            break;
+
+        case QCOW2_CLUSTER_ZERO_PLAIN:
+        case QCOW2_CLUSTER_ZERO_ALLOC:
+            cur_flags |= BDRV_REQ_ZERO_WRITE;
+            break;
+
+        case QCOW2_CLUSTER_COMPRESSED:
+            ret = -ENOTSUP;
+            goto out;
+
+        case QCOW2_CLUSTER_NORMAL:
+            child = bs->file;
+            copy_offset += offset_into_cluster(s, src_offset);
+            if ((copy_offset & 511) != 0) {
+                ret = -EIO;
+                goto out;
+            }
+            break;
+
+        default:
+            abort();
+        }
+        qemu_co_mutex_unlock(&s->lock);
+        ret = bdrv_co_copy_range_from(child, copy_offset, dst, dst_offset,
+                                      cur_bytes, cur_flags);
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto out;
+        }
+
+        bytes -= cur_bytes;
+        src_offset += cur_bytes;
+        dst_offset += cur_bytes;
+    }
+    ret = 0;
+
+out:
+    qemu_co_mutex_unlock(&s->lock);
+    return ret;
+}
+
+static int coroutine_fn
+qcow2_co_copy_range_to(BlockDriverState *bs,
+                       BdrvChild *src, uint64_t src_offset,
+                       BdrvChild *dst, uint64_t dst_offset,
+                       uint64_t bytes, BdrvRequestFlags flags)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int offset_in_cluster;
+    int ret;
+    unsigned int cur_bytes; /* number of bytes in current iteration */
+    uint64_t cluster_offset;
+    QCowL2Meta *l2meta = NULL;
+
+    assert(!bs->encrypted);
+
+    if (has_data_file(s)) {
+        /* No metadata ever changes for guest writes */
+        return bdrv_co_copy_range_to(src, src_offset, s->data_file,
+                                     dst_offset, bytes, flags);
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+
+    /* the write may reuse the space of a compressed cluster */
+    qcow2_compressed_cache_invalidate(s);
+
+    while (bytes != 0) {
+        l2meta = NULL;
+
+        offset_in_cluster = offset_into_cluster(s, dst_offset);
+        cur_bytes = MIN(bytes, INT_MAX);
+
+        ret = qcow2_alloc_cluster_offset(bs, dst_offset, &cur_bytes,
+                                         &cluster_offset, &l2meta);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        assert((cluster_offset & 511) == 0);
+
+        ret = qcow2_pre_write_overlap_check(bs, 0,
+                cluster_offset + offset_in_cluster, cur_bytes);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        /* The COW regions of newly allocated clusters are written by
+         * qcow2_alloc_cluster_link_l2() in qcow2_handle_l2meta() */
+        qemu_co_mutex_unlock(&s->lock);
+        ret = bdrv_co_copy_range_to(src, src_offset, bs->file,
+                                    cluster_offset + offset_in_cluster,
+                                    cur_bytes, flags);
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        ret = qcow2_handle_l2meta(bs, &l2meta, true);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        bytes -= cur_bytes;
+        src_offset += cur_bytes;
+        dst_offset += cur_bytes;
+    }
+    ret = 0;
+
+fail:
+    qcow2_handle_l2meta(bs, &l2meta, false);
+
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
 static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
                           PreallocMode prealloc, Error **errp)
 {
@@ -3095,6 +3866,8 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
         return -ENOTSUP;
     }
 
+    qcow2_release_alloc_extent(bs);
+
     /* cannot proceed if image has bitmaps */
     if (s->nb_bitmaps) {
         /* TODO: resize bitmaps in the image */
@@ -3105,6 +3878,16 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
     old_length = bs->total_sectors * 512;
     new_l1_size = size_to_l1(s, offset);
 
+    if (has_data_file(s)) {
+        /* The L1 table is not used for guest data, so only the data file
+         * and the virtual disk size change */
+        ret = bdrv_truncate(s->data_file, offset, prealloc, errp);
+        if (ret < 0) {
+            return ret;
+        }
+        goto update_size;
+    }
+
     if (offset < old_length) {
         int64_t last_cluster, old_file_size;
         if (prealloc != PREALLOC_MODE_OFF) {
@@ -3207,8 +3990,7 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
          *  allocated automatically, so they do not need to be covered by the
          *  preallocation. All that matters is that we will not have to allocate
          *  new refcount structures for them.) */
-        nb_new_l2_tables = DIV_ROUND_UP(nb_new_data_clusters,
-                                        s->cluster_size / sizeof(uint64_t));
+        nb_new_l2_tables = DIV_ROUND_UP(nb_new_data_clusters, s->l2_size);
         /* The cluster range may not be aligned to L2 boundaries, so add one L2
          * table for a potential head/tail */
         nb_new_l2_tables++;
@@ -3250,8 +4032,9 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
         guest_offset = old_length;
         while (nb_new_data_clusters) {
             int64_t guest_cluster = guest_offset >> s->cluster_bits;
-            int64_t nb_clusters = MIN(nb_new_data_clusters,
-                                      s->l2_size - guest_cluster % s->l2_size);
+            int64_t nb_clusters = MIN(
+                nb_new_data_clusters,
+                s->l2_slice_size - guest_cluster % s->l2_slice_size);
             QCowL2Meta allocation = {
                 .offset       = guest_offset,
                 .alloc_offset = host_offset,
@@ -3289,6 +4072,7 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
         }
     }
 
+update_size:
     /* write updated header.size */
     offset = cpu_to_be64(offset);
     ret = bdrv_pwrite_sync(bs->file, offsetof(QCowHeader, size),
@@ -3304,6 +4088,125 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
 
 /* XXX: put compressed sectors first, then all the cluster aligned
    tables to avoid losing bytes in alignment */
+/* zstd's own default, compresses about as well as zlib but much faster */
+#define QCOW2_ZSTD_LEVEL 3
+
+/*
+ * qcow2_compress()
+ *
+ * @type - compression type of the image
+ * @dest - destination buffer, at least of @dest_size bytes
+ * @src - source buffer, @src_size bytes
+ *
+ * Returns: compressed size on success
+ *          -1 if the data doesn't fit in @dest_size bytes
+ *          -2 on any other error
+ */
+static ssize_t qcow2_compress(Qcow2CompressionType type,
+                              void *dest, size_t dest_size,
+                              const void *src, size_t src_size)
+{
+    ssize_t ret;
+    z_stream strm;
+
+    switch (type) {
+    case QCOW2_COMPRESSION_TYPE_ZLIB:
+        break;
+#ifdef CONFIG_ZSTD
+    case QCOW2_COMPRESSION_TYPE_ZSTD: {
+        /* A whole frame, decompress_buffer() finds its end by itself */
+        size_t zret = ZSTD_compress(dest, dest_size, src, src_size,
+                                    QCOW2_ZSTD_LEVEL);
+
+        /* Apart from allocation failures, where being written uncompressed
+         * is fine too, the only error is that the data doesn't fit */
+        return ZSTD_isError(zret) ? -1 : zret;
+    }
+#endif
+    default:
+        g_assert_not_reached();
+    }
+
+    /* best compression, small window, no zlib header */
+    memset(&strm, 0, sizeof(strm));
+    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                       -12, 9, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        return -2;
+    }
+
+    /* strm.next_in is not const in old zlib versions, such as those used on
+     * OpenBSD/NetBSD, so cast the const away */
+    strm.avail_in = src_size;
+    strm.next_in = (void *) src;
+    strm.avail_out = dest_size;
+    strm.next_out = dest;
+
+    ret = deflate(&strm, Z_FINISH);
+    if (ret == Z_STREAM_END) {
+        ret = dest_size - strm.avail_out;
+    } else {
+        ret = (ret == Z_OK ? -1 : -2);
+    }
+
+    deflateEnd(&strm);
+
+    return ret;
+}
+
+#define QCOW2_MAX_COMPRESS_THREADS 4
+
+typedef struct Qcow2CompressData {
+    Qcow2CompressionType type;
+    void *dest;
+    size_t dest_size;
+    const void *src;
+    size_t src_size;
+    ssize_t ret;
+} Qcow2CompressData;
+
+static int qcow2_compress_pool_func(void *opaque)
+{
+    Qcow2CompressData *data = opaque;
+
+    data->ret = qcow2_compress(data->type, data->dest, data->dest_size,
+                               data->src, data->src_size);
+
+    return 0;
+}
+
+/*
+ * Compress in the thread pool of the AioContext, so that several
+ * clusters written in parallel (qemu-img convert -m, backup jobs) are
+ * compressed on several host CPUs.
+ */
+static ssize_t coroutine_fn
+qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
+                  const void *src, size_t src_size)
+{
+    BDRVQcow2State *s = bs->opaque;
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    Qcow2CompressData arg = {
+        .type = s->compression_type,
+        .dest = dest,
+        .dest_size = dest_size,
+        .src = src,
+        .src_size = src_size,
+    };
+
+    while (s->nb_compress_threads >= QCOW2_MAX_COMPRESS_THREADS) {
+        qemu_co_queue_wait(&s->compress_wait_queue, NULL);
+    }
+
+    s->nb_compress_threads++;
+    thread_pool_submit_co(pool, qcow2_compress_pool_func, &arg);
+    s->nb_compress_threads--;
+
+    qemu_co_queue_next(&s->compress_wait_queue);
+
+    return arg.ret;
+}
+
 static coroutine_fn int
 qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
                             uint64_t bytes, QEMUIOVector *qiov)
@@ -3311,11 +4214,15 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
     BDRVQcow2State *s = bs->opaque;
     QEMUIOVector hd_qiov;
     struct iovec iov;
-    z_stream strm;
-    int ret, out_len;
+    int ret;
+    ssize_t out_len;
     uint8_t *buf, *out_buf;
     int64_t cluster_offset;
 
+    if (has_data_file(s)) {
+        return -ENOTSUP;
+    }
+
     if (bytes == 0) {
         /* align end of file to a sector boundary to ease reading with
            sector based I/Os */
@@ -3345,32 +4252,12 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
 
     out_buf = g_malloc(s->cluster_size);
 
-    /* best compression, small window, no zlib header */
-    memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION,
-                       Z_DEFLATED, -12,
-                       9, Z_DEFAULT_STRATEGY);
-    if (ret != 0) {
-        ret = -EINVAL;
-        goto fail;
-    }
-
-    strm.avail_in = s->cluster_size;
-    strm.next_in = (uint8_t *)buf;
-    strm.avail_out = s->cluster_size;
-    strm.next_out = out_buf;
-
-    ret = deflate(&strm, Z_FINISH);
-    if (ret != Z_STREAM_END && ret != Z_OK) {
-        deflateEnd(&strm);
+    out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
+                                buf, s->cluster_size);
+    if (out_len == -2) {
         ret = -EINVAL;
         goto fail;
-    }
-    out_len = strm.next_out - out_buf;
-
-    deflateEnd(&strm);
-
-    if (ret != Z_STREAM_END || out_len >= s->cluster_size) {
+    } else if (out_len == -1) {
         /* could not compress: write normal cluster */
         ret = qcow2_co_pwritev(bs, offset, bytes, qiov, 0);
         if (ret < 0) {
@@ -3380,6 +4267,7 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
     }
 
     qemu_co_mutex_lock(&s->lock);
+    qcow2_compressed_cache_invalidate(s);
     cluster_offset =
         qcow2_alloc_compressed_cluster_offset(bs, offset, out_len);
     if (!cluster_offset) {
@@ -3572,6 +4460,12 @@ static int qcow2_make_empty(BlockDriverState *bs)
     int step = QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size);
     int l1_clusters, ret = 0;
 
+    if (has_data_file(s)) {
+        return -ENOTSUP;
+    }
+
+    qcow2_release_alloc_extent(bs);
+
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / sizeof(uint64_t));
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
@@ -3627,6 +4521,11 @@ static coroutine_fn int qcow2_co_flush_to_os(BlockDriverState *bs)
     }
     qemu_co_mutex_unlock(&s->lock);
 
+    /* The generic flush only covers bs->file */
+    if (has_data_file(s)) {
+        return bdrv_co_flush(s->data_file->bs);
+    }
+
     return 0;
 }
 
@@ -3644,6 +4543,8 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
     char *optstr;
     PreallocMode prealloc;
     bool has_backing_file;
+    bool extended_l2;
+    size_t l2e_size;
 
     /* Parse image creation options */
     cluster_size = qcow2_opt_get_cluster_size_del(opts, &local_err);
@@ -3673,12 +4574,15 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
     has_backing_file = !!optstr;
     g_free(optstr);
 
+    extended_l2 = qemu_opt_get_bool_del(opts, BLOCK_OPT_EXTL2, false);
+    l2e_size = extended_l2 ? 2 * sizeof(uint64_t) : sizeof(uint64_t);
+
     virtual_size = align_offset(qemu_opt_get_size_del(opts, BLOCK_OPT_SIZE, 0),
                                 cluster_size);
 
     /* Check that virtual disk size is valid */
     l2_tables = DIV_ROUND_UP(virtual_size / cluster_size,
-                             cluster_size / sizeof(uint64_t));
+                             cluster_size / l2e_size);
     if (l2_tables * sizeof(uint64_t) > QCOW_MAX_L1_SIZE) {
         error_setg(&local_err, "The image size is too large "
                                "(try using a larger cluster size)");
@@ -3743,7 +4647,7 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
     info = g_new(BlockMeasureInfo, 1);
     info->fully_allocated =
         qcow2_calc_prealloc_size(virtual_size, cluster_size,
-                                 ctz32(refcount_bits));
+                                 ctz32(refcount_bits), extended_l2);
 
     /* Remove data clusters that are not required.  This overestimates the
      * required size because metadata needed for the fully allocated file is
@@ -3828,6 +4732,21 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs)
         spec_info->u.qcow2.data->encrypt = qencrypt;
     }
 
+    if (s->compression_type != QCOW2_COMPRESSION_TYPE_ZLIB) {
+        spec_info->u.qcow2.data->has_compression_type = true;
+        spec_info->u.qcow2.data->compression_type = s->compression_type;
+    }
+
+    if (has_subclusters(s)) {
+        spec_info->u.qcow2.data->has_extended_l2 = true;
+        spec_info->u.qcow2.data->extended_l2 = true;
+    }
+
+    if (has_data_file(s)) {
+        spec_info->u.qcow2.data->has_data_file = true;
+        spec_info->u.qcow2.data->data_file = g_strdup(s->image_data_file);
+    }
+
     return spec_info;
 }
 
@@ -3836,6 +4755,10 @@ static int qcow2_save_vmstate(BlockDriverState *bs, QEMUIOVector *qiov,
 {
     BDRVQcow2State *s = bs->opaque;
 
+    if (has_data_file(s)) {
+        return -ENOTSUP;
+    }
+
     BLKDBG_EVENT(bs->file, BLKDBG_VMSTATE_SAVE);
     return bs->drv->bdrv_co_pwritev(bs, qcow2_vm_state_offset(s) + pos,
                                     qiov->size, qiov, 0);
@@ -3846,6 +4769,10 @@ static int qcow2_load_vmstate(BlockDriverState *bs, QEMUIOVector *qiov,
 {
     BDRVQcow2State *s = bs->opaque;
 
+    if (has_data_file(s)) {
+        return -ENOTSUP;
+    }
+
     BLKDBG_EVENT(bs->file, BLKDBG_VMSTATE_LOAD);
     return bs->drv->bdrv_co_preadv(bs, qcow2_vm_state_offset(s) + pos,
                                    qiov->size, qiov, 0);
@@ -3997,6 +4924,7 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
     bool encrypt;
     int encformat;
     int refcount_bits = s->refcount_bits;
+    Qcow2CompressionType compression_type;
     Error *local_err = NULL;
     int ret;
     QemuOptDesc *desc = opts->list->desc;
@@ -4070,6 +4998,29 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
                              "not exceed 64 bits");
                 return -EINVAL;
             }
+        } else if (!strcmp(desc->name, BLOCK_OPT_COMPRESSION_TYPE)) {
+            compression_type = qapi_enum_parse(&Qcow2CompressionType_lookup,
+                qemu_opt_get(opts, BLOCK_OPT_COMPRESSION_TYPE),
+                s->compression_type, NULL);
+
+            if (compression_type != s->compression_type) {
+                error_report("Changing the compression type is not "
+                             "supported");
+                return -ENOTSUP;
+            }
+        } else if (!strcmp(desc->name, BLOCK_OPT_EXTL2)) {
+            if (qemu_opt_get_bool(opts, BLOCK_OPT_EXTL2, has_subclusters(s)) !=
+                has_subclusters(s)) {
+                error_report("Changing the extended L2 entries setting is not "
+                             "supported");
+                return -ENOTSUP;
+            }
+        } else if (!strcmp(desc->name, BLOCK_OPT_DATA_FILE)) {
+            if (g_strcmp0(qemu_opt_get(opts, BLOCK_OPT_DATA_FILE),
+                          s->image_data_file)) {
+                error_report("Changing the data file is not supported");
+                return -ENOTSUP;
+            }
         } else {
             /* if this point is reached, this probably means a new option was
              * added without having it covered here */
@@ -4303,6 +5254,23 @@ static QemuOptsList qcow2_create_opts = {
             .help = "Width of a reference count entry in bits",
             .def_value_str = "16"
         },
+        {
+            .name = BLOCK_OPT_COMPRESSION_TYPE,
+            .type = QEMU_OPT_STRING,
+            .help = "Compression type of the compressed clusters (allowed "
+                    "values: zlib, zstd)",
+        },
+        {
+            .name = BLOCK_OPT_EXTL2,
+            .type = QEMU_OPT_BOOL,
+            .help = "Use 32 subclusters per cluster (compat=1.1 only, "
+                    "cluster size >= 16k)",
+        },
+        {
+            .name = BLOCK_OPT_DATA_FILE,
+            .type = QEMU_OPT_STRING,
+            .help = "File name of an external data file",
+        },
         { /* end of list */ }
     }
 };
@@ -4328,6 +5296,8 @@ BlockDriver bdrv_qcow2 = {
 
     .bdrv_co_pwrite_zeroes  = qcow2_co_pwrite_zeroes,
     .bdrv_co_pdiscard       = qcow2_co_pdiscard,
+    .bdrv_co_copy_range_from = qcow2_co_copy_range_from,
+    .bdrv_co_copy_range_to  = qcow2_co_copy_range_to,
     .bdrv_truncate          = qcow2_truncate,
     .bdrv_co_pwritev_compressed = qcow2_co_pwritev_compressed,
     .bdrv_make_empty        = qcow2_make_empty,
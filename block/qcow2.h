@@ -64,11 +64,29 @@
 /* The cluster reads as all zeros */
 #define QCOW_OFLAG_ZERO (1ULL << 0)
 
+/* Extended L2 entries: a second 64-bit word with one "allocated" bit for
+ * each subcluster in bits 0-31, and one "reads as zeros" bit in bits 32-63.
+ * QCOW_OFLAG_ZERO is not used in such images. */
+#define QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER 32
+#define QCOW_OFLAG_SUB_ALLOC(X)   (1ULL << (X))
+#define QCOW_OFLAG_SUB_ZERO(X)    (QCOW_OFLAG_SUB_ALLOC(X) << 32)
+/* Subclusters [X, Y) */
+#define QCOW_OFLAG_SUB_ALLOC_RANGE(X, Y) \
+    (QCOW_OFLAG_SUB_ALLOC(Y) - QCOW_OFLAG_SUB_ALLOC(X))
+#define QCOW_OFLAG_SUB_ZERO_RANGE(X, Y) \
+    (QCOW_OFLAG_SUB_ALLOC_RANGE(X, Y) << 32)
+#define QCOW_L2_BITMAP_ALL_ALLOC \
+    QCOW_OFLAG_SUB_ALLOC_RANGE(0, QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER)
+#define QCOW_L2_BITMAP_ALL_ZEROES (QCOW_L2_BITMAP_ALL_ALLOC << 32)
+
+/* Subclusters must be at least one sector */
+#define MIN_EXTL2_CLUSTER_BITS 14
+
 #define MIN_CLUSTER_BITS 9
 #define MAX_CLUSTER_BITS 21
 
 /* Must be at least 2 to cover COW */
-#define MIN_L2_CACHE_SIZE 2 /* clusters */
+#define MIN_L2_CACHE_SIZE 2 /* cache entries */
 
 /* Must be at least 4 to cover all cases of refcount table growth */
 #define MIN_REFCOUNT_CACHE_SIZE 4 /* clusters */
@@ -83,6 +101,8 @@
 
 #define DEFAULT_CLUSTER_SIZE 65536
 
+#define QCOW2_MAX_ALLOC_EXTENT_SIZE (1 << 30) /* bytes */
+
 
 #define QCOW2_OPT_LAZY_REFCOUNTS "lazy-refcounts"
 #define QCOW2_OPT_DISCARD_REQUEST "pass-discard-request"
@@ -100,8 +120,11 @@
 #define QCOW2_OPT_OVERLAP_INACTIVE_L2 "overlap-check.inactive-l2"
 #define QCOW2_OPT_CACHE_SIZE "cache-size"
 #define QCOW2_OPT_L2_CACHE_SIZE "l2-cache-size"
+#define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_EXTENT_SIZE "alloc-extent-size"
+#define QCOW2_OPT_BITMAP_CHECKPOINT_INTERVAL "bitmap-checkpoint-interval"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -188,13 +211,22 @@ enum {
 
 /* Incompatible feature bits */
 enum {
-    QCOW2_INCOMPAT_DIRTY_BITNR   = 0,
-    QCOW2_INCOMPAT_CORRUPT_BITNR = 1,
-    QCOW2_INCOMPAT_DIRTY         = 1 << QCOW2_INCOMPAT_DIRTY_BITNR,
-    QCOW2_INCOMPAT_CORRUPT       = 1 << QCOW2_INCOMPAT_CORRUPT_BITNR,
-
-    QCOW2_INCOMPAT_MASK          = QCOW2_INCOMPAT_DIRTY
-                                 | QCOW2_INCOMPAT_CORRUPT,
+    QCOW2_INCOMPAT_DIRTY_BITNR       = 0,
+    QCOW2_INCOMPAT_CORRUPT_BITNR     = 1,
+    QCOW2_INCOMPAT_COMPRESSION_BITNR = 2,
+    QCOW2_INCOMPAT_EXTL2_BITNR       = 3,
+    QCOW2_INCOMPAT_DATA_FILE_BITNR   = 4,
+    QCOW2_INCOMPAT_DIRTY             = 1 << QCOW2_INCOMPAT_DIRTY_BITNR,
+    QCOW2_INCOMPAT_CORRUPT           = 1 << QCOW2_INCOMPAT_CORRUPT_BITNR,
+    QCOW2_INCOMPAT_COMPRESSION       = 1 << QCOW2_INCOMPAT_COMPRESSION_BITNR,
+    QCOW2_INCOMPAT_EXTL2             = 1 << QCOW2_INCOMPAT_EXTL2_BITNR,
+    QCOW2_INCOMPAT_DATA_FILE         = 1 << QCOW2_INCOMPAT_DATA_FILE_BITNR,
+
+    QCOW2_INCOMPAT_MASK              = QCOW2_INCOMPAT_DIRTY
+                                     | QCOW2_INCOMPAT_CORRUPT
+                                     | QCOW2_INCOMPAT_COMPRESSION
+                                     | QCOW2_INCOMPAT_EXTL2
+                                     | QCOW2_INCOMPAT_DATA_FILE,
 };
 
 /* Compatible feature bits */
@@ -235,11 +267,43 @@ typedef struct Qcow2DiscardRegion {
     QTAILQ_ENTRY(Qcow2DiscardRegion) next;
 } Qcow2DiscardRegion;
 
+/*
+ * Remembers which node of the backing chain holds the data for an
+ * unallocated cluster, so that reads need not fall through every layer
+ */
+#define QCOW2_BACKING_OWNERS 4096
+
+typedef struct Qcow2BackingOwner {
+    uint64_t cluster;
+    BdrvChild *child;
+    unsigned generation;
+} Qcow2BackingOwner;
+
 typedef uint64_t Qcow2GetRefcountFunc(const void *refcount_array,
                                       uint64_t index);
 typedef void Qcow2SetRefcountFunc(void *refcount_array,
                                   uint64_t index, uint64_t value);
 
+typedef struct QEMU_PACKED Qcow2CompressionTypeExt {
+    uint8_t compression_type;
+    uint8_t reserved[7];
+} Qcow2CompressionTypeExt;
+
+/* Number of decompressed clusters kept per image */
+#define QCOW2_COMPRESSED_CACHE_SIZE 16
+
+typedef struct Qcow2CompressedCacheEntry {
+    /* Host offset of the compressed data, -1 if the entry is unused */
+    uint64_t offset;
+    /* The decompressed cluster, allocated on first use */
+    uint8_t *data;
+    uint64_t lru_counter;
+    /* Being read and decompressed, without s->lock held */
+    bool loading;
+    /* A write happened while loading, drop the entry once loaded */
+    bool stale;
+} Qcow2CompressedCacheEntry;
+
 typedef struct Qcow2BitmapHeaderExt {
     uint32_t nb_bitmaps;
     uint32_t reserved32;
@@ -251,8 +315,14 @@ typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
     int cluster_sectors;
+    /* 1 unless the image has extended L2 entries */
+    int subclusters_per_cluster;
+    int subcluster_size;
+    int subcluster_bits;
     int l2_bits;
     int l2_size;
+    /* Number of L2 entries in each L2 cache entry */
+    int l2_slice_size;
     int l1_size;
     int l1_vm_state_index;
     int refcount_block_bits;
@@ -267,10 +337,14 @@ typedef struct BDRVQcow2State {
     Qcow2Cache* refcount_block_cache;
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
-
-    uint8_t *cluster_cache;
-    uint8_t *cluster_data;
-    uint64_t cluster_cache_offset;
+    QEMUTimer *bitmap_checkpoint_timer;
+    unsigned bitmap_checkpoint_interval;
+    bool bitmap_checkpoint_running;
+
+    Qcow2CompressedCacheEntry compressed_cache[QCOW2_COMPRESSED_CACHE_SIZE];
+    uint64_t compressed_cache_lru_counter;
+    /* Readers waiting for an entry to finish loading, or to become free */
+    CoQueue compressed_cache_queue;
     QLIST_HEAD(QCowClusterAlloc, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -282,6 +356,11 @@ typedef struct BDRVQcow2State {
 
     CoMutex lock;
 
+    /* Clusters being compressed in the thread pool, and requests waiting
+     * for one of the QCOW2_MAX_COMPRESS_THREADS slots */
+    int nb_compress_threads;
+    CoQueue compress_wait_queue;
+
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
     QCryptoBlock *crypto; /* Disk encryption format driver */
@@ -300,6 +379,12 @@ typedef struct BDRVQcow2State {
     int flags;
     int qcow_version;
     bool use_lazy_refcounts;
+
+    /* Host clusters allocated ahead of time, with their refcounts already on
+     * disk, that data cluster allocations are handed out from */
+    uint64_t alloc_extent_size;
+    uint64_t alloc_extent_offset;
+    uint64_t alloc_extent_bytes;
     int refcount_order;
     int refcount_bits;
     uint64_t refcount_max;
@@ -316,6 +401,10 @@ typedef struct BDRVQcow2State {
     uint64_t compatible_features;
     uint64_t autoclear_features;
 
+    /* Used for all the compressed clusters, anything but zlib comes with
+     * QCOW2_INCOMPAT_COMPRESSION */
+    Qcow2CompressionType compression_type;
+
     size_t unknown_header_fields_size;
     void* unknown_header_fields;
     QLIST_HEAD(, Qcow2UnknownHeaderExtension) unknown_header_ext;
@@ -327,6 +416,14 @@ typedef struct BDRVQcow2State {
      * override) */
     char *image_backing_file;
     char *image_backing_format;
+
+    /* External data file holding the guest data at identical offsets, and
+     * its name as stored in the image; only with QCOW2_INCOMPAT_DATA_FILE */
+    BdrvChild *data_file;
+    char *image_data_file;
+
+    /* Direct-mapped, allocated on first use; see bdrv_backing_generation() */
+    Qcow2BackingOwner *backing_owners;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -358,6 +455,12 @@ typedef struct QCowL2Meta
     /** Do not free the old clusters */
     bool keep_old_clusters;
 
+    /**
+     * The new clusters come from the allocation extent, so their refcounts
+     * need not be flushed before the L2 update
+     */
+    bool from_alloc_extent;
+
     /**
      * Requests that overlap with this allocation and wait to be restarted
      * when the allocating request has completed.
@@ -468,6 +571,60 @@ static inline int offset_to_l2_index(BDRVQcow2State *s, int64_t offset)
     return (offset >> s->cluster_bits) & (s->l2_size - 1);
 }
 
+static inline int offset_to_l2_slice_index(BDRVQcow2State *s, int64_t offset)
+{
+    return (offset >> s->cluster_bits) & (s->l2_slice_size - 1);
+}
+
+static inline bool has_subclusters(BDRVQcow2State *s)
+{
+    return s->incompatible_features & QCOW2_INCOMPAT_EXTL2;
+}
+
+static inline bool has_data_file(BDRVQcow2State *s)
+{
+    return s->incompatible_features & QCOW2_INCOMPAT_DATA_FILE;
+}
+
+/* Size of an L2 entry in bytes */
+static inline size_t l2_entry_size(BDRVQcow2State *s)
+{
+    return has_subclusters(s) ? 2 * sizeof(uint64_t) : sizeof(uint64_t);
+}
+
+static inline int offset_to_sc_index(BDRVQcow2State *s, int64_t offset)
+{
+    return offset_into_cluster(s, offset) >> s->subcluster_bits;
+}
+
+static inline uint64_t get_l2_entry(BDRVQcow2State *s, uint64_t *l2_table,
+                                    int idx)
+{
+    idx *= l2_entry_size(s) / sizeof(uint64_t);
+    return be64_to_cpu(l2_table[idx]);
+}
+
+static inline void set_l2_entry(BDRVQcow2State *s, uint64_t *l2_table,
+                                int idx, uint64_t entry)
+{
+    idx *= l2_entry_size(s) / sizeof(uint64_t);
+    l2_table[idx] = cpu_to_be64(entry);
+}
+
+static inline uint64_t get_l2_bitmap(BDRVQcow2State *s, uint64_t *l2_table,
+                                     int idx)
+{
+    assert(has_subclusters(s));
+    return be64_to_cpu(l2_table[2 * idx + 1]);
+}
+
+static inline void set_l2_bitmap(BDRVQcow2State *s, uint64_t *l2_table,
+                                 int idx, uint64_t bitmap)
+{
+    assert(has_subclusters(s));
+    l2_table[2 * idx + 1] = cpu_to_be64(bitmap);
+}
+
 static inline int64_t align_offset(int64_t offset, int n)
 {
     offset = (offset + n - 1) & ~(n - 1);
@@ -500,6 +657,26 @@ static inline QCow2ClusterType qcow2_get_cluster_type(uint64_t l2_entry)
     }
 }
 
+/*
+ * Like qcow2_get_cluster_type(), but for extended L2 entries a cluster
+ * whose subclusters all read as zeros is reported as a zero cluster.
+ */
+static inline QCow2ClusterType qcow2_get_l2_cluster_type(BDRVQcow2State *s,
+                                                         uint64_t *l2_table,
+                                                         int idx)
+{
+    uint64_t l2_entry = get_l2_entry(s, l2_table, idx);
+    QCow2ClusterType type = qcow2_get_cluster_type(l2_entry);
+
+    if (has_subclusters(s) && type != QCOW2_CLUSTER_COMPRESSED &&
+        (get_l2_bitmap(s, l2_table, idx) & QCOW_L2_BITMAP_ALL_ZEROES) ==
+        QCOW_L2_BITMAP_ALL_ZEROES) {
+        return type == QCOW2_CLUSTER_UNALLOCATED ? QCOW2_CLUSTER_ZERO_PLAIN
+                                                 : QCOW2_CLUSTER_ZERO_ALLOC;
+    }
+    return type;
+}
+
 /* Check whether refcounts are eager or lazy */
 static inline bool qcow2_need_accurate_refcounts(BDRVQcow2State *s)
 {
@@ -536,6 +713,7 @@ int qcow2_mark_dirty(BlockDriverState *bs);
 int qcow2_mark_corrupt(BlockDriverState *bs);
 int qcow2_mark_consistent(BlockDriverState *bs);
 int qcow2_update_header(BlockDriverState *bs);
+void qcow2_wait_bitmap_checkpoint(BlockDriverState *bs);
 
 void qcow2_signal_corruption(BlockDriverState *bs, bool fatal, int64_t offset,
                              int64_t size, const char *message_format, ...)
@@ -595,7 +773,13 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
                         bool exact_size);
 int qcow2_shrink_l1_table(BlockDriverState *bs, uint64_t max_size);
 int qcow2_write_l1_entry(BlockDriverState *bs, int l1_index);
-int qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset);
+void qcow2_compressed_cache_init(BDRVQcow2State *s);
+void qcow2_compressed_cache_invalidate(BDRVQcow2State *s);
+void qcow2_compressed_cache_free(BDRVQcow2State *s);
+int coroutine_fn qcow2_co_read_compressed(BlockDriverState *bs,
+                                          uint64_t cluster_offset,
+                                          int offset_in_cluster,
+                                          QEMUIOVector *qiov, size_t bytes);
 int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
                           uint8_t *buf, int nb_sectors, bool enc, Error **errp);
 
@@ -609,6 +793,7 @@ uint64_t qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs,
                                          int compressed_size);
 
 int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m);
+void qcow2_release_alloc_extent(BlockDriverState *bs);
 int qcow2_cluster_discard(BlockDriverState *bs, uint64_t offset,
                           uint64_t bytes, enum qcow2_discard_type type,
                           bool full_discard);
@@ -636,7 +821,8 @@ void qcow2_free_snapshots(BlockDriverState *bs);
 int qcow2_read_snapshots(BlockDriverState *bs);
 
 /* qcow2-cache.c functions */
-Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables);
+Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
+                               unsigned table_size);
 int qcow2_cache_destroy(BlockDriverState* bs, Qcow2Cache *c);
 
 void qcow2_cache_entry_mark_dirty(BlockDriverState *bs, Qcow2Cache *c,
@@ -666,6 +852,8 @@ int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
 bool qcow2_load_autoloading_dirty_bitmaps(BlockDriverState *bs, Error **errp);
 int qcow2_reopen_bitmaps_rw(BlockDriverState *bs, Error **errp);
 void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp);
+void coroutine_fn qcow2_checkpoint_persistent_dirty_bitmaps(
+    BlockDriverState *bs);
 int qcow2_reopen_bitmaps_ro(BlockDriverState *bs, Error **errp);
 bool qcow2_can_store_new_dirty_bitmap(BlockDriverState *bs,
                                       const char *name,
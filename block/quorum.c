@@ -239,6 +239,14 @@ static void quorum_copy_qiov(QEMUIOVector *dest, QEMUIOVector *source)
     }
 }
 
+/* Copy the result of child @i to the request, unless it was read in place */
+static void quorum_copy_read(QuorumAIOCB *acb, int i)
+{
+    if (acb->qcrs[i].buf) {
+        quorum_copy_qiov(acb->qiov, &acb->qcrs[i].qiov);
+    }
+}
+
 static void quorum_report_bad_acb(QuorumChildRequest *sacb, int ret)
 {
     QuorumAIOCB *acb = sacb->parent;
@@ -533,7 +541,7 @@ static void quorum_vote(QuorumAIOCB *acb)
 
     /* Every successful read agrees */
     if (quorum) {
-        quorum_copy_qiov(acb->qiov, &acb->qcrs[i].qiov);
+        quorum_copy_read(acb, i);
         return;
     }
 
@@ -562,7 +570,7 @@ static void quorum_vote(QuorumAIOCB *acb)
     }
 
     /* we have a winner: copy it */
-    quorum_copy_qiov(acb->qiov, &acb->qcrs[winner->index].qiov);
+    quorum_copy_read(acb, winner->index);
 
     /* some versions are bad print them */
     quorum_report_bad_versions(s, acb, &winner->value);
@@ -611,7 +619,19 @@ static int read_quorum_children(QuorumAIOCB *acb)
     int i, ret;
 
     acb->children_read = s->num_children;
-    for (i = 0; i < s->num_children; i++) {
+
+    /* The first child reads straight into the request, so that nothing has
+     * to be copied when all the children agree.  It is only overwritten
+     * after every child has completed, if another version wins the vote.
+     */
+    acb->qcrs[0].buf = NULL;
+    qemu_iovec_init(&acb->qcrs[0].qiov, acb->qiov->niov);
+    for (i = 0; i < acb->qiov->niov; i++) {
+        qemu_iovec_add(&acb->qcrs[0].qiov, acb->qiov->iov[i].iov_base,
+                       acb->qiov->iov[i].iov_len);
+    }
+
+    for (i = 1; i < s->num_children; i++) {
         acb->qcrs[i].buf = qemu_blockalign(s->children[i]->bs, acb->qiov->size);
         qemu_iovec_init(&acb->qcrs[i].qiov, acb->qiov->niov);
         qemu_iovec_clone(&acb->qcrs[i].qiov, acb->qiov, acb->qcrs[i].buf);
@@ -19,6 +19,8 @@
 #include "block/block_int.h"
 #include "crypto/secret.h"
 #include "qemu/cutils.h"
+#include "qemu/event_notifier.h"
+#include "qemu/atomic.h"
 #include "qapi/qmp/qstring.h"
 #include "qapi/qmp/qjson.h"
 
@@ -69,7 +71,8 @@ typedef enum {
     RBD_AIO_READ,
     RBD_AIO_WRITE,
     RBD_AIO_DISCARD,
-    RBD_AIO_FLUSH
+    RBD_AIO_FLUSH,
+    RBD_AIO_WRITE_ZEROES
 } RBDAIOCmd;
 
 typedef struct RBDAIOCB {
@@ -88,6 +91,7 @@ typedef struct RADOSCB {
     int64_t size;
     char *buf;
     int64_t ret;
+    QSLIST_ENTRY(RADOSCB) next;
 } RADOSCB;
 
 typedef struct BDRVRBDState {
@@ -96,6 +100,11 @@ typedef struct BDRVRBDState {
     rbd_image_t image;
     char *image_name;
     char *snap;
+
+    /* Requests completed by librbd threads, processed in our AioContext */
+    QSLIST_HEAD(, RADOSCB) completions;
+    EventNotifier completion_notifier;
+    bool completion_notified;
 } BDRVRBDState;
 
 static char *qemu_rbd_next_tok(char *src, char delim, char **p)
@@ -454,8 +463,8 @@ exit:
 }
 
 /*
- * This aio completion is being called from rbd_finish_bh() and runs in qemu
- * BH context.
+ * This aio completion is being called from qemu_rbd_process_completions() and
+ * runs in the AioContext of the BlockDriverState.
  */
 static void qemu_rbd_complete_aio(RADOSCB *rcb)
 {
@@ -500,6 +509,59 @@ static void qemu_rbd_complete_aio(RADOSCB *rcb)
     qemu_aio_unref(acb);
 }
 
+static bool qemu_rbd_process_completions(BDRVRBDState *s)
+{
+    QSLIST_HEAD(, RADOSCB) completions;
+    RADOSCB *rcb, *next;
+
+    /* Enable notifications for completions that we don't see below */
+    atomic_mb_set(&s->completion_notified, false);
+
+    QSLIST_MOVE_ATOMIC(&completions, &s->completions);
+    if (QSLIST_EMPTY(&completions)) {
+        return false;
+    }
+
+    QSLIST_FOREACH_SAFE(rcb, &completions, next, next) {
+        qemu_rbd_complete_aio(rcb);
+    }
+    return true;
+}
+
+static void qemu_rbd_completion_cb(EventNotifier *e)
+{
+    BDRVRBDState *s = container_of(e, BDRVRBDState, completion_notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        qemu_rbd_process_completions(s);
+    }
+}
+
+static bool qemu_rbd_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    BDRVRBDState *s = container_of(e, BDRVRBDState, completion_notifier);
+
+    return qemu_rbd_process_completions(s);
+}
+
+static void qemu_rbd_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    aio_set_event_notifier(bdrv_get_aio_context(bs), &s->completion_notifier,
+                           false, NULL, NULL);
+}
+
+static void qemu_rbd_attach_aio_context(BlockDriverState *bs,
+                                        AioContext *new_context)
+{
+    BDRVRBDState *s = bs->opaque;
+
+    aio_set_event_notifier(new_context, &s->completion_notifier, false,
+                           qemu_rbd_completion_cb, qemu_rbd_poll_cb);
+}
+
 static char *qemu_rbd_mon_host(QDict *options, Error **errp)
 {
     const char **vals = g_new(const char *, qdict_size(options) + 1);
@@ -662,6 +724,14 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
         goto failed_open;
     }
 
+    r = event_notifier_init(&s->completion_notifier, false);
+    if (r < 0) {
+        error_setg_errno(errp, -r, "failed to initialize event notifier");
+        goto failed_notifier;
+    }
+    QSLIST_INIT(&s->completions);
+    qemu_rbd_attach_aio_context(bs, bdrv_get_aio_context(bs));
+
     /* If we are using an rbd snapshot, we must be r/o, otherwise
      * leave as-is */
     if (s->snap != NULL) {
@@ -673,7 +743,7 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
             r = bdrv_set_read_only(bs, true, &local_err);
             if (r < 0) {
                 error_propagate(errp, local_err);
-                goto failed_open;
+                goto failed_ro;
             }
         }
     }
@@ -681,6 +751,11 @@ static int qemu_rbd_open(BlockDriverState *bs, QDict *options, int flags,
     qemu_opts_del(opts);
     return 0;
 
+failed_ro:
+    qemu_rbd_detach_aio_context(bs);
+    event_notifier_cleanup(&s->completion_notifier);
+failed_notifier:
+    rbd_close(s->image);
 failed_open:
     rados_ioctx_destroy(s->io_ctx);
 failed_shutdown:
@@ -718,6 +793,8 @@ static void qemu_rbd_close(BlockDriverState *bs)
 {
     BDRVRBDState *s = bs->opaque;
 
+    qemu_rbd_detach_aio_context(bs);
+    event_notifier_cleanup(&s->completion_notifier);
     rbd_close(s->image);
     rados_ioctx_destroy(s->io_ctx);
     g_free(s->snap);
@@ -729,29 +806,26 @@ static const AIOCBInfo rbd_aiocb_info = {
     .aiocb_size = sizeof(RBDAIOCB),
 };
 
-static void rbd_finish_bh(void *opaque)
-{
-    RADOSCB *rcb = opaque;
-    qemu_rbd_complete_aio(rcb);
-}
-
 /*
  * This is the callback function for rbd_aio_read and _write
  *
  * Note: this function is being called from a non qemu thread so
- * we need to be careful about what we do here. Generally we only
- * schedule a BH, and do the rest of the io completion handling
- * from rbd_finish_bh() which runs in a qemu context.
+ * we need to be careful about what we do here. We only queue the
+ * request and kick the event notifier, unless a kick is already pending,
+ * and do the rest of the io completion handling from
+ * qemu_rbd_process_completions() which runs in a qemu context.
  */
 static void rbd_finish_aiocb(rbd_completion_t c, RADOSCB *rcb)
 {
-    RBDAIOCB *acb = rcb->acb;
+    BDRVRBDState *s = rcb->s;
 
     rcb->ret = rbd_aio_get_return_value(c);
     rbd_aio_release(c);
 
-    aio_bh_schedule_oneshot(bdrv_get_aio_context(acb->common.bs),
-                            rbd_finish_bh, rcb);
+    QSLIST_INSERT_HEAD_ATOMIC(&s->completions, rcb, next);
+    if (!atomic_xchg(&s->completion_notified, true)) {
+        event_notifier_set(&s->completion_notifier);
+    }
 }
 
 static int rbd_aio_discard_wrapper(rbd_image_t image,
@@ -766,6 +840,21 @@ static int rbd_aio_discard_wrapper(rbd_image_t image,
 #endif
 }
 
+static int rbd_aio_write_zeroes_wrapper(rbd_image_t image,
+                                        uint64_t off,
+                                        uint64_t len,
+                                        rbd_completion_t comp)
+{
+#ifdef LIBRBD_SUPPORTS_WRITESAME
+    static char zero_sector[BDRV_SECTOR_SIZE];
+
+    return rbd_aio_writesame(image, off, len, zero_sector,
+                             sizeof(zero_sector), comp, 0);
+#else
+    return -ENOTSUP;
+#endif
+}
+
 static int rbd_aio_flush_wrapper(rbd_image_t image,
                                  rbd_completion_t comp)
 {
@@ -799,7 +888,8 @@ static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
     rcb = g_new(RADOSCB, 1);
 
     if (!LIBRBD_USE_IOVEC) {
-        if (cmd == RBD_AIO_DISCARD || cmd == RBD_AIO_FLUSH) {
+        if (cmd == RBD_AIO_DISCARD || cmd == RBD_AIO_FLUSH ||
+            cmd == RBD_AIO_WRITE_ZEROES) {
             acb->bounce = NULL;
         } else {
             acb->bounce = qemu_try_blockalign(bs, qiov->size);
@@ -846,6 +936,9 @@ static BlockAIOCB *rbd_start_aio(BlockDriverState *bs,
     case RBD_AIO_FLUSH:
         r = rbd_aio_flush_wrapper(s->image, c);
         break;
+    case RBD_AIO_WRITE_ZEROES:
+        r = rbd_aio_write_zeroes_wrapper(s->image, off, size, c);
+        break;
     default:
         r = -EINVAL;
     }
@@ -1087,6 +1180,44 @@ static BlockAIOCB *qemu_rbd_aio_pdiscard(BlockDriverState *bs,
 }
 #endif
 
+#ifdef LIBRBD_SUPPORTS_WRITESAME
+typedef struct RBDCoData {
+    Coroutine *co;
+    int ret;
+} RBDCoData;
+
+static void qemu_rbd_co_cb(void *opaque, int ret)
+{
+    RBDCoData *data = opaque;
+
+    data->ret = ret;
+    aio_co_wake(data->co);
+}
+
+/* librbd turns a write-same of zeroes into a discard where it can */
+static int coroutine_fn qemu_rbd_co_pwrite_zeroes(BlockDriverState *bs,
+                                                  int64_t offset, int bytes,
+                                                  BdrvRequestFlags flags)
+{
+    RBDCoData data = {
+        .co = qemu_coroutine_self(),
+    };
+
+    if (!QEMU_IS_ALIGNED(offset | bytes, BDRV_SECTOR_SIZE)) {
+        return -ENOTSUP;
+    }
+
+    if (!rbd_start_aio(bs, offset, NULL, bytes, qemu_rbd_co_cb, &data,
+                       RBD_AIO_WRITE_ZEROES)) {
+        return -EIO;
+    }
+
+    /* The request always completes from qemu_rbd_process_completions() */
+    qemu_coroutine_yield();
+    return data.ret;
+}
+#endif
+
 #ifdef LIBRBD_SUPPORTS_INVALIDATE
 static void qemu_rbd_invalidate_cache(BlockDriverState *bs,
                                       Error **errp)
@@ -1150,6 +1281,13 @@ static BlockDriver bdrv_rbd = {
     .bdrv_aio_pdiscard      = qemu_rbd_aio_pdiscard,
 #endif
 
+#ifdef LIBRBD_SUPPORTS_WRITESAME
+    .bdrv_co_pwrite_zeroes  = qemu_rbd_co_pwrite_zeroes,
+#endif
+
+    .bdrv_detach_aio_context = qemu_rbd_detach_aio_context,
+    .bdrv_attach_aio_context = qemu_rbd_attach_aio_context,
+
     .bdrv_snapshot_create   = qemu_rbd_snap_create,
     .bdrv_snapshot_delete   = qemu_rbd_snap_remove,
     .bdrv_snapshot_list     = qemu_rbd_snap_list,
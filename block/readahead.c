@@ -0,0 +1,471 @@
+/*
+ * Read-ahead filter driver
+ *
+ * Detects sequential read streams and prefetches the data that follows them
+ * into a bounded cache, so that protocols with a high round trip time (curl,
+ * nbd, ssh, ...) don't serve every small sequential guest read on its own.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "block/block_int.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/option.h"
+
+#define READAHEAD_OPT_WINDOW_MAX    "window-max"
+#define READAHEAD_OPT_CACHE_SIZE    "cache-size"
+
+/* The cache is managed in chunks of this size */
+#define READAHEAD_CHUNK_SIZE        (64 * 1024)
+
+/* Initial prefetch window once a sequential stream is detected */
+#define READAHEAD_WINDOW_MIN        (2 * READAHEAD_CHUNK_SIZE)
+
+#define READAHEAD_DEFAULT_WINDOW_MAX    (2 * 1024 * 1024)
+#define READAHEAD_DEFAULT_CACHE_SIZE    (16 * 1024 * 1024)
+
+typedef struct ReadaheadChunk {
+    int64_t offset;             /* -1 if the chunk is unused */
+    int64_t bytes;              /* less than a chunk only at the end */
+    uint64_t lru_counter;
+    uint8_t *buf;
+} ReadaheadChunk;
+
+typedef struct BDRVReadaheadState {
+    ReadaheadChunk *chunks;
+    int nb_chunks;
+    uint8_t *cache_buf;
+    uint64_t lru_counter;
+
+    uint64_t window_max;
+
+    /* Sequential stream detection */
+    int64_t next_offset;
+    uint64_t window;            /* 0 while reads aren't sequential */
+
+    /* Only a single prefetch is in flight at any time */
+    bool prefetch_running;
+    int64_t prefetch_offset;
+    int64_t prefetch_bytes;
+    CoQueue prefetch_queue;
+
+    /* Incremented by every write, so that stale prefetches are dropped */
+    uint64_t write_gen;
+} BDRVReadaheadState;
+
+static QemuOptsList readahead_opts = {
+    .name = "readahead",
+    .head = QTAILQ_HEAD_INITIALIZER(readahead_opts.head),
+    .desc = {
+        {
+            .name = READAHEAD_OPT_WINDOW_MAX,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum number of bytes prefetched at once",
+        },
+        {
+            .name = READAHEAD_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of the read-ahead cache",
+        },
+        { /* end of list */ }
+    },
+};
+
+static ReadaheadChunk *readahead_find_chunk(BDRVReadaheadState *s,
+                                            int64_t offset)
+{
+    int i;
+
+    for (i = 0; i < s->nb_chunks; i++) {
+        if (s->chunks[i].offset == offset) {
+            return &s->chunks[i];
+        }
+    }
+    return NULL;
+}
+
+/* Returns the chunk for @offset, evicting the least recently used one */
+static ReadaheadChunk *readahead_get_chunk(BDRVReadaheadState *s,
+                                           int64_t offset)
+{
+    ReadaheadChunk *chunk = readahead_find_chunk(s, offset);
+    int i;
+
+    if (chunk) {
+        return chunk;
+    }
+
+    chunk = &s->chunks[0];
+    for (i = 1; i < s->nb_chunks && chunk->offset >= 0; i++) {
+        if (s->chunks[i].offset < 0 ||
+            s->chunks[i].lru_counter < chunk->lru_counter) {
+            chunk = &s->chunks[i];
+        }
+    }
+    chunk->offset = offset;
+    return chunk;
+}
+
+static void readahead_invalidate(BDRVReadaheadState *s, int64_t offset,
+                                 int64_t bytes)
+{
+    int i;
+
+    s->write_gen++;
+    for (i = 0; i < s->nb_chunks; i++) {
+        ReadaheadChunk *chunk = &s->chunks[i];
+
+        if (chunk->offset >= 0 && chunk->offset < offset + bytes &&
+            offset < chunk->offset + chunk->bytes) {
+            chunk->offset = -1;
+        }
+    }
+}
+
+/*
+ * Copies the requested range into @qiov if all of it is cached.  Returns
+ * false (and leaves @qiov untouched) otherwise.
+ */
+static bool readahead_read_cache(BDRVReadaheadState *s, int64_t offset,
+                                 int64_t bytes, QEMUIOVector *qiov)
+{
+    int64_t end = offset + bytes;
+    int64_t pos;
+
+    for (pos = QEMU_ALIGN_DOWN(offset, READAHEAD_CHUNK_SIZE); pos < end;
+         pos += READAHEAD_CHUNK_SIZE)
+    {
+        ReadaheadChunk *chunk = readahead_find_chunk(s, pos);
+        int64_t needed = MIN(end, pos + READAHEAD_CHUNK_SIZE);
+
+        if (!chunk || chunk->offset + chunk->bytes < needed) {
+            return false;
+        }
+    }
+
+    for (pos = offset; pos < end; ) {
+        ReadaheadChunk *chunk =
+            readahead_find_chunk(s, QEMU_ALIGN_DOWN(pos, READAHEAD_CHUNK_SIZE));
+        int64_t len = MIN(end, chunk->offset + chunk->bytes) - pos;
+
+        qemu_iovec_from_buf(qiov, pos - offset,
+                            chunk->buf + (pos - chunk->offset), len);
+        chunk->lru_counter = ++s->lru_counter;
+        pos += len;
+    }
+
+    return true;
+}
+
+static bool readahead_prefetch_overlaps(BDRVReadaheadState *s, int64_t offset,
+                                        int64_t bytes)
+{
+    return s->prefetch_running &&
+           offset < s->prefetch_offset + s->prefetch_bytes &&
+           s->prefetch_offset < offset + bytes;
+}
+
+static void coroutine_fn readahead_co_prefetch(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVReadaheadState *s = bs->opaque;
+    int64_t offset = s->prefetch_offset;
+    int64_t bytes = s->prefetch_bytes;
+    uint64_t write_gen = s->write_gen;
+    QEMUIOVector qiov;
+    struct iovec iov;
+    int64_t pos;
+    int ret;
+
+    iov.iov_len = bytes;
+    iov.iov_base = qemu_try_blockalign(bs->file->bs, bytes);
+    if (!iov.iov_base) {
+        goto out;
+    }
+    qemu_iovec_init_external(&qiov, &iov, 1);
+
+    ret = bdrv_co_preadv(bs->file, offset, bytes, &qiov, 0);
+
+    /* Anything written in the meantime may or may not be in the buffer */
+    if (ret >= 0 && write_gen == s->write_gen) {
+        for (pos = offset; pos < offset + bytes;
+             pos += READAHEAD_CHUNK_SIZE)
+        {
+            ReadaheadChunk *chunk = readahead_get_chunk(s, pos);
+
+            chunk->bytes = MIN(READAHEAD_CHUNK_SIZE, offset + bytes - pos);
+            chunk->lru_counter = ++s->lru_counter;
+            memcpy(chunk->buf, (uint8_t *) iov.iov_base + (pos - offset),
+                   chunk->bytes);
+        }
+    }
+
+    qemu_vfree(iov.iov_base);
+out:
+    s->prefetch_running = false;
+    qemu_co_queue_restart_all(&s->prefetch_queue);
+    bdrv_dec_in_flight(bs);
+}
+
+/* Starts prefetching the current window of the stream from @offset */
+static void readahead_start_prefetch(BlockDriverState *bs, int64_t offset)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int64_t length, end;
+    Coroutine *co;
+
+    if (s->prefetch_running) {
+        return;
+    }
+
+    length = bdrv_getlength(bs->file->bs);
+    if (length < 0) {
+        return;
+    }
+
+    offset = QEMU_ALIGN_DOWN(offset, READAHEAD_CHUNK_SIZE);
+    end = MIN(offset + s->window, length);
+    while (offset < end && readahead_find_chunk(s, offset)) {
+        offset += READAHEAD_CHUNK_SIZE;
+    }
+    if (offset >= end) {
+        return;
+    }
+
+    s->prefetch_running = true;
+    s->prefetch_offset = offset;
+    s->prefetch_bytes = end - offset;
+    s->window = MIN(s->window * 2, s->window_max);
+
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(readahead_co_prefetch, bs);
+    bdrv_coroutine_enter(bs, co);
+}
+
+static int readahead_open(BlockDriverState *bs, QDict *options, int flags,
+                          Error **errp)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    Error *local_err = NULL;
+    QemuOpts *opts;
+    uint64_t cache_size;
+    int i, ret;
+
+    bs->file = bdrv_open_child(NULL, options, "file", bs, &child_file,
+                               false, errp);
+    if (!bs->file) {
+        return -EINVAL;
+    }
+
+    opts = qemu_opts_create(&readahead_opts, NULL, 0, &error_abort);
+    qemu_opts_absorb_qdict(opts, options, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    s->window_max = qemu_opt_get_size(opts, READAHEAD_OPT_WINDOW_MAX,
+                                      READAHEAD_DEFAULT_WINDOW_MAX);
+    cache_size = qemu_opt_get_size(opts, READAHEAD_OPT_CACHE_SIZE,
+                                   READAHEAD_DEFAULT_CACHE_SIZE);
+
+    if (s->window_max < READAHEAD_WINDOW_MIN ||
+        s->window_max % READAHEAD_CHUNK_SIZE) {
+        error_setg(errp, "window-max must be a multiple of %d and at least %d",
+                   READAHEAD_CHUNK_SIZE, READAHEAD_WINDOW_MIN);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    /* A prefetch must not evict the data the stream is currently reading */
+    if (cache_size < 2 * s->window_max || cache_size > INT_MAX) {
+        error_setg(errp, "cache-size must be at least twice window-max and "
+                   "less than 2 GB");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    s->nb_chunks = cache_size / READAHEAD_CHUNK_SIZE;
+    s->cache_buf = qemu_try_blockalign(bs->file->bs,
+                                       (size_t) s->nb_chunks *
+                                       READAHEAD_CHUNK_SIZE);
+    if (!s->cache_buf) {
+        error_setg(errp, "Could not allocate read-ahead cache");
+        ret = -ENOMEM;
+        goto fail;
+    }
+
+    s->chunks = g_new0(ReadaheadChunk, s->nb_chunks);
+    for (i = 0; i < s->nb_chunks; i++) {
+        s->chunks[i].offset = -1;
+        s->chunks[i].buf = s->cache_buf + (size_t) i * READAHEAD_CHUNK_SIZE;
+    }
+
+    s->next_offset = -1;
+    qemu_co_queue_init(&s->prefetch_queue);
+
+    bs->supported_write_flags = bs->file->bs->supported_write_flags;
+    bs->supported_zero_flags = bs->file->bs->supported_zero_flags;
+
+    ret = 0;
+fail:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void readahead_close(BlockDriverState *bs)
+{
+    BDRVReadaheadState *s = bs->opaque;
+
+    assert(!s->prefetch_running);
+    g_free(s->chunks);
+    qemu_vfree(s->cache_buf);
+}
+
+static int64_t readahead_getlength(BlockDriverState *bs)
+{
+    return bdrv_getlength(bs->file->bs);
+}
+
+static int coroutine_fn readahead_co_preadv(BlockDriverState *bs,
+                                            uint64_t offset, uint64_t bytes,
+                                            QEMUIOVector *qiov, int flags)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    if ((int64_t) offset == s->next_offset) {
+        s->window = MAX(s->window, READAHEAD_WINDOW_MIN);
+    } else {
+        s->window = 0;
+    }
+    s->next_offset = offset + bytes;
+
+    while (!readahead_read_cache(s, offset, bytes, qiov)) {
+        if (!readahead_prefetch_overlaps(s, offset, bytes)) {
+            ret = bdrv_co_preadv(bs->file, offset, bytes, qiov, flags);
+            if (ret < 0) {
+                return ret;
+            }
+            break;
+        }
+        qemu_co_queue_wait(&s->prefetch_queue, NULL);
+    }
+
+    if (s->window) {
+        readahead_start_prefetch(bs, offset + bytes);
+    }
+
+    return 0;
+}
+
+static int coroutine_fn readahead_co_pwritev(BlockDriverState *bs,
+                                             uint64_t offset, uint64_t bytes,
+                                             QEMUIOVector *qiov, int flags)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    readahead_invalidate(s, offset, bytes);
+    ret = bdrv_co_pwritev(bs->file, offset, bytes, qiov, flags);
+    /* Drop anything a concurrent prefetch may have cached meanwhile */
+    readahead_invalidate(s, offset, bytes);
+
+    return ret;
+}
+
+static int coroutine_fn readahead_co_pwrite_zeroes(BlockDriverState *bs,
+                                                   int64_t offset, int bytes,
+                                                   BdrvRequestFlags flags)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    readahead_invalidate(s, offset, bytes);
+    ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    readahead_invalidate(s, offset, bytes);
+
+    return ret;
+}
+
+static int coroutine_fn readahead_co_pdiscard(BlockDriverState *bs,
+                                              int64_t offset, int bytes)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    readahead_invalidate(s, offset, bytes);
+    ret = bdrv_co_pdiscard(bs->file->bs, offset, bytes);
+    readahead_invalidate(s, offset, bytes);
+
+    return ret;
+}
+
+static int readahead_co_flush(BlockDriverState *bs)
+{
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static void readahead_invalidate_cache(BlockDriverState *bs, Error **errp)
+{
+    BDRVReadaheadState *s = bs->opaque;
+
+    readahead_invalidate(s, 0, INT64_MAX);
+}
+
+static void readahead_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                 const BdrvChildRole *role,
+                                 BlockReopenQueue *reopen_queue,
+                                 uint64_t perm, uint64_t shared,
+                                 uint64_t *nperm, uint64_t *nshared)
+{
+    bdrv_filter_default_perms(bs, c, role, reopen_queue, perm, shared,
+                              nperm, nshared);
+
+    /* Writes by other parents would not invalidate the cache */
+    *nshared &= ~BLK_PERM_WRITE;
+}
+
+static bool readahead_recurse_is_first_non_filter(BlockDriverState *bs,
+                                                  BlockDriverState *candidate)
+{
+    return bdrv_recurse_is_first_non_filter(bs->file->bs, candidate);
+}
+
+static BlockDriver bdrv_readahead = {
+    .format_name                        = "readahead",
+    .protocol_name                      = "readahead",
+    .instance_size                      = sizeof(BDRVReadaheadState),
+
+    .bdrv_file_open                     = readahead_open,
+    .bdrv_close                         = readahead_close,
+    .bdrv_co_flush                      = readahead_co_flush,
+    .bdrv_invalidate_cache              = readahead_invalidate_cache,
+
+    .bdrv_child_perm                    = readahead_child_perm,
+
+    .bdrv_getlength                     = readahead_getlength,
+
+    .bdrv_co_preadv                     = readahead_co_preadv,
+    .bdrv_co_pwritev                    = readahead_co_pwritev,
+
+    .bdrv_co_pwrite_zeroes              = readahead_co_pwrite_zeroes,
+    .bdrv_co_pdiscard                   = readahead_co_pdiscard,
+
+    .bdrv_recurse_is_first_non_filter   = readahead_recurse_is_first_non_filter,
+    .bdrv_co_get_block_status           = bdrv_co_get_block_status_from_file,
+
+    .is_filter                          = true,
+};
+
+static void bdrv_readahead_init(void)
+{
+    bdrv_register(&bdrv_readahead);
+}
+
+block_init(bdrv_readahead_init);
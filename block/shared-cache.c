@@ -0,0 +1,476 @@
+/*
+ * Shared read cache filter driver
+ *
+ * Caches data read from a read-only node in memory that is shared between
+ * QEMU processes, so that many guests using the same backing image read
+ * each block from storage only once.  The memory is a file that every
+ * process maps, typically in /dev/shm, or a memfd passed in through an fd
+ * set (path=/dev/fdset/N).
+ *
+ * The cache is a set associative table of fixed size chunks.  Chunks are
+ * identified by a key derived from the image and by their offset.  Each
+ * slot is protected by a sequence lock, so readers never block; a writer
+ * claims a slot with a compare-and-swap of its sequence and gives up if
+ * another process is already writing it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "block/block_int.h"
+#include "qemu/atomic.h"
+#include "qemu/option.h"
+#include "qemu/seqlock.h"
+
+#define SHARED_CACHE_OPT_PATH       "path"
+#define SHARED_CACHE_OPT_SIZE       "size"
+#define SHARED_CACHE_OPT_IMAGE_ID   "image-id"
+
+#define SHARED_CACHE_MAGIC          0x51434843 /* "QCHC" */
+#define SHARED_CACHE_INITIALIZING   0xffffffff
+#define SHARED_CACHE_VERSION        1
+
+#define SHARED_CACHE_CHUNK_SIZE     (64 * 1024)
+#define SHARED_CACHE_WAYS           8
+#define SHARED_CACHE_DEFAULT_SIZE   (256 * 1024 * 1024)
+
+/* How long to wait for another process to initialise the cache */
+#define SHARED_CACHE_INIT_TIMEOUT_US    (5 * 1000 * 1000)
+
+typedef struct SharedCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t chunk_size;
+    uint32_t nb_slots;
+    uint64_t data_offset;
+} SharedCacheHeader;
+
+typedef struct SharedCacheSlot {
+    /*
+     * Writers make the sequence odd with a compare-and-swap.  A process that
+     * dies while writing leaves the slot unusable, which only costs space.
+     */
+    QemuSeqLock lock;
+    uint32_t bytes;
+    uint64_t key;
+    uint64_t offset;
+} SharedCacheSlot;
+
+typedef struct BDRVSharedCacheState {
+    int fd;
+    void *map;
+    size_t map_size;
+
+    SharedCacheHeader *header;
+    SharedCacheSlot *slots;
+    uint8_t *data;
+    uint32_t nb_sets;
+
+    /* Identifies the image in the shared cache */
+    uint64_t key;
+    /* Round robin eviction within a set */
+    unsigned next_way;
+} BDRVSharedCacheState;
+
+static QemuOptsList shared_cache_opts = {
+    .name = "shared-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(shared_cache_opts.head),
+    .desc = {
+        {
+            .name = SHARED_CACHE_OPT_PATH,
+            .type = QEMU_OPT_STRING,
+            .help = "File or fd set backing the shared memory",
+        },
+        {
+            .name = SHARED_CACHE_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of the shared memory, if it has to be created",
+        },
+        {
+            .name = SHARED_CACHE_OPT_IMAGE_ID,
+            .type = QEMU_OPT_STRING,
+            .help = "String that identifies the image contents",
+        },
+        { /* end of list */ }
+    },
+};
+
+/* FNV-1a */
+static uint64_t shared_cache_hash(uint64_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static SharedCacheSlot *shared_cache_set(BDRVSharedCacheState *s,
+                                         int64_t offset)
+{
+    uint64_t hash = shared_cache_hash(s->key, &offset, sizeof(offset));
+
+    return &s->slots[(hash % s->nb_sets) * SHARED_CACHE_WAYS];
+}
+
+static uint8_t *shared_cache_slot_data(BDRVSharedCacheState *s,
+                                       SharedCacheSlot *slot)
+{
+    return s->data + (size_t) (slot - s->slots) * SHARED_CACHE_CHUNK_SIZE;
+}
+
+/* Copies the chunk at @offset into @buf if it is cached */
+static bool shared_cache_lookup(BDRVSharedCacheState *s, int64_t offset,
+                                uint32_t bytes, uint8_t *buf)
+{
+    SharedCacheSlot *set = shared_cache_set(s, offset);
+    int i;
+
+    for (i = 0; i < SHARED_CACHE_WAYS; i++) {
+        SharedCacheSlot *slot = &set[i];
+        unsigned seq = seqlock_read_begin(&slot->lock);
+
+        if (slot->key != s->key || slot->offset != offset ||
+            slot->bytes != bytes) {
+            continue;
+        }
+
+        memcpy(buf, shared_cache_slot_data(s, slot), bytes);
+        if (!seqlock_read_retry(&slot->lock, seq)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void shared_cache_insert(BDRVSharedCacheState *s, int64_t offset,
+                                uint32_t bytes, const uint8_t *buf)
+{
+    SharedCacheSlot *set = shared_cache_set(s, offset);
+    SharedCacheSlot *slot = NULL;
+    unsigned seq;
+    int i;
+
+    for (i = 0; i < SHARED_CACHE_WAYS; i++) {
+        if (atomic_read(&set[i].lock.sequence) == 0) {
+            slot = &set[i];
+            break;
+        }
+    }
+    if (!slot) {
+        slot = &set[s->next_way++ % SHARED_CACHE_WAYS];
+    }
+
+    /* Leave the slot alone if somebody else is writing it */
+    seq = atomic_read(&slot->lock.sequence);
+    if ((seq & 1) ||
+        atomic_cmpxchg(&slot->lock.sequence, seq, seq + 1) != seq) {
+        return;
+    }
+
+    slot->key = s->key;
+    slot->offset = offset;
+    slot->bytes = bytes;
+    memcpy(shared_cache_slot_data(s, slot), buf, bytes);
+
+    seqlock_write_end(&slot->lock);
+}
+
+static int shared_cache_map(BDRVSharedCacheState *s, const char *path,
+                            uint64_t size, Error **errp)
+{
+    SharedCacheHeader *header;
+    struct stat st;
+    uint64_t nb_slots, data_offset;
+    int64_t waited;
+
+    s->fd = qemu_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (s->fd < 0) {
+        error_setg_errno(errp, errno, "Could not open '%s'", path);
+        return -errno;
+    }
+
+    if (fstat(s->fd, &st) < 0) {
+        error_setg_errno(errp, errno, "Could not stat '%s'", path);
+        return -errno;
+    }
+
+    if (st.st_size == 0) {
+        if (ftruncate(s->fd, size) < 0) {
+            error_setg_errno(errp, errno, "Could not resize '%s'", path);
+            return -errno;
+        }
+        st.st_size = size;
+    }
+
+    if (st.st_size < sizeof(*header) + SHARED_CACHE_WAYS *
+                     (sizeof(SharedCacheSlot) + SHARED_CACHE_CHUNK_SIZE)) {
+        error_setg(errp, "Shared cache '%s' is too small", path);
+        return -EINVAL;
+    }
+
+    s->map_size = st.st_size;
+    s->map = mmap(NULL, s->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  s->fd, 0);
+    if (s->map == MAP_FAILED) {
+        s->map = NULL;
+        error_setg_errno(errp, errno, "Could not map '%s'", path);
+        return -errno;
+    }
+    header = s->map;
+
+    /* The first process to get here lays out the (zeroed) memory */
+    if (atomic_cmpxchg(&header->magic, 0, SHARED_CACHE_INITIALIZING) == 0) {
+        nb_slots = (s->map_size - sizeof(*header)) /
+                   (sizeof(SharedCacheSlot) + SHARED_CACHE_CHUNK_SIZE);
+        nb_slots = QEMU_ALIGN_DOWN(MIN(nb_slots, UINT32_MAX),
+                                   SHARED_CACHE_WAYS);
+        data_offset = ROUND_UP(sizeof(*header) +
+                               nb_slots * sizeof(SharedCacheSlot),
+                               SHARED_CACHE_CHUNK_SIZE);
+        while (data_offset + nb_slots * SHARED_CACHE_CHUNK_SIZE >
+               s->map_size) {
+            nb_slots -= SHARED_CACHE_WAYS;
+        }
+
+        header->version = SHARED_CACHE_VERSION;
+        header->chunk_size = SHARED_CACHE_CHUNK_SIZE;
+        header->nb_slots = nb_slots;
+        header->data_offset = data_offset;
+        atomic_store_release(&header->magic, SHARED_CACHE_MAGIC);
+    }
+
+    for (waited = 0; atomic_load_acquire(&header->magic) != SHARED_CACHE_MAGIC;
+         waited += 1000)
+    {
+        if (header->magic != SHARED_CACHE_INITIALIZING ||
+            waited >= SHARED_CACHE_INIT_TIMEOUT_US) {
+            error_setg(errp, "'%s' is not a valid shared cache", path);
+            return -EINVAL;
+        }
+        g_usleep(1000);
+    }
+
+    if (header->version != SHARED_CACHE_VERSION ||
+        header->chunk_size != SHARED_CACHE_CHUNK_SIZE ||
+        header->nb_slots == 0 || header->nb_slots % SHARED_CACHE_WAYS ||
+        header->data_offset < sizeof(*header) +
+                              (uint64_t) header->nb_slots *
+                              sizeof(SharedCacheSlot) ||
+        header->data_offset + (uint64_t) header->nb_slots *
+                              SHARED_CACHE_CHUNK_SIZE > s->map_size)
+    {
+        error_setg(errp, "Shared cache '%s' has an incompatible layout", path);
+        return -EINVAL;
+    }
+
+    s->header = header;
+    s->slots = (SharedCacheSlot *) (header + 1);
+    s->data = (uint8_t *) s->map + header->data_offset;
+    s->nb_sets = header->nb_slots / SHARED_CACHE_WAYS;
+
+    return 0;
+}
+
+static void shared_cache_unmap(BDRVSharedCacheState *s)
+{
+    if (s->map) {
+        munmap(s->map, s->map_size);
+        s->map = NULL;
+    }
+    if (s->fd >= 0) {
+        qemu_close(s->fd);
+        s->fd = -1;
+    }
+}
+
+static int shared_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                             Error **errp)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+    Error *local_err = NULL;
+    QemuOpts *opts;
+    const char *path, *image_id;
+    uint64_t size;
+    int64_t length;
+    int ret;
+
+    s->fd = -1;
+
+    if (flags & BDRV_O_RDWR) {
+        error_setg(errp, "The shared-cache driver only supports read-only "
+                   "nodes");
+        return -EINVAL;
+    }
+
+    bs->file = bdrv_open_child(NULL, options, "file", bs, &child_file,
+                               false, errp);
+    if (!bs->file) {
+        return -EINVAL;
+    }
+
+    opts = qemu_opts_create(&shared_cache_opts, NULL, 0, &error_abort);
+    qemu_opts_absorb_qdict(opts, options, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    path = qemu_opt_get(opts, SHARED_CACHE_OPT_PATH);
+    if (!path) {
+        error_setg(errp, "Please specify the path of the shared cache");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    length = bdrv_getlength(bs->file->bs);
+    if (length < 0) {
+        error_setg_errno(errp, -length, "Could not get the image length");
+        ret = length;
+        goto fail;
+    }
+
+    /* The image length is part of the key so that resized images miss */
+    image_id = qemu_opt_get(opts, SHARED_CACHE_OPT_IMAGE_ID);
+    if (!image_id) {
+        image_id = bs->file->bs->filename;
+    }
+    s->key = shared_cache_hash(0xcbf29ce484222325ULL, image_id,
+                               strlen(image_id));
+    s->key = shared_cache_hash(s->key, &length, sizeof(length));
+
+    size = qemu_opt_get_size(opts, SHARED_CACHE_OPT_SIZE,
+                             SHARED_CACHE_DEFAULT_SIZE);
+    ret = shared_cache_map(s, path, size, errp);
+    if (ret < 0) {
+        shared_cache_unmap(s);
+        goto fail;
+    }
+
+    ret = 0;
+fail:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void shared_cache_close(BlockDriverState *bs)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+
+    shared_cache_unmap(s);
+}
+
+static int64_t shared_cache_getlength(BlockDriverState *bs)
+{
+    return bdrv_getlength(bs->file->bs);
+}
+
+static int coroutine_fn shared_cache_co_preadv(BlockDriverState *bs,
+                                               uint64_t offset, uint64_t bytes,
+                                               QEMUIOVector *qiov, int flags)
+{
+    BDRVSharedCacheState *s = bs->opaque;
+    int64_t end = offset + bytes;
+    int64_t length, pos;
+    QEMUIOVector chunk_qiov;
+    struct iovec iov;
+    uint8_t *buf;
+    int ret = 0;
+
+    length = bdrv_getlength(bs->file->bs);
+    if (length < 0) {
+        return length;
+    }
+
+    buf = qemu_try_blockalign(bs->file->bs, SHARED_CACHE_CHUNK_SIZE);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    for (pos = QEMU_ALIGN_DOWN(offset, SHARED_CACHE_CHUNK_SIZE); pos < end;
+         pos += SHARED_CACHE_CHUNK_SIZE)
+    {
+        uint32_t chunk_bytes = MIN(SHARED_CACHE_CHUNK_SIZE, length - pos);
+        int64_t start = MAX(pos, offset);
+
+        if (!shared_cache_lookup(s, pos, chunk_bytes, buf)) {
+            iov = (struct iovec) {
+                .iov_base   = buf,
+                .iov_len    = chunk_bytes,
+            };
+            qemu_iovec_init_external(&chunk_qiov, &iov, 1);
+
+            ret = bdrv_co_preadv(bs->file, pos, chunk_bytes, &chunk_qiov, 0);
+            if (ret < 0) {
+                break;
+            }
+            shared_cache_insert(s, pos, chunk_bytes, buf);
+        }
+
+        qemu_iovec_from_buf(qiov, start - offset, buf + (start - pos),
+                            MIN(end, pos + chunk_bytes) - start);
+    }
+
+    qemu_vfree(buf);
+    return ret < 0 ? ret : 0;
+}
+
+static int shared_cache_co_flush(BlockDriverState *bs)
+{
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static void shared_cache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                    const BdrvChildRole *role,
+                                    BlockReopenQueue *reopen_queue,
+                                    uint64_t perm, uint64_t shared,
+                                    uint64_t *nperm, uint64_t *nshared)
+{
+    bdrv_filter_default_perms(bs, c, role, reopen_queue, perm, shared,
+                              nperm, nshared);
+
+    /* Cached data stays valid only as long as nobody writes the image */
+    *nshared &= ~BLK_PERM_WRITE;
+}
+
+static bool shared_cache_recurse_is_first_non_filter(BlockDriverState *bs,
+                                                     BlockDriverState *cand)
+{
+    return bdrv_recurse_is_first_non_filter(bs->file->bs, cand);
+}
+
+static BlockDriver bdrv_shared_cache = {
+    .format_name                        = "shared-cache",
+    .protocol_name                      = "shared-cache",
+    .instance_size                      = sizeof(BDRVSharedCacheState),
+
+    .bdrv_file_open                     = shared_cache_open,
+    .bdrv_close                         = shared_cache_close,
+    .bdrv_co_flush                      = shared_cache_co_flush,
+
+    .bdrv_child_perm                    = shared_cache_child_perm,
+
+    .bdrv_getlength                     = shared_cache_getlength,
+
+    .bdrv_co_preadv                     = shared_cache_co_preadv,
+
+    .bdrv_recurse_is_first_non_filter   =
+        shared_cache_recurse_is_first_non_filter,
+    .bdrv_co_get_block_status           = bdrv_co_get_block_status_from_file,
+
+    .is_filter                          = true,
+};
+
+static void bdrv_shared_cache_init(void)
+{
+    bdrv_register(&bdrv_shared_cache);
+}
+
+block_init(bdrv_shared_cache_init);
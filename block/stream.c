@@ -27,6 +27,9 @@ enum {
      * contiguous regions of the image is efficient.
      */
     STREAM_BUFFER_SIZE = 512 * 1024, /* in bytes */
+
+    /* Number of populate requests that may be in flight at the same time */
+    STREAM_MAX_TASKS = 8,
 };
 
 #define SLICE_TIME 100000000ULL /* ns */
@@ -38,8 +41,21 @@ typedef struct StreamBlockJob {
     BlockdevOnError on_error;
     char *backing_file_str;
     int bs_flags;
+
+    int nb_tasks;
+    bool waiting_for_task;
+    /* First failed populate request, cleared when it has been handled */
+    int task_ret;
+    int64_t task_error_offset;
+    int64_t task_error_bytes;
 } StreamBlockJob;
 
+typedef struct StreamTask {
+    StreamBlockJob *s;
+    int64_t offset;
+    int64_t bytes;
+} StreamTask;
+
 static int coroutine_fn stream_populate(BlockBackend *blk,
                                         int64_t offset, uint64_t bytes,
                                         void *buf)
@@ -57,6 +73,75 @@ static int coroutine_fn stream_populate(BlockBackend *blk,
     return blk_co_preadv(blk, offset, qiov.size, &qiov, BDRV_REQ_COPY_ON_READ);
 }
 
+static void coroutine_fn stream_task_entry(void *opaque)
+{
+    StreamTask *task = opaque;
+    StreamBlockJob *s = task->s;
+    BlockBackend *blk = s->common.blk;
+    void *buf;
+    int ret;
+
+    buf = qemu_blockalign(blk_bs(blk), task->bytes);
+    ret = stream_populate(blk, task->offset, task->bytes, buf);
+    qemu_vfree(buf);
+
+    if (ret < 0) {
+        if (s->task_ret == 0 || task->offset < s->task_error_offset) {
+            s->task_ret = ret;
+            s->task_error_offset = task->offset;
+            s->task_error_bytes = task->bytes;
+        }
+    } else {
+        /* Publish progress */
+        s->common.offset += task->bytes;
+    }
+    g_free(task);
+
+    s->nb_tasks--;
+    if (s->waiting_for_task) {
+        s->waiting_for_task = false;
+        aio_co_wake(s->common.co);
+    }
+}
+
+/* Wait until one of the populate requests has finished */
+static void coroutine_fn stream_wait_for_task(StreamBlockJob *s)
+{
+    assert(s->nb_tasks > 0);
+    s->waiting_for_task = true;
+    qemu_coroutine_yield();
+    assert(!s->waiting_for_task);
+}
+
+static void coroutine_fn stream_wait_for_all_tasks(StreamBlockJob *s)
+{
+    while (s->nb_tasks > 0) {
+        stream_wait_for_task(s);
+    }
+}
+
+static void coroutine_fn stream_start_task(StreamBlockJob *s, int64_t offset,
+                                           int64_t bytes)
+{
+    StreamTask *task;
+    Coroutine *co;
+
+    while (s->nb_tasks >= STREAM_MAX_TASKS) {
+        stream_wait_for_task(s);
+    }
+
+    task = g_new(StreamTask, 1);
+    *task = (StreamTask) {
+        .s      = s,
+        .offset = offset,
+        .bytes  = bytes,
+    };
+
+    s->nb_tasks++;
+    co = qemu_coroutine_create(stream_task_entry, task);
+    qemu_coroutine_enter(co);
+}
+
 typedef struct {
     int ret;
 } StreamCompleteData;
@@ -112,7 +197,6 @@ static void coroutine_fn stream_run(void *opaque)
     int error = 0;
     int ret = 0;
     int64_t n = 0; /* bytes */
-    void *buf;
 
     if (!bs->backing) {
         goto out;
@@ -124,8 +208,6 @@ static void coroutine_fn stream_run(void *opaque)
         goto out;
     }
 
-    buf = qemu_blockalign(bs, STREAM_BUFFER_SIZE);
-
     /* Turn on copy-on-read for the whole block device so that guest read
      * requests help us make progress.  Only do this when copying the entire
      * backing chain since the copy-on-read operation does not take base into
@@ -135,7 +217,7 @@ static void coroutine_fn stream_run(void *opaque)
         bdrv_enable_copy_on_read(bs);
     }
 
-    for ( ; offset < s->common.len; offset += n) {
+    for ( ; ; offset += n) {
         bool copy;
 
         /* Note that even when no rate limit is applied we need to yield
@@ -146,9 +228,44 @@ static void coroutine_fn stream_run(void *opaque)
             break;
         }
 
+        n = 0;
+        if (s->task_ret < 0) {
+            BlockErrorAction action;
+
+            /* Let the other requests settle and handle the first failure */
+            stream_wait_for_all_tasks(s);
+            ret = s->task_ret;
+            s->task_ret = 0;
+
+            action = block_job_error_action(&s->common, s->on_error,
+                                            true, -ret);
+            if (action == BLOCK_ERROR_ACTION_STOP) {
+                /* Retry everything from the failed request on */
+                offset = s->task_error_offset;
+                continue;
+            }
+            if (error == 0) {
+                error = ret;
+            }
+            if (action == BLOCK_ERROR_ACTION_REPORT) {
+                break;
+            }
+            s->common.offset += s->task_error_bytes;
+            continue;
+        }
+
+        if (offset >= s->common.len) {
+            if (s->nb_tasks == 0) {
+                break;
+            }
+            stream_wait_for_task(s);
+            continue;
+        }
+
         copy = false;
 
-        ret = bdrv_is_allocated(bs, offset, STREAM_BUFFER_SIZE, &n);
+        /* Skip whole areas that are allocated in the top image at once */
+        ret = bdrv_is_allocated(bs, offset, s->common.len - offset, &n);
         if (ret == 1) {
             /* Allocated in the top, no need to copy.  */
         } else if (ret >= 0) {
@@ -164,9 +281,17 @@ static void coroutine_fn stream_run(void *opaque)
 
             copy = (ret == 1);
         }
+        if (copy) {
+            n = MIN(n, STREAM_BUFFER_SIZE);
+        }
         trace_stream_one_iteration(s, offset, n, ret);
         if (copy) {
-            ret = stream_populate(blk, offset, n, buf);
+            /* Progress is published when the request has completed */
+            stream_start_task(s, offset, n);
+            if (s->common.speed) {
+                delay_ns = ratelimit_calculate_delay(&s->limit, n);
+            }
+            continue;
         }
         if (ret < 0) {
             BlockErrorAction action =
@@ -186,11 +311,10 @@ static void coroutine_fn stream_run(void *opaque)
 
         /* Publish progress */
         s->common.offset += n;
-        if (copy && s->common.speed) {
-            delay_ns = ratelimit_calculate_delay(&s->limit, n);
-        }
     }
 
+    stream_wait_for_all_tasks(s);
+
     if (!base) {
         bdrv_disable_copy_on_read(bs);
     }
@@ -198,8 +322,6 @@ static void coroutine_fn stream_run(void *opaque)
     /* Do not remove the backing file if an error was there but ignored.  */
     ret = error;
 
-    qemu_vfree(buf);
-
 out:
     /* Modify backing chain and close BDSes in main loop */
     data = g_malloc(sizeof(*data));
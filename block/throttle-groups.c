@@ -60,7 +60,17 @@ static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * In order to keep the lock out of the I/O path while the group is not
+ * saturated, a ThrottleGroupMember whose request did not have to wait is
+ * granted some local credit: the I/O that the limits allow in
+ * THROTTLE_GROUP_CREDIT_NS is accounted in the group at once, and the
+ * following requests of the member consume that credit without locking.
+ * Any change to the configuration bumps 'generation', which invalidates
+ * all credit.
  */
+#define THROTTLE_GROUP_CREDIT_NS SCALE_MS
+
 typedef struct ThrottleGroup {
     Object parent_obj;
 
@@ -75,6 +85,9 @@ typedef struct ThrottleGroup {
     bool any_timer_armed[2];
     QEMUClockType clock_type;
 
+    /* Written under the lock, read with atomic operations */
+    unsigned generation;
+
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
 } ThrottleGroup;
@@ -338,6 +351,87 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
     }
 }
 
+/* Account a new batch of I/O in the group and make it available as local
+ * credit to a ThrottleGroupMember.  Nothing is granted if the limits are
+ * so low that the credit would not cover a couple of requests.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the ThrottleGroupMember
+ * @bytes:     the size of the current request
+ * @is_write:  the type of operation (read/write)
+ */
+static void throttle_group_grant_credit(ThrottleGroupMember *tgm,
+                                        unsigned int bytes, bool is_write)
+{
+    ThrottleState *ts = tgm->throttle_state;
+    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    uint64_t size, units;
+
+    throttle_get_budget(ts, is_write, THROTTLE_GROUP_CREDIT_NS,
+                        &size, &units);
+    if (size < 2 * (uint64_t) bytes || units < 2) {
+        return;
+    }
+
+    if (tgm->credit_generation != tg->generation) {
+        memset(tgm->credit_bytes, 0, sizeof(tgm->credit_bytes));
+        memset(tgm->credit_units, 0, sizeof(tgm->credit_units));
+        tgm->credit_generation = tg->generation;
+    }
+    tgm->credit_op_size = ts->cfg.op_size;
+
+    /* Unlimited dimensions need no accounting, and their credit never
+     * runs out */
+    throttle_account_units(ts, is_write, size == UINT64_MAX ? 0 : size,
+                           units == UINT64_MAX ? 0 : units);
+    if (size == UINT64_MAX) {
+        tgm->credit_bytes[is_write] = UINT64_MAX;
+    } else {
+        tgm->credit_bytes[is_write] += size;
+    }
+    if (units == UINT64_MAX) {
+        tgm->credit_units[is_write] = UINT64_MAX;
+    } else {
+        tgm->credit_units[is_write] += units;
+    }
+}
+
+/* Try to do an I/O request with the local credit of a ThrottleGroupMember,
+ * without taking the group lock.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @is_write:  the type of operation (read/write)
+ * @ret:       whether the request could use the credit
+ */
+static bool throttle_group_consume_credit(ThrottleGroupMember *tgm,
+                                          unsigned int bytes, bool is_write)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    double units;
+
+    if (tgm->credit_generation != atomic_read(&tg->generation)) {
+        return false;
+    }
+
+    /* Don't overtake requests of this member that are already queued.
+     * pending_reqs is only modified from our own AioContext. */
+    if (tgm->pending_reqs[is_write]) {
+        return false;
+    }
+
+    units = throttle_op_units(tgm->credit_op_size, bytes);
+    if (tgm->credit_bytes[is_write] < bytes ||
+        tgm->credit_units[is_write] < units) {
+        return false;
+    }
+
+    tgm->credit_bytes[is_write] -= bytes;
+    tgm->credit_units[is_write] -= units;
+    return true;
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
@@ -351,8 +445,15 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
                                                         bool is_write)
 {
     bool must_wait;
+    bool waited = false;
     ThrottleGroupMember *token;
     ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    /* Fast path: the I/O has been accounted already */
+    if (throttle_group_consume_credit(tgm, bytes, is_write)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -361,6 +462,7 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[is_write]) {
+        waited = true;
         tgm->pending_reqs[is_write]++;
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
@@ -374,6 +476,11 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* The I/O will be executed, so do the accounting */
     throttle_account(tgm->throttle_state, is_write, bytes);
 
+    /* The group is not saturated, let the next requests bypass the lock */
+    if (!waited && !tg->any_timer_armed[is_write]) {
+        throttle_group_grant_credit(tgm, bytes, is_write);
+    }
+
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
 
@@ -440,6 +547,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    atomic_set(&tg->generation, tg->generation + 1);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -533,6 +641,9 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     qemu_co_queue_init(&tgm->throttled_reqs[0]);
     qemu_co_queue_init(&tgm->throttled_reqs[1]);
 
+    /* Start without credit */
+    tgm->credit_generation = tg->generation - 1;
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -1527,8 +1527,10 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                 qemu_iovec_reset(&local_qiov);
                 qemu_iovec_concat(&local_qiov, qiov, bytes_done, n_bytes);
 
+                qemu_co_mutex_unlock(&s->lock);
                 ret = bdrv_co_preadv(bs->backing, offset, n_bytes,
                                      &local_qiov, 0);
+                qemu_co_mutex_lock(&s->lock);
                 if (ret < 0) {
                     goto fail;
                 }
@@ -1539,8 +1541,12 @@ vmdk_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             qemu_iovec_reset(&local_qiov);
             qemu_iovec_concat(&local_qiov, qiov, bytes_done, n_bytes);
 
+            /* Grains are never freed or moved, so once the grain table
+             * lookup is done the data can be read without the lock */
+            qemu_co_mutex_unlock(&s->lock);
             ret = vmdk_read_extent(extent, cluster_offset, offset_in_cluster,
                                    &local_qiov, n_bytes);
+            qemu_co_mutex_lock(&s->lock);
             if (ret) {
                 goto fail;
             }
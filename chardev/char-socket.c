@@ -27,6 +27,7 @@
 #include "io/channel-tls.h"
 #include "io/net-listener.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qapi/error.h"
 #include "qapi/clone-visitor.h"
 
@@ -142,6 +143,41 @@ static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
     }
 }
 
+static int tcp_chr_writev(Chardev *chr, const struct iovec *iov, int iovcnt)
+{
+    SocketChardev *s = SOCKET_CHARDEV(chr);
+    ssize_t ret;
+
+    if (!s->connected) {
+        return iov_size(iov, iovcnt);
+    }
+
+    ret = qio_channel_writev_full(s->ioc, iov, iovcnt,
+                                  s->write_msgfds, s->write_msgfds_num,
+                                  NULL);
+
+    /* free the written msgfds, no matter what */
+    if (s->write_msgfds_num) {
+        g_free(s->write_msgfds);
+        s->write_msgfds = 0;
+        s->write_msgfds_num = 0;
+    }
+
+    if (ret == QIO_CHANNEL_ERR_BLOCK) {
+        errno = EAGAIN;
+        return -1;
+    } else if (ret < 0) {
+        if (tcp_chr_read_poll(chr) <= 0) {
+            tcp_chr_disconnect(chr);
+            return iov_size(iov, iovcnt);
+        } /* else let the read handler finish it properly */
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ret;
+}
+
 static int tcp_chr_read_poll(void *opaque)
 {
     Chardev *chr = CHARDEV(opaque);
@@ -1065,6 +1101,7 @@ static void char_socket_class_init(ObjectClass *oc, void *data)
     cc->open = qmp_chardev_open_socket;
     cc->chr_wait_connected = tcp_chr_wait_connected;
     cc->chr_write = tcp_chr_write;
+    cc->chr_writev = tcp_chr_writev;
     cc->chr_sync_read = tcp_chr_sync_read;
     cc->chr_disconnect = tcp_chr_disconnect;
     cc->get_msgfds = tcp_get_msgfds;
@@ -153,6 +153,39 @@ int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
     return offset;
 }
 
+int qemu_chr_writev(Chardev *s, const struct iovec *iov, int iovcnt)
+{
+    ChardevClass *cc = CHARDEV_GET_CLASS(s);
+    int res, i, total = 0;
+
+    /* Record/replay works one buffer at a time */
+    if (!cc->chr_writev || qemu_chr_replay(s)) {
+        for (i = 0; i < iovcnt; i++) {
+            res = qemu_chr_write(s, iov[i].iov_base, iov[i].iov_len, false);
+            if (res < 0) {
+                return total ? total : res;
+            }
+            total += res;
+            if (res < iov[i].iov_len) {
+                break;
+            }
+        }
+        return total;
+    }
+
+    qemu_mutex_lock(&s->chr_write_lock);
+    res = cc->chr_writev(s, iov, iovcnt);
+    for (i = 0; i < iovcnt && total < res; i++) {
+        int len = MIN(iov[i].iov_len, res - total);
+
+        qemu_chr_write_log(s, iov[i].iov_base, len);
+        total += len;
+    }
+    qemu_mutex_unlock(&s->chr_write_lock);
+
+    return res;
+}
+
 int qemu_chr_be_can_write(Chardev *s)
 {
     CharBackend *be = s->be;
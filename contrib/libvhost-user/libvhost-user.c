@@ -22,6 +22,8 @@
 #include <string.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/eventfd.h>
@@ -326,6 +328,141 @@ vu_kick_cb(VuDev *dev, int condition, void *data)
     }
 }
 
+static int64_t
+vu_clock_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void
+vu_queue_worker_run(VuDev *dev, VuVirtq *vq)
+{
+    int qidx = vq - dev->vq;
+    unsigned int poll_us = atomic_read(&vq->worker.busy_poll_us);
+    int64_t deadline;
+
+    vq->handler(dev, qidx);
+    if (!poll_us) {
+        return;
+    }
+
+    /* The guest need not kick while we are watching the avail ring */
+    vu_queue_set_notification(dev, vq, 0);
+    deadline = vu_clock_us() + poll_us;
+    while (!atomic_read(&vq->worker.stop) && vu_clock_us() < deadline) {
+        if (!vu_queue_empty(dev, vq)) {
+            vq->handler(dev, qidx);
+            deadline = vu_clock_us() + poll_us;
+        }
+    }
+    vu_queue_set_notification(dev, vq, 1);
+
+    /* Catch buffers added before notifications were enabled again */
+    if (!vu_queue_empty(dev, vq)) {
+        vq->handler(dev, qidx);
+    }
+}
+
+static void *
+vu_queue_worker(void *opaque)
+{
+    VuVirtq *vq = opaque;
+    VuDev *dev = vq->worker.dev;
+    struct pollfd fds[2] = {
+        { .fd = vq->kick_fd, .events = POLLIN },
+        { .fd = vq->worker.wake_fd, .events = POLLIN },
+    };
+    eventfd_t kick_data;
+
+    while (!atomic_read(&vq->worker.stop)) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            vu_panic(dev, "worker poll(): %s", strerror(errno));
+            break;
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+        if (eventfd_read(vq->kick_fd, &kick_data) < 0) {
+            vu_panic(dev, "kick eventfd_read(): %s", strerror(errno));
+            break;
+        }
+        vu_queue_worker_run(dev, vq);
+    }
+
+    return NULL;
+}
+
+static void
+vu_queue_start_worker(VuDev *dev, VuVirtq *vq)
+{
+    int rc;
+
+    if (vq->worker.running || !vq->worker.enabled ||
+        !vq->handler || vq->kick_fd == -1) {
+        return;
+    }
+
+    vq->worker.wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (vq->worker.wake_fd == -1) {
+        vu_panic(dev, "worker eventfd(): %s", strerror(errno));
+        return;
+    }
+
+    vq->worker.dev = dev;
+    vq->worker.stop = false;
+    rc = pthread_create(&vq->worker.thread, NULL, vu_queue_worker, vq);
+    if (rc) {
+        close(vq->worker.wake_fd);
+        vq->worker.wake_fd = -1;
+        vu_panic(dev, "pthread_create(): %s", strerror(rc));
+        return;
+    }
+    vq->worker.running = true;
+}
+
+static void
+vu_queue_stop_worker(VuDev *dev, VuVirtq *vq)
+{
+    if (!vq->worker.running) {
+        return;
+    }
+
+    atomic_set(&vq->worker.stop, true);
+    if (eventfd_write(vq->worker.wake_fd, 1) < 0) {
+        vu_panic(dev, "worker eventfd_write(): %s", strerror(errno));
+    }
+    pthread_join(vq->worker.thread, NULL);
+    close(vq->worker.wake_fd);
+    vq->worker.wake_fd = -1;
+    vq->worker.running = false;
+}
+
+static void
+vu_start_workers(VuDev *dev)
+{
+    int i;
+
+    for (i = 0; i < VHOST_MAX_NR_VIRTQUEUE; i++) {
+        vu_queue_start_worker(dev, &dev->vq[i]);
+    }
+}
+
+static void
+vu_stop_workers(VuDev *dev)
+{
+    int i;
+
+    for (i = 0; i < VHOST_MAX_NR_VIRTQUEUE; i++) {
+        vu_queue_stop_worker(dev, &dev->vq[i]);
+    }
+}
+
 static bool
 vu_get_features_exec(VuDev *dev, VhostUserMsg *vmsg)
 {
@@ -650,7 +787,8 @@ vu_set_vring_kick_exec(VuDev *dev, VhostUserMsg *vmsg)
         dev->iface->queue_set_started(dev, index, true);
     }
 
-    if (dev->vq[index].kick_fd != -1 && dev->vq[index].handler) {
+    if (dev->vq[index].kick_fd != -1 && dev->vq[index].handler &&
+        !dev->vq[index].worker.enabled) {
         dev->set_watch(dev, dev->vq[index].kick_fd, VU_WATCH_IN,
                        vu_kick_cb, (void *)(long)index);
 
@@ -666,15 +804,39 @@ void vu_set_queue_handler(VuDev *dev, VuVirtq *vq,
 {
     int qidx = vq - dev->vq;
 
+    vu_queue_stop_worker(dev, vq);
     vq->handler = handler;
     if (vq->kick_fd >= 0) {
-        if (handler) {
+        if (handler && !vq->worker.enabled) {
             dev->set_watch(dev, vq->kick_fd, VU_WATCH_IN,
                            vu_kick_cb, (void *)(long)qidx);
         } else {
             dev->remove_watch(dev, vq->kick_fd);
         }
     }
+    vu_queue_start_worker(dev, vq);
+}
+
+void vu_queue_set_worker(VuDev *dev, VuVirtq *vq, bool enable)
+{
+    int qidx = vq - dev->vq;
+
+    vu_queue_stop_worker(dev, vq);
+    vq->worker.enabled = enable;
+    if (vq->kick_fd >= 0 && vq->handler) {
+        if (enable) {
+            dev->remove_watch(dev, vq->kick_fd);
+        } else {
+            dev->set_watch(dev, vq->kick_fd, VU_WATCH_IN,
+                           vu_kick_cb, (void *)(long)qidx);
+        }
+    }
+    vu_queue_start_worker(dev, vq);
+}
+
+void vu_queue_set_busy_poll(VuDev *dev, VuVirtq *vq, unsigned int poll_us)
+{
+    atomic_set(&vq->worker.busy_poll_us, poll_us);
 }
 
 static bool
@@ -925,7 +1087,10 @@ vu_dispatch(VuDev *dev)
         goto end;
     }
 
+    /* Messages may change the rings, the memory table or the fds */
+    vu_stop_workers(dev);
     reply_requested = vu_process_message(dev, &vmsg);
+    vu_start_workers(dev);
     if (!reply_requested) {
         success = true;
         goto end;
@@ -947,6 +1112,7 @@ vu_deinit(VuDev *dev)
 {
     int i;
 
+    vu_stop_workers(dev);
     for (i = 0; i < dev->nregions; i++) {
         VuDevRegion *r = &dev->regions[i];
         void *m = (void *) (uintptr_t) r->mmap_addr;
@@ -1016,6 +1182,7 @@ vu_init(VuDev *dev,
         dev->vq[i] = (VuVirtq) {
             .call_fd = -1, .kick_fd = -1, .err_fd = -1,
             .notification = true,
+            .worker.wake_fd = -1,
         };
     }
 }
@@ -17,6 +17,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <pthread.h>
 #include <sys/poll.h>
 #include <linux/vhost.h>
 #include "standard-headers/linux/virtio_ring.h"
@@ -208,6 +209,18 @@ typedef struct VuRing {
     uint32_t flags;
 } VuRing;
 
+/* A thread that waits for the kicks of one queue and runs its handler */
+typedef struct VuVirtqWorker {
+    VuDev *dev;
+    pthread_t thread;
+    int wake_fd;
+    bool enabled;
+    bool running;
+    bool stop;
+    /* How long to keep polling the avail ring once it is empty */
+    unsigned int busy_poll_us;
+} VuVirtqWorker;
+
 typedef struct VuVirtq {
     VuRing vring;
 
@@ -237,6 +250,8 @@ typedef struct VuVirtq {
     int err_fd;
     unsigned int enable;
     bool started;
+
+    VuVirtqWorker worker;
 } VuVirtq;
 
 enum VuWatchCondtion {
@@ -356,6 +371,38 @@ void vu_set_queue_handler(VuDev *dev, VuVirtq *vq,
                           vu_queue_handler_cb handler);
 
 
+/**
+ * vu_queue_set_worker:
+ * @dev: a VuDev context
+ * @vq: a VuVirtq queue
+ * @enable: whether to use a worker thread
+ *
+ * Run the queue handler in a thread of its own, which polls the kick
+ * eventfd, instead of through the set_watch callback.  Handlers of
+ * different queues then run concurrently with each other and with the
+ * caller's loop; a handler must only use its own queue, and the panic
+ * callback may be called from its thread.  The libvhost-user functions
+ * for a queue need no locking as long as they are called from its worker,
+ * and the dirty log is updated atomically.
+ *
+ * The workers are stopped while vu_dispatch() processes a message, and
+ * restarted afterwards for the queues that have a kick fd and a handler.
+ * This must not be called from a queue handler.
+ */
+void vu_queue_set_worker(VuDev *dev, VuVirtq *vq, bool enable);
+
+/**
+ * vu_queue_set_busy_poll:
+ * @dev: a VuDev context
+ * @vq: a VuVirtq queue
+ * @poll_us: time in microseconds
+ *
+ * Let the worker thread of the queue keep polling the avail ring, with
+ * guest notifications suppressed, for up to @poll_us after its handler
+ * returned.  This trades CPU time for lower latency; 0 disables it.
+ */
+void vu_queue_set_busy_poll(VuDev *dev, VuVirtq *vq, unsigned int poll_us);
+
 /**
  * vu_queue_set_notification:
  * @dev: a VuDev context
@@ -21,11 +21,36 @@
 #include "contrib/libvhost-user/libvhost-user.h"
 
 #include <glib.h>
+#include <sys/eventfd.h>
+#ifdef CONFIG_LINUX_AIO
+#include <libaio.h>
+#endif
+
+/* Requests in flight per queue with Linux AIO */
+#define VUB_AIO_MAX_EVENTS 128
 
 struct virtio_blk_inhdr {
     unsigned char status;
 };
 
+struct VubDev;
+
+typedef struct VubQueue {
+    struct VubDev *vdev_blk;
+    VuVirtq *vq;
+    /*
+     * Protects the virtqueue: requests are popped from the queue handler,
+     * which may run in a worker thread, and with Linux AIO they complete
+     * in the main loop.
+     */
+    pthread_mutex_t lock;
+#ifdef CONFIG_LINUX_AIO
+    io_context_t aio_ctx;
+    int aio_efd;
+    unsigned int aio_inflight;
+#endif
+} VubQueue;
+
 /* vhost user block device */
 typedef struct VubDev {
     VugDev parent;
@@ -33,6 +58,11 @@ typedef struct VubDev {
     struct virtio_blk_config blkcfg;
     char *blk_name;
     GMainLoop *loop;
+    bool threaded;
+    bool use_aio;
+    unsigned int poll_us;
+    int num_queues;
+    VubQueue queues[VHOST_MAX_NR_VIRTQUEUE];
 } VubDev;
 
 typedef struct VubReq {
@@ -43,6 +73,9 @@ typedef struct VubReq {
     struct virtio_blk_outhdr *out;
     VubDev *vdev_blk;
     struct VuVirtq *vq;
+#ifdef CONFIG_LINUX_AIO
+    struct iocb iocb;
+#endif
 } VubReq;
 
 /* refer util/iov.c */
@@ -165,9 +198,90 @@ vub_flush(VubReq *req)
     fdatasync(vdev_blk->blk_fd);
 }
 
-static int vub_virtio_process_req(VubDev *vdev_blk,
-                                     VuVirtq *vq)
+#ifdef CONFIG_LINUX_AIO
+static bool
+vub_aio_prepare(VubQueue *q, VubReq *req, bool is_write,
+                struct iovec *iov, uint32_t iovcnt)
+{
+    VubDev *vdev_blk = q->vdev_blk;
+
+    if (!iovcnt) {
+        fprintf(stderr, "Invalid %s IOV count\n", is_write ? "Write" : "Read");
+        return false;
+    }
+
+    req->size = vub_iov_size(iov, iovcnt);
+    if (is_write) {
+        io_prep_pwritev(&req->iocb, vdev_blk->blk_fd, iov, iovcnt,
+                        req->sector_num * 512);
+    } else {
+        io_prep_preadv(&req->iocb, vdev_blk->blk_fd, iov, iovcnt,
+                       req->sector_num * 512);
+    }
+    io_set_eventfd(&req->iocb, q->aio_efd);
+    req->iocb.data = req;
+    return true;
+}
+
+static void
+vub_aio_submit(VubQueue *q, VubReq **reqs, int nreqs)
+{
+    struct iocb *iocbs[VUB_AIO_MAX_EVENTS];
+    int i, ret;
+
+    for (i = 0; i < nreqs; i++) {
+        iocbs[i] = &reqs[i]->iocb;
+    }
+
+    ret = io_submit(q->aio_ctx, nreqs, iocbs);
+    if (ret < 0) {
+        fprintf(stderr, "%s, io_submit failed with %s\n",
+                q->vdev_blk->blk_name, strerror(-ret));
+        ret = 0;
+    }
+    q->aio_inflight += ret;
+
+    for (i = ret; i < nreqs; i++) {
+        reqs[i]->in->status = VIRTIO_BLK_S_IOERR;
+        vub_req_complete(reqs[i]);
+    }
+}
+
+/* Complete at least @min_nr requests that are done */
+static void
+vub_aio_reap(VubQueue *q, int min_nr)
+{
+    struct io_event events[VUB_AIO_MAX_EVENTS];
+    int i, ret;
+
+    ret = io_getevents(q->aio_ctx, min_nr, VUB_AIO_MAX_EVENTS, events, NULL);
+    if (ret < 0) {
+        fprintf(stderr, "%s, io_getevents failed with %s\n",
+                q->vdev_blk->blk_name, strerror(-ret));
+        return;
+    }
+
+    for (i = 0; i < ret; i++) {
+        VubReq *req = events[i].data;
+
+        if ((long)events[i].res == (long)req->size) {
+            req->in->status = VIRTIO_BLK_S_OK;
+        } else {
+            fprintf(stderr, "%s, Sector %"PRIu64", Size %lu failed with %ld\n",
+                    q->vdev_blk->blk_name, req->sector_num, req->size,
+                    (long)events[i].res);
+            req->in->status = VIRTIO_BLK_S_IOERR;
+        }
+        vub_req_complete(req);
+    }
+    q->aio_inflight -= ret;
+}
+#endif
+
+static int vub_virtio_process_req(VubQueue *q, VubReq **batch, int *nbatch)
 {
+    VubDev *vdev_blk = q->vdev_blk;
+    VuVirtq *vq = q->vq;
     VugDev *gdev = &vdev_blk->parent;
     VuDev *vu_dev = &gdev->parent;
     VuVirtqElement *elem;
@@ -217,6 +331,21 @@ static int vub_virtio_process_req(VubDev *vdev_blk,
             ssize_t ret = 0;
             bool is_write = type & VIRTIO_BLK_T_OUT;
             req->sector_num = le64toh(req->out->sector);
+#ifdef CONFIG_LINUX_AIO
+            if (q->aio_ctx) {
+                struct iovec *iov = is_write ? &elem->out_sg[1]
+                                             : &elem->in_sg[0];
+                uint32_t iovcnt = is_write ? out_num : in_num;
+
+                if (vub_aio_prepare(q, req, is_write, iov, iovcnt)) {
+                    batch[(*nbatch)++] = req;
+                } else {
+                    req->in->status = VIRTIO_BLK_S_IOERR;
+                    vub_req_complete(req);
+                }
+                break;
+            }
+#endif
             if (is_write) {
                 ret  = vub_writev(req, &elem->out_sg[1], out_num);
             } else {
@@ -260,12 +389,103 @@ err:
     return -1;
 }
 
+/* Process the requests on the queue, called with q->lock held */
+static void vub_process_queue(VubQueue *q)
+{
+    VubReq *batch[VUB_AIO_MAX_EVENTS];
+    int nbatch = 0;
+    int room = VUB_AIO_MAX_EVENTS;
+
+#ifdef CONFIG_LINUX_AIO
+    /* Leave the rest on the ring until requests in flight complete */
+    room -= q->aio_inflight;
+#endif
+    while (nbatch < room) {
+        if (vub_virtio_process_req(q, batch, &nbatch)) {
+            break;
+        }
+    }
+
+#ifdef CONFIG_LINUX_AIO
+    if (nbatch) {
+        vub_aio_submit(q, batch, nbatch);
+    }
+#endif
+}
+
+#ifdef CONFIG_LINUX_AIO
+static void vub_aio_complete_cb(VuDev *vu_dev, int condition, void *data)
+{
+    VubQueue *q = data;
+    eventfd_t n;
+
+    if (eventfd_read(q->aio_efd, &n) < 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    vub_aio_reap(q, 0);
+    if (vu_queue_started(vu_dev, q->vq)) {
+        vub_process_queue(q);
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void vub_aio_start(VuDev *vu_dev, VubQueue *q)
+{
+    int ret;
+
+    if (q->aio_ctx) {
+        return;
+    }
+
+    q->aio_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->aio_efd < 0) {
+        fprintf(stderr, "eventfd failed with %s, using synchronous I/O\n",
+                strerror(errno));
+        return;
+    }
+
+    ret = io_setup(VUB_AIO_MAX_EVENTS, &q->aio_ctx);
+    if (ret < 0) {
+        fprintf(stderr, "io_setup failed with %s, using synchronous I/O\n",
+                strerror(-ret));
+        close(q->aio_efd);
+        q->aio_efd = -1;
+        q->aio_ctx = 0;
+        return;
+    }
+
+    vu_dev->set_watch(vu_dev, q->aio_efd, VU_WATCH_IN,
+                      vub_aio_complete_cb, q);
+}
+
+/* Wait for the requests in flight, the queue is being stopped */
+static void vub_aio_stop(VuDev *vu_dev, VubQueue *q)
+{
+    if (!q->aio_ctx) {
+        return;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    while (q->aio_inflight) {
+        vub_aio_reap(q, 1);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    vu_dev->remove_watch(vu_dev, q->aio_efd);
+    close(q->aio_efd);
+    q->aio_efd = -1;
+    io_destroy(q->aio_ctx);
+    q->aio_ctx = 0;
+}
+#endif
+
 static void vub_process_vq(VuDev *vu_dev, int idx)
 {
     VugDev *gdev;
     VubDev *vdev_blk;
-    VuVirtq *vq;
-    int ret;
+    VubQueue *q;
 
     if ((idx < 0) || (idx >= VHOST_MAX_NR_VIRTQUEUE)) {
         fprintf(stderr, "VQ Index out of range: %d\n", idx);
@@ -277,31 +497,53 @@ static void vub_process_vq(VuDev *vu_dev, int idx)
     vdev_blk = container_of(gdev, VubDev, parent);
     assert(vdev_blk);
 
-    vq = vu_get_queue(vu_dev, idx);
-    assert(vq);
-
-    while (1) {
-        ret = vub_virtio_process_req(vdev_blk, vq);
-        if (ret) {
-            break;
-        }
-    }
+    q = &vdev_blk->queues[idx];
+    pthread_mutex_lock(&q->lock);
+    vub_process_queue(q);
+    pthread_mutex_unlock(&q->lock);
 }
 
 static void vub_queue_set_started(VuDev *vu_dev, int idx, bool started)
 {
+    VugDev *gdev;
+    VubDev *vdev_blk;
     VuVirtq *vq;
 
     assert(vu_dev);
 
+    gdev = container_of(vu_dev, VugDev, parent);
+    vdev_blk = container_of(gdev, VubDev, parent);
     vq = vu_get_queue(vu_dev, idx);
+    vdev_blk->queues[idx].vq = vq;
+
+#ifdef CONFIG_LINUX_AIO
+    if (started && vdev_blk->use_aio) {
+        vub_aio_start(vu_dev, &vdev_blk->queues[idx]);
+    }
+#endif
+    vu_queue_set_worker(vu_dev, vq, vdev_blk->threaded);
+    vu_queue_set_busy_poll(vu_dev, vq, vdev_blk->poll_us);
     vu_set_queue_handler(vu_dev, vq, started ? vub_process_vq : NULL);
+#ifdef CONFIG_LINUX_AIO
+    if (!started) {
+        vub_aio_stop(vu_dev, &vdev_blk->queues[idx]);
+    }
+#endif
 }
 
 static uint64_t
 vub_get_features(VuDev *dev)
 {
-    return 1ull << VIRTIO_BLK_F_SIZE_MAX |
+    VugDev *gdev = container_of(dev, VugDev, parent);
+    VubDev *vdev_blk = container_of(gdev, VubDev, parent);
+    uint64_t features = 0;
+
+    if (vdev_blk->num_queues > 1) {
+        features |= 1ull << VIRTIO_BLK_F_MQ;
+    }
+
+    return features |
+           1ull << VIRTIO_BLK_F_SIZE_MAX |
            1ull << VIRTIO_BLK_F_SEG_MAX |
            1ull << VIRTIO_BLK_F_TOPOLOGY |
            1ull << VIRTIO_BLK_F_BLK_SIZE |
@@ -311,6 +553,12 @@ vub_get_features(VuDev *dev)
            1ull << VHOST_USER_F_PROTOCOL_FEATURES;
 }
 
+static uint64_t
+vub_get_protocol_features(VuDev *dev)
+{
+    return 1ull << VHOST_USER_PROTOCOL_F_MQ;
+}
+
 static int
 vub_get_config(VuDev *vu_dev, uint8_t *config, uint32_t len)
 {
@@ -372,6 +620,7 @@ vub_set_config(VuDev *vu_dev, const uint8_t *data,
 
 static const VuDevIface vub_iface = {
     .get_features = vub_get_features,
+    .get_protocol_features = vub_get_protocol_features,
     .queue_set_started = vub_queue_set_started,
     .get_config = vub_get_config,
     .set_config = vub_set_config,
@@ -416,6 +665,8 @@ fail:
 
 static void vub_free(struct VubDev *vdev_blk)
 {
+    int i;
+
     if (!vdev_blk) {
         return;
     }
@@ -424,6 +675,9 @@ static void vub_free(struct VubDev *vdev_blk)
     if (vdev_blk->blk_fd >= 0) {
         close(vdev_blk->blk_fd);
     }
+    for (i = 0; i < VHOST_MAX_NR_VIRTQUEUE; i++) {
+        pthread_mutex_destroy(&vdev_blk->queues[i].lock);
+    }
     g_free(vdev_blk);
 }
 
@@ -460,9 +714,22 @@ static VubDev *
 vub_new(char *blk_file)
 {
     VubDev *vdev_blk;
+    int i;
 
     vdev_blk = g_new0(VubDev, 1);
     vdev_blk->loop = g_main_loop_new(NULL, FALSE);
+    for (i = 0; i < VHOST_MAX_NR_VIRTQUEUE; i++) {
+        VubQueue *q = &vdev_blk->queues[i];
+
+        q->vdev_blk = vdev_blk;
+        pthread_mutex_init(&q->lock, NULL);
+#ifdef CONFIG_LINUX_AIO
+        q->aio_efd = -1;
+#endif
+    }
+#ifdef CONFIG_LINUX_AIO
+    vdev_blk->use_aio = true;
+#endif
     vdev_blk->blk_fd = vub_open(blk_file, 0);
     if (vdev_blk->blk_fd  < 0) {
         fprintf(stderr, "Error to open block device %s\n", blk_file);
@@ -485,8 +752,11 @@ int main(int argc, char **argv)
     char *blk_file = NULL;
     int lsock = -1, csock = -1;
     VubDev *vdev_blk = NULL;
+    bool threaded = false;
+    unsigned int poll_us = 0;
+    int num_queues = 1;
 
-    while ((opt = getopt(argc, argv, "b:s:h")) != -1) {
+    while ((opt = getopt(argc, argv, "b:s:tp:q:h")) != -1) {
         switch (opt) {
         case 'b':
             blk_file = g_strdup(optarg);
@@ -494,14 +764,36 @@ int main(int argc, char **argv)
         case 's':
             unix_socket = g_strdup(optarg);
             break;
+        case 't':
+            threaded = true;
+            break;
+        case 'p':
+            poll_us = atoi(optarg);
+            break;
+        case 'q':
+            num_queues = atoi(optarg);
+            break;
         case 'h':
         default:
             printf("Usage: %s [-b block device or file, -s UNIX domain socket]"
-                   " | [ -h ]\n", argv[0]);
+                   " [ -t run each virtqueue in its own thread ]"
+                   " [ -p poll the virtqueues for this many microseconds ]"
+                   " [ -q number of virtqueues ] | [ -h ]\n",
+                   argv[0]);
             return 0;
         }
     }
 
+    if (num_queues < 1 || num_queues > VHOST_MAX_NR_VIRTQUEUE) {
+        fprintf(stderr, "The number of queues must be between 1 and %d\n",
+                VHOST_MAX_NR_VIRTQUEUE);
+        return -1;
+    }
+    if (poll_us && !threaded) {
+        fprintf(stderr, "Polling needs the virtqueues to run in threads\n");
+        return -1;
+    }
+
     if (!unix_socket || !blk_file) {
         printf("Usage: %s [-b block device or file, -s UNIX domain socket] |"
                " [ -h ]\n", argv[0]);
@@ -523,6 +815,10 @@ int main(int argc, char **argv)
     if (!vdev_blk) {
         goto err;
     }
+    vdev_blk->threaded = threaded;
+    vdev_blk->poll_us = poll_us;
+    vdev_blk->num_queues = num_queues;
+    vdev_blk->blkcfg.num_queues = num_queues;
 
     vug_init(&vdev_blk->parent, csock, vub_panic_cb, &vub_iface);
 
@@ -20,6 +20,8 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qemu/thread.h"
+#include "qemu/atomic.h"
 #include "crypto/hash.h"
 #include "hashpriv.h"
 
@@ -78,6 +80,111 @@ int qcrypto_hash_bytes(QCryptoHashAlgorithm alg,
     return qcrypto_hash_bytesv(alg, &iov, 1, result, resultlen, errp);
 }
 
+/*
+ * qcrypto_hash_bytes_multi() starts a new thread for each
+ * QCRYPTO_HASH_MULTI_BYTES_PER_THREAD bytes of input, up to
+ * QCRYPTO_HASH_MULTI_MAX_THREADS including the caller.
+ */
+#define QCRYPTO_HASH_MULTI_MAX_THREADS 8
+#define QCRYPTO_HASH_MULTI_BYTES_PER_THREAD (1024 * 1024)
+
+typedef struct QCryptoHashMulti {
+    QCryptoHashAlgorithm alg;
+    const struct iovec *bufs;
+    size_t nbufs;
+    uint8_t *results;
+    size_t digestlen;
+    size_t next;
+    bool failed;
+} QCryptoHashMulti;
+
+typedef struct QCryptoHashMultiWorker {
+    QCryptoHashMulti *multi;
+    QemuThread thread;
+    Error *err;
+} QCryptoHashMultiWorker;
+
+static void *qcrypto_hash_multi_worker(void *opaque)
+{
+    QCryptoHashMultiWorker *worker = opaque;
+    QCryptoHashMulti *multi = worker->multi;
+    size_t i;
+
+    while (!atomic_read(&multi->failed) &&
+           (i = atomic_fetch_inc(&multi->next)) < multi->nbufs) {
+        uint8_t *result = multi->results + i * multi->digestlen;
+        size_t resultlen = multi->digestlen;
+
+        if (qcrypto_hash_bytesv(multi->alg, &multi->bufs[i], 1,
+                                &result, &resultlen, &worker->err) < 0) {
+            atomic_set(&multi->failed, true);
+        }
+    }
+
+    return NULL;
+}
+
+int qcrypto_hash_bytes_multi(QCryptoHashAlgorithm alg,
+                             const struct iovec *bufs,
+                             size_t nbufs,
+                             uint8_t *results,
+                             Error **errp)
+{
+    QCryptoHashMulti multi = {
+        .alg = alg,
+        .bufs = bufs,
+        .nbufs = nbufs,
+        .results = results,
+        .digestlen = qcrypto_hash_digest_len(alg),
+    };
+    QCryptoHashMultiWorker *workers;
+    size_t nthreads, total = 0;
+    size_t i;
+    int ret = 0;
+
+    for (i = 0; i < nbufs; i++) {
+        total += bufs[i].iov_len;
+    }
+
+    nthreads = total / QCRYPTO_HASH_MULTI_BYTES_PER_THREAD;
+    nthreads = MIN(nthreads, QCRYPTO_HASH_MULTI_MAX_THREADS);
+    nthreads = MIN(nthreads, nbufs);
+#ifdef _SC_NPROCESSORS_ONLN
+    nthreads = MIN(nthreads, MAX(sysconf(_SC_NPROCESSORS_ONLN), 1));
+#endif
+    nthreads = MAX(nthreads, 1);
+
+    /* The calling thread is workers[0] */
+    workers = g_new0(QCryptoHashMultiWorker, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        workers[i].multi = &multi;
+    }
+    for (i = 1; i < nthreads; i++) {
+        qemu_thread_create(&workers[i].thread, "hash-worker",
+                           qcrypto_hash_multi_worker, &workers[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    qcrypto_hash_multi_worker(&workers[0]);
+
+    for (i = 0; i < nthreads; i++) {
+        if (i > 0) {
+            qemu_thread_join(&workers[i].thread);
+        }
+        if (workers[i].err) {
+            if (ret == 0) {
+                error_propagate(errp, workers[i].err);
+            } else {
+                error_free(workers[i].err);
+            }
+            ret = -1;
+        }
+    }
+
+    g_free(workers);
+    return ret;
+}
+
 static const char hex[] = "0123456789abcdef";
 
 int qcrypto_hash_digestv(QCryptoHashAlgorithm alg,
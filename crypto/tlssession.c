@@ -31,6 +31,15 @@
 
 #include <gnutls/x509.h>
 
+#ifdef CONFIG_KTLS
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
 
 struct QCryptoTLSSession {
     QCryptoTLSCreds *creds;
@@ -500,6 +509,78 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 }
 
 
+#ifdef CONFIG_KTLS
+int
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *session,
+                                   int fd,
+                                   Error **errp)
+{
+    struct tls12_crypto_info_aes_gcm_128 info = {
+        .info.version = TLS_1_2_VERSION,
+        .info.cipher_type = TLS_CIPHER_AES_GCM_128,
+    };
+    gnutls_datum_t iv, key;
+    unsigned char seq[8];
+    int ret;
+
+    if (!session->handshakeComplete) {
+        error_setg(errp, "TLS handshake is not complete");
+        return -1;
+    }
+
+    /* The kernel only implements AES-GCM-128 for TLS 1.2 */
+    if (gnutls_protocol_get_version(session->handle) != GNUTLS_TLS1_2 ||
+        gnutls_cipher_get(session->handle) != GNUTLS_CIPHER_AES_128_GCM) {
+        error_setg(errp, "Kernel TLS needs TLS 1.2 with AES-128-GCM");
+        return -1;
+    }
+
+    ret = gnutls_record_get_state(session->handle, 0, NULL,
+                                  &iv, &key, seq);
+    if (ret < 0) {
+        error_setg(errp, "Cannot get TLS record state: %s",
+                   gnutls_strerror(ret));
+        return -1;
+    }
+
+    if (key.size != TLS_CIPHER_AES_GCM_128_KEY_SIZE ||
+        iv.size != TLS_CIPHER_AES_GCM_128_SALT_SIZE) {
+        error_setg(errp, "Unexpected TLS record key size");
+        return -1;
+    }
+
+    /* The explicit part of the nonce is the record sequence number */
+    memcpy(info.iv, seq, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+    memcpy(info.rec_seq, seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+    memcpy(info.key, key.data, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+    memcpy(info.salt, iv.data, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+
+    if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        error_setg_errno(errp, errno, "Cannot enable kernel TLS");
+        ret = -1;
+    } else if (setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info)) < 0) {
+        error_setg_errno(errp, errno, "Cannot set kernel TLS keys");
+        ret = -1;
+    } else {
+        trace_qcrypto_tls_session_ktls_tx(session);
+        ret = 0;
+    }
+
+    memset(&info, 0, sizeof(info));
+    return ret;
+}
+#else
+int
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *session,
+                                   int fd,
+                                   Error **errp)
+{
+    error_setg(errp, "Kernel TLS is not supported in this build");
+    return -1;
+}
+#endif
+
+
 #else /* ! CONFIG_GNUTLS */
 
 
@@ -591,4 +672,14 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
     return NULL;
 }
 
+
+int
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *sess,
+                                   int fd,
+                                   Error **errp)
+{
+    error_setg(errp, "TLS requires GNUTLS support");
+    return -1;
+}
+
 #endif
@@ -1288,17 +1288,250 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
+/*
+ * Pages are compressed in batches by a small pool of threads, and then
+ * written out in order by the dumping thread.  The guest is stopped while
+ * the pages are compressed, so the workers read guest RAM directly.
+ */
+#define DUMP_COMPRESS_BATCH 1024
+#define DUMP_COMPRESS_MAX_THREADS 8
+
+typedef struct DumpCompressPage {
+    uint8_t *buf;               /* the guest page */
+    uint8_t *out;               /* len_buf_out bytes of compressed data */
+    size_t size;                /* bytes to write, 0 for a zero page */
+    uint32_t flags;             /* DUMP_DH_COMPRESSED_*, 0 for plaintext */
+} DumpCompressPage;
+
+typedef struct DumpCompress DumpCompress;
+
+typedef struct DumpCompressWorker {
+    DumpCompress *dc;
+    QemuThread thread;
+    QemuSemaphore sem;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+} DumpCompressWorker;
+
+struct DumpCompress {
+    DumpState *s;
+    size_t len_buf_out;
+    DumpCompressPage *pages;
+    uint8_t *out;
+    size_t npages;
+    size_t next;
+    bool quit;
+    QemuSemaphore done;
+    size_t nthreads;
+    DumpCompressWorker *workers;    /* workers[0] is the dumping thread */
+};
+
+static void dump_compress_page(DumpCompressWorker *w, DumpCompressPage *p)
+{
+    DumpState *s = w->dc->s;
+    size_t page_size = s->dump_info.page_size;
+    size_t size_out = w->dc->len_buf_out;
+
+    if (is_zero_page(p->buf, page_size)) {
+        p->flags = 0;
+        p->size = 0;
+        return;
+    }
+
+    /*
+     * only one compression format will be used here, for s->flag_compress
+     * is set. But when compression fails to work, we fall back to save in
+     * plaintext.
+     */
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+            (compress2(p->out, (uLongf *)&size_out, p->buf, page_size,
+                       Z_BEST_SPEED) == Z_OK) &&
+            (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+            (lzo1x_1_compress(p->buf, page_size, p->out,
+                              (lzo_uint *)&size_out, w->wrkmem) == LZO_E_OK) &&
+            (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+            (snappy_compress((char *)p->buf, page_size, (char *)p->out,
+                             &size_out) == SNAPPY_OK) &&
+            (size_out < page_size)) {
+        p->flags = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+    } else {
+        p->flags = 0;
+        size_out = page_size;
+    }
+    p->size = size_out;
+}
+
+static void dump_compress_run(DumpCompressWorker *w)
+{
+    DumpCompress *dc = w->dc;
+    size_t i;
+
+    while ((i = atomic_fetch_inc(&dc->next)) < dc->npages) {
+        dump_compress_page(w, &dc->pages[i]);
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressWorker *w = opaque;
+    DumpCompress *dc = w->dc;
+
+    for (;;) {
+        qemu_sem_wait(&w->sem);
+        if (atomic_read(&dc->quit)) {
+            break;
+        }
+        dump_compress_run(w);
+        qemu_sem_post(&dc->done);
+    }
+
+    return NULL;
+}
+
+static void dump_compress_init(DumpCompress *dc, DumpState *s,
+                               size_t len_buf_out)
+{
+    size_t i, nthreads = 1;
+
+    if (s->num_dumpable > DUMP_COMPRESS_BATCH) {
+        nthreads = DUMP_COMPRESS_MAX_THREADS;
+#ifdef _SC_NPROCESSORS_ONLN
+        nthreads = MIN(nthreads, MAX(sysconf(_SC_NPROCESSORS_ONLN), 1));
+#endif
+    }
+
+    dc->s = s;
+    dc->len_buf_out = len_buf_out;
+    dc->pages = g_new0(DumpCompressPage, DUMP_COMPRESS_BATCH);
+    dc->out = g_malloc(DUMP_COMPRESS_BATCH * len_buf_out);
+    for (i = 0; i < DUMP_COMPRESS_BATCH; i++) {
+        dc->pages[i].out = dc->out + i * len_buf_out;
+    }
+    dc->npages = 0;
+    dc->quit = false;
+    qemu_sem_init(&dc->done, 0);
+
+    dc->nthreads = nthreads;
+    dc->workers = g_new0(DumpCompressWorker, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        dc->workers[i].dc = dc;
+#ifdef CONFIG_LZO
+        dc->workers[i].wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+        if (i > 0) {
+            qemu_sem_init(&dc->workers[i].sem, 0);
+            qemu_thread_create(&dc->workers[i].thread, "dump_compress",
+                               dump_compress_thread, &dc->workers[i],
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+}
+
+static void dump_compress_cleanup(DumpCompress *dc)
+{
+    size_t i;
+
+    atomic_set(&dc->quit, true);
+    for (i = 0; i < dc->nthreads; i++) {
+        if (i > 0) {
+            qemu_sem_post(&dc->workers[i].sem);
+            qemu_thread_join(&dc->workers[i].thread);
+            qemu_sem_destroy(&dc->workers[i].sem);
+        }
+#ifdef CONFIG_LZO
+        g_free(dc->workers[i].wrkmem);
+#endif
+    }
+    qemu_sem_destroy(&dc->done);
+    g_free(dc->workers);
+    g_free(dc->out);
+    g_free(dc->pages);
+}
+
+static void dump_compress_batch(DumpCompress *dc)
+{
+    size_t i;
+
+    dc->next = 0;
+    for (i = 1; i < dc->nthreads; i++) {
+        qemu_sem_post(&dc->workers[i].sem);
+    }
+    dump_compress_run(&dc->workers[0]);
+    for (i = 1; i < dc->nthreads; i++) {
+        qemu_sem_wait(&dc->done);
+    }
+}
+
+/*
+ * compress the pages collected in dc, then write their page_data and
+ * page_desc in order. Zero pages all share the page_data of pd_zero.
+ */
+static int write_compressed_pages(DumpCompress *dc, DataCache *page_desc,
+                                  DataCache *page_data, PageDescriptor *pd_zero,
+                                  off_t *offset_data, Error **errp)
+{
+    DumpState *s = dc->s;
+    DumpCompressPage *p;
+    PageDescriptor pd;
+    size_t i;
+    int ret;
+
+    dump_compress_batch(dc);
+
+    for (i = 0; i < dc->npages; i++) {
+        p = &dc->pages[i];
+        if (p->size == 0) {
+            ret = write_cache(page_desc, pd_zero, sizeof(PageDescriptor),
+                              false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return ret;
+            }
+        } else {
+            ret = write_cache(page_data, p->flags ? p->out : p->buf,
+                              p->size, false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                return ret;
+            }
+
+            /* get and write page desc here */
+            pd.flags = cpu_to_dump32(s, p->flags);
+            pd.size = cpu_to_dump32(s, p->size);
+            pd.page_flags = cpu_to_dump64(s, 0);
+            pd.offset = cpu_to_dump64(s, *offset_data);
+            *offset_data += p->size;
+
+            ret = write_cache(page_desc, &pd, sizeof(PageDescriptor), false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return ret;
+            }
+        }
+        s->written_size += s->dump_info.page_size;
+    }
+    dc->npages = 0;
+
+    return 0;
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    DumpCompress dc;
+    size_t len_buf_out;
     off_t offset_desc, offset_data;
-    PageDescriptor pd, pd_zero;
+    PageDescriptor pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
@@ -1314,11 +1547,7 @@ static void write_dump_pages(DumpState *s, Error **errp)
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    dump_compress_init(&dc, s, len_buf_out);
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1339,100 +1568,23 @@ static void write_dump_pages(DumpState *s, Error **errp)
     offset_data += s->dump_info.page_size;
 
     /*
-     * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * dump memory to vmcore a batch of pages at a time. zero page will all be
+     * resided in the first page of page section
      */
     while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
-        /* check zero page */
-        if (is_zero_page(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
+        dc.pages[dc.npages++].buf = buf;
+        if (dc.npages == DUMP_COMPRESS_BATCH) {
+            ret = write_compressed_pages(&dc, &page_desc, &page_data,
+                                         &pd_zero, &offset_data, errp);
             if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-            }
-
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
-
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
                 goto out;
             }
         }
-        s->written_size += s->dump_info.page_size;
+    }
+    ret = write_compressed_pages(&dc, &page_desc, &page_data, &pd_zero,
+                                 &offset_data, errp);
+    if (ret < 0) {
+        goto out;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1447,14 +1599,9 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
 out:
+    dump_compress_cleanup(&dc);
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -91,8 +91,7 @@ static MemoryRegion io_mem_unassigned;
 /* RAM is pre-allocated and passed into qemu_ram_alloc_from_ptr */
 #define RAM_PREALLOC   (1 << 0)
 
-/* RAM is mmap-ed with MAP_SHARED */
-#define RAM_SHARED     (1 << 1)
+/* RAM_SHARED and RAM_PMEM are passed in by callers, see exec/memory.h */
 
 /* Only a portion of RAM (used_length) is actually used, and migrated.
  * This used_length size can change across reboots.
@@ -456,6 +455,221 @@ address_space_translate_internal(AddressSpaceDispatch *d, hwaddr addr, hwaddr *x
     return section;
 }
 
+/*
+ * Small direct-mapped cache of IOMMU translations, shared by everything
+ * that translates through one IOMMU region.  Entries are IOMMUTLBEntry
+ * values as returned by the translate callback, with perm == IOMMU_NONE
+ * marking a free slot.  A flush bumps gen so that a lookup that raced
+ * with it does not insert the translation it got from before the flush.
+ */
+#define IOMMU_TLB_CACHE_BITS 6
+#define IOMMU_TLB_CACHE_SIZE (1 << IOMMU_TLB_CACHE_BITS)
+
+typedef struct IOMMUTLBCache {
+    struct rcu_head rcu;
+    QemuSpin lock;
+    unsigned gen;
+    IOMMUTLBEntry entries[IOMMU_TLB_CACHE_SIZE];
+} IOMMUTLBCache;
+
+void iommu_tlb_cache_flush(IOMMUMemoryRegion *iommu_mr, hwaddr iova,
+                           hwaddr addr_mask)
+{
+    IOMMUTLBCache *cache = atomic_rcu_read(&iommu_mr->tlb_cache);
+    int i;
+
+    if (!cache) {
+        return;
+    }
+
+    qemu_spin_lock(&cache->lock);
+    cache->gen++;
+    for (i = 0; i < IOMMU_TLB_CACHE_SIZE; i++) {
+        IOMMUTLBEntry *e = &cache->entries[i];
+
+        if (e->iova <= iova + addr_mask && e->iova + e->addr_mask >= iova) {
+            e->perm = IOMMU_NONE;
+        }
+    }
+    qemu_spin_unlock(&cache->lock);
+}
+
+/* Called from RCU critical section */
+static IOMMUTLBEntry iommu_translate_cached(IOMMUMemoryRegion *iommu_mr,
+                                            hwaddr addr, bool is_write)
+{
+    IOMMUMemoryRegionClass *imrc =
+        memory_region_get_iommu_class_nocheck(iommu_mr);
+    IOMMUTLBCache *cache = atomic_rcu_read(&iommu_mr->tlb_cache);
+    IOMMUAccessFlags flag = is_write ? IOMMU_WO : IOMMU_RO;
+    IOMMUTLBEntry iotlb, *e;
+    unsigned gen;
+
+    if (!cache) {
+        return imrc->translate(iommu_mr, addr, flag);
+    }
+
+    e = &cache->entries[(addr >> TARGET_PAGE_BITS) &
+                        (IOMMU_TLB_CACHE_SIZE - 1)];
+    qemu_spin_lock(&cache->lock);
+    if ((e->perm & flag) && (addr & ~e->addr_mask) == e->iova) {
+        iotlb = *e;
+        qemu_spin_unlock(&cache->lock);
+        return iotlb;
+    }
+    gen = cache->gen;
+    qemu_spin_unlock(&cache->lock);
+
+    iotlb = imrc->translate(iommu_mr, addr, flag);
+    if (iotlb.perm & flag) {
+        qemu_spin_lock(&cache->lock);
+        if (cache->gen == gen) {
+            *e = iotlb;
+            e->iova = addr & ~iotlb.addr_mask;
+        }
+        qemu_spin_unlock(&cache->lock);
+    }
+    return iotlb;
+}
+
+static void iommu_tlb_cache_ref(IOMMUMemoryRegion *iommu_mr)
+{
+    IOMMUTLBCache *cache;
+
+    if (iommu_mr->tlb_cache_users++ == 0) {
+        cache = g_new0(IOMMUTLBCache, 1);
+        qemu_spin_init(&cache->lock);
+        atomic_rcu_set(&iommu_mr->tlb_cache, cache);
+    }
+}
+
+static void iommu_tlb_cache_unref(IOMMUMemoryRegion *iommu_mr)
+{
+    IOMMUTLBCache *cache = iommu_mr->tlb_cache;
+
+    if (--iommu_mr->tlb_cache_users == 0) {
+        atomic_rcu_set(&iommu_mr->tlb_cache, NULL);
+        g_free_rcu(cache, rcu);
+    }
+}
+
+typedef struct IOMMUCacheNotifier {
+    IOMMUNotifier n;
+    IOMMUMemoryRegion *iommu_mr;
+    QLIST_ENTRY(IOMMUCacheNotifier) next;
+} IOMMUCacheNotifier;
+
+typedef struct AddressSpaceIOMMUCache {
+    MemoryListener listener;
+    QLIST_HEAD(, IOMMUCacheNotifier) notifiers;
+} AddressSpaceIOMMUCache;
+
+static void iommu_cache_notify(IOMMUNotifier *n, IOMMUTLBEntry *iotlb)
+{
+    /* The notifier only makes the IOMMU report its changes;
+     * memory_region_notify_iommu() already flushed the cache.  */
+}
+
+static void iommu_cache_region_add(MemoryListener *listener,
+                                   MemoryRegionSection *section)
+{
+    AddressSpaceIOMMUCache *c = container_of(listener,
+                                             AddressSpaceIOMMUCache,
+                                             listener);
+    IOMMUMemoryRegion *iommu_mr = memory_region_get_iommu(section->mr);
+    IOMMUCacheNotifier *icn;
+    Int128 end;
+
+    if (!iommu_mr ||
+        !memory_region_get_iommu_class_nocheck(iommu_mr)->notifies_changes) {
+        return;
+    }
+
+    icn = g_new0(IOMMUCacheNotifier, 1);
+    end = int128_add(int128_make64(section->offset_within_region),
+                     section->size);
+    end = int128_sub(end, int128_one());
+    iommu_notifier_init(&icn->n, iommu_cache_notify, IOMMU_NOTIFIER_UNMAP,
+                        section->offset_within_region, int128_get64(end));
+    icn->iommu_mr = iommu_mr;
+    memory_region_register_iommu_notifier(section->mr, &icn->n);
+    iommu_tlb_cache_ref(iommu_mr);
+    QLIST_INSERT_HEAD(&c->notifiers, icn, next);
+}
+
+static void iommu_cache_notifier_free(IOMMUCacheNotifier *icn)
+{
+    QLIST_REMOVE(icn, next);
+    memory_region_unregister_iommu_notifier(MEMORY_REGION(icn->iommu_mr),
+                                            &icn->n);
+    iommu_tlb_cache_unref(icn->iommu_mr);
+    g_free(icn);
+}
+
+static void iommu_cache_region_del(MemoryListener *listener,
+                                   MemoryRegionSection *section)
+{
+    AddressSpaceIOMMUCache *c = container_of(listener,
+                                             AddressSpaceIOMMUCache,
+                                             listener);
+    IOMMUCacheNotifier *icn;
+
+    QLIST_FOREACH(icn, &c->notifiers, next) {
+        if (MEMORY_REGION(icn->iommu_mr) == section->mr &&
+            icn->n.start == section->offset_within_region) {
+            iommu_cache_notifier_free(icn);
+            break;
+        }
+    }
+}
+
+static void iommu_cache_commit(MemoryListener *listener)
+{
+    AddressSpaceIOMMUCache *c = container_of(listener,
+                                             AddressSpaceIOMMUCache,
+                                             listener);
+    IOMMUCacheNotifier *icn;
+
+    QLIST_FOREACH(icn, &c->notifiers, next) {
+        iommu_tlb_cache_flush(icn->iommu_mr, 0, (hwaddr)-1);
+    }
+}
+
+void address_space_enable_iommu_cache(AddressSpace *as)
+{
+    AddressSpaceIOMMUCache *c;
+
+    if (as->iommu_cache) {
+        return;
+    }
+
+    c = g_new0(AddressSpaceIOMMUCache, 1);
+    c->listener = (MemoryListener) {
+        .region_add = iommu_cache_region_add,
+        .region_del = iommu_cache_region_del,
+        .commit = iommu_cache_commit,
+    };
+    QLIST_INIT(&c->notifiers);
+    as->iommu_cache = c;
+    memory_listener_register(&c->listener, as);
+}
+
+void address_space_disable_iommu_cache(AddressSpace *as)
+{
+    AddressSpaceIOMMUCache *c = as->iommu_cache;
+
+    if (!c) {
+        return;
+    }
+
+    memory_listener_unregister(&c->listener);
+    while (!QLIST_EMPTY(&c->notifiers)) {
+        iommu_cache_notifier_free(QLIST_FIRST(&c->notifiers));
+    }
+    as->iommu_cache = NULL;
+    g_free(c);
+}
+
 /**
  * flatview_do_translate - translate an address in FlatView
  *
@@ -486,7 +700,6 @@ static MemoryRegionSection flatview_do_translate(FlatView *fv,
     IOMMUTLBEntry iotlb;
     MemoryRegionSection *section;
     IOMMUMemoryRegion *iommu_mr;
-    IOMMUMemoryRegionClass *imrc;
     hwaddr page_mask = (hwaddr)(-1);
     hwaddr plen = (hwaddr)(-1);
 
@@ -503,10 +716,8 @@ static MemoryRegionSection flatview_do_translate(FlatView *fv,
         if (!iommu_mr) {
             break;
         }
-        imrc = memory_region_get_iommu_class_nocheck(iommu_mr);
 
-        iotlb = imrc->translate(iommu_mr, addr, is_write ?
-                                IOMMU_WO : IOMMU_RO);
+        iotlb = iommu_translate_cached(iommu_mr, addr, is_write);
         addr = ((iotlb.translated_addr & ~iotlb.addr_mask)
                 | (addr & iotlb.addr_mask));
         page_mask &= iotlb.addr_mask;
@@ -767,6 +978,9 @@ void cpu_exec_unrealizefn(CPUState *cpu)
     if (qdev_get_vmsd(DEVICE(cpu)) == NULL) {
         vmstate_unregister(NULL, &vmstate_cpu_common, cpu);
     }
+    if (tcg_enabled()) {
+        tlb_destroy(cpu);
+    }
 }
 
 Property cpu_common_props[] = {
@@ -806,6 +1020,9 @@ void cpu_exec_realizefn(CPUState *cpu, Error **errp)
         tcg_target_initialized = true;
         cc->tcg_initialize();
     }
+    if (tcg_enabled()) {
+        tlb_init(cpu);
+    }
 
 #ifndef CONFIG_USER_ONLY
     if (qdev_get_vmsd(DEVICE(cpu)) == NULL) {
@@ -821,9 +1038,7 @@ void cpu_exec_realizefn(CPUState *cpu, Error **errp)
 static void breakpoint_invalidate(CPUState *cpu, target_ulong pc)
 {
     mmap_lock();
-    tb_lock();
     tb_invalidate_phys_page_range(pc, pc + 1, 0);
-    tb_unlock();
     mmap_unlock();
 }
 #else
@@ -1226,13 +1441,7 @@ bool cpu_physical_memory_snapshot_get_dirty(DirtyBitmapSnapshot *snap,
     end = TARGET_PAGE_ALIGN(start + length - snap->start) >> TARGET_PAGE_BITS;
     page = (start - snap->start) >> TARGET_PAGE_BITS;
 
-    while (page < end) {
-        if (test_bit(page, snap->dirty)) {
-            return true;
-        }
-        page++;
-    }
-    return false;
+    return find_next_bit(snap->dirty, end, page) < end;
 }
 
 /* Called from RCU critical section */
@@ -1653,7 +1862,7 @@ static void *file_ram_alloc(RAMBlock *block,
     }
 
     area = qemu_ram_mmap(fd, memory, block->mr->align,
-                         block->flags & RAM_SHARED);
+                         block->flags & RAM_SHARED, block->flags & RAM_PMEM);
     if (area == MAP_FAILED) {
         error_setg_errno(errp, errno,
                          "unable to map backing store for guest RAM");
@@ -1661,7 +1870,7 @@ static void *file_ram_alloc(RAMBlock *block,
     }
 
     if (mem_prealloc) {
-        os_mem_prealloc(fd, area, memory, smp_cpus, errp);
+        os_mem_prealloc(fd, area, memory, smp_cpus, NULL, 0, errp);
         if (errp && *errp) {
             qemu_ram_munmap(area, memory);
             return NULL;
@@ -1762,11 +1971,36 @@ const char *qemu_ram_get_idstr(RAMBlock *rb)
     return rb->idstr;
 }
 
+void *qemu_ram_get_host_addr(RAMBlock *rb)
+{
+    return rb->host;
+}
+
+ram_addr_t qemu_ram_get_used_length(RAMBlock *rb)
+{
+    return rb->used_length;
+}
+
 bool qemu_ram_is_shared(RAMBlock *rb)
 {
     return rb->flags & RAM_SHARED;
 }
 
+/*
+ * Make the contents of a RAMBlock backed by persistent memory durable.
+ * On a DAX file msync() writes back the CPU caches for the range.
+ */
+void qemu_ram_block_writeback(RAMBlock *block)
+{
+#ifdef __linux__
+    if ((block->flags & RAM_PMEM) &&
+        msync(block->host, block->used_length, MS_SYNC) < 0) {
+        error_report("failed to write back persistent memory '%s': %s",
+                     block->idstr, strerror(errno));
+    }
+#endif
+}
+
 /* Called with iothread lock held.  */
 void qemu_ram_set_idstr(RAMBlock *new_block, const char *name, DeviceState *dev)
 {
@@ -2000,7 +2234,7 @@ static void ram_block_add(RAMBlock *new_block, Error **errp)
 
 #ifdef __linux__
 RAMBlock *qemu_ram_alloc_from_fd(ram_addr_t size, MemoryRegion *mr,
-                                 bool share, int fd,
+                                 uint32_t ram_flags, int fd,
                                  Error **errp)
 {
     RAMBlock *new_block;
@@ -2042,7 +2276,8 @@ RAMBlock *qemu_ram_alloc_from_fd(ram_addr_t size, MemoryRegion *mr,
     new_block->mr = mr;
     new_block->used_length = size;
     new_block->max_length = size;
-    new_block->flags = share ? RAM_SHARED : 0;
+    assert(!(ram_flags & ~(RAM_SHARED | RAM_PMEM)));
+    new_block->flags = ram_flags;
     new_block->host = file_ram_alloc(new_block, size, fd, !file_size, errp);
     if (!new_block->host) {
         g_free(new_block);
@@ -2061,7 +2296,7 @@ RAMBlock *qemu_ram_alloc_from_fd(ram_addr_t size, MemoryRegion *mr,
 
 
 RAMBlock *qemu_ram_alloc_from_file(ram_addr_t size, MemoryRegion *mr,
-                                   bool share, const char *mem_path,
+                                   uint32_t ram_flags, const char *mem_path,
                                    Error **errp)
 {
     int fd;
@@ -2073,7 +2308,7 @@ RAMBlock *qemu_ram_alloc_from_file(ram_addr_t size, MemoryRegion *mr,
         return NULL;
     }
 
-    block = qemu_ram_alloc_from_fd(size, mr, share, fd, errp);
+    block = qemu_ram_alloc_from_fd(size, mr, ram_flags, fd, errp);
     if (!block) {
         if (created) {
             unlink(mem_path);
@@ -2402,21 +2637,22 @@ void memory_notdirty_write_prepare(NotDirtyInfo *ndi,
     ndi->ram_addr = ram_addr;
     ndi->mem_vaddr = mem_vaddr;
     ndi->size = size;
-    ndi->locked = false;
+    ndi->pages = NULL;
 
     assert(tcg_enabled());
-    if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
-        ndi->locked = true;
-        tb_lock();
-        tb_invalidate_phys_page_fast(ram_addr, size);
+    if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE) &&
+        tb_page_write_hits_code(ram_addr, size)) {
+        ndi->pages = page_collection_lock(ram_addr, ram_addr + size);
+        tb_invalidate_phys_page_fast(ndi->pages, ram_addr, size);
     }
 }
 
 /* Called within RCU critical section. */
 void memory_notdirty_write_complete(NotDirtyInfo *ndi)
 {
-    if (ndi->locked) {
-        tb_unlock();
+    if (ndi->pages) {
+        page_collection_unlock(ndi->pages);
+        ndi->pages = NULL;
     }
 
     /* Set both VGA and migration bits for simplicity and to remove
@@ -2517,11 +2753,10 @@ static void check_watchpoint(int offset, int len, MemTxAttrs attrs, int flags)
                 }
                 cpu->watchpoint_hit = wp;
 
-                /* Both tb_lock and iothread_mutex will be reset when
-                 * cpu_loop_exit or cpu_loop_exit_noexc longjmp
-                 * back into the cpu_exec main loop.
+                /* The iothread mutex will be reset when cpu_loop_exit or
+                 * cpu_loop_exit_noexc longjmp back into the cpu_exec
+                 * main loop.
                  */
-                tb_lock();
                 tb_check_watchpoint(cpu);
                 if (wp->flags & BP_STOP_BEFORE_ACCESS) {
                     cpu->exception_index = EXCP_DEBUG;
@@ -2943,9 +3178,7 @@ static void invalidate_and_set_dirty(MemoryRegion *mr, hwaddr addr,
     }
     if (dirty_log_mask & (1 << DIRTY_MEMORY_CODE)) {
         assert(tcg_enabled());
-        tb_lock();
         tb_invalidate_phys_range(addr, addr + length);
-        tb_unlock();
         dirty_log_mask &= ~(1 << DIRTY_MEMORY_CODE);
     }
     cpu_physical_memory_set_dirty_range(addr, length, dirty_log_mask);
@@ -3280,15 +3513,18 @@ void cpu_flush_icache_range(hwaddr start, int len)
                                            start, NULL, len, FLUSH_CACHE);
 }
 
-typedef struct {
+typedef struct BounceBuffer BounceBuffer;
+
+struct BounceBuffer {
     MemoryRegion *mr;
     void *buffer;
     hwaddr addr;
     hwaddr len;
-    bool in_use;
-} BounceBuffer;
+    QLIST_ENTRY(BounceBuffer) link;
+};
 
-static BounceBuffer bounce;
+/* Number of bounce buffers in use across all address spaces */
+static unsigned bounce_buffers_in_use;
 
 typedef struct MapClient {
     QEMUBH *bh;
@@ -3323,7 +3559,7 @@ void cpu_register_map_client(QEMUBH *bh)
     qemu_mutex_lock(&map_client_list_lock);
     client->bh = bh;
     QLIST_INSERT_HEAD(&map_client_list, client, link);
-    if (!atomic_read(&bounce.in_use)) {
+    if (!atomic_read(&bounce_buffers_in_use)) {
         cpu_notify_map_clients_locked();
     }
     qemu_mutex_unlock(&map_client_list_lock);
@@ -3429,6 +3665,9 @@ flatview_extend_translation(FlatView *fv, hwaddr addr,
  * May map a subset of the requested range, given by and returned in *plen.
  * May return NULL if resources needed to perform the mapping are exhausted.
  * Use only for reads OR writes - not for read-modify-write operations.
+ * Regions that cannot be accessed directly are copied through a bounce
+ * buffer; each address space has its own pool of those, limited to
+ * max_bounce_buffer_size bytes, so several devices may bounce at once.
  * Use cpu_register_map_client() to know when retrying the map operation is
  * likely to succeed.
  */
@@ -3452,26 +3691,36 @@ void *address_space_map(AddressSpace *as,
     mr = flatview_translate(fv, addr, &xlat, &l, is_write);
 
     if (!memory_access_is_direct(mr, is_write)) {
-        if (atomic_xchg(&bounce.in_use, true)) {
+        BounceBuffer *bounce;
+
+        /* Avoid unbounded allocations */
+        qemu_mutex_lock(&as->bounce_lock);
+        l = MIN(l, as->max_bounce_buffer_size - as->bounce_buffer_size);
+        if (l == 0) {
+            qemu_mutex_unlock(&as->bounce_lock);
             rcu_read_unlock();
             return NULL;
         }
-        /* Avoid unbounded allocations */
-        l = MIN(l, TARGET_PAGE_SIZE);
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
-        bounce.addr = addr;
-        bounce.len = l;
+        as->bounce_buffer_size += l;
+        bounce = g_new(BounceBuffer, 1);
+        QLIST_INSERT_HEAD(&as->bounce_buffers, bounce, link);
+        qemu_mutex_unlock(&as->bounce_lock);
+        atomic_inc(&bounce_buffers_in_use);
+
+        bounce->buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
+        bounce->addr = addr;
+        bounce->len = l;
 
         memory_region_ref(mr);
-        bounce.mr = mr;
+        bounce->mr = mr;
         if (!is_write) {
             flatview_read(fv, addr, MEMTXATTRS_UNSPECIFIED,
-                               bounce.buffer, l);
+                               bounce->buffer, l);
         }
 
         rcu_read_unlock();
         *plen = l;
-        return bounce.buffer;
+        return bounce->buffer;
     }
 
 
@@ -3491,7 +3740,20 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
+    BounceBuffer *bounce = NULL;
+
+    if (atomic_read(&as->bounce_buffer_size)) {
+        qemu_mutex_lock(&as->bounce_lock);
+        QLIST_FOREACH(bounce, &as->bounce_buffers, link) {
+            if (bounce->buffer == buffer) {
+                QLIST_REMOVE(bounce, link);
+                break;
+            }
+        }
+        qemu_mutex_unlock(&as->bounce_lock);
+    }
+
+    if (!bounce) {
         MemoryRegion *mr;
         ram_addr_t addr1;
 
@@ -3507,13 +3769,17 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
         return;
     }
     if (is_write) {
-        address_space_write(as, bounce.addr, MEMTXATTRS_UNSPECIFIED,
-                            bounce.buffer, access_len);
+        address_space_write(as, bounce->addr, MEMTXATTRS_UNSPECIFIED,
+                            bounce->buffer, access_len);
     }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    atomic_mb_set(&bounce.in_use, false);
+    qemu_vfree(bounce->buffer);
+    memory_region_unref(bounce->mr);
+
+    qemu_mutex_lock(&as->bounce_lock);
+    as->bounce_buffer_size -= bounce->len;
+    qemu_mutex_unlock(&as->bounce_lock);
+    g_free(bounce);
+    atomic_dec(&bounce_buffers_in_use);
     cpu_notify_map_clients();
 }
 
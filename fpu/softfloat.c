@@ -83,6 +83,8 @@ this code that are retained.
  * target-dependent and needs the TARGET_* macros.
  */
 #include "qemu/osdep.h"
+#include <math.h>
+#include <float.h>
 
 #include "fpu/softfloat.h"
 
@@ -105,6 +107,34 @@ this code that are retained.
 *----------------------------------------------------------------------------*/
 #include "softfloat-specialize.h"
 
+/*----------------------------------------------------------------------------
+| The basic arithmetic operations first try the host FPU, and only run the
+| software implementation when the host result might differ from it.  That
+| is the case unless rounding is to nearest-even, the inputs are zero or
+| normal, and the result is normal: then no exception other than inexact can
+| be raised, and inexact is only left for softfloat to compute when it is not
+| already set.  Since the flag is sticky and rarely cleared by guests, most
+| operations take the fast path.
+|
+| The host must evaluate float and double at their own precision (no x87
+| excess precision), and -ffast-math would break the IEEE semantics we rely
+| on, so the fast paths are compiled out in either case.
+*----------------------------------------------------------------------------*/
+#if defined(__FAST_MATH__) || !defined(FLT_EVAL_METHOD) || FLT_EVAL_METHOD != 0
+# define QEMU_NO_HARDFLOAT 1
+#else
+# define QEMU_NO_HARDFLOAT 0
+#endif
+
+static inline bool can_use_fpu(const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return likely(s->float_exception_flags & float_flag_inexact &&
+                  s->float_rounding_mode == float_round_nearest_even);
+}
+
 /*----------------------------------------------------------------------------
 | Returns the fraction bits of the half-precision floating-point value `a'.
 *----------------------------------------------------------------------------*/
@@ -2183,7 +2213,8 @@ static float32 subFloat32Sigs(float32 a, float32 b, flag zSign,
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_add(float32 a, float32 b, float_status *status)
+static float32 soft_float32_add(float32 a, float32 b,
+                                float_status *status)
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a, status);
@@ -2206,7 +2237,8 @@ float32 float32_add(float32 a, float32 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sub(float32 a, float32 b, float_status *status)
+static float32 soft_float32_sub(float32 a, float32 b,
+                                float_status *status)
 {
     flag aSign, bSign;
     a = float32_squash_input_denormal(a, status);
@@ -2229,7 +2261,8 @@ float32 float32_sub(float32 a, float32 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_mul(float32 a, float32 b, float_status *status)
+static float32 soft_float32_mul(float32 a, float32 b,
+                                float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -2294,7 +2327,8 @@ float32 float32_mul(float32 a, float32 b, float_status *status)
 | IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_div(float32 a, float32 b, float_status *status)
+static float32 soft_float32_div(float32 a, float32 b,
+                                float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -2471,8 +2505,8 @@ float32 float32_rem(float32 a, float32 b, float_status *status)
 | externally will flip the sign bit on NaNs.)
 *----------------------------------------------------------------------------*/
 
-float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
-                       float_status *status)
+static float32 soft_float32_muladd(float32 a, float32 b, float32 c,
+                                   int flags, float_status *status)
 {
     flag aSign, bSign, cSign, zSign;
     int aExp, bExp, cExp, pExp, zExp, expDiff;
@@ -2692,7 +2726,7 @@ float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float32 float32_sqrt(float32 a, float_status *status)
+static float32 soft_float32_sqrt(float32 a, float_status *status)
 {
     flag aSign;
     int aExp, zExp;
@@ -2743,6 +2777,129 @@ float32 float32_sqrt(float32 a, float_status *status)
 
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast paths for the single-precision operations above.
+*----------------------------------------------------------------------------*/
+
+typedef union {
+    float32 s;
+    float h;
+} union_float32;
+
+static inline bool float32_is_zero_or_normal(float32 a)
+{
+    int aExp = extractFloat32Exp(a);
+
+    return aExp != 0xFF && (aExp != 0 || extractFloat32Frac(a) == 0);
+}
+
+/* A normal result can only have raised inexact.  This also catches NaNs.  */
+static inline bool float32_hard_result_ok(float r)
+{
+    return likely(!isinf(r) && fabsf(r) > FLT_MIN);
+}
+
+static inline float hard_f32_add(float a, float b)
+{
+    return a + b;
+}
+
+static inline float hard_f32_sub(float a, float b)
+{
+    return a - b;
+}
+
+static inline float hard_f32_mul(float a, float b)
+{
+    return a * b;
+}
+
+static inline float hard_f32_div(float a, float b)
+{
+    return a / b;
+}
+
+static inline float32
+float32_gen2(float32 a, float32 b, float_status *s,
+             float (*hard)(float, float),
+             float32 (*soft)(float32, float32, float_status *))
+{
+    union_float32 ua, ub, ur;
+
+    if (unlikely(!can_use_fpu(s) ||
+                 !float32_is_zero_or_normal(a) ||
+                 !float32_is_zero_or_normal(b))) {
+        return soft(a, b, s);
+    }
+    ua.s = a;
+    ub.s = b;
+    ur.h = hard(ua.h, ub.h);
+    if (!float32_hard_result_ok(ur.h)) {
+        return soft(a, b, s);
+    }
+    return ur.s;
+}
+
+float32 float32_add(float32 a, float32 b, float_status *status)
+{
+    return float32_gen2(a, b, status, hard_f32_add, soft_float32_add);
+}
+
+float32 float32_sub(float32 a, float32 b, float_status *status)
+{
+    return float32_gen2(a, b, status, hard_f32_sub, soft_float32_sub);
+}
+
+float32 float32_mul(float32 a, float32 b, float_status *status)
+{
+    return float32_gen2(a, b, status, hard_f32_mul, soft_float32_mul);
+}
+
+float32 float32_div(float32 a, float32 b, float_status *status)
+{
+    return float32_gen2(a, b, status, hard_f32_div, soft_float32_div);
+}
+
+float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
+                       float_status *status)
+{
+    union_float32 ua, ub, uc, ur;
+
+    if (unlikely(!can_use_fpu(status) ||
+                 (flags & float_muladd_halve_result) ||
+                 !float32_is_zero_or_normal(a) ||
+                 !float32_is_zero_or_normal(b) ||
+                 !float32_is_zero_or_normal(c))) {
+        return soft_float32_muladd(a, b, c, flags, status);
+    }
+    /* No NaNs get here, so the negations can be done on the operands */
+    ua.s = flags & float_muladd_negate_product ? float32_chs(a) : a;
+    ub.s = b;
+    uc.s = flags & float_muladd_negate_c ? float32_chs(c) : c;
+    ur.h = fmaf(ua.h, ub.h, uc.h);
+    if (!float32_hard_result_ok(ur.h)) {
+        return soft_float32_muladd(a, b, c, flags, status);
+    }
+    if (flags & float_muladd_negate_result) {
+        return float32_chs(ur.s);
+    }
+    return ur.s;
+}
+
+float32 float32_sqrt(float32 a, float_status *status)
+{
+    union_float32 ua, ur;
+
+    /* The root of a positive normal number is normal */
+    if (unlikely(!can_use_fpu(status) || extractFloat32Sign(a) ||
+                 !float32_is_zero_or_normal(a))) {
+        return soft_float32_sqrt(a, status);
+    }
+    ua.s = a;
+    ur.h = sqrtf(ua.h);
+    return ur.s;
+}
+
 /*----------------------------------------------------------------------------
 | Returns the binary exponential of the single-precision floating-point value
 | `a'. The operation is performed according to the IEC/IEEE Standard for
@@ -3978,7 +4135,8 @@ static float64 subFloat64Sigs(float64 a, float64 b, flag zSign,
 | Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_add(float64 a, float64 b, float_status *status)
+static float64 soft_float64_add(float64 a, float64 b,
+                                float_status *status)
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a, status);
@@ -4001,7 +4159,8 @@ float64 float64_add(float64 a, float64 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sub(float64 a, float64 b, float_status *status)
+static float64 soft_float64_sub(float64 a, float64 b,
+                                float_status *status)
 {
     flag aSign, bSign;
     a = float64_squash_input_denormal(a, status);
@@ -4024,7 +4183,8 @@ float64 float64_sub(float64 a, float64 b, float_status *status)
 | for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_mul(float64 a, float64 b, float_status *status)
+static float64 soft_float64_mul(float64 a, float64 b,
+                                float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -4087,7 +4247,8 @@ float64 float64_mul(float64 a, float64 b, float_status *status)
 | the IEC/IEEE Standard for Binary Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_div(float64 a, float64 b, float_status *status)
+static float64 soft_float64_div(float64 a, float64 b,
+                                float_status *status)
 {
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
@@ -4258,8 +4419,8 @@ float64 float64_rem(float64 a, float64 b, float_status *status)
 | externally will flip the sign bit on NaNs.)
 *----------------------------------------------------------------------------*/
 
-float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
-                       float_status *status)
+static float64 soft_float64_muladd(float64 a, float64 b, float64 c,
+                                   int flags, float_status *status)
 {
     flag aSign, bSign, cSign, zSign;
     int aExp, bExp, cExp, pExp, zExp, expDiff;
@@ -4500,7 +4661,7 @@ float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
 | Floating-Point Arithmetic.
 *----------------------------------------------------------------------------*/
 
-float64 float64_sqrt(float64 a, float_status *status)
+static float64 soft_float64_sqrt(float64 a, float_status *status)
 {
     flag aSign;
     int aExp, zExp;
@@ -4548,6 +4709,129 @@ float64 float64_sqrt(float64 a, float_status *status)
 
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast paths for the double-precision operations above.
+*----------------------------------------------------------------------------*/
+
+typedef union {
+    float64 s;
+    double h;
+} union_float64;
+
+static inline bool float64_is_zero_or_normal(float64 a)
+{
+    int aExp = extractFloat64Exp(a);
+
+    return aExp != 0x7FF && (aExp != 0 || extractFloat64Frac(a) == 0);
+}
+
+/* A normal result can only have raised inexact.  This also catches NaNs.  */
+static inline bool float64_hard_result_ok(double r)
+{
+    return likely(!isinf(r) && fabs(r) > DBL_MIN);
+}
+
+static inline double hard_f64_add(double a, double b)
+{
+    return a + b;
+}
+
+static inline double hard_f64_sub(double a, double b)
+{
+    return a - b;
+}
+
+static inline double hard_f64_mul(double a, double b)
+{
+    return a * b;
+}
+
+static inline double hard_f64_div(double a, double b)
+{
+    return a / b;
+}
+
+static inline float64
+float64_gen2(float64 a, float64 b, float_status *s,
+             double (*hard)(double, double),
+             float64 (*soft)(float64, float64, float_status *))
+{
+    union_float64 ua, ub, ur;
+
+    if (unlikely(!can_use_fpu(s) ||
+                 !float64_is_zero_or_normal(a) ||
+                 !float64_is_zero_or_normal(b))) {
+        return soft(a, b, s);
+    }
+    ua.s = a;
+    ub.s = b;
+    ur.h = hard(ua.h, ub.h);
+    if (!float64_hard_result_ok(ur.h)) {
+        return soft(a, b, s);
+    }
+    return ur.s;
+}
+
+float64 float64_add(float64 a, float64 b, float_status *status)
+{
+    return float64_gen2(a, b, status, hard_f64_add, soft_float64_add);
+}
+
+float64 float64_sub(float64 a, float64 b, float_status *status)
+{
+    return float64_gen2(a, b, status, hard_f64_sub, soft_float64_sub);
+}
+
+float64 float64_mul(float64 a, float64 b, float_status *status)
+{
+    return float64_gen2(a, b, status, hard_f64_mul, soft_float64_mul);
+}
+
+float64 float64_div(float64 a, float64 b, float_status *status)
+{
+    return float64_gen2(a, b, status, hard_f64_div, soft_float64_div);
+}
+
+float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
+                       float_status *status)
+{
+    union_float64 ua, ub, uc, ur;
+
+    if (unlikely(!can_use_fpu(status) ||
+                 (flags & float_muladd_halve_result) ||
+                 !float64_is_zero_or_normal(a) ||
+                 !float64_is_zero_or_normal(b) ||
+                 !float64_is_zero_or_normal(c))) {
+        return soft_float64_muladd(a, b, c, flags, status);
+    }
+    /* No NaNs get here, so the negations can be done on the operands */
+    ua.s = flags & float_muladd_negate_product ? float64_chs(a) : a;
+    ub.s = b;
+    uc.s = flags & float_muladd_negate_c ? float64_chs(c) : c;
+    ur.h = fma(ua.h, ub.h, uc.h);
+    if (!float64_hard_result_ok(ur.h)) {
+        return soft_float64_muladd(a, b, c, flags, status);
+    }
+    if (flags & float_muladd_negate_result) {
+        return float64_chs(ur.s);
+    }
+    return ur.s;
+}
+
+float64 float64_sqrt(float64 a, float_status *status)
+{
+    union_float64 ua, ur;
+
+    /* The root of a positive normal number is normal */
+    if (unlikely(!can_use_fpu(status) || extractFloat64Sign(a) ||
+                 !float64_is_zero_or_normal(a))) {
+        return soft_float64_sqrt(a, status);
+    }
+    ua.s = a;
+    ur.h = sqrt(ua.h);
+    return ur.s;
+}
+
 /*----------------------------------------------------------------------------
 | Returns the binary log of the double-precision floating-point value `a'.
 | The operation is performed according to the IEC/IEEE Standard for Binary
@@ -48,6 +48,20 @@ static QemuOptsList qemu_fsdev_opts = {
 
         THROTTLE_OPTS,
 
+        {
+            .name = "throttling.iops-meta",
+            .type = QEMU_OPT_NUMBER,
+            .help = "limit metadata operations per second",
+        }, {
+            .name = "throttling.iops-meta-max",
+            .type = QEMU_OPT_NUMBER,
+            .help = "metadata operations burst",
+        }, {
+            .name = "throttling.iops-meta-max-length",
+            .type = QEMU_OPT_NUMBER,
+            .help = "length of the iops-meta-max burst period, in seconds",
+        },
+
         { /*End of list */ }
     },
 };
@@ -29,6 +29,12 @@ static void fsdev_throttle_write_timer_cb(void *opaque)
     qemu_co_enter_next(&fst->throttled_reqs[true]);
 }
 
+static void fsdev_throttle_meta_timer_cb(void *opaque)
+{
+    FsThrottle *fst = opaque;
+    qemu_co_enter_next(&fst->throttled_meta);
+}
+
 void fsdev_throttle_parse_opts(QemuOpts *opts, FsThrottle *fst, Error **errp)
 {
     throttle_config_init(&fst->cfg);
@@ -73,7 +79,19 @@ void fsdev_throttle_parse_opts(QemuOpts *opts, FsThrottle *fst, Error **errp)
     fst->cfg.op_size =
         qemu_opt_get_number(opts, "throttling.iops-size", 0);
 
-    throttle_is_valid(&fst->cfg, errp);
+    if (!throttle_is_valid(&fst->cfg, errp)) {
+        return;
+    }
+
+    throttle_config_init(&fst->meta_cfg);
+    fst->meta_cfg.buckets[THROTTLE_OPS_TOTAL].avg =
+        qemu_opt_get_number(opts, "throttling.iops-meta", 0);
+    fst->meta_cfg.buckets[THROTTLE_OPS_TOTAL].max =
+        qemu_opt_get_number(opts, "throttling.iops-meta-max", 0);
+    fst->meta_cfg.buckets[THROTTLE_OPS_TOTAL].burst_length =
+        qemu_opt_get_number(opts, "throttling.iops-meta-max-length", 1);
+
+    throttle_is_valid(&fst->meta_cfg, errp);
 }
 
 void fsdev_throttle_init(FsThrottle *fst)
@@ -90,6 +108,18 @@ void fsdev_throttle_init(FsThrottle *fst)
         qemu_co_queue_init(&fst->throttled_reqs[0]);
         qemu_co_queue_init(&fst->throttled_reqs[1]);
     }
+
+    if (throttle_enabled(&fst->meta_cfg)) {
+        throttle_init(&fst->meta_ts);
+        throttle_timers_init(&fst->meta_tt,
+                             qemu_get_aio_context(),
+                             QEMU_CLOCK_REALTIME,
+                             fsdev_throttle_meta_timer_cb,
+                             fsdev_throttle_meta_timer_cb,
+                             fst);
+        throttle_config(&fst->meta_ts, QEMU_CLOCK_REALTIME, &fst->meta_cfg);
+        qemu_co_queue_init(&fst->throttled_meta);
+    }
 }
 
 void coroutine_fn fsdev_co_throttle_request(FsThrottle *fst, bool is_write,
@@ -110,9 +140,33 @@ void coroutine_fn fsdev_co_throttle_request(FsThrottle *fst, bool is_write,
     }
 }
 
+/*
+ * Metadata requests are all accounted as one unit on the read side of
+ * meta_ts, whose only configured bucket is the total ops one.
+ */
+void coroutine_fn fsdev_co_throttle_meta(FsThrottle *fst)
+{
+    if (throttle_enabled(&fst->meta_cfg)) {
+        if (throttle_schedule_timer(&fst->meta_ts, &fst->meta_tt, false) ||
+            !qemu_co_queue_empty(&fst->throttled_meta)) {
+            qemu_co_queue_wait(&fst->throttled_meta, NULL);
+        }
+
+        throttle_account_units(&fst->meta_ts, false, 0, 1);
+
+        if (!qemu_co_queue_empty(&fst->throttled_meta) &&
+            !throttle_schedule_timer(&fst->meta_ts, &fst->meta_tt, false)) {
+            qemu_co_queue_next(&fst->throttled_meta);
+        }
+    }
+}
+
 void fsdev_throttle_cleanup(FsThrottle *fst)
 {
     if (throttle_enabled(&fst->cfg)) {
         throttle_timers_destroy(&fst->tt);
     }
+    if (throttle_enabled(&fst->meta_cfg)) {
+        throttle_timers_destroy(&fst->meta_tt);
+    }
 }
@@ -26,6 +26,11 @@ typedef struct FsThrottle {
     ThrottleTimers tt;
     ThrottleConfig cfg;
     CoQueue      throttled_reqs[2];
+    /* ops/s limit for requests that do not move file data */
+    ThrottleState meta_ts;
+    ThrottleTimers meta_tt;
+    ThrottleConfig meta_cfg;
+    CoQueue      throttled_meta;
 } FsThrottle;
 
 void fsdev_throttle_parse_opts(QemuOpts *, FsThrottle *, Error **);
@@ -35,5 +40,7 @@ void fsdev_throttle_init(FsThrottle *);
 void coroutine_fn fsdev_co_throttle_request(FsThrottle *, bool ,
                                             struct iovec *, int);
 
+void coroutine_fn fsdev_co_throttle_meta(FsThrottle *);
+
 void fsdev_throttle_cleanup(FsThrottle *);
 #endif /* _FSDEV_THROTTLE_H */
@@ -293,6 +293,24 @@ STEXI
 @item info opcount
 @findex info opcount
 Show dynamic compiler opcode counters
+ETEXI
+
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-hot",
+        .args_type  = "count:i?",
+        .params     = "[count]",
+        .help       = "show the most executed translation blocks",
+        .cmd        = hmp_info_tb_hot,
+    },
+#endif
+
+STEXI
+@item info tb-hot @var{count}
+@findex info tb-hot
+Show the @var{count} (default 10) translation blocks that have been
+executed the most, with their guest PC and execution count. Only
+available when QEMU is configured with @option{--enable-profiler}.
 ETEXI
 
     {
@@ -705,6 +723,21 @@ STEXI
 @item info iothreads
 @findex info iothreads
 Show iothread's identifiers.
+ETEXI
+
+    {
+        .name       = "exits",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show vCPU exit and MMIO access counters",
+        .cmd        = hmp_info_exits,
+    },
+
+STEXI
+@item info exits
+@findex info exits
+Show the number of vCPU exits and the time spent handling them by exit
+reason, and the memory regions with the most emulated accesses.
 ETEXI
 
     {
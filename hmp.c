@@ -229,6 +229,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, "dirty pages rate: %" PRIu64 " pages\n",
                            info->ram->dirty_pages_rate);
         }
+        if (info->ram->dirty_pages_rate_avg) {
+            monitor_printf(mon, "dirty pages rate average: %" PRIu64
+                           " pages\n", info->ram->dirty_pages_rate_avg);
+        }
         if (info->ram->postcopy_requests) {
             monitor_printf(mon, "postcopy request count: %" PRIu64 "\n",
                            info->ram->postcopy_requests);
@@ -345,6 +349,31 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %" PRIu64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE),
             params->xbzrle_cache_size);
+        assert(params->has_x_multifd_compression);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_COMPRESSION),
+            MultiFDCompression_str(params->x_multifd_compression));
+        assert(params->has_x_multifd_zlib_level);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_ZLIB_LEVEL),
+            params->x_multifd_zlib_level);
+        assert(params->has_x_multifd_zstd_level);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_ZSTD_LEVEL),
+            params->x_multifd_zstd_level);
+        assert(params->has_x_bitmap_sync_threads);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_BITMAP_SYNC_THREADS),
+            params->x_bitmap_sync_threads);
+        assert(params->has_x_postcopy_prefetch_pages);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(
+                MIGRATION_PARAMETER_X_POSTCOPY_PREFETCH_PAGES),
+            params->x_postcopy_prefetch_pages);
+        assert(params->has_x_load_threads);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_LOAD_THREADS),
+            params->x_load_threads);
     }
 
     qapi_free_MigrationParameters(params);
@@ -1659,6 +1688,31 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         }
         p->xbzrle_cache_size = cache_size;
         break;
+    case MIGRATION_PARAMETER_X_MULTIFD_COMPRESSION:
+        p->has_x_multifd_compression = true;
+        visit_type_MultiFDCompression(v, param, &p->x_multifd_compression,
+                                      &err);
+        break;
+    case MIGRATION_PARAMETER_X_MULTIFD_ZLIB_LEVEL:
+        p->has_x_multifd_zlib_level = true;
+        visit_type_int(v, param, &p->x_multifd_zlib_level, &err);
+        break;
+    case MIGRATION_PARAMETER_X_MULTIFD_ZSTD_LEVEL:
+        p->has_x_multifd_zstd_level = true;
+        visit_type_int(v, param, &p->x_multifd_zstd_level, &err);
+        break;
+    case MIGRATION_PARAMETER_X_BITMAP_SYNC_THREADS:
+        p->has_x_bitmap_sync_threads = true;
+        visit_type_int(v, param, &p->x_bitmap_sync_threads, &err);
+        break;
+    case MIGRATION_PARAMETER_X_POSTCOPY_PREFETCH_PAGES:
+        p->has_x_postcopy_prefetch_pages = true;
+        visit_type_int(v, param, &p->x_postcopy_prefetch_pages, &err);
+        break;
+    case MIGRATION_PARAMETER_X_LOAD_THREADS:
+        p->has_x_load_threads = true;
+        visit_type_int(v, param, &p->x_load_threads, &err);
+        break;
     default:
         assert(0);
     }
@@ -2203,7 +2257,8 @@ void hmp_nbd_server_start(Monitor *mon, const QDict *qdict)
             continue;
         }
 
-        qmp_nbd_server_add(info->value->device, true, writable, &local_err);
+        qmp_nbd_server_add(info->value->device, true, writable, false, NULL,
+                           &local_err);
 
         if (local_err != NULL) {
             qmp_nbd_server_stop(NULL);
@@ -2223,7 +2278,7 @@ void hmp_nbd_server_add(Monitor *mon, const QDict *qdict)
     bool writable = qdict_get_try_bool(qdict, "writable", false);
     Error *local_err = NULL;
 
-    qmp_nbd_server_add(device, true, writable, &local_err);
+    qmp_nbd_server_add(device, true, writable, false, NULL, &local_err);
 
     if (local_err != NULL) {
         hmp_handle_error(mon, &local_err);
@@ -2457,6 +2512,7 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
     IOThreadInfoList *info_list = qmp_query_iothreads(NULL);
     IOThreadInfoList *info;
     IOThreadInfo *value;
+    IOThreadPollHandlerInfoList *handler;
 
     for (info = info_list; info; info = info->next) {
         value = info->value;
@@ -2465,11 +2521,50 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-max-ns=%" PRId64 "\n", value->poll_max_ns);
         monitor_printf(mon, "  poll-grow=%" PRId64 "\n", value->poll_grow);
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
+        monitor_printf(mon, "  run-ns=%" PRId64 " idle-ns=%" PRId64 "\n",
+                       value->run_ns, value->idle_ns);
+        if (value->has_cpu_affinity) {
+            monitor_printf(mon, "  cpu-affinity=%s\n", value->cpu_affinity);
+        }
+        for (handler = value->poll_handlers; handler;
+             handler = handler->next) {
+            monitor_printf(mon, "  poll-handler fd=%" PRId64 " polls=%" PRIu64
+                           " hits=%" PRIu64 "\n", handler->value->fd,
+                           handler->value->polls, handler->value->hits);
+        }
     }
 
     qapi_free_IOThreadInfoList(info_list);
 }
 
+void hmp_info_exits(Monitor *mon, const QDict *qdict)
+{
+    ExitStats *stats = qmp_query_exit_stats(NULL);
+    ExitReasonStatsList *reason;
+    RegionAccessStatsList *region;
+
+    if (stats->exits) {
+        monitor_printf(mon, "%-20s %12s %12s %10s\n",
+                       "exit reason", "count", "time (us)", "avg (ns)");
+    }
+    for (reason = stats->exits; reason; reason = reason->next) {
+        monitor_printf(mon, "%-20s %12" PRId64 " %12" PRId64 " %10" PRId64
+                       "\n", reason->value->reason, reason->value->count,
+                       reason->value->time_ns / 1000,
+                       reason->value->time_ns / reason->value->count);
+    }
+
+    if (stats->regions) {
+        monitor_printf(mon, "%-32s %12s\n", "memory region", "accesses");
+    }
+    for (region = stats->regions; region; region = region->next) {
+        monitor_printf(mon, "%-32s %12" PRId64 "\n", region->value->name,
+                       region->value->count);
+    }
+
+    qapi_free_ExitStats(stats);
+}
+
 void hmp_qom_list(Monitor *mon, const QDict *qdict)
 {
     const char *path = qdict_get_try_str(qdict, "path");
@@ -1281,6 +1281,46 @@ static bool not_same_qid(const V9fsQID *qid1, const V9fsQID *qid2)
         qid1->path != qid2->path;
 }
 
+/*
+ * Resolve and stat the @nwnames components of a walk starting at @dpath,
+ * whose qid is *@qid, with a single trip to the worker thread instead of
+ * one per component.  On return @path and *@qid describe the last
+ * component resolved, and qids[] holds the qid of each of them.
+ */
+static int coroutine_fn v9fs_co_walk_names(V9fsPDU *pdu, V9fsPath *dpath,
+                                           V9fsPath *path, V9fsQID *qid,
+                                           V9fsString *wnames,
+                                           uint16_t nwnames, V9fsQID *qids)
+{
+    V9fsState *s = pdu->s;
+    struct stat stbuf;
+    int i, err = 0;
+
+    if (v9fs_request_cancelled(pdu)) {
+        return -EINTR;
+    }
+    v9fs_path_read_lock(s);
+    v9fs_co_run_in_worker(
+        {
+            for (i = 0; i < nwnames; i++) {
+                if (not_same_qid(&s->root_qid, qid) ||
+                    strcmp("..", wnames[i].data)) {
+                    if (s->ops->name_to_path(&s->ctx, dpath, wnames[i].data,
+                                             path) < 0 ||
+                        s->ops->lstat(&s->ctx, path, &stbuf) < 0) {
+                        err = -errno;
+                        break;
+                    }
+                    stat_to_qid(&stbuf, qid);
+                    v9fs_path_copy(dpath, path);
+                }
+                memcpy(&qids[i], qid, sizeof(*qid));
+            }
+        });
+    v9fs_path_unlock(s);
+    return err;
+}
+
 static void coroutine_fn v9fs_walk(void *opaque)
 {
     int name_idx;
@@ -1288,7 +1328,6 @@ static void coroutine_fn v9fs_walk(void *opaque)
     int i, err = 0;
     V9fsPath dpath, path;
     uint16_t nwnames;
-    struct stat stbuf;
     size_t offset = 7;
     int32_t fid, newfid;
     V9fsString *wnames = NULL;
@@ -1345,23 +1384,12 @@ static void coroutine_fn v9fs_walk(void *opaque)
      */
     v9fs_path_copy(&dpath, &fidp->path);
     v9fs_path_copy(&path, &fidp->path);
-    for (name_idx = 0; name_idx < nwnames; name_idx++) {
-        if (not_same_qid(&pdu->s->root_qid, &qid) ||
-            strcmp("..", wnames[name_idx].data)) {
-            err = v9fs_co_name_to_path(pdu, &dpath, wnames[name_idx].data,
-                                       &path);
-            if (err < 0) {
-                goto out;
-            }
-
-            err = v9fs_co_lstat(pdu, &path, &stbuf);
-            if (err < 0) {
-                goto out;
-            }
-            stat_to_qid(&stbuf, &qid);
-            v9fs_path_copy(&dpath, &path);
+    if (nwnames) {
+        err = v9fs_co_walk_names(pdu, &dpath, &path, &qid, wnames, nwnames,
+                                 qids);
+        if (err < 0) {
+            goto out;
         }
-        memcpy(&qids[name_idx], &qid, sizeof(qid));
     }
     if (fid == newfid) {
         if (fidp->fid_type != P9_FID_NONE) {
@@ -1869,15 +1897,6 @@ out_nofid:
     pdu_complete(pdu, err);
 }
 
-static size_t v9fs_readdir_data_size(V9fsString *name)
-{
-    /*
-     * Size of each dirent on the wire: size of qid (13) + size of offset (8)
-     * size of type (1) + size of name.size (2) + strlen(name.data)
-     */
-    return 24 + v9fs_string_size(name);
-}
-
 static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
                                         int32_t max_count)
 {
@@ -1886,32 +1905,21 @@ static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
     V9fsString name;
     int len, err = 0;
     int32_t count = 0;
-    off_t saved_dir_pos;
+    V9fsDirEnt *entries, *e;
     struct dirent *dent;
 
-    /* save the directory position */
-    saved_dir_pos = v9fs_co_telldir(pdu, fidp);
-    if (saved_dir_pos < 0) {
-        return saved_dir_pos;
+    /* Fetch all the entries that fit in the reply in one go */
+    err = v9fs_co_readdir_many(pdu, fidp, &entries, max_count);
+    if (err < 0) {
+        v9fs_free_dirents(entries);
+        return err;
     }
+    err = 0;
 
-    while (1) {
-        v9fs_readdir_lock(&fidp->fs.dir);
-
-        err = v9fs_co_readdir(pdu, fidp, &dent);
-        if (err || !dent) {
-            break;
-        }
+    for (e = entries; e; e = e->next) {
+        dent = e->dent;
         v9fs_string_init(&name);
         v9fs_string_sprintf(&name, "%s", dent->d_name);
-        if ((count + v9fs_readdir_data_size(&name)) > max_count) {
-            v9fs_readdir_unlock(&fidp->fs.dir);
-
-            /* Ran out of buffer. Set dir back to old position and return */
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_string_free(&name);
-            return count;
-        }
         /*
          * Fill up just the path field of qid because the client uses
          * only that. To fill the entire qid structure we will have
@@ -1927,21 +1935,16 @@ static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
         len = pdu_marshal(pdu, 11 + count, "Qqbs",
                           &qid, dent->d_off,
                           dent->d_type, &name);
-
-        v9fs_readdir_unlock(&fidp->fs.dir);
+        v9fs_string_free(&name);
 
         if (len < 0) {
-            v9fs_co_seekdir(pdu, fidp, saved_dir_pos);
-            v9fs_string_free(&name);
-            return len;
+            err = len;
+            break;
         }
         count += len;
-        v9fs_string_free(&name);
-        saved_dir_pos = dent->d_off;
     }
 
-    v9fs_readdir_unlock(&fidp->fs.dir);
-
+    v9fs_free_dirents(entries);
     if (err < 0) {
         return err;
     }
@@ -3460,6 +3463,32 @@ static inline bool is_read_only_op(V9fsPDU *pdu)
     }
 }
 
+/*
+ * Requests other than data transfer and fid or session bookkeeping; these
+ * are subject to the fsdev metadata ops/s limit.
+ */
+static inline bool is_meta_op(V9fsPDU *pdu)
+{
+    switch (pdu->id) {
+    case P9_TREAD:
+    case P9_TWRITE:
+    case P9_TVERSION:
+    case P9_TFLUSH:
+    case P9_TCLUNK:
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+static void coroutine_fn v9fs_meta_op(void *opaque)
+{
+    V9fsPDU *pdu = opaque;
+
+    fsdev_co_throttle_meta(pdu->s->ctx.fst);
+    pdu_co_handlers[pdu->id](opaque);
+}
+
 void pdu_submit(V9fsPDU *pdu, P9MsgHeader *hdr)
 {
     Coroutine *co;
@@ -3475,6 +3504,9 @@ void pdu_submit(V9fsPDU *pdu, P9MsgHeader *hdr)
         handler = v9fs_op_not_supp;
     } else if (is_ro_export(&s->ctx) && !is_read_only_op(pdu)) {
         handler = v9fs_fs_ro;
+    } else if (is_meta_op(pdu) &&
+               throttle_enabled(&s->ctx.fst->meta_cfg)) {
+        handler = v9fs_meta_op;
     } else {
         handler = pdu_co_handlers[pdu->id];
     }
@@ -42,6 +42,99 @@ int coroutine_fn v9fs_co_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
     return err;
 }
 
+/*
+ * Size of each dirent on the wire: size of qid (13) + size of offset (8)
+ * size of type (1) + size of name.size (2) + strlen(name.data)
+ */
+#define V9FS_READDIR_ENTRY_SIZE(name_len) (24 + (name_len))
+
+/*
+ * Called in the worker thread.  Reads entries until the next one would not
+ * fit in @maxsize bytes of reply, and puts that one back.
+ */
+static int do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
+                           V9fsDirEnt **entries, int32_t maxsize)
+{
+    V9fsState *s = pdu->s;
+    V9fsDirEnt *e, **tail = entries;
+    struct dirent *dent;
+    off_t saved_dir_pos;
+    int32_t size = 0;
+    size_t len, dent_size;
+
+    saved_dir_pos = s->ops->telldir(&s->ctx, &fidp->fs);
+    if (saved_dir_pos < 0) {
+        return -errno;
+    }
+
+    while (1) {
+        errno = 0;
+        dent = s->ops->readdir(&s->ctx, &fidp->fs);
+        if (!dent) {
+            if (errno) {
+                return -errno;
+            }
+            break;
+        }
+
+        len = strlen(dent->d_name);
+        if (size + V9FS_READDIR_ENTRY_SIZE(len) > maxsize) {
+            /* Ran out of buffer. Set dir back to old position and return */
+            s->ops->seekdir(&s->ctx, &fidp->fs, saved_dir_pos);
+            break;
+        }
+
+        /* dent is only valid until the next readdir, keep a copy */
+        dent_size = offsetof(struct dirent, d_name) + len + 1;
+        e = g_new(V9fsDirEnt, 1);
+        e->dent = g_malloc0(MAX(dent_size, sizeof(struct dirent)));
+        memcpy(e->dent, dent, dent_size);
+        e->next = NULL;
+        *tail = e;
+        tail = &e->next;
+
+        size += V9FS_READDIR_ENTRY_SIZE(len);
+        saved_dir_pos = dent->d_off;
+    }
+    return size;
+}
+
+/*
+ * Read as many directory entries as fit in @maxsize bytes of Rreaddir
+ * reply with a single trip to the worker thread, rather than one trip per
+ * entry.  Returns the size of the entries on the wire or a negative errno;
+ * the entries in *@entries must be freed with v9fs_free_dirents() in
+ * either case.
+ */
+int coroutine_fn v9fs_co_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
+                                      V9fsDirEnt **entries, int32_t maxsize)
+{
+    int err;
+
+    *entries = NULL;
+    if (v9fs_request_cancelled(pdu)) {
+        return -EINTR;
+    }
+    v9fs_readdir_lock(&fidp->fs.dir);
+    v9fs_co_run_in_worker(
+        {
+            err = do_readdir_many(pdu, fidp, entries, maxsize);
+        });
+    v9fs_readdir_unlock(&fidp->fs.dir);
+    return err;
+}
+
+void v9fs_free_dirents(V9fsDirEnt *e)
+{
+    V9fsDirEnt *next;
+
+    for (; e; e = next) {
+        next = e->next;
+        g_free(e->dent);
+        g_free(e);
+    }
+}
+
 off_t v9fs_co_telldir(V9fsPDU *pdu, V9fsFidState *fidp)
 {
     off_t err;
@@ -47,9 +47,18 @@
         qemu_coroutine_yield();                                         \
     } while (0)
 
+/* Directory entries copied out of the backend by v9fs_co_readdir_many() */
+typedef struct V9fsDirEnt {
+    struct dirent *dent;
+    struct V9fsDirEnt *next;
+} V9fsDirEnt;
+
 void co_run_in_worker_bh(void *);
 int coroutine_fn v9fs_co_readlink(V9fsPDU *, V9fsPath *, V9fsString *);
 int coroutine_fn v9fs_co_readdir(V9fsPDU *, V9fsFidState *, struct dirent **);
+int coroutine_fn v9fs_co_readdir_many(V9fsPDU *, V9fsFidState *,
+                                      V9fsDirEnt **, int32_t);
+void v9fs_free_dirents(V9fsDirEnt *);
 off_t coroutine_fn v9fs_co_telldir(V9fsPDU *, V9fsFidState *);
 void coroutine_fn v9fs_co_seekdir(V9fsPDU *, V9fsFidState *, off_t);
 void coroutine_fn v9fs_co_rewinddir(V9fsPDU *, V9fsFidState *);
@@ -19,6 +19,7 @@
 #include "coth.h"
 #include "hw/virtio/virtio-access.h"
 #include "qemu/iov.h"
+#include "qemu/main-loop.h"
 
 static void virtio_9p_push_and_notify(V9fsPDU *pdu)
 {
@@ -31,7 +32,17 @@ static void virtio_9p_push_and_notify(V9fsPDU *pdu)
     g_free(elem);
     v->elems[pdu->idx] = NULL;
 
-    /* FIXME: we should batch these completions */
+    /*
+     * Requests that complete in the same main loop iteration share one
+     * interrupt.
+     */
+    qemu_bh_schedule(v->notify_bh);
+}
+
+static void virtio_9p_notify_bh(void *opaque)
+{
+    V9fsVirtioState *v = opaque;
+
     virtio_notify(VIRTIO_DEVICE(v), v->vq);
 }
 
@@ -107,6 +118,7 @@ static void virtio_9p_reset(VirtIODevice *vdev)
     V9fsVirtioState *v = (V9fsVirtioState *)vdev;
 
     v9fs_reset(&v->state);
+    qemu_bh_cancel(v->notify_bh);
 }
 
 static ssize_t virtio_pdu_vmarshal(V9fsPDU *pdu, size_t offset,
@@ -205,6 +217,7 @@ static void virtio_9p_device_realize(DeviceState *dev, Error **errp)
     v->config_size = sizeof(struct virtio_9p_config) + strlen(s->fsconf.tag);
     virtio_init(vdev, "virtio-9p", VIRTIO_ID_9P, v->config_size);
     v->vq = virtio_add_queue(vdev, MAX_REQ, handle_9p_output);
+    v->notify_bh = qemu_bh_new(virtio_9p_notify_bh, v);
     v9fs_register_transport(s, &virtio_9p_transport);
 
 out:
@@ -217,6 +230,7 @@ static void virtio_9p_device_unrealize(DeviceState *dev, Error **errp)
     V9fsVirtioState *v = VIRTIO_9P(dev);
     V9fsState *s = &v->state;
 
+    qemu_bh_delete(v->notify_bh);
     virtio_cleanup(vdev);
     v9fs_device_unrealize_common(s, errp);
 }
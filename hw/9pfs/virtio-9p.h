@@ -9,6 +9,7 @@ typedef struct V9fsVirtioState
 {
     VirtIODevice parent_obj;
     VirtQueue *vq;
+    QEMUBH *notify_bh;
     size_t config_size;
     VirtQueueElement *elems[MAX_REQ];
     V9fsState state;
@@ -45,6 +45,9 @@
             " in %s: " fmt "\n", __func__, ## __VA_ARGS__); \
     } while (0)
 
+/* Number of submission queue entries fetched with a single DMA read */
+#define NVME_SQE_BATCH 16
+
 static void nvme_process_sq(void *opaque);
 
 static void nvme_addr_read(NvmeCtrl *n, hwaddr addr, void *buf, int size)
@@ -91,6 +94,49 @@ static uint8_t nvme_sq_empty(NvmeSQueue *sq)
     return sq->head == sq->tail;
 }
 
+/*
+ * Shadow doorbells (Doorbell Buffer Config): the guest writes the new
+ * queue tail or head to host memory and only rings the MMIO doorbell when
+ * it moves past the EventIdx that we publish, so a busy queue costs no
+ * exits at all.  The shadow value is always at least as recent as the
+ * last MMIO write.
+ */
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    uint32_t v;
+
+    pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &v, sizeof(v));
+    v = le32_to_cpu(v);
+    if (likely(v < sq->size)) {
+        sq->tail = v;
+    }
+}
+
+static void nvme_update_sq_eventidx(NvmeSQueue *sq)
+{
+    uint32_t v = cpu_to_le32(sq->tail);
+
+    pci_dma_write(&sq->ctrl->parent_obj, sq->ei_addr, &v, sizeof(v));
+}
+
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    uint32_t v;
+
+    pci_dma_read(&cq->ctrl->parent_obj, cq->db_addr, &v, sizeof(v));
+    v = le32_to_cpu(v);
+    if (likely(v < cq->size)) {
+        cq->head = v;
+    }
+}
+
+static void nvme_update_cq_eventidx(NvmeCQueue *cq)
+{
+    uint32_t v = cpu_to_le32(cq->head);
+
+    pci_dma_write(&cq->ctrl->parent_obj, cq->ei_addr, &v, sizeof(v));
+}
+
 static void nvme_isr_notify(NvmeCtrl *n, NvmeCQueue *cq)
 {
     if (cq->irq_enabled) {
@@ -223,6 +269,11 @@ static void nvme_post_cqes(void *opaque)
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
 
+    if (cq->db_addr) {
+        nvme_update_cq_head(cq);
+        nvme_update_cq_eventidx(cq);
+    }
+
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
@@ -250,7 +301,7 @@ static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
     assert(cq->cqid == req->sq->cqid);
     QTAILQ_REMOVE(&req->sq->out_req_list, req, entry);
     QTAILQ_INSERT_TAIL(&cq->req_list, req, entry);
-    timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    qemu_bh_schedule(cq->bh);
 }
 
 static void nvme_rw_cb(void *opaque, int ret)
@@ -385,8 +436,7 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
-    timer_del(sq->timer);
-    timer_free(sq->timer);
+    qemu_bh_delete(sq->bh);
     g_free(sq->io_req);
     if (sq->sqid) {
         g_free(sq);
@@ -451,7 +501,12 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    sq->bh = qemu_bh_new(nvme_process_sq, sq);
+    sq->db_addr = sq->ei_addr = 0;
+    if (sqid && n->dbbuf_dbs) {
+        sq->db_addr = n->dbbuf_dbs + (sqid << 3);
+        sq->ei_addr = n->dbbuf_eis + (sqid << 3);
+    }
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
@@ -500,8 +555,7 @@ static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     n->cq[cq->cqid] = NULL;
-    timer_del(cq->timer);
-    timer_free(cq->timer);
+    qemu_bh_delete(cq->bh);
     msix_vector_unuse(&n->parent_obj, cq->vector);
     if (cq->cqid) {
         g_free(cq);
@@ -544,7 +598,12 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     QTAILQ_INIT(&cq->sq_list);
     msix_vector_use(&n->parent_obj, cq->vector);
     n->cq[cqid] = cq;
-    cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    cq->bh = qemu_bh_new(nvme_post_cqes, cq);
+    cq->db_addr = cq->ei_addr = 0;
+    if (cqid && n->dbbuf_dbs) {
+        cq->db_addr = n->dbbuf_dbs + (cqid << 3) + (1 << 2);
+        cq->ei_addr = n->dbbuf_eis + (cqid << 3) + (1 << 2);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -709,6 +768,48 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     return NVME_SUCCESS;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, NvmeCmd *cmd)
+{
+    uint64_t dbs_addr = le64_to_cpu(cmd->prp1);
+    uint64_t eis_addr = le64_to_cpu(cmd->prp2);
+    uint32_t v;
+    int i;
+
+    if (unlikely(!dbs_addr || dbs_addr & (n->page_size - 1) ||
+                 !eis_addr || eis_addr & (n->page_size - 1))) {
+        trace_nvme_err_invalid_dbbuf_config(dbs_addr, eis_addr);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    trace_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+
+    /*
+     * CAP.DSTRD is 0, so the shadow doorbells use the same layout as the
+     * MMIO ones.  The admin queue keeps using MMIO doorbells.
+     */
+    for (i = 1; i < n->num_queues; i++) {
+        NvmeSQueue *sq = n->sq[i];
+        NvmeCQueue *cq = n->cq[i];
+
+        if (sq) {
+            sq->db_addr = dbs_addr + (i << 3);
+            sq->ei_addr = eis_addr + (i << 3);
+            v = cpu_to_le32(sq->tail);
+            pci_dma_write(&n->parent_obj, sq->db_addr, &v, sizeof(v));
+        }
+        if (cq) {
+            cq->db_addr = dbs_addr + (i << 3) + (1 << 2);
+            cq->ei_addr = eis_addr + (i << 3) + (1 << 2);
+            v = cpu_to_le32(cq->head);
+            pci_dma_write(&n->parent_obj, cq->db_addr, &v, sizeof(v));
+        }
+    }
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 {
     switch (cmd->opcode) {
@@ -726,6 +827,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         return nvme_set_feature(n, cmd, req);
     case NVME_ADM_CMD_GET_FEATURES:
         return nvme_get_feature(n, cmd, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, cmd);
     default:
         trace_nvme_err_invalid_admin_opc(cmd->opcode);
         return NVME_INVALID_OPCODE | NVME_DNR;
@@ -740,25 +843,54 @@ static void nvme_process_sq(void *opaque)
 
     uint16_t status;
     hwaddr addr;
-    NvmeCmd cmd;
+    NvmeCmd cmds[NVME_SQE_BATCH];
     NvmeRequest *req;
+    uint32_t nr, i;
+
+    if (sq->db_addr) {
+        nvme_update_sq_tail(sq);
+    }
 
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
+        /*
+         * Fetch as many entries as are available up to the end of the
+         * ring.  If we run out of free requests the rest are simply
+         * fetched again on the next pass.
+         */
+        nr = (sq->tail > sq->head ? sq->tail : sq->size) - sq->head;
+        if (n->sqe_size != sizeof(NvmeCmd)) {
+            nr = 1;
+        }
+        nr = MIN(nr, NVME_SQE_BATCH);
+
         addr = sq->dma_addr + sq->head * n->sqe_size;
-        nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd));
-        nvme_inc_sq_head(sq);
-
-        req = QTAILQ_FIRST(&sq->req_list);
-        QTAILQ_REMOVE(&sq->req_list, req, entry);
-        QTAILQ_INSERT_TAIL(&sq->out_req_list, req, entry);
-        memset(&req->cqe, 0, sizeof(req->cqe));
-        req->cqe.cid = cmd.cid;
-
-        status = sq->sqid ? nvme_io_cmd(n, &cmd, req) :
-            nvme_admin_cmd(n, &cmd, req);
-        if (status != NVME_NO_COMPLETE) {
-            req->status = status;
-            nvme_enqueue_req_completion(cq, req);
+        nvme_addr_read(n, addr, (void *)cmds, nr * sizeof(NvmeCmd));
+
+        for (i = 0; i < nr && !QTAILQ_EMPTY(&sq->req_list); i++) {
+            nvme_inc_sq_head(sq);
+
+            req = QTAILQ_FIRST(&sq->req_list);
+            QTAILQ_REMOVE(&sq->req_list, req, entry);
+            QTAILQ_INSERT_TAIL(&sq->out_req_list, req, entry);
+            memset(&req->cqe, 0, sizeof(req->cqe));
+            req->cqe.cid = cmds[i].cid;
+
+            status = sq->sqid ? nvme_io_cmd(n, &cmds[i], req) :
+                nvme_admin_cmd(n, &cmds[i], req);
+            if (status != NVME_NO_COMPLETE) {
+                req->status = status;
+                nvme_enqueue_req_completion(cq, req);
+            }
+        }
+
+        if (sq->db_addr) {
+            /*
+             * Publish the tail we have consumed, then look again so that
+             * an entry written before the guest saw the new EventIdx is
+             * not missed.
+             */
+            nvme_update_sq_eventidx(sq);
+            nvme_update_sq_tail(sq);
         }
     }
 }
@@ -779,6 +911,7 @@ static void nvme_clear_ctrl(NvmeCtrl *n)
     }
 
     blk_flush(n->conf.blk);
+    n->dbbuf_dbs = n->dbbuf_eis = 0;
     n->bar.cc = 0;
 }
 
@@ -1080,9 +1213,9 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         if (start_sqs) {
             NvmeSQueue *sq;
             QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
-                timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+                qemu_bh_schedule(sq->bh);
             }
-            timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+            qemu_bh_schedule(cq->bh);
         }
 
         if (cq->tail != cq->head) {
@@ -1114,7 +1247,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         }
 
         sq->tail = new_tail;
-        timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        qemu_bh_schedule(sq->bh);
     }
 }
 
@@ -1217,6 +1350,7 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
         PCI_BASE_ADDRESS_SPACE_MEMORY | PCI_BASE_ADDRESS_MEM_TYPE_64,
         &n->iomem);
     msix_init_exclusive_bar(&n->parent_obj, n->num_queues, 4, NULL);
+    address_space_enable_iommu_cache(pci_get_address_space(pci_dev));
 
     id->vid = cpu_to_le16(pci_get_word(pci_conf + PCI_VENDOR_ID));
     id->ssvid = cpu_to_le16(pci_get_word(pci_conf + PCI_SUBSYSTEM_VENDOR_ID));
@@ -1227,7 +1361,7 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
     id->ieee[0] = 0x00;
     id->ieee[1] = 0x02;
     id->ieee[2] = 0xb3;
-    id->oacs = cpu_to_le16(0);
+    id->oacs = cpu_to_le16(NVME_OACS_DBBUF);
     id->frmw = 7 << 1;
     id->lpa = 1 << 0;
     id->sqes = (0x6 << 4) | 0x6;
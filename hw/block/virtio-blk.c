@@ -199,14 +199,17 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
+static unsigned int virtio_blk_get_requests(VirtIOBlock *s, VirtQueue *vq,
+                                            VirtIOBlockReq **reqs,
+                                            unsigned int max)
 {
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
+    unsigned int i, n;
 
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
+    n = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq), (void **)reqs, max);
+    for (i = 0; i < n; i++) {
+        virtio_blk_init_request(s, vq, reqs[i]);
     }
-    return req;
+    return n;
 }
 
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
@@ -594,7 +597,8 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
 bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtIOBlockReq *reqs[VIRTQUEUE_POP_BATCH];
+    unsigned int i, n;
     MultiReqBuffer mrb = {};
     bool progress = false;
 
@@ -602,14 +606,20 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
     blk_io_plug(s->blk);
 
     do {
+        bool failed = false;
+
         virtio_queue_set_notification(vq, 0);
 
-        while ((req = virtio_blk_get_request(s, vq))) {
+        while (!failed &&
+               (n = virtio_blk_get_requests(s, vq, reqs, ARRAY_SIZE(reqs)))) {
             progress = true;
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
-                break;
+            for (i = 0; i < n; i++) {
+                /* Drop the rest of the batch along with the bad request */
+                if (failed || virtio_blk_handle_request(reqs[i], &mrb)) {
+                    virtqueue_detach_element(reqs[i]->vq, &reqs[i]->elem, 0);
+                    virtio_blk_free_request(reqs[i]);
+                    failed = true;
+                }
             }
         }
 
@@ -862,7 +872,7 @@ static void virtio_blk_save_device(VirtIODevice *vdev, QEMUFile *f)
             qemu_put_be32(f, virtio_get_queue_index(req->vq));
         }
 
-        qemu_put_virtqueue_element(f, &req->elem);
+        qemu_put_virtqueue_element(vdev, f, &req->elem);
         req = req->next;
     }
     qemu_put_sbyte(f, 0);
@@ -973,6 +983,13 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    /*
+     * Each request runs in a coroutine; reserve pool space for half of the
+     * descriptors, as requests take at least two of them.
+     */
+    qemu_coroutine_increase_pool_batch_size(conf->num_queues *
+                                            conf->queue_size / 2);
+
     s->change = qemu_add_vm_change_state_handler(virtio_blk_dma_restart_cb, s);
     blk_set_dev_ops(s->blk, &virtio_block_ops, s);
     blk_set_guest_block_size(s->blk, s->conf.conf.logical_block_size);
@@ -984,7 +1001,10 @@ static void virtio_blk_device_unrealize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBlock *s = VIRTIO_BLK(dev);
+    VirtIOBlkConf *conf = &s->conf;
 
+    qemu_coroutine_decrease_pool_batch_size(conf->num_queues *
+                                            conf->queue_size / 2);
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
     qemu_del_vm_change_state_handler(s->change);
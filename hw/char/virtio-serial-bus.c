@@ -154,6 +154,122 @@ static void discard_throttle_data(VirtIOSerialPort *port)
     }
 }
 
+/* Limits on what is handed to have_datav() in one call */
+#define FLUSH_BATCH_ELEMS   32
+#define FLUSH_BATCH_IOV     64
+
+/*
+ * Mark @done bytes of port->elem, starting at iov_idx/iov_offset, as
+ * written.  Returns true if the element is finished, with *done reduced
+ * by what it took.
+ */
+static bool port_elem_consume(VirtIOSerialPort *port, size_t *done)
+{
+    while (port->iov_idx < port->elem->out_num) {
+        size_t left = port->elem->out_sg[port->iov_idx].iov_len
+                      - port->iov_offset;
+
+        if (*done < left) {
+            port->iov_offset += *done;
+            *done = 0;
+            return false;
+        }
+        *done -= left;
+        port->iov_idx++;
+        port->iov_offset = 0;
+    }
+    return true;
+}
+
+/*
+ * Hand the rest of port->elem and as many queued elements as fit to the
+ * port in one go.  Elements that were popped but not written at all are
+ * given back to the ring, so port->elem stays the only one in flight and
+ * the migration format does not change.
+ */
+static void do_flush_queued_data_batched(VirtIOSerialPort *port,
+                                         VirtQueue *vq, VirtIODevice *vdev)
+{
+    VirtIOSerialPortClass *vsc = VIRTIO_SERIAL_PORT_GET_CLASS(port);
+    VirtQueueElement *batch[FLUSH_BATCH_ELEMS];
+    struct iovec iov[FLUSH_BATCH_IOV];
+    unsigned int i, n, nbatch, niov;
+    size_t len, done;
+    ssize_t ret;
+
+    while (!port->throttled) {
+        if (!port->elem) {
+            port->elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
+            if (!port->elem) {
+                break;
+            }
+            port->iov_idx = 0;
+            port->iov_offset = 0;
+        }
+
+        niov = 0;
+        len = 0;
+        for (i = port->iov_idx;
+             i < port->elem->out_num && niov < FLUSH_BATCH_IOV; i++) {
+            size_t offset = i == port->iov_idx ? port->iov_offset : 0;
+
+            iov[niov].iov_base = port->elem->out_sg[i].iov_base + offset;
+            iov[niov].iov_len = port->elem->out_sg[i].iov_len - offset;
+            len += iov[niov++].iov_len;
+        }
+
+        nbatch = 0;
+        while (i == port->elem->out_num && nbatch < FLUSH_BATCH_ELEMS) {
+            VirtQueueElement *elem = virtqueue_pop(vq,
+                                                   sizeof(VirtQueueElement));
+            if (!elem) {
+                break;
+            }
+            if (niov + elem->out_num > FLUSH_BATCH_IOV) {
+                virtqueue_unpop(vq, elem, 0);
+                g_free(elem);
+                break;
+            }
+            for (n = 0; n < elem->out_num; n++) {
+                iov[niov++] = elem->out_sg[n];
+                len += elem->out_sg[n].iov_len;
+            }
+            batch[nbatch++] = elem;
+        }
+
+        ret = vsc->have_datav(port, iov, niov);
+        if (!port->elem) { /* bail if we got disconnected */
+            for (n = 0; n < nbatch; n++) {
+                virtqueue_push(vq, batch[n], 0);
+                g_free(batch[n]);
+            }
+            virtio_notify(vdev, vq);
+            return;
+        }
+
+        /* Unless throttled, everything counts as consumed */
+        done = !port->throttled ? len : ret > 0 ? ret : 0;
+        n = 0;
+        while (port->elem && port_elem_consume(port, &done)) {
+            virtqueue_push(vq, port->elem, 0);
+            g_free(port->elem);
+            port->elem = NULL;
+            if (n < nbatch) {
+                port->elem = batch[n++];
+                port->iov_idx = 0;
+                port->iov_offset = 0;
+            }
+        }
+
+        /* Give back what was not written, last popped first */
+        while (nbatch > n) {
+            virtqueue_unpop(vq, batch[--nbatch], 0);
+            g_free(batch[nbatch]);
+        }
+    }
+    virtio_notify(vdev, vq);
+}
+
 static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
                                  VirtIODevice *vdev)
 {
@@ -164,6 +280,11 @@ static void do_flush_queued_data(VirtIOSerialPort *port, VirtQueue *vq,
 
     vsc = VIRTIO_SERIAL_PORT_GET_CLASS(port);
 
+    if (vsc->have_datav) {
+        do_flush_queued_data_batched(port, vq, vdev);
+        return;
+    }
+
     while (!port->throttled) {
         unsigned int i;
 
@@ -701,7 +822,7 @@ static void virtio_serial_save_device(VirtIODevice *vdev, QEMUFile *f)
         if (elem_popped) {
             qemu_put_be32s(f, &port->iov_idx);
             qemu_put_be64s(f, &port->iov_offset);
-            qemu_put_virtqueue_element(f, port->elem);
+            qemu_put_virtqueue_element(vdev, f, port->elem);
         }
     }
 }
@@ -102,6 +102,37 @@ static void machine_set_kvm_shadow_mem(Object *obj, Visitor *v,
     ms->kvm_shadow_mem = value;
 }
 
+static void machine_get_kvm_dirty_ring_size(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    uint32_t value = ms->kvm_dirty_ring_size;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void machine_set_kvm_dirty_ring_size(Object *obj, Visitor *v,
+                                            const char *name, void *opaque,
+                                            Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+    Error *error = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &error);
+    if (error) {
+        error_propagate(errp, error);
+        return;
+    }
+    if (value & (value - 1)) {
+        error_setg(errp, "kvm-dirty-ring-size must be a power of two");
+        return;
+    }
+
+    ms->kvm_dirty_ring_size = value;
+}
+
 static char *machine_get_kernel(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -247,6 +278,21 @@ static void machine_set_mem_merge(Object *obj, bool value, Error **errp)
     ms->mem_merge = value;
 }
 
+static bool machine_get_numa_vcpu_affinity(Object *obj, Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    return ms->numa_vcpu_affinity;
+}
+
+static void machine_set_numa_vcpu_affinity(Object *obj, bool value,
+                                           Error **errp)
+{
+    MachineState *ms = MACHINE(obj);
+
+    ms->numa_vcpu_affinity = value;
+}
+
 static bool machine_get_usb(Object *obj, Error **errp)
 {
     MachineState *ms = MACHINE(obj);
@@ -532,6 +578,13 @@ static void machine_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "kvm-shadow-mem",
         "KVM shadow MMU size", &error_abort);
 
+    object_class_property_add(oc, "kvm-dirty-ring-size", "uint32",
+        machine_get_kvm_dirty_ring_size, machine_set_kvm_dirty_ring_size,
+        NULL, NULL, &error_abort);
+    object_class_property_set_description(oc, "kvm-dirty-ring-size",
+        "Entries in each KVM per-vCPU dirty ring (0 = use dirty bitmaps)",
+        &error_abort);
+
     object_class_property_add_str(oc, "kernel",
         machine_get_kernel, machine_set_kernel, &error_abort);
     object_class_property_set_description(oc, "kernel",
@@ -579,6 +632,13 @@ static void machine_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "mem-merge",
         "Enable/disable memory merge support", &error_abort);
 
+    object_class_property_add_bool(oc, "numa-vcpu-affinity",
+        machine_get_numa_vcpu_affinity, machine_set_numa_vcpu_affinity,
+        &error_abort);
+    object_class_property_set_description(oc, "numa-vcpu-affinity",
+        "Run the vCPUs of each NUMA node on the host nodes of its memdev",
+        &error_abort);
+
     object_class_property_add_bool(oc, "usb",
         machine_get_usb, machine_set_usb, &error_abort);
     object_class_property_set_description(oc, "usb",
@@ -679,6 +739,11 @@ int machine_kvm_shadow_mem(MachineState *machine)
     return machine->kvm_shadow_mem;
 }
 
+uint32_t machine_kvm_dirty_ring_size(MachineState *machine)
+{
+    return machine->kvm_dirty_ring_size;
+}
+
 int machine_phandle_start(MachineState *machine)
 {
     return machine->phandle_start;
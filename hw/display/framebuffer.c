@@ -103,6 +103,12 @@ void framebuffer_update_display(
 
     snap = memory_region_snapshot_and_clear_dirty(mem, addr, src_width * rows,
                                                   DIRTY_MEMORY_VGA);
+    if (!invalidate &&
+        !memory_region_snapshot_get_dirty(mem, snap, addr,
+                                          src_width * (rows - i))) {
+        /* Nothing was written since the last update */
+        i = rows;
+    }
     for (; i < rows; i++) {
         dirty = memory_region_snapshot_get_dirty(mem, snap, addr, src_width);
         if (dirty || invalidate) {
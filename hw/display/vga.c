@@ -1441,6 +1441,18 @@ static bool vga_scanline_invalidated(VGACommonState *s, int y)
     return s->invalidated_y_table[y >> 5] & (1 << (y & 0x1f));
 }
 
+static bool vga_any_scanline_invalidated(VGACommonState *s)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(s->invalidated_y_table); i++) {
+        if (s->invalidated_y_table[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void vga_sync_dirty_bitmap(VGACommonState *s)
 {
     memory_region_sync_dirty_bitmap(&s->vram);
@@ -1643,6 +1655,13 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         snap = memory_region_snapshot_and_clear_dirty(&s->vram, region_start,
                                                       region_end - region_start,
                                                       DIRTY_MEMORY_VGA);
+        if (!memory_region_snapshot_get_dirty(&s->vram, snap, region_start,
+                                              region_end - region_start) &&
+            !vga_any_scanline_invalidated(s)) {
+            /* Nothing was written since the last update */
+            g_free(snap);
+            return;
+        }
     }
 
     for(y = 0; y < height; y++) {
@@ -1749,7 +1768,8 @@ static void vga_update_display(void *opaque)
     if (surface_bits_per_pixel(surface) == 0) {
         /* nothing to do */
     } else {
-        full_update = 0;
+        /* e.g. a screendump while idle: nothing tracked the changes */
+        full_update = s->refresh_idle;
         if (!(s->ar_index & 0x20)) {
             graphic_mode = GMODE_BLANK;
         } else {
@@ -2132,10 +2152,29 @@ const VMStateDescription vmstate_vga_common = {
     }
 };
 
+/* Only log writes to the VRAM while some display is refreshed from it */
+static void vga_update_interval(void *opaque, uint64_t interval)
+{
+    VGACommonState *s = opaque;
+    bool idle = interval == GUI_REFRESH_INTERVAL_NONE;
+
+    if (idle == s->refresh_idle) {
+        return;
+    }
+    s->refresh_idle = idle;
+    if (idle) {
+        vga_dirty_log_stop(s);
+    } else {
+        vga_dirty_log_start(s);
+        vga_invalidate_display(s);
+    }
+}
+
 static const GraphicHwOps vga_ops = {
     .invalidate  = vga_invalidate_display,
     .gfx_update  = vga_update_display,
     .text_update = vga_update_text,
+    .update_interval = vga_update_interval,
 };
 
 static inline uint32_t uint_clamp(uint32_t val, uint32_t vmin, uint32_t vmax)
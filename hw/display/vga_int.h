@@ -162,6 +162,7 @@ typedef struct VGACommonState {
     const GraphicHwOps *hw_ops;
     bool full_update_text;
     bool full_update_gfx;
+    bool refresh_idle;      /* no display wants refreshes, dirty log off */
     bool big_endian_fb;
     bool default_endian_fb;
     /* hardware mouse cursor support */
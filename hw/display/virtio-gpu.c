@@ -469,22 +469,35 @@ static void virtio_gpu_transfer_to_host_2d(VirtIOGPU *g,
     bpp = DIV_ROUND_UP(PIXMAN_FORMAT_BPP(format), 8);
     stride = pixman_image_get_stride(res->image);
 
-    if (t2d.offset || t2d.r.x || t2d.r.y ||
-        t2d.r.width != pixman_image_get_width(res->image)) {
+    if (!t2d.r.x && t2d.r.width == pixman_image_get_width(res->image)) {
+        /* Full-width rows are contiguous on both sides */
+        iov_to_buf(res->iov, res->iov_cnt, t2d.offset,
+                   (uint8_t *)pixman_image_get_data(res->image)
+                   + t2d.r.y * stride, stride * t2d.r.height);
+    } else {
         void *img_data = pixman_image_get_data(res->image);
+        unsigned int iov_idx = 0;
+        size_t iov_base = 0;
+
         for (h = 0; h < t2d.r.height; h++) {
             src_offset = t2d.offset + stride * h;
             dst_offset = (t2d.r.y + h) * stride + (t2d.r.x * bpp);
 
-            iov_to_buf(res->iov, res->iov_cnt, src_offset,
+            /*
+             * Rows are copied in order, so resume the walk over the backing
+             * pages where the previous row started instead of at page 0.
+             */
+            while (iov_idx < res->iov_cnt &&
+                   iov_base + res->iov[iov_idx].iov_len <= src_offset) {
+                iov_base += res->iov[iov_idx].iov_len;
+                iov_idx++;
+            }
+
+            iov_to_buf(res->iov + iov_idx, res->iov_cnt - iov_idx,
+                       src_offset - iov_base,
                        (uint8_t *)img_data
                        + dst_offset, t2d.r.width * bpp);
         }
-    } else {
-        iov_to_buf(res->iov, res->iov_cnt, 0,
-                   pixman_image_get_data(res->image),
-                   pixman_image_get_stride(res->image)
-                   * pixman_image_get_height(res->image));
     }
 }
 
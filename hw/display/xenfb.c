@@ -787,7 +787,9 @@ static void xenfb_update_interval(void *opaque, uint64_t interval)
         if (xenfb_queue_full(xenfb)) {
             return;
         }
-        xenfb_send_refresh_period(xenfb, interval);
+        xenfb_send_refresh_period(xenfb,
+                                  interval == GUI_REFRESH_INTERVAL_NONE ?
+                                  XENFB_NO_REFRESH : interval);
 #endif
     }
 }
@@ -2596,6 +2596,20 @@ build_rsdp(GArray *rsdp_table, BIOSLinker *linker, unsigned rsdt_tbl_offset)
     return rsdp_table;
 }
 
+/*
+ * The inputs of acpi_build() that can change while the machine runs:
+ * the set of devices, and what firmware programs into the chipset.
+ */
+typedef struct AcpiBuildKey {
+    uint64_t device_generation;
+    Range pci_hole;
+    Range pci_hole64;
+    uint64_t mcfg_base;
+    uint32_t mcfg_size;
+    uint32_t pm_io_base;
+    uint32_t gpe0_blk;
+} AcpiBuildKey;
+
 typedef
 struct AcpiBuildState {
     /* Copy of table in RAM (for patching). */
@@ -2605,8 +2619,15 @@ struct AcpiBuildState {
     void *rsdp;
     MemoryRegion *rsdp_mr;
     MemoryRegion *linker_mr;
+    /* Inputs of the tables in table_mr, if key_valid */
+    AcpiBuildKey key;
+    bool key_valid;
+    DeviceListener device_listener;
 } AcpiBuildState;
 
+/* Bumped whenever a device is realized or unrealized */
+static uint64_t acpi_device_generation;
+
 static bool acpi_get_mcfg(AcpiMcfgInfo *mcfg)
 {
     Object *pci_host;
@@ -2817,10 +2838,50 @@ static void acpi_ram_update(MemoryRegion *mr, GArray *data)
     memory_region_set_dirty(mr, 0, size);
 }
 
+static void acpi_device_listener_update(DeviceListener *listener,
+                                        DeviceState *dev)
+{
+    acpi_device_generation++;
+}
+
+/*
+ * Fill @key with the current inputs of acpi_build().  Returns false if
+ * the tables also depend on state that the key does not cover, namely
+ * the bridge windows of PCI expander buses, and so cannot be cached.
+ */
+static bool acpi_build_key(AcpiBuildKey *key)
+{
+    PCIBus *bus = PC_MACHINE(qdev_get_machine())->bus;
+    AcpiMcfgInfo mcfg;
+    AcpiPmInfo pm;
+
+    if (bus) {
+        QLIST_FOREACH(bus, &bus->child, sibling) {
+            if (pci_bus_is_root(bus)) {
+                return false;
+            }
+        }
+    }
+
+    memset(key, 0, sizeof(*key));
+    key->device_generation = acpi_device_generation;
+    acpi_get_pci_holes(&key->pci_hole, &key->pci_hole64);
+    if (acpi_get_mcfg(&mcfg)) {
+        key->mcfg_base = mcfg.mcfg_base;
+        key->mcfg_size = mcfg.mcfg_size;
+    }
+    acpi_get_pm_info(&pm);
+    key->pm_io_base = pm.io_base;
+    key->gpe0_blk = pm.gpe0_blk;
+    return true;
+}
+
 static void acpi_build_update(void *build_opaque)
 {
     AcpiBuildState *build_state = build_opaque;
     AcpiBuildTables tables;
+    AcpiBuildKey key;
+    bool key_valid;
 
     /* No state to update or already patched? Nothing to do. */
     if (!build_state || build_state->patched) {
@@ -2828,6 +2889,19 @@ static void acpi_build_update(void *build_opaque)
     }
     build_state->patched = 1;
 
+    /*
+     * Firmware reads the tables again after every reset.  Unless devices
+     * were hotplugged or firmware set up the chipset differently, the
+     * tables already in guest-visible memory are still current.
+     */
+    key_valid = acpi_build_key(&key);
+    if (key_valid && build_state->key_valid &&
+        !memcmp(&key, &build_state->key, sizeof(key))) {
+        return;
+    }
+    build_state->key = key;
+    build_state->key_valid = key_valid;
+
     acpi_build_tables_init(&tables);
 
     acpi_build(&tables, MACHINE(qdev_get_machine()));
@@ -2892,6 +2966,9 @@ void acpi_setup(void)
     }
 
     build_state = g_malloc0(sizeof *build_state);
+    build_state->device_listener.realize = acpi_device_listener_update;
+    build_state->device_listener.unrealize = acpi_device_listener_update;
+    device_listener_register(&build_state->device_listener);
 
     acpi_build_tables_init(&tables);
     acpi_build(&tables, MACHINE(pcms));
@@ -3110,6 +3110,7 @@ static void vtd_iommu_memory_region_class_init(ObjectClass *klass,
     imrc->translate = vtd_iommu_translate;
     imrc->notify_flag_changed = vtd_iommu_notify_flag_changed;
     imrc->replay = vtd_iommu_replay;
+    imrc->notifies_changes = true;
 }
 
 static const TypeInfo vtd_iommu_memory_region_info = {
@@ -593,6 +593,8 @@ static void ahci_reset_port(AHCIState *s, int port)
     pr->sig = 0xFFFFFFFF;
     d->busy_slot = -1;
     d->init_d2h_sent = false;
+    d->finished = 0;
+    qemu_bh_cancel(d->sdb_bh);
 
     ide_state = &s->dev[port].port.ifs[0];
     if (!ide_state->blk) {
@@ -704,9 +706,8 @@ static void ahci_unmap_clb_address(AHCIDevice *ad)
     ad->lst = NULL;
 }
 
-static void ahci_write_fis_sdb(AHCIState *s, NCQTransferState *ncq_tfs)
+static void ahci_write_fis_sdb(AHCIState *s, AHCIDevice *ad)
 {
-    AHCIDevice *ad = ncq_tfs->drive;
     AHCIPortRegs *pr = &ad->port_regs;
     IDEState *ide_state;
     SDBFIS *sdb_fis;
@@ -740,6 +741,20 @@ static void ahci_write_fis_sdb(AHCIState *s, NCQTransferState *ncq_tfs)
     }
 }
 
+/*
+ * Successful NCQ completions are reported from a bottom half, so that all
+ * the tags that finish in one main loop iteration share a single SDB FIS
+ * and a single interrupt.
+ */
+static void ahci_write_fis_sdb_bh(void *opaque)
+{
+    AHCIDevice *ad = opaque;
+
+    if (ad->finished) {
+        ahci_write_fis_sdb(ad->hba, ad);
+    }
+}
+
 static void ahci_write_fis_pio(AHCIDevice *ad, uint16_t len)
 {
     AHCIPortRegs *pr = &ad->port_regs;
@@ -944,10 +959,12 @@ static void ncq_finish(NCQTransferState *ncq_tfs)
      * clear the outstanding bit in scr_act (PxSACT). */
     if (!(ncq_tfs->drive->port_regs.scr_err & (1 << ncq_tfs->tag))) {
         ncq_tfs->drive->finished |= (1 << ncq_tfs->tag);
+        qemu_bh_schedule(ncq_tfs->drive->sdb_bh);
+    } else {
+        /* Report errors right away, before the status is overwritten */
+        ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs->drive);
     }
 
-    ahci_write_fis_sdb(ncq_tfs->drive->hba, ncq_tfs);
-
     trace_ncq_finish(ncq_tfs->drive->hba, ncq_tfs->drive->port_no,
                      ncq_tfs->tag);
 
@@ -1480,6 +1497,7 @@ void ahci_realize(AHCIState *s, DeviceState *qdev, AddressSpace *as, int ports)
         ad->port_no = i;
         ad->port.dma = &ad->dma;
         ad->port.dma->ops = &ahci_dma_ops;
+        ad->sdb_bh = qemu_bh_new(ahci_write_fis_sdb_bh, ad);
         ide_register_restart_cb(&ad->port);
     }
     g_free(irqs);
@@ -1497,6 +1515,7 @@ void ahci_uninit(AHCIState *s)
 
             ide_exit(s);
         }
+        qemu_bh_delete(ad->sdb_bh);
         object_unparent(OBJECT(&ad->port));
     }
 
@@ -1656,6 +1675,11 @@ static int ahci_state_post_load(void *opaque, int version_id)
             }
             ad->cur_cmd = get_cmd_header(s, i, ad->busy_slot);
         }
+
+        /* Deliver completions that were still waiting for the SDB FIS */
+        if (ad->finished) {
+            qemu_bh_schedule(ad->sdb_bh);
+        }
     }
 
     return 0;
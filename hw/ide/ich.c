@@ -112,6 +112,7 @@ static void pci_ich9_ahci_realize(PCIDevice *dev, Error **errp)
     int ret;
 
     ahci_realize(&d->ahci, DEVICE(dev), pci_get_address_space(dev), 6);
+    address_space_enable_iommu_cache(pci_get_address_space(dev));
 
     pci_config_set_prog_interface(dev->config, AHCI_PROGMODE_MAJOR_REV_1);
 
@@ -51,6 +51,7 @@
 #define E1000E_MIN_XITR     (500) /* No more then 7813 interrupts per
                                      second according to spec 10.2.4.2 */
 #define E1000E_MAX_TX_FRAGS (64)
+#define E1000E_RX_DESC_BATCH (16) /* Descriptors written back at once */
 
 static inline void
 e1000e_set_interrupt_cause(E1000ECore *core, uint32_t val);
@@ -155,6 +156,7 @@ e1000e_intrmgr_on_throttling_timer(void *opaque)
         trace_e1000e_irq_throttling_no_pending_interrupts();
         return;
     }
+    timer->core->itr_intr_pending = false;
 
     if (msi_enabled(timer->core->owner)) {
         trace_e1000e_irq_msi_notify_postponed();
@@ -179,9 +181,18 @@ e1000e_intrmgr_on_msix_throttling_timer(void *opaque)
         trace_e1000e_irq_throttling_no_pending_vec(idx);
         return;
     }
+    timer->core->eitr_intr_pending[idx] = false;
 
     trace_e1000e_irq_msix_notify_postponed_vec(idx);
     msix_notify(timer->core->owner, idx);
+
+    /*
+     * The throttling interval starts when an interrupt is sent, so the
+     * vector stays masked for a full EITR period after this one as well.
+     */
+    if (timer->core->mac[timer->delay_reg] != 0) {
+        e1000e_intrmgr_rearm_timer(timer);
+    }
 }
 
 static void
@@ -1490,6 +1501,16 @@ e1000e_do_ps(E1000ECore *core, struct NetRxPkt *pkt, size_t *hdr_len)
     return true;
 }
 
+static inline void
+e1000e_flush_rx_descr(E1000ECore *core, dma_addr_t base,
+                      const uint8_t *descs, unsigned *count)
+{
+    if (*count) {
+        pci_dma_write(core->owner, base, descs, *count * core->rx_desc_len);
+        *count = 0;
+    }
+}
+
 static void
 e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
                              const E1000E_RxRing *rxr,
@@ -1498,6 +1519,9 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
     PCIDevice *d = core->owner;
     dma_addr_t base;
     uint8_t desc[E1000_MAX_RX_DESC_LEN];
+    uint8_t wb_descs[E1000E_RX_DESC_BATCH * E1000_MAX_RX_DESC_LEN];
+    dma_addr_t wb_base = 0;
+    unsigned wb_count = 0;
     size_t desc_size;
     size_t desc_offset = 0;
     size_t iov_ofs = 0;
@@ -1524,6 +1548,7 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
         }
 
         if (e1000e_ring_empty(core, rxi)) {
+            e1000e_flush_rx_descr(core, wb_base, wb_descs, &wb_count);
             return;
         }
 
@@ -1605,13 +1630,29 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
 
         e1000e_write_rx_descr(core, desc, is_last ? core->rx_pkt : NULL,
                            rss_info, do_ps ? ps_hdr_len : 0, &bastate.written);
-        pci_dma_write(d, base, &desc, core->rx_desc_len);
+
+        /*
+         * Descriptors of a packet that spans several buffers are usually
+         * adjacent in the ring, so write them back together.
+         */
+        if (wb_count == E1000E_RX_DESC_BATCH ||
+            base != wb_base + wb_count * core->rx_desc_len) {
+            e1000e_flush_rx_descr(core, wb_base, wb_descs, &wb_count);
+        }
+        if (!wb_count) {
+            wb_base = base;
+        }
+        memcpy(wb_descs + wb_count * core->rx_desc_len, desc,
+               core->rx_desc_len);
+        wb_count++;
 
         e1000e_ring_advance(core, rxi,
                             core->rx_desc_len / E1000_MIN_RX_DESC_LEN);
 
     } while (desc_offset < total_size);
 
+    e1000e_flush_rx_descr(core, wb_base, wb_descs, &wb_count);
+
     e1000e_update_rx_stats(core, size, total_size);
 }
 
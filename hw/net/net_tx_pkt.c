@@ -19,6 +19,7 @@
 #include "net_tx_pkt.h"
 #include "net/eth.h"
 #include "net/checksum.h"
+#include "net/gso.h"
 #include "net/tap.h"
 #include "net/net.h"
 #include "hw/pci/pci.h"
@@ -594,11 +595,82 @@ static bool net_tx_pkt_do_sw_fragmentation(struct NetTxPkt *pkt,
     return true;
 }
 
+typedef struct NetTxPktGSOCtx {
+    struct NetTxPkt *pkt;
+    NetClientState *nc;
+} NetTxPktGSOCtx;
+
+static void net_tx_pkt_send_segment(void *opaque, const struct iovec *iov,
+                                    int iovcnt)
+{
+    NetTxPktGSOCtx *ctx = opaque;
+
+    net_tx_pkt_sendv(ctx->pkt, ctx->nc, iov, iovcnt);
+}
+
+static bool net_tx_pkt_is_tcp_gso(struct NetTxPkt *pkt)
+{
+    uint8_t gso_type = pkt->virt_hdr.gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+
+    return gso_type == VIRTIO_NET_HDR_GSO_TCPV4 ||
+           gso_type == VIRTIO_NET_HDR_GSO_TCPV6;
+}
+
+/*
+ * TSO without a virtio header on the peer: cut the packet into real TCP
+ * segments rather than IP fragments, so that the receiver sees what a NIC
+ * would have put on the wire.  Only the headers of each segment are
+ * copied, the payload is passed by reference.
+ */
+static bool net_tx_pkt_do_sw_segmentation(struct NetTxPkt *pkt,
+    NetClientState *nc)
+{
+    struct iovec *payload = &pkt->vec[NET_TX_PKT_PL_START_FRAG];
+    size_t l2_len = pkt->vec[NET_TX_PKT_L2HDR_FRAG].iov_len;
+    size_t l3_len = pkt->vec[NET_TX_PKT_L3HDR_FRAG].iov_len;
+    NetTxPktGSOCtx ctx = { .pkt = pkt, .nc = nc };
+    struct tcp_hdr tcp;
+    struct iovec *data;
+    uint8_t *hdr;
+    size_t tcp_len;
+    int cnt, ret;
+
+    if (iov_to_buf(payload, pkt->payload_frags, 0, &tcp,
+                   sizeof(tcp)) < sizeof(tcp)) {
+        return false;
+    }
+    tcp_len = tcp.th_off * 4;
+    if (tcp_len < sizeof(tcp) || tcp_len > pkt->payload_len) {
+        return false;
+    }
+
+    hdr = g_malloc(l2_len + l3_len + tcp_len);
+    iov_to_buf(pkt->vec + NET_TX_PKT_L2HDR_FRAG, 2, 0, hdr, l2_len + l3_len);
+    iov_to_buf(payload, pkt->payload_frags, 0, hdr + l2_len + l3_len,
+               tcp_len);
+
+    data = g_new(struct iovec, pkt->payload_frags);
+    cnt = iov_copy(data, pkt->payload_frags, payload, pkt->payload_frags,
+                   tcp_len, pkt->payload_len - tcp_len);
+    ret = net_gso_tcp(hdr, l2_len, l2_len + l3_len, l2_len + l3_len + tcp_len,
+                      data, cnt, pkt->payload_len - tcp_len,
+                      pkt->virt_hdr.gso_size, net_tx_pkt_send_segment, &ctx);
+    g_free(data);
+    g_free(hdr);
+
+    return ret > 0;
+}
+
 bool net_tx_pkt_send(struct NetTxPkt *pkt, NetClientState *nc)
 {
+    bool sw_gso;
+
     assert(pkt);
 
-    if (!pkt->has_virt_hdr &&
+    /* Segmentation computes the checksum of each segment itself */
+    sw_gso = !pkt->has_virt_hdr && net_tx_pkt_is_tcp_gso(pkt);
+
+    if (!pkt->has_virt_hdr && !sw_gso &&
         pkt->virt_hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
         net_tx_pkt_do_sw_csum(pkt);
     }
@@ -622,6 +694,9 @@ bool net_tx_pkt_send(struct NetTxPkt *pkt, NetClientState *nc)
         return true;
     }
 
+    if (sw_gso) {
+        return net_tx_pkt_do_sw_segmentation(pkt, nc);
+    }
     return net_tx_pkt_do_sw_fragmentation(pkt, nc);
 }
 
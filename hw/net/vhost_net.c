@@ -36,11 +36,13 @@
 #include "standard-headers/linux/virtio_ring.h"
 #include "hw/virtio/vhost.h"
 #include "hw/virtio/virtio-bus.h"
+#include "hw/virtio/virtio-access.h"
 
 struct vhost_net {
     struct vhost_dev dev;
     struct vhost_virtqueue vqs[2];
     int backend;
+    uint32_t busyloop_timeout;
     NetClientState *nc;
 };
 
@@ -53,6 +55,7 @@ static const int kernel_feature_bits[] = {
     VIRTIO_F_VERSION_1,
     VIRTIO_NET_F_MTU,
     VIRTIO_F_IOMMU_PLATFORM,
+    VIRTIO_F_RING_PACKED,
     VHOST_INVALID_FEATURE_BIT
 };
 
@@ -78,6 +81,7 @@ static const int user_feature_bits[] = {
     VIRTIO_NET_F_MRG_RXBUF,
     VIRTIO_NET_F_MTU,
     VIRTIO_F_IOMMU_PLATFORM,
+    VIRTIO_F_RING_PACKED,
 
     /* This bit implies RARP isn't sent by QEMU out of band */
     VIRTIO_NET_F_GUEST_ANNOUNCE,
@@ -152,6 +156,7 @@ struct vhost_net *vhost_net_init(VhostNetOptions *options)
         goto fail;
     }
     net->nc = options->net_backend;
+    net->busyloop_timeout = options->busyloop_timeout;
 
     net->dev.max_queues = 1;
     net->dev.nvqs = 2;
@@ -450,6 +455,37 @@ int vhost_net_set_mtu(struct vhost_net *net, uint16_t mtu)
     return vhost_ops->vhost_net_set_mtu(&net->dev, mtu);
 }
 
+static uint16_t vhost_net_vring_idx(struct vhost_net *net, void *ring,
+                                    size_t offset)
+{
+    return virtio_lduw_p(net->dev.vdev, ring + offset);
+}
+
+void vhost_net_get_info(VHostNetState *net, VhostNetQueueInfo *info)
+{
+    struct vhost_virtqueue *rx = &net->vqs[0];
+    struct vhost_virtqueue *tx = &net->vqs[1];
+
+    info->started = net->dev.started;
+    info->poll_us = net->busyloop_timeout;
+    if (!net->dev.started) {
+        return;
+    }
+
+    /* The rings are mapped while the device runs; the indices are
+     * free-running 16-bit counters owned by the guest and the backend.
+     */
+    info->has_rx_avail_idx = info->has_rx_used_idx = true;
+    info->has_tx_avail_idx = info->has_tx_used_idx = true;
+    info->rx_avail_idx = vhost_net_vring_idx(net, rx->avail,
+                                    offsetof(struct vring_avail, idx));
+    info->rx_used_idx = vhost_net_vring_idx(net, rx->used,
+                                    offsetof(struct vring_used, idx));
+    info->tx_avail_idx = vhost_net_vring_idx(net, tx->avail,
+                                    offsetof(struct vring_avail, idx));
+    info->tx_used_idx = vhost_net_vring_idx(net, tx->used,
+                                    offsetof(struct vring_used, idx));
+}
 #else
 uint64_t vhost_net_get_max_queues(VHostNetState *net)
 {
@@ -521,4 +557,8 @@ int vhost_net_set_mtu(struct vhost_net *net, uint16_t mtu)
 {
     return 0;
 }
+
+void vhost_net_get_info(VHostNetState *net, VhostNetQueueInfo *info)
+{
+}
 #endif
@@ -19,6 +19,7 @@
 #include "net/tap.h"
 #include "qemu/error-report.h"
 #include "qemu/timer.h"
+#include "qemu/main-loop.h"
 #include "hw/virtio/virtio-net.h"
 #include "net/vhost_net.h"
 #include "hw/virtio/virtio-bus.h"
@@ -235,11 +236,60 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+/* Interrupt the guest for an RX or TX queue */
+static void virtio_net_notify(VirtIONet *n, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (n->dataplane_started) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify(vdev, vq);
+    }
+}
+
+/*
+ * Exclude the dataplane from main loop code that touches the RX/TX queues
+ * or their backends.  Called with the BQL held.
+ */
+static void virtio_net_dataplane_acquire(VirtIONet *n)
+{
+    int i;
+
+    if (!n->dataplane_started) {
+        return;
+    }
+    for (i = 0; i < n->max_queues; i++) {
+        aio_context_acquire(n->vqs[i].ctx);
+    }
+}
+
+static void virtio_net_dataplane_release(VirtIONet *n, bool started)
+{
+    int i;
+
+    if (!started) {
+        return;
+    }
+    for (i = 0; i < n->max_queues; i++) {
+        aio_context_release(n->vqs[i].ctx);
+    }
+}
+
+static void virtio_net_tx_schedule(VirtIONetQueue *q)
+{
+    if (q->n->dataplane_started) {
+        qemu_bh_schedule(q->dp_tx_bh);
+    } else {
+        qemu_bh_schedule(q->tx_bh);
+    }
+}
+
 static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(VIRTIO_NET(vdev), vq);
     }
 }
 
@@ -249,10 +299,13 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     VirtIONetQueue *q;
     int i;
     uint8_t queue_status;
+    bool dataplane_started;
 
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
+    dataplane_started = n->dataplane_started;
+    virtio_net_dataplane_acquire(n);
     for (i = 0; i < n->max_queues; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
         bool queue_started;
@@ -279,13 +332,16 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
                 timer_mod(q->tx_timer,
                                qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
             } else {
-                qemu_bh_schedule(q->tx_bh);
+                virtio_net_tx_schedule(q);
             }
         } else {
             if (q->tx_timer) {
                 timer_del(q->tx_timer);
             } else {
                 qemu_bh_cancel(q->tx_bh);
+                if (q->dp_tx_bh) {
+                    qemu_bh_cancel(q->dp_tx_bh);
+                }
             }
             if ((n->status & VIRTIO_NET_S_LINK_UP) == 0 &&
                 (queue_status & VIRTIO_CONFIG_S_DRIVER_OK) &&
@@ -298,6 +354,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+    virtio_net_dataplane_release(n, dataplane_started);
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -965,7 +1022,10 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
     size_t s;
     struct iovec *iov, *iov2;
     unsigned int iov_cnt;
+    bool dataplane_started = n->dataplane_started;
 
+    /* The commands change state that the RX path looks at */
+    virtio_net_dataplane_acquire(n);
     for (;;) {
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
         if (!elem) {
@@ -1007,6 +1067,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
         g_free(iov2);
         g_free(elem);
     }
+    virtio_net_dataplane_release(n, dataplane_started);
 }
 
 /* RX */
@@ -1086,14 +1147,20 @@ static void virtio_net_hdr_swap(VirtIODevice *vdev, struct virtio_net_hdr *hdr)
  * we should provide a mechanism to disable it to avoid polluting the host
  * cache.
  */
-static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
-                                        uint8_t *buf, size_t size)
+static bool is_broken_dhclient_packet(struct virtio_net_hdr *hdr,
+                                      uint8_t *buf, size_t size)
 {
-    if ((hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) && /* missing csum */
+    return (hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) && /* missing csum */
         (size > 27 && size < 1500) && /* normal sized MTU */
         (buf[12] == 0x08 && buf[13] == 0x00) && /* ethertype == IPv4 */
         (buf[23] == 17) && /* ip.protocol == UDP */
-        (buf[34] == 0 && buf[35] == 67)) { /* udp.srcport == bootps */
+        (buf[34] == 0 && buf[35] == 67); /* udp.srcport == bootps */
+}
+
+static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
+                                        uint8_t *buf, size_t size)
+{
+    if (is_broken_dhclient_packet(hdr, buf, size)) {
         net_checksum_calculate(buf, size);
         hdr->flags &= ~VIRTIO_NET_HDR_F_NEEDS_CSUM;
     }
@@ -1173,7 +1240,7 @@ static int receive_filter(VirtIONet *n, const uint8_t *buf, int size)
 }
 
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
-                                      size_t size)
+                                      size_t size, bool notify)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
@@ -1271,7 +1338,9 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    if (notify) {
+        virtio_net_notify(n, q->rx_vq);
+    }
 
     return size;
 }
@@ -1282,21 +1351,217 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
     ssize_t r;
 
     rcu_read_lock();
-    r = virtio_net_receive_rcu(nc, buf, size);
+    r = virtio_net_receive_rcu(nc, buf, size, true);
     rcu_read_unlock();
     return r;
 }
 
+/*
+ * Take a burst of packets from the backend and interrupt the guest once
+ * for all of them.  Stops at the first packet that virtio_net_receive()
+ * would not take, and leaves it and the rest to the caller.
+ */
+static int virtio_net_receive_batch(NetClientState *nc,
+                                    const struct iovec *pkts, int count)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    int i;
+
+    rcu_read_lock();
+    for (i = 0; i < count; i++) {
+        if (virtio_net_receive_rcu(nc, pkts[i].iov_base, pkts[i].iov_len,
+                                   false) <= 0) {
+            break;
+        }
+    }
+    if (i) {
+        virtio_net_notify(n, q->rx_vq);
+    }
+    rcu_read_unlock();
+    return i;
+}
+
+/*
+ * Zero-copy receive: the backend reads the packet straight into the first
+ * RX buffer, and only what does not fit there is copied.  Packets that
+ * need rewriting on the way in still go through virtio_net_receive().
+ */
+static int virtio_net_receive_prepare(NetClientState *nc, struct iovec *iov,
+                                      int iovcnt, size_t maxlen)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtQueueElement *elem;
+    size_t offset;
+    int cnt = 0;
+
+    assert(!q->rx_elem);
+
+    if (!virtio_net_can_receive(nc) || n->needs_vnet_hdr_swap ||
+        (n->has_vnet_hdr && n->host_hdr_len != n->guest_hdr_len)) {
+        return 0;
+    }
+
+    rcu_read_lock();
+    if (!virtio_net_has_buffers(q, n->guest_hdr_len)) {
+        goto out;
+    }
+    elem = virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
+    if (!elem) {
+        goto out;
+    }
+    if (elem->in_num < 1) {
+        virtio_error(vdev, "virtio-net receive queue contains no in buffers");
+        virtqueue_detach_element(q->rx_vq, elem, 0);
+        g_free(elem);
+        goto out;
+    }
+
+    /* Without a vnet header from the backend we supply our own */
+    offset = n->has_vnet_hdr ? 0 : n->guest_hdr_len;
+    cnt = iov_copy(iov, iovcnt, elem->in_sg, elem->in_num, offset, maxlen);
+    if (cnt == 0) {
+        virtqueue_unpop(q->rx_vq, elem, 0);
+        g_free(elem);
+        goto out;
+    }
+    q->rx_elem = elem;
+    q->rx_elem_len = iov_size(iov, cnt);
+
+out:
+    rcu_read_unlock();
+    return cnt;
+}
+
+/* Copy up to @len bytes of the packet in q->rx_elem to the start of @buf */
+static void virtio_net_rx_linearize(VirtIONetQueue *q, uint8_t *buf,
+                                    size_t len)
+{
+    VirtQueueElement *elem = q->rx_elem;
+    size_t offset = q->n->has_vnet_hdr ? 0 : q->n->guest_hdr_len;
+
+    iov_to_buf(elem->in_sg, elem->in_num, offset, buf,
+               MIN(len, q->rx_elem_len));
+}
+
+static bool virtio_net_receive_complete(NetClientState *nc, uint8_t *buf,
+                                        ssize_t size)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    VirtQueueElement *elem = q->rx_elem;
+    size_t guest_offset = n->has_vnet_hdr ? 0 : n->guest_hdr_len;
+    struct iovec mhdr_sg[VIRTQUEUE_MAX_SIZE];
+    struct virtio_net_hdr_mrg_rxbuf mhdr;
+    unsigned mhdr_cnt = 0;
+    size_t offset, need, elem_size, i;
+    bool consumed = true;
+
+    rcu_read_lock();
+    if (size <= 0) {
+        goto unpop;
+    }
+
+    /* Enough of the packet for receive_filter() and the dhclient check */
+    virtio_net_rx_linearize(q, buf, n->host_hdr_len + 36);
+    if (!receive_filter(n, buf, size)) {
+        goto unpop;
+    }
+    if (n->has_vnet_hdr &&
+        is_broken_dhclient_packet((struct virtio_net_hdr *)buf,
+                                  buf + n->host_hdr_len,
+                                  size - n->host_hdr_len)) {
+        goto copy;
+    }
+
+    need = size + n->guest_hdr_len - n->host_hdr_len;
+    elem_size = iov_size(elem->in_sg, elem->in_num);
+    if (need > elem_size) {
+        if (!n->mergeable_rx_bufs) {
+            /* Too big and buffers can't be merged: drop it */
+            goto unpop;
+        }
+        if (!virtio_net_has_buffers(q, need - elem_size)) {
+            goto copy;
+        }
+    }
+
+    if (!n->has_vnet_hdr) {
+        receive_header(n, elem->in_sg, elem->in_num, buf, size);
+    }
+    if (n->mergeable_rx_bufs) {
+        mhdr_cnt = iov_copy(mhdr_sg, ARRAY_SIZE(mhdr_sg),
+                            elem->in_sg, elem->in_num,
+                            offsetof(typeof(mhdr), num_buffers),
+                            sizeof(mhdr.num_buffers));
+    }
+
+    /* The backend left what did not fit at the same offset in @buf */
+    offset = MIN(size, q->rx_elem_len);
+    offset += iov_from_buf(elem->in_sg, elem->in_num, guest_offset + offset,
+                           buf + offset, size - offset);
+    virtqueue_fill(q->rx_vq, elem, guest_offset + offset, 0);
+    g_free(elem);
+    q->rx_elem = NULL;
+
+    for (i = 1; offset < size; i++) {
+        size_t len;
+
+        elem = virtqueue_pop(q->rx_vq, sizeof(VirtQueueElement));
+        if (!elem) {
+            virtio_error(vdev, "virtio-net unexpected empty queue: "
+                         "i %zd offset %zd, size %zd", i, offset, size);
+            goto out;
+        }
+        if (elem->in_num < 1) {
+            virtio_error(vdev,
+                         "virtio-net receive queue contains no in buffers");
+            virtqueue_detach_element(q->rx_vq, elem, 0);
+            g_free(elem);
+            goto out;
+        }
+        len = iov_from_buf(elem->in_sg, elem->in_num, 0,
+                           buf + offset, size - offset);
+        offset += len;
+        virtqueue_fill(q->rx_vq, elem, len, i);
+        g_free(elem);
+    }
+
+    if (mhdr_cnt) {
+        virtio_stw_p(vdev, &mhdr.num_buffers, i);
+        iov_from_buf(mhdr_sg, mhdr_cnt, 0,
+                     &mhdr.num_buffers, sizeof mhdr.num_buffers);
+    }
+
+    virtqueue_flush(q->rx_vq, i);
+    virtio_net_notify(n, q->rx_vq);
+    goto out;
+
+copy:
+    /* Hand the packet back for virtio_net_receive() */
+    virtio_net_rx_linearize(q, buf, size);
+    consumed = false;
+unpop:
+    virtqueue_unpop(q->rx_vq, elem, 0);
+    g_free(elem);
+    q->rx_elem = NULL;
+out:
+    rcu_read_unlock();
+    return consumed;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(n, q->tx_vq);
 
     g_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
@@ -1306,11 +1571,22 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+static void virtio_net_tx_unpop(VirtQueue *vq, VirtQueueElement **elems,
+                                unsigned int count)
+{
+    while (count--) {
+        virtqueue_unpop(vq, elems[count], 0);
+        g_free(elems[count]);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *elems[VIRTQUEUE_POP_BATCH];
+    unsigned int head = 0, count = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -1328,10 +1604,18 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
         struct virtio_net_hdr_mrg_rxbuf mhdr;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            break;
+        /* Never pop more than the rest of the burst */
+        if (head == count) {
+            head = 0;
+            count = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                        (void **)elems,
+                                        MIN(ARRAY_SIZE(elems),
+                                            n->tx_burst - num_packets));
+            if (!count) {
+                break;
+            }
         }
+        elem = elems[head++];
 
         out_num = elem->out_num;
         out_sg = elem->out_sg;
@@ -1339,6 +1623,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             virtio_error(vdev, "virtio-net header not in first element");
             virtqueue_detach_element(q->tx_vq, elem, 0);
             g_free(elem);
+            virtio_net_tx_unpop(q->tx_vq, elems + head, count - head);
             return -EINVAL;
         }
 
@@ -1348,6 +1633,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 virtio_error(vdev, "virtio-net header incorrect");
                 virtqueue_detach_element(q->tx_vq, elem, 0);
                 g_free(elem);
+                virtio_net_tx_unpop(q->tx_vq, elems + head, count - head);
                 return -EINVAL;
             }
             if (n->needs_vnet_hdr_swap) {
@@ -1386,12 +1672,13 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
+            virtio_net_tx_unpop(q->tx_vq, elems + head, count - head);
             return -EBUSY;
         }
 
 drop:
         virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
+        virtio_net_notify(n, q->tx_vq);
         g_free(elem);
 
         if (++num_packets >= n->tx_burst) {
@@ -1451,7 +1738,7 @@ static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
         return;
     }
     virtio_queue_set_notification(vq, 0);
-    qemu_bh_schedule(q->tx_bh);
+    virtio_net_tx_schedule(q);
 }
 
 static void virtio_net_tx_timer(void *opaque)
@@ -1477,9 +1764,8 @@ static void virtio_net_tx_timer(void *opaque)
     virtio_net_flush_tx(q);
 }
 
-static void virtio_net_tx_bh(void *opaque)
+static void virtio_net_tx_run(VirtIONetQueue *q)
 {
-    VirtIONetQueue *q = opaque;
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int32_t ret;
@@ -1507,7 +1793,7 @@ static void virtio_net_tx_bh(void *opaque)
     /* If we flush a full burst of packets, assume there are
      * more coming and immediately reschedule */
     if (ret >= n->tx_burst) {
-        qemu_bh_schedule(q->tx_bh);
+        virtio_net_tx_schedule(q);
         q->tx_waiting = 1;
         return;
     }
@@ -1521,11 +1807,257 @@ static void virtio_net_tx_bh(void *opaque)
         return;
     } else if (ret > 0) {
         virtio_queue_set_notification(q->tx_vq, 0);
-        qemu_bh_schedule(q->tx_bh);
+        virtio_net_tx_schedule(q);
         q->tx_waiting = 1;
     }
 }
 
+static void virtio_net_tx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    /* Scheduled before the dataplane started, let it carry on there */
+    if (q->n->dataplane_started) {
+        qemu_bh_schedule(q->dp_tx_bh);
+        return;
+    }
+
+    virtio_net_tx_run(q);
+}
+
+/*
+ * Dataplane handlers.  They run in the queue pair's AioContext without
+ * the BQL, and may find that the dataplane was stopped while they waited
+ * for the AioContext lock.
+ */
+static void virtio_net_dataplane_tx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    aio_context_acquire(q->ctx);
+    if (q->n->dataplane_started) {
+        virtio_net_tx_run(q);
+    }
+    aio_context_release(q->ctx);
+}
+
+static bool virtio_net_dataplane_handle_tx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    aio_context_acquire(q->ctx);
+    if (n->dataplane_started) {
+        virtio_net_handle_tx_bh(vdev, vq);
+    }
+    aio_context_release(q->ctx);
+    return true;
+}
+
+static bool virtio_net_dataplane_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    aio_context_acquire(q->ctx);
+    if (n->dataplane_started) {
+        virtio_net_handle_rx(vdev, vq);
+    }
+    aio_context_release(q->ctx);
+    return true;
+}
+
+/*
+ * Move the RX/TX queues and their backends into the queue pairs'
+ * AioContexts.  If the backend cannot follow, everything stays in the
+ * main loop.  Called with the BQL held, once ioeventfd is running.
+ */
+static void virtio_net_dataplane_start(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int i, r;
+
+    if (n->dataplane_started || n->vhost_started) {
+        return;
+    }
+
+    for (i = 0; i < queues; i++) {
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        if (!peer || !peer->info->set_aio_context ||
+            !QTAILQ_EMPTY(&peer->filters)) {
+            warn_report("virtio-net: the network backend cannot run in an "
+                        "iothread, using the main loop");
+            return;
+        }
+    }
+
+    /* Only vhost can mask its call notifiers; let the transport tear down
+     * the irqfd of a masked vector instead. */
+    vdev->use_guest_notifier_mask = false;
+    r = k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev),
+                               true);
+    if (r != 0) {
+        warn_report("virtio-net: failed to set guest notifier (%d), "
+                    "using the main loop", r);
+        return;
+    }
+
+    virtio_net_dataplane_acquire(n);
+    n->dataplane_started = true;
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        q->dp_tx_bh = aio_bh_new(q->ctx, virtio_net_dataplane_tx_bh, q);
+
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->rx_vq),
+                                   NULL);
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->tx_vq),
+                                   NULL);
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, q->ctx,
+                virtio_net_dataplane_handle_rx);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, q->ctx,
+                virtio_net_dataplane_handle_tx);
+        qemu_set_net_client_aio_context(peer, q->ctx);
+
+        if (q->tx_waiting && q->tx_bh) {
+            qemu_bh_cancel(q->tx_bh);
+            qemu_bh_schedule(q->dp_tx_bh);
+        }
+
+        /* Pick up whatever was queued while we were switching over */
+        event_notifier_set(virtio_queue_get_host_notifier(q->rx_vq));
+        event_notifier_set(virtio_queue_get_host_notifier(q->tx_vq));
+    }
+    virtio_net_dataplane_release(n, true);
+}
+
+/* Bring the RX/TX queues back into the main loop.  Called with the BQL. */
+static void virtio_net_dataplane_stop(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queues = n->multiqueue ? n->max_queues : 1;
+    int i;
+
+    if (!n->dataplane_started) {
+        return;
+    }
+
+    virtio_net_dataplane_acquire(n);
+    n->dataplane_started = false;
+    for (i = 0; i < queues; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, q->ctx, NULL);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, q->ctx, NULL);
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->rx_vq),
+                                   virtio_queue_host_notifier_read);
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->tx_vq),
+                                   virtio_queue_host_notifier_read);
+        qemu_set_net_client_aio_context(peer, NULL);
+
+        qemu_bh_delete(q->dp_tx_bh);
+        q->dp_tx_bh = NULL;
+        if (q->tx_waiting) {
+            qemu_bh_schedule(q->tx_bh);
+        }
+
+        /* A kick consumed by the detached handlers above was ignored */
+        event_notifier_set(virtio_queue_get_host_notifier(q->rx_vq));
+        event_notifier_set(virtio_queue_get_host_notifier(q->tx_vq));
+    }
+    virtio_net_dataplane_release(n, true);
+
+    k->set_guest_notifiers(qbus->parent, virtio_get_num_queues(vdev), false);
+}
+
+static void virtio_net_put_iothreads(VirtIONet *n)
+{
+    unsigned i;
+
+    for (i = 0; i < n->num_iothreads; i++) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
+    n->num_iothreads = 0;
+}
+
+/*
+ * Collect the IOThreads of iothread= or of the colon separated list in
+ * iothreads=.  Queue pairs, and the backend queues they are connected to,
+ * are spread over them round-robin.
+ */
+static bool virtio_net_get_iothreads(VirtIONet *n, Error **errp)
+{
+    char **ids;
+    unsigned i, count;
+
+    if (n->net_conf.iothread && n->net_conf.iothreads) {
+        error_setg(errp, "iothread and iothreads are mutually exclusive");
+        return false;
+    }
+    if (n->net_conf.iothread) {
+        object_ref(OBJECT(n->net_conf.iothread));
+        n->iothreads = g_new(IOThread *, 1);
+        n->iothreads[0] = n->net_conf.iothread;
+        n->num_iothreads = 1;
+        return true;
+    }
+    if (!n->net_conf.iothreads) {
+        return true;
+    }
+
+    ids = g_strsplit(n->net_conf.iothreads, ":", -1);
+    count = g_strv_length(ids);
+    if (count == 0) {
+        error_setg(errp, "iothreads= must name at least one iothread");
+        g_strfreev(ids);
+        return false;
+    }
+
+    n->iothreads = g_new0(IOThread *, count);
+    for (i = 0; i < count; i++) {
+        IOThread *iothread = iothread_by_id(ids[i]);
+
+        if (!iothread) {
+            error_setg(errp, "iothread '%s' not found", ids[i]);
+            g_strfreev(ids);
+            virtio_net_put_iothreads(n);
+            return false;
+        }
+        object_ref(OBJECT(iothread));
+        n->iothreads[n->num_iothreads++] = iothread;
+    }
+    g_strfreev(ids);
+    return true;
+}
+
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    int r;
+
+    r = virtio_device_start_ioeventfd_impl(vdev);
+    if (r == 0 && n->num_iothreads) {
+        virtio_net_dataplane_start(n);
+    }
+    return r;
+}
+
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    virtio_net_dataplane_stop(VIRTIO_NET(vdev));
+    virtio_device_stop_ioeventfd_impl(vdev);
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -1881,6 +2413,9 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .receive_iov_batch = virtio_net_receive_batch,
+    .receive_prepare = virtio_net_receive_prepare,
+    .receive_complete = virtio_net_receive_complete,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
 };
@@ -1889,7 +2424,13 @@ static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc = qemu_get_subqueue(n->nic, vq2q(idx));
-    assert(n->vhost_started);
+
+    if (!n->vhost_started) {
+        /* The dataplane signals the guest notifier directly */
+        VirtQueue *vq = virtio_get_queue(vdev, idx);
+        return event_notifier_test_and_clear(
+            virtio_queue_get_guest_notifier(vq));
+    }
     return vhost_net_virtqueue_pending(get_vhost_net(nc->peer), idx);
 }
 
@@ -1979,7 +2520,26 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+    if ((n->net_conf.iothread || n->net_conf.iothreads) && n->net_conf.tx &&
+        !strcmp(n->net_conf.tx, "timer")) {
+        error_setg(errp, "'iothread' cannot be used with tx=timer");
+        virtio_cleanup(vdev);
+        return;
+    }
+    if (!virtio_net_get_iothreads(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
+
     n->vqs = g_malloc0(sizeof(VirtIONetQueue) * n->max_queues);
+    for (i = 0; i < n->max_queues; i++) {
+        if (n->num_iothreads) {
+            n->vqs[i].ctx = iothread_get_aio_context(
+                n->iothreads[i % n->num_iothreads]);
+        } else {
+            n->vqs[i].ctx = qemu_get_aio_context();
+        }
+    }
     n->curr_queues = 1;
     n->tx_timeout = n->net_conf.txtimer;
 
@@ -2051,6 +2611,7 @@ static void virtio_net_device_unrealize(DeviceState *dev, Error **errp)
 
     /* This will stop vhost backend if appropriate. */
     virtio_net_set_status(vdev, 0);
+    virtio_net_dataplane_stop(n);
 
     g_free(n->netclient_name);
     n->netclient_name = NULL;
@@ -2068,6 +2629,7 @@ static void virtio_net_device_unrealize(DeviceState *dev, Error **errp)
     timer_del(n->announce_timer);
     timer_free(n->announce_timer);
     g_free(n->vqs);
+    virtio_net_put_iothreads(n);
     qemu_del_nic(n->nic);
     virtio_cleanup(vdev);
 }
@@ -2160,6 +2722,9 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_UINT16("host_mtu", VirtIONet, net_conf.mtu, 0),
     DEFINE_PROP_BOOL("x-mtu-bypass-backend", VirtIONet, mtu_bypass_backend,
                      true),
+    DEFINE_PROP_LINK("iothread", VirtIONet, net_conf.iothread, TYPE_IOTHREAD,
+                     IOThread *),
+    DEFINE_PROP_STRING("iothreads", VirtIONet, net_conf.iothreads),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -2182,6 +2747,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->set_status = virtio_net_set_status;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
     vdc->vmsd = &vmstate_virtio_net_device;
 }
@@ -204,6 +204,21 @@ static inline void vmxnet3_ring_write_curr_cell(PCIDevice *d, Vmxnet3Ring *ring,
     vmw_shmem_write(d, vmxnet3_ring_curr_cell_pa(ring), buff, ring->cell_size);
 }
 
+/*
+ * Read only the second dword of the current cell, which holds the generation
+ * bit of both TX and RX descriptors, to see whether the cell is ready before
+ * reading all of it.
+ */
+static inline uint32_t vmxnet3_ring_peek_curr_val1(PCIDevice *d,
+                                                   Vmxnet3Ring *ring)
+{
+    uint32_t val1;
+
+    vmw_shmem_read(d, vmxnet3_ring_curr_cell_pa(ring) + sizeof(uint64_t),
+                   &val1, sizeof(val1));
+    return le32_to_cpu(val1);
+}
+
 static inline size_t vmxnet3_ring_curr_cell_idx(Vmxnet3Ring *ring)
 {
     return ring->next;
@@ -705,11 +720,10 @@ vmxnet3_pop_next_tx_descr(VMXNET3State *s,
     Vmxnet3Ring *ring = &s->txq_descr[qidx].tx_ring;
     PCIDevice *d = PCI_DEVICE(s);
 
-    vmxnet3_ring_read_curr_txdesc(d, ring, txd);
+    txd->val1 = vmxnet3_ring_peek_curr_val1(d, ring);
     if (txd->gen == vmxnet3_ring_curr_gen(ring)) {
         /* Only read after generation field verification */
         smp_rmb();
-        /* Re-read to be sure we got the latest version */
         vmxnet3_ring_read_curr_txdesc(d, ring, txd);
         VMXNET3_RING_DUMP(VMW_RIPRN, "TX", qidx, ring);
         *descr_idx = vmxnet3_ring_curr_cell_idx(ring);
@@ -720,6 +734,13 @@ vmxnet3_pop_next_tx_descr(VMXNET3State *s,
     return false;
 }
 
+/* Spread the guest TX queues over the queues of a multiqueue backend */
+static inline NetClientState *
+vmxnet3_get_tx_nc(VMXNET3State *s, uint32_t qidx)
+{
+    return qemu_get_subqueue(s->nic, qidx % MAX(s->conf.peers.queues, 1));
+}
+
 static bool
 vmxnet3_send_packet(VMXNET3State *s, uint32_t qidx)
 {
@@ -734,7 +755,7 @@ vmxnet3_send_packet(VMXNET3State *s, uint32_t qidx)
     vmxnet3_dump_virt_hdr(net_tx_pkt_get_vhdr(s->tx_pkt));
     net_tx_pkt_dump(s->tx_pkt);
 
-    if (!net_tx_pkt_send(s->tx_pkt, qemu_get_queue(s->nic))) {
+    if (!net_tx_pkt_send(s->tx_pkt, vmxnet3_get_tx_nc(s, qidx))) {
         status = VMXNET3_PKT_STATUS_DISCARD;
         goto func_exit;
     }
@@ -814,6 +835,17 @@ vmxnet3_get_rx_ring_gen(VMXNET3State *s, int qidx, int ridx)
     return s->rxq_descr[qidx].rx_ring[ridx].gen;
 }
 
+/* Check the generation bit of the next RX descriptor without reading it */
+static inline bool
+vmxnet3_next_rx_descr_ready(VMXNET3State *s, int qidx, int ridx)
+{
+    struct Vmxnet3_RxDesc d;
+
+    d.val1 = vmxnet3_ring_peek_curr_val1(PCI_DEVICE(s),
+                                         &s->rxq_descr[qidx].rx_ring[ridx]);
+    return d.gen == vmxnet3_get_rx_ring_gen(s, qidx, ridx);
+}
+
 static inline hwaddr
 vmxnet3_pop_rxc_descr(VMXNET3State *s, int qidx, uint32_t *descr_gen)
 {
@@ -856,19 +888,13 @@ vmxnet3_get_next_head_rx_descr(VMXNET3State *s,
                                uint32_t *ridx)
 {
     for (;;) {
-        uint32_t ring_gen;
-        vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_HEAD_BODY_RING,
-                                   descr_buf, descr_idx);
-
         /* If no more free descriptors - return */
-        ring_gen = vmxnet3_get_rx_ring_gen(s, RXQ_IDX, RX_HEAD_BODY_RING);
-        if (descr_buf->gen != ring_gen) {
+        if (!vmxnet3_next_rx_descr_ready(s, RXQ_IDX, RX_HEAD_BODY_RING)) {
             return false;
         }
 
         /* Only read after generation field verification */
         smp_rmb();
-        /* Re-read to be sure we got the latest version */
         vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_HEAD_BODY_RING,
                                    descr_buf, descr_idx);
 
@@ -889,13 +915,10 @@ vmxnet3_get_next_body_rx_descr(VMXNET3State *s,
                                uint32_t *didx,
                                uint32_t *ridx)
 {
-    vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_HEAD_BODY_RING, d, didx);
-
     /* Try to find corresponding descriptor in head/body ring */
-    if (d->gen == vmxnet3_get_rx_ring_gen(s, RXQ_IDX, RX_HEAD_BODY_RING)) {
+    if (vmxnet3_next_rx_descr_ready(s, RXQ_IDX, RX_HEAD_BODY_RING)) {
         /* Only read after generation field verification */
         smp_rmb();
-        /* Re-read to be sure we got the latest version */
         vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_HEAD_BODY_RING, d, didx);
         if (d->btype == VMXNET3_RXD_BTYPE_BODY) {
             vmxnet3_inc_rx_consumption_counter(s, RXQ_IDX, RX_HEAD_BODY_RING);
@@ -908,13 +931,10 @@ vmxnet3_get_next_body_rx_descr(VMXNET3State *s,
      * If there is no free descriptors on head/body ring or next free
      * descriptor is a head descriptor switch to body only ring
      */
-    vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_BODY_ONLY_RING, d, didx);
-
     /* If no more free descriptors - return */
-    if (d->gen == vmxnet3_get_rx_ring_gen(s, RXQ_IDX, RX_BODY_ONLY_RING)) {
+    if (vmxnet3_next_rx_descr_ready(s, RXQ_IDX, RX_BODY_ONLY_RING)) {
         /* Only read after generation field verification */
         smp_rmb();
-        /* Re-read to be sure we got the latest version */
         vmxnet3_read_next_rx_descr(s, RXQ_IDX, RX_BODY_ONLY_RING, d, didx);
         assert(d->btype == VMXNET3_RXD_BTYPE_BODY);
         *ridx = RX_BODY_ONLY_RING;
@@ -1445,12 +1465,16 @@ static void vmxnet3_update_features(VMXNET3State *s)
               s->lro_supported, rxcso_supported,
               s->rx_vlan_stripping);
     if (s->peer_has_vhdr) {
-        qemu_set_offload(qemu_get_queue(s->nic)->peer,
-                         rxcso_supported,
-                         s->lro_supported,
-                         s->lro_supported,
-                         0,
-                         0);
+        int i;
+
+        for (i = 0; i < MAX(s->conf.peers.queues, 1); i++) {
+            qemu_set_offload(qemu_get_subqueue(s->nic, i)->peer,
+                             rxcso_supported,
+                             s->lro_supported,
+                             s->lro_supported,
+                             0,
+                             0);
+        }
     }
 }
 
@@ -2175,10 +2199,14 @@ static void vmxnet3_net_init(VMXNET3State *s)
     s->lro_supported = false;
 
     if (s->peer_has_vhdr) {
-        qemu_set_vnet_hdr_len(qemu_get_queue(s->nic)->peer,
-            sizeof(struct virtio_net_hdr));
+        int i;
+
+        for (i = 0; i < MAX(s->conf.peers.queues, 1); i++) {
+            NetClientState *peer = qemu_get_subqueue(s->nic, i)->peer;
 
-        qemu_using_vnet_hdr(qemu_get_queue(s->nic)->peer, 1);
+            qemu_set_vnet_hdr_len(peer, sizeof(struct virtio_net_hdr));
+            qemu_using_vnet_hdr(peer, 1);
+        }
     }
 
     qemu_format_nic_info_str(qemu_get_queue(s->nic), s->conf.macaddr.a);
@@ -2346,6 +2346,7 @@ static void megasas_scsi_realize(PCIDevice *dev, Error **errp)
                           "megasas-io", 256);
     memory_region_init_io(&s->queue_io, OBJECT(s), &megasas_queue_ops, s,
                           "megasas-queue", 0x40000);
+    address_space_enable_iommu_cache(pci_get_address_space(dev));
 
     if (megasas_use_msix(s) &&
         msix_init(dev, 15, &s->mmio_io, b->mmio_bar, 0x2000,
@@ -1302,6 +1302,7 @@ static void mptsas_scsi_realize(PCIDevice *dev, Error **errp)
                           "mptsas-io", 256);
     memory_region_init_io(&s->diag_io, OBJECT(s), &mptsas_diag_ops, s,
                           "mptsas-diag", 0x10000);
+    address_space_enable_iommu_cache(pci_get_address_space(dev));
 
     pci_register_bar(dev, 0, PCI_BASE_ADDRESS_SPACE_IO, &s->port_io);
     pci_register_bar(dev, 1, PCI_BASE_ADDRESS_SPACE_MEMORY |
@@ -45,7 +45,7 @@ do { printf("scsi-disk: " fmt , ## __VA_ARGS__); } while (0)
 #endif
 
 #define SCSI_WRITE_SAME_MAX         524288
-#define SCSI_DMA_BUF_SIZE           131072
+#define SCSI_DMA_BUF_SIZE           1048576
 #define SCSI_MAX_INQUIRY_LEN        256
 #define SCSI_MAX_MODE_LEN           256
 
@@ -144,6 +144,17 @@ static void scsi_init_iovec(SCSIDiskReq *r, size_t size)
     qemu_iovec_init_external(&r->qiov, &r->iov, 1);
 }
 
+/*
+ * Size of the bounce buffer used when the HBA does not provide a scatter/
+ * gather list.  Small requests get a buffer that fits them, large ones are
+ * split in SCSI_DMA_BUF_SIZE chunks.
+ */
+static size_t scsi_dma_buf_size(SCSIDiskReq *r)
+{
+    return MAX(BDRV_SECTOR_SIZE,
+               MIN((uint64_t)r->sector_count * 512, SCSI_DMA_BUF_SIZE));
+}
+
 static void scsi_disk_save_request(QEMUFile *f, SCSIRequest *req)
 {
     SCSIDiskReq *r = DO_UPCAST(SCSIDiskReq, req, req);
@@ -350,7 +361,7 @@ static void scsi_do_read(SCSIDiskReq *r, int ret)
                                   sdc->dma_readv, r, scsi_dma_complete, r,
                                   DMA_DIRECTION_FROM_DEVICE);
     } else {
-        scsi_init_iovec(r, SCSI_DMA_BUF_SIZE);
+        scsi_init_iovec(r, scsi_dma_buf_size(r));
         block_acct_start(blk_get_stats(s->qdev.conf.blk), &r->acct,
                          r->qiov.size, BLOCK_ACCT_READ);
         r->req.aiocb = sdc->dma_readv(r->sector << BDRV_SECTOR_BITS, &r->qiov,
@@ -496,7 +507,7 @@ static void scsi_write_complete_noio(SCSIDiskReq *r, int ret)
         scsi_write_do_fua(r);
         return;
     } else {
-        scsi_init_iovec(r, SCSI_DMA_BUF_SIZE);
+        scsi_init_iovec(r, scsi_dma_buf_size(r));
         DPRINTF("Write complete tag=0x%x more=%zd\n", r->req.tag, r->qiov.size);
         scsi_req_data(&r->req, r->qiov.size);
     }
@@ -21,6 +21,43 @@
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
 
+/* Context: QEMU global mutex held */
+static bool virtio_scsi_get_iothreads(VirtIOSCSI *s, Error **errp)
+{
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    char **ids;
+    unsigned i, n;
+
+    if (vs->conf.iothread) {
+        error_setg(errp, "iothread and iothreads are mutually exclusive");
+        return false;
+    }
+
+    ids = g_strsplit(vs->conf.iothreads, ":", -1);
+    n = g_strv_length(ids);
+    if (n == 0) {
+        error_setg(errp, "iothreads= must name at least one iothread");
+        g_strfreev(ids);
+        return false;
+    }
+
+    s->iothreads = g_new0(IOThread *, n);
+    for (i = 0; i < n; i++) {
+        IOThread *iothread = iothread_by_id(ids[i]);
+
+        if (!iothread) {
+            error_setg(errp, "iothread '%s' not found", ids[i]);
+            g_strfreev(ids);
+            virtio_scsi_dataplane_cleanup(s);
+            return false;
+        }
+        object_ref(OBJECT(iothread));
+        s->iothreads[s->num_iothreads++] = iothread;
+    }
+    g_strfreev(ids);
+    return true;
+}
+
 /* Context: QEMU global mutex held */
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
 {
@@ -28,25 +65,84 @@ void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp)
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
-    if (vs->conf.iothread) {
+    if (vs->conf.iothreads) {
+        if (!virtio_scsi_get_iothreads(s, errp)) {
+            return;
+        }
+    }
+
+    if (vs->conf.iothread || s->num_iothreads) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
                        "(transport does not support notifiers)");
+            virtio_scsi_dataplane_cleanup(s);
             return;
         }
         if (!virtio_device_ioeventfd_enabled(vdev)) {
             error_setg(errp, "ioeventfd is required for iothread");
+            virtio_scsi_dataplane_cleanup(s);
             return;
         }
-        s->ctx = iothread_get_aio_context(vs->conf.iothread);
+        if (!s->num_iothreads) {
+            s->ctx = iothread_get_aio_context(vs->conf.iothread);
+        } else {
+            s->ctx = iothread_get_aio_context(s->iothreads[0]);
+        }
     } else {
         if (!virtio_device_ioeventfd_enabled(vdev)) {
             return;
         }
         s->ctx = qemu_get_aio_context();
     }
+
+    /* Command queues go round-robin over the IOThreads */
+    s->cmd_vq_ctx = g_new(AioContext *, vs->conf.num_queues);
+    for (i = 0; i < vs->conf.num_queues; i++) {
+        s->cmd_vq_ctx[i] = s->num_iothreads ?
+            iothread_get_aio_context(s->iothreads[i % s->num_iothreads]) :
+            s->ctx;
+    }
+}
+
+/* Context: QEMU global mutex held */
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s)
+{
+    unsigned i;
+
+    for (i = 0; i < s->num_iothreads; i++) {
+        object_unref(OBJECT(s->iothreads[i]));
+    }
+    g_free(s->iothreads);
+    s->iothreads = NULL;
+    s->num_iothreads = 0;
+    g_free(s->cmd_vq_ctx);
+    s->cmd_vq_ctx = NULL;
+}
+
+/* Take the lock of every AioContext that handles a virtqueue, starting
+ * with s->ctx.  Context: QEMU global mutex held
+ */
+static void virtio_scsi_dataplane_acquire(VirtIOSCSI *s)
+{
+    unsigned i;
+
+    aio_context_acquire(s->ctx);
+    for (i = 1; i < s->num_iothreads; i++) {
+        aio_context_acquire(iothread_get_aio_context(s->iothreads[i]));
+    }
+}
+
+static void virtio_scsi_dataplane_release(VirtIOSCSI *s)
+{
+    unsigned i;
+
+    for (i = s->num_iothreads; i-- > 1; ) {
+        aio_context_release(iothread_get_aio_context(s->iothreads[i]));
+    }
+    aio_context_release(s->ctx);
 }
 
 static bool virtio_scsi_data_plane_handle_cmd(VirtIODevice *vdev,
@@ -54,11 +150,12 @@ static bool virtio_scsi_data_plane_handle_cmd(VirtIODevice *vdev,
 {
     bool progress;
     VirtIOSCSI *s = VIRTIO_SCSI(vdev);
+    AioContext *ctx = s->cmd_vq_ctx[virtio_get_queue_index(vq) - 2];
 
-    virtio_scsi_acquire(s);
+    aio_context_acquire(ctx);
     assert(s->ctx && s->dataplane_started);
     progress = virtio_scsi_handle_cmd_vq(s, vq);
-    virtio_scsi_release(s);
+    aio_context_release(ctx);
     return progress;
 }
 
@@ -89,7 +186,7 @@ static bool virtio_scsi_data_plane_handle_event(VirtIODevice *vdev,
 }
 
 static int virtio_scsi_vring_init(VirtIOSCSI *s, VirtQueue *vq, int n,
-                                  VirtIOHandleAIOOutput fn)
+                                  AioContext *ctx, VirtIOHandleAIOOutput fn)
 {
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(s)));
     int rc;
@@ -103,11 +200,11 @@ static int virtio_scsi_vring_init(VirtIOSCSI *s, VirtQueue *vq, int n,
         return rc;
     }
 
-    virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, fn);
+    virtio_queue_aio_set_host_notifier_handler(vq, ctx, fn);
     return 0;
 }
 
-/* assumes s->ctx held */
+/* assumes the contexts of all virtqueues held */
 static void virtio_scsi_clear_aio(VirtIOSCSI *s)
 {
     VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
@@ -116,7 +213,8 @@ static void virtio_scsi_clear_aio(VirtIOSCSI *s)
     virtio_queue_aio_set_host_notifier_handler(vs->ctrl_vq, s->ctx, NULL);
     virtio_queue_aio_set_host_notifier_handler(vs->event_vq, s->ctx, NULL);
     for (i = 0; i < vs->conf.num_queues; i++) {
-        virtio_queue_aio_set_host_notifier_handler(vs->cmd_vqs[i], s->ctx, NULL);
+        virtio_queue_aio_set_host_notifier_handler(vs->cmd_vqs[i],
+                                                   s->cmd_vq_ctx[i], NULL);
     }
 }
 
@@ -146,19 +244,20 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
         goto fail_guest_notifiers;
     }
 
-    aio_context_acquire(s->ctx);
-    rc = virtio_scsi_vring_init(s, vs->ctrl_vq, 0,
+    virtio_scsi_dataplane_acquire(s);
+    rc = virtio_scsi_vring_init(s, vs->ctrl_vq, 0, s->ctx,
                                 virtio_scsi_data_plane_handle_ctrl);
     if (rc) {
         goto fail_vrings;
     }
-    rc = virtio_scsi_vring_init(s, vs->event_vq, 1,
+    rc = virtio_scsi_vring_init(s, vs->event_vq, 1, s->ctx,
                                 virtio_scsi_data_plane_handle_event);
     if (rc) {
         goto fail_vrings;
     }
     for (i = 0; i < vs->conf.num_queues; i++) {
         rc = virtio_scsi_vring_init(s, vs->cmd_vqs[i], i + 2,
+                                    s->cmd_vq_ctx[i],
                                     virtio_scsi_data_plane_handle_cmd);
         if (rc) {
             goto fail_vrings;
@@ -167,12 +266,12 @@ int virtio_scsi_dataplane_start(VirtIODevice *vdev)
 
     s->dataplane_starting = false;
     s->dataplane_started = true;
-    aio_context_release(s->ctx);
+    virtio_scsi_dataplane_release(s);
     return 0;
 
 fail_vrings:
     virtio_scsi_clear_aio(s);
-    aio_context_release(s->ctx);
+    virtio_scsi_dataplane_release(s);
     for (i = 0; i < vs->conf.num_queues + 2; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
     }
@@ -205,11 +304,17 @@ void virtio_scsi_dataplane_stop(VirtIODevice *vdev)
     }
     s->dataplane_stopping = true;
 
-    aio_context_acquire(s->ctx);
+    virtio_scsi_dataplane_acquire(s);
     virtio_scsi_clear_aio(s);
-    aio_context_release(s->ctx);
+    virtio_scsi_dataplane_release(s);
 
-    blk_drain_all(); /* ensure there are no in-flight requests */
+    /* ensure there are no in-flight requests, whether in the block layer
+     * or on their way from one IOThread to another
+     */
+    do {
+        virtio_scsi_wait_bounces(s);
+        blk_drain_all();
+    } while (atomic_read(&s->bounces));
 
     for (i = 0; i < vs->conf.num_queues + 2; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
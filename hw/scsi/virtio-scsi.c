@@ -49,6 +49,7 @@ void virtio_scsi_init_req(VirtIOSCSI *s, VirtQueue *vq, VirtIOSCSIReq *req)
 
     req->vq = vq;
     req->dev = s;
+    req->ctx = qemu_get_current_aio_context();
     qemu_sglist_init(&req->qsgl, DEVICE(s), 8, vdev->dma_as);
     qemu_iovec_init(&req->resp_iov, 1);
     memset((uint8_t *)req + zero_skip, 0, sizeof(*req) - zero_skip);
@@ -61,25 +62,75 @@ void virtio_scsi_free_req(VirtIOSCSIReq *req)
     g_free(req);
 }
 
-static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
+static void virtio_scsi_bounce_wakeup(void *opaque)
+{
+    /* Dummy BH, only used to kick virtio_scsi_wait_bounces() */
+}
+
+static void virtio_scsi_bounce_done(VirtIOSCSI *s)
+{
+    if (atomic_fetch_dec(&s->bounces) == 1 &&
+        atomic_read(&s->bounce_waiting)) {
+        aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                virtio_scsi_bounce_wakeup, NULL);
+    }
+}
+
+/* Context: QEMU global mutex held */
+void virtio_scsi_wait_bounces(VirtIOSCSI *s)
+{
+    atomic_set(&s->bounce_waiting, true);
+    smp_mb();
+    while (atomic_read(&s->bounces)) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+    atomic_set(&s->bounce_waiting, false);
+}
+
+static void virtio_scsi_push_req(VirtIOSCSIReq *req)
 {
     VirtIOSCSI *s = req->dev;
     VirtQueue *vq = req->vq;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
 
-    qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
     virtqueue_push(vq, &req->elem, req->qsgl.size + req->resp_iov.size);
     if (s->dataplane_started && !s->dataplane_fenced) {
         virtio_notify_irqfd(vdev, vq);
     } else {
         virtio_notify(vdev, vq);
     }
+    virtio_scsi_free_req(req);
+}
 
+static void virtio_scsi_push_req_bh(void *opaque)
+{
+    VirtIOSCSIReq *req = opaque;
+    VirtIOSCSI *s = req->dev;
+
+    aio_context_acquire(req->ctx);
+    virtio_scsi_push_req(req);
+    aio_context_release(req->ctx);
+    virtio_scsi_bounce_done(s);
+}
+
+static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
+{
+    VirtIOSCSI *s = req->dev;
+
+    qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
     if (req->sreq) {
         req->sreq->hba_private = NULL;
         scsi_req_unref(req->sreq);
+        req->sreq = NULL;
     }
-    virtio_scsi_free_req(req);
+
+    /* The virtqueue belongs to the AioContext that popped the request */
+    if (s->num_iothreads > 1 && req->ctx != qemu_get_current_aio_context()) {
+        atomic_inc(&s->bounces);
+        aio_bh_schedule_oneshot(req->ctx, virtio_scsi_push_req_bh, req);
+        return;
+    }
+    virtio_scsi_push_req(req);
 }
 
 static void virtio_scsi_bad_req(VirtIOSCSIReq *req)
@@ -191,7 +242,7 @@ static void virtio_scsi_save_request(QEMUFile *f, SCSIRequest *sreq)
 
     assert(n < vs->conf.num_queues);
     qemu_put_be32s(f, &n);
-    qemu_put_virtqueue_element(f, &req->elem);
+    qemu_put_virtqueue_element(VIRTIO_DEVICE(req->dev), f, &req->elem);
 }
 
 static void *virtio_scsi_load_request(QEMUFile *f, SCSIRequest *sreq)
@@ -208,6 +259,9 @@ static void *virtio_scsi_load_request(QEMUFile *f, SCSIRequest *sreq)
     req = qemu_get_virtqueue_element(vdev, f,
                                      sizeof(VirtIOSCSIReq) + vs->cdb_size);
     virtio_scsi_init_req(s, vs->cmd_vqs[n], req);
+    if (s->num_iothreads > 1 && !s->dataplane_fenced) {
+        req->ctx = s->cmd_vq_ctx[n];
+    }
 
     if (virtio_scsi_parse_req(req, sizeof(VirtIOSCSICmdReq) + vs->cdb_size,
                               sizeof(VirtIOSCSICmdResp) + vs->sense_size) < 0) {
@@ -234,7 +288,7 @@ static void virtio_scsi_cancel_notify(Notifier *notifier, void *data)
                                                VirtIOSCSICancelNotifier,
                                                notifier);
 
-    if (--n->tmf_req->remaining == 0) {
+    if (atomic_dec_fetch(&n->tmf_req->remaining) == 0) {
         virtio_scsi_complete_req(n->tmf_req);
     }
     g_free(n);
@@ -243,16 +297,39 @@ static void virtio_scsi_cancel_notify(Notifier *notifier, void *data)
 static inline void virtio_scsi_ctx_check(VirtIOSCSI *s, SCSIDevice *d)
 {
     if (s->dataplane_started && d && blk_is_available(d->conf.blk)) {
-        assert(blk_get_aio_context(d->conf.blk) == s->ctx);
+        assert(s->num_iothreads > 1 ||
+               blk_get_aio_context(d->conf.blk) == s->ctx);
+    }
+}
+
+/* With several IOThreads a device need not be in the AioContext of the
+ * control queue; TMFs take its lock while they look at its requests.
+ */
+static AioContext *virtio_scsi_device_acquire(VirtIOSCSI *s, SCSIDevice *d)
+{
+    AioContext *ctx;
+
+    if (s->num_iothreads < 2 || !d) {
+        return NULL;
+    }
+    ctx = blk_get_aio_context(d->conf.blk);
+    aio_context_acquire(ctx);
+    return ctx;
+}
+
+static void virtio_scsi_device_release(AioContext *ctx)
+{
+    if (ctx) {
+        aio_context_release(ctx);
     }
 }
 
 /* Return 0 if the request is ready to be completed and return to guest;
  * -EINPROGRESS if the request is submitted and will be completed later, in the
  *  case of async cancellation. */
-static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
+static int virtio_scsi_do_tmf_device(VirtIOSCSI *s, VirtIOSCSIReq *req,
+                                     SCSIDevice *d)
 {
-    SCSIDevice *d = virtio_scsi_device_find(s, req->req.tmf.lun);
     SCSIRequest *r, *next;
     BusChild *kid;
     int target;
@@ -341,7 +418,7 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
                 } else {
                     VirtIOSCSICancelNotifier *notifier;
 
-                    req->remaining++;
+                    atomic_inc(&req->remaining);
                     notifier = g_new(VirtIOSCSICancelNotifier, 1);
                     notifier->notifier.notify = virtio_scsi_cancel_notify;
                     notifier->tmf_req = req;
@@ -349,7 +426,7 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
                 }
             }
         }
-        if (--req->remaining > 0) {
+        if (atomic_dec_fetch(&req->remaining) > 0) {
             ret = -EINPROGRESS;
         }
         break;
@@ -360,7 +437,10 @@ static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
         QTAILQ_FOREACH(kid, &s->bus.qbus.children, sibling) {
              d = SCSI_DEVICE(kid->child);
              if (d->channel == 0 && d->id == target) {
+                AioContext *ctx = virtio_scsi_device_acquire(s, d);
+
                 qdev_reset_all(&d->qdev);
+                virtio_scsi_device_release(ctx);
              }
         }
         s->resetting--;
@@ -383,6 +463,17 @@ fail:
     return ret;
 }
 
+static int virtio_scsi_do_tmf(VirtIOSCSI *s, VirtIOSCSIReq *req)
+{
+    SCSIDevice *d = virtio_scsi_device_find(s, req->req.tmf.lun);
+    AioContext *ctx = virtio_scsi_device_acquire(s, d);
+    int ret;
+
+    ret = virtio_scsi_do_tmf_device(s, req, d);
+    virtio_scsi_device_release(ctx);
+    return ret;
+}
+
 static void virtio_scsi_handle_ctrl_req(VirtIOSCSI *s, VirtIOSCSIReq *req)
 {
     VirtIODevice *vdev = (VirtIODevice *)s;
@@ -532,30 +623,9 @@ static void virtio_scsi_fail_cmd_req(VirtIOSCSIReq *req)
     virtio_scsi_complete_cmd_req(req);
 }
 
-static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
+static int virtio_scsi_handle_cmd_req_new(VirtIOSCSI *s, VirtIOSCSIReq *req,
+                                          SCSIDevice *d)
 {
-    VirtIOSCSICommon *vs = &s->parent_obj;
-    SCSIDevice *d;
-    int rc;
-
-    rc = virtio_scsi_parse_req(req, sizeof(VirtIOSCSICmdReq) + vs->cdb_size,
-                               sizeof(VirtIOSCSICmdResp) + vs->sense_size);
-    if (rc < 0) {
-        if (rc == -ENOTSUP) {
-            virtio_scsi_fail_cmd_req(req);
-            return -ENOTSUP;
-        } else {
-            virtio_scsi_bad_req(req);
-            return -EINVAL;
-        }
-    }
-
-    d = virtio_scsi_device_find(s, req->req.cmd.lun);
-    if (!d) {
-        req->resp.cmd.response = VIRTIO_SCSI_S_BAD_TARGET;
-        virtio_scsi_complete_cmd_req(req);
-        return -ENOENT;
-    }
     virtio_scsi_ctx_check(s, d);
     req->sreq = scsi_req_new(d, req->req.cmd.tag,
                              virtio_scsi_get_lun(req->req.cmd.lun),
@@ -583,9 +653,87 @@ static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
     scsi_req_unref(sreq);
 }
 
+static bool virtio_scsi_forward_cmd_req(VirtIOSCSI *s, VirtIOSCSIReq *req,
+                                        SCSIDevice *d);
+
+static void virtio_scsi_forward_cmd_req_bh(void *opaque)
+{
+    VirtIOSCSIReq *req = opaque;
+    VirtIOSCSI *s = req->dev;
+    AioContext *ctx = qemu_get_current_aio_context();
+    SCSIDevice *d;
+
+    aio_context_acquire(ctx);
+    /* Look the device up again, it may have been unplugged meanwhile */
+    d = virtio_scsi_device_find(s, req->req.cmd.lun);
+    if (!d) {
+        req->resp.cmd.response = VIRTIO_SCSI_S_BAD_TARGET;
+        virtio_scsi_complete_cmd_req(req);
+    } else if (!virtio_scsi_forward_cmd_req(s, req, d) &&
+               virtio_scsi_handle_cmd_req_new(s, req, d) == 0) {
+        virtio_scsi_handle_cmd_req_submit(s, req);
+    }
+    aio_context_release(ctx);
+    virtio_scsi_bounce_done(s);
+}
+
+/* With several IOThreads, a command is submitted from the AioContext of its
+ * device.  Return true if @req was passed on to that context.
+ */
+static bool virtio_scsi_forward_cmd_req(VirtIOSCSI *s, VirtIOSCSIReq *req,
+                                        SCSIDevice *d)
+{
+    AioContext *ctx;
+
+    if (s->num_iothreads < 2 || !d->conf.blk) {
+        return false;
+    }
+    ctx = blk_get_aio_context(d->conf.blk);
+    if (ctx == qemu_get_current_aio_context()) {
+        return false;
+    }
+
+    atomic_inc(&s->bounces);
+    aio_bh_schedule_oneshot(ctx, virtio_scsi_forward_cmd_req_bh, req);
+    return true;
+}
+
+static int virtio_scsi_handle_cmd_req_prepare(VirtIOSCSI *s, VirtIOSCSIReq *req)
+{
+    VirtIOSCSICommon *vs = &s->parent_obj;
+    SCSIDevice *d;
+    int rc;
+
+    rc = virtio_scsi_parse_req(req, sizeof(VirtIOSCSICmdReq) + vs->cdb_size,
+                               sizeof(VirtIOSCSICmdResp) + vs->sense_size);
+    if (rc < 0) {
+        if (rc == -ENOTSUP) {
+            virtio_scsi_fail_cmd_req(req);
+            return -ENOTSUP;
+        } else {
+            virtio_scsi_bad_req(req);
+            return -EINVAL;
+        }
+    }
+
+    d = virtio_scsi_device_find(s, req->req.cmd.lun);
+    if (!d) {
+        req->resp.cmd.response = VIRTIO_SCSI_S_BAD_TARGET;
+        virtio_scsi_complete_cmd_req(req);
+        return -ENOENT;
+    }
+    if (virtio_scsi_forward_cmd_req(s, req, d)) {
+        return -EINPROGRESS;
+    }
+    return virtio_scsi_handle_cmd_req_new(s, req, d);
+}
+
 bool virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
+    VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
     VirtIOSCSIReq *req, *next;
+    VirtIOSCSIReq *batch[VIRTQUEUE_POP_BATCH];
+    unsigned int i, n;
     int ret = 0;
     bool progress = false;
 
@@ -594,20 +742,36 @@ bool virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
     do {
         virtio_queue_set_notification(vq, 0);
 
-        while ((req = virtio_scsi_pop_req(s, vq))) {
+        while (ret != -EINVAL &&
+               (n = virtqueue_pop_batch(vq, sizeof(VirtIOSCSIReq) +
+                                        vs->cdb_size, (void **)batch,
+                                        ARRAY_SIZE(batch)))) {
             progress = true;
-            ret = virtio_scsi_handle_cmd_req_prepare(s, req);
-            if (!ret) {
-                QTAILQ_INSERT_TAIL(&reqs, req, next);
-            } else if (ret == -EINVAL) {
-                /* The device is broken and shouldn't process any request */
-                while (!QTAILQ_EMPTY(&reqs)) {
-                    req = QTAILQ_FIRST(&reqs);
-                    QTAILQ_REMOVE(&reqs, req, next);
-                    blk_io_unplug(req->sreq->dev->conf.blk);
-                    scsi_req_unref(req->sreq);
+            for (i = 0; i < n; i++) {
+                virtio_scsi_init_req(s, vq, batch[i]);
+            }
+            for (i = 0; i < n; i++) {
+                req = batch[i];
+                if (ret == -EINVAL) {
+                    /* Drop what is left of the batch */
                     virtqueue_detach_element(req->vq, &req->elem, 0);
                     virtio_scsi_free_req(req);
+                    continue;
+                }
+                ret = virtio_scsi_handle_cmd_req_prepare(s, req);
+                if (!ret) {
+                    QTAILQ_INSERT_TAIL(&reqs, req, next);
+                } else if (ret == -EINVAL) {
+                    /* The device is broken and shouldn't process any
+                     * request */
+                    while (!QTAILQ_EMPTY(&reqs)) {
+                        req = QTAILQ_FIRST(&reqs);
+                        QTAILQ_REMOVE(&reqs, req, next);
+                        blk_io_unplug(req->sreq->dev->conf.blk);
+                        scsi_req_unref(req->sreq);
+                        virtqueue_detach_element(req->vq, &req->elem, 0);
+                        virtio_scsi_free_req(req);
+                    }
                 }
             }
         }
@@ -689,6 +853,7 @@ static void virtio_scsi_reset(VirtIODevice *vdev)
     VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(vdev);
 
     assert(!s->dataplane_started);
+    virtio_scsi_wait_bounces(s);
     s->resetting++;
     qbus_reset_all(&s->bus.qbus);
     s->resetting--;
@@ -791,12 +956,19 @@ static void virtio_scsi_hotplug(HotplugHandler *hotplug_dev, DeviceState *dev,
     SCSIDevice *sd = SCSI_DEVICE(dev);
 
     if (s->ctx && !s->dataplane_fenced) {
+        AioContext *ctx = s->ctx;
+
         if (blk_op_is_blocked(sd->conf.blk, BLOCK_OP_TYPE_DATAPLANE, errp)) {
             return;
         }
-        virtio_scsi_acquire(s);
-        blk_set_aio_context(sd->conf.blk, s->ctx);
-        virtio_scsi_release(s);
+        /* Devices go round-robin over the IOThreads, too */
+        if (s->num_iothreads > 1) {
+            ctx = iothread_get_aio_context(
+                s->iothreads[s->next_device_iothread++ % s->num_iothreads]);
+        }
+        aio_context_acquire(ctx);
+        blk_set_aio_context(sd->conf.blk, ctx);
+        aio_context_release(ctx);
 
     }
 
@@ -912,6 +1084,7 @@ static void virtio_scsi_device_unrealize(DeviceState *dev, Error **errp)
     VirtIOSCSI *s = VIRTIO_SCSI(dev);
 
     qbus_set_hotplug_handler(BUS(&s->bus), NULL, &error_abort);
+    virtio_scsi_dataplane_cleanup(s);
     virtio_scsi_common_unrealize(dev, errp);
 }
 
@@ -929,6 +1102,7 @@ static Property virtio_scsi_properties[] = {
                                                 VIRTIO_SCSI_F_CHANGE, true),
     DEFINE_PROP_LINK("iothread", VirtIOSCSI, parent_obj.conf.iothread,
                      TYPE_IOTHREAD, IOThread *),
+    DEFINE_PROP_STRING("iothreads", VirtIOSCSI, parent_obj.conf.iothreads),
     DEFINE_PROP_END_OF_LIST(),
 };
 
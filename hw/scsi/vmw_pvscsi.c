@@ -1130,6 +1130,7 @@ pvscsi_realizefn(PCIDevice *pci_dev, Error **errp)
     memory_region_init_io(&s->io_space, OBJECT(s), &pvscsi_ops, s,
                           "pvscsi-io", PVSCSI_MEM_SPACE_SIZE);
     pci_register_bar(pci_dev, 0, PCI_BASE_ADDRESS_SPACE_MEMORY, &s->io_space);
+    address_space_enable_iommu_cache(pci_get_address_space(pci_dev));
 
     pvscsi_init_msi(s);
 
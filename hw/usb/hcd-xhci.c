@@ -140,6 +140,19 @@ typedef struct XHCITRB {
     bool ccs;
 } XHCITRB;
 
+/*
+ * TRBs are read from guest memory in aligned blocks, so that walking a TD
+ * and then fetching it costs one DMA read per block instead of two per
+ * TRB.  A block never crosses a page.  The cache only lives for one pass
+ * over a ring.
+ */
+#define TRB_CACHE_SIZE 256
+typedef struct XHCITRBCache {
+    dma_addr_t base;
+    bool valid;
+    uint8_t data[TRB_CACHE_SIZE];
+} XHCITRBCache;
+
 enum {
     PLS_U0              =  0,
     PLS_U1              =  1,
@@ -714,20 +727,44 @@ static void xhci_ring_init(XHCIState *xhci, XHCIRing *ring,
     ring->ccs = 1;
 }
 
+static void xhci_trb_cache_fill(XHCIState *xhci, XHCITRBCache *cache,
+                                dma_addr_t addr)
+{
+    cache->base = addr & ~(dma_addr_t)(TRB_CACHE_SIZE - 1);
+    pci_dma_read(PCI_DEVICE(xhci), cache->base, cache->data, TRB_CACHE_SIZE);
+    cache->valid = true;
+}
+
+static void xhci_read_trb(XHCIState *xhci, XHCITRBCache *cache,
+                          dma_addr_t addr, bool ccs, XHCITRB *trb)
+{
+    bool hit = cache->valid && addr >= cache->base &&
+               addr - cache->base < TRB_CACHE_SIZE;
+
+    if (!hit) {
+        xhci_trb_cache_fill(xhci, cache, addr);
+    }
+    memcpy(trb, cache->data + (addr - cache->base), TRB_SIZE);
+    if (hit && (le32_to_cpu(trb->control) & TRB_C) != ccs) {
+        /* It was not ours when cached, the guest may have posted it since */
+        xhci_trb_cache_fill(xhci, cache, addr);
+        memcpy(trb, cache->data + (addr - cache->base), TRB_SIZE);
+    }
+    le64_to_cpus(&trb->parameter);
+    le32_to_cpus(&trb->status);
+    le32_to_cpus(&trb->control);
+}
+
 static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
-                               dma_addr_t *addr)
+                               dma_addr_t *addr, XHCITRBCache *cache)
 {
-    PCIDevice *pci_dev = PCI_DEVICE(xhci);
     uint32_t link_cnt = 0;
 
     while (1) {
         TRBType type;
-        pci_dma_read(pci_dev, ring->dequeue, trb, TRB_SIZE);
+        xhci_read_trb(xhci, cache, ring->dequeue, ring->ccs, trb);
         trb->addr = ring->dequeue;
         trb->ccs = ring->ccs;
-        le64_to_cpus(&trb->parameter);
-        le32_to_cpus(&trb->status);
-        le32_to_cpus(&trb->control);
 
         trace_usb_xhci_fetch_trb(ring->dequeue, trb_name(trb),
                                  trb->parameter, trb->status, trb->control);
@@ -757,9 +794,9 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
     }
 }
 
-static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
+static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring,
+                                  XHCITRBCache *cache)
 {
-    PCIDevice *pci_dev = PCI_DEVICE(xhci);
     XHCITRB trb;
     int length = 0;
     dma_addr_t dequeue = ring->dequeue;
@@ -770,10 +807,7 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
 
     while (1) {
         TRBType type;
-        pci_dma_read(pci_dev, dequeue, &trb, TRB_SIZE);
-        le64_to_cpus(&trb.parameter);
-        le32_to_cpus(&trb.status);
-        le32_to_cpus(&trb.control);
+        xhci_read_trb(xhci, cache, dequeue, ccs, &trb);
 
         if ((trb.control & TRB_C) != ccs) {
             return -length;
@@ -1859,6 +1893,7 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
     XHCIStreamContext *stctx = NULL;
     XHCITransfer *xfer;
     XHCIRing *ring;
+    XHCITRBCache cache = { .valid = false };
     USBEndpoint *ep = NULL;
     uint64_t mfindex;
     unsigned int count = 0;
@@ -1942,7 +1977,7 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
 
     epctx->kick_active++;
     while (1) {
-        length = xhci_ring_chain_length(xhci, ring);
+        length = xhci_ring_chain_length(xhci, ring, &cache);
         if (length <= 0) {
             break;
         }
@@ -1953,7 +1988,8 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
 
         for (i = 0; i < length; i++) {
             TRBType type;
-            type = xhci_ring_fetch(xhci, ring, &xfer->trbs[i], NULL);
+            type = xhci_ring_fetch(xhci, ring, &xfer->trbs[i], NULL,
+                                   &cache);
             assert(type);
         }
         xfer->streamid = streamid;
@@ -2425,6 +2461,7 @@ static uint32_t xhci_nec_challenge(uint32_t hi, uint32_t lo)
 static void xhci_process_commands(XHCIState *xhci)
 {
     XHCITRB trb;
+    XHCITRBCache cache = { .valid = false };
     TRBType type;
     XHCIEvent event = {ER_COMMAND_COMPLETE, CC_SUCCESS};
     dma_addr_t addr;
@@ -2438,7 +2475,8 @@ static void xhci_process_commands(XHCIState *xhci)
 
     xhci->crcr_low |= CRCR_CRR;
 
-    while ((type = xhci_ring_fetch(xhci, &xhci->cmd_ring, &trb, &addr))) {
+    while ((type = xhci_ring_fetch(xhci, &xhci->cmd_ring, &trb, &addr,
+                                   &cache))) {
         event.ptr = addr;
         switch (type) {
         case CR_ENABLE_SLOT:
@@ -33,6 +33,7 @@
 #include "qemu/error-report.h"
 #include "qemu/range.h"
 #include "sysemu/kvm.h"
+#include "sysemu/sysemu.h"
 #include "trace.h"
 #include "qapi/error.h"
 
@@ -52,6 +53,14 @@ struct vfio_as_head vfio_address_spaces =
 static int vfio_kvm_device_fd = -1;
 #endif
 
+/*
+ * VFIO_IOMMU_MAP_DMA pins the whole range from a single thread, faulting
+ * in every page that is not present yet, and the type1 backend holds the
+ * container lock while doing so.  For large RAM sections fault the pages
+ * in first from several threads, so that pinning only has to look them up.
+ */
+#define VFIO_PREFAULT_MIN_SIZE (1ULL << 30)
+
 /*
  * Common VFIO interrupt disable
  */
@@ -518,6 +527,20 @@ static void vfio_listener_region_add(MemoryListener *listener,
 
     llsize = int128_sub(llend, int128_make64(iova));
 
+    if (!section->readonly && smp_cpus > 1 &&
+        int128_get64(llsize) >= VFIO_PREFAULT_MIN_SIZE) {
+        Error *local_err = NULL;
+
+        trace_vfio_listener_region_add_prefault(iova, int128_get64(llsize),
+                                                smp_cpus);
+        os_mem_prealloc(memory_region_get_fd(section->mr), vaddr,
+                        int128_get64(llsize), smp_cpus, NULL, 0, &local_err);
+        if (local_err) {
+            /* Not fatal, VFIO_IOMMU_MAP_DMA will report the real error */
+            warn_report_err(local_err);
+        }
+    }
+
     ret = vfio_dma_map(container, iova, int128_get64(llsize),
                        vaddr, section->readonly);
     if (ret) {
@@ -24,6 +24,8 @@
 #include <linux/vhost.h>
 
 #define VHOST_MEMORY_MAX_NREGIONS    8
+/* Most slots used when VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS is acked */
+#define VHOST_USER_MAX_RAM_SLOTS     512
 #define VHOST_USER_F_PROTOCOL_FEATURES 30
 
 /*
@@ -39,6 +41,7 @@ enum VhostUserProtocolFeature {
     VHOST_USER_PROTOCOL_F_NET_MTU = 4,
     VHOST_USER_PROTOCOL_F_SLAVE_REQ = 5,
     VHOST_USER_PROTOCOL_F_CROSS_ENDIAN = 6,
+    VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS = 7,
 
     VHOST_USER_PROTOCOL_F_MAX
 };
@@ -72,6 +75,9 @@ typedef enum VhostUserRequest {
     VHOST_USER_SET_VRING_ENDIAN = 23,
     VHOST_USER_GET_CONFIG = 24,
     VHOST_USER_SET_CONFIG = 25,
+    VHOST_USER_GET_MAX_MEM_SLOTS = 26,
+    VHOST_USER_ADD_MEM_REG = 27,
+    VHOST_USER_REM_MEM_REG = 28,
     VHOST_USER_MAX
 } VhostUserRequest;
 
@@ -95,6 +101,11 @@ typedef struct VhostUserMemory {
     VhostUserMemoryRegion regions[VHOST_MEMORY_MAX_NREGIONS];
 } VhostUserMemory;
 
+typedef struct VhostUserMemRegMsg {
+    uint64_t padding;
+    VhostUserMemoryRegion region;
+} VhostUserMemRegMsg;
+
 typedef struct VhostUserLog {
     uint64_t mmap_size;
     uint64_t mmap_offset;
@@ -129,6 +140,7 @@ typedef union {
         struct vhost_vring_state state;
         struct vhost_vring_addr addr;
         VhostUserMemory memory;
+        VhostUserMemRegMsg mem_reg;
         VhostUserLog log;
         struct vhost_iotlb_msg iotlb;
         VhostUserConfig config;
@@ -150,6 +162,12 @@ static VhostUserMsg m __attribute__ ((unused));
 struct vhost_user {
     CharBackend *chr;
     int slave_fd;
+    /* With VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS: the slave's slot
+     * count and the regions it currently has mapped.
+     */
+    int max_mem_slots;
+    int num_shadow_regions;
+    VhostUserMemoryRegion *shadow_regions;
 };
 
 static bool ioeventfd_enabled(void)
@@ -233,6 +251,8 @@ static bool vhost_user_one_time_request(VhostUserRequest request)
     case VHOST_USER_SET_OWNER:
     case VHOST_USER_RESET_OWNER:
     case VHOST_USER_SET_MEM_TABLE:
+    case VHOST_USER_ADD_MEM_REG:
+    case VHOST_USER_REM_MEM_REG:
     case VHOST_USER_GET_QUEUE_NUM:
     case VHOST_USER_NET_SET_MTU:
         return true;
@@ -314,6 +334,129 @@ static int vhost_user_set_log_base(struct vhost_dev *dev, uint64_t base,
     return 0;
 }
 
+static bool vhost_user_mem_region_equal(const VhostUserMemoryRegion *a,
+                                        const VhostUserMemoryRegion *b)
+{
+    return a->guest_phys_addr == b->guest_phys_addr &&
+           a->memory_size == b->memory_size &&
+           a->userspace_addr == b->userspace_addr &&
+           a->mmap_offset == b->mmap_offset;
+}
+
+static bool vhost_user_mem_region_find(const VhostUserMemoryRegion *regions,
+                                       int nregions,
+                                       const VhostUserMemoryRegion *reg)
+{
+    int i;
+
+    for (i = 0; i < nregions; i++) {
+        if (vhost_user_mem_region_equal(&regions[i], reg)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int vhost_user_send_mem_reg(struct vhost_dev *dev, int request,
+                                   const VhostUserMemoryRegion *reg, int fd)
+{
+    bool reply_supported = virtio_has_feature(dev->protocol_features,
+                                              VHOST_USER_PROTOCOL_F_REPLY_ACK);
+    VhostUserMsg msg = {
+        .hdr.request = request,
+        .hdr.flags = VHOST_USER_VERSION,
+        .hdr.size = sizeof(msg.payload.mem_reg),
+        .payload.mem_reg.region = *reg,
+    };
+
+    if (reply_supported) {
+        msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
+    }
+
+    if (vhost_user_write(dev, &msg, fd >= 0 ? &fd : NULL, fd >= 0) < 0) {
+        return -1;
+    }
+
+    if (reply_supported) {
+        return process_message_reply(dev, &msg);
+    }
+
+    return 0;
+}
+
+/*
+ * Bring the slave's memory map in line with dev->mem by removing and
+ * adding single regions, so that regions that did not change stay
+ * mapped in the slave and its datapath keeps running.
+ */
+static int vhost_user_set_mem_table_incremental(struct vhost_dev *dev)
+{
+    struct vhost_user *u = dev->opaque;
+    VhostUserMemoryRegion *regions;
+    int *fds;
+    int i, fd, nregions = 0, ret = -1;
+
+    regions = g_new(VhostUserMemoryRegion, dev->mem->nregions);
+    fds = g_new(int, dev->mem->nregions);
+
+    for (i = 0; i < dev->mem->nregions; ++i) {
+        struct vhost_memory_region *reg = dev->mem->regions + i;
+        ram_addr_t offset;
+        MemoryRegion *mr;
+
+        assert((uintptr_t)reg->userspace_addr == reg->userspace_addr);
+        mr = memory_region_from_host((void *)(uintptr_t)reg->userspace_addr,
+                                     &offset);
+        fd = memory_region_get_fd(mr);
+        if (fd > 0) {
+            if (nregions == u->max_mem_slots) {
+                error_report("Failed preparing vhost-user memory table msg");
+                goto out;
+            }
+            regions[nregions].userspace_addr = reg->userspace_addr;
+            regions[nregions].memory_size = reg->memory_size;
+            regions[nregions].guest_phys_addr = reg->guest_phys_addr;
+            regions[nregions].mmap_offset = offset;
+            fds[nregions++] = fd;
+        }
+    }
+
+    if (!nregions) {
+        error_report("Failed initializing vhost-user memory map, "
+                     "consider using -object memory-backend-file share=on");
+        goto out;
+    }
+
+    /* Remove first, so that the slave never holds overlapping regions */
+    for (i = 0; i < u->num_shadow_regions; i++) {
+        if (!vhost_user_mem_region_find(regions, nregions,
+                                        &u->shadow_regions[i]) &&
+            vhost_user_send_mem_reg(dev, VHOST_USER_REM_MEM_REG,
+                                    &u->shadow_regions[i], -1) < 0) {
+            goto out;
+        }
+    }
+    for (i = 0; i < nregions; i++) {
+        if (!vhost_user_mem_region_find(u->shadow_regions,
+                                        u->num_shadow_regions, &regions[i]) &&
+            vhost_user_send_mem_reg(dev, VHOST_USER_ADD_MEM_REG,
+                                    &regions[i], fds[i]) < 0) {
+            goto out;
+        }
+    }
+
+    g_free(u->shadow_regions);
+    u->shadow_regions = regions;
+    u->num_shadow_regions = nregions;
+    regions = NULL;
+    ret = 0;
+
+out:
+    g_free(regions);
+    g_free(fds);
+    return ret;
+}
+
 static int vhost_user_set_mem_table(struct vhost_dev *dev,
                                     struct vhost_memory *mem)
 {
@@ -328,6 +471,11 @@ static int vhost_user_set_mem_table(struct vhost_dev *dev,
         .hdr.flags = VHOST_USER_VERSION,
     };
 
+    if (virtio_has_feature(dev->protocol_features,
+                           VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
+        return vhost_user_set_mem_table_incremental(dev);
+    }
+
     if (reply_supported) {
         msg.hdr.flags |= VHOST_USER_NEED_REPLY_MASK;
     }
@@ -786,6 +934,7 @@ static int vhost_user_init(struct vhost_dev *dev, void *opaque)
     u = g_new0(struct vhost_user, 1);
     u->chr = opaque;
     u->slave_fd = -1;
+    u->max_mem_slots = VHOST_MEMORY_MAX_NREGIONS;
     dev->opaque = u;
 
     err = vhost_user_get_features(dev, &features);
@@ -818,6 +967,24 @@ static int vhost_user_init(struct vhost_dev *dev, void *opaque)
             }
         }
 
+        if (virtio_has_feature(dev->protocol_features,
+                               VHOST_USER_PROTOCOL_F_CONFIGURE_MEM_SLOTS)) {
+            uint64_t max_slots;
+
+            err = vhost_user_get_u64(dev, VHOST_USER_GET_MAX_MEM_SLOTS,
+                                     &max_slots);
+            if (err < 0) {
+                return err;
+            }
+            if (max_slots < VHOST_MEMORY_MAX_NREGIONS) {
+                error_report("vhost-user backend supports only %" PRIu64
+                             " memory slots, at least %d are required",
+                             max_slots, VHOST_MEMORY_MAX_NREGIONS);
+                return -1;
+            }
+            u->max_mem_slots = MIN(max_slots, VHOST_USER_MAX_RAM_SLOTS);
+        }
+
         if (virtio_has_feature(features, VIRTIO_F_IOMMU_PLATFORM) &&
                 !(virtio_has_feature(dev->protocol_features,
                     VHOST_USER_PROTOCOL_F_SLAVE_REQ) &&
@@ -857,6 +1024,7 @@ static int vhost_user_cleanup(struct vhost_dev *dev)
         close(u->slave_fd);
         u->slave_fd = -1;
     }
+    g_free(u->shadow_regions);
     g_free(u);
     dev->opaque = 0;
 
@@ -872,7 +1040,9 @@ static int vhost_user_get_vq_index(struct vhost_dev *dev, int idx)
 
 static int vhost_user_memslots_limit(struct vhost_dev *dev)
 {
-    return VHOST_MEMORY_MAX_NREGIONS;
+    struct vhost_user *u = dev->opaque;
+
+    return u->max_mem_slots;
 }
 
 static bool vhost_user_requires_shm_log(struct vhost_dev *dev)
@@ -178,7 +178,8 @@ static uint64_t vhost_vsock_get_features(VirtIODevice *vdev,
                                          uint64_t requested_features,
                                          Error **errp)
 {
-    /* No feature bits used yet */
+    /* No feature bits used yet, and the host kernel has no packed ring */
+    virtio_clear_feature(&requested_features, VIRTIO_F_RING_PACKED);
     return requested_features;
 }
 
@@ -27,17 +27,18 @@
 #include "qapi-event.h"
 #include "trace.h"
 #include "qemu/error-report.h"
+#include "migration/misc.h"
 
 #include "hw/virtio/virtio-bus.h"
 #include "hw/virtio/virtio-access.h"
 
 #define BALLOON_PAGE_SIZE  (1 << VIRTIO_BALLOON_PFN_SHIFT)
 
-static void balloon_page(void *addr, int deflate)
+static void balloon_pages(void *addr, size_t len, int deflate)
 {
     if (!qemu_balloon_is_inhibited() && (!kvm_enabled() ||
                                          kvm_has_sync_mmu())) {
-        qemu_madvise(addr, BALLOON_PAGE_SIZE,
+        qemu_madvise(addr, len,
                 deflate ? QEMU_MADV_WILLNEED : QEMU_MADV_DONTNEED);
     }
 }
@@ -205,13 +206,49 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+/* A run of guest pages that are contiguous in one RAM MemoryRegion */
+typedef struct BalloonRange {
+    MemoryRegion *mr;
+    ram_addr_t start;
+    ram_addr_t len;
+} BalloonRange;
+
+static void balloon_range_flush(BalloonRange *range, int deflate)
+{
+    if (range->mr) {
+        balloon_pages(memory_region_get_ram_ptr(range->mr) + range->start,
+                      range->len, deflate);
+        memory_region_unref(range->mr);
+        range->mr = NULL;
+    }
+}
+
+/* Add one page to @range, flushing the previous run if it cannot grow.
+ * Takes over the reference to @mr.
+ */
+static void balloon_range_add(BalloonRange *range, MemoryRegion *mr,
+                              ram_addr_t addr, int deflate)
+{
+    if (range->mr == mr && range->start + range->len == addr) {
+        range->len += BALLOON_PAGE_SIZE;
+        memory_region_unref(mr);
+        return;
+    }
+    balloon_range_flush(range, deflate);
+    range->mr = mr;
+    range->start = addr;
+    range->len = BALLOON_PAGE_SIZE;
+}
+
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
     VirtQueueElement *elem;
     MemoryRegionSection section;
+    int deflate = vq == s->dvq;
 
     for (;;) {
+        BalloonRange range = { .mr = NULL };
         size_t offset = 0;
         uint32_t pfn;
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
@@ -240,12 +277,13 @@ static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
             trace_virtio_balloon_handle_output(memory_region_name(section.mr),
                                                pa);
             /* Using memory_region_get_ram_ptr is bending the rules a bit, but
-               should be OK because we only want a single page.  */
+               should be OK because the run never leaves the region.  Guests
+               usually hand over long runs of consecutive PFNs; discard them
+               with one madvise each instead of one per page.  */
             addr = section.offset_within_region;
-            balloon_page(memory_region_get_ram_ptr(section.mr) + addr,
-                         !!(vq == s->dvq));
-            memory_region_unref(section.mr);
+            balloon_range_add(&range, section.mr, addr, deflate);
         }
+        balloon_range_flush(&range, deflate);
 
         virtqueue_push(vq, elem, offset);
         virtio_notify(vdev, vq);
@@ -305,16 +343,176 @@ out:
     }
 }
 
+static bool virtio_balloon_free_page_support(VirtIOBalloon *s)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+
+    return virtio_vdev_has_feature(vdev, VIRTIO_BALLOON_F_FREE_PAGE_HINT);
+}
+
+/*
+ * Free page hints.  While migration is in a precopy round, the device
+ * publishes a command id in the config space.  The guest acknowledges it
+ * on free_page_vq with an out buffer holding the id, then queues its free
+ * page blocks as in buffers; they are dropped from the migration bitmap
+ * without being touched, since the guest can take them back at any time.
+ * Before each bitmap sync the id is replaced by STOP, so that no hint is
+ * applied across a sync, and a new id starts the next round afterwards.
+ */
+static void virtio_balloon_handle_free_page_vq(VirtIODevice *vdev,
+                                               VirtQueue *vq)
+{
+    VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
+    VirtQueueElement *elem;
+    bool notify = false;
+
+    for (;;) {
+        elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
+        if (!elem) {
+            break;
+        }
+
+        if (elem->out_num) {
+            uint32_t id;
+
+            if (iov_to_buf(elem->out_sg, elem->out_num, 0,
+                           &id, sizeof(id)) != sizeof(id)) {
+                virtio_error(vdev, "virtio-balloon: bad free page command");
+                virtqueue_detach_element(vq, elem, 0);
+                g_free(elem);
+                break;
+            }
+            virtio_tswap32s(vdev, &id);
+            if (id == s->free_page_report_cmd_id &&
+                s->free_page_report_status == FREE_PAGE_REPORT_S_REQUESTED) {
+                s->free_page_report_status = FREE_PAGE_REPORT_S_START;
+            } else if (s->free_page_report_status ==
+                       FREE_PAGE_REPORT_S_START) {
+                /* The guest has no more free pages to report */
+                s->free_page_report_status = FREE_PAGE_REPORT_S_STOP;
+            }
+        }
+
+        if (elem->in_num &&
+            s->free_page_report_status == FREE_PAGE_REPORT_S_START) {
+            unsigned i;
+
+            for (i = 0; i < elem->in_num; i++) {
+                qemu_guest_free_page_hint(elem->in_sg[i].iov_base,
+                                          elem->in_sg[i].iov_len);
+            }
+        }
+
+        /* Nothing was written, so none of the pages is dirtied on unmap */
+        virtqueue_push(vq, elem, 0);
+        g_free(elem);
+        notify = true;
+    }
+
+    if (notify) {
+        virtio_notify(vdev, vq);
+    }
+}
+
+static void virtio_balloon_free_page_start(VirtIOBalloon *s)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+
+    if (s->free_page_report_cmd_id == VIRTIO_BALLOON_CMD_ID_MAX) {
+        s->free_page_report_cmd_id = VIRTIO_BALLOON_CMD_ID_MIN;
+    } else {
+        s->free_page_report_cmd_id++;
+    }
+    s->free_page_report_status = FREE_PAGE_REPORT_S_REQUESTED;
+    virtio_notify_config(vdev);
+}
+
+static void virtio_balloon_free_page_stop(VirtIOBalloon *s)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+
+    if (s->free_page_report_status == FREE_PAGE_REPORT_S_REQUESTED ||
+        s->free_page_report_status == FREE_PAGE_REPORT_S_START) {
+        s->free_page_report_status = FREE_PAGE_REPORT_S_STOP;
+        virtio_notify_config(vdev);
+    }
+}
+
+static void virtio_balloon_free_page_done(VirtIOBalloon *s)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+
+    if (s->free_page_report_status != FREE_PAGE_REPORT_S_DONE) {
+        s->free_page_report_status = FREE_PAGE_REPORT_S_DONE;
+        virtio_notify_config(vdev);
+    }
+}
+
+static void virtio_balloon_free_page_report_notify(Notifier *n, void *data)
+{
+    VirtIOBalloon *s = container_of(n, VirtIOBalloon,
+                                    free_page_report_notify);
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    PrecopyNotifyReason reason = *(PrecopyNotifyReason *)data;
+
+    if (!virtio_balloon_free_page_support(s) ||
+        !(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+        return;
+    }
+
+    switch (reason) {
+    case PRECOPY_NOTIFY_BEFORE_BITMAP_SYNC:
+        virtio_balloon_free_page_stop(s);
+        break;
+    case PRECOPY_NOTIFY_AFTER_BITMAP_SYNC:
+        if (vdev->vm_running) {
+            virtio_balloon_free_page_start(s);
+        } else {
+            /* Last sync: let the guest take its pages back, also on the
+             * destination, which gets this status with the device state */
+            virtio_balloon_free_page_done(s);
+        }
+        break;
+    case PRECOPY_NOTIFY_CLEANUP:
+        virtio_balloon_free_page_done(s);
+        break;
+    }
+}
+
+static size_t virtio_balloon_config_size(VirtIOBalloon *s)
+{
+    if (s->host_features & (1ULL << VIRTIO_BALLOON_F_FREE_PAGE_HINT)) {
+        return sizeof(struct virtio_balloon_config);
+    }
+    return offsetof(struct virtio_balloon_config, free_page_report_cmd_id);
+}
+
 static void virtio_balloon_get_config(VirtIODevice *vdev, uint8_t *config_data)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
-    struct virtio_balloon_config config;
+    struct virtio_balloon_config config = {};
 
     config.num_pages = cpu_to_le32(dev->num_pages);
     config.actual = cpu_to_le32(dev->actual);
 
+    switch (dev->free_page_report_status) {
+    case FREE_PAGE_REPORT_S_REQUESTED:
+    case FREE_PAGE_REPORT_S_START:
+        config.free_page_report_cmd_id =
+            cpu_to_le32(dev->free_page_report_cmd_id);
+        break;
+    case FREE_PAGE_REPORT_S_STOP:
+        config.free_page_report_cmd_id =
+            cpu_to_le32(VIRTIO_BALLOON_CMD_ID_STOP);
+        break;
+    case FREE_PAGE_REPORT_S_DONE:
+        config.free_page_report_cmd_id =
+            cpu_to_le32(VIRTIO_BALLOON_CMD_ID_DONE);
+        break;
+    }
+
     trace_virtio_balloon_get_config(config.num_pages, config.actual);
-    memcpy(config_data, &config, sizeof(struct virtio_balloon_config));
+    memcpy(config_data, &config, virtio_balloon_config_size(dev));
 }
 
 static int build_dimm_list(Object *obj, void *opaque)
@@ -358,7 +556,7 @@ static void virtio_balloon_set_config(VirtIODevice *vdev,
     uint32_t oldactual = dev->actual;
     ram_addr_t vm_ram_size = get_current_ram_size();
 
-    memcpy(&config, config_data, sizeof(struct virtio_balloon_config));
+    memcpy(&config, config_data, virtio_balloon_config_size(dev));
     dev->actual = le32_to_cpu(config.actual);
     if (dev->actual != oldactual) {
         qapi_event_send_balloon_change(vm_ram_size -
@@ -410,6 +608,23 @@ static int virtio_balloon_post_load_device(void *opaque, int version_id)
     return 0;
 }
 
+static bool virtio_balloon_free_page_report_needed(void *opaque)
+{
+    return virtio_balloon_free_page_support(opaque);
+}
+
+static const VMStateDescription vmstate_virtio_balloon_free_page_report = {
+    .name = "virtio-balloon-device/free-page-report",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = virtio_balloon_free_page_report_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(free_page_report_cmd_id, VirtIOBalloon),
+        VMSTATE_UINT32(free_page_report_status, VirtIOBalloon),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static const VMStateDescription vmstate_virtio_balloon_device = {
     .name = "virtio-balloon-device",
     .version_id = 1,
@@ -420,6 +635,10 @@ static const VMStateDescription vmstate_virtio_balloon_device = {
         VMSTATE_UINT32(actual, VirtIOBalloon),
         VMSTATE_END_OF_LIST()
     },
+    .subsections = (const VMStateDescription * []) {
+        &vmstate_virtio_balloon_free_page_report,
+        NULL
+    }
 };
 
 static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
@@ -429,7 +648,7 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
     int ret;
 
     virtio_init(vdev, "virtio-balloon", VIRTIO_ID_BALLOON,
-                sizeof(struct virtio_balloon_config));
+                virtio_balloon_config_size(s));
 
     ret = qemu_add_balloon_handler(virtio_balloon_to_target,
                                    virtio_balloon_stat, s);
@@ -444,6 +663,16 @@ static void virtio_balloon_device_realize(DeviceState *dev, Error **errp)
     s->dvq = virtio_add_queue(vdev, 128, virtio_balloon_handle_output);
     s->svq = virtio_add_queue(vdev, 128, virtio_balloon_receive_stats);
 
+    if (s->host_features & (1ULL << VIRTIO_BALLOON_F_FREE_PAGE_HINT)) {
+        s->free_page_vq = virtio_add_queue(vdev, VIRTQUEUE_MAX_SIZE,
+                                           virtio_balloon_handle_free_page_vq);
+        s->free_page_report_status = FREE_PAGE_REPORT_S_STOP;
+        s->free_page_report_cmd_id = VIRTIO_BALLOON_CMD_ID_MIN - 1;
+        s->free_page_report_notify.notify =
+            virtio_balloon_free_page_report_notify;
+        precopy_add_notifier(&s->free_page_report_notify);
+    }
+
     reset_stats(s);
 }
 
@@ -452,6 +681,9 @@ static void virtio_balloon_device_unrealize(DeviceState *dev, Error **errp)
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBalloon *s = VIRTIO_BALLOON(dev);
 
+    if (s->free_page_vq) {
+        precopy_remove_notifier(&s->free_page_report_notify);
+    }
     balloon_stats_destroy_timer(s);
     qemu_remove_balloon_handler(s);
     virtio_cleanup(vdev);
@@ -466,6 +698,7 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
         g_free(s->stats_vq_elem);
         s->stats_vq_elem = NULL;
     }
+    s->free_page_report_status = FREE_PAGE_REPORT_S_STOP;
 }
 
 static void virtio_balloon_set_status(VirtIODevice *vdev, uint8_t status)
@@ -506,6 +739,8 @@ static const VMStateDescription vmstate_virtio_balloon = {
 static Property virtio_balloon_properties[] = {
     DEFINE_PROP_BIT("deflate-on-oom", VirtIOBalloon, host_features,
                     VIRTIO_BALLOON_F_DEFLATE_ON_OOM, false),
+    DEFINE_PROP_BIT("free-page-hint", VirtIOBalloon, host_features,
+                    VIRTIO_BALLOON_F_FREE_PAGE_HINT, false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
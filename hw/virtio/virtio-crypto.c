@@ -569,6 +569,30 @@ virtio_crypto_handle_sym_req(VirtIOCrypto *vcrypto,
     return 0;
 }
 
+static void virtio_crypto_req_done(void *opaque, int ret)
+{
+    VirtIOCryptoReq *request = opaque;
+    VirtIOCrypto *vcrypto = request->vcrypto;
+    uint8_t status;
+
+    if (ret < 0) {
+        status = -ret;
+    } else { /* ret == VIRTIO_CRYPTO_OK */
+        status = ret;
+    }
+    virtio_crypto_req_complete(request, status);
+    virtio_crypto_free_request(request);
+    vcrypto->inflight--;
+}
+
+/* Wait for the backend to complete the requests it was given */
+static void virtio_crypto_drain(VirtIOCrypto *vcrypto)
+{
+    while (vcrypto->inflight) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+}
+
 static int
 virtio_crypto_handle_request(VirtIOCryptoReq *request)
 {
@@ -583,7 +607,6 @@ virtio_crypto_handle_request(VirtIOCryptoReq *request)
     unsigned in_num;
     unsigned out_num;
     uint32_t opcode;
-    uint8_t status = VIRTIO_CRYPTO_ERR;
     uint64_t session_id;
     CryptoDevBackendSymOpInfo *sym_op_info = NULL;
     Error *local_err = NULL;
@@ -645,18 +668,16 @@ virtio_crypto_handle_request(VirtIOCryptoReq *request)
             /* Set request's parameter */
             request->flags = CRYPTODEV_BACKEND_ALG_SYM;
             request->u.sym_op_info = sym_op_info;
+            vcrypto->inflight++;
             ret = cryptodev_backend_crypto_operation(vcrypto->cryptodev,
-                                    request, queue_index, &local_err);
+                                    request, queue_index,
+                                    virtio_crypto_req_done, &local_err);
             if (ret < 0) {
-                status = -ret;
                 if (local_err) {
                     error_report_err(local_err);
                 }
-            } else { /* ret == VIRTIO_CRYPTO_OK */
-                status = ret;
+                virtio_crypto_req_done(request, ret);
             }
-            virtio_crypto_req_complete(request, status);
-            virtio_crypto_free_request(request);
         }
         break;
     case VIRTIO_CRYPTO_HASH:
@@ -741,6 +762,8 @@ static uint64_t virtio_crypto_get_features(VirtIODevice *vdev,
 static void virtio_crypto_reset(VirtIODevice *vdev)
 {
     VirtIOCrypto *vcrypto = VIRTIO_CRYPTO(vdev);
+
+    virtio_crypto_drain(vcrypto);
     /* multiqueue is disabled by default */
     vcrypto->curr_queues = 1;
     if (!cryptodev_backend_is_ready(vcrypto->cryptodev)) {
@@ -825,6 +848,8 @@ static void virtio_crypto_device_unrealize(DeviceState *dev, Error **errp)
     VirtIOCryptoQueue *q;
     int i, max_queues;
 
+    virtio_crypto_drain(vcrypto);
+
     max_queues = vcrypto->multiqueue ? vcrypto->max_queues : 1;
     for (i = 0; i < max_queues; i++) {
         virtio_del_queue(vdev, i);
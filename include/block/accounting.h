@@ -26,7 +26,9 @@
 #define BLOCK_ACCOUNTING_H
 
 #include "qemu/timed-average.h"
+#include "qemu/log-histogram.h"
 #include "qemu/thread.h"
+#include "qemu/stats64.h"
 
 typedef struct BlockAcctTimedStats BlockAcctTimedStats;
 typedef struct BlockAcctStats BlockAcctStats;
@@ -41,19 +43,26 @@ enum BlockAcctType {
 struct BlockAcctTimedStats {
     BlockAcctStats *stats;
     TimedAverage latency[BLOCK_MAX_IOTYPE];
+    /* Latencies of the current interval, reset when it expires */
+    LogHistogram latency_hist[BLOCK_MAX_IOTYPE];
+    int64_t hist_expiration;
     unsigned interval_length; /* in seconds */
     QSLIST_ENTRY(BlockAcctTimedStats) entries;
 };
 
 struct BlockAcctStats {
+    /* The counters are updated atomically, read them with stat64_get() */
+    Stat64 nr_bytes[BLOCK_MAX_IOTYPE];
+    Stat64 nr_ops[BLOCK_MAX_IOTYPE];
+    Stat64 invalid_ops[BLOCK_MAX_IOTYPE];
+    Stat64 failed_ops[BLOCK_MAX_IOTYPE];
+    Stat64 total_time_ns[BLOCK_MAX_IOTYPE];
+    Stat64 merged[BLOCK_MAX_IOTYPE];
+    Stat64 last_access_time_ns;
+
+    /* Protects the histograms and the intervals */
     QemuMutex lock;
-    uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
-    uint64_t nr_ops[BLOCK_MAX_IOTYPE];
-    uint64_t invalid_ops[BLOCK_MAX_IOTYPE];
-    uint64_t failed_ops[BLOCK_MAX_IOTYPE];
-    uint64_t total_time_ns[BLOCK_MAX_IOTYPE];
-    uint64_t merged[BLOCK_MAX_IOTYPE];
-    int64_t last_access_time_ns;
+    LogHistogram latency_hist[BLOCK_MAX_IOTYPE];
     QSLIST_HEAD(, BlockAcctTimedStats) intervals;
     bool account_invalid;
     bool account_failed;
@@ -82,5 +91,10 @@ void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
                               enum BlockAcctType type);
+bool block_acct_latency_percentiles(BlockAcctStats *stats,
+                                    BlockAcctTimedStats *timed_stats,
+                                    enum BlockAcctType type,
+                                    const double *percentiles,
+                                    uint64_t *values, int n);
 
 #endif
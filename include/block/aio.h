@@ -50,6 +50,7 @@ typedef void IOHandler(void *opaque);
 struct Coroutine;
 struct ThreadPool;
 struct LinuxAioState;
+struct LuringState;
 
 struct AioContext {
     GSource source;
@@ -123,6 +124,12 @@ struct AioContext {
      */
     struct LinuxAioState *linux_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    /* State for Linux io_uring.  Uses aio_context_acquire/release for
+     * locking.
+     */
+    struct LuringState *linux_io_uring;
+#endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
      * locking.
@@ -143,6 +150,11 @@ struct AioContext {
     /* Are we in polling mode or monitoring file descriptors? */
     bool poll_started;
 
+    /* Time aio_poll() spent blocked waiting for events, in nanoseconds.
+     * Written only by the thread running the AioContext.
+     */
+    int64_t idle_ns;
+
     /* epoll(7) state used when built with CONFIG_EPOLL */
     int epollfd;
     bool epoll_enabled;
@@ -384,6 +396,14 @@ struct ThreadPool *aio_get_thread_pool(AioContext *ctx);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
+/* Set up the io_uring ring of this AioContext if it does not exist yet and
+ * return it, or return NULL and set @errp if the host cannot provide one */
+struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+
+/* Return the LuringState bound to this AioContext, or NULL if none has been
+ * set up with aio_setup_linux_io_uring() */
+struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
 /**
  * aio_timer_new:
  * @ctx: the aio context
@@ -564,4 +584,21 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+typedef void AioPollStatsFn(void *opaque, int fd, uint64_t polls,
+                            uint64_t hits);
+
+/**
+ * aio_context_foreach_poll_handler:
+ * @ctx: the aio context
+ * @fn: callback
+ * @opaque: passed to @fn
+ *
+ * Call @fn for each handler of @ctx that can be busy polled, with its fd,
+ * the number of times it was polled and how many of those made progress.
+ * May be called from any thread; the statistics are read without
+ * synchronization and may be slightly stale.
+ */
+void aio_context_foreach_poll_handler(AioContext *ctx, AioPollStatsFn *fn,
+                                      void *opaque);
+
 #endif
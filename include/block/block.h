@@ -98,6 +98,7 @@ typedef struct HDGeometry {
                                       select an appropriate protocol driver,
                                       ignoring the format layer */
 #define BDRV_O_NO_IO       0x10000 /* don't initialize for I/O */
+#define BDRV_O_IO_URING    0x20000 /* use io_uring instead of the thread pool */
 
 #define BDRV_O_CACHE_MASK  (BDRV_O_NOCACHE | BDRV_O_NO_FLUSH)
 
@@ -300,6 +301,34 @@ int coroutine_fn bdrv_co_writev(BdrvChild *child, int64_t sector_num,
  */
 int coroutine_fn bdrv_co_pwrite_zeroes(BdrvChild *child, int64_t offset,
                                        int bytes, BdrvRequestFlags flags);
+/*
+ * Copy a range from @src to @dst, letting the drivers offload the copy (for
+ * example to the filesystem or the storage) so that the data does not pass
+ * through QEMU.  Returns -ENOTSUP if the copy cannot be offloaded, in which
+ * case nothing has been written.  @flags may contain BDRV_REQ_ZERO_WRITE to
+ * write zeroes to @dst instead.
+ */
+int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
+                                    BdrvChild *dst, uint64_t dst_offset,
+                                    uint64_t bytes, BdrvRequestFlags flags);
+int coroutine_fn bdrv_co_copy_range_from(BdrvChild *src, uint64_t src_offset,
+                                         BdrvChild *dst, uint64_t dst_offset,
+                                         uint64_t bytes,
+                                         BdrvRequestFlags flags);
+int coroutine_fn bdrv_co_copy_range_to(BdrvChild *src, uint64_t src_offset,
+                                       BdrvChild *dst, uint64_t dst_offset,
+                                       uint64_t bytes, BdrvRequestFlags flags);
+/*
+ * Send @hdr_iov and then @bytes of data read from @child at @offset to the
+ * stream socket @fd, letting the kernel move the data from the page cache
+ * to the socket.  Returns -ENOTSUP if this is not possible, in which case
+ * nothing has been sent.  Any other error may leave a partial message on
+ * @fd.
+ */
+int coroutine_fn bdrv_co_sendfile(BdrvChild *child, uint64_t offset,
+                                  uint64_t bytes, int fd,
+                                  struct iovec *hdr_iov,
+                                  unsigned int hdr_niov);
 BlockDriverState *bdrv_find_backing_image(BlockDriverState *bs,
     const char *backing_file);
 void bdrv_refresh_filename(BlockDriverState *bs);
@@ -57,6 +57,9 @@
 #define BLOCK_OPT_NOCOW             "nocow"
 #define BLOCK_OPT_OBJECT_SIZE       "object_size"
 #define BLOCK_OPT_REFCOUNT_BITS     "refcount_bits"
+#define BLOCK_OPT_COMPRESSION_TYPE  "compression_type"
+#define BLOCK_OPT_EXTL2             "extended_l2"
+#define BLOCK_OPT_DATA_FILE         "data_file"
 
 #define BLOCK_PROBE_BUF_SIZE        512
 
@@ -76,6 +79,11 @@ typedef struct BdrvTrackedRequest {
     int64_t overlap_offset;
     unsigned int overlap_bytes;
 
+    /* Set if the request can become serialising, see tracked_request_begin */
+    bool may_serialise;
+    /* Set if the request is on bs->tracked_requests */
+    bool tracked;
+
     QLIST_ENTRY(BdrvTrackedRequest) list;
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
@@ -201,6 +209,35 @@ struct BlockDriver {
     int coroutine_fn (*bdrv_co_pdiscard)(BlockDriverState *bs,
         int64_t offset, int bytes);
 
+    /*
+     * Copy @bytes from @src at @src_offset to @dst at @dst_offset without
+     * passing the data through a buffer.  bs is src->bs in
+     * bdrv_co_copy_range_from, which maps the source range and forwards the
+     * request with bdrv_co_copy_range_from() to a child, or to
+     * bdrv_co_copy_range_to() once it has reached the node that stores the
+     * data.  bs is dst->bs in bdrv_co_copy_range_to, which does the same for
+     * the destination and performs the copy.  Return -ENOTSUP if the
+     * request cannot be offloaded; callers then fall back to reading and
+     * writing the data.
+     */
+    int coroutine_fn (*bdrv_co_copy_range_from)(BlockDriverState *bs,
+        BdrvChild *src, uint64_t src_offset, BdrvChild *dst,
+        uint64_t dst_offset, uint64_t bytes, BdrvRequestFlags flags);
+    int coroutine_fn (*bdrv_co_copy_range_to)(BlockDriverState *bs,
+        BdrvChild *src, uint64_t src_offset, BdrvChild *dst,
+        uint64_t dst_offset, uint64_t bytes, BdrvRequestFlags flags);
+
+    /*
+     * Write the @hdr_niov buffers in @hdr_iov to the stream socket @fd,
+     * followed by @bytes of data at @offset, without copying the data
+     * through a buffer.  Format drivers map the range and forward the
+     * request with bdrv_co_sendfile().  Return -ENOTSUP, before anything
+     * has been written to @fd, if the request cannot be served this way.
+     */
+    int coroutine_fn (*bdrv_co_sendfile)(BlockDriverState *bs,
+        uint64_t offset, uint64_t bytes, int fd,
+        struct iovec *hdr_iov, unsigned int hdr_niov);
+
     /*
      * Building block for bdrv_block_status[_above] and
      * bdrv_is_allocated[_above].  The driver should answer only
@@ -721,11 +758,23 @@ struct BlockDriverState {
 
     unsigned int write_gen;               /* Current data generation */
 
+    /* Requests that can become serialising, and requests that are not on
+     * tracked_requests.  As long as no request of the former kind is in
+     * flight, requests skip tracked_requests.  Accessed with atomic ops.
+     */
+    unsigned int may_serialise_in_flight;
+    unsigned int untracked_in_flight;
+
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
+    CoQueue untracked_queue;    /* waiting for untracked_in_flight == 0 */
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
+    /* Discards are merged into discard_batch while others are in flight */
+    unsigned int discards_in_flight;
+    struct BdrvDiscardBatch *discard_batch;
+    CoQueue discard_queue;      /* waiting for a discard to complete */
 
     /* Only read/written by whoever has set active_flush_req to true.  */
     unsigned int flushed_gen;             /* Flushed write generation */
@@ -946,6 +995,7 @@ void commit_active_start(const char *job_id, BlockDriverState *bs,
  * @filter_node_name: The node name that should be assigned to the filter
  * driver that the mirror job inserts into the graph above @bs. NULL means that
  * a node name should be autogenerated.
+ * @copy_mode: When to trigger writes to the target.
  * @errp: Error object.
  *
  * Start a mirroring operation on @bs.  Clusters that are allocated
@@ -959,7 +1009,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
-                  bool unmap, const char *filter_node_name, Error **errp);
+                  bool unmap, const char *filter_node_name,
+                  MirrorCopyMode copy_mode, Error **errp);
 
 /*
  * backup_job_create:
@@ -1042,6 +1093,9 @@ int64_t coroutine_fn bdrv_co_get_block_status_from_backing(BlockDriverState *bs,
                                                            int *pnum,
                                                            BlockDriverState **file);
 const char *bdrv_get_parent_name(const BlockDriverState *bs);
+unsigned bdrv_backing_generation(void);
+void bdrv_backing_generation_bump(void);
+void bdrv_backing_data_changed(BlockDriverState *bs);
 void blk_dev_change_media_cb(BlockBackend *blk, bool load, Error **errp);
 bool blk_dev_has_removable_media(BlockBackend *blk);
 bool blk_dev_has_tray(BlockBackend *blk);
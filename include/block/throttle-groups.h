@@ -51,6 +51,15 @@ typedef struct ThrottleGroupMember {
     unsigned       pending_reqs[2];
     QLIST_ENTRY(ThrottleGroupMember) round_robin;
 
+    /* I/O that has already been accounted in the group and can be done
+     * without taking the group lock.  These fields are only accessed from
+     * aio_context; credit_generation tells whether they are still valid
+     * for the current group configuration. */
+    uint64_t       credit_bytes[2];
+    double         credit_units[2];
+    uint64_t       credit_op_size;
+    unsigned       credit_generation;
+
 } ThrottleGroupMember;
 
 #define TYPE_THROTTLE_GROUP "throttle-group"
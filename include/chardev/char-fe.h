@@ -190,6 +190,20 @@ guint qemu_chr_fe_add_watch(CharBackend *be, GIOCondition cond,
  */
 int qemu_chr_fe_write(CharBackend *be, const uint8_t *buf, int len);
 
+/**
+ * @qemu_chr_fe_writev:
+ *
+ * Like qemu_chr_fe_write(), but gathers the data from @iov.  Back ends
+ * that implement chr_writev send it with a single call, so a front end
+ * can hand over many buffers at once without copying them.
+ *
+ * @iov the data
+ * @iovcnt the number of elements in @iov
+ *
+ * Returns: the number of bytes consumed (0 if no assicated Chardev)
+ */
+int qemu_chr_fe_writev(CharBackend *be, const struct iovec *iov, int iovcnt);
+
 /**
  * @qemu_chr_fe_write_all:
  *
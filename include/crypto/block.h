@@ -75,6 +75,7 @@ typedef enum {
  * @readfunc: callback for reading data from the volume
  * @opaque: data to pass to @readfunc
  * @flags: bitmask of QCryptoBlockOpenFlags values
+ * @n_threads: allow concurrent I/O from up to @n_threads threads
  * @errp: pointer to a NULL-initialized error object
  *
  * Create a new block encryption object for an existing
@@ -107,6 +108,7 @@ QCryptoBlock *qcrypto_block_open(QCryptoBlockOpenOptions *options,
                                  QCryptoBlockReadFunc readfunc,
                                  void *opaque,
                                  unsigned int flags,
+                                 size_t n_threads,
                                  Error **errp);
 
 /**
@@ -170,6 +172,9 @@ QCryptoBlockInfo *qcrypto_block_get_info(QCryptoBlock *block,
  * plain text back into @buf. @len and @offset must be
  * a multiple of the encryption format sector size.
  *
+ * Up to the @n_threads given to qcrypto_block_open() threads
+ * may call this and qcrypto_block_encrypt() at the same time.
+ *
  * Returns 0 on success, -1 on failure
  */
 int qcrypto_block_decrypt(QCryptoBlock *block,
@@ -190,6 +195,9 @@ int qcrypto_block_decrypt(QCryptoBlock *block,
  * cipher text back into @buf. @len and @offset must be
  * a multiple of the encryption format sector size.
  *
+ * Up to the @n_threads given to qcrypto_block_open() threads
+ * may call this and qcrypto_block_decrypt() at the same time.
+ *
  * Returns 0 on success, -1 on failure
  */
 int qcrypto_block_encrypt(QCryptoBlock *block,
@@ -202,7 +210,9 @@ int qcrypto_block_encrypt(QCryptoBlock *block,
  * qcrypto_block_get_cipher:
  * @block: the block encryption object
  *
- * Get the cipher to use for payload encryption
+ * Get the cipher to use for payload encryption.  If the
+ * block was opened for several threads, this is the first
+ * of the ciphers they use.
  *
  * Returns: the cipher object
  */
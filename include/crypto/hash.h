@@ -97,6 +97,31 @@ int qcrypto_hash_bytes(QCryptoHashAlgorithm alg,
                        size_t *resultlen,
                        Error **errp);
 
+/**
+ * qcrypto_hash_bytes_multi:
+ * @alg: the hash algorithm
+ * @bufs: the array of memory regions to hash
+ * @nbufs: the length of @bufs
+ * @results: buffer to hold the output hashes
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Computes a separate hash for each of the memory
+ * regions present in @bufs, and stores the hash of
+ * @bufs[i] at offset i * qcrypto_hash_digest_len(@alg)
+ * of @results, which must be large enough to hold
+ * @nbufs hashes.
+ *
+ * When there is enough data, the regions are hashed
+ * in parallel by several threads.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qcrypto_hash_bytes_multi(QCryptoHashAlgorithm alg,
+                             const struct iovec *bufs,
+                             size_t nbufs,
+                             uint8_t *results,
+                             Error **errp);
+
 /**
  * qcrypto_hash_digestv:
  * @alg: the hash algorithm
@@ -319,4 +319,26 @@ int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
  */
 char *qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess);
 
+/**
+ * qcrypto_tls_session_enable_ktls_tx:
+ * @sess: the TLS session object
+ * @fd: the TCP socket the session runs over
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Once the handshake is complete, hand the transmit keys of
+ * @sess to the kernel so that plain text written to @fd is
+ * encrypted there.  After this succeeds, payload data must be
+ * written directly to @fd and never with
+ * qcrypto_tls_session_write(), whose record state is no longer
+ * kept up to date.  Receiving data is not affected.
+ *
+ * This is only possible on Linux, for TLS 1.2 sessions using
+ * AES-128-GCM.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *sess,
+                                       int fd,
+                                       Error **errp);
+
 #endif /* QCRYPTO_TLSSESSION_H */
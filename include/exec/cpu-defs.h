@@ -32,6 +32,7 @@
 #include "exec/hwaddr.h"
 #endif
 #include "exec/memattrs.h"
+#include "qemu/thread.h"
 
 #ifndef TARGET_LONG_BITS
 #error TARGET_LONG_BITS must be defined before including this header
@@ -66,6 +67,32 @@ typedef uint64_t target_ulong;
 #define CPU_TLB_ENTRY_BITS 5
 #endif
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/*
+ * The TLB of each MMU mode is allocated at run time, and resized on a
+ * flush according to how full it got since the last resize; see
+ * tlb_mmu_resize() in cputlb.c.  The TCG fast path loads tlb_mask[] and
+ * tlb_table[] from env instead of using a constant size.
+ */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+
+# if HOST_LONG_BITS == 32
+/* Make sure we do not require a double-word shift for the TLB load */
+#  define CPU_TLB_DYN_MAX_BITS (32 - TARGET_PAGE_BITS)
+# else /* HOST_LONG_BITS == 64 */
+/*
+ * Assuming TARGET_PAGE_BITS==12, with 2**22 entries we can cover 2**(22+12)
+ * == 16G of address space, roughly what the second-level TLB of a current
+ * x86_64 host covers.  Also, do not size the TLB past the guest's address
+ * space.
+ */
+#  define CPU_TLB_DYN_MAX_BITS                                  \
+    MIN(22, TARGET_VIRT_ADDR_SPACE_BITS - TARGET_PAGE_BITS)
+# endif
+
+#else /* !TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 /* TCG_TARGET_TLB_DISPLACEMENT_BITS is used in CPU_TLB_BITS to ensure that
  * the TLB is not unnecessarily small, but still small enough for the
  * TLB lookup instruction sequence used by the TCG target.
@@ -98,6 +125,8 @@ typedef uint64_t target_ulong;
 
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 typedef struct CPUTLBEntry {
     /* bit TARGET_LONG_BITS to TARGET_PAGE_BITS : virtual address
        bit TARGET_PAGE_BITS-1..4  : Nonzero for accesses that should not
@@ -131,17 +160,63 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+/*
+ * In CPU_COMMON_TLB below, tlb_large_page_addr[i] and tlb_large_page_mask[i]
+ * describe a region covering all of the large pages entered into
+ * tlb_table[i]; flushing any page within it flushes all of tlb_table[i].
+ * The region is matched if (addr & tlb_large_page_mask[i]) ==
+ * tlb_large_page_addr[i], and is empty when tlb_large_page_addr[i] is -1.
+ */
+
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* Usage statistics of one MMU mode's TLB, used to decide its next size */
+typedef struct CPUTLBDesc {
+    /* start of the current usage window, in ns of realtime */
+    int64_t window_begin_ns;
+    /* maximum number of entries in use observed during the window */
+    size_t window_max_entries;
+    /* number of valid entries in the table since the last flush */
+    size_t n_used_entries;
+} CPUTLBDesc;
+
+/*
+ * tlb_mask[i] is (number of entries in tlb_table[i] - 1) << CPU_TLB_ENTRY_BITS:
+ * applied to the page number shifted left by CPU_TLB_ENTRY_BITS, it gives
+ * the byte offset of the entry within tlb_table[i].
+ *
+ * tlb_lock is taken by the owning vCPU when it replaces the tables, and
+ * by other threads that walk them (see tlb_reset_dirty).
+ */
+#define CPU_COMMON_TLB \
+    /* The meaning of the MMU modes is defined in the target code. */   \
+    CPUTLBDesc tlb_desc[NB_MMU_MODES];                                  \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    CPUIOTLBEntry *iotlb[NB_MMU_MODES];                                 \
+    CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                 \
+    QemuSpin tlb_lock;                                                  \
+    size_t tlb_flush_count;                                             \
+    target_ulong tlb_large_page_addr[NB_MMU_MODES];                     \
+    target_ulong tlb_large_page_mask[NB_MMU_MODES];                     \
+    target_ulong vtlb_index;                                            \
+
+#else
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
     CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
     CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
     CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                    \
     CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                 \
+    QemuSpin tlb_lock;                                                  \
     size_t tlb_flush_count;                                             \
-    target_ulong tlb_flush_addr;                                        \
-    target_ulong tlb_flush_mask;                                        \
+    target_ulong tlb_large_page_addr[NB_MMU_MODES];                     \
+    target_ulong tlb_large_page_mask[NB_MMU_MODES];                     \
     target_ulong vtlb_index;                                            \
 
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 #else
 
 #define CPU_COMMON_TLB
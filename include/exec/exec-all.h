@@ -96,6 +96,16 @@ void cpu_address_space_init(CPUState *cpu, int asidx,
 
 #if !defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
 /* cputlb.c */
+/**
+ * tlb_init - initialize a CPU's TLB
+ * @cpu: CPU whose TLB should be initialized
+ */
+void tlb_init(CPUState *cpu);
+/**
+ * tlb_destroy - free a CPU's TLB
+ * @cpu: CPU whose TLB should be freed
+ */
+void tlb_destroy(CPUState *cpu);
 /**
  * tlb_flush_page:
  * @cpu: CPU whose TLB should be flushed
@@ -187,6 +197,58 @@ void tlb_flush_page_by_mmuidx_all_cpus(CPUState *cpu, target_ulong addr,
  */
 void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *cpu, target_ulong addr,
                                               uint16_t idxmap);
+/**
+ * tlb_flush_range:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ *
+ * Flush the pages covering [@addr, @addr + @len) from the TLB of the
+ * specified CPU, for all MMU indexes.  This is cheaper than calling
+ * tlb_flush_page for each page, and falls back to flushing a whole
+ * MMU index if the range covers a large page or most of its TLB.
+ */
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len);
+/**
+ * tlb_flush_range_by_mmuidx:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush a range of pages from the TLB of the specified CPU, for the
+ * specified MMU indexes.
+ */
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap);
+/**
+ * tlb_flush_range_by_mmuidx_all_cpus:
+ * @cpu: Originating CPU of the flush
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush a range of pages from the TLB of all CPUs, for the specified
+ * MMU indexes.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *cpu, target_ulong addr,
+                                        target_ulong len, uint16_t idxmap);
+/**
+ * tlb_flush_range_by_mmuidx_all_cpus_synced:
+ * @cpu: Originating CPU of the flush
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush a range of pages from the TLB of all CPUs, for the specified
+ * MMU indexes like tlb_flush_range_by_mmuidx_all_cpus except the source
+ * vCPUs work is scheduled as safe work, as for
+ * tlb_flush_page_by_mmuidx_all_cpus_synced.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                               target_ulong addr,
+                                               target_ulong len,
+                                               uint16_t idxmap);
 /**
  * tlb_flush_by_mmuidx:
  * @cpu: CPU whose TLB should be flushed
@@ -238,7 +300,8 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu, uint16_t idxmap);
  *
  * At most one entry for a given virtual address is permitted. Only a
  * single TARGET_PAGE_SIZE region is mapped; the supplied @size is only
- * used by tlb_flush_page.
+ * used by tlb_flush_page and tlb_flush_range, which flush the whole
+ * MMU index when they hit a large page.
  */
 void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
                              hwaddr paddr, MemTxAttrs attrs,
@@ -256,6 +319,12 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr);
 void probe_write(CPUArchState *env, target_ulong addr, int mmu_idx,
                  uintptr_t retaddr);
 #else
+static inline void tlb_init(CPUState *cpu)
+{
+}
+static inline void tlb_destroy(CPUState *cpu)
+{
+}
 static inline void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
 }
@@ -300,6 +369,26 @@ static inline void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                        uint16_t idxmap)
 {
 }
+static inline void tlb_flush_range(CPUState *cpu, target_ulong addr,
+                                   target_ulong len)
+{
+}
+static inline void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                                             target_ulong len, uint16_t idxmap)
+{
+}
+static inline void tlb_flush_range_by_mmuidx_all_cpus(CPUState *cpu,
+                                                      target_ulong addr,
+                                                      target_ulong len,
+                                                      uint16_t idxmap)
+{
+}
+static inline void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                                             target_ulong addr,
+                                                             target_ulong len,
+                                                             uint16_t idxmap)
+{
+}
 static inline void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
 {
 }
@@ -341,7 +430,7 @@ struct TranslationBlock {
 #define CF_LAST_IO     0x00008000 /* Last insn may be an IO access.  */
 #define CF_NOCACHE     0x00010000 /* To be freed after execution */
 #define CF_USE_ICOUNT  0x00020000
-#define CF_INVALID     0x00040000 /* TB is stale. Setters need tb_lock */
+#define CF_INVALID     0x00040000 /* TB is stale. Set with jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
 /* cflags' mask for hashing/comparison */
 #define CF_HASH_MASK   \
@@ -370,20 +459,33 @@ struct TranslationBlock {
 #define TB_JMP_RESET_OFFSET_INVALID 0xffff /* indicates no jump generated */
     uintptr_t jmp_target_arg[2];  /* target address or offset */
 
-    /* Each TB has an associated circular list of TBs jumping to this one.
-     * jmp_list_first points to the first TB jumping to this one.
-     * jmp_list_next is used to point to the next TB in a list.
-     * Since each TB can have two jumps, it can participate in two lists.
-     * jmp_list_first and jmp_list_next are 4-byte aligned pointers to a
-     * TranslationBlock structure, but the two least significant bits of
-     * them are used to encode which data field of the pointed TB should
-     * be used to traverse the list further from that TB:
-     * 0 => jmp_list_next[0], 1 => jmp_list_next[1], 2 => jmp_list_first.
-     * In other words, 0/1 tells which jump is used in the pointed TB,
-     * and 2 means that this is a pointer back to the target TB of this list.
+    /* Each TB has a NULL-terminated list of the TBs jumping to it,
+     * starting at jmp_list_head.  Since each TB can have two outgoing
+     * jumps, it can be on two such lists, linked through jmp_list_next[].
+     * The least significant bit of the pointers in these lists tells
+     * which of the two jmp_list_next[] entries of the pointed TB
+     * continues the list.
+     *
+     * The lists are protected by jmp_lock of the TB they lead to.  The
+     * destination of each outgoing jump is kept in jmp_dest[] so that an
+     * origin TB can find the lock to take; its least significant bit is
+     * set while the origin TB is being invalidated, so that no new jump
+     * can be chained from it.
+     *
+     * jmp_lock also protects CF_INVALID: a jump must not be chained to a
+     * TB that has it set.
      */
+    QemuSpin jmp_lock;
+    uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
-    uintptr_t jmp_list_first;
+    uintptr_t jmp_dest[2];
+
+#ifdef CONFIG_PROFILER
+    /* Number of times the TB was entered; updated non-atomically by
+     * the generated code, so only an estimate with MTTCG.
+     */
+    uint64_t exec_count;
+#endif
 };
 
 extern bool parallel_cpus;
@@ -401,7 +503,6 @@ static inline uint32_t curr_cflags(void)
          | (use_icount ? CF_USE_ICOUNT : 0);
 }
 
-void tb_remove(TranslationBlock *tb);
 void tb_flush(CPUState *cpu);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
@@ -427,10 +528,6 @@ extern uintptr_t tci_tb_ptr;
    smaller than 4 bytes, so we don't worry about special-casing this.  */
 #define GETPC_ADJ   2
 
-void tb_lock(void);
-void tb_unlock(void);
-void tb_lock_reset(void);
-
 #if !defined(CONFIG_USER_ONLY)
 
 struct MemoryRegion *iotlb_to_region(CPUState *cpu,
@@ -41,6 +41,19 @@ static inline void gen_tb_start(TranslationBlock *tb)
     }
 
     tcg_temp_free_i32(count);
+
+#ifdef CONFIG_PROFILER
+    {
+        TCGv_ptr ptr = tcg_const_ptr(&tb->exec_count);
+        TCGv_i64 execs = tcg_temp_new_i64();
+
+        tcg_gen_ld_i64(execs, ptr, 0);
+        tcg_gen_addi_i64(execs, execs, 1);
+        tcg_gen_st_i64(execs, ptr, 0);
+        tcg_temp_free_i64(execs);
+        tcg_temp_free_ptr(ptr);
+    }
+#endif
 }
 
 static inline void gen_tb_end(TranslationBlock *tb, int num_insns)
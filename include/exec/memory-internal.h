@@ -35,10 +35,17 @@ AddressSpaceDispatch *address_space_to_dispatch(AddressSpace *as);
 AddressSpaceDispatch *flatview_to_dispatch(FlatView *fv);
 void address_space_dispatch_free(AddressSpaceDispatch *d);
 
+/* Drop cached translations of @iommu_mr that overlap the IOVA range
+ * [@iova, @iova + @addr_mask]. */
+void iommu_tlb_cache_flush(IOMMUMemoryRegion *iommu_mr, hwaddr iova,
+                           hwaddr addr_mask);
+
 void mtree_print_dispatch(fprintf_function mon, void *f,
                           struct AddressSpaceDispatch *d,
                           MemoryRegion *root);
 
+struct page_collection;
+
 /* Opaque struct for passing info from memory_notdirty_write_prepare()
  * to memory_notdirty_write_complete(). Callers should treat all fields
  * as private, with the exception of @active.
@@ -53,7 +60,7 @@ typedef struct {
     ram_addr_t ram_addr;
     vaddr mem_vaddr;
     unsigned size;
-    bool locked;
+    struct page_collection *pages;
     bool active;
 } NotDirtyInfo;
 
@@ -25,6 +25,7 @@
 #include "qemu/notify.h"
 #include "qom/object.h"
 #include "qemu/rcu.h"
+#include "qemu/stats64.h"
 #include "hw/qdev-core.h"
 
 #define RAM_ADDR_INVALID (~(ram_addr_t)0)
@@ -210,6 +211,13 @@ typedef struct IOMMUMemoryRegionClass {
                                 IOMMUNotifierFlag new_flags);
     /* Set this up to provide customized IOMMU replay function */
     void (*replay)(IOMMUMemoryRegion *iommu, IOMMUNotifier *notifier);
+    /*
+     * Set if, once a notifier is registered, every change to a translation
+     * is reported through memory_region_notify_iommu() or
+     * memory_region_iommu_replay_all().  Only translations of such IOMMUs
+     * are cached for address_space_enable_iommu_cache().
+     */
+    bool notifies_changes;
 } IOMMUMemoryRegionClass;
 
 typedef struct CoalescedMemoryRange CoalescedMemoryRange;
@@ -254,6 +262,12 @@ struct MemoryRegion {
     const char *name;
     unsigned ioeventfd_nb;
     MemoryRegionIoeventfd *ioeventfds;
+    /* Used by memory.c to re-render only the FlatViews that changed */
+    unsigned changed_gen;
+    unsigned checked_gen;
+    bool tree_changed;
+    /* Number of dispatched MMIO/PIO reads and writes */
+    Stat64 accesses;
 };
 
 struct IOMMUMemoryRegion {
@@ -261,6 +275,10 @@ struct IOMMUMemoryRegion {
 
     QLIST_HEAD(, IOMMUNotifier) iommu_notify;
     IOMMUNotifierFlag iommu_notify_flags;
+
+    /* Translation cache, present while tlb_cache_users is nonzero */
+    struct IOMMUTLBCache *tlb_cache;
+    unsigned tlb_cache_users;
 };
 
 #define IOMMU_NOTIFIER_FOREACH(n, mr) \
@@ -283,6 +301,9 @@ struct MemoryListener {
     void (*log_stop)(MemoryListener *listener, MemoryRegionSection *section,
                      int old, int new);
     void (*log_sync)(MemoryListener *listener, MemoryRegionSection *section);
+    /* Sync the dirty log of every section at once; used instead of
+     * log_sync if set.  */
+    void (*log_sync_global)(MemoryListener *listener);
     void (*log_global_start)(MemoryListener *listener);
     void (*log_global_stop)(MemoryListener *listener);
     void (*eventfd_add)(MemoryListener *listener, MemoryRegionSection *section,
@@ -300,6 +321,9 @@ struct MemoryListener {
     QTAILQ_ENTRY(MemoryListener) link_as;
 };
 
+/* Default limit on the bytes bounce-buffered at once for one address space */
+#define DEFAULT_MAX_BOUNCE_BUFFER_SIZE 4096
+
 /**
  * AddressSpace: describes a mapping of addresses to #MemoryRegion objects
  */
@@ -316,6 +340,18 @@ struct AddressSpace {
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(memory_listeners_as, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+
+    /* Bounce buffers handed out by address_space_map(), protected by
+     * bounce_lock.  bounce_buffer_size counts the bytes they hold and may
+     * not exceed max_bounce_buffer_size.
+     */
+    QemuMutex bounce_lock;
+    QLIST_HEAD(, BounceBuffer) bounce_buffers;
+    size_t bounce_buffer_size;
+    size_t max_bounce_buffer_size;
+
+    /* Set by address_space_enable_iommu_cache() */
+    struct AddressSpaceIOMMUCache *iommu_cache;
 };
 
 FlatView *address_space_to_flatview(AddressSpace *as);
@@ -455,6 +491,12 @@ void memory_region_init_resizeable_ram(MemoryRegion *mr,
                                                        uint64_t length,
                                                        void *host),
                                        Error **errp);
+/* RAM is mmap-ed with MAP_SHARED */
+#define RAM_SHARED     (1 << 1)
+
+/* RAM is a file on persistent memory, mmap-ed with MAP_SYNC if possible */
+#define RAM_PMEM       (1 << 3)
+
 #ifdef __linux__
 /**
  * memory_region_init_ram_from_file:  Initialize RAM memory region with a
@@ -467,7 +509,8 @@ void memory_region_init_resizeable_ram(MemoryRegion *mr,
  * @size: size of the region.
  * @align: alignment of the region base address; if 0, the default alignment
  *         (getpagesize()) will be used.
- * @share: %true if memory must be mmaped with the MAP_SHARED flag
+ * @ram_flags: RAM_SHARED if memory must be mmaped with the MAP_SHARED flag,
+ *             RAM_PMEM if the file is on persistent memory
  * @path: the path in which to allocate the RAM.
  * @errp: pointer to Error*, to store an error if it happens.
  *
@@ -479,7 +522,7 @@ void memory_region_init_ram_from_file(MemoryRegion *mr,
                                       const char *name,
                                       uint64_t size,
                                       uint64_t align,
-                                      bool share,
+                                      uint32_t ram_flags,
                                       const char *path,
                                       Error **errp);
 
@@ -1503,6 +1546,16 @@ void memory_global_dirty_log_start(void);
  */
 void memory_global_dirty_log_stop(void);
 
+/**
+ * memory_region_access_stats: list the busiest emulated memory regions
+ *
+ * Returns up to @max regions reachable from an address space that had
+ * dispatched reads or writes, sorted by decreasing access count.
+ *
+ * @max: maximum number of regions to return
+ */
+RegionAccessStatsList *memory_region_access_stats(unsigned max);
+
 void mtree_info(fprintf_function mon_printf, void *f, bool flatview,
                 bool dispatch_tree);
 
@@ -1584,6 +1637,28 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name);
  */
 void address_space_destroy(AddressSpace *as);
 
+/**
+ * address_space_enable_iommu_cache: cache IOMMU translations used by @as
+ *
+ * Keeps a small cache of the translations of every IOMMU region mapped
+ * in @as, so that repeated DMA to the same pages does not go through the
+ * IOMMU's translate callback each time.  The cache is flushed when the
+ * IOMMU reports a change and on every memory transaction commit.  This
+ * is meant for the bus master address space of DMA-heavy devices.
+ *
+ * @as: the address space, usually from pci_get_address_space()
+ */
+void address_space_enable_iommu_cache(AddressSpace *as);
+
+/**
+ * address_space_disable_iommu_cache: undo address_space_enable_iommu_cache()
+ *
+ * Called by address_space_destroy(), so devices need not do it themselves.
+ *
+ * @as: the address space
+ */
+void address_space_disable_iommu_cache(AddressSpace *as);
+
 /**
  * address_space_rw: read from or write to an address space.
  *
@@ -141,4 +141,66 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
 
 void translator_loop_temp_check(DisasContextBase *db);
 
+/**
+ * TranslatorInstrumentCB:
+ * Function called from generated code by translator_gen_call().
+ */
+typedef void (*TranslatorInstrumentCB)(CPUState *cpu, void *opaque);
+
+/**
+ * TranslatorInstrumentOps:
+ * @tb_start:
+ *      Called for each TB, after #TranslatorOps::tb_start.  Code emitted
+ *      here runs every time the TB is executed.
+ *
+ * @insn_start:
+ *      Called for each guest instruction, after #TranslatorOps::insn_start
+ *      and before the instruction is translated; db->pc_next is its
+ *      address.  Code emitted here runs every time the instruction is
+ *      executed.
+ *
+ * Instrumentation hooks for analysis tools such as profilers and coverage
+ * collectors.  Either hook may be NULL.  The hooks see the TB being built
+ * and decide at translation time what to emit, typically with
+ * translator_gen_inline_add() or translator_gen_call(), so that nothing is
+ * paid for code that is not instrumented.
+ */
+typedef struct TranslatorInstrumentOps {
+    void (*tb_start)(DisasContextBase *db, CPUState *cpu, void *opaque);
+    void (*insn_start)(DisasContextBase *db, CPUState *cpu, void *opaque);
+} TranslatorInstrumentOps;
+
+/**
+ * translator_instrument_register:
+ * @ops: Hooks to call while translating.
+ * @opaque: Passed to the hooks.
+ *
+ * Add a set of instrumentation hooks to translator_loop().  This must be
+ * done before the vCPUs start; code translated before the call is not
+ * instrumented until the next tb_flush().
+ */
+void translator_instrument_register(const TranslatorInstrumentOps *ops,
+                                    void *opaque);
+
+/**
+ * translator_gen_inline_add:
+ * @counter: Host address of the counter.
+ * @val: Value to add.
+ *
+ * Emit an inline, non-atomic addition of @val to *@counter.  With MTTCG,
+ * concurrent updates from different vCPUs may be lost; use per-vCPU
+ * counters where exact totals matter.
+ */
+void translator_gen_inline_add(uint64_t *counter, int64_t val);
+
+/**
+ * translator_gen_call:
+ * @fn: Function to call.
+ * @opaque: Passed to @fn.
+ *
+ * Emit a call of @fn(cpu, @opaque).  Guest registers are synced to the
+ * CPU state before the call.
+ */
+void translator_gen_call(TranslatorInstrumentCB fn, void *opaque);
+
 #endif  /* EXEC__TRANSLATOR_H */
@@ -56,6 +56,8 @@ typedef struct {
     int size[2];
     int align[2];
     const char *name;
+    /* same layout for target and host, so no conversion is needed */
+    bool identical;
 } StructEntry;
 
 /* Translation table for bitmasks... */
@@ -71,6 +73,7 @@ void thunk_register_struct_direct(int id, const char *name,
                                   const StructEntry *se1);
 const argtype *thunk_convert(void *dst, const void *src,
                              const argtype *type_ptr, int to_host);
+bool thunk_type_is_identical(const argtype *type_ptr);
 
 extern StructEntry *struct_entries;
 
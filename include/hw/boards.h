@@ -67,6 +67,7 @@ bool machine_kernel_irqchip_allowed(MachineState *machine);
 bool machine_kernel_irqchip_required(MachineState *machine);
 bool machine_kernel_irqchip_split(MachineState *machine);
 int machine_kvm_shadow_mem(MachineState *machine);
+uint32_t machine_kvm_dirty_ring_size(MachineState *machine);
 int machine_phandle_start(MachineState *machine);
 bool machine_dump_guest_core(MachineState *machine);
 bool machine_mem_merge(MachineState *machine);
@@ -229,12 +230,14 @@ struct MachineState {
     bool kernel_irqchip_required;
     bool kernel_irqchip_split;
     int kvm_shadow_mem;
+    uint32_t kvm_dirty_ring_size;
     char *dtb;
     char *dumpdtb;
     int phandle_start;
     char *dt_compatible;
     bool dump_guest_core;
     bool mem_merge;
+    bool numa_vcpu_affinity;
     bool usb;
     bool usb_disabled;
     bool igd_gfx_passthru;
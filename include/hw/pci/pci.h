@@ -296,6 +296,8 @@ struct PCIDevice {
     AddressSpace bus_master_as;
     MemoryRegion bus_master_container_region;
     MemoryRegion bus_master_enable_region;
+    /* Limit on the bytes bounce-buffered at once for DMA to non-RAM */
+    uint64_t max_bounce_buffer_size;
 
     /* do not access the following fields */
     PCIConfigReadFunc *config_read;
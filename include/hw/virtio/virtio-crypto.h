@@ -96,6 +96,8 @@ typedef struct VirtIOCrypto {
     int multiqueue;
     uint32_t curr_queues;
     size_t config_size;
+    /* Data queue requests submitted to the backend and not completed */
+    unsigned int inflight;
 } VirtIOCrypto;
 
 #endif /* _QEMU_VIRTIO_CRYPTO_H */
@@ -16,6 +16,7 @@
 
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
+#include "sysemu/iothread.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 #define VIRTIO_NET(obj) \
@@ -38,6 +39,8 @@ typedef struct virtio_net_conf
     uint16_t rx_queue_size;
     uint16_t tx_queue_size;
     uint16_t mtu;
+    IOThread *iothread;
+    char *iothreads;
 } virtio_net_conf;
 
 /* Maximum packet size we can receive from tap device: header + 64k */
@@ -53,6 +56,12 @@ typedef struct VirtIONetQueue {
         VirtQueueElement *elem;
     } async_tx;
     struct VirtIONet *n;
+    /* Where the queue pair and its backend run while dataplane_started */
+    AioContext *ctx;
+    QEMUBH *dp_tx_bh;
+    /* RX buffer the backend is reading into, see receive_prepare */
+    VirtQueueElement *rx_elem;
+    size_t rx_elem_len;
 } VirtIONetQueue;
 
 typedef struct VirtIONet {
@@ -99,6 +108,12 @@ typedef struct VirtIONet {
     int announce_counter;
     bool needs_vnet_hdr_swap;
     bool mtu_bypass_backend;
+    /* RX/TX processing happens in the queues' AioContexts, not under the
+     * BQL; main loop code touching them must acquire those contexts. */
+    bool dataplane_started;
+    /* From iothread= or iothreads=, queue pair i runs in iothreads[i % n] */
+    IOThread **iothreads;
+    unsigned num_iothreads;
 } VirtIONet;
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
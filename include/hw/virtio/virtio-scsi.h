@@ -57,6 +57,7 @@ struct VirtIOSCSIConf {
     CharBackend chardev;
     uint32_t boot_tpgt;
     IOThread *iothread;
+    char *iothreads;
 };
 
 struct VirtIOSCSI;
@@ -80,7 +81,21 @@ typedef struct VirtIOSCSI {
     bool events_dropped;
 
     /* Fields for dataplane below */
-    AioContext *ctx; /* one iothread per virtio-scsi-pci for now */
+    AioContext *ctx; /* control and event queues */
+
+    /* AioContext that handles each command queue */
+    AioContext **cmd_vq_ctx;
+
+    /* With the iothreads property, command queues and devices are spread
+     * over several IOThreads.  Requests are then submitted from the
+     * AioContext of their device and completed in the one of their queue;
+     * bounces counts those in flight between two contexts.
+     */
+    IOThread **iothreads;
+    unsigned num_iothreads;
+    unsigned next_device_iothread;
+    unsigned bounces;
+    bool bounce_waiting;
 
     bool dataplane_started;
     bool dataplane_starting;
@@ -98,6 +113,7 @@ typedef struct VirtIOSCSIReq {
 
     VirtIOSCSI *dev;
     VirtQueue *vq;
+    AioContext *ctx; /* where vq was popped */
     QEMUSGList qsgl;
     QEMUIOVector resp_iov;
 
@@ -155,6 +171,8 @@ void virtio_scsi_push_event(VirtIOSCSI *s, SCSIDevice *dev,
                             uint32_t event, uint32_t reason);
 
 void virtio_scsi_dataplane_setup(VirtIOSCSI *s, Error **errp);
+void virtio_scsi_dataplane_cleanup(VirtIOSCSI *s);
+void virtio_scsi_wait_bounces(VirtIOSCSI *s);
 int virtio_scsi_dataplane_start(VirtIODevice *s);
 void virtio_scsi_dataplane_stop(VirtIODevice *s);
 
@@ -82,6 +82,12 @@ typedef struct VirtIOSerialPortClass {
      */
     ssize_t (*have_data)(VirtIOSerialPort *port, const uint8_t *buf,
                          ssize_t len);
+    /*
+     * Optional: like have_data, but with the contents of several
+     * buffers, possibly spanning several elements, at once.
+     */
+    ssize_t (*have_datav)(VirtIOSerialPort *port, const struct iovec *iov,
+                          int iovcnt);
 } VirtIOSerialPortClass;
 
 /*
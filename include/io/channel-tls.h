@@ -48,6 +48,8 @@ struct QIOChannelTLS {
     QIOChannel parent;
     QIOChannel *master;
     QCryptoTLSSession *session;
+    /* Payload is encrypted by the kernel and written straight to master */
+    bool ktls_tx;
 };
 
 /**
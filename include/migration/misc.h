@@ -18,7 +18,23 @@
 
 /* migration/ram.c */
 
+typedef enum PrecopyNotifyReason {
+    PRECOPY_NOTIFY_BEFORE_BITMAP_SYNC,
+    PRECOPY_NOTIFY_AFTER_BITMAP_SYNC,
+    PRECOPY_NOTIFY_CLEANUP,
+} PrecopyNotifyReason;
+
 void ram_mig_init(void);
+/*
+ * Notifiers are called with the iothread lock held and a pointer to a
+ * PrecopyNotifyReason.  Dirty bitmap syncs also run under that lock, so a
+ * device that reports free guest pages from the main loop cannot race
+ * with them.
+ */
+void precopy_add_notifier(Notifier *n);
+void precopy_remove_notifier(Notifier *n);
+/* The guest does not need the contents of [addr, addr + len) */
+void qemu_guest_free_page_hint(void *addr, size_t len);
 
 /* migration/block.c */
 
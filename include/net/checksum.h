@@ -21,6 +21,11 @@
 #include "qemu/bswap.h"
 struct iovec;
 
+/*
+ * Partial sums are only meaningful modulo 0xffff; they can be added
+ * together and get folded by net_checksum_finish().  @seq is the offset
+ * of @buf in the data being checksummed, only its parity matters.
+ */
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq);
 uint16_t net_checksum_finish(uint32_t sum);
 uint16_t net_checksum_tcpudp(uint16_t length, uint16_t proto,
@@ -59,6 +64,9 @@ uint32_t net_checksum_add_iov(const struct iovec *iov,
                               uint32_t iov_off, uint32_t size,
                               uint32_t csum_offset);
 
+/* For tests: switch to the next slower implementation, if there is one */
+bool test_net_checksum_next_accel(void);
+
 typedef struct toeplitz_key_st {
     uint32_t leftmost_32_bits;
     uint8_t *next_byte;
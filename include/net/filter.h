@@ -37,6 +37,12 @@ typedef ssize_t (FilterReceiveIOV)(NetFilterState *nc,
 
 typedef void (FilterStatusChanged) (NetFilterState *nf, Error **errp);
 
+/*
+ * Return true if the filter currently has nothing to do with packets, for
+ * example because its output is not connected, so that it can be skipped.
+ */
+typedef bool (FilterIsIdle) (NetFilterState *nf);
+
 typedef struct NetFilterClass {
     ObjectClass parent_class;
 
@@ -44,6 +50,7 @@ typedef struct NetFilterClass {
     FilterSetup *setup;
     FilterCleanup *cleanup;
     FilterStatusChanged *status_changed;
+    FilterIsIdle *is_idle;
     /* mandatory */
     FilterReceiveIOV *receive_iov;
 } NetFilterClass;
@@ -76,4 +83,17 @@ ssize_t qemu_netfilter_pass_to_next(NetClientState *sender,
                                     int iovcnt,
                                     void *opaque);
 
+/*
+ * pass a batch of packets to the next filter, or straight to the receiver
+ * in one go if no filter after this one has work to do
+ */
+int qemu_netfilter_pass_to_next_batch(NetClientState *sender,
+                                      const struct iovec *pkts,
+                                      int count,
+                                      void *opaque);
+
+/* true if no filter of @nc has to see packets going in @direction */
+bool qemu_netfilter_chain_idle(NetClientState *nc,
+                               NetFilterDirection direction);
+
 #endif /* QEMU_NET_FILTER_H */
@@ -0,0 +1,40 @@
+/*
+ * Software segmentation of TCP packets
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_NET_GSO_H
+#define QEMU_NET_GSO_H
+
+typedef void (NetGSOSendFunc)(void *opaque, const struct iovec *iov,
+                              int iovcnt);
+
+/**
+ * net_gso_tcp:
+ * @hdr: the Ethernet, IP and TCP headers of the packet
+ * @l3_off: offset of the IPv4 or IPv6 header in @hdr
+ * @l4_off: offset of the TCP header in @hdr
+ * @hdr_len: length of @hdr, up to the end of the TCP options
+ * @payload: the TCP payload
+ * @payload_cnt: number of elements in @payload
+ * @payload_len: length of the TCP payload
+ * @mss: payload length of every segment but the last one
+ * @send: called with each segment
+ * @opaque: passed to @send
+ *
+ * Split a TCP packet into segments of @mss bytes of payload.  The segments
+ * reference @payload; only their headers are copied, with the IP length,
+ * ID and checksum, and the TCP sequence number, flags and checksum
+ * rewritten.  @send must be done with a segment when it returns.
+ *
+ * Returns the number of segments sent, or -EINVAL if the headers are not
+ * those of a TCP packet.
+ */
+int net_gso_tcp(const uint8_t *hdr, size_t l3_off, size_t l4_off,
+                size_t hdr_len, const struct iovec *payload, int payload_cnt,
+                size_t payload_len, size_t mss,
+                NetGSOSendFunc *send, void *opaque);
+
+#endif /* QEMU_NET_GSO_H */
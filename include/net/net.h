@@ -50,6 +50,9 @@ typedef void (NetPoll)(NetClientState *, bool enable);
 typedef int (NetCanReceive)(NetClientState *);
 typedef ssize_t (NetReceive)(NetClientState *, const uint8_t *, size_t);
 typedef ssize_t (NetReceiveIOV)(NetClientState *, const struct iovec *, int);
+typedef int (NetReceiveIOVBatch)(NetClientState *, const struct iovec *, int);
+typedef int (NetReceivePrepare)(NetClientState *, struct iovec *, int, size_t);
+typedef bool (NetReceiveComplete)(NetClientState *, uint8_t *, ssize_t);
 typedef void (NetCleanup) (NetClientState *);
 typedef void (LinkStatusChanged)(NetClientState *);
 typedef void (NetClientDestructor)(NetClientState *);
@@ -62,6 +65,7 @@ typedef void (SetOffload)(NetClientState *, int, int, int, int, int);
 typedef void (SetVnetHdrLen)(NetClientState *, int);
 typedef int (SetVnetLE)(NetClientState *, bool);
 typedef int (SetVnetBE)(NetClientState *, bool);
+typedef void (NetSetAioContext)(NetClientState *, AioContext *);
 typedef struct SocketReadState SocketReadState;
 typedef void (SocketReadStateFinalize)(SocketReadState *rs);
 
@@ -71,7 +75,11 @@ typedef struct NetClientInfo {
     NetReceive *receive;
     NetReceive *receive_raw;
     NetReceiveIOV *receive_iov;
+    /* One iovec per packet; returns how many packets were consumed */
+    NetReceiveIOVBatch *receive_iov_batch;
     NetCanReceive *can_receive;
+    NetReceivePrepare *receive_prepare;
+    NetReceiveComplete *receive_complete;
     NetCleanup *cleanup;
     LinkStatusChanged *link_status_changed;
     QueryRxFilter *query_rx_filter;
@@ -84,6 +92,7 @@ typedef struct NetClientInfo {
     SetVnetHdrLen *set_vnet_hdr_len;
     SetVnetLE *set_vnet_le;
     SetVnetBE *set_vnet_be;
+    NetSetAioContext *set_aio_context;
 } NetClientInfo;
 
 struct NetClientState {
@@ -154,6 +163,9 @@ void qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_raw(NetClientState *nc, const uint8_t *buf, int size);
 ssize_t qemu_send_packet_async(NetClientState *nc, const uint8_t *buf,
                                int size, NetPacketSent *sent_cb);
+ssize_t qemu_send_packet_batch_async(NetClientState *nc,
+                                     const struct iovec *pkts, int count,
+                                     NetPacketSent *sent_cb);
 void qemu_purge_queued_packets(NetClientState *nc);
 void qemu_flush_queued_packets(NetClientState *nc);
 void qemu_format_nic_info_str(NetClientState *nc, uint8_t macaddr[6]);
@@ -166,6 +178,10 @@ void qemu_set_offload(NetClientState *nc, int csum, int tso4, int tso6,
 void qemu_set_vnet_hdr_len(NetClientState *nc, int len);
 int qemu_set_vnet_le(NetClientState *nc, bool is_le);
 int qemu_set_vnet_be(NetClientState *nc, bool is_be);
+bool qemu_set_net_client_aio_context(NetClientState *nc, AioContext *ctx);
+int qemu_receive_prepare(NetClientState *nc, struct iovec *iov, int iovcnt,
+                         size_t maxlen);
+bool qemu_receive_complete(NetClientState *nc, uint8_t *buf, ssize_t size);
 void qemu_macaddr_default_if_unset(MACAddr *macaddr);
 int qemu_show_nic_models(const char *arg, const char *const *models);
 void qemu_check_nic_model(NICInfo *nd, const char *model);
@@ -177,6 +193,9 @@ ssize_t qemu_deliver_packet_iov(NetClientState *sender,
                             const struct iovec *iov,
                             int iovcnt,
                             void *opaque);
+int qemu_deliver_packet_batch(NetClientState *sender,
+                              const struct iovec *pkts, int count,
+                              void *opaque);
 
 void print_net_client(Monitor *mon, NetClientState *nc);
 void hmp_info_network(Monitor *mon, const QDict *qdict);
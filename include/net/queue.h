@@ -45,7 +45,15 @@ typedef ssize_t (NetQueueDeliverFunc)(NetClientState *sender,
                                       int iovcnt,
                                       void *opaque);
 
+/* Returns how many of the @count packets were consumed */
+typedef int (NetQueueDeliverBatchFunc)(NetClientState *sender,
+                                       const struct iovec *pkts,
+                                       int count,
+                                       void *opaque);
+
 NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque);
+void qemu_net_queue_set_deliver_batch(NetQueue *queue,
+                                      NetQueueDeliverBatchFunc *deliver_batch);
 
 void qemu_net_queue_append_iov(NetQueue *queue,
                                NetClientState *sender,
@@ -70,6 +78,12 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 int iovcnt,
                                 NetPacketSent *sent_cb);
 
+ssize_t qemu_net_queue_send_batch(NetQueue *queue,
+                                  NetClientState *sender,
+                                  const struct iovec *pkts,
+                                  int count,
+                                  NetPacketSent *sent_cb);
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
 bool qemu_net_queue_flush(NetQueue *queue);
 
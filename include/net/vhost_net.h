@@ -37,4 +37,7 @@ uint64_t vhost_net_get_acked_features(VHostNetState *net);
 
 int vhost_net_set_mtu(struct vhost_net *net, uint16_t mtu);
 
+/* Fill in the state of one vhost-net queue pair for query-vhost-net. */
+void vhost_net_get_info(VHostNetState *net, VhostNetQueueInfo *info);
+
 #endif
@@ -117,6 +117,20 @@ bool qemu_in_coroutine(void);
  */
 bool qemu_coroutine_entered(Coroutine *co);
 
+/**
+ * Grow the coroutine pool by @additional_pool_size coroutines
+ *
+ * Devices that can keep many requests in flight call this when they are
+ * realized, so that finished coroutines are kept for reuse instead of
+ * having their stacks unmapped and mapped again at high queue depths.
+ */
+void qemu_coroutine_increase_pool_batch_size(unsigned int additional_pool_size);
+
+/**
+ * Undo a previous qemu_coroutine_increase_pool_batch_size()
+ */
+void qemu_coroutine_decrease_pool_batch_size(unsigned int removing_pool_size);
+
 /**
  * Provides a mutex that can be used to synchronise coroutines
  */
@@ -307,7 +307,8 @@ int64_t hbitmap_next_zero(const HBitmap *hb, uint64_t start);
  *
  * Currently, we only guarantee that if a bit in the hbitmap is changed it
  * will be reflected in the meta bitmap, but we do not yet guarantee the
- * opposite.
+ * opposite.  Resetting all bits, merging and deserializing conservatively
+ * mark the whole affected range in the meta bitmap.
  *
  * @hb: The HBitmap to operate on.
  * @chunk_size: How many bits in @hb does one bit in the meta track.
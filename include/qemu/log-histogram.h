@@ -0,0 +1,40 @@
+/*
+ * Log-linear histogram
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef LOG_HISTOGRAM_H
+#define LOG_HISTOGRAM_H
+
+/*
+ * Values below LOG_HISTOGRAM_SUB_BUCKETS get a bucket of their own.  Every
+ * power of two above that is split into LOG_HISTOGRAM_SUB_BUCKETS buckets of
+ * equal width, so the relative error of a value taken from the histogram is
+ * at most 1 / LOG_HISTOGRAM_SUB_BUCKETS, over the whole 64 bit range.
+ */
+#define LOG_HISTOGRAM_SUB_BITS      3
+#define LOG_HISTOGRAM_SUB_BUCKETS   (1 << LOG_HISTOGRAM_SUB_BITS)
+#define LOG_HISTOGRAM_BUCKETS \
+    ((64 - LOG_HISTOGRAM_SUB_BITS + 1) * LOG_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct LogHistogram LogHistogram;
+
+/* All fields are private */
+struct LogHistogram {
+    uint64_t count;
+    uint64_t buckets[LOG_HISTOGRAM_BUCKETS];
+};
+
+void log_histogram_reset(LogHistogram *hist);
+void log_histogram_account(LogHistogram *hist, uint64_t value);
+uint64_t log_histogram_count(const LogHistogram *hist);
+
+/*
+ * Returns an upper bound for the @percentile (0 to 100) of the accounted
+ * values, or 0 if the histogram is empty.
+ */
+uint64_t log_histogram_percentile(const LogHistogram *hist, double percentile);
+
+#endif
@@ -7,7 +7,15 @@ size_t qemu_fd_getpagesize(int fd);
 
 size_t qemu_mempath_getpagesize(const char *mem_path);
 
-void *qemu_ram_mmap(int fd, size_t size, size_t align, bool shared);
+/*
+ * qemu_ram_mmap: map @size bytes of @fd (or anonymous memory if @fd is -1)
+ * at an @align-aligned address.  With @is_pmem the file is on persistent
+ * memory and is mapped with MAP_SYNC where the host supports it, so that
+ * data written through the mapping is durable once flushed from the CPU
+ * caches.
+ */
+void *qemu_ram_mmap(int fd, size_t size, size_t align, bool shared,
+                    bool is_pmem);
 
 void qemu_ram_munmap(void *ptr, size_t size);
 
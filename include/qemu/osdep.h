@@ -510,9 +510,38 @@ unsigned long qemu_getauxval(unsigned long type);
 
 void qemu_set_tty_echo(int fd, bool echo);
 
+/**
+ * os_mem_prealloc:
+ * @fd: file descriptor backing @area, or -1
+ * @area: start of the memory to preallocate
+ * @sz: size of @area
+ * @smp_cpus: upper bound for the number of worker threads
+ * @host_nodes: bitmap of host NUMA nodes @area is bound to, or NULL
+ * @max_node: number of bits in @host_nodes
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Fault in every page of @area using a pool of worker threads.  When
+ * @host_nodes is not empty the workers run on the CPUs of those nodes,
+ * so that the pages are zeroed close to where they are allocated.
+ */
 void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
+                     const unsigned long *host_nodes, unsigned long max_node,
                      Error **errp);
 
+/**
+ * qemu_bind_thread_to_host_nodes:
+ * @host_nodes: bitmap of host NUMA nodes
+ * @max_node: number of bits in @host_nodes
+ *
+ * Restrict the calling thread to the CPUs of the host nodes in
+ * @host_nodes.  Nothing is done if @host_nodes is empty or the host does
+ * not describe the CPUs of those nodes.
+ *
+ * Returns: 0 on success, or a negative errno value.
+ */
+int qemu_bind_thread_to_host_nodes(const unsigned long *host_nodes,
+                                   unsigned long max_node);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
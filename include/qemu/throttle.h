@@ -151,7 +151,15 @@ bool throttle_schedule_timer(ThrottleState *ts,
                              ThrottleTimers *tt,
                              bool is_write);
 
+double throttle_op_units(uint64_t op_size, uint64_t size);
+
 void throttle_account(ThrottleState *ts, bool is_write, uint64_t size);
+
+void throttle_account_units(ThrottleState *ts, bool is_write, uint64_t size,
+                            double units);
+
+void throttle_get_budget(ThrottleState *ts, bool is_write, int64_t delta_ns,
+                         uint64_t *size, uint64_t *units);
 void throttle_limits_to_config(ThrottleLimits *arg, ThrottleConfig *cfg,
                                Error **errp);
 void throttle_config_to_limits(ThrottleConfig *cfg, ThrottleLimits *var);
@@ -66,7 +66,8 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    uint64_t seq;               /* orders timers with the same expiry */
+    unsigned heap_idx;          /* position in the timer list, if pending */
     int scale;
 };
 
@@ -240,6 +240,7 @@ struct CPUWatchpoint {
 
 struct KVMState;
 struct kvm_run;
+struct kvm_dirty_gfn;
 
 struct hax_vcpu_state;
 
@@ -386,6 +387,8 @@ struct CPUState {
     int kvm_fd;
     struct KVMState *kvm_state;
     struct kvm_run *kvm_run;
+    struct kvm_dirty_gfn *kvm_dirty_gfns;
+    uint32_t kvm_fetch_index;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
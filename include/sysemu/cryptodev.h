@@ -146,6 +146,12 @@ typedef struct CryptoDevBackendSymOpInfo {
     uint8_t data[0];
 } CryptoDevBackendSymOpInfo;
 
+/*
+ * Called once an operation started by do_sym_op() is over, with
+ * VIRTIO_CRYPTO_OK or a negative VIRTIO_CRYPTO_* error in @ret.
+ */
+typedef void CryptoDevCompletionFunc(void *opaque, int ret);
+
 typedef struct CryptoDevBackendClass {
     ObjectClass parent_class;
 
@@ -158,9 +164,16 @@ typedef struct CryptoDevBackendClass {
     int (*close_session)(CryptoDevBackend *backend,
                            uint64_t session_id,
                            uint32_t queue_index, Error **errp);
+    /*
+     * Returns 0 if @cb will be called with the result, which may
+     * happen before do_sym_op() returns, or -VIRTIO_CRYPTO_* if the
+     * operation could not be started.
+     */
     int (*do_sym_op)(CryptoDevBackend *backend,
                      CryptoDevBackendSymOpInfo *op_info,
-                     uint32_t queue_index, Error **errp);
+                     uint32_t queue_index,
+                     CryptoDevCompletionFunc *cb, void *opaque,
+                     Error **errp);
 } CryptoDevBackendClass;
 
 
@@ -284,18 +297,21 @@ int cryptodev_backend_sym_close_session(
  * @backend: the cryptodev backend object
  * @opaque: pointer to a VirtIOCryptoReq object
  * @queue_index: queue index of cryptodev backend client
+ * @cb: function called with @opaque and the result of the operation
  * @errp: pointer to a NULL-initialized error object
  *
- * Do crypto operation, such as encryption and
- * decryption
+ * Start a crypto operation, such as encryption and
+ * decryption.  Backends may run it asynchronously, in
+ * which case @cb is called from the main loop later.
  *
- * Returns: VIRTIO_CRYPTO_OK on success,
- *         or -VIRTIO_CRYPTO_* on error
+ * Returns: 0 if @cb will be called,
+ *         or -VIRTIO_CRYPTO_* if the operation failed to start
  */
 int cryptodev_backend_crypto_operation(
                  CryptoDevBackend *backend,
                  void *opaque,
-                 uint32_t queue_index, Error **errp);
+                 uint32_t queue_index,
+                 CryptoDevCompletionFunc *cb, Error **errp);
 
 /**
  * cryptodev_backend_set_used:
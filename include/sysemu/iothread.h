@@ -32,6 +32,8 @@ typedef struct {
     bool stopping;              /* has iothread_stop() been called? */
     bool running;               /* should iothread_run() continue? */
     int thread_id;
+    int64_t start_ns;           /* when iothread_run() started */
+    char *cpu_affinity;         /* host CPUs to run on, e.g. "0-3,8" */
 
     /* AioContext poll parameters */
     int64_t poll_max_ns;
@@ -220,6 +220,14 @@ int kvm_init_vcpu(CPUState *cpu);
 int kvm_cpu_exec(CPUState *cpu);
 int kvm_destroy_vcpu(CPUState *cpu);
 
+/**
+ * kvm_exit_stats:
+ *
+ * Returns: the number of exits and the time spent handling them, for
+ * each KVM exit reason that has occurred.
+ */
+ExitReasonStatsList *kvm_exit_stats(void);
+
 /**
  * kvm_arm_supports_user_irq
  *
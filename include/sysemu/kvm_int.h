@@ -18,8 +18,12 @@ typedef struct KVMSlot
     hwaddr start_addr;
     ram_addr_t memory_size;
     void *ram;
+    ram_addr_t ram_start_offset;
     int slot;
     int flags;
+    /* Set while the slot's section is gone but its deletion is deferred
+     * to the end of the memory transaction; holds a reference.  */
+    MemoryRegion *deferred_mr;
 } KVMSlot;
 
 typedef struct KVMMemoryListener {
@@ -31,6 +31,13 @@
 /* in ms */
 #define GUI_REFRESH_INTERVAL_DEFAULT    30
 #define GUI_REFRESH_INTERVAL_IDLE     3000
+/*
+ * Set by a listener that has nobody to show the display to.  Once every
+ * listener is in this state the refresh timer stops, and the devices'
+ * update_interval callback is given this value so that they can stop
+ * tracking changes until a refresh is wanted again.
+ */
+#define GUI_REFRESH_INTERVAL_NONE     UINT64_MAX
 
 /* Color number is match to standard vga palette */
 enum qemu_color_names {
@@ -21,9 +21,38 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "io/channel-tls.h"
+#include "io/channel-socket.h"
 #include "trace.h"
 
 
+/*
+ * Try to move the encryption of outgoing data into the kernel once
+ * the handshake is done.  This is only an optimization, so failures
+ * just leave gnutls in charge.
+ */
+static void qio_channel_tls_enable_ktls_tx(QIOChannelTLS *ioc)
+{
+    QIOChannelSocket *sioc;
+    Error *err = NULL;
+
+    if (!object_dynamic_cast(OBJECT(ioc->master), TYPE_QIO_CHANNEL_SOCKET)) {
+        return;
+    }
+
+    sioc = QIO_CHANNEL_SOCKET(ioc->master);
+    if (qcrypto_tls_session_enable_ktls_tx(ioc->session, sioc->fd,
+                                           &err) < 0) {
+        trace_qio_channel_tls_ktls_tx_unavailable(ioc,
+                                                  error_get_pretty(err));
+        error_free(err);
+        return;
+    }
+
+    trace_qio_channel_tls_ktls_tx_enabled(ioc);
+    ioc->ktls_tx = true;
+}
+
+
 static ssize_t qio_channel_tls_write_handler(const char *buf,
                                              size_t len,
                                              void *opaque)
@@ -167,6 +196,7 @@ static void qio_channel_tls_handshake_task(QIOChannelTLS *ioc,
             qio_task_set_error(task, err);
         } else {
             trace_qio_channel_tls_credentials_allow(ioc);
+            qio_channel_tls_enable_ktls_tx(ioc);
         }
         qio_task_complete(task);
     } else {
@@ -278,6 +308,10 @@ static ssize_t qio_channel_tls_writev(QIOChannel *ioc,
     size_t i;
     ssize_t done = 0;
 
+    if (tioc->ktls_tx) {
+        return qio_channel_writev(tioc->master, iov, niov, errp);
+    }
+
     for (i = 0 ; i < niov ; i++) {
         ssize_t ret = qcrypto_tls_session_write(tioc->session,
                                                 iov[i].iov_base,
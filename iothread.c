@@ -22,6 +22,8 @@
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
 
 typedef ObjectClass IOThreadClass;
 
@@ -51,6 +53,7 @@ static void *iothread_run(void *opaque)
 
     my_iothread = iothread;
     qemu_mutex_lock(&iothread->init_done_lock);
+    iothread->start_ns = get_clock();
     iothread->thread_id = qemu_get_thread_id();
     qemu_cond_signal(&iothread->init_done_cond);
     qemu_mutex_unlock(&iothread->init_done_lock);
@@ -112,11 +115,71 @@ static int iothread_stop_iter(Object *object, void *opaque)
     return 0;
 }
 
+/* Parse a list of host CPUs such as "0-3,8,10-11" */
+#ifdef CONFIG_LINUX
+static bool iothread_parse_cpu_list(const char *str, cpu_set_t *set,
+                                    Error **errp)
+{
+    const char *p = str;
+    unsigned long first, last;
+
+    CPU_ZERO(set);
+    do {
+        if (qemu_strtoul(p, &p, 10, &first) < 0) {
+            goto fail;
+        }
+        last = first;
+        if (*p == '-' &&
+            (qemu_strtoul(p + 1, &p, 10, &last) < 0 || last < first)) {
+            goto fail;
+        }
+        if (last >= CPU_SETSIZE) {
+            goto fail;
+        }
+        for (; first <= last; first++) {
+            CPU_SET(first, set);
+        }
+    } while (*p++ == ',');
+
+    if (p[-1] == '\0') {
+        return true;
+    }
+
+fail:
+    error_setg(errp, "invalid CPU list '%s'", str);
+    return false;
+}
+#endif
+
+/* Check @str and, if the thread is running, move it to those CPUs */
+static bool iothread_apply_cpu_affinity(IOThread *iothread, const char *str,
+                                        Error **errp)
+{
+#ifdef CONFIG_LINUX
+    cpu_set_t set;
+
+    if (!iothread_parse_cpu_list(str, &set, errp)) {
+        return false;
+    }
+    if (iothread->thread_id != -1 &&
+        sched_setaffinity(iothread->thread_id, sizeof(set), &set) < 0) {
+        error_setg_errno(errp, errno, "failed to set CPU affinity to '%s'",
+                         str);
+        return false;
+    }
+    return true;
+#else
+    error_setg(errp, "cpu-affinity is not supported on this host");
+    return false;
+#endif
+}
+
 static void iothread_instance_init(Object *obj)
 {
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->thread_id = -1;
 }
 
 static void iothread_instance_finalize(Object *obj)
@@ -128,6 +191,7 @@ static void iothread_instance_finalize(Object *obj)
         g_main_context_unref(iothread->worker_context);
         iothread->worker_context = NULL;
     }
+    g_free(iothread->cpu_affinity);
     qemu_cond_destroy(&iothread->init_done_cond);
     qemu_mutex_destroy(&iothread->init_done_lock);
     if (!iothread->ctx) {
@@ -184,6 +248,10 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
                        &iothread->init_done_lock);
     }
     qemu_mutex_unlock(&iothread->init_done_lock);
+
+    if (iothread->cpu_affinity) {
+        iothread_apply_cpu_affinity(iothread, iothread->cpu_affinity, errp);
+    }
 }
 
 typedef struct {
@@ -245,6 +313,25 @@ out:
     error_propagate(errp, local_err);
 }
 
+static char *iothread_get_cpu_affinity(Object *obj, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    return g_strdup(iothread->cpu_affinity ? iothread->cpu_affinity : "");
+}
+
+static void iothread_set_cpu_affinity(Object *obj, const char *value,
+                                      Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    if (!iothread_apply_cpu_affinity(iothread, value, errp)) {
+        return;
+    }
+    g_free(iothread->cpu_affinity);
+    iothread->cpu_affinity = g_strdup(value);
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -262,6 +349,9 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info, &error_abort);
+    object_class_property_add_str(klass, "cpu-affinity",
+                                  iothread_get_cpu_affinity,
+                                  iothread_set_cpu_affinity, &error_abort);
 }
 
 static const TypeInfo iothread_info = {
@@ -294,11 +384,28 @@ AioContext *iothread_get_aio_context(IOThread *iothread)
     return iothread->ctx;
 }
 
+static void iothread_add_poll_handler_info(void *opaque, int fd,
+                                           uint64_t polls, uint64_t hits)
+{
+    IOThreadPollHandlerInfoList ***prev = opaque;
+    IOThreadPollHandlerInfoList *elem;
+
+    elem = g_new0(IOThreadPollHandlerInfoList, 1);
+    elem->value = g_new0(IOThreadPollHandlerInfo, 1);
+    elem->value->fd = fd;
+    elem->value->polls = polls;
+    elem->value->hits = hits;
+
+    **prev = elem;
+    *prev = &elem->next;
+}
+
 static int query_one_iothread(Object *object, void *opaque)
 {
     IOThreadInfoList ***prev = opaque;
     IOThreadInfoList *elem;
     IOThreadInfo *info;
+    IOThreadPollHandlerInfoList **poll_prev;
     IOThread *iothread;
 
     iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
@@ -312,6 +419,16 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_max_ns = iothread->poll_max_ns;
     info->poll_grow = iothread->poll_grow;
     info->poll_shrink = iothread->poll_shrink;
+    info->run_ns = get_clock() - iothread->start_ns;
+    info->idle_ns = atomic_read(&iothread->ctx->idle_ns);
+    if (iothread->cpu_affinity) {
+        info->has_cpu_affinity = true;
+        info->cpu_affinity = g_strdup(iothread->cpu_affinity);
+    }
+    poll_prev = &info->poll_handlers;
+    aio_context_foreach_poll_handler(iothread->ctx,
+                                     iothread_add_poll_handler_info,
+                                     &poll_prev);
 
     elem = g_new0(IOThreadInfoList, 1);
     elem->value = info;
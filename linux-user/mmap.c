@@ -46,20 +46,118 @@ bool have_mmap_lock(void)
     return mmap_lock_count > 0 ? true : false;
 }
 
+/*
+ * Host page ranges whose host mapping is changed without holding
+ * mmap_lock: fresh mappings that target_mmap is populating, and ranges
+ * that target_munmap has already dropped from the page flags.  Neither
+ * is visible in the page flags, so translation and page_unprotect leave
+ * them alone, and mmap_lock is only needed to claim and release them.
+ * Operations that could touch such a range anyway (MAP_FIXED mappings,
+ * mprotect, mremap, fork) wait for it in mmap_lock_range.
+ */
+typedef struct MMapInflight {
+    abi_ulong start;
+    abi_ulong last;
+    QLIST_ENTRY(MMapInflight) next;
+} MMapInflight;
+
+static pthread_mutex_t inflight_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t inflight_cond = PTHREAD_COND_INITIALIZER;
+static QLIST_HEAD(, MMapInflight) inflight_ranges =
+    QLIST_HEAD_INITIALIZER(inflight_ranges);
+
+/* Called with inflight_mutex held.  */
+static bool inflight_overlaps_locked(abi_ulong start, abi_ulong last)
+{
+    MMapInflight *r;
+
+    QLIST_FOREACH(r, &inflight_ranges, next) {
+        if (r->start <= last && start <= r->last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool mmap_inflight_overlaps(abi_ulong start, abi_ulong last)
+{
+    bool ret;
+
+    pthread_mutex_lock(&inflight_mutex);
+    ret = inflight_overlaps_locked(start, last);
+    pthread_mutex_unlock(&inflight_mutex);
+    return ret;
+}
+
+/* Called with mmap_lock held, for a range that only the caller uses.  */
+static void mmap_inflight_add(MMapInflight *r, abi_ulong start,
+                              abi_ulong last)
+{
+    r->start = start;
+    r->last = last;
+    pthread_mutex_lock(&inflight_mutex);
+    QLIST_INSERT_HEAD(&inflight_ranges, r, next);
+    pthread_mutex_unlock(&inflight_mutex);
+}
+
+static void mmap_inflight_del(MMapInflight *r)
+{
+    pthread_mutex_lock(&inflight_mutex);
+    QLIST_REMOVE(r, next);
+    pthread_cond_broadcast(&inflight_cond);
+    pthread_mutex_unlock(&inflight_mutex);
+}
+
+/* Take mmap_lock once no in-flight operation overlaps [start, last].
+   A nested call is covered by the outermost one.  */
+static void mmap_lock_range(abi_ulong start, abi_ulong last)
+{
+    if (have_mmap_lock()) {
+        mmap_lock();
+        return;
+    }
+    for (;;) {
+        mmap_lock();
+        pthread_mutex_lock(&inflight_mutex);
+        if (!inflight_overlaps_locked(start, last)) {
+            pthread_mutex_unlock(&inflight_mutex);
+            return;
+        }
+        /* The owner may need mmap_lock to finish, so wait without it.  */
+        mmap_unlock();
+        pthread_cond_wait(&inflight_cond, &inflight_mutex);
+        pthread_mutex_unlock(&inflight_mutex);
+    }
+}
+
 /* Grab lock to make sure things are in a consistent state after fork().  */
 void mmap_fork_start(void)
 {
     if (mmap_lock_count)
         abort();
-    pthread_mutex_lock(&mmap_mutex);
+    /* ... including the host mappings changed without the lock.  */
+    for (;;) {
+        pthread_mutex_lock(&mmap_mutex);
+        pthread_mutex_lock(&inflight_mutex);
+        if (QLIST_EMPTY(&inflight_ranges)) {
+            pthread_mutex_unlock(&inflight_mutex);
+            break;
+        }
+        pthread_mutex_unlock(&mmap_mutex);
+        pthread_cond_wait(&inflight_cond, &inflight_mutex);
+        pthread_mutex_unlock(&inflight_mutex);
+    }
 }
 
 void mmap_fork_end(int child)
 {
-    if (child)
+    if (child) {
         pthread_mutex_init(&mmap_mutex, NULL);
-    else
+        pthread_mutex_init(&inflight_mutex, NULL);
+        pthread_cond_init(&inflight_cond, NULL);
+    } else {
         pthread_mutex_unlock(&mmap_mutex);
+    }
 }
 
 /* NOTE: all the constants are the HOST ones, but addresses are target. */
@@ -86,9 +184,9 @@ int target_mprotect(abi_ulong start, abi_ulong len, int prot)
     if (len == 0)
         return 0;
 
-    mmap_lock();
     host_start = start & qemu_host_page_mask;
     host_end = HOST_PAGE_ALIGN(end);
+    mmap_lock_range(host_start, host_end - 1);
     if (start > host_start) {
         /* handle host page containing start */
         prot1 = prot;
@@ -231,7 +329,8 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
             continue;
         }
         prot = page_get_flags(addr);
-        if (prot) {
+        if (prot || mmap_inflight_overlaps(addr,
+                                           addr + qemu_host_page_size - 1)) {
             end_addr = addr;
         }
         if (addr + size == end_addr) {
@@ -362,8 +461,15 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
                      int flags, int fd, abi_ulong offset)
 {
     abi_ulong ret, end, real_start, real_end, retaddr, host_offset, host_len;
+    MMapInflight inflight;
+    bool claimed = false;
 
-    mmap_lock();
+    if (flags & MAP_FIXED) {
+        mmap_lock_range(start & qemu_host_page_mask,
+                        HOST_PAGE_ALIGN(start + TARGET_PAGE_ALIGN(len)) - 1);
+    } else {
+        mmap_lock();
+    }
 #ifdef DEBUG_MMAP
     {
         printf("mmap: start=0x" TARGET_ABI_FMT_lx
@@ -412,6 +518,8 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
             errno = ENOMEM;
             goto fail;
         }
+        mmap_inflight_add(&inflight, start, start + host_len - 1);
+        claimed = true;
     }
 
     /* When mapping files into a memory area larger than the file, accesses
@@ -449,13 +557,19 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
         host_len = len + offset - host_offset;
         host_len = HOST_PAGE_ALIGN(host_len);
 
+        /* The range we claimed above is reserved on the host and has no
+           page flags yet, so populate it without holding mmap_lock.  */
+        mmap_unlock();
+
         /* Note: we prefer to control the mapping address. It is
            especially important if qemu_host_page_size >
            qemu_real_host_page_size */
         p = mmap(g2h(start), host_len, prot,
                  flags | MAP_FIXED | MAP_ANONYMOUS, -1, 0);
-        if (p == MAP_FAILED)
+        if (p == MAP_FAILED) {
+            mmap_lock();
             goto fail;
+        }
         /* update start so that it points to the file position at 'offset' */
         host_start = (unsigned long)p;
         if (!(flags & MAP_ANONYMOUS)) {
@@ -463,10 +577,12 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
                      flags | MAP_FIXED, fd, host_offset);
             if (p == MAP_FAILED) {
                 munmap(g2h(start), host_len);
+                mmap_lock();
                 goto fail;
             }
             host_start += offset - host_offset;
         }
+        mmap_lock();
         start = h2g(host_start);
     } else {
         if (start & ~TARGET_PAGE_MASK) {
@@ -561,9 +677,15 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
     printf("\n");
 #endif
     tb_invalidate_phys_range(start, start + len);
+    if (claimed) {
+        mmap_inflight_del(&inflight);
+    }
     mmap_unlock();
     return start;
 fail:
+    if (claimed) {
+        mmap_inflight_del(&inflight);
+    }
     mmap_unlock();
     return -1;
 }
@@ -612,6 +734,7 @@ static void mmap_reserve(abi_ulong start, abi_ulong size)
 int target_munmap(abi_ulong start, abi_ulong len)
 {
     abi_ulong end, real_start, real_end, addr;
+    MMapInflight inflight;
     int prot, ret;
 
 #ifdef DEBUG_MMAP
@@ -624,10 +747,10 @@ int target_munmap(abi_ulong start, abi_ulong len)
     len = TARGET_PAGE_ALIGN(len);
     if (len == 0)
         return -EINVAL;
-    mmap_lock();
     end = start + len;
     real_start = start & qemu_host_page_mask;
     real_end = HOST_PAGE_ALIGN(end);
+    mmap_lock_range(real_start, real_end - 1);
 
     if (start > real_start) {
         /* handle host page containing start */
@@ -653,21 +776,27 @@ int target_munmap(abi_ulong start, abi_ulong len)
             real_end -= qemu_host_page_size;
     }
 
+    /* Drop the pages from the guest's view first.  After that nothing
+       else looks at the whole host pages, so unmap them without holding
+       mmap_lock.  */
+    page_set_flags(start, start + len, 0);
+    tb_invalidate_phys_range(start, start + len);
+
     ret = 0;
     /* unmap what we can */
     if (real_start < real_end) {
+        mmap_inflight_add(&inflight, real_start, real_end - 1);
+        mmap_unlock();
+        /* Host page aligned, so this does not look at the page flags */
         if (reserved_va) {
             mmap_reserve(real_start, real_end - real_start);
         } else {
             ret = munmap(g2h(real_start), real_end - real_start);
         }
+        mmap_inflight_del(&inflight);
+    } else {
+        mmap_unlock();
     }
-
-    if (ret == 0) {
-        page_set_flags(start, start + len, 0);
-        tb_invalidate_phys_range(start, start + len);
-    }
-    mmap_unlock();
     return ret;
 }
 
@@ -678,7 +807,8 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
     int prot;
     void *host_addr;
 
-    mmap_lock();
+    /* Both ranges may be touched; mremap is rare, so wait for everything */
+    mmap_lock_range(0, (abi_ulong)-1);
 
     if (flags & MREMAP_FIXED) {
         host_addr = mremap(g2h(old_addr), old_size, new_size,
@@ -5663,6 +5663,17 @@ static abi_long do_ioctl(int fd, int cmd, abi_long arg)
     case TYPE_PTR:
         arg_type++;
         target_size = thunk_type_size(arg_type, 0);
+        if (thunk_type_is_identical(arg_type)) {
+            /* The host can work on the guest's copy of the argument */
+            argptr = lock_user(ie->access == IOC_W ? VERIFY_READ
+                               : VERIFY_WRITE, arg, target_size,
+                               ie->access != IOC_R);
+            if (!argptr)
+                return -TARGET_EFAULT;
+            ret = get_errno(safe_ioctl(fd, ie->host_cmd, argptr));
+            unlock_user(argptr, arg, ie->access == IOC_W ? 0 : target_size);
+            break;
+        }
         switch(ie->access) {
         case IOC_R:
             ret = get_errno(safe_ioctl(fd, ie->host_cmd, buf_temp));
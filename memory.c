@@ -39,6 +39,11 @@
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
+/* Set when every FlatView must be rendered again, not just those whose
+ * tree contains a region marked by memory_region_update_mark().  */
+static bool memory_region_update_all;
+/* Incremented after each commit that rendered FlatViews again */
+static unsigned memory_region_update_gen = 1;
 static bool global_dirty_log = false;
 
 static QTAILQ_HEAD(memory_listeners, MemoryListener) memory_listeners
@@ -968,6 +973,44 @@ static void address_space_update_topology_pass(AddressSpace *as,
     }
 }
 
+static inline void memory_region_update_mark(MemoryRegion *mr, bool pending)
+{
+    if (pending) {
+        mr->changed_gen = memory_region_update_gen;
+        memory_region_update_pending = true;
+    }
+}
+
+/* Return whether any region that rendering @mr would visit, following
+ * subregions and aliases, was changed in this transaction.  The result is
+ * remembered in each region so that trees shared by several roots are
+ * only walked once per commit.
+ */
+static bool memory_region_tree_changed(MemoryRegion *mr)
+{
+    MemoryRegion *subregion;
+    bool changed;
+
+    if (mr->checked_gen == memory_region_update_gen) {
+        return mr->tree_changed;
+    }
+
+    changed = mr->changed_gen == memory_region_update_gen;
+    if (!changed && mr->alias) {
+        changed = memory_region_tree_changed(mr->alias);
+    }
+    QTAILQ_FOREACH(subregion, &mr->subregions, subregions_link) {
+        if (changed) {
+            break;
+        }
+        changed = memory_region_tree_changed(subregion);
+    }
+
+    mr->checked_gen = memory_region_update_gen;
+    mr->tree_changed = changed;
+    return changed;
+}
+
 static void flatviews_init(void)
 {
     static FlatView *empty_view;
@@ -990,24 +1033,37 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /* Render unique FVs, reusing those whose tree did not change */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *view;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
+        view = old_views ? g_hash_table_lookup(old_views, physmr) : NULL;
+        if (view && !memory_region_update_all &&
+            !memory_region_tree_changed(physmr)) {
+            flatview_ref(view);
+            g_hash_table_replace(flat_views, physmr, view);
+            continue;
+        }
+
         generate_memory_topology(physmr);
     }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
+    }
+    memory_region_update_all = false;
+    memory_region_update_gen++;
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1450,6 +1506,8 @@ MemTxResult memory_region_dispatch_read(MemoryRegion *mr,
         return MEMTX_DECODE_ERROR;
     }
 
+    stat64_add(&mr->accesses, 1);
+
     r = memory_region_dispatch_read1(mr, addr, pval, size, attrs);
     adjust_endianness(mr, pval, size);
     return r;
@@ -1492,6 +1550,7 @@ MemTxResult memory_region_dispatch_write(MemoryRegion *mr,
         return MEMTX_DECODE_ERROR;
     }
 
+    stat64_add(&mr->accesses, 1);
     adjust_endianness(mr, &data, size);
 
     if ((!kvm_eventfds_enabled()) &&
@@ -1571,7 +1630,7 @@ void memory_region_init_ram_from_file(MemoryRegion *mr,
                                       const char *name,
                                       uint64_t size,
                                       uint64_t align,
-                                      bool share,
+                                      uint32_t ram_flags,
                                       const char *path,
                                       Error **errp)
 {
@@ -1580,7 +1639,7 @@ void memory_region_init_ram_from_file(MemoryRegion *mr,
     mr->terminates = true;
     mr->destructor = memory_region_destructor_ram;
     mr->align = align;
-    mr->ram_block = qemu_ram_alloc_from_file(size, mr, share, path, errp);
+    mr->ram_block = qemu_ram_alloc_from_file(size, mr, ram_flags, path, errp);
     mr->dirty_log_mask = tcg_enabled() ? (1 << DIRTY_MEMORY_CODE) : 0;
 }
 
@@ -1596,7 +1655,8 @@ void memory_region_init_ram_from_fd(MemoryRegion *mr,
     mr->ram = true;
     mr->terminates = true;
     mr->destructor = memory_region_destructor_ram;
-    mr->ram_block = qemu_ram_alloc_from_fd(size, mr, share, fd, errp);
+    mr->ram_block = qemu_ram_alloc_from_fd(size, mr,
+                                           share ? RAM_SHARED : 0, fd, errp);
     mr->dirty_log_mask = tcg_enabled() ? (1 << DIRTY_MEMORY_CODE) : 0;
 }
 #endif
@@ -1866,6 +1926,7 @@ void memory_region_iommu_replay_all(IOMMUMemoryRegion *iommu_mr)
 {
     IOMMUNotifier *notifier;
 
+    iommu_tlb_cache_flush(iommu_mr, 0, (hwaddr)-1);
     IOMMU_NOTIFIER_FOREACH(notifier, iommu_mr) {
         memory_region_iommu_replay(iommu_mr, notifier);
     }
@@ -1917,6 +1978,8 @@ void memory_region_notify_iommu(IOMMUMemoryRegion *iommu_mr,
 
     assert(memory_region_is_iommu(MEMORY_REGION(iommu_mr)));
 
+    /* Both new mappings and unmaps make cached translations stale.  */
+    iommu_tlb_cache_flush(iommu_mr, entry.iova, entry.addr_mask);
     IOMMU_NOTIFIER_FOREACH(iommu_notifier, iommu_mr) {
         memory_region_notify_one(iommu_notifier, &entry);
     }
@@ -1936,7 +1999,7 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    memory_region_update_mark(mr, mr->enabled);
     memory_region_transaction_commit();
 }
 
@@ -1996,6 +2059,10 @@ void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
      * address space once.
      */
     QTAILQ_FOREACH(listener, &memory_listeners, link) {
+        if (listener->log_sync_global) {
+            listener->log_sync_global(listener);
+            continue;
+        }
         if (!listener->log_sync) {
             continue;
         }
@@ -2016,7 +2083,7 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        memory_region_update_mark(mr, mr->enabled);
         memory_region_transaction_commit();
     }
 }
@@ -2026,7 +2093,7 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        memory_region_update_mark(mr, mr->enabled);
         memory_region_transaction_commit();
     }
 }
@@ -2291,7 +2358,7 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    memory_region_update_mark(mr, mr->enabled && subregion->enabled);
     memory_region_transaction_commit();
 }
 
@@ -2330,7 +2397,7 @@ void memory_region_del_subregion(MemoryRegion *mr,
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    memory_region_update_mark(mr, mr->enabled && subregion->enabled);
     memory_region_transaction_commit();
 }
 
@@ -2341,7 +2408,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_mark(mr, true);
     memory_region_transaction_commit();
 }
 
@@ -2357,7 +2424,7 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
     }
     memory_region_transaction_begin();
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_update_mark(mr, true);
     memory_region_transaction_commit();
 }
 
@@ -2394,7 +2461,7 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    memory_region_update_mark(mr, mr->enabled);
     memory_region_transaction_commit();
 }
 
@@ -2505,6 +2572,10 @@ void memory_global_dirty_log_sync(void)
     FlatRange *fr;
 
     QTAILQ_FOREACH(listener, &memory_listeners, link) {
+        if (listener->log_sync_global) {
+            listener->log_sync_global(listener);
+            continue;
+        }
         if (!listener->log_sync) {
             continue;
         }
@@ -2537,6 +2608,7 @@ void memory_global_dirty_log_start(void)
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
+    memory_region_update_all = true;
     memory_region_transaction_commit();
 }
 
@@ -2547,6 +2619,7 @@ static void memory_global_dirty_log_do_stop(void)
     /* Refresh DIRTY_LOG_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
+    memory_region_update_all = true;
     memory_region_transaction_commit();
 
     MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
@@ -2774,6 +2847,11 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfds = NULL;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
+    qemu_mutex_init(&as->bounce_lock);
+    QLIST_INIT(&as->bounce_buffers);
+    as->bounce_buffer_size = 0;
+    as->max_bounce_buffer_size = DEFAULT_MAX_BOUNCE_BUFFER_SIZE;
+    as->iommu_cache = NULL;
     as->name = g_strdup(name ? name : "anonymous");
     address_space_update_topology(as);
     address_space_update_ioeventfds(as);
@@ -2782,7 +2860,9 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
 static void do_address_space_destroy(AddressSpace *as)
 {
     assert(QTAILQ_EMPTY(&as->listeners));
+    assert(QLIST_EMPTY(&as->bounce_buffers));
 
+    qemu_mutex_destroy(&as->bounce_lock);
     flatview_unref(as->current_map);
     g_free(as->name);
     g_free(as->ioeventfds);
@@ -2797,6 +2877,9 @@ void address_space_destroy(AddressSpace *as)
     memory_region_transaction_begin();
     as->root = NULL;
     memory_region_transaction_commit();
+    if (as->iommu_cache) {
+        address_space_disable_iommu_cache(as);
+    }
     QTAILQ_REMOVE(&address_spaces, as, address_spaces_link);
 
     /* At this point, as->dispatch and as->current_map are dummy
@@ -2807,6 +2890,68 @@ void address_space_destroy(AddressSpace *as)
     call_rcu(as, do_address_space_destroy, rcu);
 }
 
+static void memory_region_collect_accessed(MemoryRegion *mr,
+                                           GHashTable *seen, GPtrArray *busy)
+{
+    MemoryRegion *submr;
+
+    while (mr->alias) {
+        mr = mr->alias;
+    }
+    if (g_hash_table_lookup(seen, mr)) {
+        return;
+    }
+    g_hash_table_insert(seen, mr, mr);
+
+    if (stat64_get(&mr->accesses)) {
+        g_ptr_array_add(busy, mr);
+    }
+    QTAILQ_FOREACH(submr, &mr->subregions, subregions_link) {
+        memory_region_collect_accessed(submr, seen, busy);
+    }
+}
+
+static gint memory_region_accesses_compare(gconstpointer a, gconstpointer b)
+{
+    const MemoryRegion *mr_a = *(MemoryRegion * const *)a;
+    const MemoryRegion *mr_b = *(MemoryRegion * const *)b;
+    uint64_t count_a = stat64_get(&mr_a->accesses);
+    uint64_t count_b = stat64_get(&mr_b->accesses);
+
+    /* busiest first */
+    return count_a < count_b ? 1 : count_a > count_b ? -1 : 0;
+}
+
+RegionAccessStatsList *memory_region_access_stats(unsigned max)
+{
+    RegionAccessStatsList *head = NULL, *entry;
+    GHashTable *seen = g_hash_table_new(NULL, NULL);
+    GPtrArray *busy = g_ptr_array_new();
+    AddressSpace *as;
+    MemoryRegion *mr;
+    unsigned i;
+
+    QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+        memory_region_collect_accessed(as->root, seen, busy);
+    }
+    g_ptr_array_sort(busy, memory_region_accesses_compare);
+
+    /* build the list backwards so that it ends up sorted */
+    for (i = MIN(max, busy->len); i-- > 0; ) {
+        mr = g_ptr_array_index(busy, i);
+        entry = g_new0(RegionAccessStatsList, 1);
+        entry->value = g_new0(RegionAccessStats, 1);
+        entry->value->name = g_strdup(memory_region_name(mr));
+        entry->value->count = stat64_get(&mr->accesses);
+        entry->next = head;
+        head = entry;
+    }
+
+    g_ptr_array_free(busy, true);
+    g_hash_table_destroy(seen);
+    return head;
+}
+
 static const char *memory_region_type(MemoryRegion *mr)
 {
     if (memory_region_is_ram_device(mr)) {
@@ -366,7 +366,11 @@ static int colo_do_checkpoint_transaction(MigrationState *s,
         goto out;
     }
 
-    qemu_put_buffer(s->to_dst_file, bioc->data, bioc->usage);
+    /*
+     * Send the buffered state without copying it through the QEMUFile
+     * buffer; bioc->data stays untouched until the flush below is done.
+     */
+    qemu_put_buffer_async(s->to_dst_file, bioc->data, bioc->usage, false);
     qemu_fflush(s->to_dst_file);
     ret = qemu_file_get_error(s->to_dst_file);
     if (ret < 0) {
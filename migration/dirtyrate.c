@@ -0,0 +1,234 @@
+/*
+ *  Dirty page rate measurement
+ *
+ *  The guest dirty rate is estimated without dirty logging, so it can
+ *  be measured before a migration is started, and without disturbing
+ *  one that is running: a few pages of every RAMBlock are hashed, and
+ *  hashed again after the measurement time to see how many of them
+ *  changed.
+ *
+ *  Copyright (c) 2018 Red Hat Inc
+ *
+ *  This work is licensed under the terms of the GNU GPL, version 2 or later.
+ *  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/crc32c.h"
+#include "qemu/rcu.h"
+#include "qemu/rcu_queue.h"
+#include "qemu/timer.h"
+#include "exec/ram_addr.h"
+#include "qmp-commands.h"
+#include "qapi/qmp/qerror.h"
+#include "trace.h"
+#include "dirtyrate.h"
+
+static struct {
+    QemuThread thread;
+    /* DirtyRateStatus, only accessed with atomic operations */
+    int status;
+    /* calc-time of the current or last measurement, in seconds */
+    int64_t calc_time;
+    /* start of the current or last measurement, in seconds */
+    int64_t start_time;
+    /* result of the last measurement, in MiB/s */
+    int64_t dirty_rate;
+} dirtyrate_state = {
+    .status = DIRTY_RATE_STATUS_UNSTARTED,
+    .dirty_rate = -1,
+};
+
+static uint32_t get_ramblock_page_hash(RAMBlock *block, uint64_t vfn)
+{
+    return crc32c(0xffffffff, block->host + vfn * TARGET_PAGE_SIZE,
+                  TARGET_PAGE_SIZE);
+}
+
+static bool skip_sample_ramblock(RAMBlock *block)
+{
+    return block->used_length < (DIRTYRATE_MIN_RAMBLOCK_SIZE << 20);
+}
+
+static void free_ramblock_dirty_info(RamblockDirtyInfo *infos, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        g_free(infos[i].sample_page_vfn);
+        g_free(infos[i].hash_result);
+    }
+    g_free(infos);
+}
+
+/* Called with rcu_read_lock() held */
+static void sample_ramblock(RamblockDirtyInfo *info, RAMBlock *block)
+{
+    uint64_t gb = MAX(block->used_length >> 30, 1);
+    uint32_t i;
+
+    pstrcpy(info->idstr, sizeof(info->idstr), block->idstr);
+    info->ramblock_pages = block->used_length >> TARGET_PAGE_BITS;
+    info->sample_pages_count = MIN(DIRTYRATE_SAMPLE_PAGES_PER_GB * gb,
+                                   info->ramblock_pages);
+    info->sample_dirty_count = 0;
+    info->sample_page_vfn = g_new(uint64_t, info->sample_pages_count);
+    info->hash_result = g_new(uint32_t, info->sample_pages_count);
+
+    for (i = 0; i < info->sample_pages_count; i++) {
+        info->sample_page_vfn[i] =
+            g_random_int_range(0, MIN(info->ramblock_pages, INT32_MAX));
+        info->hash_result[i] =
+            get_ramblock_page_hash(block, info->sample_page_vfn[i]);
+    }
+}
+
+static RamblockDirtyInfo *record_ramblock_hash_info(int *count)
+{
+    RamblockDirtyInfo *infos = NULL;
+    RAMBlock *block;
+    int n = 0;
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH(block) {
+        if (skip_sample_ramblock(block)) {
+            continue;
+        }
+        infos = g_renew(RamblockDirtyInfo, infos, n + 1);
+        sample_ramblock(&infos[n], block);
+        n++;
+    }
+    rcu_read_unlock();
+
+    *count = n;
+    return infos;
+}
+
+/* Called with rcu_read_lock() held */
+static RamblockDirtyInfo *find_ramblock_dirty_info(RamblockDirtyInfo *infos,
+                                                   int count,
+                                                   RAMBlock *block)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!strcmp(infos[i].idstr, block->idstr)) {
+            return &infos[i];
+        }
+    }
+    return NULL;
+}
+
+static void compare_ramblock_hash_info(RamblockDirtyInfo *infos, int count)
+{
+    RamblockDirtyInfo *info;
+    RAMBlock *block;
+    uint32_t i;
+
+    rcu_read_lock();
+    RAMBLOCK_FOREACH(block) {
+        info = find_ramblock_dirty_info(infos, count, block);
+        /* a block that was resized is not the one we sampled anymore */
+        if (!info ||
+            info->ramblock_pages != block->used_length >> TARGET_PAGE_BITS) {
+            continue;
+        }
+        for (i = 0; i < info->sample_pages_count; i++) {
+            if (get_ramblock_page_hash(block, info->sample_page_vfn[i]) !=
+                info->hash_result[i]) {
+                info->sample_dirty_count++;
+            }
+        }
+    }
+    rcu_read_unlock();
+}
+
+/*
+ * Every block contributes the fraction of its sampled pages that
+ * changed, scaled to its size.  Note that this counts the pages that
+ * were written at least once during the measurement, which is what
+ * matters for migration, not the number of writes.
+ */
+static int64_t calculate_dirty_rate(RamblockDirtyInfo *infos, int count,
+                                    int64_t calc_time_ms)
+{
+    uint64_t dirty_bytes = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!infos[i].sample_pages_count) {
+            continue;
+        }
+        dirty_bytes += infos[i].ramblock_pages * TARGET_PAGE_SIZE *
+                       infos[i].sample_dirty_count /
+                       infos[i].sample_pages_count;
+    }
+    return (dirty_bytes >> 20) * 1000 / MAX(calc_time_ms, 1);
+}
+
+static void *get_dirtyrate_thread(void *opaque)
+{
+    RamblockDirtyInfo *infos;
+    int64_t start_ms, end_ms;
+    int count;
+
+    rcu_register_thread();
+
+    start_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    dirtyrate_state.start_time = start_ms / 1000;
+    infos = record_ramblock_hash_info(&count);
+
+    g_usleep(dirtyrate_state.calc_time * G_USEC_PER_SEC);
+
+    compare_ramblock_hash_info(infos, count);
+    end_ms = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    dirtyrate_state.dirty_rate = calculate_dirty_rate(infos, count,
+                                                      end_ms - start_ms);
+    trace_get_dirtyrate_thread(count, dirtyrate_state.dirty_rate);
+    free_ramblock_dirty_info(infos, count);
+
+    atomic_mb_set(&dirtyrate_state.status, DIRTY_RATE_STATUS_MEASURED);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+void qmp_calc_dirty_rate(int64_t calc_time, Error **errp)
+{
+    int status;
+
+    if (calc_time < DIRTYRATE_MIN_CALC_TIME_SEC ||
+        calc_time > DIRTYRATE_MAX_CALC_TIME_SEC) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "calc-time",
+                   "a value between 1 and 60");
+        return;
+    }
+
+    status = atomic_read(&dirtyrate_state.status);
+    if (status == DIRTY_RATE_STATUS_MEASURING ||
+        atomic_cmpxchg(&dirtyrate_state.status, status,
+                       DIRTY_RATE_STATUS_MEASURING) != status) {
+        error_setg(errp, "the dirty rate is already being measured");
+        return;
+    }
+
+    dirtyrate_state.calc_time = calc_time;
+    dirtyrate_state.dirty_rate = -1;
+    qemu_thread_create(&dirtyrate_state.thread, "get_dirtyrate",
+                       get_dirtyrate_thread, NULL, QEMU_THREAD_DETACHED);
+}
+
+DirtyRateInfo *qmp_query_dirty_rate(Error **errp)
+{
+    DirtyRateInfo *info = g_new0(DirtyRateInfo, 1);
+
+    info->status = atomic_mb_read(&dirtyrate_state.status);
+    info->dirty_rate = info->status == DIRTY_RATE_STATUS_MEASURED ?
+                       dirtyrate_state.dirty_rate : -1;
+    info->start_time = dirtyrate_state.start_time;
+    info->calc_time = dirtyrate_state.calc_time;
+
+    return info;
+}
@@ -0,0 +1,35 @@
+/*
+ *  Dirty page rate measurement
+ *
+ *  Copyright (c) 2018 Red Hat Inc
+ *
+ *  This work is licensed under the terms of the GNU GPL, version 2 or later.
+ *  See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_DIRTYRATE_H
+#define QEMU_MIGRATION_DIRTYRATE_H
+
+/* Pages sampled for every GiB of guest RAM */
+#define DIRTYRATE_SAMPLE_PAGES_PER_GB      512
+
+/* RAMBlocks smaller than this (in MiB) are ROMs and the like, skip them */
+#define DIRTYRATE_MIN_RAMBLOCK_SIZE        128
+
+#define DIRTYRATE_MIN_CALC_TIME_SEC        1
+#define DIRTYRATE_MAX_CALC_TIME_SEC        60
+
+typedef struct RamblockDirtyInfo {
+    /* idstr of the RAMBlock, to find it again after the sleep */
+    char idstr[256];
+    /* used_length of the RAMBlock when it was sampled, in pages */
+    uint64_t ramblock_pages;
+    /* offsets of the sampled pages, in pages */
+    uint64_t *sample_page_vfn;
+    /* crc32c of the sampled pages at the start of the measurement */
+    uint32_t *hash_result;
+    uint32_t sample_pages_count;
+    uint32_t sample_dirty_count;
+} RamblockDirtyInfo;
+
+#endif
@@ -19,6 +19,7 @@
 #include "migration/blocker.h"
 #include "exec.h"
 #include "fd.h"
+#include "file.h"
 #include "socket.h"
 #include "rdma.h"
 #include "ram.h"
@@ -79,6 +80,14 @@
 #define DEFAULT_MIGRATE_X_CHECKPOINT_DELAY 200
 #define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
 #define DEFAULT_MIGRATE_MULTIFD_PAGE_COUNT 16
+#define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
+#define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
+#define DEFAULT_MIGRATE_BITMAP_SYNC_THREADS 0
+#define DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES 16
+#define DEFAULT_MIGRATE_LOAD_THREADS 0
+#define MAX_BITMAP_SYNC_THREADS 64
+#define MAX_POSTCOPY_PREFETCH_PAGES 256
+#define MAX_LOAD_THREADS 64
 
 static NotifierList migration_state_notifiers =
     NOTIFIER_LIST_INITIALIZER(migration_state_notifiers);
@@ -264,6 +273,8 @@ void qemu_start_incoming_migration(const char *uri, Error **errp)
         unix_start_incoming_migration(p, errp);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_incoming_migration(p, errp);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_incoming_migration(p, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -411,12 +422,34 @@ void migration_fd_process_incoming(QEMUFile *f)
 void migration_ioc_process_incoming(QIOChannel *ioc)
 {
     MigrationIncomingState *mis = migration_incoming_get_current();
+    bool start_migration;
 
     if (!mis->from_src_file) {
+        /* The first connection is always the main migration stream */
         QEMUFile *f = qemu_fopen_channel_input(ioc);
-        migration_fd_process_incoming(f);
+        migration_incoming_setup(f);
+        start_migration = !migrate_use_multifd();
+    } else {
+        Error *local_err = NULL;
+
+        if (!migrate_use_multifd()) {
+            error_report("Unexpected extra migration channel, "
+                         "x-multifd is not enabled");
+            return;
+        }
+        /* Multiple connections */
+        start_migration = multifd_recv_new_channel(ioc, &local_err);
+        if (local_err) {
+            error_report_err(local_err);
+            return;
+        }
+    }
+
+    /* The main stream blocks waiting for the multifd channels at each
+     * sync point, so only start loading once all of them are there */
+    if (start_migration) {
+        migration_incoming_process();
     }
-    /* We still only have a single channel.  Nothing to do here yet */
 }
 
 /**
@@ -427,7 +460,12 @@ void migration_ioc_process_incoming(QIOChannel *ioc)
  */
 bool migration_has_all_channels(void)
 {
-    return true;
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    bool all_channels;
+
+    all_channels = multifd_recv_all_channels_created();
+
+    return all_channels && mis->from_src_file != NULL;
 }
 
 /*
@@ -522,6 +560,18 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->x_multifd_page_count = s->parameters.x_multifd_page_count;
     params->has_xbzrle_cache_size = true;
     params->xbzrle_cache_size = s->parameters.xbzrle_cache_size;
+    params->has_x_multifd_compression = true;
+    params->x_multifd_compression = s->parameters.x_multifd_compression;
+    params->has_x_multifd_zlib_level = true;
+    params->x_multifd_zlib_level = s->parameters.x_multifd_zlib_level;
+    params->has_x_multifd_zstd_level = true;
+    params->x_multifd_zstd_level = s->parameters.x_multifd_zstd_level;
+    params->has_x_bitmap_sync_threads = true;
+    params->x_bitmap_sync_threads = s->parameters.x_bitmap_sync_threads;
+    params->has_x_postcopy_prefetch_pages = true;
+    params->x_postcopy_prefetch_pages = s->parameters.x_postcopy_prefetch_pages;
+    params->has_x_load_threads = true;
+    params->x_load_threads = s->parameters.x_load_threads;
 
     return params;
 }
@@ -582,6 +632,7 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     if (s->state != MIGRATION_STATUS_COMPLETED) {
         info->ram->remaining = ram_bytes_remaining();
         info->ram->dirty_pages_rate = ram_counters.dirty_pages_rate;
+        info->ram->dirty_pages_rate_avg = ram_counters.dirty_pages_rate_avg;
     }
 }
 
@@ -690,7 +741,37 @@ static bool migrate_caps_check(bool *cap_list,
     }
 #endif
 
+    if (cap_list[MIGRATION_CAPABILITY_X_BACKGROUND_SNAPSHOT]) {
+        if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM] ||
+            cap_list[MIGRATION_CAPABILITY_X_COLO]) {
+            /* Both need the guest to run on the destination */
+            error_setg(errp, "Background snapshot is not compatible "
+                       "with postcopy or COLO");
+            return false;
+        }
+    }
+
+    if (cap_list[MIGRATION_CAPABILITY_X_MAPPED_RAM]) {
+        if (cap_list[MIGRATION_CAPABILITY_XBZRLE] ||
+            cap_list[MIGRATION_CAPABILITY_COMPRESS] ||
+            cap_list[MIGRATION_CAPABILITY_X_MULTIFD] ||
+            cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+            /* Each page must be stored whole at its own offset */
+            error_setg(errp, "Mapped RAM is not compatible with xbzrle, "
+                       "compression, multifd or postcopy");
+            return false;
+        }
+    }
+
     if (cap_list[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+        if (cap_list[MIGRATION_CAPABILITY_X_MULTIFD]) {
+            /* Pages arriving on the multifd channels are not placed
+             * atomically, which userfaultfd requires.
+             */
+            error_setg(errp, "Postcopy is not currently compatible "
+                       "with multifd");
+            return false;
+        }
         if (cap_list[MIGRATION_CAPABILITY_COMPRESS]) {
             /* The decompression threads asynchronously write into RAM
              * rather than use the atomic copies needed to avoid
@@ -825,6 +906,53 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+#ifndef CONFIG_ZSTD
+    if (params->has_x_multifd_compression &&
+        params->x_multifd_compression == MULTIFD_COMPRESSION_ZSTD) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_compression",
+                   "is invalid, QEMU was built without zstd support");
+        return false;
+    }
+#endif
+
+    if (params->has_x_multifd_zlib_level &&
+        (params->x_multifd_zlib_level > 9)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_zlib_level",
+                   "is invalid, it should be in the range of 0 to 9");
+        return false;
+    }
+
+    if (params->has_x_multifd_zstd_level &&
+        (params->x_multifd_zstd_level > 20)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "multifd_zstd_level",
+                   "is invalid, it should be in the range of 0 to 20");
+        return false;
+    }
+
+    if (params->has_x_bitmap_sync_threads &&
+        (params->x_bitmap_sync_threads > MAX_BITMAP_SYNC_THREADS)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "x_bitmap_sync_threads",
+                   "is invalid, it should be in the range of 0 to 64");
+        return false;
+    }
+
+    if (params->has_x_postcopy_prefetch_pages &&
+        (params->x_postcopy_prefetch_pages > MAX_POSTCOPY_PREFETCH_PAGES)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "x_postcopy_prefetch_pages",
+                   "is invalid, it should be in the range of 0 to 256");
+        return false;
+    }
+
+    if (params->has_x_load_threads &&
+        (params->x_load_threads > MAX_LOAD_THREADS)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "x_load_threads",
+                   "is invalid, it should be in the range of 0 to 64");
+        return false;
+    }
+
     return true;
 }
 
@@ -889,6 +1017,24 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_xbzrle_cache_size) {
         dest->xbzrle_cache_size = params->xbzrle_cache_size;
     }
+    if (params->has_x_multifd_compression) {
+        dest->x_multifd_compression = params->x_multifd_compression;
+    }
+    if (params->has_x_multifd_zlib_level) {
+        dest->x_multifd_zlib_level = params->x_multifd_zlib_level;
+    }
+    if (params->has_x_multifd_zstd_level) {
+        dest->x_multifd_zstd_level = params->x_multifd_zstd_level;
+    }
+    if (params->has_x_bitmap_sync_threads) {
+        dest->x_bitmap_sync_threads = params->x_bitmap_sync_threads;
+    }
+    if (params->has_x_postcopy_prefetch_pages) {
+        dest->x_postcopy_prefetch_pages = params->x_postcopy_prefetch_pages;
+    }
+    if (params->has_x_load_threads) {
+        dest->x_load_threads = params->x_load_threads;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -961,6 +1107,25 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
         s->parameters.xbzrle_cache_size = params->xbzrle_cache_size;
         xbzrle_cache_resize(params->xbzrle_cache_size, errp);
     }
+    if (params->has_x_multifd_compression) {
+        s->parameters.x_multifd_compression = params->x_multifd_compression;
+    }
+    if (params->has_x_multifd_zlib_level) {
+        s->parameters.x_multifd_zlib_level = params->x_multifd_zlib_level;
+    }
+    if (params->has_x_multifd_zstd_level) {
+        s->parameters.x_multifd_zstd_level = params->x_multifd_zstd_level;
+    }
+    if (params->has_x_bitmap_sync_threads) {
+        s->parameters.x_bitmap_sync_threads = params->x_bitmap_sync_threads;
+    }
+    if (params->has_x_postcopy_prefetch_pages) {
+        s->parameters.x_postcopy_prefetch_pages =
+            params->x_postcopy_prefetch_pages;
+    }
+    if (params->has_x_load_threads) {
+        s->parameters.x_load_threads = params->x_load_threads;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
@@ -1092,6 +1257,7 @@ static void migrate_fd_cleanup(void *opaque)
         qemu_fclose(s->to_dst_file);
         s->to_dst_file = NULL;
     }
+    socket_outgoing_cleanup();
 
     assert((s->state != MIGRATION_STATUS_ACTIVE) &&
            (s->state != MIGRATION_STATUS_POSTCOPY_ACTIVE));
@@ -1390,6 +1556,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
         unix_start_outgoing_migration(s, p, &local_err);
     } else if (strstart(uri, "fd:", &p)) {
         fd_start_outgoing_migration(s, p, &local_err);
+    } else if (strstart(uri, "file:", &p)) {
+        file_start_outgoing_migration(s, p, &local_err);
     } else {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "uri",
                    "a valid migration protocol");
@@ -1475,6 +1643,24 @@ bool migrate_release_ram(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_RELEASE_RAM];
 }
 
+bool migrate_background_snapshot(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_X_BACKGROUND_SNAPSHOT];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_X_MAPPED_RAM];
+}
+
 bool migrate_postcopy_ram(void)
 {
     MigrationState *s;
@@ -1589,6 +1775,60 @@ int migrate_multifd_page_count(void)
     return s->parameters.x_multifd_page_count;
 }
 
+MultiFDCompression migrate_multifd_compression(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_multifd_compression;
+}
+
+int migrate_multifd_zlib_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_multifd_zlib_level;
+}
+
+int migrate_multifd_zstd_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_multifd_zstd_level;
+}
+
+int migrate_bitmap_sync_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_bitmap_sync_threads;
+}
+
+int migrate_postcopy_prefetch_pages(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_postcopy_prefetch_pages;
+}
+
+int migrate_load_threads(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_load_threads;
+}
+
 int migrate_use_xbzrle(void)
 {
     MigrationState *s;
@@ -2247,6 +2487,32 @@ static MigIterateState migration_iteration_run(MigrationState *s)
     return MIG_ITERATE_RESUME;
 }
 
+/*
+ * With x-background-snapshot the migration stream is a checkpoint, not
+ * a hand over: the guest only stopped for the final stage and goes on
+ * running here, as it does after a failed migration.
+ */
+static void migration_snapshot_resume(MigrationState *s)
+{
+    Error *local_err = NULL;
+
+    if (s->block_inactive) {
+        bdrv_invalidate_cache_all(&local_err);
+        if (local_err) {
+            error_report_err(local_err);
+            runstate_set(RUN_STATE_POSTMIGRATE);
+            return;
+        }
+        s->block_inactive = false;
+    }
+
+    if (s->vm_was_running) {
+        vm_start();
+    } else if (runstate_check(RUN_STATE_FINISH_MIGRATE)) {
+        runstate_set(RUN_STATE_POSTMIGRATE);
+    }
+}
+
 static void migration_iteration_finish(MigrationState *s)
 {
     /* If we enabled cpu throttling for auto-converge, turn it off. */
@@ -2256,7 +2522,11 @@ static void migration_iteration_finish(MigrationState *s)
     switch (s->state) {
     case MIGRATION_STATUS_COMPLETED:
         migration_calculate_complete(s);
-        runstate_set(RUN_STATE_POSTMIGRATE);
+        if (migrate_background_snapshot()) {
+            migration_snapshot_resume(s);
+        } else {
+            runstate_set(RUN_STATE_POSTMIGRATE);
+        }
         break;
 
     case MIGRATION_STATUS_ACTIVE:
@@ -2476,6 +2746,21 @@ static Property migration_properties[] = {
     DEFINE_PROP_SIZE("xbzrle-cache-size", MigrationState,
                       parameters.xbzrle_cache_size,
                       DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE),
+    DEFINE_PROP_UINT8("x-multifd-zlib-level", MigrationState,
+                      parameters.x_multifd_zlib_level,
+                      DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL),
+    DEFINE_PROP_UINT8("x-multifd-zstd-level", MigrationState,
+                      parameters.x_multifd_zstd_level,
+                      DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL),
+    DEFINE_PROP_UINT8("x-bitmap-sync-threads", MigrationState,
+                      parameters.x_bitmap_sync_threads,
+                      DEFAULT_MIGRATE_BITMAP_SYNC_THREADS),
+    DEFINE_PROP_UINT16("x-postcopy-prefetch-pages", MigrationState,
+                       parameters.x_postcopy_prefetch_pages,
+                       DEFAULT_MIGRATE_POSTCOPY_PREFETCH_PAGES),
+    DEFINE_PROP_UINT8("x-load-threads", MigrationState,
+                      parameters.x_load_threads,
+                      DEFAULT_MIGRATE_LOAD_THREADS),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -2490,6 +2775,9 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_X_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-background-snapshot",
+                        MIGRATION_CAPABILITY_X_BACKGROUND_SNAPSHOT),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram", MIGRATION_CAPABILITY_X_MAPPED_RAM),
 
     DEFINE_PROP_END_OF_LIST(),
 };
@@ -2526,6 +2814,8 @@ static void migration_instance_init(Object *obj)
     params->tls_hostname = g_strdup("");
     params->tls_creds = g_strdup("");
 
+    params->x_multifd_compression = MULTIFD_COMPRESSION_NONE;
+
     /* Set has_* up only for parameter checks */
     params->has_compress_level = true;
     params->has_compress_threads = true;
@@ -2539,6 +2829,12 @@ static void migration_instance_init(Object *obj)
     params->has_x_multifd_channels = true;
     params->has_x_multifd_page_count = true;
     params->has_xbzrle_cache_size = true;
+    params->has_x_multifd_compression = true;
+    params->has_x_multifd_zlib_level = true;
+    params->has_x_multifd_zstd_level = true;
+    params->has_x_bitmap_sync_threads = true;
+    params->has_x_postcopy_prefetch_pages = true;
+    params->has_x_load_threads = true;
 }
 
 /*
@@ -201,6 +201,8 @@ MigrationState *migrate_get_current(void);
 bool migrate_postcopy(void);
 
 bool migrate_release_ram(void);
+bool migrate_background_snapshot(void);
+bool migrate_mapped_ram(void);
 bool migrate_postcopy_ram(void);
 bool migrate_zero_blocks(void);
 
@@ -209,6 +211,12 @@ bool migrate_use_multifd(void);
 bool migrate_pause_before_switchover(void);
 int migrate_multifd_channels(void);
 int migrate_multifd_page_count(void);
+MultiFDCompression migrate_multifd_compression(void);
+int migrate_multifd_zlib_level(void);
+int migrate_multifd_zstd_level(void);
+int migrate_bitmap_sync_threads(void);
+int migrate_postcopy_prefetch_pages(void);
+int migrate_load_threads(void);
 
 int migrate_use_xbzrle(void);
 int64_t migrate_xbzrle_cache_size(void);
@@ -0,0 +1,180 @@
+/*
+ * Multifd common code
+ *
+ * Copyright (c) 2017-2018 Red Hat Inc
+ *
+ * Authors:
+ *  Juan Quintela <quintela@redhat.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_MULTIFD_H
+#define QEMU_MIGRATION_MULTIFD_H
+
+#include "qemu/thread.h"
+#include "exec/cpu-common.h"
+#include "io/channel.h"
+
+#define MULTIFD_MAGIC 0x11223344U
+#define MULTIFD_VERSION 2
+
+#define MULTIFD_FLAG_SYNC (1 << 0)
+
+/* We reserve 4 bits for the compression method, it holds the value of
+ * MultiFDCompression shifted by MULTIFD_FLAG_COMPRESSION_SHIFT */
+#define MULTIFD_FLAG_COMPRESSION_SHIFT 1
+#define MULTIFD_FLAG_COMPRESSION_MASK (0xf << MULTIFD_FLAG_COMPRESSION_SHIFT)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    unsigned char uuid[16]; /* QemuUUID */
+    uint8_t id;
+} __attribute__((packed)) MultiFDInit_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    /* maximum number of allocated pages */
+    uint32_t size;
+    /* number of pages used in this packet */
+    uint32_t used;
+    /* number of them that are not zero, the first ones in offset[] */
+    uint32_t normal_pages;
+    /* size of the data that follows the packet, after compression */
+    uint32_t next_packet_size;
+    uint64_t packet_num;
+    char ramblock[256];
+    uint64_t offset[];
+} __attribute__((packed)) MultiFDPacket_t;
+
+typedef struct {
+    /* number of used pages */
+    uint32_t used;
+    /* number of allocated pages */
+    uint32_t allocated;
+    /* global number of generated multifd packets */
+    uint64_t packet_num;
+    /* offset of each page */
+    ram_addr_t *offset;
+    /* pointer to each page */
+    struct iovec *iov;
+    RAMBlock *block;
+} MultiFDPages_t;
+
+struct MultiFDSendParams {
+    /* this fields are not changed once the thread is created */
+    /* channel number */
+    uint8_t id;
+    /* channel thread name */
+    char *name;
+    /* channel thread id */
+    QemuThread thread;
+    /* communication channel */
+    QIOChannel *c;
+    /* sem where to wait for more work */
+    QemuSemaphore sem;
+    /* this mutex protects the following parameters */
+    QemuMutex mutex;
+    /* is this channel thread running */
+    bool running;
+    /* should this thread finish */
+    bool quit;
+    /* thread has work to do */
+    int pending_job;
+    /* array of pages to sent */
+    MultiFDPages_t *pages;
+    /* packet allocated len */
+    uint32_t packet_len;
+    /* pointer to the packet */
+    MultiFDPacket_t *packet;
+    /* multifd flags for each packet */
+    uint32_t flags;
+    /* global number of generated multifd packets */
+    uint64_t packet_num;
+    /* bytes written since the migration thread last accounted them */
+    uint64_t sent_bytes;
+    /* zero pages found since the migration thread last accounted them */
+    uint64_t zero_pages;
+    /* thread local variables */
+    /* number of pages of the packet that are not zero */
+    uint32_t normal_pages;
+    /* size of the next packet that contains pages */
+    uint32_t next_packet_size;
+    /* packets sent through this channel */
+    uint64_t num_packets;
+    /* pages sent through this channel */
+    uint64_t num_pages;
+    /* used by the compression methods */
+    void *data;
+};
+typedef struct MultiFDSendParams MultiFDSendParams;
+
+struct MultiFDRecvParams {
+    /* this fields are not changed once the thread is created */
+    /* channel number */
+    uint8_t id;
+    /* channel thread name */
+    char *name;
+    /* channel thread id */
+    QemuThread thread;
+    /* communication channel */
+    QIOChannel *c;
+    /* this mutex protects the following parameters */
+    QemuMutex mutex;
+    /* is this channel thread running */
+    bool running;
+    /* array of pages to receive */
+    MultiFDPages_t *pages;
+    /* packet allocated len */
+    uint32_t packet_len;
+    /* pointer to the packet */
+    MultiFDPacket_t *packet;
+    /* multifd flags for each packet */
+    uint32_t flags;
+    /* global number of generated multifd packets */
+    uint64_t packet_num;
+    /* thread local variables */
+    /* number of pages of the packet that are not zero */
+    uint32_t normal_pages;
+    /* size of the next packet that contains pages */
+    uint32_t next_packet_size;
+    /* packets received through this channel */
+    uint64_t num_packets;
+    /* pages received through this channel */
+    uint64_t num_pages;
+    /* syncs main thread and channels */
+    QemuSemaphore sem_sync;
+    /* used by the compression methods */
+    void *data;
+};
+typedef struct MultiFDRecvParams MultiFDRecvParams;
+
+typedef struct {
+    /* Setup for sending side */
+    int (*send_setup)(MultiFDSendParams *p, Error **errp);
+    /* Cleanup for sending side */
+    void (*send_cleanup)(MultiFDSendParams *p);
+    /* Prepare the pages of the packet, sets p->next_packet_size.
+     * Zero pages are not passed to the methods, @used only counts
+     * the normal pages, which are the first ones in p->pages */
+    int (*send_prepare)(MultiFDSendParams *p, uint32_t used, Error **errp);
+    /* Write the pages of the packet to the channel */
+    int (*send_write)(MultiFDSendParams *p, uint32_t used, Error **errp);
+    /* Setup for receiving side */
+    int (*recv_setup)(MultiFDRecvParams *p, Error **errp);
+    /* Cleanup for receiving side */
+    void (*recv_cleanup)(MultiFDRecvParams *p);
+    /* Read all the pages of the packet into place */
+    int (*recv_pages)(MultiFDRecvParams *p, uint32_t used, Error **errp);
+} MultiFDMethods;
+
+extern MultiFDMethods multifd_zlib_ops;
+#ifdef CONFIG_ZSTD
+extern MultiFDMethods multifd_zstd_ops;
+#endif
+
+#endif
@@ -18,6 +18,9 @@
 #include "qapi/error.h"
 #include "qemu-common.h"
 #include "qemu/host-utils.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include "qemu/rcu.h"
 #include "migration/page_cache.h"
 
 #ifdef DEBUG_CACHE
@@ -28,27 +31,40 @@
     do { } while (0)
 #endif
 
-/* the page in cache will not be replaced in two cycles */
-#define CACHED_PAGE_LIFETIME 2
+/* number of pages that can be cached for addresses hashing to one set */
+#define PAGE_CACHE_WAYS 8
 
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
     uint64_t it_addr;
-    uint64_t it_age;
     uint8_t *it_data;
+    /* CLOCK reference bit, set on every hit and insert */
+    bool it_ref;
 };
 
 struct PageCache {
+    /* must be first, see cache_fini_rcu() */
+    struct rcu_head rcu;
+    /* num_sets sets of ways items each, one set after the other */
     CacheItem *page_cache;
+    /* next way of each set that CLOCK will look at */
+    uint8_t *clock_hand;
+    /* set i is protected by shard_lock[i & (num_shards - 1)] */
+    QemuMutex *shard_lock;
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    size_t ways;
+    size_t num_sets;
+    unsigned set_bits;
+    size_t num_shards;
 };
 
-PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
+PageCache *cache_init(int64_t new_size, size_t page_size, unsigned shards,
+                      Error **errp)
 {
-    int64_t i;
+    size_t i;
     size_t num_pages = new_size / page_size;
     PageCache *cache;
 
@@ -66,7 +82,7 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
     }
 
     /* We prefer not to abort if there is no memory */
-    cache = g_try_malloc(sizeof(*cache));
+    cache = g_try_malloc0(sizeof(*cache));
     if (!cache) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "cache size",
                    "Failed to allocate cache");
@@ -75,31 +91,44 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
     cache->page_size = page_size;
     cache->num_items = 0;
     cache->max_num_items = num_pages;
+    cache->ways = MIN(PAGE_CACHE_WAYS, num_pages);
+    cache->num_sets = num_pages / cache->ways;
+    cache->set_bits = ctz64(cache->num_sets);
+    cache->num_shards = pow2floor(MAX(MIN(shards, cache->num_sets), 1));
 
-    DPRINTF("Setting cache buckets to %" PRId64 "\n", cache->max_num_items);
+    DPRINTF("Setting cache buckets to %zu in %zu sets, %zu shards\n",
+            cache->max_num_items, cache->num_sets, cache->num_shards);
 
     /* We prefer not to abort if there is no memory */
     cache->page_cache = g_try_malloc((cache->max_num_items) *
                                      sizeof(*cache->page_cache));
-    if (!cache->page_cache) {
+    cache->clock_hand = g_try_malloc0(cache->num_sets);
+    if (!cache->page_cache || !cache->clock_hand) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "cache size",
                    "Failed to allocate page cache");
+        g_free(cache->page_cache);
+        g_free(cache->clock_hand);
         g_free(cache);
         return NULL;
     }
 
     for (i = 0; i < cache->max_num_items; i++) {
         cache->page_cache[i].it_data = NULL;
-        cache->page_cache[i].it_age = 0;
+        cache->page_cache[i].it_ref = false;
         cache->page_cache[i].it_addr = -1;
     }
 
+    cache->shard_lock = g_new(QemuMutex, cache->num_shards);
+    for (i = 0; i < cache->num_shards; i++) {
+        qemu_mutex_init(&cache->shard_lock[i]);
+    }
+
     return cache;
 }
 
 void cache_fini(PageCache *cache)
 {
-    int64_t i;
+    size_t i;
 
     g_assert(cache);
     g_assert(cache->page_cache);
@@ -107,65 +136,133 @@ void cache_fini(PageCache *cache)
     for (i = 0; i < cache->max_num_items; i++) {
         g_free(cache->page_cache[i].it_data);
     }
+    for (i = 0; i < cache->num_shards; i++) {
+        qemu_mutex_destroy(&cache->shard_lock[i]);
+    }
 
+    g_free(cache->shard_lock);
+    g_free(cache->clock_hand);
     g_free(cache->page_cache);
     cache->page_cache = NULL;
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
+void cache_fini_rcu(PageCache *cache)
 {
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
+    call_rcu(cache, cache_fini, rcu);
 }
 
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+static size_t cache_get_set_index(const PageCache *cache, uint64_t address)
 {
-    size_t pos;
+    uint64_t page = address / cache->page_size;
+
+    g_assert(cache->num_sets);
+    if (!cache->set_bits) {
+        return 0;
+    }
+    /* Multiplicative hashing, so that guest memory strides matching the
+     * cache size don't all land in the same set */
+    return (page * 0x9e3779b97f4a7c15ULL) >> (64 - cache->set_bits);
+}
 
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t addr)
+{
     g_assert(cache);
     g_assert(cache->page_cache);
 
-    pos = cache_get_cache_pos(cache, addr);
+    return &cache->page_cache[cache_get_set_index(cache, addr) * cache->ways];
+}
+
+static QemuMutex *cache_get_shard_lock(const PageCache *cache, uint64_t addr)
+{
+    size_t shard = cache_get_set_index(cache, addr) & (cache->num_shards - 1);
+
+    return &cache->shard_lock[shard];
+}
+
+void cache_lock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_lock(cache_get_shard_lock(cache, addr));
+}
 
-    return &cache->page_cache[pos];
+void cache_unlock(PageCache *cache, uint64_t addr)
+{
+    qemu_mutex_unlock(cache_get_shard_lock(cache, addr));
+}
+
+static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    size_t i;
+
+    for (i = 0; i < cache->ways; i++) {
+        if (set[i].it_data && set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+/* Pick the item for @addr to go into: a free way if there is one,
+ * otherwise the first way found by the CLOCK hand whose reference bit
+ * is clear, clearing the bits it passes over.  This always terminates
+ * before the hand has gone twice round the set.
+ */
+static CacheItem *cache_get_victim(PageCache *cache, uint64_t addr)
+{
+    size_t set_index = cache_get_set_index(cache, addr);
+    CacheItem *set = &cache->page_cache[set_index * cache->ways];
+    uint8_t *hand = &cache->clock_hand[set_index];
+    CacheItem *it;
+    size_t i;
+
+    for (i = 0; i < cache->ways; i++) {
+        if (!set[i].it_data) {
+            return &set[i];
+        }
+    }
+
+    for (;;) {
+        it = &set[*hand];
+        *hand = (*hand + 1) & (cache->ways - 1);
+        if (!it->it_ref) {
+            return it;
+        }
+        it->it_ref = false;
+    }
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age)
+bool cache_is_cached(const PageCache *cache, uint64_t addr)
 {
     CacheItem *it;
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
-        /* update the it_age when the cache hit */
-        it->it_age = current_age;
+    if (it) {
+        /* give the page a second chance when CLOCK goes round */
+        it->it_ref = true;
         return true;
     }
     return false;
 }
 
-int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
-                 uint64_t current_age)
+int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata)
 {
-
     CacheItem *it;
 
     /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
-
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
+    if (!it) {
+        it = cache_get_victim(cache, addr);
     }
+
     /* allocate page */
     if (!it->it_data) {
         it->it_data = g_try_malloc(cache->page_size);
@@ -173,12 +270,12 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
             DPRINTF("Error allocating page\n");
             return -1;
         }
-        cache->num_items++;
+        atomic_inc(&cache->num_items);
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
 
-    it->it_age = current_age;
+    it->it_ref = true;
     it->it_addr = addr;
 
     return 0;
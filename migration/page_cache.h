@@ -15,7 +15,14 @@
 #ifndef PAGE_CACHE_H
 #define PAGE_CACHE_H
 
-/* Page cache for storing guest pages */
+/* Page cache for storing guest pages
+ *
+ * The cache is set associative, with CLOCK replacement inside each
+ * set.  Sets are grouped in shards with a lock each; every other
+ * function below must be called with the lock for @addr taken with
+ * cache_lock(), so that different threads can use different shards
+ * at the same time.
+ */
 typedef struct PageCache PageCache;
 
 /**
@@ -26,15 +33,43 @@ typedef struct PageCache PageCache;
  *
  * @cache_size: cache size in bytes
  * @page_size: cache page size
+ * @shards: number of independently locked shards wanted, it is
+ *          rounded down to a power of two
  * @errp: set *errp if the check failed, with reason
  */
-PageCache *cache_init(int64_t cache_size, size_t page_size, Error **errp);
+PageCache *cache_init(int64_t cache_size, size_t page_size, unsigned shards,
+                      Error **errp);
 /**
  * cache_fini: free all cache resources
  * @cache pointer to the PageCache struct
  */
 void cache_fini(PageCache *cache);
 
+/**
+ * cache_fini_rcu: free all cache resources after an RCU grace period
+ *
+ * For caches that readers look up under rcu_read_lock().
+ *
+ * @cache pointer to the PageCache struct
+ */
+void cache_fini_rcu(PageCache *cache);
+
+/**
+ * cache_lock: take the lock of the shard that holds @addr
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_lock(PageCache *cache, uint64_t addr);
+
+/**
+ * cache_unlock: release the lock taken by cache_lock()
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ */
+void cache_unlock(PageCache *cache, uint64_t addr);
+
 /**
  * cache_is_cached: Checks to see if the page is cached
  *
@@ -42,10 +77,8 @@ void cache_fini(PageCache *cache);
  *
  * @cache pointer to the PageCache struct
  * @addr: page addr
- * @current_age: current bitmap generation
  */
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age);
+bool cache_is_cached(const PageCache *cache, uint64_t addr);
 
 /**
  * get_cached_data: Get the data cached for an addr
@@ -59,16 +92,15 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
 
 /**
  * cache_insert: insert the page into the cache. the page cache
- * will dup the data on insert. the previous value will be overwritten
+ * will dup the data on insert. the previous value will be overwritten,
+ * and if the set is full another page of the set is evicted
  *
  * Returns -1 when the page isn't inserted into cache
  *
  * @cache pointer to the PageCache struct
  * @addr: page address
  * @pdata: pointer to the page
- * @current_age: current bitmap generation
  */
-int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
-                 uint64_t current_age);
+int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata);
 
 #endif
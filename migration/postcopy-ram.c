@@ -494,6 +494,124 @@ static int ram_block_enable_notify(const char *block_name, void *host_addr,
     return 0;
 }
 
+/* Faults further apart than this many host pages are not a stride */
+#define POSTCOPY_PREFETCH_MAX_STRIDE 64
+
+/*
+ * Guests often touch memory in sequential or strided scans, and each
+ * fault costs a round trip to the source.  Once two faults in a row are
+ * the same distance apart, the next pages along that stride are asked
+ * for too, and the window doubles (up to x-postcopy-prefetch-pages)
+ * every time the guest keeps going the same way.
+ */
+typedef struct PostcopyFaultPredictor {
+    RAMBlock *rb;
+    /* offset of the last fault */
+    ram_addr_t last_offset;
+    /* distance between the last two faults, in bytes, 0 if none */
+    int64_t stride;
+    /* first page along the stride that hasn't been requested */
+    int64_t next_offset;
+    /* number of pages requested ahead of the fault */
+    uint32_t window;
+} PostcopyFaultPredictor;
+
+static void postcopy_request_pages(MigrationIncomingState *mis,
+                                   RAMBlock *rb, RAMBlock **last_rb,
+                                   ram_addr_t start, size_t len)
+{
+    if (rb != *last_rb) {
+        *last_rb = rb;
+        migrate_send_rp_req_pages(mis, qemu_ram_get_idstr(rb), start, len);
+    } else {
+        /* Save some space */
+        migrate_send_rp_req_pages(mis, NULL, start, len);
+    }
+}
+
+/* Is the fault at @offset one we were expecting, along the stride? */
+static bool postcopy_fault_predicted(PostcopyFaultPredictor *pred,
+                                     RAMBlock *rb, ram_addr_t offset)
+{
+    int64_t delta = (int64_t)offset - (int64_t)pred->last_offset;
+    int64_t ahead = pred->next_offset - (int64_t)pred->last_offset;
+
+    if (rb != pred->rb || !pred->stride || delta % pred->stride) {
+        return false;
+    }
+    return delta / pred->stride > 0 &&
+           delta / pred->stride <= ahead / pred->stride;
+}
+
+/**
+ * postcopy_request_fault: ask the source for a faulting page
+ *
+ * Also asks for the pages that the predictor expects to be touched
+ * next.  When they follow the faulting page they are sent in the same
+ * request; the source serves the rest of a request after all pending
+ * faults.
+ *
+ * @mis: incoming state
+ * @pred: fault predictor of the fault thread
+ * @last_rb: last RAMBlock we sent a request for
+ * @rb: RAMBlock of the fault
+ * @offset: offset of the faulting host page in @rb
+ */
+static void postcopy_request_fault(MigrationIncomingState *mis,
+                                   PostcopyFaultPredictor *pred,
+                                   RAMBlock **last_rb, RAMBlock *rb,
+                                   ram_addr_t offset)
+{
+    uint8_t *host = qemu_ram_get_host_addr(rb);
+    size_t pagesize = qemu_ram_pagesize(rb);
+    int64_t used_length = qemu_ram_get_used_length(rb);
+    int64_t delta, run_start = offset, run_len = pagesize, t;
+    uint32_t i;
+
+    if (postcopy_fault_predicted(pred, rb, offset)) {
+        pred->window = MIN(MAX(pred->window * 2, 1),
+                           migrate_postcopy_prefetch_pages());
+    } else {
+        delta = rb == pred->rb ?
+                (int64_t)offset - (int64_t)pred->last_offset : 0;
+        if (ABS(delta) > POSTCOPY_PREFETCH_MAX_STRIDE * pagesize) {
+            delta = 0;
+        }
+        pred->rb = rb;
+        pred->stride = delta;
+        pred->next_offset = offset + delta;
+        pred->window = 0;
+    }
+    pred->last_offset = offset;
+
+    for (i = 1; i <= pred->window; i++) {
+        t = offset + i * pred->stride;
+        if (t < 0 || t + pagesize > used_length) {
+            break;
+        }
+        /* Already on its way or already here */
+        if ((pred->stride > 0 && t < pred->next_offset) ||
+            (pred->stride < 0 && t > pred->next_offset) ||
+            ramblock_recv_bitmap_test(rb, host + t)) {
+            continue;
+        }
+        if (t == run_start + run_len) {
+            run_len += pagesize;
+            continue;
+        }
+        postcopy_request_pages(mis, rb, last_rb, run_start, run_len);
+        run_start = t;
+        run_len = pagesize;
+    }
+    postcopy_request_pages(mis, rb, last_rb, run_start, run_len);
+
+    if (pred->window) {
+        pred->next_offset = offset + (pred->window + 1) * pred->stride;
+        trace_postcopy_ram_fault_prefetch(qemu_ram_get_idstr(rb), offset,
+                                          pred->stride, pred->window);
+    }
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
@@ -504,6 +622,7 @@ static void *postcopy_ram_fault_thread(void *opaque)
     int ret;
     RAMBlock *rb = NULL;
     RAMBlock *last_rb = NULL; /* last RAMBlock we sent part of */
+    PostcopyFaultPredictor pred = { 0 };
 
     trace_postcopy_ram_fault_thread_entry();
     qemu_sem_post(&mis->fault_thread_sem);
@@ -577,15 +696,7 @@ static void *postcopy_ram_fault_thread(void *opaque)
          * Send the request to the source - we want to request one
          * of our host page sizes (which is >= TPS)
          */
-        if (rb != last_rb) {
-            last_rb = rb;
-            migrate_send_rp_req_pages(mis, qemu_ram_get_idstr(rb),
-                                     rb_offset, qemu_ram_pagesize(rb));
-        } else {
-            /* Save some space */
-            migrate_send_rp_req_pages(mis, NULL,
-                                     rb_offset, qemu_ram_pagesize(rb));
-        }
+        postcopy_request_fault(mis, &pred, &last_rb, rb, rb_offset);
     }
     trace_postcopy_ram_fault_thread_exit();
     return NULL;
@@ -27,6 +27,7 @@
 #include "exec/cpu-common.h"
 #include "qemu-file.h"
 #include "io/channel-socket.h"
+#include "io/channel-file.h"
 #include "qemu/iov.h"
 
 
@@ -151,12 +152,23 @@ static QEMUFile *channel_get_output_return_path(void *opaque)
     return qemu_fopen_channel_input(ioc);
 }
 
+static int channel_get_fd(void *opaque)
+{
+    QIOChannel *ioc = QIO_CHANNEL(opaque);
+
+    if (object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        return QIO_CHANNEL_FILE(ioc)->fd;
+    }
+    return -1;
+}
+
 static const QEMUFileOps channel_input_ops = {
     .get_buffer = channel_get_buffer,
     .close = channel_close,
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_input_return_path,
+    .get_fd = channel_get_fd,
 };
 
 
@@ -166,6 +178,7 @@ static const QEMUFileOps channel_output_ops = {
     .shut_down = channel_shutdown,
     .set_blocking = channel_set_blocking,
     .get_return_path = channel_get_output_return_path,
+    .get_fd = channel_get_fd,
 };
 
 
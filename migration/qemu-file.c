@@ -31,7 +31,12 @@
 #include "trace.h"
 
 #define IO_BUF_SIZE 32768
-#define MAX_IOV_SIZE MIN(IOV_MAX, 64)
+/*
+ * A RAM page sent with qemu_put_buffer_async() takes two iovecs, one for
+ * the header in buf and one for the page itself, so this is how many
+ * pages go out with one writev().
+ */
+#define MAX_IOV_SIZE MIN(IOV_MAX, 256)
 
 struct QEMUFile {
     const QEMUFileOps *ops;
@@ -586,6 +591,65 @@ int64_t qemu_ftell(QEMUFile *f)
     return f->pos;
 }
 
+int qemu_get_fd(QEMUFile *f)
+{
+    if (f->ops->get_fd) {
+        return f->ops->get_fd(f->opaque);
+    }
+    return -1;
+}
+
+/*
+ * Return the offset in the underlying file that the next byte is read
+ * from or written to, or -1 if the QEMUFile is not backed by a file.
+ * Unlike qemu_ftell() this is a real file offset, so it can be used
+ * for layouts that mix the stream with data at fixed offsets.
+ */
+off_t qemu_file_offset(QEMUFile *f)
+{
+    int fd = qemu_get_fd(f);
+    off_t pos;
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    }
+    pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0) {
+        return -1;
+    }
+    return qemu_file_is_writable(f) ? pos : pos - (f->buf_size - f->buf_index);
+}
+
+/*
+ * Continue the stream at offset @pos of the underlying file, dropping
+ * whatever was read ahead.  Returns 0 or a negative errno.
+ */
+int qemu_file_seek(QEMUFile *f, off_t pos)
+{
+    int fd = qemu_get_fd(f);
+
+    if (fd < 0) {
+        qemu_file_set_error(f, -EINVAL);
+        return -EINVAL;
+    }
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+    if (lseek(fd, pos, SEEK_SET) < 0) {
+        int ret = -errno;
+
+        qemu_file_set_error(f, ret);
+        return ret;
+    }
+    return qemu_file_get_error(f);
+}
+
 int qemu_file_rate_limit(QEMUFile *f)
 {
     if (qemu_file_get_error(f)) {
@@ -104,6 +104,7 @@ typedef struct QEMUFileOps {
     QEMUFileWritevBufferFunc *writev_buffer;
     QEMURetPathFunc *get_return_path;
     QEMUFileShutdownFunc *shut_down;
+    QEMUFileGetFD *get_fd;
 } QEMUFileOps;
 
 typedef struct QEMUFileHooks {
@@ -119,6 +120,8 @@ int qemu_get_fd(QEMUFile *f);
 int qemu_fclose(QEMUFile *f);
 int64_t qemu_ftell(QEMUFile *f);
 int64_t qemu_ftell_fast(QEMUFile *f);
+off_t qemu_file_offset(QEMUFile *f);
+int qemu_file_seek(QEMUFile *f, off_t pos);
 /*
  * put_buffer without copying the buffer.
  * The buffer should be available till it is sent asynchronously.
@@ -49,6 +49,12 @@
 #include "qemu/rcu_queue.h"
 #include "migration/colo.h"
 #include "migration/block.h"
+#include "sysemu/sysemu.h"
+#include "sysemu/balloon.h"
+#include "qemu/uuid.h"
+#include "io/channel.h"
+#include "socket.h"
+#include "multifd.h"
 
 /***********************************************************/
 /* ram save/restore */
@@ -68,6 +74,12 @@
 #define RAM_SAVE_FLAG_XBZRLE   0x40
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
+/* All pages queued on the multifd channels before this point must be
+ * in place before going on with the main stream */
+#define RAM_SAVE_FLAG_MULTIFD_SYNC     0x200
+
+/* Alignment of the page area of each RAMBlock in an x-mapped-ram file */
+#define MAPPED_RAM_ALIGN               0x100000
 
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
@@ -83,7 +95,7 @@ static struct {
     uint8_t *encoded_buf;
     /* buffer for storing page content */
     uint8_t *current_buf;
-    /* Cache for XBZRLE, Protected by lock. */
+    /* Cache for XBZRLE, read under RCU, replaced under lock. */
     PageCache *cache;
     QemuMutex lock;
     /* it will store a page full of zeros */
@@ -104,13 +116,64 @@ static void XBZRLE_cache_unlock(void)
         qemu_mutex_unlock(&XBZRLE.lock);
 }
 
+/**
+ * XBZRLE_cache_get: get the XBZRLE cache and lock the page in it
+ *
+ * The sender never takes XBZRLE.lock, it only locks the cache shard
+ * that holds @addr, so xbzrle_cache_resize() doesn't stall it.
+ * Must be called with rcu_read_lock() held, which keeps the cache
+ * alive until XBZRLE_cache_put() even if it is replaced meanwhile.
+ *
+ * Returns the cache, or NULL if XBZRLE is not in use
+ *
+ * @addr: address of the page that is going to be used
+ */
+static PageCache *XBZRLE_cache_get(ram_addr_t addr)
+{
+    PageCache *cache;
+
+    if (!migrate_use_xbzrle()) {
+        return NULL;
+    }
+    cache = atomic_rcu_read(&XBZRLE.cache);
+    if (cache) {
+        cache_lock(cache, addr);
+    }
+    return cache;
+}
+
+/**
+ * XBZRLE_cache_put: release the page locked by XBZRLE_cache_get()
+ *
+ * @cache: the cache returned by XBZRLE_cache_get()
+ * @addr: address of the page
+ */
+static void XBZRLE_cache_put(PageCache *cache, ram_addr_t addr)
+{
+    if (cache) {
+        cache_unlock(cache, addr);
+    }
+}
+
+/**
+ * xbzrle_cache_shards: number of shards wanted for the XBZRLE cache
+ *
+ * One per multifd channel, so that every channel can have its own.
+ */
+static unsigned xbzrle_cache_shards(void)
+{
+    return migrate_use_multifd() ? migrate_multifd_channels() : 1;
+}
+
 /**
  * xbzrle_cache_resize: resize the xbzrle cache
  *
  * This function is called from qmp_migrate_set_cache_size in main
  * thread, possibly while a migration is in progress.  A running
  * migration may be using the cache and might finish during this call,
- * hence changes to the cache are protected by XBZRLE.lock().
+ * hence replacing the cache is protected by XBZRLE.lock().  The
+ * sender looks the cache up under RCU, so the old one is only freed
+ * once it can't be using it anymore.
  *
  * Returns 0 for success or -1 for error
  *
@@ -119,7 +182,7 @@ static void XBZRLE_cache_unlock(void)
  */
 int xbzrle_cache_resize(int64_t new_size, Error **errp)
 {
-    PageCache *new_cache;
+    PageCache *new_cache, *old_cache;
     int64_t ret = 0;
 
     /* Check for truncation */
@@ -137,14 +200,16 @@ int xbzrle_cache_resize(int64_t new_size, Error **errp)
     XBZRLE_cache_lock();
 
     if (XBZRLE.cache != NULL) {
-        new_cache = cache_init(new_size, TARGET_PAGE_SIZE, errp);
+        new_cache = cache_init(new_size, TARGET_PAGE_SIZE,
+                               xbzrle_cache_shards(), errp);
         if (!new_cache) {
             ret = -1;
             goto out;
         }
 
-        cache_fini(XBZRLE.cache);
-        XBZRLE.cache = new_cache;
+        old_cache = XBZRLE.cache;
+        atomic_rcu_set(&XBZRLE.cache, new_cache);
+        cache_fini_rcu(old_cache);
     }
 out:
     XBZRLE_cache_unlock();
@@ -196,6 +261,8 @@ struct RAMSrcPageRequest {
 struct RAMState {
     /* QEMUFile used for this migration */
     QEMUFile *f;
+    /* file descriptor behind f that x-mapped-ram writes pages to */
+    int mapped_fd;
     /* Last block that we have visited searching for dirty pages */
     RAMBlock *last_seen_block;
     /* Last block from where we have sent data */
@@ -206,6 +273,9 @@ struct RAMState {
     uint32_t last_version;
     /* We are in the first round */
     bool ram_bulk_stage;
+    /* The guest has reported free pages, so even the first round must
+     * look at the dirty bitmap */
+    bool fpo_enabled;
     /* How many times we have dirty too many pages */
     int dirty_rate_high_cnt;
     /* these variables are used for bitmap sync */
@@ -215,6 +285,8 @@ struct RAMState {
     uint64_t bytes_xfer_prev;
     /* number of dirty pages since start_time */
     uint64_t num_dirty_pages_period;
+    /* rolling average of the dirty pages rate, in pages per second */
+    uint64_t dirty_pages_rate_avg;
     /* xbzrle misses since the beginning of the period */
     uint64_t xbzrle_cache_miss_prev;
     /* number of iterations at the beginning of period */
@@ -223,6 +295,8 @@ struct RAMState {
     uint64_t iterations;
     /* number of dirty bits in the bitmap */
     uint64_t migration_dirty_pages;
+    /* a bitmap sync happened since the last multifd sync point */
+    bool multifd_sync_needed;
     /* protects modification of the bitmap */
     QemuMutex bitmap_mutex;
     /* The RAMBlock used in the last src_page_requests */
@@ -230,11 +304,33 @@ struct RAMState {
     /* Queue of outstanding page requests from the destination */
     QemuMutex src_page_req_mutex;
     QSIMPLEQ_HEAD(src_page_requests, RAMSrcPageRequest) src_page_requests;
+    /* Pages the destination asked for ahead of a fault, only served
+     * once src_page_requests is empty; protected by src_page_req_mutex */
+    QSIMPLEQ_HEAD(src_prefetch_requests, RAMSrcPageRequest)
+        src_prefetch_requests;
 };
 typedef struct RAMState RAMState;
 
 static RAMState *ram_state;
 
+static NotifierList precopy_notifier_list =
+    NOTIFIER_LIST_INITIALIZER(precopy_notifier_list);
+
+void precopy_add_notifier(Notifier *n)
+{
+    notifier_list_add(&precopy_notifier_list, n);
+}
+
+void precopy_remove_notifier(Notifier *n)
+{
+    notifier_remove(n);
+}
+
+static void precopy_notify(PrecopyNotifyReason reason)
+{
+    notifier_list_notify(&precopy_notifier_list, &reason);
+}
+
 uint64_t ram_bytes_remaining(void)
 {
     return ram_state ? (ram_state->migration_dirty_pages * TARGET_PAGE_SIZE) :
@@ -262,6 +358,8 @@ struct CompressParam {
     QemuCond cond;
     RAMBlock *block;
     ram_addr_t offset;
+    /* the page in file is a zero page, protected by comp_done_lock */
+    bool zero_page;
 };
 typedef struct CompressParam CompressParam;
 
@@ -292,14 +390,15 @@ static QemuThread *decompress_threads;
 static QemuMutex decomp_done_lock;
 static QemuCond decomp_done_cond;
 
-static int do_compress_ram_page(QEMUFile *f, RAMBlock *block,
-                                ram_addr_t offset);
+static bool do_compress_ram_page(QEMUFile *f, RAMBlock *block,
+                                 ram_addr_t offset);
 
 static void *do_data_compress(void *opaque)
 {
     CompressParam *param = opaque;
     RAMBlock *block;
     ram_addr_t offset;
+    bool zero_page;
 
     qemu_mutex_lock(&param->mutex);
     while (!param->quit) {
@@ -309,9 +408,10 @@ static void *do_data_compress(void *opaque)
             param->block = NULL;
             qemu_mutex_unlock(&param->mutex);
 
-            do_compress_ram_page(param->file, block, offset);
+            zero_page = do_compress_ram_page(param->file, block, offset);
 
             qemu_mutex_lock(&comp_done_lock);
+            param->zero_page = zero_page;
             param->done = true;
             qemu_cond_signal(&comp_done_cond);
             qemu_mutex_unlock(&comp_done_lock);
@@ -392,33 +492,459 @@ static void compress_threads_save_setup(void)
 
 /* Multiple fd's */
 
-struct MultiFDSendParams {
-    uint8_t id;
-    char *name;
-    QemuThread thread;
-    QemuSemaphore sem;
-    QemuMutex mutex;
-    bool quit;
+static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDInit_t msg;
+    int ret;
+
+    msg.magic = cpu_to_be32(MULTIFD_MAGIC);
+    msg.version = cpu_to_be32(MULTIFD_VERSION);
+    msg.id = p->id;
+    memcpy(msg.uuid, &qemu_uuid.data, sizeof(msg.uuid));
+
+    ret = qio_channel_write_all(p->c, (char *)&msg, sizeof(msg), errp);
+    if (ret != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int multifd_recv_initial_packet(QIOChannel *c, Error **errp)
+{
+    MultiFDInit_t msg;
+    int ret;
+
+    ret = qio_channel_read_all(c, (char *)&msg, sizeof(msg), errp);
+    if (ret != 0) {
+        return -1;
+    }
+
+    be32_to_cpus(&msg.magic);
+    be32_to_cpus(&msg.version);
+
+    if (msg.magic != MULTIFD_MAGIC) {
+        error_setg(errp, "multifd: received packet magic %x "
+                   "expected %x", msg.magic, MULTIFD_MAGIC);
+        return -1;
+    }
+
+    if (msg.version != MULTIFD_VERSION) {
+        error_setg(errp, "multifd: received packet version %d "
+                   "expected %d", msg.version, MULTIFD_VERSION);
+        return -1;
+    }
+
+    if (memcmp(msg.uuid, &qemu_uuid, sizeof(qemu_uuid))) {
+        char *uuid = qemu_uuid_unparse_strdup(&qemu_uuid);
+        char *msg_uuid = qemu_uuid_unparse_strdup((const QemuUUID *)msg.uuid);
+
+        error_setg(errp, "multifd: received uuid '%s' and expected "
+                   "uuid '%s' for channel %hhd", msg_uuid, uuid, msg.id);
+        g_free(uuid);
+        g_free(msg_uuid);
+        return -1;
+    }
+
+    if (msg.id >= migrate_multifd_channels()) {
+        error_setg(errp, "multifd: received channel id %d is greater than "
+                   "number of channels %d", msg.id, migrate_multifd_channels());
+        return -1;
+    }
+
+    return msg.id;
+}
+
+static MultiFDPages_t *multifd_pages_init(size_t size)
+{
+    MultiFDPages_t *pages = g_new0(MultiFDPages_t, 1);
+
+    pages->allocated = size;
+    pages->iov = g_new0(struct iovec, size);
+    pages->offset = g_new0(ram_addr_t, size);
+
+    return pages;
+}
+
+static void multifd_pages_clear(MultiFDPages_t *pages)
+{
+    pages->used = 0;
+    pages->allocated = 0;
+    pages->packet_num = 0;
+    pages->block = NULL;
+    g_free(pages->iov);
+    pages->iov = NULL;
+    g_free(pages->offset);
+    pages->offset = NULL;
+    g_free(pages);
+}
+
+/**
+ * multifd_account_sent: move the counters of a channel to ram_counters
+ *
+ * The pages were counted as normal when they were queued, the channel
+ * is the one that finds out which of them were zero pages.
+ *
+ * Called with p->mutex held
+ *
+ * @p: channel
+ */
+static void multifd_account_sent(MultiFDSendParams *p)
+{
+    ram_counters.transferred += p->sent_bytes;
+    p->sent_bytes = 0;
+    ram_counters.normal -= p->zero_pages;
+    ram_counters.duplicate += p->zero_pages;
+    p->zero_pages = 0;
+}
+
+/**
+ * multifd_send_zero_pages: move the zero pages to the end of the packet
+ *
+ * Zero pages are only sent as their offset, at the end of the offset
+ * array, so they don't reach the compression methods and cost nothing
+ * in the stream besides the packet that is sent anyway.
+ *
+ * Returns the number of pages that are not zero
+ *
+ * @p: channel, the pages are owned by its thread
+ * @used: number of pages in the packet
+ */
+static uint32_t multifd_send_zero_pages(MultiFDSendParams *p, uint32_t used)
+{
+    MultiFDPages_t *pages = p->pages;
+    uint32_t normal = 0, i;
+
+    for (i = 0; i < used; i++) {
+        if (buffer_is_zero(pages->iov[i].iov_base, TARGET_PAGE_SIZE)) {
+            continue;
+        }
+        if (i != normal) {
+            struct iovec iov = pages->iov[normal];
+            ram_addr_t offset = pages->offset[normal];
+
+            pages->iov[normal] = pages->iov[i];
+            pages->offset[normal] = pages->offset[i];
+            pages->iov[i] = iov;
+            pages->offset[i] = offset;
+        }
+        normal++;
+    }
+
+    return normal;
+}
+
+static void multifd_send_fill_packet(MultiFDSendParams *p, uint32_t used,
+                                     uint32_t flags, uint64_t packet_num)
+{
+    MultiFDPacket_t *packet = p->packet;
+    int i;
+
+    packet->magic = cpu_to_be32(MULTIFD_MAGIC);
+    packet->version = cpu_to_be32(MULTIFD_VERSION);
+    packet->flags = cpu_to_be32(flags);
+    packet->size = cpu_to_be32(migrate_multifd_page_count());
+    packet->used = cpu_to_be32(used);
+    packet->normal_pages = cpu_to_be32(p->normal_pages);
+    packet->next_packet_size = cpu_to_be32(p->next_packet_size);
+    packet->packet_num = cpu_to_be64(packet_num);
+
+    if (p->pages->block) {
+        strncpy(packet->ramblock, p->pages->block->idstr, 256);
+    }
+
+    for (i = 0; i < used; i++) {
+        packet->offset[i] = cpu_to_be64(p->pages->offset[i]);
+    }
+}
+
+static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDPacket_t *packet = p->packet;
+    RAMBlock *block = NULL;
+    int i;
+
+    be32_to_cpus(&packet->magic);
+    if (packet->magic != MULTIFD_MAGIC) {
+        error_setg(errp, "multifd: received packet "
+                   "magic %x and expected magic %x",
+                   packet->magic, MULTIFD_MAGIC);
+        return -1;
+    }
+
+    be32_to_cpus(&packet->version);
+    if (packet->version != MULTIFD_VERSION) {
+        error_setg(errp, "multifd: received packet "
+                   "version %d and expected version %d",
+                   packet->version, MULTIFD_VERSION);
+        return -1;
+    }
+
+    p->flags = be32_to_cpu(packet->flags);
+
+    be32_to_cpus(&packet->size);
+    if (packet->size > migrate_multifd_page_count()) {
+        error_setg(errp, "multifd: received packet "
+                   "with size %d and expected maximum size %d",
+                   packet->size, migrate_multifd_page_count());
+        return -1;
+    }
+
+    p->pages->used = be32_to_cpu(packet->used);
+    if (p->pages->used > packet->size) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d pages and expected maximum pages are %d",
+                   p->pages->used, packet->size);
+        return -1;
+    }
+
+    p->normal_pages = be32_to_cpu(packet->normal_pages);
+    if (p->normal_pages > p->pages->used) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d normal pages and only %d pages",
+                   p->normal_pages, p->pages->used);
+        return -1;
+    }
+
+    p->next_packet_size = be32_to_cpu(packet->next_packet_size);
+    p->packet_num = be64_to_cpu(packet->packet_num);
+
+    if (p->pages->used) {
+        uint32_t method = (p->flags & MULTIFD_FLAG_COMPRESSION_MASK) >>
+                          MULTIFD_FLAG_COMPRESSION_SHIFT;
+
+        if (method != migrate_multifd_compression()) {
+            error_setg(errp, "multifd: received packet compressed with "
+                       "method %d and expected method %d",
+                       method, migrate_multifd_compression());
+            return -1;
+        }
+
+        /* make sure that ramblock is 0 terminated */
+        packet->ramblock[255] = 0;
+        block = qemu_ram_block_by_name(packet->ramblock);
+        if (!block) {
+            error_setg(errp, "multifd: unknown ram block %s",
+                       packet->ramblock);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < p->pages->used; i++) {
+        ram_addr_t offset = be64_to_cpu(packet->offset[i]);
+
+        if (offset > (block->used_length - TARGET_PAGE_SIZE)) {
+            error_setg(errp, "multifd: offset too long " RAM_ADDR_FMT
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, block->max_length);
+            return -1;
+        }
+        p->pages->iov[i].iov_base = block->host + offset;
+        p->pages->iov[i].iov_len = TARGET_PAGE_SIZE;
+        ramblock_recv_bitmap_set(block, block->host + offset);
+    }
+
+    return 0;
+}
+
+/* Multifd without compression */
+
+static int nocomp_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    return 0;
+}
+
+static void nocomp_send_cleanup(MultiFDSendParams *p)
+{
+}
+
+static int nocomp_send_prepare(MultiFDSendParams *p, uint32_t used,
+                               Error **errp)
+{
+    p->next_packet_size = used * qemu_target_page_size();
+    return 0;
+}
+
+static int nocomp_send_write(MultiFDSendParams *p, uint32_t used,
+                             Error **errp)
+{
+    /* Pages go straight from guest RAM, no bounce copy */
+    return qio_channel_writev_all(p->c, p->pages->iov, used, errp);
+}
+
+static int nocomp_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    return 0;
+}
+
+static void nocomp_recv_cleanup(MultiFDRecvParams *p)
+{
+}
+
+static int nocomp_recv_pages(MultiFDRecvParams *p, uint32_t used,
+                             Error **errp)
+{
+    if (p->next_packet_size != used * qemu_target_page_size()) {
+        error_setg(errp, "multifd %d: received %u bytes for %u pages",
+                   p->id, p->next_packet_size, used);
+        return -1;
+    }
+    /* Read straight into guest RAM */
+    return qio_channel_readv_all(p->c, p->pages->iov, used, errp);
+}
+
+static MultiFDMethods multifd_nocomp_ops = {
+    .send_setup = nocomp_send_setup,
+    .send_cleanup = nocomp_send_cleanup,
+    .send_prepare = nocomp_send_prepare,
+    .send_write = nocomp_send_write,
+    .recv_setup = nocomp_recv_setup,
+    .recv_cleanup = nocomp_recv_cleanup,
+    .recv_pages = nocomp_recv_pages
+};
+
+static MultiFDMethods *multifd_ops[MULTIFD_COMPRESSION__MAX] = {
+    [MULTIFD_COMPRESSION_NONE] = &multifd_nocomp_ops,
+    [MULTIFD_COMPRESSION_ZLIB] = &multifd_zlib_ops,
+#ifdef CONFIG_ZSTD
+    [MULTIFD_COMPRESSION_ZSTD] = &multifd_zstd_ops,
+#endif
 };
-typedef struct MultiFDSendParams MultiFDSendParams;
 
 struct {
     MultiFDSendParams *params;
     /* number of created threads */
     int count;
+    /* array of pages to sent */
+    MultiFDPages_t *pages;
+    /* syncs main thread and channels */
+    QemuSemaphore sem_sync;
+    /* global number of generated multifd packets */
+    uint64_t packet_num;
+    /* send channels ready */
+    QemuSemaphore channels_ready;
+    /* set when any of the channels failed */
+    bool exiting;
+    /* MULTIFD_FLAG_COMPRESSION_* bits for packets with pages */
+    uint32_t compression_flags;
+    /* multifd ops */
+    MultiFDMethods *ops;
 } *multifd_send_state;
 
-static void terminate_multifd_send_threads(Error *errp)
+/*
+ * How we use multifd_send_state->pages and channel->pages?
+ *
+ * We create a pages for each channel, and a main one.  Each time that
+ * we need to send a batch of pages we interchange the ones between
+ * multifd_send_state and the channel that is sending it.  There are
+ * two reasons for that:
+ *    - to not have to do so many mallocs during migration
+ *    - to make easier to know what to free at the end of migration
+ *
+ * This way we always know who is the owner of each "pages" struct,
+ * and we don't need any locking.  It belongs to the migration thread
+ * or to the channel thread.  Switching is safe because the migration
+ * thread is using the channel mutex when changing it, and the channel
+ * have to had finish with its own, otherwise pending_job can't be
+ * false.
+ */
+
+static int multifd_send_pages(void)
+{
+    int i;
+    static int next_channel;
+    MultiFDSendParams *p = NULL; /* make happy gcc */
+    MultiFDPages_t *pages = multifd_send_state->pages;
+
+    qemu_sem_wait(&multifd_send_state->channels_ready);
+    for (i = next_channel;; i = (i + 1) % migrate_multifd_channels()) {
+        p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->quit || atomic_read(&multifd_send_state->exiting)) {
+            qemu_mutex_unlock(&p->mutex);
+            error_report("%s: channel %d has already quit!", __func__, i);
+            return -1;
+        }
+        if (!p->pending_job) {
+            p->pending_job++;
+            next_channel = (i + 1) % migrate_multifd_channels();
+            break;
+        }
+        qemu_mutex_unlock(&p->mutex);
+    }
+    p->pages->used = 0;
+
+    p->packet_num = multifd_send_state->packet_num++;
+    p->pages->block = NULL;
+    multifd_send_state->pages = p->pages;
+    p->pages = pages;
+    multifd_account_sent(p);
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+
+    return 1;
+}
+
+static int multifd_queue_page(RAMBlock *block, ram_addr_t offset)
+{
+    MultiFDPages_t *pages = multifd_send_state->pages;
+    bool changed = false;
+
+    if (!pages->block) {
+        pages->block = block;
+    }
+
+    if (pages->block == block) {
+        pages->offset[pages->used] = offset;
+        pages->iov[pages->used].iov_base = block->host + offset;
+        pages->iov[pages->used].iov_len = TARGET_PAGE_SIZE;
+        pages->used++;
+
+        if (pages->used < pages->allocated) {
+            return 1;
+        }
+    } else {
+        changed = true;
+    }
+
+    if (multifd_send_pages() < 0) {
+        return -1;
+    }
+
+    if (changed) {
+        return multifd_queue_page(block, offset);
+    }
+
+    return 1;
+}
+
+static void multifd_send_terminate_threads(Error *err)
 {
     int i;
 
-    for (i = 0; i < multifd_send_state->count; i++) {
+    if (err) {
+        MigrationState *s = migrate_get_current();
+        migrate_set_error(s, err);
+        if (s->state == MIGRATION_STATUS_SETUP ||
+            s->state == MIGRATION_STATUS_PRE_SWITCHOVER ||
+            s->state == MIGRATION_STATUS_DEVICE ||
+            s->state == MIGRATION_STATUS_ACTIVE) {
+            migrate_set_state(&s->state, s->state,
+                              MIGRATION_STATUS_FAILED);
+        }
+    }
+
+    atomic_set(&multifd_send_state->exiting, true);
+    for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
         qemu_mutex_lock(&p->mutex);
         p->quit = true;
         qemu_sem_post(&p->sem);
         qemu_mutex_unlock(&p->mutex);
+        /* Don't leave the migration thread waiting for this channel */
+        qemu_sem_post(&multifd_send_state->channels_ready);
+        qemu_sem_post(&multifd_send_state->sem_sync);
     }
 }
 
@@ -427,97 +953,320 @@ int multifd_save_cleanup(Error **errp)
     int i;
     int ret = 0;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || !multifd_send_state) {
         return 0;
     }
-    terminate_multifd_send_threads(NULL);
-    for (i = 0; i < multifd_send_state->count; i++) {
+    multifd_send_terminate_threads(NULL);
+    for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
-        qemu_thread_join(&p->thread);
+        if (p->running) {
+            qemu_thread_join(&p->thread);
+            p->running = false;
+        }
+        if (p->c) {
+            socket_send_channel_destroy(p->c);
+            p->c = NULL;
+        }
+        multifd_send_state->ops->send_cleanup(p);
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem);
         g_free(p->name);
         p->name = NULL;
+        multifd_pages_clear(p->pages);
+        p->pages = NULL;
+        p->packet_len = 0;
+        g_free(p->packet);
+        p->packet = NULL;
     }
+    qemu_sem_destroy(&multifd_send_state->channels_ready);
+    qemu_sem_destroy(&multifd_send_state->sem_sync);
     g_free(multifd_send_state->params);
     multifd_send_state->params = NULL;
+    multifd_pages_clear(multifd_send_state->pages);
+    multifd_send_state->pages = NULL;
     g_free(multifd_send_state);
     multifd_send_state = NULL;
     return ret;
 }
 
+/**
+ * multifd_send_sync_main: flush the pending pages and synchronize channels
+ *
+ * Sends whatever is pending in the current batch and then a packet
+ * with MULTIFD_FLAG_SYNC on every channel.  It waits until every
+ * channel has written its sync packet, so all pages queued before the
+ * call are on the wire before anything sent on the main stream after
+ * it.
+ *
+ * Returns 0 for success or -1 if any of the channels has failed
+ */
+static int multifd_send_sync_main(void)
+{
+    int i;
+
+    if (!migrate_use_multifd()) {
+        return 0;
+    }
+    if (multifd_send_state->pages->used) {
+        if (multifd_send_pages() < 0) {
+            return -1;
+        }
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        trace_multifd_send_sync_main_signal(p->id);
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->quit) {
+            qemu_mutex_unlock(&p->mutex);
+            error_report("%s: channel %d has already quit", __func__, i);
+            return -1;
+        }
+        p->packet_num = multifd_send_state->packet_num++;
+        p->flags |= MULTIFD_FLAG_SYNC;
+        p->pending_job++;
+        qemu_mutex_unlock(&p->mutex);
+        qemu_sem_post(&p->sem);
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        trace_multifd_send_sync_main_wait(p->id);
+        qemu_sem_wait(&multifd_send_state->sem_sync);
+        /* the sync packet did not take a slot from channels_ready */
+        qemu_sem_wait(&multifd_send_state->channels_ready);
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        multifd_account_sent(p);
+        qemu_mutex_unlock(&p->mutex);
+    }
+    trace_multifd_send_sync_main(multifd_send_state->packet_num);
+
+    return atomic_read(&multifd_send_state->exiting) ? -1 : 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
+    Error *local_err = NULL;
+    int ret;
+
+    trace_multifd_send_thread_start(p->id);
+
+    if (multifd_send_initial_packet(p, &local_err) < 0) {
+        goto out;
+    }
+    /* initial packet */
+    p->num_packets = 1;
+    qemu_sem_post(&multifd_send_state->channels_ready);
 
     while (true) {
+        qemu_sem_wait(&p->sem);
         qemu_mutex_lock(&p->mutex);
-        if (p->quit) {
+
+        if (p->pending_job) {
+            uint32_t used = p->pages->used;
+            uint64_t packet_num = p->packet_num;
+            uint32_t flags = p->flags;
+
+            p->flags = 0;
+            p->num_packets++;
+            p->num_pages += used;
+            qemu_mutex_unlock(&p->mutex);
+
+            /* The pages are ours until pending_job is decremented, so
+             * zero detection and compression run without holding the
+             * mutex */
+            p->next_packet_size = 0;
+            p->normal_pages = multifd_send_zero_pages(p, used);
+            if (p->normal_pages) {
+                ret = multifd_send_state->ops->send_prepare(p, p->normal_pages,
+                                                            &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            }
+            if (used) {
+                flags |= multifd_send_state->compression_flags;
+            }
+            multifd_send_fill_packet(p, used, flags, packet_num);
+
+            trace_multifd_send(p->id, packet_num, used, p->normal_pages,
+                               flags, p->next_packet_size);
+
+            ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                        p->packet_len, &local_err);
+            if (ret != 0) {
+                break;
+            }
+
+            if (p->normal_pages) {
+                ret = multifd_send_state->ops->send_write(p, p->normal_pages,
+                                                          &local_err);
+                if (ret != 0) {
+                    break;
+                }
+            }
+
+            qemu_mutex_lock(&p->mutex);
+            p->pages->used = 0;
+            p->pending_job--;
+            p->sent_bytes += p->packet_len + p->next_packet_size;
+            p->zero_pages += used - p->normal_pages;
+            qemu_mutex_unlock(&p->mutex);
+
+            if (flags & MULTIFD_FLAG_SYNC) {
+                qemu_sem_post(&multifd_send_state->sem_sync);
+            }
+            qemu_sem_post(&multifd_send_state->channels_ready);
+        } else if (p->quit) {
             qemu_mutex_unlock(&p->mutex);
             break;
+        } else {
+            qemu_mutex_unlock(&p->mutex);
+            /* sometimes there are spurious wakeups */
         }
-        qemu_mutex_unlock(&p->mutex);
-        qemu_sem_wait(&p->sem);
     }
 
+out:
+    if (local_err) {
+        multifd_send_terminate_threads(local_err);
+        error_free(local_err);
+    }
+
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->num_pages);
+
     return NULL;
 }
 
+static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
+{
+    MultiFDSendParams *p = opaque;
+    QIOChannel *sioc = QIO_CHANNEL(qio_task_get_source(task));
+    Error *local_err = NULL;
+
+    if (qio_task_propagate_error(task, &local_err)) {
+        object_unref(OBJECT(sioc));
+        multifd_send_terminate_threads(local_err);
+        error_free(local_err);
+    } else {
+        p->c = QIO_CHANNEL(sioc);
+        qio_channel_set_delay(p->c, false);
+        p->running = true;
+        qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
+                           QEMU_THREAD_JOINABLE);
+
+        atomic_inc(&multifd_send_state->count);
+    }
+}
+
 int multifd_save_setup(void)
 {
+    MigrationState *s = migrate_get_current();
     int thread_count;
+    uint32_t page_count = migrate_multifd_page_count();
     uint8_t i;
 
     if (!migrate_use_multifd()) {
         return 0;
     }
+    if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+        error_report("multifd: TLS is not supported on multifd channels");
+        return -1;
+    }
+    if (!socket_send_channel_available()) {
+        error_report("multifd: needs a tcp or unix socket transport");
+        return -1;
+    }
     thread_count = migrate_multifd_channels();
     multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
     multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
-    multifd_send_state->count = 0;
+    atomic_set(&multifd_send_state->count, 0);
+    multifd_send_state->pages = multifd_pages_init(page_count);
+    qemu_sem_init(&multifd_send_state->sem_sync, 0);
+    qemu_sem_init(&multifd_send_state->channels_ready, 0);
+    multifd_send_state->ops = multifd_ops[migrate_multifd_compression()];
+    multifd_send_state->compression_flags =
+        migrate_multifd_compression() << MULTIFD_FLAG_COMPRESSION_SHIFT;
+
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
         qemu_mutex_init(&p->mutex);
         qemu_sem_init(&p->sem, 0);
         p->quit = false;
+        p->pending_job = 0;
         p->id = i;
+        p->pages = multifd_pages_init(page_count);
+        p->packet_len = sizeof(MultiFDPacket_t)
+                      + sizeof(uint64_t) * page_count;
+        p->packet = g_malloc0(p->packet_len);
         p->name = g_strdup_printf("multifdsend_%d", i);
-        qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
-                           QEMU_THREAD_JOINABLE);
+    }
+
+    for (i = 0; i < thread_count; i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+        Error *local_err = NULL;
 
-        multifd_send_state->count++;
+        if (multifd_send_state->ops->send_setup(p, &local_err)) {
+            /* multifd_save_cleanup() will undo the channels already set up */
+            error_report_err(local_err);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < thread_count; i++) {
+        socket_send_channel_create(multifd_new_send_channel_async,
+                                   &multifd_send_state->params[i]);
     }
     return 0;
 }
 
-struct MultiFDRecvParams {
-    uint8_t id;
-    char *name;
-    QemuThread thread;
-    QemuSemaphore sem;
-    QemuMutex mutex;
-    bool quit;
-};
-typedef struct MultiFDRecvParams MultiFDRecvParams;
-
 struct {
     MultiFDRecvParams *params;
     /* number of created threads */
     int count;
+    /* syncs main thread and channels */
+    QemuSemaphore sem_sync;
+    /* global number of generated multifd packets */
+    uint64_t packet_num;
+    /* set when any of the channels failed */
+    bool exiting;
+    /* multifd ops */
+    MultiFDMethods *ops;
 } *multifd_recv_state;
 
-static void terminate_multifd_recv_threads(Error *errp)
+static void multifd_recv_terminate_threads(Error *err)
 {
     int i;
 
-    for (i = 0; i < multifd_recv_state->count; i++) {
+    if (err) {
+        MigrationState *s = migrate_get_current();
+        migrate_set_error(s, err);
+        if (s->state == MIGRATION_STATUS_SETUP ||
+            s->state == MIGRATION_STATUS_ACTIVE) {
+            migrate_set_state(&s->state, s->state,
+                              MIGRATION_STATUS_FAILED);
+        }
+    }
+
+    atomic_set(&multifd_recv_state->exiting, true);
+    for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
         qemu_mutex_lock(&p->mutex);
-        p->quit = true;
-        qemu_sem_post(&p->sem);
+        /* We could arrive here for two reasons:
+           - normal quit, i.e. everything went fine, just finished
+           - error quit: We close the channels so the channel threads
+             finish the qio_channel_read_all_eof() */
+        if (p->c) {
+            qio_channel_shutdown(p->c, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        }
         qemu_mutex_unlock(&p->mutex);
     }
 }
@@ -527,19 +1276,35 @@ int multifd_load_cleanup(Error **errp)
     int i;
     int ret = 0;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || !multifd_recv_state) {
         return 0;
     }
-    terminate_multifd_recv_threads(NULL);
-    for (i = 0; i < multifd_recv_state->count; i++) {
+    multifd_recv_terminate_threads(NULL);
+    for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
-        qemu_thread_join(&p->thread);
+        if (p->running) {
+            /* Wake up a thread waiting in a sync point */
+            qemu_sem_post(&p->sem_sync);
+            qemu_thread_join(&p->thread);
+            p->running = false;
+        }
+        if (p->c) {
+            object_unref(OBJECT(p->c));
+            p->c = NULL;
+        }
+        multifd_recv_state->ops->recv_cleanup(p);
         qemu_mutex_destroy(&p->mutex);
-        qemu_sem_destroy(&p->sem);
+        qemu_sem_destroy(&p->sem_sync);
         g_free(p->name);
         p->name = NULL;
+        multifd_pages_clear(p->pages);
+        p->pages = NULL;
+        p->packet_len = 0;
+        g_free(p->packet);
+        p->packet = NULL;
     }
+    qemu_sem_destroy(&multifd_recv_state->sem_sync);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
     g_free(multifd_recv_state);
@@ -548,26 +1313,122 @@ int multifd_load_cleanup(Error **errp)
     return ret;
 }
 
+/**
+ * multifd_recv_sync_main: wait for all channels to reach a sync point
+ *
+ * Called from the main incoming thread when it finds a
+ * RAM_SAVE_FLAG_MULTIFD_SYNC in the stream.  Once it returns, every
+ * page the source queued on the channels before the sync has been
+ * placed in guest memory.
+ *
+ * Returns 0 for success or -1 if any of the channels has failed
+ */
+static int multifd_recv_sync_main(void)
+{
+    int i;
+
+    if (!migrate_use_multifd()) {
+        return 0;
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        trace_multifd_recv_sync_main_wait(p->id);
+        qemu_sem_wait(&multifd_recv_state->sem_sync);
+    }
+    if (atomic_read(&multifd_recv_state->exiting)) {
+        return -1;
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        if (multifd_recv_state->packet_num < p->packet_num) {
+            multifd_recv_state->packet_num = p->packet_num;
+        }
+        qemu_mutex_unlock(&p->mutex);
+        trace_multifd_recv_sync_main_signal(p->id);
+        qemu_sem_post(&p->sem_sync);
+    }
+    trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
+
+    return 0;
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
+    Error *local_err = NULL;
+    int ret;
+
+    trace_multifd_recv_thread_start(p->id);
 
     while (true) {
+        uint32_t used, normal, i;
+        uint32_t flags;
+
+        ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
+                                       p->packet_len, &local_err);
+        if (ret == 0) {   /* EOF */
+            break;
+        }
+        if (ret == -1) {   /* Error */
+            break;
+        }
+
         qemu_mutex_lock(&p->mutex);
-        if (p->quit) {
+        ret = multifd_recv_unfill_packet(p, &local_err);
+        if (ret) {
             qemu_mutex_unlock(&p->mutex);
             break;
         }
+
+        used = p->pages->used;
+        normal = p->normal_pages;
+        flags = p->flags;
+        trace_multifd_recv(p->id, p->packet_num, used, normal, flags,
+                           p->next_packet_size);
+        p->num_packets++;
+        p->num_pages += used;
         qemu_mutex_unlock(&p->mutex);
-        qemu_sem_wait(&p->sem);
+
+        if (normal) {
+            ret = multifd_recv_state->ops->recv_pages(p, normal, &local_err);
+            if (ret != 0) {
+                break;
+            }
+        }
+
+        for (i = normal; i < used; i++) {
+            ram_handle_compressed(p->pages->iov[i].iov_base, 0,
+                                  TARGET_PAGE_SIZE);
+        }
+
+        if (flags & MULTIFD_FLAG_SYNC) {
+            qemu_sem_post(&multifd_recv_state->sem_sync);
+            qemu_sem_wait(&p->sem_sync);
+            if (atomic_read(&multifd_recv_state->exiting)) {
+                break;
+            }
+        }
     }
 
+    if (local_err) {
+        multifd_recv_terminate_threads(local_err);
+        error_free(local_err);
+        /* Don't leave the main thread waiting in a sync point */
+        qemu_sem_post(&multifd_recv_state->sem_sync);
+    }
+
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->num_pages);
+
     return NULL;
 }
 
 int multifd_load_setup(void)
 {
     int thread_count;
+    uint32_t page_count = migrate_multifd_page_count();
     uint8_t i;
 
     if (!migrate_use_multifd()) {
@@ -576,22 +1437,92 @@ int multifd_load_setup(void)
     thread_count = migrate_multifd_channels();
     multifd_recv_state = g_malloc0(sizeof(*multifd_recv_state));
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
-    multifd_recv_state->count = 0;
+    atomic_set(&multifd_recv_state->count, 0);
+    qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
+
     for (i = 0; i < thread_count; i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
         qemu_mutex_init(&p->mutex);
-        qemu_sem_init(&p->sem, 0);
-        p->quit = false;
+        qemu_sem_init(&p->sem_sync, 0);
         p->id = i;
+        p->pages = multifd_pages_init(page_count);
+        p->packet_len = sizeof(MultiFDPacket_t)
+                      + sizeof(uint64_t) * page_count;
+        p->packet = g_malloc0(p->packet_len);
         p->name = g_strdup_printf("multifdrecv_%d", i);
-        qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
-                           QEMU_THREAD_JOINABLE);
-        multifd_recv_state->count++;
+    }
+
+    for (i = 0; i < thread_count; i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+        Error *local_err = NULL;
+
+        if (multifd_recv_state->ops->recv_setup(p, &local_err)) {
+            error_report_err(local_err);
+            return -1;
+        }
     }
     return 0;
 }
 
+bool multifd_recv_all_channels_created(void)
+{
+    int thread_count = migrate_multifd_channels();
+
+    if (!migrate_use_multifd()) {
+        return true;
+    }
+
+    if (!multifd_recv_state) {
+        return false;
+    }
+
+    return thread_count == atomic_read(&multifd_recv_state->count);
+}
+
+/**
+ * multifd_recv_new_channel: attach a new incoming channel
+ *
+ * Returns true when all the expected channels have been created
+ *
+ * @ioc: channel the source connected with
+ * @errp: set *errp if the handshake failed, with reason
+ */
+bool multifd_recv_new_channel(QIOChannel *ioc, Error **errp)
+{
+    MultiFDRecvParams *p;
+    Error *local_err = NULL;
+    int id;
+
+    id = multifd_recv_initial_packet(ioc, &local_err);
+    if (id < 0) {
+        multifd_recv_terminate_threads(local_err);
+        error_propagate(errp, local_err);
+        return false;
+    }
+
+    p = &multifd_recv_state->params[id];
+    if (p->c != NULL) {
+        error_setg(&local_err, "multifd: received id '%d' already setup'",
+                   id);
+        multifd_recv_terminate_threads(local_err);
+        error_propagate(errp, local_err);
+        return false;
+    }
+    p->c = ioc;
+    object_ref(OBJECT(ioc));
+    /* initial packet */
+    p->num_packets = 1;
+
+    p->running = true;
+    qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
+                       QEMU_THREAD_JOINABLE);
+    atomic_inc(&multifd_recv_state->count);
+    return atomic_read(&multifd_recv_state->count) ==
+           migrate_multifd_channels();
+}
+
 /**
  * save_page_header: write page header to wire
  *
@@ -633,26 +1564,50 @@ static size_t save_page_header(RAMState *rs, QEMUFile *f,  RAMBlock *block,
  * which we can transfer pages to the destination then we should be
  * able to complete migration. Some workloads dirty memory way too
  * fast and will not effectively converge, even with auto-converge.
+ *
+ * The throttle is raised at least by cpu-throttle-increment, but if
+ * the measured rates show that this won't be enough it goes straight
+ * to the percentage that should get the dirty rate down to half of
+ * the transfer rate, assuming that the guest dirties memory in
+ * proportion to the CPU time it is given.
+ *
+ * @dirty_bytes_rate: estimated bytes dirtied per second
+ * @xfer_bytes_rate: bytes transferred per second
  */
-static void mig_throttle_guest_down(void)
+static void mig_throttle_guest_down(uint64_t dirty_bytes_rate,
+                                    uint64_t xfer_bytes_rate)
 {
     MigrationState *s = migrate_get_current();
     uint64_t pct_initial = s->parameters.cpu_throttle_initial;
     uint64_t pct_icrement = s->parameters.cpu_throttle_increment;
+    uint64_t pct_current = 0, pct_needed = 0, pct;
+
+    if (cpu_throttle_active()) {
+        pct_current = cpu_throttle_get_percentage();
+    }
+    /* The rate we see is already throttled by pct_current */
+    if (dirty_bytes_rate && xfer_bytes_rate < 2 * dirty_bytes_rate) {
+        pct_needed = 100 - (100 - pct_current) * xfer_bytes_rate /
+                           (2 * dirty_bytes_rate);
+    }
 
-    /* We have not started throttling yet. Let's start it. */
     if (!cpu_throttle_active()) {
-        cpu_throttle_set(pct_initial);
+        /* We have not started throttling yet. Let's start it. */
+        pct = MAX(pct_initial, pct_needed);
     } else {
         /* Throttling already on, just increase the rate */
-        cpu_throttle_set(cpu_throttle_get_percentage() + pct_icrement);
+        pct = MAX(pct_current + pct_icrement, pct_needed);
     }
+    trace_mig_throttle_guest_down(dirty_bytes_rate, xfer_bytes_rate,
+                                  pct_needed, pct);
+    cpu_throttle_set(pct);
 }
 
 /**
  * xbzrle_cache_zero_page: insert a zero page in the XBZRLE cache
  *
  * @rs: current RAM state
+ * @cache: XBZRLE cache, locked for @current_addr
  * @current_addr: address for the zero page
  *
  * Update the xbzrle cache to reflect a page that's been sent as all 0.
@@ -661,16 +1616,16 @@ static void mig_throttle_guest_down(void)
  * As a bonus, if the page wasn't in the cache it gets added so that
  * when a small write is made into the 0'd page it gets XBZRLE sent.
  */
-static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
+static void xbzrle_cache_zero_page(RAMState *rs, PageCache *cache,
+                                   ram_addr_t current_addr)
 {
-    if (rs->ram_bulk_stage || !migrate_use_xbzrle()) {
+    if (rs->ram_bulk_stage || !cache) {
         return;
     }
 
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
-    cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
-                 ram_counters.dirty_sync_count);
+    cache_insert(cache, current_addr, XBZRLE.zero_target_page);
 }
 
 #define ENCODING_FLAG_XBZRLE 0x1
@@ -683,36 +1638,36 @@ static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
  *          -1 means that xbzrle would be longer than normal
  *
  * @rs: current RAM state
+ * @cache: XBZRLE cache, locked for @current_addr
  * @current_data: pointer to the address of the page contents
  * @current_addr: addr of the page
  * @block: block that contains the page we want to send
  * @offset: offset inside the block for the page
  * @last_stage: if we are at the completion stage
  */
-static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
+static int save_xbzrle_page(RAMState *rs, PageCache *cache,
+                            uint8_t **current_data,
                             ram_addr_t current_addr, RAMBlock *block,
                             ram_addr_t offset, bool last_stage)
 {
     int encoded_len = 0, bytes_xbzrle;
     uint8_t *prev_cached_page;
 
-    if (!cache_is_cached(XBZRLE.cache, current_addr,
-                         ram_counters.dirty_sync_count)) {
+    if (!cache_is_cached(cache, current_addr)) {
         xbzrle_counters.cache_miss++;
         if (!last_stage) {
-            if (cache_insert(XBZRLE.cache, current_addr, *current_data,
-                             ram_counters.dirty_sync_count) == -1) {
+            if (cache_insert(cache, current_addr, *current_data) == -1) {
                 return -1;
             } else {
                 /* update *current_data when the page has been
                    inserted into cache */
-                *current_data = get_cached_data(XBZRLE.cache, current_addr);
+                *current_data = get_cached_data(cache, current_addr);
             }
         }
         return -1;
     }
 
-    prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
+    prev_cached_page = get_cached_data(cache, current_addr);
 
     /* save current buffer into memory */
     memcpy(XBZRLE.current_buf, *current_data, TARGET_PAGE_SIZE);
@@ -773,7 +1728,7 @@ unsigned long migration_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
     unsigned long *bitmap = rb->bmap;
     unsigned long next;
 
-    if (rs->ram_bulk_stage && start > 0) {
+    if (rs->ram_bulk_stage && start > 0 && !rs->fpo_enabled) {
         next = start + 1;
     } else {
         next = find_next_bit(bitmap, size, start);
@@ -804,6 +1759,201 @@ static void migration_bitmap_sync_range(RAMState *rs, RAMBlock *rb,
                                               &rs->num_dirty_pages_period);
 }
 
+/* With x-bitmap-sync-threads, RAMBlocks are synced in chunks of this
+ * size, shared between the migration thread and the helper threads.
+ * It is a multiple of BITS_PER_LONG pages, so different chunks never
+ * touch the same word of the destination bitmap.
+ */
+#define BITMAP_SYNC_CHUNK_SIZE (1ULL << 30)
+
+typedef struct {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t length;
+} BitmapSyncJob;
+
+static struct {
+    QemuThread *threads;
+    int thread_count;
+    /* protects everything below, except next_job */
+    QemuMutex mutex;
+    /* a new round of jobs is ready */
+    QemuCond job_cond;
+    /* all the threads have finished the current round */
+    QemuCond done_cond;
+    bool quit;
+    /* bumped for every round, the threads wait for it to change */
+    uint64_t round;
+    /* threads still working on the current round */
+    int active;
+    BitmapSyncJob *jobs;
+    int job_count;
+    int job_alloc;
+    /* next job to be taken, claimed with atomic_fetch_inc() */
+    int next_job;
+    /* counters of the current round */
+    uint64_t num_dirty;
+    uint64_t real_dirty_pages;
+} bitmap_sync;
+
+static void bitmap_sync_run_jobs(uint64_t *num_dirty,
+                                 uint64_t *real_dirty_pages)
+{
+    BitmapSyncJob *job;
+    int i;
+
+    while ((i = atomic_fetch_inc(&bitmap_sync.next_job)) <
+           bitmap_sync.job_count) {
+        job = &bitmap_sync.jobs[i];
+        *num_dirty += cpu_physical_memory_sync_dirty_bitmap(job->rb,
+                                                            job->start,
+                                                            job->length,
+                                                            real_dirty_pages);
+    }
+}
+
+static void *bitmap_sync_thread(void *opaque)
+{
+    uint64_t round = 0, num_dirty, real_dirty_pages;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&bitmap_sync.mutex);
+    while (true) {
+        while (!bitmap_sync.quit && bitmap_sync.round == round) {
+            qemu_cond_wait(&bitmap_sync.job_cond, &bitmap_sync.mutex);
+        }
+        if (bitmap_sync.quit) {
+            break;
+        }
+        round = bitmap_sync.round;
+        qemu_mutex_unlock(&bitmap_sync.mutex);
+
+        num_dirty = 0;
+        real_dirty_pages = 0;
+        bitmap_sync_run_jobs(&num_dirty, &real_dirty_pages);
+
+        qemu_mutex_lock(&bitmap_sync.mutex);
+        bitmap_sync.num_dirty += num_dirty;
+        bitmap_sync.real_dirty_pages += real_dirty_pages;
+        if (--bitmap_sync.active == 0) {
+            qemu_cond_signal(&bitmap_sync.done_cond);
+        }
+    }
+    qemu_mutex_unlock(&bitmap_sync.mutex);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void bitmap_sync_setup(void)
+{
+    int i;
+
+    bitmap_sync.thread_count = migrate_bitmap_sync_threads();
+    if (!bitmap_sync.thread_count) {
+        return;
+    }
+
+    qemu_mutex_init(&bitmap_sync.mutex);
+    qemu_cond_init(&bitmap_sync.job_cond);
+    qemu_cond_init(&bitmap_sync.done_cond);
+    bitmap_sync.quit = false;
+    bitmap_sync.round = 0;
+    bitmap_sync.threads = g_new0(QemuThread, bitmap_sync.thread_count);
+    for (i = 0; i < bitmap_sync.thread_count; i++) {
+        qemu_thread_create(&bitmap_sync.threads[i], "bitmapsync",
+                           bitmap_sync_thread, NULL, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void bitmap_sync_cleanup(void)
+{
+    int i;
+
+    if (!bitmap_sync.thread_count) {
+        return;
+    }
+
+    qemu_mutex_lock(&bitmap_sync.mutex);
+    bitmap_sync.quit = true;
+    qemu_cond_broadcast(&bitmap_sync.job_cond);
+    qemu_mutex_unlock(&bitmap_sync.mutex);
+
+    for (i = 0; i < bitmap_sync.thread_count; i++) {
+        qemu_thread_join(&bitmap_sync.threads[i]);
+    }
+    g_free(bitmap_sync.threads);
+    bitmap_sync.threads = NULL;
+    g_free(bitmap_sync.jobs);
+    bitmap_sync.jobs = NULL;
+    bitmap_sync.job_alloc = 0;
+    qemu_cond_destroy(&bitmap_sync.done_cond);
+    qemu_cond_destroy(&bitmap_sync.job_cond);
+    qemu_mutex_destroy(&bitmap_sync.mutex);
+    bitmap_sync.thread_count = 0;
+}
+
+/**
+ * migration_bitmap_sync_parallel: sync all the RAMBlocks in chunks
+ *
+ * The chunks are taken in turn by the helper threads and by the
+ * migration thread itself.  The dirty memory words are fetched with
+ * atomic_xchg(), so KVM and TCG can keep setting bits meanwhile.
+ *
+ * Called with rcu_read_lock() and rs->bitmap_mutex held, the first
+ * keeps the RAMBlocks alive while the helper threads use them.
+ *
+ * @rs: current RAM state
+ */
+static void migration_bitmap_sync_parallel(RAMState *rs)
+{
+    uint64_t num_dirty = 0, real_dirty_pages = 0;
+    BitmapSyncJob *job;
+    RAMBlock *block;
+    ram_addr_t start;
+
+    /* All the threads are idle between rounds, jobs can be rebuilt */
+    bitmap_sync.job_count = 0;
+    RAMBLOCK_FOREACH(block) {
+        for (start = 0; start < block->used_length;
+             start += BITMAP_SYNC_CHUNK_SIZE) {
+            if (bitmap_sync.job_count == bitmap_sync.job_alloc) {
+                bitmap_sync.job_alloc = MAX(16, bitmap_sync.job_alloc * 2);
+                bitmap_sync.jobs = g_renew(BitmapSyncJob, bitmap_sync.jobs,
+                                           bitmap_sync.job_alloc);
+            }
+            job = &bitmap_sync.jobs[bitmap_sync.job_count++];
+            job->rb = block;
+            job->start = start;
+            job->length = MIN(BITMAP_SYNC_CHUNK_SIZE,
+                              block->used_length - start);
+        }
+    }
+
+    qemu_mutex_lock(&bitmap_sync.mutex);
+    bitmap_sync.next_job = 0;
+    bitmap_sync.num_dirty = 0;
+    bitmap_sync.real_dirty_pages = 0;
+    bitmap_sync.active = bitmap_sync.thread_count;
+    bitmap_sync.round++;
+    qemu_cond_broadcast(&bitmap_sync.job_cond);
+    qemu_mutex_unlock(&bitmap_sync.mutex);
+
+    bitmap_sync_run_jobs(&num_dirty, &real_dirty_pages);
+
+    qemu_mutex_lock(&bitmap_sync.mutex);
+    while (bitmap_sync.active) {
+        qemu_cond_wait(&bitmap_sync.done_cond, &bitmap_sync.mutex);
+    }
+    num_dirty += bitmap_sync.num_dirty;
+    real_dirty_pages += bitmap_sync.real_dirty_pages;
+    qemu_mutex_unlock(&bitmap_sync.mutex);
+
+    rs->migration_dirty_pages += num_dirty;
+    rs->num_dirty_pages_period += real_dirty_pages;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -829,7 +1979,7 @@ static void migration_bitmap_sync(RAMState *rs)
 {
     RAMBlock *block;
     int64_t end_time;
-    uint64_t bytes_xfer_now;
+    uint64_t bytes_xfer_now, xfer_bytes_rate;
 
     ram_counters.dirty_sync_count++;
 
@@ -837,19 +1987,30 @@ static void migration_bitmap_sync(RAMState *rs)
         rs->time_last_bitmap_sync = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     }
 
+    precopy_notify(PRECOPY_NOTIFY_BEFORE_BITMAP_SYNC);
+
     trace_migration_bitmap_sync_start();
     memory_global_dirty_log_sync();
 
     qemu_mutex_lock(&rs->bitmap_mutex);
     rcu_read_lock();
-    RAMBLOCK_FOREACH(block) {
-        migration_bitmap_sync_range(rs, block, 0, block->used_length);
+    if (bitmap_sync.thread_count) {
+        migration_bitmap_sync_parallel(rs);
+    } else {
+        RAMBLOCK_FOREACH(block) {
+            migration_bitmap_sync_range(rs, block, 0, block->used_length);
+        }
     }
     rcu_read_unlock();
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
 
+    /* Pages from the previous round can still be in flight on the
+     * multifd channels; they must be placed before any page of the
+     * new round. */
+    rs->multifd_sync_needed = migrate_use_multifd();
+
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
     /* more than 1 second = 1000 millisecons */
@@ -858,6 +2019,21 @@ static void migration_bitmap_sync(RAMState *rs)
         ram_counters.dirty_pages_rate = rs->num_dirty_pages_period * 1000
             / (end_time - rs->time_last_bitmap_sync);
         bytes_xfer_now = ram_counters.transferred;
+        xfer_bytes_rate = (bytes_xfer_now - rs->bytes_xfer_prev) * 1000
+            / (end_time - rs->time_last_bitmap_sync);
+
+        /* A single period is noisy: the guest may have been idle while
+         * we were busy sending, or the other way round.  Keep an
+         * exponentially weighted average, with 1/4 for the new sample. */
+        if (!rs->dirty_pages_rate_avg) {
+            rs->dirty_pages_rate_avg = ram_counters.dirty_pages_rate;
+        } else {
+            rs->dirty_pages_rate_avg = (3 * rs->dirty_pages_rate_avg +
+                                        ram_counters.dirty_pages_rate) / 4;
+        }
+        ram_counters.dirty_pages_rate_avg = rs->dirty_pages_rate_avg;
+        trace_migration_dirty_rate(ram_counters.dirty_pages_rate,
+                                   rs->dirty_pages_rate_avg, xfer_bytes_rate);
 
         /* During block migration the auto-converge logic incorrectly detects
          * that ram migration makes no progress. Avoid this by disabling the
@@ -874,7 +2050,9 @@ static void migration_bitmap_sync(RAMState *rs)
                 (++rs->dirty_rate_high_cnt >= 2)) {
                     trace_migration_throttle();
                     rs->dirty_rate_high_cnt = 0;
-                    mig_throttle_guest_down();
+                    mig_throttle_guest_down(rs->dirty_pages_rate_avg *
+                                            TARGET_PAGE_SIZE,
+                                            xfer_bytes_rate);
             }
         }
 
@@ -889,14 +2067,90 @@ static void migration_bitmap_sync(RAMState *rs)
             rs->xbzrle_cache_miss_prev = xbzrle_counters.cache_miss;
         }
 
-        /* reset period counters */
-        rs->time_last_bitmap_sync = end_time;
-        rs->num_dirty_pages_period = 0;
-        rs->bytes_xfer_prev = bytes_xfer_now;
-    }
-    if (migrate_use_events()) {
-        qapi_event_send_migration_pass(ram_counters.dirty_sync_count, NULL);
+        /* reset period counters */
+        rs->time_last_bitmap_sync = end_time;
+        rs->num_dirty_pages_period = 0;
+        rs->bytes_xfer_prev = bytes_xfer_now;
+    }
+    if (migrate_use_events()) {
+        qapi_event_send_migration_pass(ram_counters.dirty_sync_count, NULL);
+    }
+
+    precopy_notify(PRECOPY_NOTIFY_AFTER_BITMAP_SYNC);
+}
+
+/*
+ * Drop the pages of [addr, addr + len) from the migration bitmap.  The
+ * guest may reuse them as soon as it has reported them; such writes go to
+ * the dirty log and are picked up again by the next bitmap sync, which is
+ * why hints must not be applied across a sync (see precopy_add_notifier).
+ *
+ * Called with the iothread lock held.
+ */
+void qemu_guest_free_page_hint(void *addr, size_t len)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+    ram_addr_t offset;
+    size_t used_len;
+    unsigned long start, end, page;
+
+    if (!rs) {
+        return;
+    }
+
+    rcu_read_lock();
+    for (; len > 0; len -= used_len, addr += used_len) {
+        block = qemu_ram_block_from_host(addr, false, &offset);
+        if (unlikely(!block || !block->bmap ||
+                     offset >= block->used_length)) {
+            break;
+        }
+        used_len = MIN(len, block->used_length - offset);
+
+        /* Only whole target pages inside the range can be skipped */
+        start = DIV_ROUND_UP(offset, TARGET_PAGE_SIZE);
+        end = (offset + used_len) >> TARGET_PAGE_BITS;
+        if (start >= end) {
+            continue;
+        }
+
+        qemu_mutex_lock(&rs->bitmap_mutex);
+        rs->fpo_enabled = true;
+        for (page = find_next_bit(block->bmap, end, start); page < end;
+             page = find_next_bit(block->bmap, end, page + 1)) {
+            rs->migration_dirty_pages--;
+        }
+        bitmap_clear(block->bmap, start, end - start);
+        qemu_mutex_unlock(&rs->bitmap_mutex);
+    }
+    rcu_read_unlock();
+}
+
+/**
+ * save_zero_page_to_file: send the zero page to the file
+ *
+ * Returns the size of data written to the file, 0 means the page is not
+ * a zero page
+ *
+ * @rs: current RAM state
+ * @file: the file where the data is saved
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ * @p: pointer to the page
+ */
+static int save_zero_page_to_file(RAMState *rs, QEMUFile *file,
+                                  RAMBlock *block, ram_addr_t offset,
+                                  uint8_t *p)
+{
+    int len = 0;
+
+    if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+        len += save_page_header(rs, file, block, offset | RAM_SAVE_FLAG_ZERO);
+        qemu_put_byte(file, 0);
+        len += 1;
     }
+    return len;
 }
 
 /**
@@ -912,18 +2166,14 @@ static void migration_bitmap_sync(RAMState *rs)
 static int save_zero_page(RAMState *rs, RAMBlock *block, ram_addr_t offset,
                           uint8_t *p)
 {
-    int pages = -1;
+    int len = save_zero_page_to_file(rs, rs->f, block, offset, p);
 
-    if (is_zero_range(p, TARGET_PAGE_SIZE)) {
+    if (len) {
         ram_counters.duplicate++;
-        ram_counters.transferred +=
-            save_page_header(rs, rs->f, block, offset | RAM_SAVE_FLAG_ZERO);
-        qemu_put_byte(rs->f, 0);
-        ram_counters.transferred += 1;
-        pages = 1;
+        ram_counters.transferred += len;
+        return 1;
     }
-
-    return pages;
+    return -1;
 }
 
 static void ram_release_pages(const char *rbname, uint64_t offset, int pages)
@@ -953,6 +2203,7 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
     int pages = -1;
     uint64_t bytes_xmit;
     ram_addr_t current_addr;
+    PageCache *cache;
     uint8_t *p;
     int ret;
     bool send_async = true;
@@ -971,9 +2222,8 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
         pages = 1;
     }
 
-    XBZRLE_cache_lock();
-
     current_addr = block->offset + offset;
+    cache = XBZRLE_cache_get(current_addr);
 
     if (ret != RAM_SAVE_CONTROL_NOT_SUPP) {
         if (ret != RAM_SAVE_CONTROL_DELAYED) {
@@ -989,11 +2239,11 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
             /* Must let xbzrle know, otherwise a previous (now 0'd) cached
              * page would be stale
              */
-            xbzrle_cache_zero_page(rs, current_addr);
+            xbzrle_cache_zero_page(rs, cache, current_addr);
             ram_release_pages(block->idstr, offset, pages);
         } else if (!rs->ram_bulk_stage &&
-                   !migration_in_postcopy() && migrate_use_xbzrle()) {
-            pages = save_xbzrle_page(rs, &p, current_addr, block,
+                   !migration_in_postcopy() && cache) {
+            pages = save_xbzrle_page(rs, cache, &p, current_addr, block,
                                      offset, last_stage);
             if (!last_stage) {
                 /* Can't send this cached data async, since the cache page
@@ -1020,32 +2270,54 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
         ram_counters.normal++;
     }
 
-    XBZRLE_cache_unlock();
+    XBZRLE_cache_put(cache, current_addr);
 
     return pages;
 }
 
-static int do_compress_ram_page(QEMUFile *f, RAMBlock *block,
-                                ram_addr_t offset)
+/*
+ * Called from the compression threads, the zero check is done here so
+ * that the migration thread doesn't have to touch the page at all.
+ *
+ * Returns true if the page was sent as a zero page
+ */
+static bool do_compress_ram_page(QEMUFile *f, RAMBlock *block,
+                                 ram_addr_t offset)
 {
     RAMState *rs = ram_state;
-    int bytes_sent, blen;
+    int blen;
     uint8_t *p = block->host + (offset & TARGET_PAGE_MASK);
+    bool zero_page = false;
+
+    if (save_zero_page_to_file(rs, f, block, offset, p)) {
+        zero_page = true;
+        goto exit;
+    }
 
-    bytes_sent = save_page_header(rs, f, block, offset |
-                                  RAM_SAVE_FLAG_COMPRESS_PAGE);
+    save_page_header(rs, f, block, offset | RAM_SAVE_FLAG_COMPRESS_PAGE);
     blen = qemu_put_compression_data(f, p, TARGET_PAGE_SIZE,
                                      migrate_compress_level());
     if (blen < 0) {
-        bytes_sent = 0;
         qemu_file_set_error(migrate_get_current()->to_dst_file, blen);
         error_report("compressed data failed!");
-    } else {
-        bytes_sent += blen;
-        ram_release_pages(block->idstr, offset & TARGET_PAGE_MASK, 1);
+        return false;
     }
 
-    return bytes_sent;
+exit:
+    ram_release_pages(block->idstr, offset & TARGET_PAGE_MASK, 1);
+    return zero_page;
+}
+
+/* Called with comp_done_lock held, once the page of @param is in its file */
+static void update_compress_thread_counts(CompressParam *param, int bytes_xmit)
+{
+    ram_counters.transferred += bytes_xmit;
+    if (param->zero_page) {
+        ram_counters.duplicate++;
+        param->zero_page = false;
+    } else if (bytes_xmit) {
+        ram_counters.normal++;
+    }
 }
 
 static void flush_compressed_data(RAMState *rs)
@@ -1063,16 +2335,16 @@ static void flush_compressed_data(RAMState *rs)
             qemu_cond_wait(&comp_done_cond, &comp_done_lock);
         }
     }
-    qemu_mutex_unlock(&comp_done_lock);
 
     for (idx = 0; idx < thread_count; idx++) {
         qemu_mutex_lock(&comp_param[idx].mutex);
         if (!comp_param[idx].quit) {
             len = qemu_put_qemu_file(rs->f, comp_param[idx].file);
-            ram_counters.transferred += len;
+            update_compress_thread_counts(&comp_param[idx], len);
         }
         qemu_mutex_unlock(&comp_param[idx].mutex);
     }
+    qemu_mutex_unlock(&comp_done_lock);
 }
 
 static inline void set_compress_params(CompressParam *param, RAMBlock *block,
@@ -1094,13 +2366,12 @@ static int compress_page_with_multi_thread(RAMState *rs, RAMBlock *block,
             if (comp_param[idx].done) {
                 comp_param[idx].done = false;
                 bytes_xmit = qemu_put_qemu_file(rs->f, comp_param[idx].file);
+                update_compress_thread_counts(&comp_param[idx], bytes_xmit);
                 qemu_mutex_lock(&comp_param[idx].mutex);
                 set_compress_params(&comp_param[idx], block, offset);
                 qemu_cond_signal(&comp_param[idx].cond);
                 qemu_mutex_unlock(&comp_param[idx].mutex);
                 pages = 1;
-                ram_counters.normal++;
-                ram_counters.transferred += bytes_xmit;
                 break;
             }
         }
@@ -1180,12 +2451,8 @@ static int ram_save_compressed_page(RAMState *rs, PageSearchStatus *pss,
                 ram_release_pages(block->idstr, offset, pages);
             }
         } else {
-            pages = save_zero_page(rs, block, offset, p);
-            if (pages == -1) {
-                pages = compress_page_with_multi_thread(rs, block, offset);
-            } else {
-                ram_release_pages(block->idstr, offset, pages);
-            }
+            /* the compression thread checks for zero pages */
+            pages = compress_page_with_multi_thread(rs, block, offset);
         }
     }
 
@@ -1255,11 +2522,17 @@ static bool find_dirty_block(RAMState *rs, PageSearchStatus *pss, bool *again)
 static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
 {
     RAMBlock *block = NULL;
+    struct RAMSrcPageRequest *entry = NULL;
+    bool prefetch = false;
 
     qemu_mutex_lock(&rs->src_page_req_mutex);
     if (!QSIMPLEQ_EMPTY(&rs->src_page_requests)) {
-        struct RAMSrcPageRequest *entry =
-                                QSIMPLEQ_FIRST(&rs->src_page_requests);
+        entry = QSIMPLEQ_FIRST(&rs->src_page_requests);
+    } else if (!QSIMPLEQ_EMPTY(&rs->src_prefetch_requests)) {
+        entry = QSIMPLEQ_FIRST(&rs->src_prefetch_requests);
+        prefetch = true;
+    }
+    if (entry) {
         block = entry->rb;
         *offset = entry->offset;
 
@@ -1268,7 +2541,11 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
             entry->offset += TARGET_PAGE_SIZE;
         } else {
             memory_region_unref(block->mr);
-            QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
+            if (prefetch) {
+                QSIMPLEQ_REMOVE_HEAD(&rs->src_prefetch_requests, next_req);
+            } else {
+                QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
+            }
             g_free(entry);
         }
     }
@@ -1357,6 +2634,12 @@ static void migration_page_queue_free(RAMState *rs)
         QSIMPLEQ_REMOVE_HEAD(&rs->src_page_requests, next_req);
         g_free(mspr);
     }
+    QSIMPLEQ_FOREACH_SAFE(mspr, &rs->src_prefetch_requests, next_req,
+                          next_mspr) {
+        memory_region_unref(mspr->rb->mr);
+        QSIMPLEQ_REMOVE_HEAD(&rs->src_prefetch_requests, next_req);
+        g_free(mspr);
+    }
     rcu_read_unlock();
 }
 
@@ -1365,6 +2648,11 @@ static void migration_page_queue_free(RAMState *rs)
  *
  * A request from postcopy destination for example.
  *
+ * The destination only waits for the first host page of a request, the
+ * faulting one; anything after it was asked for ahead of time, so it
+ * goes to a second queue that is only served when there are no faults
+ * pending.
+ *
  * Returns zero on success or negative on error
  *
  * @rbname: Name of the RAMBLock of the request. NULL means the
@@ -1409,15 +2697,30 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len)
         goto err;
     }
 
+    size_t pagesize = qemu_ram_pagesize(ramblock);
     struct RAMSrcPageRequest *new_entry =
         g_malloc0(sizeof(struct RAMSrcPageRequest));
+    struct RAMSrcPageRequest *prefetch_entry = NULL;
+
     new_entry->rb = ramblock;
     new_entry->offset = start;
-    new_entry->len = len;
-
+    new_entry->len = MIN(len, pagesize);
     memory_region_ref(ramblock->mr);
+
+    if (len > pagesize) {
+        prefetch_entry = g_malloc0(sizeof(struct RAMSrcPageRequest));
+        prefetch_entry->rb = ramblock;
+        prefetch_entry->offset = start + pagesize;
+        prefetch_entry->len = len - pagesize;
+        memory_region_ref(ramblock->mr);
+    }
+
     qemu_mutex_lock(&rs->src_page_req_mutex);
     QSIMPLEQ_INSERT_TAIL(&rs->src_page_requests, new_entry, next_req);
+    if (prefetch_entry) {
+        QSIMPLEQ_INSERT_TAIL(&rs->src_prefetch_requests, prefetch_entry,
+                             next_req);
+    }
     qemu_mutex_unlock(&rs->src_page_req_mutex);
     rcu_read_unlock();
 
@@ -1428,6 +2731,92 @@ err:
     return -1;
 }
 
+/**
+ * ram_save_multifd_page: queue the given page on the multifd channels
+ *
+ * Zero pages still go through the main stream, everything else is
+ * batched and sent by the multifd channel threads.
+ *
+ * Returns the number of pages queued or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ */
+static int ram_save_multifd_page(RAMState *rs, PageSearchStatus *pss)
+{
+    RAMBlock *block = pss->block;
+    ram_addr_t offset = pss->page << TARGET_PAGE_BITS;
+
+    /* Zero pages are found by the channel threads, they move them from
+     * normal to duplicate in multifd_account_sent() */
+    if (multifd_queue_page(block, offset) < 0) {
+        return -1;
+    }
+    ram_counters.normal++;
+
+    return 1;
+}
+
+/**
+ * ram_multifd_sync: emit a multifd sync point if a bitmap sync happened
+ *
+ * Returns zero for success or negative on error
+ *
+ * @rs: current RAM state
+ * @f: QEMUFile where to send the data
+ * @force: emit the sync point even without a new bitmap sync
+ */
+static int ram_multifd_sync(RAMState *rs, QEMUFile *f, bool force)
+{
+    if (!migrate_use_multifd() || (!rs->multifd_sync_needed && !force)) {
+        return 0;
+    }
+    rs->multifd_sync_needed = false;
+    if (multifd_send_sync_main() < 0) {
+        return -1;
+    }
+    qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_SYNC);
+    ram_counters.transferred += 8;
+
+    return 0;
+}
+
+/**
+ * ram_save_mapped_page: write a page at its own offset in the file
+ *
+ * Returns the number of pages written or negative on error
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ */
+static int ram_save_mapped_page(RAMState *rs, PageSearchStatus *pss)
+{
+    RAMBlock *block = pss->block;
+    ram_addr_t offset = pss->page << TARGET_PAGE_BITS;
+    uint8_t *p = block->host + offset;
+    ssize_t ret;
+
+    /* The file starts out sparse, so the first round can skip zero pages */
+    if (rs->ram_bulk_stage && is_zero_range(p, TARGET_PAGE_SIZE)) {
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    ret = pwrite(rs->mapped_fd, p, TARGET_PAGE_SIZE,
+                 block->pages_offset + offset);
+    if (ret != TARGET_PAGE_SIZE) {
+        ret = ret < 0 ? -errno : -EIO;
+        qemu_file_set_error(rs->f, ret);
+        return ret;
+    }
+
+    /* Let the bandwidth estimates see the data written beside the stream */
+    qemu_update_position(rs->f, TARGET_PAGE_SIZE);
+    ram_counters.transferred += TARGET_PAGE_SIZE;
+    ram_counters.normal++;
+    return 1;
+}
+
 /**
  * ram_save_target_page: save one target page
  *
@@ -1450,7 +2839,11 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
          * round of migration even if compression is enabled. In theory,
          * xbzrle can do better than compression.
          */
-        if (migrate_use_compression() &&
+        if (migrate_mapped_ram()) {
+            res = ram_save_mapped_page(rs, pss);
+        } else if (migrate_use_multifd() && !migration_in_postcopy()) {
+            res = ram_save_multifd_page(rs, pss);
+        } else if (migrate_use_compression() &&
             (rs->ram_bulk_stage || !migrate_use_xbzrle())) {
             res = ram_save_compressed_page(rs, pss, last_stage);
         } else {
@@ -1632,6 +3025,7 @@ static void ram_save_cleanup(void *opaque)
     /* caller have hold iothread lock or is in a bh, so there is
      * no writing race against this migration_bitmap
      */
+    precopy_notify(PRECOPY_NOTIFY_CLEANUP);
     memory_global_dirty_log_stop();
 
     QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
@@ -1643,6 +3037,7 @@ static void ram_save_cleanup(void *opaque)
 
     xbzrle_cleanup();
     compress_threads_save_cleanup();
+    bitmap_sync_cleanup();
     ram_state_cleanup(rsp);
 }
 
@@ -2075,7 +3470,8 @@ static int xbzrle_init(void)
     }
 
     XBZRLE.cache = cache_init(migrate_xbzrle_cache_size(),
-                              TARGET_PAGE_SIZE, &local_err);
+                              TARGET_PAGE_SIZE, xbzrle_cache_shards(),
+                              &local_err);
     if (!XBZRLE.cache) {
         error_report_err(local_err);
         goto free_zero_page;
@@ -2123,6 +3519,7 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    QSIMPLEQ_INIT(&(*rsp)->src_prefetch_requests);
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -2181,6 +3578,7 @@ static int ram_init_all(RAMState **rsp)
         return -1;
     }
 
+    bitmap_sync_setup();
     ram_init_bitmaps(*rsp);
 
     return 0;
@@ -2201,6 +3599,24 @@ static int ram_init_all(RAMState **rsp)
  * @f: QEMUFile where to send the data
  * @opaque: RAMState pointer
  */
+/*
+ * With x-mapped-ram each block's header is followed by the offset of its
+ * page area, and the stream goes on after that area.  Pages are written
+ * there with pwrite() and a page dirtied again simply overwrites its
+ * older copy, so the file always holds exactly one copy of the RAM.
+ */
+static int ram_save_mapped_block_header(QEMUFile *f, RAMBlock *block)
+{
+    off_t pos = qemu_file_offset(f);
+
+    if (pos < 0) {
+        return -1;
+    }
+    block->pages_offset = ROUND_UP(pos + 8, MAPPED_RAM_ALIGN);
+    qemu_put_be64(f, block->pages_offset);
+    return qemu_file_seek(f, block->pages_offset + block->used_length);
+}
+
 static int ram_save_setup(QEMUFile *f, void *opaque)
 {
     RAMState **rsp = opaque;
@@ -2214,6 +3630,14 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     }
     (*rsp)->f = f;
 
+    if (migrate_mapped_ram()) {
+        (*rsp)->mapped_fd = qemu_get_fd(f);
+        if ((*rsp)->mapped_fd < 0) {
+            error_report("x-mapped-ram needs a file: migration URI");
+            return -1;
+        }
+    }
+
     rcu_read_lock();
 
     qemu_put_be64(f, ram_bytes_total() | RAM_SAVE_FLAG_MEM_SIZE);
@@ -2225,6 +3649,10 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         if (migrate_postcopy_ram() && block->page_size != qemu_host_page_size) {
             qemu_put_be64(f, block->page_size);
         }
+        if (migrate_mapped_ram() && ram_save_mapped_block_header(f, block)) {
+            rcu_read_unlock();
+            return -1;
+        }
     }
 
     rcu_read_unlock();
@@ -2265,6 +3693,11 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
 
     ram_control_before_iterate(f, RAM_CONTROL_ROUND);
 
+    if (ram_multifd_sync(rs, f, false) < 0) {
+        rcu_read_unlock();
+        return -EIO;
+    }
+
     t0 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     i = 0;
     while ((ret = qemu_file_rate_limit(f)) == 0) {
@@ -2335,6 +3768,11 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     ram_control_before_iterate(f, RAM_CONTROL_FINISH);
 
+    if (ram_multifd_sync(rs, f, false) < 0) {
+        rcu_read_unlock();
+        return -EIO;
+    }
+
     /* try transferring iterative blocks of memory */
 
     /* flush all remaining blocks regardless of rate limiting */
@@ -2353,6 +3791,11 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     rcu_read_unlock();
 
+    /* The destination must have every page before it can finish */
+    if (ram_multifd_sync(rs, f, true) < 0) {
+        return -EIO;
+    }
+
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
 
     return 0;
@@ -2386,11 +3829,11 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
     }
 }
 
-static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
+/* Returns the length of the encoded page that follows, or -1 on error */
+static int load_xbzrle_header(QEMUFile *f)
 {
     unsigned int xh_len;
     int xh_flags;
-    uint8_t *loaded_data;
 
     /* extract RLE header */
     xh_flags = qemu_get_byte(f);
@@ -2405,6 +3848,18 @@ static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
         error_report("Failed to load XBZRLE page - len overflow!");
         return -1;
     }
+    return xh_len;
+}
+
+static int load_xbzrle(QEMUFile *f, ram_addr_t addr, void *host)
+{
+    int xh_len;
+    uint8_t *loaded_data;
+
+    xh_len = load_xbzrle_header(f);
+    if (xh_len < 0) {
+        return -1;
+    }
     loaded_data = XBZRLE.decoded_buf;
     /* load data and decode */
     /* it can change loaded_data to point to an internal buffer */
@@ -2620,6 +4075,234 @@ static void decompress_data_with_multi_threads(QEMUFile *f,
     qemu_mutex_unlock(&decomp_done_lock);
 }
 
+/*
+ * Load threads: with x-load-threads, the migration thread only parses
+ * the stream, and copies the data of every page into a job of a load
+ * thread, which is the one that writes guest memory (and takes the
+ * page faults that come with touching it for the first time), or
+ * decompresses/decodes the page.  A page always goes to the same
+ * thread, so two versions of a page are applied in order.
+ */
+
+/* jobs queued per load thread */
+#define LOAD_THREAD_JOBS 64
+
+typedef enum {
+    LOAD_JOB_ZERO,
+    LOAD_JOB_PAGE,
+    LOAD_JOB_COMPRESS,
+    LOAD_JOB_XBZRLE,
+    /* post done once all the jobs before are finished */
+    LOAD_JOB_FLUSH,
+    LOAD_JOB_QUIT,
+} LoadJobType;
+
+typedef struct {
+    LoadJobType type;
+    void *host;
+    ram_addr_t addr;
+    /* byte for zero pages, length of buf for the others */
+    int len;
+    uint8_t *buf;
+} LoadJob;
+
+typedef struct {
+    QemuThread thread;
+    /* jobs the migration thread can fill */
+    QemuSemaphore free;
+    /* jobs the load thread has to handle */
+    QemuSemaphore ready;
+    /* a LOAD_JOB_FLUSH was reached */
+    QemuSemaphore done;
+    /* next job to fill, only used by the migration thread */
+    unsigned head;
+    /* next job to handle, only used by the load thread */
+    unsigned tail;
+    LoadJob jobs[LOAD_THREAD_JOBS];
+} LoadThread;
+
+static struct {
+    LoadThread *threads;
+    int count;
+    /* a load thread failed to apply a page */
+    bool failed;
+} load_threads;
+
+static void load_job_run(LoadJob *job)
+{
+    unsigned long pagesize = TARGET_PAGE_SIZE;
+
+    switch (job->type) {
+    case LOAD_JOB_ZERO:
+        ram_handle_compressed(job->host, job->len, TARGET_PAGE_SIZE);
+        break;
+    case LOAD_JOB_PAGE:
+        memcpy(job->host, job->buf, TARGET_PAGE_SIZE);
+        break;
+    case LOAD_JOB_COMPRESS:
+        /* Same as do_data_decompress(), a failure is not an error */
+        uncompress((Bytef *)job->host, &pagesize,
+                   (const Bytef *)job->buf, job->len);
+        break;
+    case LOAD_JOB_XBZRLE:
+        if (xbzrle_decode_buffer(job->buf, job->len, job->host,
+                                 TARGET_PAGE_SIZE) == -1) {
+            error_report("Failed to load XBZRLE page at " RAM_ADDR_FMT
+                         " - decode error!", job->addr);
+            atomic_set(&load_threads.failed, true);
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void *load_thread(void *opaque)
+{
+    LoadThread *t = opaque;
+    LoadJob *job;
+
+    while (true) {
+        qemu_sem_wait(&t->ready);
+        job = &t->jobs[t->tail];
+        t->tail = (t->tail + 1) % LOAD_THREAD_JOBS;
+
+        if (job->type == LOAD_JOB_QUIT) {
+            break;
+        } else if (job->type == LOAD_JOB_FLUSH) {
+            qemu_sem_post(&t->done);
+        } else {
+            load_job_run(job);
+        }
+        qemu_sem_post(&t->free);
+    }
+
+    return NULL;
+}
+
+/* Waits for a free job in @t, to be queued with load_job_queue() */
+static LoadJob *load_job_get(LoadThread *t)
+{
+    qemu_sem_wait(&t->free);
+    return &t->jobs[t->head];
+}
+
+static void load_job_queue(LoadThread *t)
+{
+    t->head = (t->head + 1) % LOAD_THREAD_JOBS;
+    qemu_sem_post(&t->ready);
+}
+
+static LoadThread *load_thread_for_page(void *host)
+{
+    uintptr_t page = (uintptr_t)host >> TARGET_PAGE_BITS;
+
+    return &load_threads.threads[page % load_threads.count];
+}
+
+/**
+ * load_page_with_threads: hand a page of the stream to a load thread
+ *
+ * @f: QEMUFile where to read the data of the page from
+ * @type: what to do with the page
+ * @host: host address of the page
+ * @addr: offset of the page in its RAMBlock
+ * @len: zero byte, or length of the data of the page in @f
+ */
+static void load_page_with_threads(QEMUFile *f, LoadJobType type,
+                                   void *host, ram_addr_t addr, int len)
+{
+    LoadThread *t = load_thread_for_page(host);
+    LoadJob *job = load_job_get(t);
+
+    job->type = type;
+    job->host = host;
+    job->addr = addr;
+    job->len = len;
+    if (type != LOAD_JOB_ZERO) {
+        qemu_get_buffer(f, job->buf, len);
+    }
+    load_job_queue(t);
+}
+
+/**
+ * wait_for_load_threads: wait until all the queued pages are in place
+ *
+ * Returns 0 for success or -EINVAL if a page could not be applied
+ */
+static int wait_for_load_threads(void)
+{
+    LoadJob *job;
+    int i;
+
+    for (i = 0; i < load_threads.count; i++) {
+        job = load_job_get(&load_threads.threads[i]);
+        job->type = LOAD_JOB_FLUSH;
+        load_job_queue(&load_threads.threads[i]);
+    }
+    for (i = 0; i < load_threads.count; i++) {
+        qemu_sem_wait(&load_threads.threads[i].done);
+    }
+    return atomic_read(&load_threads.failed) ? -EINVAL : 0;
+}
+
+static void load_threads_setup(void)
+{
+    size_t buf_size = MAX(compressBound(TARGET_PAGE_SIZE), TARGET_PAGE_SIZE);
+    LoadThread *t;
+    int i, j;
+
+    load_threads.count = migrate_load_threads();
+    if (!load_threads.count) {
+        return;
+    }
+
+    load_threads.failed = false;
+    load_threads.threads = g_new0(LoadThread, load_threads.count);
+    for (i = 0; i < load_threads.count; i++) {
+        t = &load_threads.threads[i];
+        qemu_sem_init(&t->free, LOAD_THREAD_JOBS);
+        qemu_sem_init(&t->ready, 0);
+        qemu_sem_init(&t->done, 0);
+        for (j = 0; j < LOAD_THREAD_JOBS; j++) {
+            t->jobs[j].buf = g_malloc(buf_size);
+        }
+        qemu_thread_create(&t->thread, "load", load_thread, t,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void load_threads_cleanup(void)
+{
+    LoadThread *t;
+    LoadJob *job;
+    int i, j;
+
+    if (!load_threads.count) {
+        return;
+    }
+
+    for (i = 0; i < load_threads.count; i++) {
+        t = &load_threads.threads[i];
+        job = load_job_get(t);
+        job->type = LOAD_JOB_QUIT;
+        load_job_queue(t);
+    }
+    for (i = 0; i < load_threads.count; i++) {
+        t = &load_threads.threads[i];
+        qemu_thread_join(&t->thread);
+        for (j = 0; j < LOAD_THREAD_JOBS; j++) {
+            g_free(t->jobs[j].buf);
+        }
+        qemu_sem_destroy(&t->done);
+        qemu_sem_destroy(&t->ready);
+        qemu_sem_destroy(&t->free);
+    }
+    g_free(load_threads.threads);
+    load_threads.threads = NULL;
+    load_threads.count = 0;
+}
+
 /**
  * ram_load_setup: Setup RAM for migration incoming side
  *
@@ -2632,6 +4315,7 @@ static int ram_load_setup(QEMUFile *f, void *opaque)
 {
     xbzrle_load_setup();
     compress_threads_load_setup();
+    load_threads_setup();
     ramblock_recv_map_init();
     return 0;
 }
@@ -2641,8 +4325,10 @@ static int ram_load_cleanup(void *opaque)
     RAMBlock *rb;
     xbzrle_load_cleanup();
     compress_threads_load_cleanup();
+    load_threads_cleanup();
 
     RAMBLOCK_FOREACH(rb) {
+        qemu_ram_block_writeback(rb);
         g_free(rb->receivedmap);
         rb->receivedmap = NULL;
     }
@@ -2770,6 +4456,12 @@ static int ram_load_postcopy(QEMUFile *f)
                                          TARGET_PAGE_SIZE);
             }
             break;
+        case RAM_SAVE_FLAG_MULTIFD_SYNC:
+            if (multifd_recv_sync_main() < 0) {
+                error_report("Failed to synchronize multifd channels");
+                ret = -EIO;
+            }
+            break;
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
             break;
@@ -2811,6 +4503,66 @@ static bool postcopy_is_running(void)
     return ps >= POSTCOPY_INCOMING_LISTENING && ps < POSTCOPY_INCOMING_END;
 }
 
+/*
+ * Load the page area of @block from an x-mapped-ram file.
+ *
+ * Private anonymous RAM is replaced with a private mapping of the file,
+ * so the guest can start right away and each page is only read from the
+ * page cache when it is first touched.  Anything else, and RAM that may
+ * already be pinned for device DMA, is read in eagerly.
+ *
+ * Returns 0 for success or a negative errno.
+ */
+static int ram_load_mapped_block(QEMUFile *f, RAMBlock *block)
+{
+    uint64_t pages_offset = qemu_get_be64(f);
+    size_t length = block->used_length;
+    off_t pos = qemu_file_offset(f);
+    int fd = qemu_get_fd(f);
+    bool mapped = false;
+    size_t done = 0;
+    ssize_t ret;
+
+    if (fd < 0) {
+        error_report("x-mapped-ram needs a file: migration URI");
+        return -EINVAL;
+    }
+    if (pos < 0 || pages_offset < pos ||
+        !QEMU_IS_ALIGNED(pages_offset, TARGET_PAGE_SIZE)) {
+        error_report("Invalid page offset 0x%" PRIx64 " for RAM block %s",
+                     pages_offset, block->idstr);
+        return -EINVAL;
+    }
+
+    if (block->fd < 0 && !qemu_ram_is_shared(block) &&
+        block->page_size == qemu_host_page_size &&
+        QEMU_IS_ALIGNED(pages_offset, qemu_host_page_size) &&
+        !qemu_balloon_is_inhibited()) {
+        mapped = mmap(block->host, length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_FIXED, fd, pages_offset) ==
+                 block->host;
+    }
+
+    while (!mapped && done < length) {
+        ret = pread(fd, block->host + done, length - done,
+                    pages_offset + done);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            error_report("Failed to read RAM block %s: %s", block->idstr,
+                         ret < 0 ? strerror(errno) : "unexpected end of file");
+            return ret < 0 ? -errno : -EIO;
+        }
+        done += ret;
+    }
+
+    trace_ram_load_mapped_block(block->idstr, pages_offset, length, mapped);
+    ramblock_recv_bitmap_set_range(block, block->host,
+                                   length >> TARGET_PAGE_BITS);
+    return qemu_file_seek(f, pages_offset + length);
+}
+
 static int ram_load(QEMUFile *f, void *opaque, int version_id)
 {
     int flags = 0, ret = 0, invalid_flags = 0;
@@ -2833,6 +4585,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
     if (!migrate_use_compression()) {
         invalid_flags |= RAM_SAVE_FLAG_COMPRESS_PAGE;
     }
+    if (!migrate_use_multifd()) {
+        invalid_flags |= RAM_SAVE_FLAG_MULTIFD_SYNC;
+    }
     /* This RCU critical section can be very long running.
      * When RCU reclaims in the code start to become numerous,
      * it will be necessary to reduce the granularity of this
@@ -2857,6 +4612,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
             if (flags & invalid_flags & RAM_SAVE_FLAG_COMPRESS_PAGE) {
                 error_report("Received an unexpected compressed page");
             }
+            if (flags & invalid_flags & RAM_SAVE_FLAG_MULTIFD_SYNC) {
+                error_report("Received a multifd sync without multifd");
+            }
 
             ret = -EINVAL;
             break;
@@ -2913,6 +4671,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_mapped_ram()) {
+                        ret = ram_load_mapped_block(f, block);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
@@ -2927,10 +4688,19 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
 
         case RAM_SAVE_FLAG_ZERO:
             ch = qemu_get_byte(f);
+            if (load_threads.count) {
+                load_page_with_threads(f, LOAD_JOB_ZERO, host, addr, ch);
+                break;
+            }
             ram_handle_compressed(host, ch, TARGET_PAGE_SIZE);
             break;
 
         case RAM_SAVE_FLAG_PAGE:
+            if (load_threads.count) {
+                load_page_with_threads(f, LOAD_JOB_PAGE, host, addr,
+                                       TARGET_PAGE_SIZE);
+                break;
+            }
             qemu_get_buffer(f, host, TARGET_PAGE_SIZE);
             break;
 
@@ -2941,10 +4711,23 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
                 ret = -EINVAL;
                 break;
             }
+            if (load_threads.count) {
+                load_page_with_threads(f, LOAD_JOB_COMPRESS, host, addr, len);
+                break;
+            }
             decompress_data_with_multi_threads(f, host, len);
             break;
 
         case RAM_SAVE_FLAG_XBZRLE:
+            if (load_threads.count) {
+                len = load_xbzrle_header(f);
+                if (len < 0) {
+                    ret = -EINVAL;
+                    break;
+                }
+                load_page_with_threads(f, LOAD_JOB_XBZRLE, host, addr, len);
+                break;
+            }
             if (load_xbzrle(f, addr, host) < 0) {
                 error_report("Failed to decompress XBZRLE page at "
                              RAM_ADDR_FMT, addr);
@@ -2969,6 +4752,11 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
         }
     }
 
+    if (load_threads.count) {
+        int load_ret = wait_for_load_threads();
+
+        ret = ret ? ret : load_ret;
+    }
     wait_for_decompress_done();
     rcu_read_unlock();
     trace_ram_load_complete(ret, seq_iter);
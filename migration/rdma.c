@@ -71,12 +71,21 @@
  * Capabilities for negotiation.
  */
 #define RDMA_CAPABILITY_PIN_ALL 0x01
+/* The destination answers a multi-chunk REGISTER_REQUEST with all rkeys */
+#define RDMA_CAPABILITY_REG_BATCH 0x02
 
 /*
  * Add the other flags above to this list of known capabilities
  * as they are introduced.
  */
-static uint32_t known_capabilities = RDMA_CAPABILITY_PIN_ALL;
+static uint32_t known_capabilities = RDMA_CAPABILITY_PIN_ALL |
+                                     RDMA_CAPABILITY_REG_BATCH;
+
+/*
+ * Maximum number of chunks registered with one REGISTER_REQUEST when
+ * RDMA_CAPABILITY_REG_BATCH was negotiated.
+ */
+#define RDMA_REG_BATCH_MAX 32
 
 #define CHECK_ERROR_STATE() \
     do { \
@@ -336,6 +345,7 @@ typedef struct RDMAContext {
     int current_chunk;
 
     bool pin_all;
+    bool reg_batch;
 
     /*
      * infiniband-specific variables for opening the device
@@ -1934,7 +1944,11 @@ static int qemu_rdma_write_one(QEMUFile *f, RDMAContext *rdma,
     uint64_t chunk, chunks;
     uint8_t *chunk_start, *chunk_end;
     RDMALocalBlock *block = &(rdma->local_ram_blocks.block[current_index]);
-    RDMARegister reg;
+    RDMARegister reg[RDMA_REG_BATCH_MAX];
+    uint64_t reg_chunk[RDMA_REG_BATCH_MAX];
+    int nb_reg, i;
+    uint64_t next;
+    uint8_t *next_start;
     RDMARegisterResult *reg_result;
     RDMAControlHeader resp = { .type = RDMA_CONTROL_REGISTER_RESULT };
     RDMAControlHeader head = { .len = sizeof(RDMARegister),
@@ -2031,19 +2045,49 @@ retry:
             /*
              * Otherwise, tell other side to register.
              */
-            reg.current_index = current_index;
+            reg[0].current_index = current_index;
             if (block->is_ram_block) {
-                reg.key.current_addr = current_addr;
+                reg[0].key.current_addr = current_addr;
             } else {
-                reg.key.chunk = chunk;
+                reg[0].key.chunk = chunk;
+            }
+            reg[0].chunks = chunks;
+            reg_chunk[0] = chunk;
+            nb_reg = 1;
+
+            /*
+             * The first pass over RAM would otherwise wait for one control
+             * round trip per chunk.  If the destination can answer them,
+             * ask it to register the next few non-zero chunks of this RAM
+             * block as well; their rkeys stay cached in remote_keys.
+             */
+            for (next = chunk + chunks + 1;
+                 rdma->reg_batch && block->is_ram_block &&
+                 next < block->nb_chunks && nb_reg < RDMA_REG_BATCH_MAX;
+                 next++) {
+                next_start = ram_chunk_start(block, next);
+                if (block->remote_keys[next] ||
+                    buffer_is_zero(next_start,
+                                   ram_chunk_end(block, next) - next_start)) {
+                    continue;
+                }
+                reg[nb_reg].current_index = current_index;
+                reg[nb_reg].key.current_addr = block->offset +
+                    (next_start - block->local_host_addr);
+                reg[nb_reg].chunks = 0;
+                reg_chunk[nb_reg] = next;
+                nb_reg++;
             }
-            reg.chunks = chunks;
 
             trace_qemu_rdma_write_one_sendreg(chunk, sge.length, current_index,
                                               current_addr);
 
-            register_to_network(rdma, &reg);
-            ret = qemu_rdma_exchange_send(rdma, &head, (uint8_t *) &reg,
+            for (i = 0; i < nb_reg; i++) {
+                register_to_network(rdma, &reg[i]);
+            }
+            head.len = sizeof(RDMARegister) * nb_reg;
+            head.repeat = nb_reg;
+            ret = qemu_rdma_exchange_send(rdma, &head, (uint8_t *) reg,
                                     &resp, &reg_result_idx, NULL);
             if (ret < 0) {
                 return ret;
@@ -2060,12 +2104,20 @@ retry:
             reg_result = (RDMARegisterResult *)
                     rdma->wr_data[reg_result_idx].control_curr;
 
-            network_to_result(reg_result);
+            if (resp.len < sizeof(RDMARegisterResult) * nb_reg) {
+                error_report("rdma: short registration result: %d bytes "
+                             "for %d chunks", resp.len, nb_reg);
+                return -EINVAL;
+            }
+            for (i = 0; i < nb_reg; i++) {
+                network_to_result(&reg_result[i]);
 
-            trace_qemu_rdma_write_one_recvregres(block->remote_keys[chunk],
-                                                 reg_result->rkey, chunk);
+                trace_qemu_rdma_write_one_recvregres(
+                    block->remote_keys[reg_chunk[i]], reg_result[i].rkey,
+                    reg_chunk[i]);
 
-            block->remote_keys[chunk] = reg_result->rkey;
+                block->remote_keys[reg_chunk[i]] = reg_result[i].rkey;
+            }
             block->remote_host_addr = reg_result->host_addr;
         } else {
             /* already registered before */
@@ -2425,6 +2477,7 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp)
         trace_qemu_rdma_connect_pin_all_requested();
         cap.flags |= RDMA_CAPABILITY_PIN_ALL;
     }
+    cap.flags |= RDMA_CAPABILITY_REG_BATCH;
 
     caps_to_network(&cap);
 
@@ -2469,6 +2522,7 @@ static int qemu_rdma_connect(RDMAContext *rdma, Error **errp)
                         "Will register memory dynamically.");
         rdma->pin_all = false;
     }
+    rdma->reg_batch = !!(cap.flags & RDMA_CAPABILITY_REG_BATCH);
 
     trace_qemu_rdma_connect_pin_all_outcome(rdma->pin_all);
 
@@ -3298,6 +3352,7 @@ static int qemu_rdma_registration_handle(QEMUFile *f, void *opaque)
             trace_qemu_rdma_registration_handle_register(head.repeat);
 
             reg_resp.repeat = head.repeat;
+            reg_resp.len = sizeof(RDMARegisterResult) * head.repeat;
             registers = (RDMARegister *) rdma->wr_data[idx].control_curr;
 
             for (count = 0; count < head.repeat; count++) {
@@ -27,6 +27,43 @@
 #include "trace.h"
 
 
+static struct SocketOutgoingArgs {
+    SocketAddress *saddr;
+} outgoing_args;
+
+/**
+ * socket_send_channel_available: can extra channels be opened
+ *
+ * Returns true if the current outgoing migration goes over a socket,
+ * so socket_send_channel_create() can connect to the same address.
+ */
+bool socket_send_channel_available(void)
+{
+    return outgoing_args.saddr != NULL;
+}
+
+void socket_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelSocket *sioc = qio_channel_socket_new();
+    qio_channel_socket_connect_async(sioc, outgoing_args.saddr,
+                                     f, data, NULL);
+}
+
+int socket_send_channel_destroy(QIOChannel *send)
+{
+    /* Remove channel */
+    object_unref(OBJECT(send));
+    return 0;
+}
+
+void socket_outgoing_cleanup(void)
+{
+    if (outgoing_args.saddr) {
+        qapi_free_SocketAddress(outgoing_args.saddr);
+        outgoing_args.saddr = NULL;
+    }
+}
+
 static SocketAddress *tcp_build_address(const char *host_port, Error **errp)
 {
     SocketAddress *saddr;
@@ -106,7 +143,11 @@ static void socket_start_outgoing_migration(MigrationState *s,
                                      socket_outgoing_migration,
                                      data,
                                      socket_connect_data_free);
-    qapi_free_SocketAddress(saddr);
+    /* Keep the address around, multifd channels connect to it too */
+    if (outgoing_args.saddr) {
+        qapi_free_SocketAddress(outgoing_args.saddr);
+    }
+    outgoing_args.saddr = saddr;
 }
 
 void tcp_start_outgoing_migration(MigrationState *s,
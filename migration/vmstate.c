@@ -17,6 +17,7 @@
 #include "migration/savevm.h"
 #include "qemu-file.h"
 #include "qemu/bitops.h"
+#include "qemu/bswap.h"
 #include "qemu/error-report.h"
 #include "trace.h"
 #include "qjson.h"
@@ -75,6 +76,99 @@ static void vmstate_handle_alloc(void *ptr, VMStateField *field, void *opaque)
     }
 }
 
+/*
+ * Arrays of plain integers are the most common arrays in device state.
+ * They are moved in bulk rather than with one put/get call per element;
+ * the stream format is the same sequence of big endian values.
+ *
+ * Returns the element size if @field is such an array, 0 otherwise.
+ */
+static int vmstate_flat_elem_size(VMStateField *field, int n_elems, int size)
+{
+    const VMStateInfo *info = field->info;
+
+    if (n_elems < 2 || (field->flags & (VMS_STRUCT | VMS_ARRAY_OF_POINTER))) {
+        return 0;
+    }
+    if ((size == 1 && (info == &vmstate_info_uint8 ||
+                       info == &vmstate_info_int8)) ||
+        (size == 2 && (info == &vmstate_info_uint16 ||
+                       info == &vmstate_info_int16)) ||
+        (size == 4 && (info == &vmstate_info_uint32 ||
+                       info == &vmstate_info_int32)) ||
+        (size == 8 && (info == &vmstate_info_uint64 ||
+                       info == &vmstate_info_int64))) {
+        return size;
+    }
+    return 0;
+}
+
+#define VMSTATE_FLAT_BUF_SIZE 1024
+
+static void vmstate_put_flat(QEMUFile *f, uint8_t *elem, int n_elems,
+                             int size)
+{
+    uint8_t buf[VMSTATE_FLAT_BUF_SIZE];
+    int i, n;
+
+    if (size == 1) {
+        qemu_put_buffer(f, elem, n_elems);
+        return;
+    }
+
+    while (n_elems > 0) {
+        n = MIN(n_elems, VMSTATE_FLAT_BUF_SIZE / size);
+        for (i = 0; i < n; i++, elem += size) {
+            switch (size) {
+            case 2:
+                stw_be_p(buf + i * 2, lduw_he_p(elem));
+                break;
+            case 4:
+                stl_be_p(buf + i * 4, ldl_he_p(elem));
+                break;
+            default:
+                stq_be_p(buf + i * 8, ldq_he_p(elem));
+                break;
+            }
+        }
+        qemu_put_buffer(f, buf, n * size);
+        n_elems -= n;
+    }
+}
+
+static void vmstate_get_flat(QEMUFile *f, uint8_t *elem, int n_elems,
+                             int size)
+{
+    uint8_t buf[VMSTATE_FLAT_BUF_SIZE];
+    int i, n;
+
+    if (size == 1) {
+        qemu_get_buffer(f, elem, n_elems);
+        return;
+    }
+
+    while (n_elems > 0) {
+        n = MIN(n_elems, VMSTATE_FLAT_BUF_SIZE / size);
+        if (qemu_get_buffer(f, buf, n * size) != n * size) {
+            return;
+        }
+        for (i = 0; i < n; i++, elem += size) {
+            switch (size) {
+            case 2:
+                stw_he_p(elem, lduw_be_p(buf + i * 2));
+                break;
+            case 4:
+                stl_he_p(elem, ldl_be_p(buf + i * 4));
+                break;
+            default:
+                stq_he_p(elem, ldq_be_p(buf + i * 8));
+                break;
+            }
+        }
+        n_elems -= n;
+    }
+}
+
 int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                        void *opaque, int version_id)
 {
@@ -123,6 +217,18 @@ int vmstate_load_state(QEMUFile *f, const VMStateDescription *vmsd,
                 first_elem = *(void **)first_elem;
                 assert(first_elem || !n_elems || !size);
             }
+            if (vmstate_flat_elem_size(field, n_elems, size)) {
+                vmstate_get_flat(f, first_elem, n_elems, size);
+                ret = qemu_file_get_error(f);
+                if (ret < 0) {
+                    error_report("Failed to load %s:%s", vmsd->name,
+                                 field->name);
+                    trace_vmstate_load_field_error(field->name, ret);
+                    return ret;
+                }
+                field++;
+                continue;
+            }
             for (i = 0; i < n_elems; i++) {
                 void *curr_elem = first_elem + size * i;
 
@@ -345,6 +451,15 @@ int vmstate_save_state(QEMUFile *f, const VMStateDescription *vmsd,
                 first_elem = *(void **)first_elem;
                 assert(first_elem || !n_elems || !size);
             }
+            if (vmstate_flat_elem_size(field, n_elems, size) &&
+                (!vmdesc || vmsd_can_compress(field))) {
+                /* a compressed vmdesc entry describes only the first element */
+                vmsd_desc_field_start(vmsd, vmdesc, field, 0, n_elems);
+                vmstate_put_flat(f, first_elem, n_elems, size);
+                vmsd_desc_field_end(vmsd, vmdesc, field, size, 0);
+                field++;
+                continue;
+            }
             for (i = 0; i < n_elems; i++) {
                 void *curr_elem = first_elem + size * i;
                 ret = 0;
@@ -12,8 +12,243 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
+/*
+ * Run boundary scanning.
+ *
+ * xbzrle_find_ne returns the index of the first byte at or after @i
+ * where @old_buf and @new_buf differ (i.e. the end of a zrun), and
+ * xbzrle_find_eq the index of the first byte where they are equal
+ * (i.e. the end of an nzrun).  Both return @slen if there is none.
+ */
+static int
+xbzrle_find_ne_int(const uint8_t *old_buf, const uint8_t *new_buf,
+                   int i, int slen)
+{
+    /* not aligned to sizeof(long) */
+    while (i < slen && (i % sizeof(long))) {
+        if (old_buf[i] != new_buf[i]) {
+            return i;
+        }
+        i++;
+    }
+
+    /* word at a time for speed */
+    while (i < slen &&
+           (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
+        i += sizeof(long);
+    }
+
+    /* go over the rest */
+    while (i < slen && old_buf[i] == new_buf[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int
+xbzrle_find_eq_int(const uint8_t *old_buf, const uint8_t *new_buf,
+                   int i, int slen)
+{
+    /* truncation to 32-bit long okay */
+    unsigned long mask = (unsigned long)0x0101010101010101ULL;
+
+    /* not aligned to sizeof(long) */
+    while (i < slen && (i % sizeof(long))) {
+        if (old_buf[i] == new_buf[i]) {
+            return i;
+        }
+        i++;
+    }
+
+    /* word at a time for speed, use of 32-bit long okay */
+    while (i < slen) {
+        unsigned long xor;
+        xor = *(unsigned long *)(old_buf + i)
+            ^ *(unsigned long *)(new_buf + i);
+        if ((xor - mask) & ~xor & (mask << 7)) {
+            /* found the end of an nzrun within the current long */
+            while (old_buf[i] != new_buf[i]) {
+                i++;
+            }
+            break;
+        }
+        i += sizeof(long);
+    }
+    return i;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
+/* The vectorized scanners handle as many full vectors as they can
+ * and leave the tail, which is always a multiple of sizeof(long),
+ * to the integer versions.  As in util/bufferiszero.c, the intrinsic
+ * headers have to be included within the push_options regions, and
+ * the regions ordered with increasing ISA.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static int
+xbzrle_find_ne_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                    int i, int slen)
+{
+    while (i + 32 <= slen) {
+        __m256i o = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i n = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t ne = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(o, n));
+
+        if (ne) {
+            return i + ctz32(ne);
+        }
+        i += 32;
+    }
+    return xbzrle_find_ne_int(old_buf, new_buf, i, slen);
+}
+
+static int
+xbzrle_find_eq_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                    int i, int slen)
+{
+    while (i + 32 <= slen) {
+        __m256i o = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i n = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(o, n));
+
+        if (eq) {
+            return i + ctz32(eq);
+        }
+        i += 32;
+    }
+    return xbzrle_find_eq_int(old_buf, new_buf, i, slen);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512BW_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512bw")
+#include <immintrin.h>
+
+static int
+xbzrle_find_ne_avx512bw(const uint8_t *old_buf, const uint8_t *new_buf,
+                        int i, int slen)
+{
+    while (i + 64 <= slen) {
+        __m512i o = _mm512_loadu_si512(old_buf + i);
+        __m512i n = _mm512_loadu_si512(new_buf + i);
+        uint64_t ne = ~(uint64_t)_mm512_cmpeq_epi8_mask(o, n);
+
+        if (ne) {
+            return i + ctz64(ne);
+        }
+        i += 64;
+    }
+    return xbzrle_find_ne_int(old_buf, new_buf, i, slen);
+}
+
+static int
+xbzrle_find_eq_avx512bw(const uint8_t *old_buf, const uint8_t *new_buf,
+                        int i, int slen)
+{
+    while (i + 64 <= slen) {
+        __m512i o = _mm512_loadu_si512(old_buf + i);
+        __m512i n = _mm512_loadu_si512(new_buf + i);
+        uint64_t eq = _mm512_cmpeq_epi8_mask(o, n);
+
+        if (eq) {
+            return i + ctz64(eq);
+        }
+        i += 64;
+    }
+    return xbzrle_find_eq_int(old_buf, new_buf, i, slen);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512BW_OPT */
+
+/* Note that for test_xbzrle_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX512BW 1
+#define CACHE_AVX2     2
+
+static unsigned cpuid_cache;
+static int (*xbzrle_find_ne)(const uint8_t *, const uint8_t *, int, int) =
+    xbzrle_find_ne_int;
+static int (*xbzrle_find_eq)(const uint8_t *, const uint8_t *, int, int) =
+    xbzrle_find_eq_int;
+
+static void init_accel(unsigned cache)
+{
+    xbzrle_find_ne = xbzrle_find_ne_int;
+    xbzrle_find_eq = xbzrle_find_eq_int;
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        xbzrle_find_ne = xbzrle_find_ne_avx2;
+        xbzrle_find_eq = xbzrle_find_eq_avx2;
+    }
+#endif
+#ifdef CONFIG_AVX512BW_OPT
+    if (cache & CACHE_AVX512BW) {
+        xbzrle_find_ne = xbzrle_find_ne_avx512bw;
+        xbzrle_find_eq = xbzrle_find_eq_avx512bw;
+    }
+#endif
+}
+
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+            /* AVX-512 also needs the opmask and ZMM state enabled.  */
+            if ((bv & 0xe6) == 0xe6 && (b & bit_AVX512BW)) {
+                cache |= CACHE_AVX512BW;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+
+bool test_xbzrle_next_accel(void)
+{
+    /* If no bits set, we just tested the integer scanners, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+#else
+#define xbzrle_find_ne xbzrle_find_ne_int
+#define xbzrle_find_eq xbzrle_find_eq_int
+bool test_xbzrle_next_accel(void)
+{
+    return false;
+}
+#endif
+
 /*
   page = zrun nzrun
        | zrun nzrun page
@@ -28,9 +263,7 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
-    int d = 0, i = 0;
-    long res;
-    uint8_t *nzrun_start = NULL;
+    int d = 0, i = 0, end;
 
     g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
                sizeof(long)));
@@ -41,28 +274,9 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
             return -1;
         }
 
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] == new_buf[i]) {
-            zrun_len++;
-            i++;
-            res--;
-        }
-
-        /* word at a time for speed */
-        if (!res) {
-            while (i < slen &&
-                   (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
-                i += sizeof(long);
-                zrun_len += sizeof(long);
-            }
-
-            /* go over the rest */
-            while (i < slen && old_buf[i] == new_buf[i]) {
-                zrun_len++;
-                i++;
-            }
-        }
+        end = xbzrle_find_ne(old_buf, new_buf, i, slen);
+        zrun_len = end - i;
+        i = end;
 
         /* buffer unchanged */
         if (zrun_len == slen) {
@@ -76,51 +290,22 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
         d += uleb128_encode_small(dst + d, zrun_len);
 
-        zrun_len = 0;
-        nzrun_start = new_buf + i;
-
         /* overflow */
         if (d + 2 > dlen) {
             return -1;
         }
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] != new_buf[i]) {
-            i++;
-            nzrun_len++;
-            res--;
-        }
-
-        /* word at a time for speed, use of 32-bit long okay */
-        if (!res) {
-            /* truncation to 32-bit long okay */
-            unsigned long mask = (unsigned long)0x0101010101010101ULL;
-            while (i < slen) {
-                unsigned long xor;
-                xor = *(unsigned long *)(old_buf + i)
-                    ^ *(unsigned long *)(new_buf + i);
-                if ((xor - mask) & ~xor & (mask << 7)) {
-                    /* found the end of an nzrun within the current long */
-                    while (old_buf[i] != new_buf[i]) {
-                        nzrun_len++;
-                        i++;
-                    }
-                    break;
-                } else {
-                    i += sizeof(long);
-                    nzrun_len += sizeof(long);
-                }
-            }
-        }
+
+        end = xbzrle_find_eq(old_buf, new_buf, i, slen);
+        nzrun_len = end - i;
 
         d += uleb128_encode_small(dst + d, nzrun_len);
         /* overflow */
         if (d + nzrun_len > dlen) {
             return -1;
         }
-        memcpy(dst + d, nzrun_start, nzrun_len);
+        memcpy(dst + d, new_buf + i, nzrun_len);
         d += nzrun_len;
-        nzrun_len = 0;
+        i = end;
     }
 
     return d;
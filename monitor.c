@@ -1127,6 +1127,18 @@ static void hmp_info_opcount(Monitor *mon, const QDict *qdict)
 {
     dump_opcount_info((FILE *)mon, monitor_fprintf);
 }
+
+static void hmp_info_tb_hot(Monitor *mon, const QDict *qdict)
+{
+    int count = qdict_get_try_int(qdict, "count", 10);
+
+    if (!tcg_enabled()) {
+        error_report("JIT information is only available with accel=tcg");
+        return;
+    }
+
+    dump_hot_tb_info((FILE *)mon, monitor_fprintf, count);
+}
 #endif
 
 static void hmp_info_history(Monitor *mon, const QDict *qdict)
@@ -19,9 +19,19 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "block/block_int.h"
 #include "trace.h"
 #include "nbd-internal.h"
 
+#define NBD_META_ID_BASE_ALLOCATION 0
+#define NBD_META_ID_DIRTY_BITMAP 1
+
+/* NBD_MAX_BLOCK_STATUS_EXTENTS: 1 mb of extents data. An empirical
+ * constant. If an increase is needed, note that the NBD protocol
+ * recommends no larger than 32 mb, so that the client won't consider
+ * the reply as a denial of service attack. */
+#define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * 1024 * 1024 / sizeof(NBDExtent))
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -78,10 +88,25 @@ struct NBDExport {
 
     BlockBackend *eject_notifier_blk;
     Notifier eject_notifier;
+
+    BdrvDirtyBitmap *export_bitmap;
+    char *export_bitmap_context;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
 
+/* NBDExportMetaContexts represents a list of contexts to be exported,
+ * as selected by NBD_OPT_SET_META_CONTEXT. Also used for
+ * NBD_OPT_LIST_META_CONTEXT. */
+typedef struct NBDExportMetaContexts {
+    char export_name[NBD_MAX_NAME_SIZE + 1];
+    bool valid; /* means that negotiation of the option finished without
+                   errors */
+    NBDExport *exp;
+    bool base_allocation; /* export base:allocation context (block status) */
+    bool bitmap; /* export qemu:dirty-bitmap:<export bitmap name> */
+} NBDExportMetaContexts;
+
 struct NBDClient {
     int refcount;
     void (*close_fn)(NBDClient *client, bool negotiated);
@@ -102,6 +127,7 @@ struct NBDClient {
     bool closing;
 
     bool structured_reply;
+    NBDExportMetaContexts export_meta;
 
     uint32_t opt; /* Current option being negotiated */
     uint32_t optlen; /* remaining length of data in ioc for the option being
@@ -249,6 +275,62 @@ static int nbd_opt_read(NBDClient *client, void *buffer, size_t size,
     return qio_channel_read_all(client->ioc, buffer, size, errp) < 0 ? -EIO : 1;
 }
 
+/* Drop size bytes from the unparsed payload of the current option.
+ * Return -errno on I/O error, 0 if option was completely handled by
+ * sending a reply about inconsistent lengths, or 1 on success. */
+static int nbd_opt_skip(NBDClient *client, size_t size, Error **errp)
+{
+    if (size > client->optlen) {
+        return nbd_opt_drop(client, NBD_REP_ERR_INVALID, errp,
+                            "Inconsistent lengths in option %s",
+                            nbd_opt_lookup(client->opt));
+    }
+    client->optlen -= size;
+    return nbd_drop(client->ioc, size, errp) < 0 ? -EIO : 1;
+}
+
+/* nbd_opt_read_name
+ *
+ * Read a string with the format:
+ *   uint32_t len     (<= NBD_MAX_NAME_SIZE)
+ *   len bytes string (not 0-terminated)
+ *
+ * @name should be enough to store NBD_MAX_NAME_SIZE+1.
+ * If @length is non-null, it will be set to the actual string length.
+ *
+ * Return -errno on I/O error, 0 if option was completely handled by
+ * sending a reply about inconsistent lengths, or 1 on success.
+ */
+static int nbd_opt_read_name(NBDClient *client, char *name, uint32_t *length,
+                             Error **errp)
+{
+    int ret;
+    uint32_t len;
+
+    ret = nbd_opt_read(client, &len, sizeof(len), errp);
+    if (ret <= 0) {
+        return ret;
+    }
+    be32_to_cpus(&len);
+
+    if (len > NBD_MAX_NAME_SIZE) {
+        return nbd_opt_drop(client, NBD_REP_ERR_INVALID, errp,
+                            "Invalid name length: %" PRIu32, len);
+    }
+
+    ret = nbd_opt_read(client, name, len, errp);
+    if (ret <= 0) {
+        return ret;
+    }
+    name[len] = '\0';
+
+    if (length) {
+        *length = len;
+    }
+
+    return 1;
+}
+
 /* Send a single NBD_REP_SERVER reply to NBD_OPT_LIST, including payload.
  * Return -errno on error, 0 on success. */
 static int nbd_negotiate_send_rep_list(NBDClient *client, NBDExport *exp,
@@ -343,6 +425,9 @@ static int nbd_negotiate_handle_export_name(NBDClient *client,
         error_setg(errp, "export not found");
         return -EINVAL;
     }
+    if (strcmp(client->export_meta.export_name, name)) {
+        client->export_meta.valid = false;
+    }
 
     trace_nbd_negotiate_new_style_size_flags(client->exp->size,
                                              client->exp->nbdflags | myflags);
@@ -559,6 +644,9 @@ static int nbd_negotiate_handle_info(NBDClient *client, uint16_t myflags,
 
     if (client->opt == NBD_OPT_GO) {
         client->exp = exp;
+        if (strcmp(client->export_meta.export_name, name)) {
+            client->export_meta.valid = false;
+        }
         QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
         nbd_export_get(client->exp);
         rc = 1;
@@ -567,6 +655,312 @@ static int nbd_negotiate_handle_info(NBDClient *client, uint16_t myflags,
 }
 
 
+/* nbd_negotiate_send_meta_context
+ *
+ * Send one chunk of reply to NBD_OPT_{LIST,SET}_META_CONTEXT
+ *
+ * For NBD_OPT_LIST_META_CONTEXT @context_id is ignored, 0 is used instead.
+ */
+static int nbd_negotiate_send_meta_context(NBDClient *client,
+                                           const char *context,
+                                           uint32_t context_id,
+                                           Error **errp)
+{
+    NBDOptionReplyMetaContext opt;
+    struct iovec iov[] = {
+        {.iov_base = &opt, .iov_len = sizeof(opt)},
+        {.iov_base = (void *)context, .iov_len = strlen(context)}
+    };
+
+    if (client->opt == NBD_OPT_LIST_META_CONTEXT) {
+        context_id = 0;
+    }
+
+    trace_nbd_negotiate_meta_query_reply(context, context_id);
+    set_be_option_rep(&opt.h, client->opt, NBD_REP_META_CONTEXT,
+                      sizeof(opt) - sizeof(opt.h) + iov[1].iov_len);
+    stl_be_p(&opt.context_id, context_id);
+
+    return qio_channel_writev_all(client->ioc, iov, 2, errp) < 0 ? -EIO : 0;
+}
+
+/* nbd_meta_pattern
+ *
+ * Read @len bytes, and set @match to true if they match @pattern, or false
+ * otherwise.  A query that cannot match because of its length is skipped.
+ *
+ * Return -errno on I/O error, 0 if option was completely handled by
+ * sending a reply about inconsistent lengths, or 1 on success.
+ */
+static int nbd_meta_pattern(NBDClient *client, const char *pattern,
+                            uint32_t len, bool *match, Error **errp)
+{
+    int ret;
+    char *query;
+
+    *match = false;
+    if (len != strlen(pattern)) {
+        trace_nbd_negotiate_meta_query_skip("pattern not matched");
+        return nbd_opt_skip(client, len, errp);
+    }
+
+    query = g_malloc(len);
+    ret = nbd_opt_read(client, query, len, errp);
+    if (ret <= 0) {
+        g_free(query);
+        return ret;
+    }
+
+    if (strncmp(query, pattern, len) == 0) {
+        trace_nbd_negotiate_meta_query_parse(pattern);
+        *match = true;
+    } else {
+        trace_nbd_negotiate_meta_query_skip("pattern not matched");
+    }
+    g_free(query);
+
+    return 1;
+}
+
+/* nbd_meta_empty_or_pattern
+ *
+ * The remainder of the query is either empty, which selects every context
+ * of the namespace for NBD_OPT_LIST_META_CONTEXT, or must be @pattern.
+ * 'len' is the amount of text remaining to be read from the current name.
+ *
+ * Return -errno on I/O error, 0 if option was completely handled by
+ * sending a reply about inconsistent lengths, or 1 on success.
+ */
+static int nbd_meta_empty_or_pattern(NBDClient *client, const char *pattern,
+                                     uint32_t len, bool *match, Error **errp)
+{
+    if (len == 0) {
+        if (client->opt == NBD_OPT_LIST_META_CONTEXT) {
+            *match = true;
+        }
+        trace_nbd_negotiate_meta_query_parse("empty");
+        return 1;
+    }
+
+    return nbd_meta_pattern(client, pattern, len, match, errp);
+}
+
+/* nbd_meta_base_query
+ *
+ * Handle query to 'base' namespace. For now, only base:allocation context is
+ * available in it.  'len' is the amount of text remaining to be read from
+ * the current name, after the 'base:' portion has been stripped.
+ *
+ * Return -errno on I/O error, 0 if option was completely handled by
+ * sending a reply about inconsistent lengths, or 1 on success.
+ */
+static int nbd_meta_base_query(NBDClient *client, NBDExportMetaContexts *meta,
+                               uint32_t len, Error **errp)
+{
+    bool match;
+    int ret = nbd_meta_empty_or_pattern(client, "allocation", len, &match,
+                                        errp);
+
+    meta->base_allocation |= match;
+    return ret;
+}
+
+/* nbd_meta_qemu_query
+ *
+ * Handle query to 'qemu' namespace, which only contains the
+ * dirty-bitmap:<name> context of the bitmap exported with the export.
+ * 'len' is the amount of text remaining to be read from the current name,
+ * after the 'qemu:' portion has been stripped.
+ *
+ * Return -errno on I/O error, 0 if option was completely handled by
+ * sending a reply about inconsistent lengths, or 1 on success.
+ */
+static int nbd_meta_qemu_query(NBDClient *client, NBDExportMetaContexts *meta,
+                               uint32_t len, Error **errp)
+{
+    bool match;
+    size_t dirty_bitmap_len = strlen("dirty-bitmap:");
+    char query[sizeof("dirty-bitmap:") - 1];
+    int ret;
+
+    if (!meta->exp->export_bitmap) {
+        trace_nbd_negotiate_meta_query_skip("no dirty-bitmap exported");
+        return nbd_opt_skip(client, len, errp);
+    }
+
+    if (len == 0) {
+        if (client->opt == NBD_OPT_LIST_META_CONTEXT) {
+            meta->bitmap = true;
+        }
+        trace_nbd_negotiate_meta_query_parse("empty");
+        return 1;
+    }
+
+    if (len < dirty_bitmap_len) {
+        trace_nbd_negotiate_meta_query_skip("not dirty-bitmap:");
+        return nbd_opt_skip(client, len, errp);
+    }
+
+    len -= dirty_bitmap_len;
+    ret = nbd_opt_read(client, query, dirty_bitmap_len, errp);
+    if (ret <= 0) {
+        return ret;
+    }
+    if (strncmp(query, "dirty-bitmap:", dirty_bitmap_len) != 0) {
+        trace_nbd_negotiate_meta_query_skip("not dirty-bitmap:");
+        return nbd_opt_skip(client, len, errp);
+    }
+
+    ret = nbd_meta_empty_or_pattern(client,
+                                    meta->exp->export_bitmap_context +
+                                    strlen("qemu:dirty-bitmap:"),
+                                    len, &match, errp);
+    meta->bitmap |= match;
+    return ret;
+}
+
+/* nbd_negotiate_meta_query
+ *
+ * Parse namespace name and call corresponding function to parse body of the
+ * query.
+ *
+ * The supported namespaces are 'base' and 'qemu'.  Both names have the
+ * same length, which lets us read the namespace in one go.
+ *
+ * The function aims not wasting time and memory to read long unknown namespace
+ * names.
+ *
+ * Return -errno on I/O error, 0 if option was completely handled by
+ * sending a reply about inconsistent lengths, or 1 on success. */
+static int nbd_negotiate_meta_query(NBDClient *client,
+                                    NBDExportMetaContexts *meta, Error **errp)
+{
+    int ret;
+    char ns[sizeof("base:") - 1];
+    size_t nslen = strlen("base:");
+    uint32_t len;
+
+    QEMU_BUILD_BUG_ON(sizeof("base:") != sizeof("qemu:"));
+
+    ret = nbd_opt_read(client, &len, sizeof(len), errp);
+    if (ret <= 0) {
+        return ret;
+    }
+    be32_to_cpus(&len);
+
+    if (len < nslen) {
+        trace_nbd_negotiate_meta_query_skip("length too short");
+        return nbd_opt_skip(client, len, errp);
+    }
+
+    len -= nslen;
+    ret = nbd_opt_read(client, ns, nslen, errp);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    if (!strncmp(ns, "base:", nslen)) {
+        trace_nbd_negotiate_meta_query_parse("base:");
+        return nbd_meta_base_query(client, meta, len, errp);
+    } else if (!strncmp(ns, "qemu:", nslen)) {
+        trace_nbd_negotiate_meta_query_parse("qemu:");
+        return nbd_meta_qemu_query(client, meta, len, errp);
+    }
+
+    trace_nbd_negotiate_meta_query_skip("unknown namespace");
+    return nbd_opt_skip(client, len, errp);
+}
+
+/* nbd_negotiate_meta_queries
+ * Handle NBD_OPT_LIST_META_CONTEXT and NBD_OPT_SET_META_CONTEXT
+ *
+ * Return -errno on I/O error, or 0 if option was completely handled. */
+static int nbd_negotiate_meta_queries(NBDClient *client,
+                                      NBDExportMetaContexts *meta, Error **errp)
+{
+    int ret;
+    NBDExport *exp;
+    NBDExportMetaContexts local_meta;
+    uint32_t nb_queries;
+    int i;
+
+    if (!client->structured_reply) {
+        return nbd_opt_drop(client, NBD_REP_ERR_INVALID, errp,
+                            "request option '%s' when structured reply "
+                            "is not negotiated",
+                            nbd_opt_lookup(client->opt));
+    }
+
+    if (client->opt == NBD_OPT_LIST_META_CONTEXT) {
+        /* Only change the caller's meta on SET. */
+        meta = &local_meta;
+    }
+
+    memset(meta, 0, sizeof(*meta));
+
+    ret = nbd_opt_read_name(client, meta->export_name, NULL, errp);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    exp = nbd_export_find(meta->export_name);
+    if (exp == NULL) {
+        return nbd_opt_drop(client, NBD_REP_ERR_UNKNOWN, errp,
+                            "export '%s' not present", meta->export_name);
+    }
+    meta->exp = exp;
+
+    ret = nbd_opt_read(client, &nb_queries, sizeof(nb_queries), errp);
+    if (ret <= 0) {
+        return ret;
+    }
+    be32_to_cpus(&nb_queries);
+    trace_nbd_negotiate_meta_context(nbd_opt_lookup(client->opt),
+                                     meta->export_name, nb_queries);
+
+    if (client->opt == NBD_OPT_LIST_META_CONTEXT && !nb_queries) {
+        /* enable all known contexts */
+        meta->base_allocation = true;
+        meta->bitmap = !!exp->export_bitmap;
+    } else {
+        for (i = 0; i < nb_queries; ++i) {
+            ret = nbd_negotiate_meta_query(client, meta, errp);
+            if (ret <= 0) {
+                return ret;
+            }
+        }
+    }
+    if (client->optlen) {
+        return nbd_reject_length(client, false, errp);
+    }
+
+    if (meta->base_allocation) {
+        ret = nbd_negotiate_send_meta_context(client, "base:allocation",
+                                              NBD_META_ID_BASE_ALLOCATION,
+                                              errp);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    if (meta->bitmap) {
+        ret = nbd_negotiate_send_meta_context(client,
+                                              exp->export_bitmap_context,
+                                              NBD_META_ID_DIRTY_BITMAP,
+                                              errp);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    ret = nbd_negotiate_send_rep(client, NBD_REP_ACK, errp);
+    if (ret == 0) {
+        meta->valid = true;
+    }
+
+    return ret;
+}
+
 /* Handle NBD_OPT_STARTTLS. Return NULL to drop connection, or else the
  * new channel for all further (now-encrypted) communication. */
 static QIOChannel *nbd_negotiate_handle_starttls(NBDClient *client,
@@ -804,6 +1198,12 @@ static int nbd_negotiate_options(NBDClient *client, uint16_t myflags,
                 }
                 break;
 
+            case NBD_OPT_LIST_META_CONTEXT:
+            case NBD_OPT_SET_META_CONTEXT:
+                ret = nbd_negotiate_meta_queries(client, &client->export_meta,
+                                                 errp);
+                break;
+
             default:
                 ret = nbd_opt_drop(client, NBD_REP_ERR_UNSUP, errp,
                                    "Unsupported option 0x%" PRIx32 " (%s)",
@@ -1098,7 +1498,10 @@ NBDExport *nbd_export_new(BlockDriverState *bs, off_t dev_offset, off_t size,
     QTAILQ_INIT(&exp->clients);
     exp->blk = blk;
     exp->dev_offset = dev_offset;
-    exp->nbdflags = nbdflags;
+    /* All clients of an export share its BlockBackend, so a flush from
+     * one of them covers the writes completed by any other, and reads
+     * see them too: that is all that NBD_FLAG_CAN_MULTI_CONN promises. */
+    exp->nbdflags = nbdflags | NBD_FLAG_CAN_MULTI_CONN;
     exp->size = size < 0 ? blk_getlength(blk) : size;
     if (exp->size < 0) {
         error_setg_errno(errp, -exp->size,
@@ -1204,6 +1607,11 @@ void nbd_export_put(NBDExport *exp)
             exp->close(exp);
         }
 
+        if (exp->export_bitmap) {
+            bdrv_dirty_bitmap_set_qmp_locked(exp->export_bitmap, false);
+            g_free(exp->export_bitmap_context);
+        }
+
         if (exp->blk) {
             if (exp->eject_notifier_blk) {
                 notifier_remove(&exp->eject_notifier);
@@ -1219,6 +1627,59 @@ void nbd_export_put(NBDExport *exp)
     }
 }
 
+/* nbd_export_bitmap
+ * Make the dirty bitmap @bitmap available to the clients of @exp as the
+ * qemu:dirty-bitmap:@bitmap meta context.  The bitmap is looked up in the
+ * exported node and then in its backing chain, so that a point-in-time
+ * fleecing node can be exported together with the bitmap of its source.
+ * The bitmap is locked against modification by QMP until the export goes
+ * away. */
+void nbd_export_bitmap(NBDExport *exp, const char *bitmap, Error **errp)
+{
+    BdrvDirtyBitmap *bm = NULL;
+    BlockDriverState *bs = blk_bs(exp->blk);
+
+    if (exp->export_bitmap) {
+        error_setg(errp, "Export bitmap is already set");
+        return;
+    }
+
+    while (true) {
+        bm = bdrv_find_dirty_bitmap(bs, bitmap);
+        if (bm != NULL || bs->backing == NULL) {
+            break;
+        }
+
+        bs = bs->backing->bs;
+    }
+
+    if (bm == NULL) {
+        error_setg(errp, "Bitmap '%s' is not found", bitmap);
+        return;
+    }
+
+    if (bdrv_dirty_bitmap_frozen(bm)) {
+        error_setg(errp, "Bitmap '%s' is frozen", bitmap);
+        return;
+    }
+
+    if (bdrv_dirty_bitmap_qmp_locked(bm)) {
+        error_setg(errp, "Bitmap '%s' is locked", bitmap);
+        return;
+    }
+
+    if (strlen("qemu:dirty-bitmap:") + strlen(bitmap) > NBD_MAX_NAME_SIZE) {
+        error_setg(errp, "Bitmap name '%s' is too long to be exported",
+                   bitmap);
+        return;
+    }
+
+    bdrv_dirty_bitmap_set_qmp_locked(bm, true);
+    exp->export_bitmap = bm;
+    exp->export_bitmap_context = g_strdup_printf("qemu:dirty-bitmap:%s",
+                                                 bitmap);
+}
+
 BlockBackend *nbd_export_get_blockdev(NBDExport *exp)
 {
     return exp->blk;
@@ -1328,6 +1789,62 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
     return nbd_co_send_iov(client, iov, 2, errp);
 }
 
+/* nbd_co_send_read_direct
+ * Send the reply for @size bytes of the export at @offset (a simple reply, or
+ * an NBD_REPLY_TYPE_OFFSET_DATA chunk if structured replies are in use),
+ * letting the kernel move the data from the image file to the socket.  This
+ * saves the copy through req->data but needs a plain socket and a node
+ * supporting bdrv_co_sendfile(); otherwise return -ENOTSUP with nothing sent.
+ * After any other failure the reply may be incomplete, so the channel is
+ * shut down and the client must go away. */
+static int coroutine_fn nbd_co_send_read_direct(NBDClient *client,
+                                                uint64_t handle,
+                                                uint64_t offset,
+                                                size_t size,
+                                                bool final,
+                                                Error **errp)
+{
+    NBDExport *exp = client->exp;
+    NBDSimpleReply reply;
+    NBDStructuredReadData chunk;
+    struct iovec iov;
+    int ret;
+
+    /* TLS needs to see the data */
+    if (client->ioc != QIO_CHANNEL(client->sioc)) {
+        return -ENOTSUP;
+    }
+
+    if (client->structured_reply) {
+        set_be_chunk(&chunk.h, final ? NBD_REPLY_FLAG_DONE : 0,
+                     NBD_REPLY_TYPE_OFFSET_DATA, handle,
+                     sizeof(chunk) - sizeof(chunk.h) + size);
+        stq_be_p(&chunk.offset, offset);
+        iov.iov_base = &chunk;
+        iov.iov_len = sizeof(chunk);
+    } else {
+        set_be_simple_reply(&reply, 0, handle);
+        iov.iov_base = &reply;
+        iov.iov_len = sizeof(reply);
+    }
+
+    qemu_co_mutex_lock(&client->send_lock);
+    ret = blk_co_sendfile(exp->blk, offset + exp->dev_offset, size,
+                          client->sioc->fd, &iov, 1);
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    if (ret == -ENOTSUP) {
+        return ret;
+    }
+
+    trace_nbd_co_send_read_direct(handle, offset, size, ret);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "sending data from file failed");
+        qio_channel_shutdown(client->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+    }
+    return ret;
+}
+
 static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                                                 uint64_t handle,
                                                 uint64_t offset,
@@ -1342,7 +1859,8 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
     while (progress < size) {
         int64_t pnum;
         int status = bdrv_block_status_above(blk_bs(exp->blk), NULL,
-                                             offset + progress,
+                                             offset + progress +
+                                             exp->dev_offset,
                                              size - progress, &pnum, NULL,
                                              NULL);
         bool final;
@@ -1368,15 +1886,20 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
             stl_be_p(&chunk.length, pnum);
             ret = nbd_co_send_iov(client, iov, 1, errp);
         } else {
-            ret = blk_pread(exp->blk, offset + progress + exp->dev_offset,
-                            data + progress, pnum);
-            if (ret < 0) {
-                error_setg_errno(errp, -ret, "reading from file failed");
-                break;
+            ret = nbd_co_send_read_direct(client, handle, offset + progress,
+                                          pnum, final, errp);
+            if (ret == -ENOTSUP) {
+                ret = blk_pread(exp->blk, offset + progress + exp->dev_offset,
+                                data + progress, pnum);
+                if (ret < 0) {
+                    error_setg_errno(errp, -ret, "reading from file failed");
+                    break;
+                }
+                ret = nbd_co_send_structured_read(client, handle,
+                                                  offset + progress,
+                                                  data + progress, pnum,
+                                                  final, errp);
             }
-            ret = nbd_co_send_structured_read(client, handle, offset + progress,
-                                              data + progress, pnum, final,
-                                              errp);
         }
 
         if (ret < 0) {
@@ -1387,6 +1910,180 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
     return ret;
 }
 
+/* blockstatus_to_extents
+ * Describe the allocation status of @bytes bytes of @bs at @offset in at
+ * most @nb_extents entries of @extents, merging neighbouring ranges with
+ * the same status.  The extents are returned in network byte order.
+ * Return the number of extents filled in, or -errno on failure. */
+static int blockstatus_to_extents(BlockDriverState *bs, uint64_t offset,
+                                  uint64_t bytes, NBDExtent *extents,
+                                  unsigned int nb_extents)
+{
+    unsigned int i = 0;
+
+    while (bytes) {
+        uint32_t flags;
+        int64_t num;
+        int ret = bdrv_block_status_above(bs, NULL, offset, bytes, &num,
+                                          NULL, NULL);
+
+        if (ret < 0) {
+            return ret;
+        }
+
+        flags = (ret & BDRV_BLOCK_DATA ? 0 : NBD_STATE_HOLE) |
+                (ret & BDRV_BLOCK_ZERO ? NBD_STATE_ZERO : 0);
+
+        if (i && extents[i - 1].flags == flags) {
+            extents[i - 1].length += num;
+        } else {
+            if (i == nb_extents) {
+                break;
+            }
+            extents[i].flags = flags;
+            extents[i].length = num;
+            i++;
+        }
+
+        offset += num;
+        bytes -= num;
+    }
+
+    for (nb_extents = 0; nb_extents < i; nb_extents++) {
+        cpu_to_be32s(&extents[nb_extents].flags);
+        cpu_to_be32s(&extents[nb_extents].length);
+    }
+
+    return i;
+}
+
+/* nbd_co_send_extents
+ * @extents should be in big-endian */
+static int coroutine_fn nbd_co_send_extents(NBDClient *client,
+                                            uint64_t handle,
+                                            NBDExtent *extents,
+                                            unsigned int nb_extents,
+                                            bool last, uint32_t context_id,
+                                            Error **errp)
+{
+    NBDStructuredMeta chunk;
+
+    struct iovec iov[] = {
+        {.iov_base = &chunk, .iov_len = sizeof(chunk)},
+        {.iov_base = extents, .iov_len = nb_extents * sizeof(extents[0])}
+    };
+
+    trace_nbd_co_send_extents(handle, nb_extents, context_id);
+    set_be_chunk(&chunk.h, last ? NBD_REPLY_FLAG_DONE : 0,
+                 NBD_REPLY_TYPE_BLOCK_STATUS,
+                 handle, sizeof(chunk) - sizeof(chunk.h) + iov[1].iov_len);
+    stl_be_p(&chunk.context_id, context_id);
+
+    return nbd_co_send_iov(client, iov, 2, errp);
+}
+
+/* Get block status from the exported device and send it to the client */
+static int coroutine_fn nbd_co_send_block_status(NBDClient *client,
+                                                 uint64_t handle,
+                                                 BlockDriverState *bs,
+                                                 uint64_t offset,
+                                                 uint32_t length,
+                                                 bool dont_fragment,
+                                                 bool last,
+                                                 uint32_t context_id,
+                                                 Error **errp)
+{
+    int ret;
+    unsigned int nb_extents = dont_fragment ? 1 : NBD_MAX_BLOCK_STATUS_EXTENTS;
+    NBDExtent *extents = g_new(NBDExtent, nb_extents);
+
+    ret = blockstatus_to_extents(bs, offset, length, extents, nb_extents);
+    if (ret < 0) {
+        g_free(extents);
+        error_setg_errno(errp, -ret, "can't get block status");
+        return ret;
+    }
+
+    ret = nbd_co_send_extents(client, handle, extents, ret, last, context_id,
+                              errp);
+    g_free(extents);
+
+    return ret;
+}
+
+/* bitmap_to_extents
+ * Describe the dirty state of @length bytes of @bitmap at @offset in at most
+ * @nb_extents entries of @extents, in network byte order.  Dirty and clean
+ * ranges are found by hopping between bdrv_dirty_bitmap_next_zero() and the
+ * dirty bitmap iterator, so the cost depends on the number of extents rather
+ * than on the number of clusters.  Return the number of extents filled. */
+static unsigned int bitmap_to_extents(BdrvDirtyBitmap *bitmap, uint64_t offset,
+                                      uint64_t length, NBDExtent *extents,
+                                      unsigned int nb_extents)
+{
+    uint64_t begin = offset, end;
+    uint64_t overall_end = offset + length;
+    uint64_t size = bdrv_dirty_bitmap_size(bitmap);
+    int64_t next;
+    unsigned int i = 0;
+    BdrvDirtyBitmapIter *it;
+    bool dirty;
+
+    bdrv_dirty_bitmap_lock(bitmap);
+
+    it = bdrv_dirty_iter_new(bitmap);
+    dirty = offset < size && bdrv_get_dirty_locked(NULL, bitmap, offset);
+
+    /* A bitmap of a smaller backing node is clean beyond its end */
+    while (begin < overall_end && i < nb_extents) {
+        if (dirty) {
+            next = bdrv_dirty_bitmap_next_zero(bitmap, begin);
+            if (next < 0) {
+                next = size;
+            }
+        } else if (begin < size) {
+            bdrv_set_dirty_iter(it, begin);
+            next = bdrv_dirty_iter_next(it);
+        } else {
+            next = -1;
+        }
+        end = next < 0 ? overall_end : MIN(next, overall_end);
+
+        extents[i].length = cpu_to_be32(end - begin);
+        extents[i].flags = cpu_to_be32(dirty ? NBD_STATE_DIRTY : 0);
+        i++;
+        begin = end;
+        dirty = !dirty;
+    }
+
+    bdrv_dirty_iter_free(it);
+
+    bdrv_dirty_bitmap_unlock(bitmap);
+
+    return i;
+}
+
+static int coroutine_fn nbd_co_send_bitmap(NBDClient *client, uint64_t handle,
+                                           BdrvDirtyBitmap *bitmap,
+                                           uint64_t offset, uint32_t length,
+                                           bool dont_fragment, bool last,
+                                           uint32_t context_id, Error **errp)
+{
+    int ret;
+    unsigned int nb_extents = dont_fragment ? 1 : NBD_MAX_BLOCK_STATUS_EXTENTS;
+    NBDExtent *extents = g_new(NBDExtent, nb_extents);
+
+    nb_extents = bitmap_to_extents(bitmap, offset, length, extents,
+                                   nb_extents);
+
+    ret = nbd_co_send_extents(client, handle, extents, nb_extents, last,
+                              context_id, errp);
+
+    g_free(extents);
+
+    return ret;
+}
+
 static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
                                                      uint64_t handle,
                                                      uint32_t error,
@@ -1488,6 +2185,8 @@ static int nbd_co_receive_request(NBDRequestData *req, NBDRequest *request,
         valid_flags |= NBD_CMD_FLAG_DF;
     } else if (request->type == NBD_CMD_WRITE_ZEROES) {
         valid_flags |= NBD_CMD_FLAG_NO_HOLE;
+    } else if (request->type == NBD_CMD_BLOCK_STATUS) {
+        valid_flags |= NBD_CMD_FLAG_REQ_ONE;
     }
     if (request->flags & ~valid_flags) {
         error_setg(errp, "unsupported flags for command %s (got 0x%x)",
@@ -1559,6 +2258,17 @@ static coroutine_fn void nbd_trip(void *opaque)
             goto done;
         }
 
+        if (request.len) {
+            ret = nbd_co_send_read_direct(req->client, request.handle,
+                                          request.from, request.len, true,
+                                          &local_err);
+            if (ret == 0) {
+                goto done;
+            } else if (ret != -ENOTSUP) {
+                goto disconnect;
+            }
+        }
+
         ret = blk_pread(exp->blk, request.from + exp->dev_offset,
                         req->data, request.len);
         if (ret < 0) {
@@ -1615,6 +2325,46 @@ static coroutine_fn void nbd_trip(void *opaque)
         }
 
         break;
+    case NBD_CMD_BLOCK_STATUS:
+        if (!request.len) {
+            error_setg(&local_err, "need non-zero length");
+            ret = -EINVAL;
+            break;
+        }
+        if (!client->export_meta.valid ||
+            (!client->export_meta.base_allocation &&
+             !client->export_meta.bitmap)) {
+            error_setg(&local_err, "CMD_BLOCK_STATUS not negotiated");
+            ret = -EINVAL;
+            break;
+        }
+
+        if (client->export_meta.base_allocation) {
+            ret = nbd_co_send_block_status(req->client, request.handle,
+                                           blk_bs(exp->blk),
+                                           request.from + exp->dev_offset,
+                                           request.len,
+                                           request.flags & NBD_CMD_FLAG_REQ_ONE,
+                                           !client->export_meta.bitmap,
+                                           NBD_META_ID_BASE_ALLOCATION,
+                                           &local_err);
+            if (ret < 0) {
+                goto reply;
+            }
+        }
+        if (client->export_meta.bitmap) {
+            ret = nbd_co_send_bitmap(req->client, request.handle,
+                                     exp->export_bitmap,
+                                     request.from + exp->dev_offset,
+                                     request.len,
+                                     request.flags & NBD_CMD_FLAG_REQ_ONE,
+                                     true, NBD_META_ID_DIRTY_BITMAP,
+                                     &local_err);
+            if (ret < 0) {
+                goto reply;
+            }
+        }
+        goto done;
     default:
         error_setg(&local_err, "invalid request type (%" PRIu32 ") received",
                    request.type);
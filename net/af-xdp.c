@@ -0,0 +1,666 @@
+/*
+ * AF_XDP network backend
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#include "net/net.h"
+#include "clients.h"
+#include "block/aio.h"
+#include "qemu/atomic.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qapi/error.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/*
+ * Each socket has its own UMEM.  The first AF_XDP_RING_SIZE frames only
+ * ever go back and forth between the fill and RX rings: a packet is copied
+ * out (or queued, which copies it too) as soon as it is seen, so its frame
+ * can be refilled right away and the NIC never runs dry because the guest
+ * is slow to post buffers.  The other half is a free list for TX, which
+ * frames leave through the TX ring and rejoin from the completion ring.
+ */
+#define AF_XDP_FRAME_SIZE   4096
+#define AF_XDP_RING_SIZE    2048
+#define AF_XDP_NUM_FRAMES   (2 * AF_XDP_RING_SIZE)
+
+/* Packets handed to the peer in one call, and per invocation of the reader */
+#define AF_XDP_BATCH        32
+#define AF_XDP_RX_BUDGET    256
+
+typedef struct AFXDPRing {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *ring;
+    void *map;
+    size_t map_size;
+} AFXDPRing;
+
+typedef struct AFXDPState {
+    NetClientState nc;
+    int fd;
+    int link_fd;                /* keeps our XDP program attached, or -1 */
+    char ifname[IFNAMSIZ];
+    uint32_t queue_id;
+    void *umem;
+    AFXDPRing rx;
+    AFXDPRing tx;
+    AFXDPRing fq;
+    AFXDPRing cq;
+    uint64_t tx_free[AF_XDP_RING_SIZE];
+    uint32_t n_tx_free;
+    bool read_poll;
+    bool write_poll;
+    AioContext *ctx;            /* NULL when polled by the main loop */
+} AFXDPState;
+
+/* Entries that the kernel has produced for us */
+static inline uint32_t af_xdp_ring_avail(AFXDPRing *r)
+{
+    return atomic_load_acquire(r->producer) - atomic_read(r->consumer);
+}
+
+/* Entries that we may produce for the kernel */
+static inline uint32_t af_xdp_ring_space(AFXDPRing *r)
+{
+    return AF_XDP_RING_SIZE -
+           (atomic_read(r->producer) - atomic_load_acquire(r->consumer));
+}
+
+static inline bool af_xdp_ring_needs_wakeup(AFXDPRing *r)
+{
+    return atomic_read(r->flags) & XDP_RING_NEED_WAKEUP;
+}
+
+static void af_xdp_fq_submit(AFXDPState *s, const uint64_t *addrs, uint32_t n)
+{
+    uint64_t *ring = s->fq.ring;
+    uint32_t prod = atomic_read(s->fq.producer);
+    uint32_t i;
+
+    /* Only RX frames go to the fill ring, and there is room for all */
+    assert(af_xdp_ring_space(&s->fq) >= n);
+    for (i = 0; i < n; i++) {
+        ring[(prod + i) & (AF_XDP_RING_SIZE - 1)] = addrs[i];
+    }
+    atomic_store_release(s->fq.producer, prod + n);
+}
+
+static void af_xdp_complete_tx(AFXDPState *s)
+{
+    uint64_t *ring = s->cq.ring;
+    uint32_t cons = atomic_read(s->cq.consumer);
+    uint32_t n = af_xdp_ring_avail(&s->cq);
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        s->tx_free[s->n_tx_free++] = ring[(cons + i) & (AF_XDP_RING_SIZE - 1)];
+    }
+    if (n) {
+        atomic_store_release(s->cq.consumer, cons + n);
+    }
+}
+
+static void af_xdp_send(void *opaque);
+static void af_xdp_writable(void *opaque);
+static void af_xdp_aio_send(void *opaque);
+static void af_xdp_aio_writable(void *opaque);
+static bool af_xdp_aio_poll(void *opaque);
+
+static void af_xdp_update_fd_handler(AFXDPState *s)
+{
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false,
+                           s->read_poll ? af_xdp_aio_send : NULL,
+                           s->write_poll ? af_xdp_aio_writable : NULL,
+                           s->read_poll ? af_xdp_aio_poll : NULL, s);
+        return;
+    }
+
+    qemu_set_fd_handler(s->fd,
+                        s->read_poll ? af_xdp_send : NULL,
+                        s->write_poll ? af_xdp_writable : NULL,
+                        s);
+}
+
+static void af_xdp_read_poll(AFXDPState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_write_poll(AFXDPState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_poll(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->read_poll != enable || s->write_poll != enable) {
+        s->read_poll = enable;
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    af_xdp_write_poll(s, false);
+    af_xdp_complete_tx(s);
+    qemu_flush_queued_packets(&s->nc);
+}
+
+static void af_xdp_send_completed(NetClientState *nc, ssize_t len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    af_xdp_read_poll(s, true);
+}
+
+static void af_xdp_send(void *opaque)
+{
+    AFXDPState *s = opaque;
+    struct xdp_desc *ring = s->rx.ring;
+    struct iovec iov[AF_XDP_BATCH];
+    uint64_t addrs[AF_XDP_BATCH];
+    int packets = 0;
+
+    while (packets < AF_XDP_RX_BUDGET) {
+        uint32_t n = MIN(af_xdp_ring_avail(&s->rx), AF_XDP_BATCH);
+        uint32_t cons = atomic_read(s->rx.consumer);
+        uint32_t i;
+        ssize_t ret;
+
+        if (!n) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            struct xdp_desc *desc = &ring[(cons + i) & (AF_XDP_RING_SIZE - 1)];
+
+            iov[i].iov_base = s->umem + desc->addr;
+            iov[i].iov_len = desc->len;
+            addrs[i] = desc->addr & ~(uint64_t)(AF_XDP_FRAME_SIZE - 1);
+        }
+
+        ret = qemu_send_packet_batch_async(&s->nc, iov, n,
+                                           af_xdp_send_completed);
+
+        /* Whatever was not delivered has been copied into the queue */
+        atomic_store_release(s->rx.consumer, cons + n);
+        af_xdp_fq_submit(s, addrs, n);
+        packets += n;
+
+        if (ret == 0) {
+            af_xdp_read_poll(s, false);
+            break;
+        }
+    }
+
+    if (packets && af_xdp_ring_needs_wakeup(&s->fq)) {
+        recvfrom(s->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+}
+
+/*
+ * Outside the main loop the handlers run under the AioContext lock, which
+ * is also what the peer and af_xdp_set_aio_context() use to exclude them.
+ */
+static void af_xdp_aio_send(void *opaque)
+{
+    AFXDPState *s = opaque;
+    AioContext *ctx = atomic_read(&s->ctx);
+
+    if (!ctx) {
+        return;
+    }
+    aio_context_acquire(ctx);
+    if (atomic_read(&s->ctx) == ctx) {
+        af_xdp_send(s);
+    }
+    aio_context_release(ctx);
+}
+
+static void af_xdp_aio_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+    AioContext *ctx = atomic_read(&s->ctx);
+
+    if (!ctx) {
+        return;
+    }
+    aio_context_acquire(ctx);
+    if (atomic_read(&s->ctx) == ctx) {
+        af_xdp_writable(s);
+    }
+    aio_context_release(ctx);
+}
+
+/* Busy polling only has to look at the RX ring, no system call needed */
+static bool af_xdp_aio_poll(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    if (!af_xdp_ring_avail(&s->rx)) {
+        return false;
+    }
+    af_xdp_aio_send(s);
+    return true;
+}
+
+/* Called with the BQL and the AioContext being entered or left held */
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+    atomic_set(&s->ctx, ctx);
+    af_xdp_update_fd_handler(s);
+}
+
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    struct xdp_desc *ring = s->tx.ring;
+    struct xdp_desc *desc;
+    size_t size = iov_size(iov, iovcnt);
+    uint32_t prod;
+    uint64_t addr;
+
+    if (size > AF_XDP_FRAME_SIZE) {
+        /* Drop, it would not fit in a frame */
+        return size;
+    }
+
+    af_xdp_complete_tx(s);
+    if (!s->n_tx_free || !af_xdp_ring_space(&s->tx)) {
+        af_xdp_write_poll(s, true);
+        return 0;
+    }
+
+    addr = s->tx_free[--s->n_tx_free];
+    iov_to_buf(iov, iovcnt, 0, s->umem + addr, size);
+
+    prod = atomic_read(s->tx.producer);
+    desc = &ring[prod & (AF_XDP_RING_SIZE - 1)];
+    desc->addr = addr;
+    desc->len = size;
+    desc->options = 0;
+    atomic_store_release(s->tx.producer, prod + 1);
+
+    if (af_xdp_ring_needs_wakeup(&s->tx)) {
+        sendto(s->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+
+    return size;
+}
+
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
+static void af_xdp_unmap_ring(AFXDPRing *r)
+{
+    if (r->map) {
+        munmap(r->map, r->map_size);
+        r->map = NULL;
+    }
+}
+
+static void af_xdp_cleanup(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    if (s->fd >= 0) {
+        af_xdp_poll(nc, false);
+    }
+    af_xdp_unmap_ring(&s->rx);
+    af_xdp_unmap_ring(&s->tx);
+    af_xdp_unmap_ring(&s->fq);
+    af_xdp_unmap_ring(&s->cq);
+    if (s->fd >= 0) {
+        close(s->fd);
+        s->fd = -1;
+    }
+    if (s->link_fd >= 0) {
+        close(s->link_fd);
+        s->link_fd = -1;
+    }
+    qemu_vfree(s->umem);
+    s->umem = NULL;
+}
+
+static NetClientInfo net_af_xdp_info = {
+    .type = NET_CLIENT_DRIVER_AF_XDP,
+    .size = sizeof(AFXDPState),
+    .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
+    .poll = af_xdp_poll,
+    .cleanup = af_xdp_cleanup,
+    .set_aio_context = af_xdp_set_aio_context,
+};
+
+static int af_xdp_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * Redirect each packet to the socket in @map_fd that is bound to its RX
+ * queue, and pass it up the host stack if there is none.
+ */
+static int af_xdp_load_prog(int map_fd, Error **errp)
+{
+    struct bpf_insn insns[] = {
+        /* r2 = ctx->rx_queue_index */
+        { .code = BPF_LDX | BPF_MEM | BPF_W,
+          .dst_reg = BPF_REG_2, .src_reg = BPF_REG_1,
+          .off = offsetof(struct xdp_md, rx_queue_index) },
+        /* r1 = map */
+        { .code = BPF_LD | BPF_DW | BPF_IMM,
+          .dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD,
+          .imm = map_fd },
+        { 0 },
+        /* r3 = XDP_PASS, the action if nothing is bound to the queue */
+        { .code = BPF_ALU64 | BPF_MOV | BPF_K,
+          .dst_reg = BPF_REG_3, .imm = XDP_PASS },
+        { .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+        { .code = BPF_JMP | BPF_EXIT },
+    };
+    union bpf_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)insns;
+    attr.insn_cnt = ARRAY_SIZE(insns);
+    attr.license = (uintptr_t)"GPL";
+
+    fd = af_xdp_bpf(BPF_PROG_LOAD, &attr);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "failed to load XDP program");
+    }
+    return fd;
+}
+
+/*
+ * Get the XSKMAP for the sockets, and unless the user brought their own
+ * program attach ours to the interface.  Returns the map fd and stores the
+ * fd of the link that keeps the program attached in *link_fd.
+ */
+static int af_xdp_setup_prog(const NetdevAFXDPOptions *opts, int ifindex,
+                             int max_queues, int *link_fd, Error **errp)
+{
+    static const uint32_t mode_flags[] = {
+        [AFXDP_MODE_NATIVE] = XDP_FLAGS_DRV_MODE,
+        [AFXDP_MODE_SKB] = XDP_FLAGS_SKB_MODE,
+    };
+    union bpf_attr attr;
+    int map_fd, prog_fd;
+    int i;
+
+    *link_fd = -1;
+    memset(&attr, 0, sizeof(attr));
+    if (opts->has_xsks_map) {
+        attr.pathname = (uintptr_t)opts->xsks_map;
+        map_fd = af_xdp_bpf(BPF_OBJ_GET, &attr);
+        if (map_fd < 0) {
+            error_setg_errno(errp, errno, "failed to open XSKMAP '%s'",
+                             opts->xsks_map);
+        }
+        return map_fd;
+    }
+
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = max_queues;
+    map_fd = af_xdp_bpf(BPF_MAP_CREATE, &attr);
+    if (map_fd < 0) {
+        error_setg_errno(errp, errno, "failed to create XSKMAP");
+        return -1;
+    }
+
+    prog_fd = af_xdp_load_prog(map_fd, errp);
+    if (prog_fd < 0) {
+        close(map_fd);
+        return -1;
+    }
+
+    /* Without an explicit mode, prefer the driver hook */
+    for (i = AFXDP_MODE_NATIVE; i < AFXDP_MODE__MAX; i++) {
+        if (opts->has_mode && opts->mode != i) {
+            continue;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = prog_fd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = mode_flags[i];
+        *link_fd = af_xdp_bpf(BPF_LINK_CREATE, &attr);
+        if (*link_fd >= 0) {
+            break;
+        }
+    }
+    close(prog_fd);
+
+    if (*link_fd < 0) {
+        error_setg_errno(errp, errno, "failed to attach XDP program to %s",
+                         opts->ifname);
+        close(map_fd);
+        return -1;
+    }
+    return map_fd;
+}
+
+static int af_xdp_map_ring(AFXDPState *s, AFXDPRing *r,
+                           const struct xdp_ring_offset *off,
+                           size_t desc_size, off_t pgoff, Error **errp)
+{
+    r->map_size = off->desc + AF_XDP_RING_SIZE * desc_size;
+    r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, s->fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        error_setg_errno(errp, errno, "failed to map AF_XDP ring");
+        return -1;
+    }
+    r->producer = r->map + off->producer;
+    r->consumer = r->map + off->consumer;
+    r->flags = r->map + off->flags;
+    r->ring = r->map + off->desc;
+    return 0;
+}
+
+static int af_xdp_socket_create(AFXDPState *s, const NetdevAFXDPOptions *opts,
+                                int ifindex, Error **errp)
+{
+    struct xdp_umem_reg reg = {
+        .len = AF_XDP_NUM_FRAMES * AF_XDP_FRAME_SIZE,
+        .chunk_size = AF_XDP_FRAME_SIZE,
+    };
+    struct sockaddr_xdp sxdp = {
+        .sxdp_family = AF_XDP,
+        .sxdp_ifindex = ifindex,
+        .sxdp_queue_id = s->queue_id,
+        .sxdp_flags = XDP_USE_NEED_WAKEUP,
+    };
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    int size = AF_XDP_RING_SIZE;
+    uint64_t *fq;
+    uint32_t i;
+
+    s->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (s->fd < 0) {
+        error_setg_errno(errp, errno, "failed to create AF_XDP socket");
+        return -1;
+    }
+
+    s->umem = qemu_memalign(qemu_real_host_page_size, reg.len);
+    reg.addr = (uintptr_t)s->umem;
+    if (setsockopt(s->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) ||
+        setsockopt(s->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) ||
+        setsockopt(s->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+                   &size, sizeof(size)) ||
+        setsockopt(s->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) ||
+        setsockopt(s->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size))) {
+        error_setg_errno(errp, errno, "failed to set up AF_XDP rings");
+        return -1;
+    }
+    if (getsockopt(s->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)) {
+        error_setg_errno(errp, errno, "failed to query AF_XDP rings");
+        return -1;
+    }
+    if (af_xdp_map_ring(s, &s->rx, &off.rx, sizeof(struct xdp_desc),
+                        XDP_PGOFF_RX_RING, errp) < 0 ||
+        af_xdp_map_ring(s, &s->tx, &off.tx, sizeof(struct xdp_desc),
+                        XDP_PGOFF_TX_RING, errp) < 0 ||
+        af_xdp_map_ring(s, &s->fq, &off.fr, sizeof(uint64_t),
+                        XDP_UMEM_PGOFF_FILL_RING, errp) < 0 ||
+        af_xdp_map_ring(s, &s->cq, &off.cr, sizeof(uint64_t),
+                        XDP_UMEM_PGOFF_COMPLETION_RING, errp) < 0) {
+        return -1;
+    }
+
+    fq = s->fq.ring;
+    for (i = 0; i < AF_XDP_RING_SIZE; i++) {
+        fq[i] = (uint64_t)i * AF_XDP_FRAME_SIZE;
+        s->tx_free[i] = (uint64_t)(AF_XDP_RING_SIZE + i) * AF_XDP_FRAME_SIZE;
+    }
+    atomic_store_release(s->fq.producer, AF_XDP_RING_SIZE);
+    s->n_tx_free = AF_XDP_RING_SIZE;
+
+    if (opts->has_force_copy && opts->force_copy) {
+        sxdp.sxdp_flags |= XDP_COPY;
+    }
+    if (bind(s->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        error_setg_errno(errp, errno,
+                         "failed to bind AF_XDP socket to %s queue %u",
+                         opts->ifname, s->queue_id);
+        return -1;
+    }
+    return 0;
+}
+
+int net_init_af_xdp(const Netdev *netdev, const char *name,
+                    NetClientState *peer, Error **errp)
+{
+    const NetdevAFXDPOptions *opts = &netdev->u.af_xdp;
+    NetClientState *nc, *nc0 = NULL;
+    int64_t queues = opts->has_queues ? opts->queues : 1;
+    int64_t start = opts->has_start_queue ? opts->start_queue : 0;
+    int ifindex, map_fd, link_fd;
+    int i;
+
+    if (queues < 1 || start < 0 || start + queues > INT_MAX) {
+        error_setg(errp, "invalid queues=%" PRId64 " or start-queue=%" PRId64,
+                   queues, start);
+        return -1;
+    }
+
+    ifindex = if_nametoindex(opts->ifname);
+    if (!ifindex) {
+        error_setg_errno(errp, errno, "unknown interface '%s'", opts->ifname);
+        return -1;
+    }
+
+    map_fd = af_xdp_setup_prog(opts, ifindex, start + queues, &link_fd, errp);
+    if (map_fd < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < queues; i++) {
+        union bpf_attr attr;
+        AFXDPState *s;
+        uint32_t key;
+
+        nc = qemu_new_net_client(&net_af_xdp_info, peer, "af-xdp", name);
+        s = DO_UPCAST(AFXDPState, nc, nc);
+        s->fd = -1;
+        s->link_fd = -1;
+        s->queue_id = start + i;
+        pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
+        nc->queue_index = i;
+        snprintf(nc->info_str, sizeof(nc->info_str), "af-xdp: %s queue %u",
+                 s->ifname, s->queue_id);
+        if (!nc0) {
+            nc0 = nc;
+        }
+
+        if (af_xdp_socket_create(s, opts, ifindex, errp) < 0) {
+            goto fail;
+        }
+
+        memset(&attr, 0, sizeof(attr));
+        key = s->queue_id;
+        attr.map_fd = map_fd;
+        attr.key = (uintptr_t)&key;
+        attr.value = (uintptr_t)&s->fd;
+        attr.flags = BPF_ANY;
+        if (af_xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+            error_setg_errno(errp, errno, "failed to add socket for queue %u "
+                             "to XSKMAP", s->queue_id);
+            goto fail;
+        }
+
+        /* Every queue holds the program, it goes away with the last one */
+        if (link_fd >= 0) {
+            s->link_fd = dup(link_fd);
+        }
+        af_xdp_read_poll(s, true);
+    }
+
+    close(map_fd);
+    if (link_fd >= 0) {
+        close(link_fd);
+    }
+    return 0;
+
+fail:
+    qemu_del_net_client(nc0);
+    close(map_fd);
+    if (link_fd >= 0) {
+        close(link_fd);
+    }
+    return -1;
+}
@@ -20,24 +20,238 @@
 #include "net/checksum.h"
 #include "net/eth.h"
 
-uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+/*
+ * The one's complement sum does not depend on byte order: summing 16-bit
+ * words as the host loads them and swapping the folded result gives the
+ * same as summing big-endian words.  Nor does it depend on the word size,
+ * since 2^16 == 1 mod 0xffff, so the helpers below add up whatever is
+ * widest and fold at the end.  They return the folded host order sum, which
+ * is only zero if the data is.
+ */
+
+static inline uint32_t net_checksum_fold(uint64_t sum)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return sum;
+}
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+static uint32_t net_checksum_int(const uint8_t *buf, size_t len)
+{
+    uint64_t sum = 0;
+
+    for (; len >= 16; len -= 16, buf += 16) {
+        sum += (uint64_t)ldl_he_p(buf) + ldl_he_p(buf + 4) +
+               ldl_he_p(buf + 8) + ldl_he_p(buf + 12);
+    }
+    for (; len >= 4; len -= 4, buf += 4) {
+        sum += ldl_he_p(buf);
+    }
+    if (len >= 2) {
+        sum += lduw_he_p(buf);
+        buf += 2;
+        len -= 2;
     }
-    if (i < len) {
-        sum1 += (uint32_t)buf[i];
+    if (len) {
+        /* The odd byte comes first in its word */
+        uint8_t tail[2] = { buf[0], 0 };
+        sum += lduw_he_p(tail);
+    }
+    return net_checksum_fold(sum);
+}
+
+/*
+ * In the vectorized versions each 32-bit lane of the accumulator takes two
+ * 16-bit words per vector, so it can absorb this many vectors.
+ */
+#define CSUM_VEC_BLOCKS 16384
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static uint32_t net_checksum_sse2(const uint8_t *buf, size_t len)
+{
+    __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        size_t n = MIN(len / 16, CSUM_VEC_BLOCKS);
+        __m128i acc = zero;
+        uint32_t lanes[4];
+
+        len -= n * 16;
+        for (; n; n--, buf += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)buf);
+
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+        }
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
     }
+    return net_checksum_fold(sum + net_checksum_int(buf, len));
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static uint32_t net_checksum_avx2(const uint8_t *buf, size_t len)
+{
+    __m256i zero = _mm256_setzero_si256();
+    uint64_t sum = 0;
+
+    while (len >= 32) {
+        size_t n = MIN(len / 32, CSUM_VEC_BLOCKS);
+        __m256i acc = zero;
+        uint32_t lanes[8];
+        int i;
+
+        len -= n * 32;
+        for (; n; n--, buf += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)buf);
 
-    if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+        }
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        for (i = 0; i < 8; i++) {
+            sum += lanes[i];
+        }
     }
+    return net_checksum_fold(sum + net_checksum_int(buf, len));
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+/* The most preferred ISA must have the least significant bit */
+#define CACHE_AVX2    1
+#define CACHE_SSE2    2
+
+#ifdef CONFIG_AVX2_OPT
+# define INIT_CACHE 0
+# define INIT_ACCEL net_checksum_int
+#else
+# define INIT_CACHE CACHE_SSE2
+# define INIT_ACCEL net_checksum_sse2
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static uint32_t (*checksum_accel)(const uint8_t *, size_t) = INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    uint32_t (*fn)(const uint8_t *, size_t) = net_checksum_int;
+
+    if (cache & CACHE_SSE2) {
+        fn = net_checksum_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = net_checksum_avx2;
+    }
+#endif
+    checksum_accel = fn;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_net_checksum_next_accel(void)
+{
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+static uint32_t checksum_accel(const uint8_t *buf, size_t len)
+{
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        size_t n = MIN(len / 16, CSUM_VEC_BLOCKS);
+        uint32x4_t acc = vdupq_n_u32(0);
+
+        len -= n * 16;
+        for (; n; n--, buf += 16) {
+            acc = vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(buf)));
+        }
+        sum += vaddlvq_u32(acc);
+    }
+    return net_checksum_fold(sum + net_checksum_int(buf, len));
+}
+
+bool test_net_checksum_next_accel(void)
+{
+    return false;
+}
+
+#else
+#define checksum_accel net_checksum_int
+bool test_net_checksum_next_accel(void)
+{
+    return false;
+}
+#endif
+
+uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+{
+    uint32_t sum;
+
+    if (len <= 0) {
+        return 0;
+    }
+    sum = len >= 64 ? checksum_accel(buf, len) : net_checksum_int(buf, len);
+
+#ifdef HOST_WORDS_BIGENDIAN
+    return seq & 1 ? bswap16(sum) : sum;
+#else
+    return seq & 1 ? sum : bswap16(sum);
+#endif
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
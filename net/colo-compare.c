@@ -20,12 +20,14 @@
 #include "qapi/error.h"
 #include "net/net.h"
 #include "net/eth.h"
+#include "net/checksum.h"
 #include "qom/object_interfaces.h"
 #include "qemu/iov.h"
 #include "qom/object.h"
 #include "net/queue.h"
 #include "chardev/char-fe.h"
 #include "qemu/sockets.h"
+#include "qemu/thread.h"
 #include "qapi-visit.h"
 #include "net/colo.h"
 #include "sysemu/iothread.h"
@@ -36,6 +38,7 @@
 
 #define COMPARE_READ_LEN_MAX NET_BUFSIZE
 #define MAX_QUEUE_SIZE 1024
+#define MAX_COMPARE_THREADS 16
 
 /* TODO: Should be configurable */
 #define REGULAR_PACKET_CHECK_MS 3000
@@ -61,8 +64,40 @@
  *                    |primary |  |secondary    |primary | |secondary
  *                    |packet  |  |packet  +    |packet  | |packet  +
  *                    +--------+  +--------+    +--------+ +--------+
+ *
+ * Connections are spread over the workers by the hash of their key, each
+ * worker owns the connections that hash to it.  With compare_threads=1
+ * there is one worker and it compares in the iothread, otherwise every
+ * worker has its own thread and the iothread only parses and queues.
  */
-typedef struct CompareState {
+typedef struct CompareState CompareState;
+
+typedef struct CompareWorker {
+    CompareState *s;
+    QemuThread thread;
+    /* Protects everything below, and the connections in the table */
+    QemuMutex lock;
+    QemuCond cond;
+    bool stopping;
+
+    /*
+     * Record the connection that through the NIC
+     * Element type: Connection
+     */
+    GQueue conn_list;
+    /* Record the connection without repetition */
+    GHashTable *connection_track_table;
+    /* Connections with new packets to compare, element type: Connection */
+    GQueue pending;
+    /*
+     * Primary packets that have not been matched yet, in arrival order.
+     * All packets have the same timeout, so the head is always the first
+     * packet to become too old.
+     */
+    QTAILQ_HEAD(, Packet) age_list;
+} CompareWorker;
+
+struct CompareState {
     Object parent;
 
     char *pri_indev;
@@ -75,18 +110,15 @@ typedef struct CompareState {
     SocketReadState sec_rs;
     bool vnet_hdr;
 
-    /*
-     * Record the connection that through the NIC
-     * Element type: Connection
-     */
-    GQueue conn_list;
-    /* Record the connection without repetition */
-    GHashTable *connection_track_table;
+    uint32_t compare_threads;
+    CompareWorker *workers;
+    /* Serializes the packets written to outdev by the workers */
+    QemuMutex out_lock;
 
     IOThread *iothread;
     GMainContext *worker_context;
     QEMUTimer *packet_check_timer;
-} CompareState;
+};
 
 typedef struct CompareClass {
     ObjectClass parent_class;
@@ -131,15 +163,38 @@ static int colo_insert_packet(GQueue *queue, Packet *pkt)
     return 0;
 }
 
+/*
+ * Sum of the bytes that every comparison of this packet includes, taken
+ * while the packet is still hot in the cache.  Two packets whose sums
+ * differ cannot compare equal, so most mismatches skip the memcmp().
+ */
+static uint32_t colo_packet_payload_sum(Packet *pkt)
+{
+    uint8_t *start = pkt->transport_header;
+    uint8_t *end = (uint8_t *)pkt->data + pkt->size;
+
+    if (pkt->ip->ip_p == IPPROTO_TCP) {
+        if (start + sizeof(struct tcphdr) > end) {
+            return 0;
+        }
+        start += ((struct tcphdr *)start)->th_off * 4;
+    }
+
+    return start < end ? net_checksum_add(end - start, start) : 0;
+}
+
+static void colo_compare_connection(void *opaque, void *user_data);
+
 /*
  * Return 0 on success, if return -1 means the pkt
  * is unsupported(arp and ipv6) and will be sent later
  */
-static int packet_enqueue(CompareState *s, int mode, Connection **con)
+static int packet_enqueue(CompareState *s, int mode)
 {
     ConnectionKey key;
     Packet *pkt = NULL;
     Connection *conn;
+    CompareWorker *w;
 
     if (mode == PRIMARY_IN) {
         pkt = packet_new(s->pri_rs.buf,
@@ -157,13 +212,24 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
         return -1;
     }
     fill_connection_key(pkt, &key);
+    pkt->payload_sum = colo_packet_payload_sum(pkt);
+
+    w = &s->workers[connection_key_hash(&key) % s->compare_threads];
+    qemu_mutex_lock(&w->lock);
 
-    conn = connection_get(s->connection_track_table,
+    /* connection_get() destroys every connection when the table is full */
+    if (g_hash_table_size(w->connection_track_table) > HASHTABLE_MAX_SIZE &&
+        !g_hash_table_lookup(w->connection_track_table, &key)) {
+        QTAILQ_INIT(&w->age_list);
+        g_queue_clear(&w->pending);
+    }
+
+    conn = connection_get(w->connection_track_table,
                           &key,
-                          &s->conn_list);
+                          &w->conn_list);
 
     if (!conn->processing) {
-        g_queue_push_tail(&s->conn_list, conn);
+        g_queue_push_tail(&w->conn_list, conn);
         conn->processing = true;
     }
 
@@ -171,15 +237,28 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
         if (!colo_insert_packet(&conn->primary_list, pkt)) {
             error_report("colo compare primary queue size too big,"
                          "drop packet");
+            packet_destroy(pkt, NULL);
+        } else {
+            QTAILQ_INSERT_TAIL(&w->age_list, pkt, age_next);
         }
     } else {
         if (!colo_insert_packet(&conn->secondary_list, pkt)) {
             error_report("colo compare secondary queue size too big,"
                          "drop packet");
+            packet_destroy(pkt, NULL);
         }
     }
-    *con = conn;
 
+    /* compare packet in the specified connection */
+    if (s->compare_threads == 1) {
+        colo_compare_connection(conn, w);
+    } else if (!conn->pending) {
+        conn->pending = true;
+        g_queue_push_tail(&w->pending, conn);
+        qemu_cond_signal(&w->cond);
+    }
+
+    qemu_mutex_unlock(&w->lock);
     return 0;
 }
 
@@ -212,6 +291,10 @@ static int colo_packet_compare_common(Packet *ppkt,
     soffset = ppkt->vnet_hdr_len + soffset;
 
     if (ppkt->size - poffset == spkt->size - soffset) {
+        if (ppkt->payload_sum != spkt->payload_sum) {
+            trace_colo_compare_main("Net packet payload sums differ");
+            return -1;
+        }
         return memcmp(ppkt->data + poffset,
                       spkt->data + soffset,
                       spkt->size - soffset);
@@ -426,38 +509,20 @@ static int colo_packet_compare_other(Packet *spkt, Packet *ppkt)
     return colo_packet_compare_common(ppkt, spkt, 0, 0);
 }
 
-static int colo_old_packet_check_one(Packet *pkt, int64_t *check_time)
+static bool colo_old_packet_check_one_worker(CompareWorker *w, int64_t now)
 {
-    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    Packet *pkt;
+    bool found = false;
 
-    if ((now - pkt->creation_ms) > (*check_time)) {
+    qemu_mutex_lock(&w->lock);
+    pkt = QTAILQ_FIRST(&w->age_list);
+    if (pkt && now - pkt->creation_ms > REGULAR_PACKET_CHECK_MS) {
         trace_colo_old_packet_check_found(pkt->creation_ms);
-        return 0;
-    } else {
-        return 1;
-    }
-}
-
-static int colo_old_packet_check_one_conn(Connection *conn,
-                                          void *user_data)
-{
-    GList *result = NULL;
-    int64_t check_time = REGULAR_PACKET_CHECK_MS;
-
-    result = g_queue_find_custom(&conn->primary_list,
-                                 &check_time,
-                                 (GCompareFunc)colo_old_packet_check_one);
-
-    if (result) {
-        /* Do checkpoint will flush old packet */
-        /*
-         * TODO: Notify colo frame to do checkpoint.
-         * colo_compare_inconsistent_notify();
-         */
-        return 0;
+        found = true;
     }
+    qemu_mutex_unlock(&w->lock);
 
-    return 1;
+    return found;
 }
 
 /*
@@ -468,26 +533,37 @@ static int colo_old_packet_check_one_conn(Connection *conn,
 static void colo_old_packet_check(void *opaque)
 {
     CompareState *s = opaque;
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    int i;
 
     /*
      * If we find one old packet, stop finding job and notify
      * COLO frame do checkpoint.
      */
-    g_queue_find_custom(&s->conn_list, NULL,
-                        (GCompareFunc)colo_old_packet_check_one_conn);
+    for (i = 0; i < s->compare_threads; i++) {
+        if (colo_old_packet_check_one_worker(&s->workers[i], now)) {
+            /* Do checkpoint will flush old packet */
+            /*
+             * TODO: Notify colo frame to do checkpoint.
+             * colo_compare_inconsistent_notify();
+             */
+            break;
+        }
+    }
 }
 
 /*
  * Called from the compare thread on the primary
  * for compare packet with secondary list of the
  * specified connection when a new packet was
- * queued to it.
+ * queued to it.  The worker lock is held.
  */
 static void colo_compare_connection(void *opaque, void *user_data)
 {
-    CompareState *s = user_data;
+    CompareWorker *w = user_data;
+    CompareState *s = w->s;
     Connection *conn = opaque;
-    Packet *pkt = NULL;
+    Packet *pkt = NULL, *spkt;
     GList *result = NULL;
     int ret;
 
@@ -522,7 +598,10 @@ static void colo_compare_connection(void *opaque, void *user_data)
                 error_report("colo_send_primary_packet failed");
             }
             trace_colo_compare_main("packet same and release packet");
-            g_queue_remove(&conn->secondary_list, result->data);
+            spkt = result->data;
+            g_queue_remove(&conn->secondary_list, spkt);
+            packet_destroy(spkt, NULL);
+            QTAILQ_REMOVE(&w->age_list, pkt, age_next);
             packet_destroy(pkt, NULL);
         } else {
             /*
@@ -550,6 +629,7 @@ static int compare_chr_send(CompareState *s,
         return 0;
     }
 
+    qemu_mutex_lock(&s->out_lock);
     ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)&len, sizeof(len));
     if (ret != sizeof(len)) {
         goto err;
@@ -572,9 +652,11 @@ static int compare_chr_send(CompareState *s,
         goto err;
     }
 
+    qemu_mutex_unlock(&s->out_lock);
     return 0;
 
 err:
+    qemu_mutex_unlock(&s->out_lock);
     return ret < 0 ? ret : -EIO;
 }
 
@@ -727,33 +809,108 @@ static void compare_set_vnet_hdr(Object *obj,
     s->vnet_hdr = value;
 }
 
+static void compare_get_compare_threads(Object *obj, Visitor *v,
+                                        const char *name, void *opaque,
+                                        Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value = s->compare_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void compare_set_compare_threads(Object *obj, Visitor *v,
+                                        const char *name, void *opaque,
+                                        Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    Error *local_err = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+    if (!value || value > MAX_COMPARE_THREADS) {
+        error_setg(&local_err, "Property '%s.%s' must be between 1 and %d",
+                   object_get_typename(obj), name, MAX_COMPARE_THREADS);
+        goto out;
+    }
+    s->compare_threads = value;
+
+out:
+    error_propagate(errp, local_err);
+}
+
 static void compare_pri_rs_finalize(SocketReadState *pri_rs)
 {
     CompareState *s = container_of(pri_rs, CompareState, pri_rs);
-    Connection *conn = NULL;
 
-    if (packet_enqueue(s, PRIMARY_IN, &conn)) {
+    if (packet_enqueue(s, PRIMARY_IN)) {
         trace_colo_compare_main("primary: unsupported packet in");
         compare_chr_send(s,
                          pri_rs->buf,
                          pri_rs->packet_len,
                          pri_rs->vnet_hdr_len);
-    } else {
-        /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
     }
 }
 
 static void compare_sec_rs_finalize(SocketReadState *sec_rs)
 {
     CompareState *s = container_of(sec_rs, CompareState, sec_rs);
-    Connection *conn = NULL;
 
-    if (packet_enqueue(s, SECONDARY_IN, &conn)) {
+    if (packet_enqueue(s, SECONDARY_IN)) {
         trace_colo_compare_main("secondary: unsupported packet in");
-    } else {
-        /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+    }
+}
+
+/*
+ * Called from a compare thread when compare_threads > 1: compare the
+ * connections of one worker as the iothread queues packets to them.
+ */
+static void *colo_compare_worker_thread(void *opaque)
+{
+    CompareWorker *w = opaque;
+    Connection *conn;
+
+    qemu_mutex_lock(&w->lock);
+    while (!w->stopping) {
+        conn = g_queue_pop_head(&w->pending);
+        if (!conn) {
+            qemu_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+        conn->pending = false;
+        colo_compare_connection(conn, w);
+    }
+    qemu_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+static void colo_compare_workers_init(CompareState *s)
+{
+    int i;
+
+    s->workers = g_new0(CompareWorker, s->compare_threads);
+    for (i = 0; i < s->compare_threads; i++) {
+        CompareWorker *w = &s->workers[i];
+
+        w->s = s;
+        qemu_mutex_init(&w->lock);
+        qemu_cond_init(&w->cond);
+        g_queue_init(&w->conn_list);
+        g_queue_init(&w->pending);
+        QTAILQ_INIT(&w->age_list);
+        w->connection_track_table = g_hash_table_new_full(connection_key_hash,
+                                                          connection_key_equal,
+                                                          g_free,
+                                                          connection_destroy);
+        if (s->compare_threads > 1) {
+            qemu_thread_create(&w->thread, "colo-compare",
+                               colo_compare_worker_thread, w,
+                               QEMU_THREAD_JOINABLE);
+        }
     }
 }
 
@@ -821,12 +978,8 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
     net_socket_rs_init(&s->pri_rs, compare_pri_rs_finalize, s->vnet_hdr);
     net_socket_rs_init(&s->sec_rs, compare_sec_rs_finalize, s->vnet_hdr);
 
-    g_queue_init(&s->conn_list);
-
-    s->connection_track_table = g_hash_table_new_full(connection_key_hash,
-                                                      connection_key_equal,
-                                                      g_free,
-                                                      connection_destroy);
+    qemu_mutex_init(&s->out_lock);
+    colo_compare_workers_init(s);
 
     colo_compare_iothread(s);
     return;
@@ -834,7 +987,8 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
 
 static void colo_flush_packets(void *opaque, void *user_data)
 {
-    CompareState *s = user_data;
+    CompareWorker *w = user_data;
+    CompareState *s = w->s;
     Connection *conn = opaque;
     Packet *pkt = NULL;
 
@@ -852,6 +1006,33 @@ static void colo_flush_packets(void *opaque, void *user_data)
     }
 }
 
+static void colo_compare_workers_cleanup(CompareState *s)
+{
+    int i;
+
+    for (i = 0; i < s->compare_threads; i++) {
+        CompareWorker *w = &s->workers[i];
+
+        if (s->compare_threads > 1) {
+            qemu_mutex_lock(&w->lock);
+            w->stopping = true;
+            qemu_cond_signal(&w->cond);
+            qemu_mutex_unlock(&w->lock);
+            qemu_thread_join(&w->thread);
+        }
+
+        /* Release all unhandled packets after compare thead exited */
+        g_queue_foreach(&w->conn_list, colo_flush_packets, w);
+        g_queue_clear(&w->conn_list);
+        g_queue_clear(&w->pending);
+        g_hash_table_destroy(w->connection_track_table);
+        qemu_cond_destroy(&w->cond);
+        qemu_mutex_destroy(&w->lock);
+    }
+    g_free(s->workers);
+    s->workers = NULL;
+}
+
 static void colo_compare_class_init(ObjectClass *oc, void *data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(oc);
@@ -880,6 +1061,11 @@ static void colo_compare_init(Object *obj)
     s->vnet_hdr = false;
     object_property_add_bool(obj, "vnet_hdr_support", compare_get_vnet_hdr,
                              compare_set_vnet_hdr, NULL);
+
+    s->compare_threads = 1;
+    object_property_add(obj, "compare_threads", "uint32",
+                        compare_get_compare_threads,
+                        compare_set_compare_threads, NULL, NULL, NULL);
 }
 
 static void colo_compare_finalize(Object *obj)
@@ -892,13 +1078,10 @@ static void colo_compare_finalize(Object *obj)
     if (s->iothread) {
         colo_compare_timer_del(s);
     }
-    /* Release all unhandled packets after compare thead exited */
-    g_queue_foreach(&s->conn_list, colo_flush_packets, s);
-
-    g_queue_clear(&s->conn_list);
 
-    if (s->connection_track_table) {
-        g_hash_table_destroy(s->connection_track_table);
+    if (s->workers) {
+        colo_compare_workers_cleanup(s);
+        qemu_mutex_destroy(&s->out_lock);
     }
 
     if (s->iothread) {
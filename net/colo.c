@@ -136,6 +136,7 @@ Connection *connection_new(ConnectionKey *key)
 
     conn->ip_proto = key->ip_proto;
     conn->processing = false;
+    conn->pending = false;
     conn->offset = 0;
     conn->syn_flag = 0;
     g_queue_init(&conn->primary_list);
@@ -200,10 +201,11 @@ Connection *connection_get(GHashTable *connection_track_table,
                                   " clear it");
             connection_hashtable_reset(connection_track_table);
             /*
-             * clear the conn_list
+             * clear the conn_list, the hash table has already
+             * destroyed its elements
              */
-            while (!g_queue_is_empty(conn_list)) {
-                connection_destroy(g_queue_pop_head(conn_list));
+            if (conn_list) {
+                g_queue_clear(conn_list);
             }
         }
 
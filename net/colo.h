@@ -18,6 +18,7 @@
 #include "slirp/slirp.h"
 #include "qemu/jhash.h"
 #include "qemu/timer.h"
+#include "qemu/queue.h"
 
 #define HASHTABLE_MAX_SIZE 16384
 
@@ -45,6 +46,10 @@ typedef struct Packet {
     int64_t creation_ms;
     /* Get vnet_hdr_len from filter */
     uint32_t vnet_hdr_len;
+    /* Checksum of the L4 payload, for a quick compare */
+    uint32_t payload_sum;
+    /* Link in the list of unmatched packets, oldest first */
+    QTAILQ_ENTRY(Packet) age_next;
 } Packet;
 
 typedef struct ConnectionKey {
@@ -63,6 +68,8 @@ typedef struct Connection {
     GQueue secondary_list;
     /* flag to enqueue unprocessed_connections */
     bool processing;
+    /* flag to enqueue the connections waiting for a compare thread */
+    bool pending;
     uint8_t ip_proto;
     /* offset = secondary_seq - primary_seq */
     tcp_seq  offset;
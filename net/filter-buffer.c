@@ -129,6 +129,8 @@ static void filter_buffer_setup(NetFilterState *nf, Error **errp)
     }
 
     s->incoming_queue = qemu_new_net_queue(qemu_netfilter_pass_to_next, nf);
+    qemu_net_queue_set_deliver_batch(s->incoming_queue,
+                                     qemu_netfilter_pass_to_next_batch);
     filter_buffer_setup_timer(nf);
 }
 
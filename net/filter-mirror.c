@@ -52,7 +52,7 @@ static int filter_send(MirrorState *s,
     int ret = 0;
     ssize_t size = 0;
     uint32_t len = 0;
-    char *buf;
+    int i;
 
     size = iov_size(iov, iovcnt);
     if (!size) {
@@ -82,12 +82,13 @@ static int filter_send(MirrorState *s,
         }
     }
 
-    buf = g_malloc(size);
-    iov_to_buf(iov, iovcnt, 0, buf, size);
-    ret = qemu_chr_fe_write_all(&s->chr_out, (uint8_t *)buf, size);
-    g_free(buf);
-    if (ret != size) {
-        goto err;
+    /* The length is sent first, so the payload need not be contiguous */
+    for (i = 0; i < iovcnt; i++) {
+        ret = qemu_chr_fe_write_all(&s->chr_out, iov[i].iov_base,
+                                    iov[i].iov_len);
+        if (ret != iov[i].iov_len) {
+            goto err;
+        }
     }
 
     return 0;
@@ -193,6 +194,25 @@ static ssize_t filter_redirector_receive_iov(NetFilterState *nf,
     }
 }
 
+/*
+ * Packets written to a socket chardev with no peer are dropped anyway;
+ * don't bother formatting them.
+ */
+static bool filter_mirror_is_idle(NetFilterState *nf)
+{
+    MirrorState *s = FILTER_MIRROR(nf);
+
+    return !qemu_chr_fe_backend_open(&s->chr_out);
+}
+
+/* Without outdev the redirector lets every packet through */
+static bool filter_redirector_is_idle(NetFilterState *nf)
+{
+    MirrorState *s = FILTER_REDIRECTOR(nf);
+
+    return !qemu_chr_fe_backend_connected(&s->chr_out);
+}
+
 static void filter_mirror_cleanup(NetFilterState *nf)
 {
     MirrorState *s = FILTER_MIRROR(nf);
@@ -292,6 +312,7 @@ static void filter_mirror_class_init(ObjectClass *oc, void *data)
 
     nfc->setup = filter_mirror_setup;
     nfc->cleanup = filter_mirror_cleanup;
+    nfc->is_idle = filter_mirror_is_idle;
     nfc->receive_iov = filter_mirror_receive_iov;
 }
 
@@ -301,6 +322,7 @@ static void filter_redirector_class_init(ObjectClass *oc, void *data)
 
     nfc->setup = filter_redirector_setup;
     nfc->cleanup = filter_redirector_cleanup;
+    nfc->is_idle = filter_redirector_is_idle;
     nfc->receive_iov = filter_redirector_receive_iov;
 }
 
@@ -20,7 +20,9 @@
 
 static inline bool qemu_can_skip_netfilter(NetFilterState *nf)
 {
-    return !nf->on;
+    NetFilterClass *nfc = NETFILTER_GET_CLASS(OBJECT(nf));
+
+    return !nf->on || (nfc->is_idle && nfc->is_idle(nf));
 }
 
 ssize_t qemu_netfilter_receive(NetFilterState *nf,
@@ -59,6 +61,48 @@ static NetFilterState *netfilter_next(NetFilterState *nf,
     return next;
 }
 
+/* Whether @nf and the filters that follow it would all pass a packet on */
+static bool netfilter_idle_from(NetFilterState *nf, NetFilterDirection dir)
+{
+    for (; nf; nf = netfilter_next(nf, dir)) {
+        if (!qemu_can_skip_netfilter(nf) &&
+            (nf->direction == dir ||
+             nf->direction == NET_FILTER_DIRECTION_ALL)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool qemu_netfilter_chain_idle(NetClientState *nc,
+                               NetFilterDirection direction)
+{
+    NetFilterState *first;
+
+    if (direction == NET_FILTER_DIRECTION_TX) {
+        first = QTAILQ_FIRST(&nc->filters);
+    } else {
+        first = QTAILQ_LAST(&nc->filters, NetFilterHead);
+    }
+
+    return netfilter_idle_from(first, direction);
+}
+
+static NetFilterDirection netfilter_pass_direction(NetFilterState *nf,
+                                                   NetClientState *sender)
+{
+    if (nf->direction == NET_FILTER_DIRECTION_ALL) {
+        if (sender == nf->netdev) {
+            /* This packet is sent by netdev itself */
+            return NET_FILTER_DIRECTION_TX;
+        } else {
+            return NET_FILTER_DIRECTION_RX;
+        }
+    }
+
+    return nf->direction;
+}
+
 ssize_t qemu_netfilter_pass_to_next(NetClientState *sender,
                                     unsigned flags,
                                     const struct iovec *iov,
@@ -75,17 +119,7 @@ ssize_t qemu_netfilter_pass_to_next(NetClientState *sender,
         goto out;
     }
 
-    if (nf->direction == NET_FILTER_DIRECTION_ALL) {
-        if (sender == nf->netdev) {
-            /* This packet is sent by netdev itself */
-            direction = NET_FILTER_DIRECTION_TX;
-        } else {
-            direction = NET_FILTER_DIRECTION_RX;
-        }
-    } else {
-        direction = nf->direction;
-    }
-
+    direction = netfilter_pass_direction(nf, sender);
     next = netfilter_next(nf, direction);
     while (next) {
         /*
@@ -117,6 +151,33 @@ out:
     return iov_size(iov, iovcnt);
 }
 
+int qemu_netfilter_pass_to_next_batch(NetClientState *sender,
+                                      const struct iovec *pkts,
+                                      int count,
+                                      void *opaque)
+{
+    NetFilterState *nf = opaque;
+    NetFilterDirection direction;
+    int i;
+
+    if (!sender || !sender->peer) {
+        return count;
+    }
+
+    direction = netfilter_pass_direction(nf, sender);
+    if (netfilter_idle_from(netfilter_next(nf, direction), direction)) {
+        qemu_net_queue_send_batch(sender->peer->incoming_queue, sender,
+                                  pkts, count, NULL);
+        return count;
+    }
+
+    for (i = 0; i < count; i++) {
+        qemu_netfilter_pass_to_next(sender, QEMU_NET_PACKET_FLAG_NONE,
+                                    &pkts[i], 1, nf);
+    }
+    return count;
+}
+
 static char *netfilter_get_netdev_id(Object *obj, Error **errp)
 {
     NetFilterState *nf = NETFILTER(obj);
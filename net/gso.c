@@ -0,0 +1,103 @@
+/*
+ * Software segmentation of TCP packets
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/gso.h"
+
+int net_gso_tcp(const uint8_t *hdr, size_t l3_off, size_t l4_off,
+                size_t hdr_len, const struct iovec *payload, int payload_cnt,
+                size_t payload_len, size_t mss,
+                NetGSOSendFunc *send, void *opaque)
+{
+    const struct tcp_hdr *tcp = (const struct tcp_hdr *)(hdr + l4_off);
+    size_t l4_hdr_len = hdr_len - l4_off;
+    struct iovec *iov;
+    uint8_t *seg;
+    uint32_t seq;
+    uint16_t ip_id = 0;
+    uint8_t flags;
+    bool ipv4;
+    size_t off = 0;
+    int n = 0;
+
+    if (!mss || l4_off + sizeof(struct tcp_hdr) > hdr_len || l3_off >= l4_off) {
+        return -EINVAL;
+    }
+    switch (hdr[l3_off] >> 4) {
+    case IP_HEADER_VERSION_4:
+        if (l4_off - l3_off < sizeof(struct ip_header) ||
+            IP_HDR_GET_LEN(hdr + l3_off) != l4_off - l3_off) {
+            return -EINVAL;
+        }
+        ipv4 = true;
+        ip_id = lduw_be_p(&((const struct ip_header *)(hdr + l3_off))->ip_id);
+        break;
+    case IP_HEADER_VERSION_6:
+        if (l4_off - l3_off < sizeof(struct ip6_header)) {
+            return -EINVAL;
+        }
+        ipv4 = false;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    seq = ldl_be_p(&tcp->th_seq);
+    flags = tcp->th_flags;
+
+    seg = g_malloc(hdr_len);
+    iov = g_new(struct iovec, payload_cnt + 1);
+    iov[0].iov_base = seg;
+    iov[0].iov_len = hdr_len;
+
+    do {
+        size_t len = MIN(mss, payload_len - off);
+        bool last = off + len == payload_len;
+        struct tcp_hdr *seg_tcp = (struct tcp_hdr *)(seg + l4_off);
+        uint32_t cntr, cso;
+        int cnt;
+
+        memcpy(seg, hdr, hdr_len);
+        if (ipv4) {
+            struct ip_header *ip = (struct ip_header *)(seg + l3_off);
+
+            stw_be_p(&ip->ip_len, hdr_len - l3_off + len);
+            stw_be_p(&ip->ip_id, ip_id + n);
+            eth_fix_ip4_checksum(ip, l4_off - l3_off);
+            cntr = eth_calc_ip4_pseudo_hdr_csum(ip, l4_hdr_len + len, &cso);
+        } else {
+            struct ip6_header *ip6 = (struct ip6_header *)(seg + l3_off);
+
+            stw_be_p(&ip6->ip6_ctlun.ip6_un1.ip6_un1_plen,
+                     hdr_len - l3_off - sizeof(*ip6) + len);
+            cntr = eth_calc_ip6_pseudo_hdr_csum(ip6, l4_hdr_len + len,
+                                                IP_PROTO_TCP, &cso);
+        }
+
+        /* FIN and PSH belong to the last segment, CWR to the first */
+        stl_be_p(&seg_tcp->th_seq, seq + off);
+        seg_tcp->th_flags = flags & ~(last ? 0 : TH_FIN | TH_PUSH)
+                                  & ~(n ? TH_CWR : 0);
+        stw_be_p(&seg_tcp->th_sum, 0);
+
+        cnt = iov_copy(iov + 1, payload_cnt, payload, payload_cnt, off, len);
+        cntr += net_checksum_add_cont(l4_hdr_len, (uint8_t *)seg_tcp, cso);
+        cntr += net_checksum_add_iov(iov + 1, cnt, 0, len, cso + l4_hdr_len);
+        stw_be_p(&seg_tcp->th_sum, net_checksum_finish(cntr));
+
+        send(opaque, iov, cnt + 1);
+        off += len;
+        n++;
+    } while (off < payload_len);
+
+    g_free(iov);
+    g_free(seg);
+    return n;
+}
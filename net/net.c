@@ -47,6 +47,7 @@
 #include "sysemu/sysemu.h"
 #include "sysemu/qtest.h"
 #include "net/filter.h"
+#include "net/vhost_net.h"
 #include "qapi/string-output-visitor.h"
 
 /* Net bridge is currently not supported for W32. */
@@ -272,6 +273,10 @@ static void qemu_net_client_setup(NetClientState *nc,
     QTAILQ_INSERT_TAIL(&net_clients, nc, next);
 
     nc->incoming_queue = qemu_new_net_queue(qemu_deliver_packet_iov, nc);
+    if (info->receive_iov_batch) {
+        qemu_net_queue_set_deliver_batch(nc->incoming_queue,
+                                         qemu_deliver_packet_batch);
+    }
     nc->destructor = destructor;
     QTAILQ_INIT(&nc->filters);
 }
@@ -534,6 +539,62 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
 #endif
 }
 
+/*
+ * Move the fd handlers of @nc into @ctx, or back to the main loop if @ctx
+ * is NULL.  While in @ctx the handlers run under its AioContext lock and
+ * without the BQL, so this is refused for backends that do not support it
+ * and for clients with filters attached, which use main loop timers.
+ */
+bool qemu_set_net_client_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (!nc || !nc->info->set_aio_context) {
+        return false;
+    }
+    if (ctx && !QTAILQ_EMPTY(&nc->filters)) {
+        return false;
+    }
+
+    nc->info->set_aio_context(nc, ctx);
+    return true;
+}
+
+/*
+ * Zero-copy receive, for backends that read packets themselves.
+ *
+ * qemu_receive_prepare() asks the peer of @nc for the memory the next
+ * packet should be read into, filling at most @iovcnt entries of @iov with
+ * at most @maxlen bytes.  It returns 0 if the peer cannot take a packet
+ * this way right now, and the backend must use qemu_send_packet_async().
+ *
+ * Otherwise the backend reads one packet of at most @maxlen bytes into
+ * @iov, followed by its own buffer at the same offset for whatever does
+ * not fit, and passes the size it read (or the read's error) to
+ * qemu_receive_complete().  If that returns false the whole packet has
+ * been copied back into the backend's buffer and must be sent the usual
+ * way; this happens when the peer ran out of buffers halfway.
+ */
+int qemu_receive_prepare(NetClientState *nc, struct iovec *iov, int iovcnt,
+                         size_t maxlen)
+{
+    NetClientState *peer = nc->peer;
+
+    if (!peer || !peer->info->receive_prepare ||
+        nc->link_down || peer->link_down ||
+        !QTAILQ_EMPTY(&nc->filters) || !QTAILQ_EMPTY(&peer->filters) ||
+        !qemu_can_send_packet(nc)) {
+        return 0;
+    }
+
+    return peer->info->receive_prepare(peer, iov, iovcnt, maxlen);
+}
+
+bool qemu_receive_complete(NetClientState *nc, uint8_t *buf, ssize_t size)
+{
+    NetClientState *peer = nc->peer;
+
+    return peer->info->receive_complete(peer, buf, size);
+}
+
 int qemu_can_send_packet(NetClientState *sender)
 {
     int vm_running = runstate_is_running();
@@ -753,6 +814,56 @@ ssize_t qemu_deliver_packet_iov(NetClientState *sender,
     return ret;
 }
 
+int qemu_deliver_packet_batch(NetClientState *sender,
+                              const struct iovec *pkts, int count,
+                              void *opaque)
+{
+    NetClientState *nc = opaque;
+
+    if (nc->link_down) {
+        return count;
+    }
+
+    if (nc->receive_disabled) {
+        return 0;
+    }
+
+    return nc->info->receive_iov_batch(nc, pkts, count);
+}
+
+/*
+ * Send a burst of packets, each in a single iovec.  Peers that implement
+ * receive_iov_batch get the whole burst in one call when nothing else is
+ * in the way; filters that have work to do still see the packets one by
+ * one.  Returns 0 if any packet was queued, in which case the caller must
+ * wait for @sent_cb.
+ */
+ssize_t qemu_send_packet_batch_async(NetClientState *sender,
+                                     const struct iovec *pkts, int count,
+                                     NetPacketSent *sent_cb)
+{
+    ssize_t ret = count;
+    int i;
+
+    if (sender->link_down || !sender->peer) {
+        return count;
+    }
+
+    if (qemu_netfilter_chain_idle(sender, NET_FILTER_DIRECTION_TX) &&
+        qemu_netfilter_chain_idle(sender->peer, NET_FILTER_DIRECTION_RX)) {
+        return qemu_net_queue_send_batch(sender->peer->incoming_queue, sender,
+                                         pkts, count, sent_cb);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (qemu_send_packet_async(sender, pkts[i].iov_base, pkts[i].iov_len,
+                                   sent_cb) == 0) {
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
 ssize_t qemu_sendv_packet_async(NetClientState *sender,
                                 const struct iovec *iov, int iovcnt,
                                 NetPacketSent *sent_cb)
@@ -963,6 +1074,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #endif
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
+#endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
 #endif
         [NET_CLIENT_DRIVER_DUMP]      = net_init_dump,
 #ifdef CONFIG_NET_BRIDGE
@@ -1373,6 +1487,53 @@ RxFilterInfoList *qmp_query_rx_filter(bool has_name, const char *name,
     return filter_list;
 }
 
+VhostNetQueueInfoList *qmp_query_vhost_net(bool has_name, const char *name,
+                                           Error **errp)
+{
+    NetClientState *nc;
+    VhostNetQueueInfoList *head = NULL, **tail = &head;
+    bool found = false;
+
+    QTAILQ_FOREACH(nc, &net_clients, next) {
+        VHostNetState *net;
+        VhostNetQueueInfoList *entry;
+        VhostNetQueueInfo *info;
+
+        /* all queues of a multiqueue backend share the name */
+        if (has_name && strcmp(nc->name, name) != 0) {
+            continue;
+        }
+        found = true;
+
+        /* vhost-user clients lose their vhost_net on disconnect */
+        if (nc->info->type != NET_CLIENT_DRIVER_TAP) {
+            continue;
+        }
+        net = get_vhost_net(nc);
+        if (!net) {
+            continue;
+        }
+
+        info = g_new0(VhostNetQueueInfo, 1);
+        info->name = g_strdup(nc->name);
+        info->queue_index = nc->queue_index;
+        vhost_net_get_info(net, info);
+
+        entry = g_new0(VhostNetQueueInfoList, 1);
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+
+    if (has_name && !found) {
+        error_setg(errp, "invalid net client name: %s", name);
+    } else if (has_name && !head) {
+        error_setg(errp, "net client(%s) doesn't use vhost", name);
+    }
+
+    return head;
+}
+
 void hmp_info_network(Monitor *mon, const QDict *qdict)
 {
     NetClientState *nc, *peer;
@@ -38,14 +38,26 @@
  *
  * If a sent callback isn't provided, we just drop the packet to avoid
  * unbounded queueing.
+ *
+ * Packets of up to NET_PACKET_POOL_BUFSIZE bytes are recycled through a
+ * small per-queue free list, so that a queue that keeps filling up and
+ * draining with small frames does not go to the allocator every time.
+ *
+ * When the queue has a batch handler, flushing hands it up to
+ * NET_QUEUE_FLUSH_BATCH packets at a time.
  */
 
+#define NET_PACKET_POOL_BUFSIZE 2048
+#define NET_PACKET_POOL_MAX     64
+#define NET_QUEUE_FLUSH_BATCH   64
+
 struct NetPacket {
     QTAILQ_ENTRY(NetPacket) entry;
     NetClientState *sender;
     unsigned flags;
     int size;
     NetPacketSent *sent_cb;
+    bool pooled;
     uint8_t data[0];
 };
 
@@ -54,8 +66,11 @@ struct NetQueue {
     uint32_t nq_maxlen;
     uint32_t nq_count;
     NetQueueDeliverFunc *deliver;
+    NetQueueDeliverBatchFunc *deliver_batch;
 
     QTAILQ_HEAD(packets, NetPacket) packets;
+    QTAILQ_HEAD(, NetPacket) pool;
+    uint32_t pool_count;
 
     unsigned delivering : 1;
 };
@@ -72,12 +87,19 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     queue->deliver = deliver;
 
     QTAILQ_INIT(&queue->packets);
+    QTAILQ_INIT(&queue->pool);
 
     queue->delivering = 0;
 
     return queue;
 }
 
+void qemu_net_queue_set_deliver_batch(NetQueue *queue,
+                                      NetQueueDeliverBatchFunc *deliver_batch)
+{
+    queue->deliver_batch = deliver_batch;
+}
+
 void qemu_del_net_queue(NetQueue *queue)
 {
     NetPacket *packet, *next;
@@ -86,10 +108,45 @@ void qemu_del_net_queue(NetQueue *queue)
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         g_free(packet);
     }
+    QTAILQ_FOREACH_SAFE(packet, &queue->pool, entry, next) {
+        QTAILQ_REMOVE(&queue->pool, packet, entry);
+        g_free(packet);
+    }
 
     g_free(queue);
 }
 
+static NetPacket *net_packet_alloc(NetQueue *queue, size_t size)
+{
+    NetPacket *packet;
+
+    if (size > NET_PACKET_POOL_BUFSIZE) {
+        packet = g_malloc(sizeof(NetPacket) + size);
+        packet->pooled = false;
+        return packet;
+    }
+
+    packet = QTAILQ_FIRST(&queue->pool);
+    if (packet) {
+        QTAILQ_REMOVE(&queue->pool, packet, entry);
+        queue->pool_count--;
+    } else {
+        packet = g_malloc(sizeof(NetPacket) + NET_PACKET_POOL_BUFSIZE);
+        packet->pooled = true;
+    }
+    return packet;
+}
+
+static void net_packet_free(NetQueue *queue, NetPacket *packet)
+{
+    if (packet->pooled && queue->pool_count < NET_PACKET_POOL_MAX) {
+        QTAILQ_INSERT_HEAD(&queue->pool, packet, entry);
+        queue->pool_count++;
+    } else {
+        g_free(packet);
+    }
+}
+
 static void qemu_net_queue_append(NetQueue *queue,
                                   NetClientState *sender,
                                   unsigned flags,
@@ -102,7 +159,7 @@ static void qemu_net_queue_append(NetQueue *queue,
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
         return; /* drop if queue full and no callback */
     }
-    packet = g_malloc(sizeof(NetPacket) + size);
+    packet = net_packet_alloc(queue, size);
     packet->sender = sender;
     packet->flags = flags;
     packet->size = size;
@@ -131,7 +188,7 @@ void qemu_net_queue_append_iov(NetQueue *queue,
         max_len += iov[i].iov_len;
     }
 
-    packet = g_malloc(sizeof(NetPacket) + max_len);
+    packet = net_packet_alloc(queue, max_len);
     packet->sender = sender;
     packet->sent_cb = sent_cb;
     packet->flags = flags;
@@ -232,6 +289,39 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     return ret;
 }
 
+/*
+ * Send @count packets of one iovec each.  When nothing is queued ahead of
+ * them they go to the batch handler in one call; whatever it leaves is sent
+ * one packet at a time.  Returns 0 if any packet was queued, in which case
+ * the caller must wait for @sent_cb, and @count otherwise.
+ */
+ssize_t qemu_net_queue_send_batch(NetQueue *queue,
+                                  NetClientState *sender,
+                                  const struct iovec *pkts,
+                                  int count,
+                                  NetPacketSent *sent_cb)
+{
+    ssize_t ret = count;
+    int i = 0;
+
+    if (queue->deliver_batch && !queue->delivering &&
+        QTAILQ_EMPTY(&queue->packets) && qemu_can_send_packet(sender)) {
+        queue->delivering = 1;
+        i = queue->deliver_batch(sender, pkts, count, queue->opaque);
+        queue->delivering = 0;
+    }
+
+    for (; i < count; i++) {
+        if (qemu_net_queue_send(queue, sender, QEMU_NET_PACKET_FLAG_NONE,
+                                pkts[i].iov_base, pkts[i].iov_len,
+                                sent_cb) == 0) {
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
     NetPacket *packet, *next;
@@ -243,9 +333,55 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
             if (packet->sent_cb) {
                 packet->sent_cb(packet->sender, 0);
             }
-            g_free(packet);
+            net_packet_free(queue, packet);
+        }
+    }
+}
+
+/*
+ * Hand the packets at the head of the queue that share a sender and have
+ * no flags to the batch handler in one call.  Returns how many of them it
+ * took; *offered is how many there were, the handler is not called for
+ * fewer than two.
+ */
+static int qemu_net_queue_flush_batch(NetQueue *queue, int *offered)
+{
+    struct iovec pkts[NET_QUEUE_FLUSH_BATCH];
+    NetPacket *batch[NET_QUEUE_FLUSH_BATCH];
+    NetClientState *sender = QTAILQ_FIRST(&queue->packets)->sender;
+    NetPacket *packet;
+    int count = 0, done, i;
+
+    QTAILQ_FOREACH(packet, &queue->packets, entry) {
+        if (count == NET_QUEUE_FLUSH_BATCH || packet->sender != sender ||
+            packet->flags != QEMU_NET_PACKET_FLAG_NONE) {
+            break;
+        }
+        batch[count] = packet;
+        pkts[count].iov_base = packet->data;
+        pkts[count].iov_len = packet->size;
+        count++;
+    }
+
+    *offered = count;
+    if (count < 2) {
+        return 0;
+    }
+
+    queue->delivering = 1;
+    done = queue->deliver_batch(sender, pkts, count, queue->opaque);
+    queue->delivering = 0;
+
+    for (i = 0; i < done; i++) {
+        packet = batch[i];
+        QTAILQ_REMOVE(&queue->packets, packet, entry);
+        queue->nq_count--;
+        if (packet->sent_cb) {
+            packet->sent_cb(packet->sender, packet->size);
         }
+        net_packet_free(queue, packet);
     }
+    return done;
 }
 
 bool qemu_net_queue_flush(NetQueue *queue)
@@ -254,6 +390,18 @@ bool qemu_net_queue_flush(NetQueue *queue)
         NetPacket *packet;
         int ret;
 
+        if (queue->deliver_batch) {
+            int offered;
+
+            ret = qemu_net_queue_flush_batch(queue, &offered);
+            if (offered > 1) {
+                if (ret < offered) {
+                    return false;
+                }
+                continue;
+            }
+        }
+
         packet = QTAILQ_FIRST(&queue->packets);
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         queue->nq_count--;
@@ -273,7 +421,7 @@ bool qemu_net_queue_flush(NetQueue *queue)
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        net_packet_free(queue, packet);
     }
     return true;
 }
@@ -40,17 +40,24 @@
 #include "qemu-common.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/atomic.h"
+#include "qemu/iov.h"
+#include "block/aio.h"
 
 #include "net/tap.h"
 
 #include "net/vhost_net.h"
 
+/* Room for a burst of small packets, and always for one more full one */
+#define TAP_BUFSIZE (2 * NET_BUFSIZE)
+#define TAP_BATCH_MAX 32
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
-    uint8_t buf[NET_BUFSIZE];
+    uint8_t buf[TAP_BUFSIZE];
     bool read_poll;
     bool write_poll;
     bool using_vnet_hdr;
@@ -59,6 +66,7 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    AioContext *ctx;            /* NULL when polled by the main loop */
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -66,9 +74,20 @@ static void launch_script(const char *setup_script, const char *ifname,
 
 static void tap_send(void *opaque);
 static void tap_writable(void *opaque);
+static void tap_aio_send(void *opaque);
+static void tap_aio_writable(void *opaque);
 
 static void tap_update_fd_handler(TAPState *s)
 {
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false,
+                           s->read_poll && s->enabled ? tap_aio_send : NULL,
+                           s->write_poll && s->enabled ? tap_aio_writable
+                                                       : NULL,
+                           NULL, s);
+        return;
+    }
+
     qemu_set_fd_handler(s->fd,
                         s->read_poll && s->enabled ? tap_send : NULL,
                         s->write_poll && s->enabled ? tap_writable : NULL,
@@ -96,6 +115,55 @@ static void tap_writable(void *opaque)
     qemu_flush_queued_packets(&s->nc);
 }
 
+/*
+ * Outside the main loop the handlers run under the AioContext lock, which
+ * is also what the peer and tap_set_aio_context() use to exclude them.
+ * The handler may have been moved away while we waited for the lock.
+ */
+static void tap_aio_send(void *opaque)
+{
+    TAPState *s = opaque;
+    AioContext *ctx = atomic_read(&s->ctx);
+
+    if (!ctx) {
+        return;
+    }
+    aio_context_acquire(ctx);
+    if (atomic_read(&s->ctx) == ctx) {
+        tap_send(s);
+    }
+    aio_context_release(ctx);
+}
+
+static void tap_aio_writable(void *opaque)
+{
+    TAPState *s = opaque;
+    AioContext *ctx = atomic_read(&s->ctx);
+
+    if (!ctx) {
+        return;
+    }
+    aio_context_acquire(ctx);
+    if (atomic_read(&s->ctx) == ctx) {
+        tap_writable(s);
+    }
+    aio_context_release(ctx);
+}
+
+/* Called with the BQL and the AioContext being entered or left held */
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+    atomic_set(&s->ctx, ctx);
+    tap_update_fd_handler(s);
+}
+
 static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt)
 {
     ssize_t len;
@@ -179,31 +247,109 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
+#define TAP_RECV_IOV_MAX 64
+
+/*
+ * Read the next packet, straight into the peer's buffers if @zerocopy and
+ * the peer can take it that way.  Returns what tap_read_packet() would, and
+ * sets *done if the peer has already received the packet; otherwise it is
+ * in @buf, which is s->buf whenever @zerocopy is set.
+ */
+static int tap_read_packet_zerocopy(TAPState *s, uint8_t *buf, bool zerocopy,
+                                    bool *done)
+{
+    struct iovec iov[TAP_RECV_IOV_MAX + 1];
+    int iovcnt = 0;
+    size_t len;
+    int size;
+
+    *done = false;
+#ifndef __sun__
+    /* A header that we strip must not land in guest memory */
+    if (zerocopy && (!s->host_vnet_hdr_len || s->using_vnet_hdr)) {
+        iovcnt = qemu_receive_prepare(&s->nc, iov, TAP_RECV_IOV_MAX,
+                                      NET_BUFSIZE);
+    }
+#endif
+    if (iovcnt <= 0) {
+        return tap_read_packet(s->fd, buf, NET_BUFSIZE);
+    }
+
+    len = iov_size(iov, iovcnt);
+    if (len < NET_BUFSIZE) {
+        iov[iovcnt].iov_base = s->buf + len;
+        iov[iovcnt].iov_len = NET_BUFSIZE - len;
+        iovcnt++;
+    }
+
+    size = readv(s->fd, iov, iovcnt);
+    *done = qemu_receive_complete(&s->nc, s->buf, size);
+    return size;
+}
+
+/* Returns false if the peer queued the burst and reading must stop */
+static bool tap_send_batch(TAPState *s, const struct iovec *batch, int count)
+{
+    if (count &&
+        !qemu_send_packet_batch_async(&s->nc, batch, count,
+                                      tap_send_completed)) {
+        tap_read_poll(s, false);
+        return false;
+    }
+    return true;
+}
+
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
+    NetClientState *peer = s->nc.peer;
+    bool batching = peer && peer->info->receive_iov_batch;
+    struct iovec batch[TAP_BATCH_MAX];
+    int nbatch = 0;
+    size_t used = 0;
     int size;
     int packets = 0;
 
     while (true) {
-        uint8_t *buf = s->buf;
+        uint8_t *buf = s->buf + used;
+        bool done;
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+        /* The peer's zero-copy buffers must not overtake a pending burst */
+        size = tap_read_packet_zerocopy(s, buf, nbatch == 0, &done);
         if (size <= 0) {
             break;
         }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
-        }
+        if (!done) {
+            used += size;
+            if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+                buf  += s->host_vnet_hdr_len;
+                size -= s->host_vnet_hdr_len;
+            }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
-            tap_read_poll(s, false);
-            break;
-        } else if (size < 0) {
-            break;
+            if (batching) {
+                batch[nbatch].iov_base = buf;
+                batch[nbatch].iov_len = size;
+                nbatch++;
+                if (nbatch == TAP_BATCH_MAX ||
+                    used + NET_BUFSIZE > sizeof(s->buf)) {
+                    if (!tap_send_batch(s, batch, nbatch)) {
+                        return;
+                    }
+                    nbatch = 0;
+                    used = 0;
+                }
+            } else {
+                used = 0;
+                size = qemu_send_packet_async(&s->nc, buf, size,
+                                              tap_send_completed);
+                if (size == 0) {
+                    tap_read_poll(s, false);
+                    break;
+                } else if (size < 0) {
+                    break;
+                }
+            }
         }
 
         /*
@@ -217,6 +363,8 @@ static void tap_send(void *opaque)
             break;
         }
     }
+
+    tap_send_batch(s, batch, nbatch);
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -359,6 +507,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_hdr_len = tap_set_vnet_hdr_len,
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -708,6 +857,8 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         }
     } else if (vhostfdname) {
         error_setg(errp, "vhostfd(s)= is not valid without vhost");
+    } else if (tap->has_poll_us) {
+        warn_report("tap: poll-us= has no effect without vhost");
     }
 }
 
@@ -449,6 +449,37 @@ void numa_cpu_pre_plug(const CPUArchId *slot, DeviceState *dev, Error **errp)
     }
 }
 
+/*
+ * With -machine numa-vcpu-affinity=on, move the calling vCPU thread to the
+ * host nodes that the memory of its guest NUMA node is bound to.
+ */
+void numa_cpu_bind_host_nodes(CPUState *cpu)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    MachineClass *mc = MACHINE_GET_CLASS(ms);
+    CpuInstanceProperties props;
+    HostMemoryBackend *backend;
+    int ret;
+
+    if (!ms->numa_vcpu_affinity || !nb_numa_nodes ||
+        !mc->cpu_index_to_instance_props) {
+        return;
+    }
+
+    props = mc->cpu_index_to_instance_props(ms, cpu->cpu_index);
+    if (!props.has_node_id || !numa_info[props.node_id].node_memdev) {
+        return;
+    }
+
+    backend = numa_info[props.node_id].node_memdev;
+    ret = qemu_bind_thread_to_host_nodes(backend->host_nodes, MAX_NODES);
+    if (ret < 0) {
+        warn_report("cannot bind CPU %d to the host nodes of NUMA node %"
+                    PRId64 ": %s", cpu->cpu_index, props.node_id,
+                    strerror(-ret));
+    }
+}
+
 static void allocate_system_memory_nonnuma(MemoryRegion *mr, Object *owner,
                                            const char *name,
                                            uint64_t ram_size)
@@ -456,7 +487,7 @@ static void allocate_system_memory_nonnuma(MemoryRegion *mr, Object *owner,
     if (mem_path) {
 #ifdef __linux__
         Error *err = NULL;
-        memory_region_init_ram_from_file(mr, owner, name, ram_size, 0, false,
+        memory_region_init_ram_from_file(mr, owner, name, ram_size, 0, 0,
                                          mem_path, &err);
         if (err) {
             error_report_err(err);
@@ -65,6 +65,8 @@ enum {
     OPTION_SIZE = 264,
     OPTION_PREALLOCATION = 265,
     OPTION_SHRINK = 266,
+    OPTION_RANDOM = 267,
+    OPTION_RWMIXREAD = 268,
 };
 
 typedef enum OutputFormat {
@@ -178,6 +180,8 @@ static void QEMU_NORETURN help(void)
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '-C' offload the copy to the storage (e.g. copy_file_range) if the\n"
+           "       source and target support it\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -1526,6 +1530,14 @@ enum ImgConvertBlockStatus {
 };
 
 #define MAX_COROUTINES 16
+/* Number of extents the block status coroutine may find ahead of the copy */
+#define CONVERT_STATUS_QUEUE_LEN 64
+
+typedef struct ImgConvertExtent {
+    int64_t sector_num;
+    int nb_sectors;
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
 
 typedef struct ImgConvertState {
     BlockBackend **src;
@@ -1534,15 +1546,25 @@ typedef struct ImgConvertState {
     int64_t total_sectors;
     int64_t allocated_sectors;
     int64_t allocated_done;
-    int64_t sector_num;
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    /* Ring of extents that still have to be copied, filled by status_co */
+    ImgConvertExtent status_queue[CONVERT_STATUS_QUEUE_LEN];
+    int status_head;
+    int status_count;
+    int64_t status_sector_num;
+    Coroutine *status_co;
+    bool status_co_waiting;
+    CoQueue status_waiters;
     BlockBackend *target;
     bool has_zero_init;
+    /* Freshly created with all data preallocated, so already zeroed */
+    bool target_is_zero;
     bool compressed;
     bool target_has_backing;
     bool wr_in_order;
+    bool copy_range;
     int min_sparse;
     size_t cluster_sectors;
     size_t buf_sectors;
@@ -1550,7 +1572,6 @@ typedef struct ImgConvertState {
     int running_coroutines;
     Coroutine *co[MAX_COROUTINES];
     int64_t wait_sector_num[MAX_COROUTINES];
-    CoMutex lock;
     int ret;
 } ImgConvertState;
 
@@ -1736,6 +1757,87 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
     return 0;
 }
 
+static int coroutine_fn convert_co_copy_range(ImgConvertState *s,
+                                              int64_t sector_num,
+                                              int nb_sectors)
+{
+    int n, ret;
+
+    while (nb_sectors > 0) {
+        BlockBackend *blk;
+        int src_cur;
+        int64_t bs_sectors, src_cur_offset;
+        int64_t offset;
+
+        convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
+        offset = (sector_num - src_cur_offset) << BDRV_SECTOR_BITS;
+        blk = s->src[src_cur];
+        bs_sectors = s->src_sectors[src_cur];
+
+        n = MIN(nb_sectors, bs_sectors - (sector_num - src_cur_offset));
+
+        ret = blk_co_copy_range(blk, offset, s->target,
+                                sector_num << BDRV_SECTOR_BITS,
+                                n << BDRV_SECTOR_BITS, 0);
+        if (ret < 0) {
+            return ret;
+        }
+
+        sector_num += n;
+        nb_sectors -= n;
+    }
+    return 0;
+}
+
+/*
+ * Query the block status of the source ahead of the copy coroutines, so that
+ * metadata lookups overlap with the data transfers instead of serialising all
+ * coroutines.
+ */
+static void coroutine_fn convert_co_block_status(void *opaque)
+{
+    ImgConvertState *s = opaque;
+    ImgConvertExtent *ext;
+    int n;
+
+    while (s->ret == -EINPROGRESS && s->status_sector_num < s->total_sectors) {
+        if (s->status_count == CONVERT_STATUS_QUEUE_LEN) {
+            /* Reentered by convert_co_do_copy() once an entry is free */
+            s->status_co_waiting = true;
+            qemu_coroutine_yield();
+            continue;
+        }
+
+        n = convert_iteration_sectors(s, s->status_sector_num);
+        if (n < 0) {
+            s->ret = n;
+            break;
+        }
+
+        ext = &s->status_queue[(s->status_head + s->status_count) %
+                               CONVERT_STATUS_QUEUE_LEN];
+        *ext = (ImgConvertExtent) {
+            .sector_num = s->status_sector_num,
+            .nb_sectors = n,
+            .status     = s->status,
+        };
+        s->status_count++;
+        s->status_sector_num += n;
+        qemu_co_queue_next(&s->status_waiters);
+    }
+
+    s->status_co = NULL;
+    qemu_co_queue_restart_all(&s->status_waiters);
+}
+
+static void convert_kick_block_status(ImgConvertState *s)
+{
+    if (s->status_co_waiting) {
+        s->status_co_waiting = false;
+        qemu_coroutine_enter(s->status_co);
+    }
+}
+
 static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
@@ -1758,28 +1860,34 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         int n;
         int64_t sector_num;
         enum ImgConvertBlockStatus status;
+        bool copy_range;
+        ImgConvertExtent *ext;
 
-        qemu_co_mutex_lock(&s->lock);
-        if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
-            qemu_co_mutex_unlock(&s->lock);
-            break;
+        while (s->ret == -EINPROGRESS && !s->status_count && s->status_co) {
+            qemu_co_queue_wait(&s->status_waiters, NULL);
         }
-        n = convert_iteration_sectors(s, s->sector_num);
-        if (n < 0) {
-            qemu_co_mutex_unlock(&s->lock);
-            s->ret = n;
+        if (s->ret != -EINPROGRESS || !s->status_count) {
             break;
         }
+
         /* save current sector and allocation status to local variables */
-        sector_num = s->sector_num;
-        status = s->status;
-        if (!s->min_sparse && s->status == BLK_ZERO) {
+        ext = &s->status_queue[s->status_head];
+        sector_num = ext->sector_num;
+        status = ext->status;
+        n = ext->nb_sectors;
+        if (!s->min_sparse && status == BLK_ZERO) {
             n = MIN(n, s->buf_sectors);
         }
-        /* increment global sector counter so that other coroutines can
-         * already continue reading beyond this request */
-        s->sector_num += n;
-        qemu_co_mutex_unlock(&s->lock);
+        /* consume the extent so that other coroutines can already continue
+         * reading beyond this request */
+        if (n < ext->nb_sectors) {
+            ext->sector_num += n;
+            ext->nb_sectors -= n;
+        } else {
+            s->status_head = (s->status_head + 1) % CONVERT_STATUS_QUEUE_LEN;
+            s->status_count--;
+            convert_kick_block_status(s);
+        }
 
         if (status == BLK_DATA || (!s->min_sparse && status == BLK_ZERO)) {
             s->allocated_done += n;
@@ -1787,7 +1895,9 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
                                         s->allocated_sectors, 0);
         }
 
-        if (status == BLK_DATA) {
+retry:
+        copy_range = s->copy_range && status == BLK_DATA;
+        if (status == BLK_DATA && !copy_range) {
             ret = convert_co_read(s, sector_num, n, buf);
             if (ret < 0) {
                 error_report("error while reading sector %" PRId64
@@ -1809,7 +1919,16 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         }
 
         if (s->ret == -EINPROGRESS) {
-            ret = convert_co_write(s, sector_num, n, buf, status);
+            if (copy_range) {
+                ret = convert_co_copy_range(s, sector_num, n);
+                if (ret) {
+                    /* Copy the data through the buffer from now on */
+                    s->copy_range = false;
+                    goto retry;
+                }
+            } else {
+                ret = convert_co_write(s, sector_num, n, buf, status);
+            }
             if (ret < 0) {
                 error_report("error while writing sector %" PRId64
                              ": %s", sector_num, strerror(-ret));
@@ -1838,6 +1957,8 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
     qemu_vfree(buf);
     s->co[index] = NULL;
     s->running_coroutines--;
+    /* let the block status coroutine notice errors */
+    convert_kick_block_status(s);
     if (!s->running_coroutines && s->ret == -EINPROGRESS) {
         /* the convert job finished successfully */
         s->ret = 0;
@@ -1854,6 +1975,12 @@ static int convert_do_copy(ImgConvertState *s)
                      ? bdrv_has_zero_init(blk_bs(s->target))
                      : false;
 
+    /* Even with -S 0 there is no point in writing zeroes to an image that
+     * was just preallocated; they are both allocated and zero already. */
+    if (!s->has_zero_init && s->target_is_zero && !s->target_has_backing) {
+        s->has_zero_init = bdrv_has_zero_init(blk_bs(s->target));
+    }
+
     if (!s->has_zero_init && !s->target_has_backing &&
         bdrv_can_write_zeroes_with_unmap(blk_bs(s->target)))
     {
@@ -1889,7 +2016,10 @@ static int convert_do_copy(ImgConvertState *s)
     s->sector_next_status = 0;
     s->ret = -EINPROGRESS;
 
-    qemu_co_mutex_init(&s->lock);
+    qemu_co_queue_init(&s->status_waiters);
+    s->status_co = qemu_coroutine_create(convert_co_block_status, s);
+    qemu_coroutine_enter(s->status_co);
+
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
         s->wait_sector_num[i] = -1;
@@ -1946,7 +2076,7 @@ static int img_convert(int argc, char **argv)
             {"target-image-opts", no_argument, 0, OPTION_TARGET_IMAGE_OPTS},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:O:B:co:s:l:S:pt:T:qnm:WU",
+        c = getopt_long(argc, argv, ":hf:O:B:Cco:s:l:S:pt:T:qnm:WU",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -1973,6 +2103,9 @@ static int img_convert(int argc, char **argv)
         case 'c':
             s.compressed = true;
             break;
+        case 'C':
+            s.copy_range = true;
+            break;
         case 'o':
             if (!is_valid_option_list(optarg)) {
                 error_report("Invalid option list: %s", optarg);
@@ -2077,6 +2210,11 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
+    if (s.compressed && s.copy_range) {
+        error_report("Cannot enable copy offloading when -c is used");
+        goto fail_getopt;
+    }
+
     if (tgt_image_opts && !skip_create) {
         error_report("--target-image-opts requires use of -n flag");
         goto fail_getopt;
@@ -2255,6 +2393,8 @@ static int img_convert(int argc, char **argv)
     }
 
     if (!skip_create) {
+        const char *preallocation = qemu_opt_get(opts, BLOCK_OPT_PREALLOC);
+
         /* Create the new image */
         ret = bdrv_create(drv, out_filename, opts, &local_err);
         if (ret < 0) {
@@ -2262,6 +2402,10 @@ static int img_convert(int argc, char **argv)
                               out_filename, out_fmt);
             goto out;
         }
+
+        s.target_is_zero = preallocation &&
+                           (!strcmp(preallocation, "full") ||
+                            !strcmp(preallocation, "falloc"));
     }
 
     flags = s.min_sparse ? (BDRV_O_RDWR | BDRV_O_UNMAP) : BDRV_O_RDWR;
@@ -2329,6 +2473,13 @@ static int img_convert(int argc, char **argv)
         s.cluster_sectors = bdi.cluster_size / BDRV_SECTOR_SIZE;
     }
 
+    /* Raw images have no metadata that could get fragmented by writing out
+     * of order, so don't make the coroutines wait for each other */
+    if (!strcmp(out_bs->drv->format_name, "raw") && !s.compressed &&
+        !s.target_has_backing) {
+        s.wr_in_order = false;
+    }
+
     ret = convert_do_copy(&s);
 out:
     if (!ret) {
@@ -3748,6 +3899,18 @@ out_no_progress:
     return 0;
 }
 
+/* Latencies are recorded in buckets that are 1/16 of a power of two wide */
+#define BENCH_LAT_SUB_BITS 4
+#define BENCH_LAT_BUCKETS (64 << BENCH_LAT_SUB_BITS)
+
+typedef struct BenchStats {
+    uint64_t requests;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t buckets[BENCH_LAT_BUCKETS];
+} BenchStats;
+
 typedef struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
@@ -3758,14 +3921,134 @@ typedef struct BenchData {
     int n;
     int flush_interval;
     bool drain_on_flush;
+    bool random;
+    int rwmixread;
     uint8_t *buf;
     QEMUIOVector *qiov;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
+
+    /* Indexed by whether the requests are writes */
+    BenchStats stats[2];
 } BenchData;
 
+typedef struct BenchRequest {
+    BenchData *b;
+    bool write;
+    int64_t start_ns;
+} BenchRequest;
+
+static int bench_lat_bucket(uint64_t ns)
+{
+    int msb;
+
+    if (ns < (1 << BENCH_LAT_SUB_BITS)) {
+        return ns;
+    }
+    msb = 63 - clz64(ns);
+    return ((msb - BENCH_LAT_SUB_BITS + 1) << BENCH_LAT_SUB_BITS) |
+           ((ns >> (msb - BENCH_LAT_SUB_BITS)) &
+            ((1 << BENCH_LAT_SUB_BITS) - 1));
+}
+
+/* Returns the smallest latency that is recorded in @bucket */
+static uint64_t bench_lat_value(int bucket)
+{
+    int shift = bucket >> BENCH_LAT_SUB_BITS;
+    uint64_t mantissa = bucket & ((1 << BENCH_LAT_SUB_BITS) - 1);
+
+    if (shift == 0) {
+        return bucket;
+    }
+    return (mantissa | (1 << BENCH_LAT_SUB_BITS)) << (shift - 1);
+}
+
+static void bench_stats_add(BenchStats *st, uint64_t ns)
+{
+    if (!st->requests || ns < st->min_ns) {
+        st->min_ns = ns;
+    }
+    st->max_ns = MAX(st->max_ns, ns);
+    st->requests++;
+    st->total_ns += ns;
+    st->buckets[bench_lat_bucket(ns)]++;
+}
+
+/* Returns the latency below which @permille of the requests completed */
+static uint64_t bench_stats_percentile(BenchStats *st, int permille)
+{
+    uint64_t rank = MAX(1, (st->requests * permille + 999) / 1000);
+    uint64_t sum = 0;
+    int i;
+
+    for (i = 0; i < BENCH_LAT_BUCKETS; i++) {
+        sum += st->buckets[i];
+        if (sum >= rank) {
+            return MAX(st->min_ns, MIN(st->max_ns, bench_lat_value(i)));
+        }
+    }
+    return st->max_ns;
+}
+
+static const struct {
+    const char *name;
+    int permille;
+} bench_percentiles[] = {
+    { "p50",    500 },
+    { "p90",    900 },
+    { "p99",    990 },
+    { "p99.9",  999 },
+};
+
+static void bench_print_stats(const char *name, BenchStats *st)
+{
+    int i;
+
+    if (!st->requests) {
+        return;
+    }
+
+    printf("%s: %" PRIu64 " requests, latency (us): min %.1f, avg %.1f, "
+           "max %.1f\n", name, st->requests, st->min_ns / 1000.0,
+           (double)st->total_ns / st->requests / 1000.0,
+           st->max_ns / 1000.0);
+    printf("%s: percentiles (us):", name);
+    for (i = 0; i < ARRAY_SIZE(bench_percentiles); i++) {
+        printf(" %s %.1f", bench_percentiles[i].name,
+               bench_stats_percentile(st, bench_percentiles[i].permille) /
+               1000.0);
+    }
+    printf("\n");
+}
+
+static void bench_stats_to_qdict(QDict *dict, const char *name,
+                                 BenchStats *st)
+{
+    QDict *stats, *percentiles;
+    int i;
+
+    if (!st->requests) {
+        return;
+    }
+
+    percentiles = qdict_new();
+    for (i = 0; i < ARRAY_SIZE(bench_percentiles); i++) {
+        qdict_put_int(percentiles, bench_percentiles[i].name,
+                      bench_stats_percentile(st,
+                                             bench_percentiles[i].permille));
+    }
+
+    stats = qdict_new();
+    qdict_put_int(stats, "requests", st->requests);
+    qdict_put_int(stats, "min-ns", st->min_ns);
+    qdict_put_int(stats, "avg-ns", st->total_ns / st->requests);
+    qdict_put_int(stats, "max-ns", st->max_ns);
+    qdict_put(stats, "percentiles-ns", percentiles);
+    qdict_put(dict, name, stats);
+}
+
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
     if (ret < 0) {
@@ -3774,6 +4057,21 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
+static void bench_cb(void *opaque, int ret);
+
+static void bench_request_cb(void *opaque, int ret)
+{
+    BenchRequest *req = opaque;
+    BenchData *b = req->b;
+
+    if (ret >= 0) {
+        bench_stats_add(&b->stats[req->write], get_clock() - req->start_ns);
+    }
+    g_free(req);
+
+    bench_cb(b, ret);
+}
+
 static void bench_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
@@ -3820,6 +4118,20 @@ static void bench_cb(void *opaque, int ret)
 
     while (b->n > b->in_flight && b->in_flight < b->nrreq) {
         int64_t offset = b->offset;
+        BenchRequest *req;
+
+        if (b->random) {
+            offset = (uint64_t)(g_random_double() *
+                                (b->image_size / b->bufsize)) * b->bufsize;
+        }
+
+        req = g_new(BenchRequest, 1);
+        *req = (BenchRequest) {
+            .b      = b,
+            .write  = b->write && !(b->rwmixread &&
+                                    g_random_int_range(0, 100) < b->rwmixread),
+        };
+
         /* blk_aio_* might look for completed I/Os and kick bench_cb
          * again, so make sure this operation is counted by in_flight
          * and b->offset is ready for the next submission.
@@ -3827,10 +4139,13 @@ static void bench_cb(void *opaque, int ret)
         b->in_flight++;
         b->offset += b->step;
         b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+        req->start_ns = get_clock();
+        if (req->write) {
+            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0,
+                                  bench_request_cb, req);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0,
+                                 bench_request_cb, req);
         }
         if (!acb) {
             error_report("Failed to issue request");
@@ -3854,12 +4169,17 @@ static int img_bench(int argc, char **argv)
     size_t step = 0;
     int flush_interval = 0;
     bool drain_on_flush = true;
+    bool random = false;
+    int rwmixread = 0;
+    const char *output = NULL;
+    OutputFormat output_format = OFORMAT_HUMAN;
     int64_t image_size;
     BlockBackend *blk = NULL;
     BenchData data = {};
     int flags = 0;
     bool writethrough = false;
     struct timeval t1, t2;
+    double seconds;
     int i;
     bool force_share = false;
 
@@ -3871,6 +4191,9 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"random", no_argument, 0, OPTION_RANDOM},
+            {"rwmixread", required_argument, 0, OPTION_RWMIXREAD},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:no:qs:S:t:wU", long_options, NULL);
@@ -3995,6 +4318,23 @@ static int img_bench(int argc, char **argv)
         case OPTION_NO_DRAIN:
             drain_on_flush = false;
             break;
+        case OPTION_RANDOM:
+            random = true;
+            break;
+        case OPTION_RWMIXREAD:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid read percentage specified");
+                return 1;
+            }
+            rwmixread = res;
+            break;
+        }
+        case OPTION_OUTPUT:
+            output = optarg;
+            break;
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
@@ -4006,11 +4346,25 @@ static int img_bench(int argc, char **argv)
     }
     filename = argv[argc - 1];
 
+    if (output && !strcmp(output, "json")) {
+        output_format = OFORMAT_JSON;
+    } else if (output && !strcmp(output, "human")) {
+        output_format = OFORMAT_HUMAN;
+    } else if (output) {
+        error_report("--output must be used with human or json as argument.");
+        return 1;
+    }
+
     if (!is_write && flush_interval) {
         error_report("--flush-interval is only available in write tests");
         ret = -1;
         goto out;
     }
+    if (!is_write && rwmixread) {
+        error_report("--rwmixread is only available in write tests");
+        ret = -1;
+        goto out;
+    }
     if (flush_interval && flush_interval < depth) {
         error_report("Flush interval can't be smaller than depth");
         ret = -1;
@@ -4029,6 +4383,11 @@ static int img_bench(int argc, char **argv)
         ret = image_size;
         goto out;
     }
+    if (random && image_size < bufsize) {
+        error_report("Image is smaller than the buffer size");
+        ret = -1;
+        goto out;
+    }
 
     data = (BenchData) {
         .blk            = blk,
@@ -4041,13 +4400,27 @@ static int img_bench(int argc, char **argv)
         .write          = is_write,
         .flush_interval = flush_interval,
         .drain_on_flush = drain_on_flush,
+        .random         = random,
+        .rwmixread      = rwmixread,
     };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+    if (output_format == OFORMAT_HUMAN) {
+        if (random) {
+            printf("Sending %d %s requests, %d bytes each, %d in parallel "
+                   "(random offsets)\n",
+                   data.n, data.write ? "write" : "read", data.bufsize,
+                   data.nrreq);
+        } else {
+            printf("Sending %d %s requests, %d bytes each, %d in parallel "
+                   "(starting at offset %" PRId64 ", step size %d)\n",
+                   data.n, data.write ? "write" : "read", data.bufsize,
+                   data.nrreq, data.offset, data.step);
+        }
+        if (rwmixread) {
+            printf("%d%% of the requests are reads\n", rwmixread);
+        }
+        if (flush_interval) {
+            printf("Sending flush every %d requests\n", flush_interval);
+        }
     }
 
     data.buf = blk_blockalign(blk, data.nrreq * data.bufsize);
@@ -4068,9 +4441,26 @@ static int img_bench(int argc, char **argv)
     }
     gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    seconds = (t2.tv_sec - t1.tv_sec) +
+              ((double)(t2.tv_usec - t1.tv_usec) / 1000000);
+
+    if (output_format == OFORMAT_JSON) {
+        QDict *result = qdict_new();
+        QString *str;
+
+        qdict_put(result, "seconds", qnum_from_double(seconds));
+        bench_stats_to_qdict(result, "read", &data.stats[false]);
+        bench_stats_to_qdict(result, "write", &data.stats[true]);
+
+        str = qobject_to_json_pretty(QOBJECT(result));
+        printf("%s\n", qstring_get_str(str));
+        QDECREF(str);
+        QDECREF(result);
+    } else {
+        printf("Run completed in %3.3f seconds.\n", seconds);
+        bench_print_stats("read", &data.stats[false]);
+        bench_print_stats("write", &data.stats[true]);
+    }
 
 out:
     qemu_vfree(data.buf);
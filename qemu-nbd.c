@@ -36,6 +36,7 @@
 #include "block/snapshot.h"
 #include "qapi/qmp/qstring.h"
 #include "qom/object_interfaces.h"
+#include "sysemu/iothread.h"
 #include "io/channel-socket.h"
 #include "io/net-listener.h"
 #include "crypto/init.h"
@@ -51,6 +52,7 @@
 #define QEMU_NBD_OPT_TLSCREDS      261
 #define QEMU_NBD_OPT_IMAGE_OPTS    262
 #define QEMU_NBD_OPT_FORK          263
+#define QEMU_NBD_OPT_IOTHREAD      264
 
 #define MBR_SIZE 512
 
@@ -97,6 +99,8 @@ static void usage(const char *name)
 "                            specify tracing options\n"
 "  --fork                    fork off the server process and exit the parent\n"
 "                            once the server is running\n"
+"  --iothread                handle the export and its clients in a dedicated\n"
+"                            thread instead of the main loop\n"
 #ifdef __linux__
 "Kernel NBD client support:\n"
 "  -c, --connect=DEV         connect FILE to the local NBD device DEV\n"
@@ -117,7 +121,7 @@ static void usage(const char *name)
 "                            '[ID_OR_NAME]'\n"
 "  -n, --nocache             disable host cache\n"
 "      --cache=MODE          set cache mode (none, writeback, ...)\n"
-"      --aio=MODE            set AIO mode (native or threads)\n"
+"      --aio=MODE            set AIO mode (native, io_uring or threads)\n"
 "      --discard=MODE        set discard mode (ignore, unmap)\n"
 "      --detect-zeroes=MODE  set detect-zeroes mode (off, on, unmap)\n"
 "      --image-opts          treat FILE as a full set of image options\n"
@@ -326,22 +330,45 @@ static int nbd_can_accept(void)
     return state == RUNNING && nb_fds < shared;
 }
 
+/* May run in the I/O thread, so wake up main_loop_wait() */
 static void nbd_export_closed(NBDExport *exp)
 {
     assert(state == TERMINATING);
     state = TERMINATED;
+    qemu_notify_event();
 }
 
 static void nbd_update_server_watch(void);
 
-static void nbd_client_closed(NBDClient *client, bool negotiated)
+typedef struct NBDClientClosed {
+    NBDClient *client;
+    bool negotiated;
+} NBDClientClosed;
+
+static void nbd_client_closed_bh(void *opaque)
 {
+    NBDClientClosed *closed = opaque;
+
     nb_fds--;
-    if (negotiated && nb_fds == 0 && !persistent && state == RUNNING) {
+    if (closed->negotiated && nb_fds == 0 && !persistent &&
+        state == RUNNING) {
         state = TERMINATE;
     }
     nbd_update_server_watch();
-    nbd_client_put(client);
+    nbd_client_put(closed->client);
+    g_free(closed);
+}
+
+/* Clients are closed from the AioContext of the export, but the listener
+ * and the server state belong to the main loop */
+static void nbd_client_closed(NBDClient *client, bool negotiated)
+{
+    NBDClientClosed *closed = g_new(NBDClientClosed, 1);
+
+    closed->client = client;
+    closed->negotiated = negotiated;
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), nbd_client_closed_bh,
+                            closed);
 }
 
 static void nbd_accept(QIONetListener *listener, QIOChannelSocket *cioc,
@@ -526,6 +553,7 @@ int main(int argc, char **argv)
         { "image-opts", no_argument, NULL, QEMU_NBD_OPT_IMAGE_OPTS },
         { "trace", required_argument, NULL, 'T' },
         { "fork", no_argument, NULL, QEMU_NBD_OPT_FORK },
+        { "iothread", no_argument, NULL, QEMU_NBD_OPT_IOTHREAD },
         { NULL, 0, NULL, 0 }
     };
     int ch;
@@ -549,6 +577,9 @@ int main(int argc, char **argv)
     bool writethrough = true;
     char *trace_file = NULL;
     bool fork_process = false;
+    bool use_iothread = false;
+    IOThread *iothread = NULL;
+    AioContext *ctx = qemu_get_aio_context();
     int old_stderr = -1;
     unsigned socket_activation;
 
@@ -599,6 +630,8 @@ int main(int argc, char **argv)
             seen_aio = true;
             if (!strcmp(optarg, "native")) {
                 flags |= BDRV_O_NATIVE_AIO;
+            } else if (!strcmp(optarg, "io_uring")) {
+                flags |= BDRV_O_IO_URING;
             } else if (!strcmp(optarg, "threads")) {
                 /* this is the default */
             } else {
@@ -751,6 +784,9 @@ int main(int argc, char **argv)
         case QEMU_NBD_OPT_FORK:
             fork_process = true;
             break;
+        case QEMU_NBD_OPT_IOTHREAD:
+            use_iothread = true;
+            break;
         }
     }
 
@@ -1000,8 +1036,21 @@ int main(int argc, char **argv)
         }
     }
 
+    /* Created only now because threads do not survive the fork above */
+    if (use_iothread) {
+        iothread = iothread_create("qemu-nbd-iothread", &local_err);
+        if (!iothread) {
+            error_report_err(local_err);
+            exit(EXIT_FAILURE);
+        }
+        ctx = iothread_get_aio_context(iothread);
+        blk_set_aio_context(blk, ctx);
+    }
+
+    aio_context_acquire(ctx);
     exp = nbd_export_new(bs, dev_offset, fd_size, nbdflags, nbd_export_closed,
                          writethrough, NULL, &local_err);
+    aio_context_release(ctx);
     if (!exp) {
         error_report_err(local_err);
         exit(EXIT_FAILURE);
@@ -1048,12 +1097,18 @@ int main(int argc, char **argv)
         main_loop_wait(false);
         if (state == TERMINATE) {
             state = TERMINATING;
+            aio_context_acquire(ctx);
             nbd_export_close(exp);
             nbd_export_put(exp);
+            aio_context_release(ctx);
             exp = NULL;
         }
     } while (state != TERMINATED);
 
+    if (iothread) {
+        /* Moves the image back to the main context */
+        iothread_stop_all();
+    }
     blk_unref(blk);
     if (sockpath) {
         unlink(sockpath);
@@ -35,8 +35,10 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kernel_irqchip=on|off|split controls accelerated irqchip support (default=off)\n"
     "                vmport=on|off|auto controls emulation of vmport (default: auto)\n"
     "                kvm_shadow_mem=size of KVM shadow MMU in bytes\n"
+    "                kvm-dirty-ring-size=n track dirty pages with n-entry KVM dirty rings\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
+    "                numa-vcpu-affinity=on|off binds vCPUs to the host nodes of their NUMA node's memdev (default=off)\n"
     "                igd-passthru=on|off controls IGD GFX passthrough support (default=off)\n"
     "                aes-key-wrap=on|off controls support for AES key wrapping (default=on)\n"
     "                dea-key-wrap=on|off controls support for DEA key wrapping (default=on)\n"
@@ -79,12 +81,23 @@ value based on accel. For accel=xen the default is off otherwise the default
 is on.
 @item kvm_shadow_mem=size
 Defines the size of the KVM shadow MMU.
+@item kvm-dirty-ring-size=@var{n}
+Track dirty guest memory with per-vCPU KVM dirty rings of @var{n} entries
+each, a power of two, instead of per-slot dirty bitmaps.  The cost of a
+dirty log sync then depends on how many pages were written rather than on
+the size of the guest.  The default of 0 uses dirty bitmaps.
 @item dump-guest-core=on|off
 Include guest memory in a core dump. The default is on.
 @item mem-merge=on|off
 Enables or disables memory merge support. This feature, when supported by
 the host, de-duplicates identical memory pages among VMs instances
 (enabled by default).
+@item numa-vcpu-affinity=on|off
+Restrict the thread of each vCPU to the host CPUs of the @option{host-nodes}
+of the memory backend of its guest NUMA node, so that vCPUs run next to
+their memory.  vCPUs of nodes whose memdev has no @option{host-nodes} are
+left alone.  Only vCPUs with a thread of their own (KVM, or TCG with
+@option{thread=multi}) are bound.  The default is off.
 @item aes-key-wrap=on|off
 Enables or disables AES key wrapping support on s390-ccw hosts. This feature
 controls whether AES wrapping keys will be created to allow
@@ -758,6 +771,10 @@ The maximum total size of the L2 table and refcount block caches in bytes
 The maximum size of the L2 table cache in bytes
 (default: 4/5 of the total cache size)
 
+@item l2-cache-entry-size
+The size of each entry in the L2 table cache in bytes, a power of two between
+512 and the cluster size (default: the cluster size)
+
 @item refcount-cache-size
 The maximum size of the refcount block cache in bytes
 (default: 1/5 of the total cache size)
@@ -766,6 +783,20 @@ The maximum size of the refcount block cache in bytes
 Clean unused entries in the L2 and refcount caches. The interval is in seconds.
 The default value is 0 and it disables this feature.
 
+@item alloc-extent-size
+Allocate host clusters for guest data in runs of this size in bytes, so that
+most cluster allocations don't need to update or flush refcount blocks.
+Clusters of a run that are still unused when the image is closed are freed
+again; after a crash they show up as leaked clusters. The default value is 0
+and it disables this feature.
+
+@item bitmap-checkpoint-interval
+Write the parts of persistent dirty bitmaps that changed to the image at this
+interval, so that closing the image only has to write what changed since the
+last checkpoint. The interval is in seconds. The bitmaps stay marked as in use
+in the image until it is closed. The default value is 0 and it disables this
+feature.
+
 @item pass-discard-request
 Whether discard requests to the qcow2 device should be forwarded to the data
 source (on/off; default: on if discard=unmap is specified, off otherwise)
@@ -807,7 +838,8 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,serial=s][,addr=A][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name]\n"
+    "       [,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -879,7 +911,7 @@ unsafe       │ on                off            on
 The default mode is @option{cache=writeback}.
 
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread based disk I/O, native Linux AIO and Linux io_uring.
 @item format=@var{format}
 Specify which disk @var{format} will be used rather than detecting
 the format.  Can be used to specify format=raw to avoid interpreting
@@ -1036,7 +1068,8 @@ DEF("fsdev", HAS_ARG, QEMU_OPTION_fsdev,
     " [[,throttling.iops-total=i]|[[,throttling.iops-read=r][,throttling.iops-write=w]]]\n"
     " [[,throttling.bps-total-max=bm]|[[,throttling.bps-read-max=rm][,throttling.bps-write-max=wm]]]\n"
     " [[,throttling.iops-total-max=im]|[[,throttling.iops-read-max=irm][,throttling.iops-write-max=iwm]]]\n"
-    " [[,throttling.iops-size=is]]\n",
+    " [[,throttling.iops-size=is]]\n"
+    " [[,throttling.iops-meta=im][,throttling.iops-meta-max=imm]]\n",
     QEMU_ARCH_ALL)
 
 STEXI
@@ -1088,6 +1121,12 @@ with security models "mapped-xattr" and "mapped-file".
 @item dmode=@var{dmode}
 Specifies the default mode for newly created directories on the host. Works
 only with security models "mapped-xattr" and "mapped-file".
+@item throttling.iops-meta=@var{im}
+Limit the number of requests per second that do not transfer file data,
+such as walk, getattr, readdir or create. Reads and writes are covered by
+the other throttling options. @option{throttling.iops-meta-max} and
+@option{throttling.iops-meta-max-length} set a burst as for -drive.
+Works only with the "local" fsdriver.
 @end table
 
 -fsdev option is used along with -device driver "virtio-9p-pci".
@@ -2016,6 +2055,12 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                attach to the existing netmap-enabled network interface 'name', or to a\n"
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
+#endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m][,xsks-map=path]\n"
+    "                attach to queues 'm' to 'm+n-1' of the host network interface\n"
+    "                'name' with AF_XDP sockets\n"
 #endif
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -2272,6 +2317,15 @@ qemu-system-i386 linux.img \
                  -net nic -net tap,"helper=/path/to/qemu-bridge-helper"
 @end example
 
+@example
+#launch a QEMU instance with a four queue TAP device whose queues,
+#together with the virtio-net queue pairs, run in two IOThreads
+qemu-system-x86_64 linux.img \
+                 -object iothread,id=io0 -object iothread,id=io1 \
+                 -netdev tap,id=net0,vhost=off,queues=4 \
+                 -device virtio-net-pci,netdev=net0,mq=on,vectors=10,iothreads=io0:io1
+@end example
+
 @item -netdev bridge,id=@var{id}[,br=@var{bridge}][,helper=@var{helper}]
 @itemx -net bridge[,vlan=@var{n}][,name=@var{name}][,br=@var{bridge}][,helper=@var{helper}]
 Connect a host TAP network interface to a host bridge device.
@@ -2455,6 +2509,31 @@ The hubport netdev lets you connect a NIC to a QEMU "vlan" instead of a single
 netdev.  @code{-net} and @code{-device} with parameter @option{vlan} create the
 required hub automatically.
 
+@item -netdev af-xdp,id=@var{id},ifname=@var{name}[,mode=native|skb][,force-copy=on|off][,queues=@var{n}][,start-queue=@var{m}][,xsks-map=@var{path}]
+
+Bind AF_XDP sockets to @var{n} receive queues of the host interface
+@var{name}, starting at queue @var{m}, and exchange packets with them
+without going through the host network stack.  Each queue becomes one
+queue pair of a multiqueue virtio-net device.  QEMU attaches an XDP program
+that sends the packets of these queues to its sockets and everything else
+to the host stack; with @option{xsks-map} it only adds its sockets to the
+pinned XSKMAP @var{path} used by a program the user attached instead.
+
+@option{mode} selects the driver (@code{native}) or generic (@code{skb})
+XDP hook, the default is whichever works, driver first.  Zero-copy is used
+when the driver supports it unless @option{force-copy=on}.  Packets for the
+guest must be steered to the chosen queues, for example with
+@code{ethtool -N}.  When the virtio-net device uses an IOThread, the
+receive rings are busy polled from it.  Needs @code{CAP_NET_ADMIN} and
+@code{CAP_BPF} or root, and a kernel with AF_XDP support.
+
+Example:
+@example
+qemu-system-x86_64 linux.img -object iothread,id=io0 \
+        -netdev af-xdp,id=net0,ifname=eth1,queues=2,start-queue=4 \
+        -device virtio-net-pci,netdev=net0,mq=on,vectors=6,iothread=io0
+@end example
+
 @item -netdev vhost-user,chardev=@var{id}[,vhostforce=on|off][,queues=n]
 
 Establish a vhost-user netdev, backed by a chardev @var{id}. The chardev should
@@ -3703,6 +3782,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                load the migration stream from the given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -3721,6 +3802,12 @@ Accept incoming migration from a given filedescriptor.
 @item -incoming exec:@var{cmdline}
 Accept incoming migration as an output from specified external command.
 
+@item -incoming file:@var{filename}
+Load the migration stream from the given file, as saved by migrating to a
+file: URI.  If the file was saved with the x-mapped-ram capability, set it
+here as well (with @code{-global migration.x-mapped-ram=on}); guest RAM is
+then mapped from the file and read on first access.
+
 @item -incoming defer
 Wait for the URI to be specified via migrate_incoming.  The monitor can
 be used to change settings (such as migration parameters) prior to issuing
@@ -3974,7 +4061,7 @@ property must be set.  These objects are placed in the
 
 @table @option
 
-@item -object memory-backend-file,id=@var{id},size=@var{size},mem-path=@var{dir},share=@var{on|off},discard-data=@var{on|off},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},align=@var{align}
+@item -object memory-backend-file,id=@var{id},size=@var{size},mem-path=@var{dir},share=@var{on|off},discard-data=@var{on|off},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave},align=@var{align},pmem=@var{on|off}
 
 Creates a memory file backend object, which can be used to back
 the guest RAM with huge pages.
@@ -4034,6 +4121,13 @@ requires an alignment different than the default one used by QEMU, eg
 the device DAX /dev/dax0.0 requires 2M alignment rather than 4K. In
 such cases, users can specify the required alignment via this option.
 
+The @option{pmem} option specifies whether the backing file specified
+by @option{mem-path} is in host persistent memory that can be accessed
+using the SNIA NVM programming model (e.g. Intel NVDIMM).  It requires
+@option{share}=on.  QEMU then maps the file with MAP_SYNC if the host
+supports it, and writes back the guest memory after an incoming migration
+so that it is persistent when the migration completes.
+
 @item -object memory-backend-ram,id=@var{id},merge=@var{on|off},dump=@var{on|off},prealloc=@var{on|off},size=@var{size},host-nodes=@var{host-nodes},policy=@var{default|preferred|bind|interleave}
 
 Creates a memory backend object, which can be used to back the guest RAM.
@@ -4163,13 +4257,16 @@ Dump the network traffic on netdev @var{dev} to the file specified by
 The file format is libpcap, so it can be analyzed with tools such as tcpdump
 or Wireshark.
 
-@item -object colo-compare,id=@var{id},primary_in=@var{chardevid},secondary_in=@var{chardevid},outdev=@var{chardevid}[,vnet_hdr_support]
+@item -object colo-compare,id=@var{id},primary_in=@var{chardevid},secondary_in=@var{chardevid},outdev=@var{chardevid}[,vnet_hdr_support][,compare_threads=@var{n}]
 
 Colo-compare gets packet from primary_in@var{chardevid} and secondary_in@var{chardevid}, than compare primary packet with
 secondary packet. If the packets are same, we will output primary
 packet to outdev@var{chardevid}, else we will notify colo-frame
 do checkpoint and send primary packet to outdev@var{chardevid}.
 if it has the vnet_hdr_support flag, colo compare will send/recv packet with vnet_hdr_len.
+@option{compare_threads} spreads the connections over @var{n} threads
+(at most 16) that compare packets in parallel; the default of 1
+compares them in the iothread.
 
 we must use it with the help of filter-mirror and filter-redirector.
 
@@ -22,6 +22,8 @@
 #define GUEST_EXEC_MAX_OUTPUT (16*1024*1024)
 /* Allocation and I/O buffer for reading guest-exec out_data/err_data - 4KB */
 #define GUEST_EXEC_IO_SIZE (4*1024)
+/* The capture buffer doubles from this size as output arrives - 64KB */
+#define GUEST_EXEC_INITIAL_SIZE (64*1024)
 
 /* Note: in some situations, like with the fsfreeze, logging may be
  * temporarilly disabled. if it is necessary that a command be able
@@ -340,8 +342,11 @@ static gboolean guest_exec_output_watch(GIOChannel *ch,
 
     if (p->size == p->length) {
         gpointer t = NULL;
+        gsize new_size = MIN(MAX(p->size * 2, GUEST_EXEC_INITIAL_SIZE),
+                             GUEST_EXEC_MAX_OUTPUT);
+
         if (!p->truncated && p->size < GUEST_EXEC_MAX_OUTPUT) {
-            t = g_try_realloc(p->data, p->size + GUEST_EXEC_IO_SIZE);
+            t = g_try_realloc(p->data, new_size);
         }
         if (t == NULL) {
             /* ignore truncated output */
@@ -356,7 +361,7 @@ static gboolean guest_exec_output_watch(GIOChannel *ch,
 
             return true;
         }
-        p->size += GUEST_EXEC_IO_SIZE;
+        p->size = new_size;
         p->data = t;
     }
 
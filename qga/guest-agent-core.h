@@ -15,6 +15,10 @@
 #include "qga-qmp-commands.h"
 
 #define QGA_READ_COUNT_DEFAULT 4096
+/* Largest guest-file-read count, so a single reply stays manageable */
+#define QGA_READ_COUNT_MAX (48 * 1024 * 1024)
+/* Bytes read from the agent channel at once */
+#define QGA_CHANNEL_READ_SIZE (64 * 1024)
 
 typedef struct GAState GAState;
 typedef struct GACommandState GACommandState;
@@ -363,6 +363,26 @@ static int json_lexer_feed_char(JSONLexer *lexer, char ch, bool flush)
     return 0;
 }
 
+/*
+ * Return how many bytes at the start of @buffer keep a string token in
+ * @state, so that long strings can be appended to the token in one go.
+ * Newlines are left to json_lexer_feed_char(), which tracks the position.
+ */
+static size_t json_lexer_string_run(int state, const char *buffer,
+                                    size_t size)
+{
+    size_t n;
+
+    for (n = 0; n < size; n++) {
+        uint8_t ch = buffer[n];
+
+        if (ch == '\n' || json_lexer[state][ch] != state) {
+            break;
+        }
+    }
+    return n;
+}
+
 int json_lexer_feed(JSONLexer *lexer, const char *buffer, size_t size)
 {
     size_t i;
@@ -370,6 +390,20 @@ int json_lexer_feed(JSONLexer *lexer, const char *buffer, size_t size)
     for (i = 0; i < size; i++) {
         int err;
 
+        if ((lexer->state == IN_DQ_STRING || lexer->state == IN_SQ_STRING) &&
+            lexer->token->len < MAX_TOKEN_SIZE) {
+            size_t n = json_lexer_string_run(lexer->state, buffer + i,
+                                             MIN(size - i, MAX_TOKEN_SIZE -
+                                                 lexer->token->len));
+
+            g_string_append_len(lexer->token, buffer + i, n);
+            lexer->x += n;
+            i += n;
+            if (i == size) {
+                break;
+            }
+        }
+
         err = json_lexer_feed_char(lexer, buffer[i], false);
         if (err < 0) {
             return err;
@@ -205,12 +205,11 @@ static QString *qstring_from_escaped_str(JSONParserContext *ctxt,
                 goto out;
             }
         } else {
-            char dummy[2];
+            /* Copy the whole run up to the next escape or quote at once */
+            const char *end = ptr + strcspn(ptr, double_quote ? "\\\"" : "\\'");
 
-            dummy[0] = *ptr++;
-            dummy[1] = 0;
-
-            qstring_append(str, dummy);
+            qstring_append_len(str, ptr, end - ptr);
+            ptr = end;
         }
     }
 
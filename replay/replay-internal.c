@@ -14,6 +14,7 @@
 #include "sysemu/replay.h"
 #include "replay-internal.h"
 #include "qemu/error-report.h"
+#include "qemu/bswap.h"
 #include "sysemu/sysemu.h"
 
 /* Mutex to protect reading and writing events to the log.
@@ -40,22 +41,35 @@ void replay_put_event(uint8_t event)
 }
 
 
+/* Multi-byte values are stored big endian with a single stdio call */
 void replay_put_word(uint16_t word)
 {
-    replay_put_byte(word >> 8);
-    replay_put_byte(word);
+    uint8_t buf[2];
+
+    if (replay_file) {
+        stw_be_p(buf, word);
+        fwrite(buf, 1, sizeof(buf), replay_file);
+    }
 }
 
 void replay_put_dword(uint32_t dword)
 {
-    replay_put_word(dword >> 16);
-    replay_put_word(dword);
+    uint8_t buf[4];
+
+    if (replay_file) {
+        stl_be_p(buf, dword);
+        fwrite(buf, 1, sizeof(buf), replay_file);
+    }
 }
 
 void replay_put_qword(int64_t qword)
 {
-    replay_put_dword(qword >> 32);
-    replay_put_dword(qword);
+    uint8_t buf[8];
+
+    if (replay_file) {
+        stq_be_p(buf, qword);
+        fwrite(buf, 1, sizeof(buf), replay_file);
+    }
 }
 
 void replay_put_array(const uint8_t *buf, size_t size)
@@ -75,37 +89,44 @@ uint8_t replay_get_byte(void)
     return byte;
 }
 
+/* A short read leaves zeroes behind; replay_check_error catches EOF */
 uint16_t replay_get_word(void)
 {
-    uint16_t word = 0;
+    uint8_t buf[2] = { 0 };
+
     if (replay_file) {
-        word = replay_get_byte();
-        word = (word << 8) + replay_get_byte();
+        if (fread(buf, 1, sizeof(buf), replay_file) != sizeof(buf)) {
+            return 0;
+        }
     }
 
-    return word;
+    return lduw_be_p(buf);
 }
 
 uint32_t replay_get_dword(void)
 {
-    uint32_t dword = 0;
+    uint8_t buf[4] = { 0 };
+
     if (replay_file) {
-        dword = replay_get_word();
-        dword = (dword << 16) + replay_get_word();
+        if (fread(buf, 1, sizeof(buf), replay_file) != sizeof(buf)) {
+            return 0;
+        }
     }
 
-    return dword;
+    return ldl_be_p(buf);
 }
 
 int64_t replay_get_qword(void)
 {
-    int64_t qword = 0;
+    uint8_t buf[8] = { 0 };
+
     if (replay_file) {
-        qword = replay_get_dword();
-        qword = (qword << 32) + replay_get_dword();
+        if (fread(buf, 1, sizeof(buf), replay_file) != sizeof(buf)) {
+            return 0;
+        }
     }
 
-    return qword;
+    return ldq_be_p(buf);
 }
 
 void replay_get_array(uint8_t *buf, size_t *size)
@@ -150,7 +171,8 @@ void replay_fetch_data_kind(void)
         if (!replay_state.has_unread_data) {
             replay_state.data_kind = replay_get_byte();
             if (replay_state.data_kind == EVENT_INSTRUCTION) {
-                replay_state.instructions_count = replay_get_dword();
+                atomic_set(&replay_state.instructions_count,
+                           replay_get_dword());
             }
             replay_check_error();
             replay_state.has_unread_data = 1;
@@ -29,8 +29,12 @@
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
 
+/* Size of the stdio buffer used for the replay log */
+#define REPLAY_FILE_BUF_SIZE        (1 * 1024 * 1024)
+
 /* Name of replay file  */
 static char *replay_filename;
+static char *replay_file_buf;
 ReplayState replay_state;
 static GSList *replay_blockers;
 
@@ -80,7 +84,14 @@ int replay_get_instructions(void)
 
 void replay_account_executed_instructions(void)
 {
-    if (replay_mode == REPLAY_MODE_PLAY) {
+    /*
+     * This runs after every TCG execution slice.  Only take the lock when
+     * the log is waiting for instructions.  instructions_count is only
+     * changed under the lock, and a stale read just defers the accounting
+     * to the next slice because it is based on the current step.
+     */
+    if (replay_mode == REPLAY_MODE_PLAY &&
+        atomic_read(&replay_state.instructions_count) > 0) {
         replay_mutex_lock();
         if (replay_state.instructions_count > 0) {
             int count = (int)(replay_get_current_step()
@@ -89,7 +100,8 @@ void replay_account_executed_instructions(void)
             /* Time can only go forward */
             assert(count >= 0);
 
-            replay_state.instructions_count -= count;
+            atomic_set(&replay_state.instructions_count,
+                       replay_state.instructions_count - count);
             replay_state.current_step += count;
             if (replay_state.instructions_count == 0) {
                 assert(replay_state.data_kind == EVENT_INSTRUCTION);
@@ -240,6 +252,9 @@ static void replay_enable(const char *fname, int mode)
         fprintf(stderr, "Replay: open %s: %s\n", fname, strerror(errno));
         exit(1);
     }
+    /* events are small and frequent, batch them into large reads/writes */
+    replay_file_buf = g_malloc(REPLAY_FILE_BUF_SIZE);
+    setvbuf(replay_file, replay_file_buf, _IOFBF, REPLAY_FILE_BUF_SIZE);
 
     replay_filename = g_strdup(fname);
 
@@ -349,6 +364,8 @@ void replay_finish(void)
         fclose(replay_file);
         replay_file = NULL;
     }
+    g_free(replay_file_buf);
+    replay_file_buf = NULL;
     if (replay_filename) {
         g_free(replay_filename);
         replay_filename = NULL;
@@ -18,7 +18,7 @@
 #include "qemu/osdep.h"
 #include "slirp.h"
 
-#define MBUF_THRESH 30
+#define MBUF_THRESH 256
 
 /*
  * Find a nice value for msize
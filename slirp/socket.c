@@ -16,13 +16,56 @@
 static void sofcantrcvmore(struct socket *so);
 static void sofcantsendmore(struct socket *so);
 
-struct socket *solookup(struct socket **last, struct socket *head,
+static uint32_t so_hash_addr(struct sockaddr_storage *addr)
+{
+    switch (addr->ss_family) {
+    case AF_INET:
+    {
+        struct sockaddr_in *a4 = (struct sockaddr_in *) addr;
+        return a4->sin_addr.s_addr ^ a4->sin_port;
+    }
+    case AF_INET6:
+    {
+        struct sockaddr_in6 *a6 = (struct sockaddr_in6 *) addr;
+        uint32_t w[4];
+
+        memcpy(w, &a6->sin6_addr, sizeof(w));
+        return w[0] ^ w[1] ^ w[2] ^ w[3] ^ a6->sin6_port;
+    }
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static unsigned so_cache_index(struct sockaddr_storage *lhost,
+                               struct sockaddr_storage *fhost)
+{
+    uint32_t h = so_hash_addr(lhost);
+
+    if (fhost) {
+        h = h * 31 + so_hash_addr(fhost);
+    }
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h & (SO_CACHE_SIZE - 1);
+}
+
+/*
+ * Find the socket of a connection.  @cache holds the sockets found by
+ * earlier lookups, indexed by a hash of the addresses that were looked up,
+ * so that with many connections most packets don't walk the whole list.
+ * The list stays authoritative; entries are checked before being trusted
+ * and are dropped by sofree().
+ */
+struct socket *solookup(struct socket **cache, struct socket *head,
         struct sockaddr_storage *lhost, struct sockaddr_storage *fhost)
 {
-    struct socket *so = *last;
+    unsigned idx = so_cache_index(lhost, fhost);
+    struct socket *so = cache[idx];
 
     /* Optimisation */
-    if (so != head && sockaddr_equal(&(so->lhost.ss), lhost)
+    if (so && sockaddr_equal(&(so->lhost.ss), lhost)
             && (!fhost || sockaddr_equal(&so->fhost.ss, fhost))) {
         return so;
     }
@@ -30,7 +73,7 @@ struct socket *solookup(struct socket **last, struct socket *head,
     for (so = head->so_next; so != head; so = so->so_next) {
         if (sockaddr_equal(&(so->lhost.ss), lhost)
                 && (!fhost || sockaddr_equal(&so->fhost.ss, fhost))) {
-            *last = so;
+            cache[idx] = so;
             return so;
         }
     }
@@ -38,6 +81,17 @@ struct socket *solookup(struct socket **last, struct socket *head,
     return (struct socket *)NULL;
 }
 
+void so_cache_drop(struct socket **cache, struct socket *so)
+{
+    int i;
+
+    for (i = 0; i < SO_CACHE_SIZE; i++) {
+        if (cache[i] == so) {
+            cache[i] = NULL;
+        }
+    }
+}
+
 /*
  * Create a new socket, initialise the fields
  * It is the responsibility of the caller to
@@ -95,11 +149,9 @@ sofree(struct socket *so)
 	sofree(so->extra);
 	so->extra=NULL;
   }
-  if (so == slirp->tcp_last_so) {
-      slirp->tcp_last_so = &slirp->tcb;
-  } else if (so == slirp->udp_last_so) {
-      slirp->udp_last_so = &slirp->udb;
-  } else if (so == slirp->icmp_last_so) {
+  so_cache_drop(slirp->tcp_so_cache, so);
+  so_cache_drop(slirp->udp_so_cache, so);
+  if (so == slirp->icmp_last_so) {
       slirp->icmp_last_so = &slirp->icmp;
   }
   m_free(so->so_m);
@@ -11,6 +11,9 @@
 #define SO_EXPIRE 240000
 #define SO_EXPIREFAST 10000
 
+/* Slots in the solookup() caches, a power of two */
+#define SO_CACHE_SIZE 256
+
 /*
  * Our socket structure
  */
@@ -134,6 +137,7 @@ static inline socklen_t sockaddr_size(struct sockaddr_storage *a)
 
 struct socket *solookup(struct socket **, struct socket *,
         struct sockaddr_storage *, struct sockaddr_storage *);
+void so_cache_drop(struct socket **, struct socket *);
 struct socket *socreate(Slirp *);
 void sofree(struct socket *);
 int soread(struct socket *);
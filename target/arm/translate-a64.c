@@ -21,6 +21,7 @@
 #include "cpu.h"
 #include "exec/exec-all.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "qemu/log.h"
 #include "arm_ldst.h"
 #include "translate.h"
@@ -550,6 +551,23 @@ static inline int fp_reg_offset(DisasContext *s, int regno, TCGMemOp size)
     return offs;
 }
 
+/* Return the offset into CPUARMState of the whole of vector register Qn,
+ * for use with the generic vector expanders.
+ */
+static inline int vec_full_reg_offset(DisasContext *s, int regno)
+{
+    assert_fp_access_checked(s);
+    return offsetof(CPUARMState, vfp.regs[regno * 2]);
+}
+
+/* Return the byte size of the whole vector register; operations on the
+ * 64 bit forms of instructions zero everything above that.
+ */
+static inline int vec_full_reg_size(DisasContext *s)
+{
+    return 16;
+}
+
 /* Offset of the high half of the 128 bit vector Qn */
 static inline int fp_reg_hi_offset(DisasContext *s, int regno)
 {
@@ -9081,6 +9099,33 @@ static void disas_simd_3same_logic(DisasContext *s, uint32_t insn)
         return;
     }
 
+    if (!is_u || size == 0) {
+        uint32_t oprsz = is_q ? 16 : 8;
+        uint32_t maxsz = vec_full_reg_size(s);
+        uint32_t dofs = vec_full_reg_offset(s, rd);
+        uint32_t nofs = vec_full_reg_offset(s, rn);
+        uint32_t mofs = vec_full_reg_offset(s, rm);
+
+        switch (is_u ? 4 : size) {
+        case 0: /* AND */
+            tcg_gen_gvec_and(MO_64, dofs, nofs, mofs, oprsz, maxsz);
+            break;
+        case 1: /* BIC */
+            tcg_gen_gvec_andc(MO_64, dofs, nofs, mofs, oprsz, maxsz);
+            break;
+        case 2: /* ORR */
+            tcg_gen_gvec_or(MO_64, dofs, nofs, mofs, oprsz, maxsz);
+            break;
+        case 3: /* ORN */
+            tcg_gen_gvec_orc(MO_64, dofs, nofs, mofs, oprsz, maxsz);
+            break;
+        case 4: /* EOR */
+            tcg_gen_gvec_xor(MO_64, dofs, nofs, mofs, oprsz, maxsz);
+            break;
+        }
+        return;
+    }
+
     tcg_op1 = tcg_temp_new_i64();
     tcg_op2 = tcg_temp_new_i64();
     tcg_res[0] = tcg_temp_new_i64();
@@ -9443,6 +9488,45 @@ static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
         return;
     }
 
+    /* Operations that map directly onto a generic vector operation */
+    switch (opcode) {
+    case 0x10: /* ADD, SUB */
+    case 0x6: /* CMGT, CMHI */
+    case 0x7: /* CMGE, CMHS */
+    case 0x11: /* CMTST, CMEQ */
+    {
+        uint32_t oprsz = is_q ? 16 : 8;
+        uint32_t maxsz = vec_full_reg_size(s);
+        uint32_t dofs = vec_full_reg_offset(s, rd);
+        uint32_t nofs = vec_full_reg_offset(s, rn);
+        uint32_t mofs = vec_full_reg_offset(s, rm);
+
+        if (opcode == 0x10) {
+            if (u) {
+                tcg_gen_gvec_sub(size, dofs, nofs, mofs, oprsz, maxsz);
+            } else {
+                tcg_gen_gvec_add(size, dofs, nofs, mofs, oprsz, maxsz);
+            }
+            return;
+        }
+        if (opcode == 0x11 && !u) {
+            /* CMTST has no generic form; use the per-element code below */
+            break;
+        }
+        if (opcode == 0x6) {
+            tcg_gen_gvec_cmp(u ? TCG_COND_GTU : TCG_COND_GT, size,
+                             dofs, nofs, mofs, oprsz, maxsz);
+        } else if (opcode == 0x7) {
+            tcg_gen_gvec_cmp(u ? TCG_COND_GEU : TCG_COND_GE, size,
+                             dofs, nofs, mofs, oprsz, maxsz);
+        } else {
+            tcg_gen_gvec_cmp(TCG_COND_EQ, size,
+                             dofs, nofs, mofs, oprsz, maxsz);
+        }
+        return;
+    }
+    }
+
     if (size == 3) {
         assert(is_q);
         for (pass = 0; pass < 2; pass++) {
@@ -34,31 +34,37 @@
 #define dh_is_signed_ZMMReg dh_is_signed_ptr
 #define dh_is_signed_MMXReg dh_is_signed_ptr
 
-DEF_HELPER_3(glue(psrlw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psraw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psllw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psrld, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psrad, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pslld, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psrlq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psllq, SUFFIX), void, env, Reg, Reg)
+/* Most helpers only access the MMX/SSE registers and the MXCSR state,
+ * none of which are TCG globals, so they are TCG_CALL_NO_RWG and the
+ * general registers and cc_* globals need not be synced around them.
+ * The exceptions write CC_SRC (comis, ptest), read or write the general
+ * registers (pcmp*str*), or access guest memory (maskmov).
+ */
+DEF_HELPER_FLAGS_3(glue(psrlw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psraw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psllw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psrld, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psrad, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pslld, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psrlq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psllq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 
 #if SHIFT == 1
-DEF_HELPER_3(glue(psrldq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pslldq, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psrldq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pslldq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 #endif
 
 #define SSE_HELPER_B(name, F)\
-    DEF_HELPER_3(glue(name, SUFFIX), void, env, Reg, Reg)
+    DEF_HELPER_FLAGS_3(glue(name, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 
 #define SSE_HELPER_W(name, F)\
-    DEF_HELPER_3(glue(name, SUFFIX), void, env, Reg, Reg)
+    DEF_HELPER_FLAGS_3(glue(name, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 
 #define SSE_HELPER_L(name, F)\
-    DEF_HELPER_3(glue(name, SUFFIX), void, env, Reg, Reg)
+    DEF_HELPER_FLAGS_3(glue(name, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 
 #define SSE_HELPER_Q(name, F)\
-    DEF_HELPER_3(glue(name, SUFFIX), void, env, Reg, Reg)
+    DEF_HELPER_FLAGS_3(glue(name, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 
 SSE_HELPER_B(paddb, FADD)
 SSE_HELPER_W(paddw, FADD)
@@ -109,35 +115,35 @@ SSE_HELPER_W(pmulhw, FMULHW)
 SSE_HELPER_B(pavgb, FAVG)
 SSE_HELPER_W(pavgw, FAVG)
 
-DEF_HELPER_3(glue(pmuludq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmaddwd, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmuludq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmaddwd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 
-DEF_HELPER_3(glue(psadbw, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psadbw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 DEF_HELPER_4(glue(maskmov, SUFFIX), void, env, Reg, Reg, tl)
-DEF_HELPER_2(glue(movl_mm_T0, SUFFIX), void, Reg, i32)
+DEF_HELPER_FLAGS_2(glue(movl_mm_T0, SUFFIX), TCG_CALL_NO_RWG, void, Reg, i32)
 #ifdef TARGET_X86_64
-DEF_HELPER_2(glue(movq_mm_T0, SUFFIX), void, Reg, i64)
+DEF_HELPER_FLAGS_2(glue(movq_mm_T0, SUFFIX), TCG_CALL_NO_RWG, void, Reg, i64)
 #endif
 
 #if SHIFT == 0
-DEF_HELPER_3(glue(pshufw, SUFFIX), void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(glue(pshufw, SUFFIX), TCG_CALL_NO_RWG, void, Reg, Reg, int)
 #else
-DEF_HELPER_3(shufps, void, Reg, Reg, int)
-DEF_HELPER_3(shufpd, void, Reg, Reg, int)
-DEF_HELPER_3(glue(pshufd, SUFFIX), void, Reg, Reg, int)
-DEF_HELPER_3(glue(pshuflw, SUFFIX), void, Reg, Reg, int)
-DEF_HELPER_3(glue(pshufhw, SUFFIX), void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(shufps, TCG_CALL_NO_RWG, void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(shufpd, TCG_CALL_NO_RWG, void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(glue(pshufd, SUFFIX), TCG_CALL_NO_RWG, void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(glue(pshuflw, SUFFIX), TCG_CALL_NO_RWG, void, Reg, Reg, int)
+DEF_HELPER_FLAGS_3(glue(pshufhw, SUFFIX), TCG_CALL_NO_RWG, void, Reg, Reg, int)
 #endif
 
 #if SHIFT == 1
 /* FPU ops */
 /* XXX: not accurate */
 
-#define SSE_HELPER_S(name, F)                            \
-    DEF_HELPER_3(name ## ps, void, env, Reg, Reg)        \
-    DEF_HELPER_3(name ## ss, void, env, Reg, Reg)        \
-    DEF_HELPER_3(name ## pd, void, env, Reg, Reg)        \
-    DEF_HELPER_3(name ## sd, void, env, Reg, Reg)
+#define SSE_HELPER_S(name, F)                                               \
+    DEF_HELPER_FLAGS_3(name ## ps, TCG_CALL_NO_RWG, void, env, Reg, Reg)    \
+    DEF_HELPER_FLAGS_3(name ## ss, TCG_CALL_NO_RWG, void, env, Reg, Reg)    \
+    DEF_HELPER_FLAGS_3(name ## pd, TCG_CALL_NO_RWG, void, env, Reg, Reg)    \
+    DEF_HELPER_FLAGS_3(name ## sd, TCG_CALL_NO_RWG, void, env, Reg, Reg)
 
 SSE_HELPER_S(add, FPU_ADD)
 SSE_HELPER_S(sub, FPU_SUB)
@@ -148,64 +154,64 @@ SSE_HELPER_S(max, FPU_MAX)
 SSE_HELPER_S(sqrt, FPU_SQRT)
 
 
-DEF_HELPER_3(cvtps2pd, void, env, Reg, Reg)
-DEF_HELPER_3(cvtpd2ps, void, env, Reg, Reg)
-DEF_HELPER_3(cvtss2sd, void, env, Reg, Reg)
-DEF_HELPER_3(cvtsd2ss, void, env, Reg, Reg)
-DEF_HELPER_3(cvtdq2ps, void, env, Reg, Reg)
-DEF_HELPER_3(cvtdq2pd, void, env, Reg, Reg)
-DEF_HELPER_3(cvtpi2ps, void, env, ZMMReg, MMXReg)
-DEF_HELPER_3(cvtpi2pd, void, env, ZMMReg, MMXReg)
-DEF_HELPER_3(cvtsi2ss, void, env, ZMMReg, i32)
-DEF_HELPER_3(cvtsi2sd, void, env, ZMMReg, i32)
+DEF_HELPER_FLAGS_3(cvtps2pd, TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(cvtpd2ps, TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(cvtss2sd, TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(cvtsd2ss, TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(cvtdq2ps, TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(cvtdq2pd, TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(cvtpi2ps, TCG_CALL_NO_RWG, void, env, ZMMReg, MMXReg)
+DEF_HELPER_FLAGS_3(cvtpi2pd, TCG_CALL_NO_RWG, void, env, ZMMReg, MMXReg)
+DEF_HELPER_FLAGS_3(cvtsi2ss, TCG_CALL_NO_RWG, void, env, ZMMReg, i32)
+DEF_HELPER_FLAGS_3(cvtsi2sd, TCG_CALL_NO_RWG, void, env, ZMMReg, i32)
 
 #ifdef TARGET_X86_64
-DEF_HELPER_3(cvtsq2ss, void, env, ZMMReg, i64)
-DEF_HELPER_3(cvtsq2sd, void, env, ZMMReg, i64)
+DEF_HELPER_FLAGS_3(cvtsq2ss, TCG_CALL_NO_RWG, void, env, ZMMReg, i64)
+DEF_HELPER_FLAGS_3(cvtsq2sd, TCG_CALL_NO_RWG, void, env, ZMMReg, i64)
 #endif
 
-DEF_HELPER_3(cvtps2dq, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(cvtpd2dq, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(cvtps2pi, void, env, MMXReg, ZMMReg)
-DEF_HELPER_3(cvtpd2pi, void, env, MMXReg, ZMMReg)
-DEF_HELPER_2(cvtss2si, s32, env, ZMMReg)
-DEF_HELPER_2(cvtsd2si, s32, env, ZMMReg)
+DEF_HELPER_FLAGS_3(cvtps2dq, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(cvtpd2dq, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(cvtps2pi, TCG_CALL_NO_RWG, void, env, MMXReg, ZMMReg)
+DEF_HELPER_FLAGS_3(cvtpd2pi, TCG_CALL_NO_RWG, void, env, MMXReg, ZMMReg)
+DEF_HELPER_FLAGS_2(cvtss2si, TCG_CALL_NO_RWG, s32, env, ZMMReg)
+DEF_HELPER_FLAGS_2(cvtsd2si, TCG_CALL_NO_RWG, s32, env, ZMMReg)
 #ifdef TARGET_X86_64
-DEF_HELPER_2(cvtss2sq, s64, env, ZMMReg)
-DEF_HELPER_2(cvtsd2sq, s64, env, ZMMReg)
+DEF_HELPER_FLAGS_2(cvtss2sq, TCG_CALL_NO_RWG, s64, env, ZMMReg)
+DEF_HELPER_FLAGS_2(cvtsd2sq, TCG_CALL_NO_RWG, s64, env, ZMMReg)
 #endif
 
-DEF_HELPER_3(cvttps2dq, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(cvttpd2dq, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(cvttps2pi, void, env, MMXReg, ZMMReg)
-DEF_HELPER_3(cvttpd2pi, void, env, MMXReg, ZMMReg)
-DEF_HELPER_2(cvttss2si, s32, env, ZMMReg)
-DEF_HELPER_2(cvttsd2si, s32, env, ZMMReg)
+DEF_HELPER_FLAGS_3(cvttps2dq, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(cvttpd2dq, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(cvttps2pi, TCG_CALL_NO_RWG, void, env, MMXReg, ZMMReg)
+DEF_HELPER_FLAGS_3(cvttpd2pi, TCG_CALL_NO_RWG, void, env, MMXReg, ZMMReg)
+DEF_HELPER_FLAGS_2(cvttss2si, TCG_CALL_NO_RWG, s32, env, ZMMReg)
+DEF_HELPER_FLAGS_2(cvttsd2si, TCG_CALL_NO_RWG, s32, env, ZMMReg)
 #ifdef TARGET_X86_64
-DEF_HELPER_2(cvttss2sq, s64, env, ZMMReg)
-DEF_HELPER_2(cvttsd2sq, s64, env, ZMMReg)
+DEF_HELPER_FLAGS_2(cvttss2sq, TCG_CALL_NO_RWG, s64, env, ZMMReg)
+DEF_HELPER_FLAGS_2(cvttsd2sq, TCG_CALL_NO_RWG, s64, env, ZMMReg)
 #endif
 
-DEF_HELPER_3(rsqrtps, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(rsqrtss, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(rcpps, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(rcpss, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(extrq_r, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_4(extrq_i, void, env, ZMMReg, int, int)
-DEF_HELPER_3(insertq_r, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_4(insertq_i, void, env, ZMMReg, int, int)
-DEF_HELPER_3(haddps, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(haddpd, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(hsubps, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(hsubpd, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(addsubps, void, env, ZMMReg, ZMMReg)
-DEF_HELPER_3(addsubpd, void, env, ZMMReg, ZMMReg)
-
-#define SSE_HELPER_CMP(name, F)                           \
-    DEF_HELPER_3(name ## ps, void, env, Reg, Reg)         \
-    DEF_HELPER_3(name ## ss, void, env, Reg, Reg)         \
-    DEF_HELPER_3(name ## pd, void, env, Reg, Reg)         \
-    DEF_HELPER_3(name ## sd, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(rsqrtps, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(rsqrtss, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(rcpps, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(rcpss, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(extrq_r, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_4(extrq_i, TCG_CALL_NO_RWG, void, env, ZMMReg, int, int)
+DEF_HELPER_FLAGS_3(insertq_r, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_4(insertq_i, TCG_CALL_NO_RWG, void, env, ZMMReg, int, int)
+DEF_HELPER_FLAGS_3(haddps, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(haddpd, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(hsubps, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(hsubpd, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(addsubps, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+DEF_HELPER_FLAGS_3(addsubpd, TCG_CALL_NO_RWG, void, env, ZMMReg, ZMMReg)
+
+#define SSE_HELPER_CMP(name, F)                                             \
+    DEF_HELPER_FLAGS_3(name ## ps, TCG_CALL_NO_RWG, void, env, Reg, Reg)    \
+    DEF_HELPER_FLAGS_3(name ## ss, TCG_CALL_NO_RWG, void, env, Reg, Reg)    \
+    DEF_HELPER_FLAGS_3(name ## pd, TCG_CALL_NO_RWG, void, env, Reg, Reg)    \
+    DEF_HELPER_FLAGS_3(name ## sd, TCG_CALL_NO_RWG, void, env, Reg, Reg)
 
 SSE_HELPER_CMP(cmpeq, FPU_CMPEQ)
 SSE_HELPER_CMP(cmplt, FPU_CMPLT)
@@ -220,130 +226,152 @@ DEF_HELPER_3(ucomiss, void, env, Reg, Reg)
 DEF_HELPER_3(comiss, void, env, Reg, Reg)
 DEF_HELPER_3(ucomisd, void, env, Reg, Reg)
 DEF_HELPER_3(comisd, void, env, Reg, Reg)
-DEF_HELPER_2(movmskps, i32, env, Reg)
-DEF_HELPER_2(movmskpd, i32, env, Reg)
+DEF_HELPER_FLAGS_2(movmskps, TCG_CALL_NO_RWG, i32, env, Reg)
+DEF_HELPER_FLAGS_2(movmskpd, TCG_CALL_NO_RWG, i32, env, Reg)
 #endif
 
-DEF_HELPER_2(glue(pmovmskb, SUFFIX), i32, env, Reg)
-DEF_HELPER_3(glue(packsswb, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(packuswb, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(packssdw, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_2(glue(pmovmskb, SUFFIX), TCG_CALL_NO_RWG, i32, env, Reg)
+DEF_HELPER_FLAGS_3(glue(packsswb, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(packuswb, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(packssdw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 #define UNPCK_OP(base_name, base)                                       \
-    DEF_HELPER_3(glue(punpck ## base_name ## bw, SUFFIX), void, env, Reg, Reg) \
-    DEF_HELPER_3(glue(punpck ## base_name ## wd, SUFFIX), void, env, Reg, Reg) \
-    DEF_HELPER_3(glue(punpck ## base_name ## dq, SUFFIX), void, env, Reg, Reg)
+    DEF_HELPER_FLAGS_3(glue(punpck ## base_name ## bw, SUFFIX),         \
+                       TCG_CALL_NO_RWG, void, env, Reg, Reg)            \
+    DEF_HELPER_FLAGS_3(glue(punpck ## base_name ## wd, SUFFIX),         \
+                       TCG_CALL_NO_RWG, void, env, Reg, Reg)            \
+    DEF_HELPER_FLAGS_3(glue(punpck ## base_name ## dq, SUFFIX),         \
+                       TCG_CALL_NO_RWG, void, env, Reg, Reg)
 
 UNPCK_OP(l, 0)
 UNPCK_OP(h, 1)
 
 #if SHIFT == 1
-DEF_HELPER_3(glue(punpcklqdq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(punpckhqdq, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(punpcklqdq, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(punpckhqdq, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg)
 #endif
 
 /* 3DNow! float ops */
 #if SHIFT == 0
-DEF_HELPER_3(pi2fd, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pi2fw, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pf2id, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pf2iw, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfacc, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfadd, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfcmpeq, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfcmpge, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfcmpgt, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfmax, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfmin, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfmul, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfnacc, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfpnacc, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfrcp, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfrsqrt, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfsub, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pfsubr, void, env, MMXReg, MMXReg)
-DEF_HELPER_3(pswapd, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pi2fd, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pi2fw, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pf2id, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pf2iw, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfacc, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfadd, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfcmpeq, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfcmpge, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfcmpgt, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfmax, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfmin, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfmul, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfnacc, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfpnacc, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfrcp, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfrsqrt, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfsub, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pfsubr, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
+DEF_HELPER_FLAGS_3(pswapd, TCG_CALL_NO_RWG, void, env, MMXReg, MMXReg)
 #endif
 
 /* SSSE3 op helpers */
-DEF_HELPER_3(glue(phaddw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(phaddd, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(phaddsw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(phsubw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(phsubd, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(phsubsw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pabsb, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pabsw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pabsd, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmaddubsw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmulhrsw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pshufb, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psignb, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psignw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(psignd, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_4(glue(palignr, SUFFIX), void, env, Reg, Reg, s32)
+DEF_HELPER_FLAGS_3(glue(phaddw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(phaddd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(phaddsw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(phsubw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(phsubd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(phsubsw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pabsb, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pabsw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pabsd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmaddubsw, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmulhrsw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pshufb, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psignb, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psignw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(psignd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_4(glue(palignr, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, s32)
 
 /* SSE4.1 op helpers */
 #if SHIFT == 1
-DEF_HELPER_3(glue(pblendvb, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(blendvps, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(blendvpd, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pblendvb, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(blendvps, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(blendvpd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 DEF_HELPER_3(glue(ptest, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovsxbw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovsxbd, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovsxbq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovsxwd, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovsxwq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovsxdq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovzxbw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovzxbd, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovzxbq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovzxwd, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovzxwq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmovzxdq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmuldq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pcmpeqq, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(packusdw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pminsb, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pminsd, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pminuw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pminud, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmaxsb, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmaxsd, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmaxuw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmaxud, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(pmulld, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(phminposuw, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_4(glue(roundps, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_4(glue(roundpd, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_4(glue(roundss, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_4(glue(roundsd, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_4(glue(blendps, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_4(glue(blendpd, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_4(glue(pblendw, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_4(glue(dpps, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_4(glue(dppd, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_4(glue(mpsadbw, SUFFIX), void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_3(glue(pmovsxbw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovsxbd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovsxbq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovsxwd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovsxwq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovsxdq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovzxbw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovzxbd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovzxbq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovzxwd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovzxwq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmovzxdq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmuldq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pcmpeqq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(packusdw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pminsb, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pminsd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pminuw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pminud, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmaxsb, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmaxsd, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmaxuw, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmaxud, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pmulld, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(phminposuw, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg)
+DEF_HELPER_FLAGS_4(glue(roundps, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_4(glue(roundpd, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_4(glue(roundss, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_4(glue(roundsd, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_4(glue(blendps, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_4(glue(blendpd, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_4(glue(pblendw, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_4(glue(dpps, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_4(glue(dppd, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_4(glue(mpsadbw, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
 #endif
 
 /* SSE4.2 op helpers */
 #if SHIFT == 1
-DEF_HELPER_3(glue(pcmpgtq, SUFFIX), void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(pcmpgtq, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
 DEF_HELPER_4(glue(pcmpestri, SUFFIX), void, env, Reg, Reg, i32)
 DEF_HELPER_4(glue(pcmpestrm, SUFFIX), void, env, Reg, Reg, i32)
 DEF_HELPER_4(glue(pcmpistri, SUFFIX), void, env, Reg, Reg, i32)
 DEF_HELPER_4(glue(pcmpistrm, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_3(crc32, tl, i32, tl, i32)
+DEF_HELPER_FLAGS_3(crc32, TCG_CALL_NO_RWG, tl, i32, tl, i32)
 #endif
 
 /* AES-NI op helpers */
 #if SHIFT == 1
-DEF_HELPER_3(glue(aesdec, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(aesdeclast, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(aesenc, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(aesenclast, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_3(glue(aesimc, SUFFIX), void, env, Reg, Reg)
-DEF_HELPER_4(glue(aeskeygenassist, SUFFIX), void, env, Reg, Reg, i32)
-DEF_HELPER_4(glue(pclmulqdq, SUFFIX), void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_3(glue(aesdec, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(aesdeclast, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(aesenc, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(aesenclast, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg)
+DEF_HELPER_FLAGS_3(glue(aesimc, SUFFIX), TCG_CALL_NO_RWG, void, env, Reg, Reg)
+DEF_HELPER_FLAGS_4(glue(aeskeygenassist, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
+DEF_HELPER_FLAGS_4(glue(pclmulqdq, SUFFIX), TCG_CALL_NO_RWG,
+                   void, env, Reg, Reg, i32)
 #endif
 
 #undef SHIFT
@@ -23,6 +23,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translator.h"
 
@@ -3015,6 +3016,64 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/* Expand the element-wise MMX/SSE operations that have a generic vector
+ * form inline instead of through a per-instruction helper.  B1 selects
+ * the MMX (0) or the 66-prefixed XMM (1) form.  The legacy encodings leave
+ * the bits above the operation size alone, so MAXSZ is the operation size.
+ * Return false if the operation has to go through the helper.
+ */
+static bool gen_sse_gvec(int b, int b1, int op1_offset, int op2_offset)
+{
+    uint32_t sz = b1 ? 16 : 8;
+    int vece;
+
+    switch (b) {
+    case 0x54: /* andps, andpd */
+        tcg_gen_gvec_and(MO_64, op1_offset, op1_offset, op2_offset, 16, 16);
+        return true;
+    case 0x55: /* andnps, andnpd */
+        tcg_gen_gvec_andc(MO_64, op1_offset, op2_offset, op1_offset, 16, 16);
+        return true;
+    case 0x56: /* orps, orpd */
+        tcg_gen_gvec_or(MO_64, op1_offset, op1_offset, op2_offset, 16, 16);
+        return true;
+    case 0x57: /* xorps, xorpd */
+        tcg_gen_gvec_xor(MO_64, op1_offset, op1_offset, op2_offset, 16, 16);
+        return true;
+    case 0xdb: /* pand */
+        tcg_gen_gvec_and(MO_64, op1_offset, op1_offset, op2_offset, sz, sz);
+        return true;
+    case 0xdf: /* pandn */
+        tcg_gen_gvec_andc(MO_64, op1_offset, op2_offset, op1_offset, sz, sz);
+        return true;
+    case 0xeb: /* por */
+        tcg_gen_gvec_or(MO_64, op1_offset, op1_offset, op2_offset, sz, sz);
+        return true;
+    case 0xef: /* pxor */
+        tcg_gen_gvec_xor(MO_64, op1_offset, op1_offset, op2_offset, sz, sz);
+        return true;
+    case 0xfc ... 0xfe: /* paddb, paddw, paddd */
+    case 0xd4: /* paddq */
+        vece = b == 0xd4 ? MO_64 : b - 0xfc;
+        tcg_gen_gvec_add(vece, op1_offset, op1_offset, op2_offset, sz, sz);
+        return true;
+    case 0xf8 ... 0xfb: /* psubb, psubw, psubd, psubq */
+        vece = b - 0xf8;
+        tcg_gen_gvec_sub(vece, op1_offset, op1_offset, op2_offset, sz, sz);
+        return true;
+    case 0x74 ... 0x76: /* pcmpeqb, pcmpeqw, pcmpeql */
+        tcg_gen_gvec_cmp(TCG_COND_EQ, b - 0x74, op1_offset,
+                         op1_offset, op2_offset, sz, sz);
+        return true;
+    case 0x64 ... 0x66: /* pcmpgtb, pcmpgtw, pcmpgtl */
+        tcg_gen_gvec_cmp(TCG_COND_GT, b - 0x64, op1_offset,
+                         op1_offset, op2_offset, sz, sz);
+        return true;
+    default:
+        return false;
+    }
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -4441,6 +4500,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_gvec(b, b1, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -1460,7 +1460,7 @@ static void gen_jmp_tb(DisasContext *s, int n, uint32_t dest)
         tcg_gen_exit_tb((uintptr_t)s->tb + n);
     } else {
         gen_jmp_im(s, dest);
-        tcg_gen_exit_tb(0);
+        tcg_gen_lookup_and_goto_ptr();
     }
     s->is_jmp = DISAS_TB_JUMP;
 }
@@ -5878,8 +5878,12 @@ void gen_intermediate_code(CPUState *cs, TranslationBlock *tb)
             update_cc_op(dc);
             gen_jmp_tb(dc, 0, dc->pc);
             break;
-        default:
         case DISAS_JUMP:
+            /* Only the PC was changed: look up the next TB directly.  */
+            update_cc_op(dc);
+            tcg_gen_lookup_and_goto_ptr();
+            break;
+        default:
         case DISAS_UPDATE:
             update_cc_op(dc);
             /* indicate that the hash table must be used to find the next TB */
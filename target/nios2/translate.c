@@ -403,7 +403,7 @@ static void eret(DisasContext *dc, uint32_t code, uint32_t flags)
     tcg_gen_mov_tl(dc->cpu_R[CR_STATUS], dc->cpu_R[CR_ESTATUS]);
     tcg_gen_mov_tl(dc->cpu_R[R_PC], dc->cpu_R[R_EA]);
 
-    dc->is_jmp = DISAS_JUMP;
+    dc->is_jmp = DISAS_UPDATE;
 }
 
 /* PC <- ra */
@@ -883,10 +883,17 @@ void gen_intermediate_code(CPUState *cs, TranslationBlock *tb)
         tcg_gen_exit_tb(0);
         break;
 
-    default:
     case DISAS_JUMP:
-    case DISAS_UPDATE:
         /* The jump will already have updated the PC register */
+        if (unlikely(dc->singlestep_enabled)) {
+            tcg_gen_exit_tb(0);
+        } else {
+            tcg_gen_lookup_and_goto_ptr();
+        }
+        break;
+
+    default:
+    case DISAS_UPDATE:
         tcg_gen_exit_tb(0);
         break;
 
@@ -27,6 +27,7 @@
 
 #define TCG_TARGET_INSN_UNIT_SIZE  1
 #define TCG_TARGET_TLB_DISPLACEMENT_BITS 31
+#define TCG_TARGET_IMPLEMENTS_DYN_TLB 1
 
 #ifdef __x86_64__
 # define TCG_TARGET_REG_BITS  64
@@ -110,6 +111,11 @@ extern bool have_popcnt;
 #define TCG_TARGET_HAS_goto_ptr         1
 #define TCG_TARGET_HAS_direct_jump      1
 
+/* The cmpxchg slow path passes all six helper arguments in registers */
+#if TCG_TARGET_REG_BITS == 64 && !defined(_WIN64)
+#define TCG_TARGET_HAS_qemu_cmpxchg     1
+#endif
+
 #if TCG_TARGET_REG_BITS == 64
 #define TCG_TARGET_HAS_extrl_i64_i32    0
 #define TCG_TARGET_HAS_extrh_i64_i32    0
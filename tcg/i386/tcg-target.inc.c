@@ -285,12 +285,15 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_ARITH_GvEv	(0x03)		/* ... plus (ARITH_FOO << 3) */
 #define OPC_ANDN        (0xf2 | P_EXT38)
 #define OPC_ADD_GvEv	(OPC_ARITH_GvEv | (ARITH_ADD << 3))
+#define OPC_AND_GvEv	(OPC_ARITH_GvEv | (ARITH_AND << 3))
 #define OPC_BSF         (0xbc | P_EXT)
 #define OPC_BSR         (0xbd | P_EXT)
 #define OPC_BSWAP	(0xc8 | P_EXT)
 #define OPC_CALL_Jz	(0xe8)
 #define OPC_CMOVCC      (0x40 | P_EXT)  /* ... plus condition code */
 #define OPC_CMP_GvEv	(OPC_ARITH_GvEv | (ARITH_CMP << 3))
+#define OPC_CMPXCHG_EbGb (0xb0 | P_EXT | P_REXB_R)
+#define OPC_CMPXCHG_EvGv (0xb1 | P_EXT)
 #define OPC_DEC_r32	(0x48)
 #define OPC_IMUL_GvEv	(0xaf | P_EXT)
 #define OPC_IMUL_GvEvIb	(0x6b)
@@ -1278,7 +1281,7 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
         }
         if (TCG_TYPE_PTR == TCG_TYPE_I64) {
             hrexw = P_REXW;
-            if (TARGET_PAGE_BITS + CPU_TLB_BITS > 32) {
+            if (TARGET_PAGE_BITS + CPU_TLB_DYN_MAX_BITS > 32) {
                 tlbtype = TCG_TYPE_I64;
                 tlbrexw = P_REXW;
             }
@@ -1286,6 +1289,17 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
     }
 
     tcg_out_mov(s, tlbtype, r0, addrlo);
+    tcg_out_shifti(s, SHIFT_SHR + tlbrexw, r0,
+                   TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS);
+
+    /* and tlb_mask[mem_index](env), r0 */
+    tcg_out_modrm_offset(s, OPC_AND_GvEv + trexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_mask[mem_index]));
+
+    /* add tlb_table[mem_index](env), r0 */
+    tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_table[mem_index]));
+
     /* If the required alignment is at least as large as the access, simply
        copy the address and mask.  For lesser alignments, check that we don't
        cross pages for the complete access.  */
@@ -1295,20 +1309,10 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
         tcg_out_modrm_offset(s, OPC_LEA + trexw, r1, addrlo, s_mask - a_mask);
     }
     tlb_mask = (target_ulong)TARGET_PAGE_MASK | a_mask;
-
-    tcg_out_shifti(s, SHIFT_SHR + tlbrexw, r0,
-                   TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS);
-
     tgen_arithi(s, ARITH_AND + trexw, r1, tlb_mask, 0);
-    tgen_arithi(s, ARITH_AND + tlbrexw, r0,
-                (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
-
-    tcg_out_modrm_sib_offset(s, OPC_LEA + hrexw, r0, TCG_AREG0, r0, 0,
-                             offsetof(CPUArchState, tlb_table[mem_index][0])
-                             + which);
 
     /* cmp 0(r0), r1 */
-    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, 0);
+    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, which);
 
     /* Prepare for both the fast path add of the tlb addend, and the slow
        path function argument setup.  There are two cases worth note:
@@ -1325,7 +1329,7 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
         /* cmp 4(r0), addrhi */
-        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, 4);
+        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, which + 4);
 
         /* jne slow_path */
         tcg_out_opc(s, OPC_JCC_long + JCC_JNE, 0, 0, 0);
@@ -1337,7 +1341,7 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     /* add addend(r0), r1 */
     tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r1, r0,
-                         offsetof(CPUTLBEntry, addend) - which);
+                         offsetof(CPUTLBEntry, addend));
 }
 
 /*
@@ -1515,6 +1519,49 @@ static void tcg_out_qemu_st_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
     tcg_out_push(s, retaddr);
     tcg_out_jmp(s, qemu_st_helpers[opc & (MO_BSWAP | MO_SIZE)]);
 }
+
+#if TCG_TARGET_HAS_qemu_cmpxchg
+/* helper signature: helper_atomic_cmpxchg_mmu(CPUArchState *env,
+ *                                             target_ulong addr,
+ *                                             uintxx_t cmpv, uintxx_t newv,
+ *                                             TCGMemOpIdx oi, uintptr_t ra)
+ */
+static void * const qemu_cmpxchg_helpers[16] = {
+    [MO_UB]   = helper_atomic_cmpxchgb_mmu,
+    [MO_LEUW] = helper_atomic_cmpxchgw_le_mmu,
+    [MO_LEUL] = helper_atomic_cmpxchgl_le_mmu,
+    [MO_LEQ]  = helper_atomic_cmpxchgq_le_mmu,
+};
+
+/*
+ * Generate code for the slow path for a compare-and-swap at the end of block
+ */
+static void tcg_out_qemu_cmpxchg_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
+{
+    TCGMemOpIdx oi = l->oi;
+    TCGMemOp opc = get_memop(oi);
+    tcg_insn_unit **label_ptr = &l->label_ptr[0];
+
+    /* resolve label address */
+    tcg_patch32(label_ptr[0], s->code_ptr - label_ptr[0] - 4);
+
+    tcg_out_mov(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[0], TCG_AREG0);
+    /* The second argument is already loaded with addrlo.  The new value
+       may be in the register for the third, so move it first; the
+       comparison value is in RAX.  */
+    tcg_out_mov(s, TCG_TYPE_I64, tcg_target_call_iarg_regs[3],
+                l->datahi_reg);
+    tcg_out_mov(s, TCG_TYPE_I64, tcg_target_call_iarg_regs[2], TCG_REG_RAX);
+    tcg_out_movi(s, TCG_TYPE_I32, tcg_target_call_iarg_regs[4], oi);
+    tcg_out_movi(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[5],
+                 (uintptr_t)l->raddr);
+
+    tcg_out_call(s, qemu_cmpxchg_helpers[opc & (MO_BSWAP | MO_SIZE)]);
+
+    /* The helpers return the zero-extended old value in RAX, the output.  */
+    tcg_out_jmp(s, l->raddr);
+}
+#endif
 #elif defined(__x86_64__) && defined(__linux__)
 # include <asm/prctl.h>
 # include <sys/prctl.h>
@@ -1533,6 +1580,15 @@ static inline void setup_guest_base_seg(void)
 static inline void setup_guest_base_seg(void) { }
 #endif /* SOFTMMU */
 
+#if !defined(CONFIG_SOFTMMU)
+/* When no segment register can hold a guest_base that does not fit in a
+   32-bit displacement, keep it in a reserved callee-saved register that
+   the prologue loads once, rather than materializing the constant for
+   every guest memory access.  */
+#define TCG_GUEST_BASE_REG TCG_REG_R15
+static bool guest_base_in_reg;
+#endif
+
 static void tcg_out_qemu_ld_direct(TCGContext *s, TCGReg datalo, TCGReg datahi,
                                    TCGReg base, int index, intptr_t ofs,
                                    int seg, TCGMemOp memop)
@@ -1689,7 +1745,10 @@ static void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args, bool is64)
                 tcg_out_ext32u(s, TCG_REG_L0, base);
                 base = TCG_REG_L0;
             }
-            if (offset != guest_base) {
+            if (guest_base_in_reg) {
+                index = TCG_GUEST_BASE_REG;
+                offset = 0;
+            } else if (offset != guest_base) {
                 tcg_out_movi(s, TCG_TYPE_I64, TCG_REG_L1, guest_base);
                 index = TCG_REG_L1;
                 offset = 0;
@@ -1828,8 +1887,13 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
                     tcg_out_ext32u(s, TCG_REG_L0, base);
                     base = TCG_REG_L0;
                 }
-                tcg_out_movi(s, TCG_TYPE_I64, TCG_REG_L1, guest_base);
-                tgen_arithr(s, ARITH_ADD + P_REXW, TCG_REG_L1, base);
+                if (guest_base_in_reg) {
+                    tcg_out_modrm_sib_offset(s, OPC_LEA + P_REXW, TCG_REG_L1,
+                                             base, TCG_GUEST_BASE_REG, 0, 0);
+                } else {
+                    tcg_out_movi(s, TCG_TYPE_I64, TCG_REG_L1, guest_base);
+                    tgen_arithr(s, ARITH_ADD + P_REXW, TCG_REG_L1, base);
+                }
                 base = TCG_REG_L1;
                 offset = 0;
             } else if (TARGET_LONG_BITS == 32) {
@@ -1843,6 +1907,67 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
 #endif
 }
 
+#if TCG_TARGET_HAS_qemu_cmpxchg
+/* Compare-and-swap on guest memory: LOCK CMPXCHG on the host address after
+   a TLB hit, and the out of line atomic helper for everything else.  The
+   comparison value and the result are both in EAX.  */
+static void tcg_out_qemu_cmpxchg(TCGContext *s, const TCGArg *args, bool is64)
+{
+#if defined(CONFIG_SOFTMMU)
+    TCGReg datalo = args[0];
+    TCGReg addrlo = args[1];
+    TCGReg newv = args[3];
+    TCGMemOpIdx oi = args[4];
+    TCGMemOp opc = get_memop(oi);
+    tcg_insn_unit *label_ptr[2];
+    TCGLabelQemuLdst *label;
+
+    tcg_debug_assert(datalo == TCG_REG_EAX && args[2] == TCG_REG_EAX);
+
+    /* Require natural alignment, so that the fast path does not need to
+       check for an access crossing pages; the helper handles the rest.  */
+    tcg_out_tlb_load(s, addrlo, 0, get_mmuidx(oi),
+                     (opc & ~MO_AMASK) | MO_ALIGN,
+                     label_ptr, offsetof(CPUTLBEntry, addr_write));
+
+    /* TLB Hit.  */
+    tcg_out8(s, 0xf0); /* lock */
+    switch (opc & MO_SIZE) {
+    case MO_8:
+        tcg_out_modrm_offset(s, OPC_CMPXCHG_EbGb, newv, TCG_REG_L1, 0);
+        tcg_out_ext8u(s, datalo, datalo);
+        break;
+    case MO_16:
+        tcg_out_modrm_offset(s, OPC_CMPXCHG_EvGv | P_DATA16,
+                             newv, TCG_REG_L1, 0);
+        tcg_out_ext16u(s, datalo, datalo);
+        break;
+    case MO_32:
+        tcg_out_modrm_offset(s, OPC_CMPXCHG_EvGv, newv, TCG_REG_L1, 0);
+        if (is64) {
+            tcg_out_ext32u(s, datalo, datalo);
+        }
+        break;
+    case MO_64:
+        tcg_out_modrm_offset(s, OPC_CMPXCHG_EvGv | P_REXW,
+                             newv, TCG_REG_L1, 0);
+        break;
+    default:
+        tcg_abort();
+    }
+
+    /* Record the current context of the access into an ldst label */
+    add_qemu_ldst_label(s, false, oi, datalo, newv, addrlo, 0,
+                        s->code_ptr, label_ptr);
+    label = s->ldst_labels;
+    label->is_cmpxchg = true;
+#else
+    /* Only softmmu has a TLB to check; user-mode uses the helpers.  */
+    tcg_abort();
+#endif
+}
+#endif
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -2127,6 +2252,14 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
     case INDEX_op_qemu_st_i64:
         tcg_out_qemu_st(s, args, 1);
         break;
+#if TCG_TARGET_HAS_qemu_cmpxchg
+    case INDEX_op_qemu_cmpxchg_i32:
+        tcg_out_qemu_cmpxchg(s, args, 0);
+        break;
+    case INDEX_op_qemu_cmpxchg_i64:
+        tcg_out_qemu_cmpxchg(s, args, 1);
+        break;
+#endif
 
     OP_32_64(mulu2):
         tcg_out_modrm(s, OPC_GRP3_Ev + rexw, EXT3_MUL, args[3]);
@@ -2479,6 +2612,13 @@ static const TCGTargetOpDef *tcg_target_op_def(TCGOpcode op)
         return (TCG_TARGET_REG_BITS == 64 ? &L_L
                 : TARGET_LONG_BITS <= TCG_TARGET_REG_BITS ? &L_L_L
                 : &L_L_L_L);
+    case INDEX_op_qemu_cmpxchg_i32:
+    case INDEX_op_qemu_cmpxchg_i64:
+        {
+            static const TCGTargetOpDef cmpxchg
+                = { .args_ct_str = { "a", "L", "0", "L" } };
+            return &cmpxchg;
+        }
 
     case INDEX_op_brcond2_i32:
         {
@@ -2559,6 +2699,18 @@ static void tcg_target_qemu_prologue(TCGContext *s)
 		         (ARRAY_SIZE(tcg_target_callee_save_regs) + 2) * 4
 			 + stack_addend);
 #else
+# if !defined(CONFIG_SOFTMMU)
+    /* Try to set up a segment register to point to guest_base, and fall
+       back to a register if the displacement cannot hold it.  */
+    if (guest_base) {
+        setup_guest_base_seg();
+        if (!guest_base_flags && (int32_t)guest_base != guest_base) {
+            guest_base_in_reg = true;
+            tcg_out_movi(s, TCG_TYPE_I64, TCG_GUEST_BASE_REG, guest_base);
+            tcg_regset_set_reg(s->reserved_regs, TCG_GUEST_BASE_REG);
+        }
+    }
+# endif
     tcg_out_mov(s, TCG_TYPE_PTR, TCG_AREG0, tcg_target_call_iarg_regs[0]);
     tcg_out_addi(s, TCG_REG_ESP, -stack_addend);
     /* jmp *tb.  */
@@ -2581,13 +2733,6 @@ static void tcg_target_qemu_prologue(TCGContext *s)
         tcg_out_pop(s, tcg_target_callee_save_regs[i]);
     }
     tcg_out_opc(s, OPC_RET, 0, 0, 0);
-
-#if !defined(CONFIG_SOFTMMU)
-    /* Try to set up a segment register to point to guest_base.  */
-    if (guest_base) {
-        setup_guest_base_seg();
-    }
-#endif
 }
 
 static void tcg_out_nop_fill(tcg_insn_unit *p, int count)
@@ -2751,6 +2751,26 @@ static void * const table_cmpxchg[16] = {
     WITH_ATOMIC64([MO_64 | MO_BE] = gen_helper_atomic_cmpxchgq_be)
 };
 
+#ifdef CONFIG_SOFTMMU
+/*
+ * Emit the backend's inline compare-and-swap.  This is only used for
+ * host-endian accesses, since the backend does not byte-swap.
+ */
+static void gen_qemu_cmpxchg(TCGOpcode opc, TCGArg retv, TCGv addr,
+                             TCGArg cmpv, TCGArg newv,
+                             TCGMemOp memop, TCGArg idx)
+{
+    TCGMemOpIdx oi = make_memop_idx(memop, idx);
+
+    tcg_debug_assert(!(memop & (MO_BSWAP | MO_SIGN)));
+#if TARGET_LONG_BITS == 32
+    tcg_gen_op5(opc, retv, tcgv_i32_arg(addr), cmpv, newv, oi);
+#else
+    tcg_gen_op5(opc, retv, tcgv_i64_arg(addr), cmpv, newv, oi);
+#endif
+}
+#endif
+
 void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
                                 TCGv_i32 newv, TCGArg idx, TCGMemOp memop)
 {
@@ -2780,7 +2800,11 @@ void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
         tcg_debug_assert(gen != NULL);
 
 #ifdef CONFIG_SOFTMMU
-        {
+        if (TCG_TARGET_HAS_qemu_cmpxchg && !(memop & MO_BSWAP)) {
+            gen_qemu_cmpxchg(INDEX_op_qemu_cmpxchg_i32, tcgv_i32_arg(retv),
+                             addr, tcgv_i32_arg(cmpv), tcgv_i32_arg(newv),
+                             memop & ~MO_SIGN, idx);
+        } else {
             TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop & ~MO_SIGN, idx));
             gen(retv, cpu_env, addr, cmpv, newv, oi);
             tcg_temp_free_i32(oi);
@@ -2825,7 +2849,11 @@ void tcg_gen_atomic_cmpxchg_i64(TCGv_i64 retv, TCGv addr, TCGv_i64 cmpv,
         tcg_debug_assert(gen != NULL);
 
 #ifdef CONFIG_SOFTMMU
-        {
+        if (TCG_TARGET_HAS_qemu_cmpxchg && !(memop & MO_BSWAP)) {
+            gen_qemu_cmpxchg(INDEX_op_qemu_cmpxchg_i64, tcgv_i64_arg(retv),
+                             addr, tcgv_i64_arg(cmpv), tcgv_i64_arg(newv),
+                             memop, idx);
+        } else {
             TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop, idx));
             gen(retv, cpu_env, addr, cmpv, newv, oi);
             tcg_temp_free_i32(oi);
@@ -204,6 +204,14 @@ DEF(qemu_ld_i64, DATA64_ARGS, TLADDR_ARGS, 1,
 DEF(qemu_st_i64, 0, TLADDR_ARGS + DATA64_ARGS, 1,
     TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS | TCG_OPF_64BIT)
 
+/* retv, addr, cmpv, newv, oi; only provided by 64-bit hosts */
+DEF(qemu_cmpxchg_i32, 1, 3, 1,
+    TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS
+    | IMPL(TCG_TARGET_HAS_qemu_cmpxchg))
+DEF(qemu_cmpxchg_i64, 1, 3, 1,
+    TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS
+    | IMPL64 | IMPL(TCG_TARGET_HAS_qemu_cmpxchg))
+
 #undef TLADDR_ARGS
 #undef DATA64_ARGS
 #undef IMPL
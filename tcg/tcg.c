@@ -33,6 +33,7 @@
 #include "qemu/cutils.h"
 #include "qemu/host-utils.h"
 #include "qemu/timer.h"
+#include "qemu/bitmap.h"
 
 /* Note: the long term plan is to reduce the dependencies on the QEMU
    CPU definitions. Currently they are used for qemu_ld/st
@@ -143,9 +144,30 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    /*
+     * Full regions that are not assigned to any context, oldest first,
+     * as a ring of n_full entries starting at full_head.  Once few
+     * regions are left, the oldest one is retired: its TBs are
+     * invalidated, and after an RCU grace period it is marked in
+     * @recycled and can be handed out again.
+     */
+    size_t *full;
+    size_t full_head;
+    size_t n_full;
+    unsigned long *recycled;
+    size_t n_recycled;
+    /* incremented by tcg_region_reset_all, to cancel pending retirements */
+    unsigned int reset_gen;
 };
 
 static struct tcg_region_state region;
+/*
+ * This is an array of struct tcg_region_tree's, with padding.
+ * We use void * to simplify the computation of region_trees[i]; each
+ * struct is found every tree_size bytes.
+ */
+static void *region_trees;
+static size_t tree_size;
 
 static TCGRegSet tcg_target_available_regs[2];
 static TCGRegSet tcg_target_call_clobber_regs;
@@ -284,6 +306,192 @@ TCGLabel *gen_new_label(void)
 
 #include "tcg-target.inc.c"
 
+/*
+ * Each region keeps its own binary search tree of the TBs whose code it
+ * holds, sorted by host code address, so that threads translating into
+ * different regions never contend on it.
+ */
+struct tcg_region_tree {
+    QemuMutex lock;
+    GTree *tree;
+    /* padding to avoid false sharing is computed at run-time */
+};
+
+/* compare a pointer @ptr and a tb_tc @s */
+static int ptr_cmp_tb_tc(const void *ptr, const struct tb_tc *s)
+{
+    if (ptr >= s->ptr + s->size) {
+        return 1;
+    } else if (ptr < s->ptr) {
+        return -1;
+    }
+    return 0;
+}
+
+static gint tb_tc_cmp(gconstpointer ap, gconstpointer bp)
+{
+    const struct tb_tc *a = ap;
+    const struct tb_tc *b = bp;
+
+    /*
+     * When both sizes are set, we know this isn't a lookup.
+     * This is the most likely case: every TB must be inserted; lookups
+     * are a lot less frequent.
+     */
+    if (likely(a->size && b->size)) {
+        if (a->ptr > b->ptr) {
+            return 1;
+        } else if (a->ptr < b->ptr) {
+            return -1;
+        }
+        /* a->ptr == b->ptr should happen only on deletions */
+        g_assert(a->size == b->size);
+        return 0;
+    }
+    /*
+     * All lookups have either .size field set to 0.
+     * From the glib sources we see that @ap is always the lookup key. However
+     * the docs provide no guarantee, so we just mark this case as likely.
+     */
+    if (likely(a->size == 0)) {
+        return ptr_cmp_tb_tc(a->ptr, b);
+    }
+    return ptr_cmp_tb_tc(b->ptr, a);
+}
+
+static void tcg_region_trees_init(void)
+{
+    size_t i;
+
+    tree_size = ROUND_UP(sizeof(struct tcg_region_tree), qemu_dcache_linesize);
+    region_trees = qemu_memalign(qemu_dcache_linesize, region.n * tree_size);
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+
+        qemu_mutex_init(&rt->lock);
+        rt->tree = g_tree_new(tb_tc_cmp);
+    }
+}
+
+static size_t tcg_region_idx(void *p)
+{
+    ptrdiff_t offset;
+
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(void *p)
+{
+    return region_trees + tcg_region_idx(p) * tree_size;
+}
+
+void tcg_tb_insert(TranslationBlock *tb)
+{
+    struct tcg_region_tree *rt = tc_ptr_to_region_tree(tb->tc.ptr);
+
+    qemu_mutex_lock(&rt->lock);
+    g_tree_insert(rt->tree, &tb->tc, tb);
+    qemu_mutex_unlock(&rt->lock);
+}
+
+void tcg_tb_remove(TranslationBlock *tb)
+{
+    struct tcg_region_tree *rt = tc_ptr_to_region_tree(tb->tc.ptr);
+
+    qemu_mutex_lock(&rt->lock);
+    g_tree_remove(rt->tree, &tb->tc);
+    qemu_mutex_unlock(&rt->lock);
+}
+
+/*
+ * Find the TB 'tb' such that
+ * tb->tc.ptr <= tc_ptr < tb->tc.ptr + tb->tc.size
+ * Return NULL if not found.
+ */
+TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr)
+{
+    struct tcg_region_tree *rt = tc_ptr_to_region_tree((void *)tc_ptr);
+    TranslationBlock *tb;
+    struct tb_tc s = { .ptr = (void *)tc_ptr };
+
+    qemu_mutex_lock(&rt->lock);
+    tb = g_tree_lookup(rt->tree, &s);
+    qemu_mutex_unlock(&rt->lock);
+    return tb;
+}
+
+static void tcg_region_tree_lock_all(void)
+{
+    size_t i;
+
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+
+        qemu_mutex_lock(&rt->lock);
+    }
+}
+
+static void tcg_region_tree_unlock_all(void)
+{
+    size_t i;
+
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+
+        qemu_mutex_unlock(&rt->lock);
+    }
+}
+
+void tcg_tb_foreach(GTraverseFunc func, gpointer user_data)
+{
+    size_t i;
+
+    tcg_region_tree_lock_all();
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+
+        g_tree_foreach(rt->tree, func, user_data);
+    }
+    tcg_region_tree_unlock_all();
+}
+
+size_t tcg_nb_tbs(void)
+{
+    size_t nb_tbs = 0;
+    size_t i;
+
+    tcg_region_tree_lock_all();
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+
+        nb_tbs += g_tree_nnodes(rt->tree);
+    }
+    tcg_region_tree_unlock_all();
+    return nb_tbs;
+}
+
+static void tcg_region_tree_reset_all(void)
+{
+    size_t i;
+
+    tcg_region_tree_lock_all();
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+
+        /* Increment the refcount first so that destroy acts as a reset */
+        g_tree_ref(rt->tree);
+        g_tree_destroy(rt->tree);
+    }
+    tcg_region_tree_unlock_all();
+}
+
 static void tcg_region_bounds(size_t curr_region, void **pstart, void **pend)
 {
     void *start, *end;
@@ -316,30 +524,151 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t idx;
+
+    if (region.current < region.n) {
+        tcg_region_assign(s, region.current);
+        region.current++;
+        return false;
+    }
+    if (region.n_recycled == 0) {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    idx = find_first_bit(region.recycled, region.n);
+    clear_bit(idx, region.recycled);
+    region.n_recycled--;
+    tcg_region_assign(s, idx);
     return false;
 }
 
+struct tcg_region_retired {
+    struct rcu_head rcu;
+    size_t idx;
+    unsigned int reset_gen;
+};
+
+/*
+ * Runs once no vCPU can still be executing code from the retired region,
+ * nor hold a pointer to one of its TBs.
+ */
+static void tcg_region_retired_rcu(struct tcg_region_retired *r)
+{
+    struct tcg_region_tree *rt = region_trees + r->idx * tree_size;
+    void *start, *end;
+    CPUState *cpu;
+    size_t i;
+
+    tcg_region_bounds(r->idx, &start, &end);
+
+    /*
+     * tb_phys_invalidate removed the region's TBs from every tb_jmp_cache,
+     * but a vCPU that found one of them in the hash table just before may
+     * have put it back.
+     */
+    rcu_read_lock();
+    CPU_FOREACH(cpu) {
+        for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+            TranslationBlock *tb = atomic_rcu_read(&cpu->tb_jmp_cache[i]);
+
+            if ((void *)tb >= start && (void *)tb < end) {
+                atomic_cmpxchg(&cpu->tb_jmp_cache[i], tb, NULL);
+            }
+        }
+    }
+    rcu_read_unlock();
+
+    qemu_mutex_lock(&region.lock);
+    if (r->reset_gen == region.reset_gen) {
+        qemu_mutex_lock(&rt->lock);
+        /* Increment the refcount first so that destroy acts as a reset */
+        g_tree_ref(rt->tree);
+        g_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+
+        set_bit(r->idx, region.recycled);
+        region.n_recycled++;
+        region.agg_size_full -= end - start - TCG_HIGHWATER;
+    }
+    qemu_mutex_unlock(&region.lock);
+    g_free(r);
+}
+
+static gboolean tcg_region_collect_tb(gpointer key, gpointer value,
+                                      gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+/*
+ * Invalidate all the TBs of region @r->idx, which no context is using,
+ * and recycle it after a grace period.  Unlike tb_flush, this does not
+ * need to stop the other vCPUs.
+ */
+static void tcg_region_retire(struct tcg_region_retired *r)
+{
+    struct tcg_region_tree *rt = region_trees + r->idx * tree_size;
+    GPtrArray *tbs = g_ptr_array_new();
+    guint i;
+
+    /* tb_phys_invalidate takes the page locks, so not under rt->lock */
+    qemu_mutex_lock(&rt->lock);
+    g_tree_foreach(rt->tree, tcg_region_collect_tb, tbs);
+    qemu_mutex_unlock(&rt->lock);
+
+    for (i = 0; i < tbs->len; i++) {
+        tb_phys_invalidate(g_ptr_array_index(tbs, i), -1);
+    }
+    g_ptr_array_free(tbs, true);
+
+    call_rcu(r, tcg_region_retired_rcu, rcu);
+}
+
+/*
+ * Pick the oldest full region for retirement when no more than an eighth
+ * of the regions are left to hand out.
+ */
+static struct tcg_region_retired *tcg_region_pick_retire__locked(void)
+{
+    struct tcg_region_retired *r;
+    size_t n_free = region.n - region.current + region.n_recycled;
+
+    if (region.n_full == 0 || n_free > region.n / 8) {
+        return NULL;
+    }
+    r = g_new(struct tcg_region_retired, 1);
+    r->idx = region.full[region.full_head];
+    r->reset_gen = region.reset_gen;
+    region.full_head = (region.full_head + 1) % region.n;
+    region.n_full--;
+    return r;
+}
+
 /*
  * Request a new region once the one in use has filled up.
  * Returns true on error.
  */
 static bool tcg_region_alloc(TCGContext *s)
 {
+    struct tcg_region_retired *retire;
     bool err;
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t idx_full = tcg_region_idx(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.full[(region.full_head + region.n_full) % region.n] = idx_full;
+        region.n_full++;
     }
+    retire = tcg_region_pick_retire__locked();
     qemu_mutex_unlock(&region.lock);
+
+    if (retire) {
+        tcg_region_retire(retire);
+    }
     return err;
 }
 
@@ -361,6 +690,11 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.full_head = 0;
+    region.n_full = 0;
+    bitmap_zero(region.recycled, region.n);
+    region.n_recycled = 0;
+    region.reset_gen++;
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = atomic_read(&tcg_ctxs[i]);
@@ -369,6 +703,8 @@ void tcg_region_reset_all(void)
         g_assert(!err);
     }
     qemu_mutex_unlock(&region.lock);
+
+    tcg_region_tree_reset_all();
 }
 
 #ifdef CONFIG_USER_ONLY
@@ -474,6 +810,8 @@ void tcg_region_init(void)
     region.end = QEMU_ALIGN_PTR_DOWN(buf + size, page_size);
     /* account for that last guard page */
     region.end -= page_size;
+    region.full = g_new(size_t, n_regions);
+    region.recycled = bitmap_new(n_regions);
 
     /* set guard pages */
     for (i = 0; i < region.n; i++) {
@@ -485,6 +823,8 @@ void tcg_region_init(void)
         g_assert(!rc);
     }
 
+    tcg_region_trees_init();
+
     /* In user-mode we support only one ctx, so do the initial allocation now */
 #ifdef CONFIG_USER_ONLY
     {
@@ -1132,6 +1472,11 @@ bool tcg_op_supported(TCGOpcode op)
     case INDEX_op_goto_ptr:
         return TCG_TARGET_HAS_goto_ptr;
 
+    case INDEX_op_qemu_cmpxchg_i32:
+        return TCG_TARGET_HAS_qemu_cmpxchg;
+    case INDEX_op_qemu_cmpxchg_i64:
+        return TCG_TARGET_REG_BITS == 64 && TCG_TARGET_HAS_qemu_cmpxchg;
+
     case INDEX_op_mov_i32:
     case INDEX_op_movi_i32:
     case INDEX_op_setcond_i32:
@@ -1697,6 +2042,8 @@ void tcg_dump_ops(TCGContext *s)
             case INDEX_op_qemu_st_i32:
             case INDEX_op_qemu_ld_i64:
             case INDEX_op_qemu_st_i64:
+            case INDEX_op_qemu_cmpxchg_i32:
+            case INDEX_op_qemu_cmpxchg_i64:
                 {
                     TCGMemOpIdx oi = op->args[k++];
                     TCGMemOp op = get_memop(oi);
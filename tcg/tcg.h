@@ -149,6 +149,11 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_extract_i64_valid(ofs, len) 1
 #endif
 
+/* Inline guest compare-and-swap, with a TLB fast path in softmmu.  */
+#ifndef TCG_TARGET_HAS_qemu_cmpxchg
+#define TCG_TARGET_HAS_qemu_cmpxchg     0
+#endif
+
 /* Only one of DIV or DIV2 should be defined.  */
 #if defined(TCG_TARGET_HAS_div_i32)
 #define TCG_TARGET_HAS_div2_i32         0
@@ -788,7 +793,7 @@ static inline bool tcg_op_buf_full(void)
 
 /* pool based memory allocation */
 
-/* user-mode: tb_lock must be held for tcg_malloc_internal. */
+/* user-mode: mmap_lock must be held for tcg_malloc_internal. */
 void *tcg_malloc_internal(TCGContext *s, int size);
 void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
@@ -796,10 +801,16 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 void tcg_region_init(void);
 void tcg_region_reset_all(void);
 
+void tcg_tb_insert(TranslationBlock *tb);
+void tcg_tb_remove(TranslationBlock *tb);
+TranslationBlock *tcg_tb_lookup(uintptr_t tc_ptr);
+void tcg_tb_foreach(GTraverseFunc func, gpointer user_data);
+size_t tcg_nb_tbs(void);
+
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
 
-/* user-mode: Called with tb_lock held.  */
+/* user-mode: Called with mmap_lock held.  */
 static inline void *tcg_malloc(int size)
 {
     TCGContext *s = tcg_ctx;
@@ -0,0 +1,264 @@
+/*
+ * Microbenchmarks for core utility and block layer hot paths
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ *
+ * Each benchmark repeats a fixed workload for about BENCH_SECONDS and
+ * prints one JSON object per line, so that results can be collected and
+ * compared across releases:
+ *
+ *   {"name": "/core/buffer-is-zero/4096", "ops": 123, "seconds": 1.000,
+ *    "ns-per-op": 8.13}
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/hbitmap.h"
+#include "qemu/main-loop.h"
+#include "block/aio.h"
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+
+#define BENCH_SECONDS 1.0
+
+static void GCC_FMT_ATTR(3, 4) bench_report(uint64_t ops, double secs,
+                                            const char *fmt, ...)
+{
+    va_list ap;
+    char *name;
+
+    va_start(ap, fmt);
+    name = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+
+    g_print("{\"name\": \"/core/%s\", \"ops\": %" PRIu64 ", "
+            "\"seconds\": %.3f, \"ns-per-op\": %.2f}\n",
+            name, ops, secs, secs * 1e9 / ops);
+    g_free(name);
+}
+
+/*
+ * buffer_is_zero
+ */
+
+static void bench_buffer_is_zero(const void *opaque)
+{
+    size_t len = (size_t)opaque;
+    uint8_t *buf = g_malloc0(len);
+    uint64_t ops = 0;
+    int i;
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < 1000; i++) {
+            g_assert(buffer_is_zero(buf, len));
+        }
+        ops += 1000;
+    } while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+    bench_report(ops, g_test_timer_last(), "buffer-is-zero/%zu", len);
+    g_free(buf);
+}
+
+/*
+ * hbitmap iteration over a bitmap with one bit set every @stride bits
+ */
+
+#define HBITMAP_BENCH_BITS (1 << 24)
+
+static void bench_hbitmap_iter(const void *opaque)
+{
+    uint64_t stride = (uintptr_t)opaque;
+    HBitmap *hb = hbitmap_alloc(HBITMAP_BENCH_BITS, 0);
+    HBitmapIter hbi;
+    uint64_t ops = 0, i;
+
+    for (i = 0; i < HBITMAP_BENCH_BITS; i += stride) {
+        hbitmap_set(hb, i, 1);
+    }
+
+    g_test_timer_start();
+    do {
+        hbitmap_iter_init(&hbi, hb, 0);
+        while (hbitmap_iter_next(&hbi) >= 0) {
+            ops++;
+        }
+    } while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+    bench_report(ops, g_test_timer_last(), "hbitmap-iter/stride-%" PRIu64,
+                 stride);
+    hbitmap_free(hb);
+}
+
+/*
+ * Coroutine create+enter+terminate, and switch via yield
+ */
+
+static void coroutine_fn bench_empty_co(void *opaque)
+{
+}
+
+static void bench_coroutine_create(const void *opaque)
+{
+    uint64_t ops = 0;
+    int i;
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < 1000; i++) {
+            qemu_coroutine_enter(qemu_coroutine_create(bench_empty_co, NULL));
+        }
+        ops += 1000;
+    } while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+    bench_report(ops, g_test_timer_last(), "coroutine/create");
+}
+
+static void coroutine_fn bench_yield_co(void *opaque)
+{
+    bool *done = opaque;
+
+    while (!*done) {
+        qemu_coroutine_yield();
+    }
+}
+
+static void bench_coroutine_switch(const void *opaque)
+{
+    bool done = false;
+    Coroutine *co = qemu_coroutine_create(bench_yield_co, &done);
+    uint64_t ops = 0;
+    int i;
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < 1000; i++) {
+            qemu_coroutine_enter(co);
+        }
+        ops += 1000;
+    } while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+    bench_report(ops, g_test_timer_last(), "coroutine/switch");
+    done = true;
+    qemu_coroutine_enter(co);
+}
+
+/*
+ * aio_poll dispatching @n ready event notifiers per call
+ */
+
+static void bench_aio_notifier_read(EventNotifier *e)
+{
+    event_notifier_test_and_clear(e);
+}
+
+static void bench_aio_poll(const void *opaque)
+{
+    int n = (uintptr_t)opaque;
+    AioContext *ctx = aio_context_new(&error_abort);
+    EventNotifier *notifiers = g_new0(EventNotifier, n);
+    uint64_t ops = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        event_notifier_init(&notifiers[i], false);
+        aio_set_event_notifier(ctx, &notifiers[i], false,
+                               bench_aio_notifier_read, NULL);
+    }
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < n; i++) {
+            event_notifier_set(&notifiers[i]);
+        }
+        while (aio_poll(ctx, false)) {
+            /* dispatch until nothing is ready */
+        }
+        ops++;
+    } while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+    bench_report(ops, g_test_timer_last(), "aio-poll/handlers-%d", n);
+
+    for (i = 0; i < n; i++) {
+        aio_set_event_notifier(ctx, &notifiers[i], false, NULL, NULL);
+        event_notifier_cleanup(&notifiers[i]);
+    }
+    g_free(notifiers);
+    aio_context_unref(ctx);
+}
+
+/*
+ * blk_pread of @len bytes from null-co, through bdrv_co_preadv and the
+ * request tracking of the block layer
+ */
+
+static void bench_null_co_read(const void *opaque)
+{
+    size_t len = (size_t)opaque;
+    BlockBackend *blk;
+    uint8_t *buf = qemu_memalign(4096, len);
+    uint64_t ops = 0;
+    int i;
+
+    blk = blk_new_open("null-co://", NULL, NULL, BDRV_O_RDWR, &error_abort);
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < 100; i++) {
+            g_assert(blk_pread(blk, i * len, buf, len) == len);
+        }
+        ops += 100;
+    } while (g_test_timer_elapsed() < BENCH_SECONDS);
+
+    bench_report(ops, g_test_timer_last(), "null-co-read/%zu", len);
+    blk_unref(blk);
+    qemu_vfree(buf);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t zero_sizes[] = { 64, 4096, 65536 };
+    static const uintptr_t strides[] = { 1, 64, 4096 };
+    static const uintptr_t handlers[] = { 1, 16, 128 };
+    static const size_t read_sizes[] = { 512, 4096, 65536 };
+    char *name;
+    int i;
+
+    qemu_init_main_loop(&error_abort);
+    bdrv_init();
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < ARRAY_SIZE(zero_sizes); i++) {
+        name = g_strdup_printf("/core/buffer-is-zero/%zu", zero_sizes[i]);
+        g_test_add_data_func(name, (void *)zero_sizes[i],
+                             bench_buffer_is_zero);
+        g_free(name);
+    }
+    for (i = 0; i < ARRAY_SIZE(strides); i++) {
+        name = g_strdup_printf("/core/hbitmap-iter/stride-%" PRIuPTR,
+                               strides[i]);
+        g_test_add_data_func(name, (void *)strides[i], bench_hbitmap_iter);
+        g_free(name);
+    }
+    g_test_add_data_func("/core/coroutine/create", NULL,
+                         bench_coroutine_create);
+    g_test_add_data_func("/core/coroutine/switch", NULL,
+                         bench_coroutine_switch);
+    for (i = 0; i < ARRAY_SIZE(handlers); i++) {
+        name = g_strdup_printf("/core/aio-poll/handlers-%" PRIuPTR,
+                               handlers[i]);
+        g_test_add_data_func(name, (void *)handlers[i], bench_aio_poll);
+        g_free(name);
+    }
+    for (i = 0; i < ARRAY_SIZE(read_sizes); i++) {
+        name = g_strdup_printf("/core/null-co-read/%zu", read_sizes[i]);
+        g_test_add_data_func(name, (void *)read_sizes[i], bench_null_co_read);
+        g_free(name);
+    }
+
+    return g_test_run();
+}
@@ -49,6 +49,46 @@ static void test_hash_speed(const void *opaque)
     g_free(in);
 }
 
+#define MULTI_NBUFS 16
+
+static void test_hash_multi_speed(const void *opaque)
+{
+    size_t chunk_size = (size_t)opaque;
+    uint8_t *in = NULL, *out = NULL;
+    double total = 0.0;
+    struct iovec iov[MULTI_NBUFS];
+    size_t i;
+    int ret;
+
+    in = g_new0(uint8_t, chunk_size * MULTI_NBUFS);
+    memset(in, g_test_rand_int(), chunk_size * MULTI_NBUFS);
+    out = g_new0(uint8_t, qcrypto_hash_digest_len(QCRYPTO_HASH_ALG_SHA256) *
+                          MULTI_NBUFS);
+
+    for (i = 0; i < MULTI_NBUFS; i++) {
+        iov[i].iov_base = (char *)in + i * chunk_size;
+        iov[i].iov_len = chunk_size;
+    }
+
+    g_test_timer_start();
+    do {
+        ret = qcrypto_hash_bytes_multi(QCRYPTO_HASH_ALG_SHA256,
+                                       iov, MULTI_NBUFS, out, NULL);
+        g_assert(ret == 0);
+
+        total += chunk_size * MULTI_NBUFS;
+    } while (g_test_timer_elapsed() < 5.0);
+
+    total /= 1024 * 1024; /* to MB */
+    g_print("sha256 multi: ");
+    g_print("Testing %d x chunk_size %zu bytes ", MULTI_NBUFS, chunk_size);
+    g_print("done: %.2f MB in %.2f secs: ", total, g_test_timer_last());
+    g_print("%.2f MB/sec\n", total / g_test_timer_last());
+
+    g_free(out);
+    g_free(in);
+}
+
 int main(int argc, char **argv)
 {
     size_t i;
@@ -63,5 +103,11 @@ int main(int argc, char **argv)
         g_test_add_data_func(name, (void *)i, test_hash_speed);
     }
 
+    for (i = 64 * 1024; i <= 4 * 1024 * 1024; i *= 4) {
+        memset(name, 0 , sizeof(name));
+        snprintf(name, sizeof(name), "/crypto/hash/multi-speed-%zu", i);
+        g_test_add_data_func(name, (void *)i, test_hash_multi_speed);
+    }
+
     return g_test_run();
 }
@@ -15,8 +15,11 @@
 #include "qemu-common.h"
 #include "hw/smbios/smbios.h"
 #include "qemu/bitmap.h"
+#include "qemu/bswap.h"
 #include "acpi-utils.h"
 #include "boot-sector.h"
+#include "hw/nvram/fw_cfg_keys.h"
+#include "libqos/fw_cfg.h"
 
 #define MACHINE_PC "pc"
 #define MACHINE_Q35 "q35"
@@ -838,6 +841,57 @@ static void test_acpi_piix4_tcg_numamem(void)
     free_test_data(&data);
 }
 
+static uint16_t find_fw_cfg_file(QFWCFG *fw_cfg, const char *name)
+{
+    struct {
+        uint32_t size;
+        uint16_t select;
+        uint16_t reserved;
+        char name[FW_CFG_MAX_FILE_PATH];
+    } file;
+    uint32_t count, i;
+
+    qfw_cfg_get(fw_cfg, FW_CFG_FILE_DIR, &count, sizeof(count));
+    count = be32_to_cpu(count);
+    for (i = 0; i < count; i++) {
+        qfw_cfg_read_data(fw_cfg, &file, sizeof(file));
+        if (!strcmp(file.name, name)) {
+            return be16_to_cpu(file.select);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Time a reset followed by firmware selecting the ACPI tables, which is
+ * when QEMU regenerates them, for a machine with large CPU AML.
+ */
+static void test_acpi_rebuild_perf(void)
+{
+    QFWCFG *fw_cfg;
+    uint16_t key;
+    uint64_t n = 0;
+
+    qtest_start("-machine q35,accel=tcg -smp 1,maxcpus=255 -S");
+    fw_cfg = pc_fw_cfg_init();
+    key = find_fw_cfg_file(fw_cfg, "etc/acpi/tables");
+    g_assert(key);
+
+    g_test_timer_start();
+    do {
+        qmp_discard_response("{ 'execute': 'system_reset' }");
+        qmp_eventwait("RESET");
+        qfw_cfg_select(fw_cfg, key);
+        n++;
+    } while (g_test_timer_elapsed() < 2.0);
+
+    g_test_message("ACPI rebuild: %" PRIu64 " resets in %f s, %.3f ms each",
+                   n, g_test_timer_last(), g_test_timer_last() * 1000 / n);
+
+    g_free(fw_cfg);
+    qtest_end();
+}
+
 int main(int argc, char *argv[])
 {
     const char *arch = qtest_get_arch();
@@ -862,6 +916,9 @@ int main(int argc, char *argv[])
         qtest_add_func("acpi/q35/memhp", test_acpi_q35_tcg_memhp);
         qtest_add_func("acpi/piix4/numamem", test_acpi_piix4_tcg_numamem);
         qtest_add_func("acpi/q35/numamem", test_acpi_q35_tcg_numamem);
+        if (g_test_perf()) {
+            qtest_add_func("acpi/q35/perf/rebuild", test_acpi_rebuild_perf);
+        }
     }
     ret = g_test_run();
     boot_sector_cleanup(disk);
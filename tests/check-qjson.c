@@ -847,6 +847,36 @@ static void utf8_string(void)
     }
 }
 
+static void large_string(void)
+{
+    GString *encoded = g_string_new("\"");
+    GString *decoded = g_string_new("");
+    QObject *obj;
+    QString *str;
+    int i;
+
+    /* Long unescaped runs, with escapes and newlines in between */
+    for (i = 0; i < 4096; i++) {
+        g_string_append(encoded, "QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVo=");
+        g_string_append(decoded, "QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVo=");
+        if (i % 64 == 0) {
+            g_string_append(encoded, "\\n\\\"\\u00e9\n");
+            g_string_append(decoded, "\n\"\xc3\xa9\n");
+        }
+    }
+    g_string_append(encoded, "\"");
+
+    obj = qobject_from_json(encoded->str, &error_abort);
+    str = qobject_to_qstring(obj);
+    g_assert(str);
+    g_assert_cmpuint(qstring_get_length(str), ==, decoded->len);
+    g_assert_cmpstr(qstring_get_str(str), ==, decoded->str);
+
+    qobject_decref(obj);
+    g_string_free(encoded, true);
+    g_string_free(decoded, true);
+}
+
 static void vararg_string(void)
 {
     int i;
@@ -1421,6 +1451,7 @@ int main(int argc, char **argv)
     g_test_add_func("/literals/string/escaped", escaped_string);
     g_test_add_func("/literals/string/utf8", utf8_string);
     g_test_add_func("/literals/string/single_quote", single_quote_string);
+    g_test_add_func("/literals/string/large", large_string);
     g_test_add_func("/literals/string/vararg", vararg_string);
 
     g_test_add_func("/literals/number/simple", simple_number);
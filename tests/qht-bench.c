@@ -9,6 +9,7 @@
 #include "qemu/atomic.h"
 #include "qemu/qht.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/tb-hash-xx.h"
 
 struct thread_stats {
@@ -20,6 +21,7 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    int64_t max_update_ns;
 };
 
 struct thread_info {
@@ -55,6 +57,7 @@ static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 
 static double update_rate; /* 0.0 to 1.0 */
+static bool measure_latency;
 static uint64_t update_threshold;
 static uint64_t resize_threshold;
 
@@ -80,6 +83,7 @@ static const char commands_string[] =
     " -r = update range of keys (will be rounded up to pow2)\n"
     "\n"
     " -u = update rate (0.0 to 100.0), 50/50 split of insertions/removals\n"
+    " -L = report the slowest insertion/removal, e.g. to see resize stalls\n"
     "\n"
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
@@ -157,6 +161,8 @@ static void do_rw(struct thread_info *info)
             stats->not_rd++;
         }
     } else {
+        int64_t t0 = measure_latency ? get_clock() : 0;
+
         p = &keys[info->r & (update_range - 1)];
         hash = h(*p);
         if (info->write_op) {
@@ -183,6 +189,9 @@ static void do_rw(struct thread_info *info)
             }
         }
         info->write_op = !info->write_op;
+        if (measure_latency) {
+            stats->max_update_ns = MAX(stats->max_update_ns, get_clock() - t0);
+        }
     }
 }
 
@@ -349,6 +358,8 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+
+        s->max_update_ns = MAX(s->max_update_ns, stats->max_update_ns);
     }
 }
 
@@ -383,6 +394,9 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+    if (measure_latency) {
+        printf(" Slowest update:    %.2f us\n", s.max_update_ns / 1e3);
+    }
 }
 
 static void run_test(void)
@@ -412,7 +426,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:r:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:Lhn:N:o:r:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -442,6 +456,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
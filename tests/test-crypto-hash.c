@@ -188,6 +188,58 @@ static void test_hash_iov(void)
 }
 
 
+/* Test hashing several buffers at once, enough to use threads */
+#define MULTI_NBUFS 8
+#define MULTI_BUFLEN (512 * 1024)
+
+static void test_hash_multi(void)
+{
+    size_t i;
+    const size_t nbufs = MULTI_NBUFS;
+    const size_t buflen = MULTI_BUFLEN;
+    uint8_t *data = g_malloc(nbufs * buflen);
+    struct iovec bufs[MULTI_NBUFS];
+
+    for (i = 0; i < nbufs * buflen; i++) {
+        data[i] = i * 7 + (i >> 13);
+    }
+    for (i = 0; i < nbufs; i++) {
+        bufs[i].iov_base = data + i * buflen;
+        bufs[i].iov_len = buflen - i;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(expected_outputs) ; i++) {
+        size_t digestlen = qcrypto_hash_digest_len(i);
+        uint8_t *results;
+        int ret;
+        size_t j;
+
+        if (!qcrypto_hash_supports(i)) {
+            continue;
+        }
+
+        results = g_new0(uint8_t, nbufs * digestlen);
+        ret = qcrypto_hash_bytes_multi(i, bufs, nbufs, results, NULL);
+        g_assert(ret == 0);
+
+        for (j = 0; j < nbufs; j++) {
+            uint8_t *result = NULL;
+            size_t resultlen = 0;
+
+            ret = qcrypto_hash_bytesv(i, &bufs[j], 1,
+                                      &result, &resultlen, NULL);
+            g_assert(ret == 0);
+            g_assert(resultlen == digestlen);
+            g_assert(memcmp(result, results + j * digestlen,
+                            digestlen) == 0);
+            g_free(result);
+        }
+        g_free(results);
+    }
+    g_free(data);
+}
+
+
 /* Test with printable hashing */
 static void test_hash_digest(void)
 {
@@ -247,6 +299,7 @@ int main(int argc, char **argv)
 
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/crypto/hash/iov", test_hash_iov);
+    g_test_add_func("/crypto/hash/multi", test_hash_multi);
     g_test_add_func("/crypto/hash/alloc", test_hash_alloc);
     g_test_add_func("/crypto/hash/prealloc", test_hash_prealloc);
     g_test_add_func("/crypto/hash/digest", test_hash_digest);
@@ -738,6 +738,20 @@ static void test_hbitmap_meta_one(TestHBitmapData *data, const void *unused)
     }
 }
 
+/**
+ * Resetting all bits must be visible in the meta bitmap.
+ */
+static void test_hbitmap_meta_reset_all(TestHBitmapData *data,
+                                        const void *unused)
+{
+    hbitmap_test_init_meta(data, L3 * 2, 0, BITS_PER_LONG);
+    hbitmap_set(data->hb, L1, 1);
+    hbitmap_reset_all(data->meta);
+
+    hbitmap_reset_all(data->hb);
+    hbitmap_check_meta(data, 0, L3 * 2);
+}
+
 static void test_hbitmap_serialize_align(TestHBitmapData *data,
                                          const void *unused)
 {
@@ -1028,6 +1042,7 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/meta/byte", test_hbitmap_meta_byte);
     hbitmap_test_add("/hbitmap/meta/word", test_hbitmap_meta_word);
     hbitmap_test_add("/hbitmap/meta/sector", test_hbitmap_meta_sector);
+    hbitmap_test_add("/hbitmap/meta/reset_all", test_hbitmap_meta_reset_all);
 
     hbitmap_test_add("/hbitmap/serialize/align",
                      test_hbitmap_serialize_align);
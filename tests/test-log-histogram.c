@@ -0,0 +1,90 @@
+/*
+ * Log-linear histogram tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qemu/log-histogram.h"
+
+static void test_empty(void)
+{
+    LogHistogram hist;
+
+    log_histogram_reset(&hist);
+    g_assert_cmpuint(log_histogram_count(&hist), ==, 0);
+    g_assert_cmpuint(log_histogram_percentile(&hist, 50), ==, 0);
+}
+
+static void test_exact(void)
+{
+    LogHistogram hist;
+    uint64_t i;
+
+    /* Small values have a bucket of their own */
+    log_histogram_reset(&hist);
+    for (i = 0; i < LOG_HISTOGRAM_SUB_BUCKETS; i++) {
+        log_histogram_account(&hist, i);
+    }
+
+    g_assert_cmpuint(log_histogram_count(&hist), ==, LOG_HISTOGRAM_SUB_BUCKETS);
+    g_assert_cmpuint(log_histogram_percentile(&hist, 0), ==, 0);
+    g_assert_cmpuint(log_histogram_percentile(&hist, 50), ==,
+                     LOG_HISTOGRAM_SUB_BUCKETS / 2 - 1);
+    g_assert_cmpuint(log_histogram_percentile(&hist, 100), ==,
+                     LOG_HISTOGRAM_SUB_BUCKETS - 1);
+}
+
+static void test_percentiles(void)
+{
+    LogHistogram hist;
+    uint64_t i, p;
+
+    /* 1000 values of 1000, 10 values of 100000 and one of 10000000 */
+    log_histogram_reset(&hist);
+    for (i = 0; i < 1000; i++) {
+        log_histogram_account(&hist, 1000);
+    }
+    for (i = 0; i < 10; i++) {
+        log_histogram_account(&hist, 100000);
+    }
+    log_histogram_account(&hist, 10000000);
+
+    p = log_histogram_percentile(&hist, 50);
+    g_assert_cmpuint(p, >=, 1000);
+    g_assert_cmpuint(p, <=, 1000 + 1000 / LOG_HISTOGRAM_SUB_BUCKETS);
+
+    p = log_histogram_percentile(&hist, 99.9);
+    g_assert_cmpuint(p, >=, 100000);
+    g_assert_cmpuint(p, <=, 100000 + 100000 / LOG_HISTOGRAM_SUB_BUCKETS);
+
+    p = log_histogram_percentile(&hist, 100);
+    g_assert_cmpuint(p, >=, 10000000);
+    g_assert_cmpuint(p, <=, 10000000 + 10000000 / LOG_HISTOGRAM_SUB_BUCKETS);
+}
+
+static void test_range(void)
+{
+    LogHistogram hist;
+
+    log_histogram_reset(&hist);
+    log_histogram_account(&hist, UINT64_MAX);
+    g_assert_cmpuint(log_histogram_percentile(&hist, 50), ==, UINT64_MAX);
+
+    log_histogram_reset(&hist);
+    log_histogram_account(&hist, UINT64_C(1) << 63);
+    g_assert_cmpuint(log_histogram_percentile(&hist, 50), >=,
+                     UINT64_C(1) << 63);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/log-histogram/empty", test_empty);
+    g_test_add_func("/log-histogram/exact", test_exact);
+    g_test_add_func("/log-histogram/percentiles", test_percentiles);
+    g_test_add_func("/log-histogram/range", test_range);
+    return g_test_run();
+}
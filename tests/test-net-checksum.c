@@ -0,0 +1,102 @@
+/*
+ * Internet checksum tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "net/checksum.h"
+
+static uint8_t buffer[64 * 1024 + 64];
+
+/* The byte pair at a time sum that net_checksum_add_cont() used to do */
+static uint32_t checksum_ref(int len, const uint8_t *buf, int seq)
+{
+    uint32_t sum1 = 0, sum2 = 0;
+    int i;
+
+    for (i = 0; i < len - 1; i += 2) {
+        sum1 += buf[i];
+        sum2 += buf[i + 1];
+    }
+    if (i < len) {
+        sum1 += buf[i];
+    }
+    return seq & 1 ? sum1 + (sum2 << 8) : sum2 + (sum1 << 8);
+}
+
+static void check(int len, int align, int seq)
+{
+    uint8_t *buf = buffer + align;
+
+    g_assert_cmphex(net_checksum_finish(net_checksum_add_cont(len, buf, seq)),
+                    ==, net_checksum_finish(checksum_ref(len, buf, seq)));
+}
+
+static void test_linear_1(void)
+{
+    int len, align;
+    size_t i;
+
+    /* All zeroes and all ones are where 0 and 0xffff get mixed up */
+    memset(buffer, 0, sizeof(buffer));
+    check(64 * 1024, 0, 0);
+    memset(buffer, 0xff, sizeof(buffer));
+    check(64 * 1024, 0, 0);
+    check(64 * 1024 - 1, 1, 1);
+
+    for (i = 0; i < sizeof(buffer); i++) {
+        buffer[i] = g_test_rand_int();
+    }
+    check(64 * 1024, 0, 0);
+    for (align = 0; align < 64; align++) {
+        for (len = 0; len < 600; len++) {
+            check(len, align, 0);
+            check(len, align, 1);
+        }
+    }
+}
+
+static void test_linear(void)
+{
+    do {
+        test_linear_1();
+    } while (test_net_checksum_next_accel());
+}
+
+static void test_iov(void)
+{
+    struct iovec iov[3];
+    uint32_t linear, sg;
+    size_t i;
+
+    for (i = 0; i < 1500; i++) {
+        buffer[i] = g_test_rand_int();
+    }
+
+    /* Odd sized elements, so that later ones start at odd offsets */
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = 33;
+    iov[1].iov_base = buffer + 33;
+    iov[1].iov_len = 1001;
+    iov[2].iov_base = buffer + 1034;
+    iov[2].iov_len = 466;
+
+    for (i = 0; i < 40; i++) {
+        linear = net_checksum_add_cont(1500 - i, buffer + i, 0);
+        sg = net_checksum_add_iov(iov, ARRAY_SIZE(iov), i, 1500 - i, 0);
+        g_assert_cmphex(net_checksum_finish(sg), ==,
+                        net_checksum_finish(linear));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/checksum/linear", test_linear);
+    g_test_add_func("/net/checksum/iov", test_iov);
+
+    return g_test_run();
+}
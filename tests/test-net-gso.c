@@ -0,0 +1,157 @@
+/*
+ * TCP segmentation tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/gso.h"
+
+#define L3_OFF      ETH_HLEN
+#define PAYLOAD_LEN 3500
+#define MSS         1000
+#define SEQ         0xfffffc00
+
+typedef struct {
+    size_t l4_off;
+    bool ipv4;
+    size_t received;
+    int segs;
+} TestState;
+
+static uint8_t payload[PAYLOAD_LEN];
+
+static void check_segment(void *opaque, const struct iovec *iov, int iovcnt)
+{
+    TestState *s = opaque;
+    size_t len = iov_size(iov, iovcnt);
+    size_t hdr_len = s->l4_off + sizeof(struct tcp_hdr);
+    size_t seg_len = MIN(MSS, PAYLOAD_LEN - s->received);
+    uint8_t *buf = g_malloc(len);
+    struct tcp_hdr *tcp = (struct tcp_hdr *)(buf + s->l4_off);
+    bool last = s->received + seg_len == PAYLOAD_LEN;
+    uint32_t cntr, cso;
+
+    iov_to_buf(iov, iovcnt, 0, buf, len);
+    g_assert_cmpuint(len, ==, hdr_len + seg_len);
+    g_assert(!memcmp(buf + hdr_len, payload + s->received, seg_len));
+
+    if (s->ipv4) {
+        struct ip_header *ip = (struct ip_header *)(buf + L3_OFF);
+
+        g_assert_cmpuint(lduw_be_p(&ip->ip_len), ==, len - L3_OFF);
+        g_assert_cmpuint(lduw_be_p(&ip->ip_id), ==, 0x1234 + s->segs);
+        g_assert_cmphex(net_raw_checksum((uint8_t *)ip, sizeof(*ip)), ==, 0);
+        cntr = eth_calc_ip4_pseudo_hdr_csum(ip, len - s->l4_off, &cso);
+    } else {
+        struct ip6_header *ip6 = (struct ip6_header *)(buf + L3_OFF);
+
+        g_assert_cmpuint(lduw_be_p(&ip6->ip6_ctlun.ip6_un1.ip6_un1_plen), ==,
+                         len - s->l4_off);
+        cntr = eth_calc_ip6_pseudo_hdr_csum(ip6, len - s->l4_off,
+                                            IP_PROTO_TCP, &cso);
+    }
+
+    g_assert_cmphex(ldl_be_p(&tcp->th_seq), ==,
+                    (uint32_t)(SEQ + s->received));
+    g_assert_cmphex(tcp->th_flags, ==,
+                    TH_ACK | (last ? TH_FIN | TH_PUSH : 0) |
+                    (s->segs ? 0 : TH_CWR));
+    cntr += net_checksum_add_cont(len - s->l4_off, buf + s->l4_off, cso);
+    g_assert_cmphex(net_checksum_finish(cntr), ==, 0);
+
+    s->received += seg_len;
+    s->segs++;
+    g_free(buf);
+}
+
+static void build_tcp(uint8_t *tcp_hdr)
+{
+    struct tcp_hdr *tcp = (struct tcp_hdr *)tcp_hdr;
+
+    stl_be_p(&tcp->th_seq, SEQ);
+    tcp->th_off = sizeof(*tcp) / 4;
+    tcp->th_flags = TH_ACK | TH_FIN | TH_PUSH | TH_CWR;
+}
+
+static void run(const uint8_t *hdr, size_t l4_off, bool ipv4)
+{
+    TestState s = { .l4_off = l4_off, .ipv4 = ipv4 };
+    struct iovec iov[3];
+    int i, ret;
+
+    for (i = 0; i < PAYLOAD_LEN; i++) {
+        payload[i] = i * 7;
+    }
+    /* Payload buffers that do not line up with the segments */
+    iov[0].iov_base = payload;
+    iov[0].iov_len = 1;
+    iov[1].iov_base = payload + 1;
+    iov[1].iov_len = 1500;
+    iov[2].iov_base = payload + 1501;
+    iov[2].iov_len = PAYLOAD_LEN - 1501;
+
+    ret = net_gso_tcp(hdr, L3_OFF, l4_off, l4_off + sizeof(struct tcp_hdr),
+                      iov, 3, PAYLOAD_LEN, MSS, check_segment, &s);
+    g_assert_cmpint(ret, ==, DIV_ROUND_UP(PAYLOAD_LEN, MSS));
+    g_assert_cmpint(s.segs, ==, ret);
+    g_assert_cmpuint(s.received, ==, PAYLOAD_LEN);
+}
+
+static void test_ipv4(void)
+{
+    size_t l4_off = L3_OFF + sizeof(struct ip_header);
+    uint8_t hdr[l4_off + sizeof(struct tcp_hdr)];
+    struct ip_header *ip = (struct ip_header *)(hdr + L3_OFF);
+
+    memset(hdr, 0, sizeof(hdr));
+    ip->ip_ver_len = (IP_HEADER_VERSION_4 << 4) | (sizeof(*ip) / 4);
+    ip->ip_p = IP_PROTO_TCP;
+    ip->ip_ttl = 64;
+    stw_be_p(&ip->ip_id, 0x1234);
+    stl_be_p(&ip->ip_src, 0x0a000001);
+    stl_be_p(&ip->ip_dst, 0x0a000002);
+    build_tcp(hdr + l4_off);
+    run(hdr, l4_off, true);
+}
+
+static void test_ipv6(void)
+{
+    size_t l4_off = L3_OFF + sizeof(struct ip6_header);
+    uint8_t hdr[l4_off + sizeof(struct tcp_hdr)];
+    struct ip6_header *ip6 = (struct ip6_header *)(hdr + L3_OFF);
+
+    memset(hdr, 0, sizeof(hdr));
+    ip6->ip6_ctlun.ip6_un1.ip6_un1_flow = cpu_to_be32(6 << 28);
+    ip6->ip6_ctlun.ip6_un1.ip6_un1_nxt = IP_PROTO_TCP;
+    ip6->ip6_ctlun.ip6_un1.ip6_un1_hlim = 64;
+    ip6->ip6_src.__in6_u.__u6_addr8[15] = 1;
+    ip6->ip6_dst.__in6_u.__u6_addr8[15] = 2;
+    build_tcp(hdr + l4_off);
+    run(hdr, l4_off, false);
+}
+
+static void test_invalid(void)
+{
+    uint8_t hdr[L3_OFF + sizeof(struct ip_header) + sizeof(struct tcp_hdr)];
+    struct iovec iov = { .iov_base = payload, .iov_len = MSS };
+
+    /* Neither IPv4 nor IPv6 */
+    memset(hdr, 0, sizeof(hdr));
+    g_assert_cmpint(net_gso_tcp(hdr, L3_OFF, L3_OFF + sizeof(struct ip_header),
+                                sizeof(hdr), &iov, 1, MSS, MSS,
+                                check_segment, NULL), ==, -EINVAL);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/gso/ipv4", test_ipv4);
+    g_test_add_func("/net/gso/ipv6", test_ipv6);
+    g_test_add_func("/net/gso/invalid", test_invalid);
+    return g_test_run();
+}
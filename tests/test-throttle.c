@@ -667,6 +667,39 @@ static void test_accounting(void)
                                 (64.0 / 13)));
 }
 
+static void test_budget(void)
+{
+    uint64_t size, units;
+
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_BPS_TOTAL].avg = 1000000;
+    cfg.buckets[THROTTLE_BPS_WRITE].avg = 200000;
+    cfg.buckets[THROTTLE_OPS_READ].avg = 5000;
+
+    throttle_init(&ts);
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+
+    /* the smallest limit of each kind applies */
+    throttle_get_budget(&ts, false, SCALE_MS, &size, &units);
+    g_assert_cmpint(size, ==, 1000);
+    g_assert_cmpint(units, ==, 5);
+
+    throttle_get_budget(&ts, true, SCALE_MS, &size, &units);
+    g_assert_cmpint(size, ==, 200);
+    g_assert(units == UINT64_MAX);
+
+    /* a budget is accounted like the equivalent requests */
+    throttle_account_units(&ts, false, size, 5);
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 200));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_READ].level, 200));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_WRITE].level, 0));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_READ].level, 5));
+
+    g_assert(double_cmp(throttle_op_units(0, 65536), 1));
+    g_assert(double_cmp(throttle_op_units(4096, 512), 1));
+    g_assert(double_cmp(throttle_op_units(4096, 65536), 16));
+}
+
 static void test_groups(void)
 {
     ThrottleConfig cfg1, cfg2;
@@ -760,6 +793,7 @@ int main(int argc, char **argv)
                     test_iops_size_is_missing_limit);
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
+    g_test_add_func("/throttle/budget",             test_budget);
     g_test_add_func("/throttle/groups",             test_groups);
     return g_test_run();
 }
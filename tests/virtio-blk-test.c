@@ -678,6 +678,105 @@ static void pci_hotplug(void)
  * Check that setting the vring addr on a non-existent virtqueue does
  * not crash.
  */
+/*
+ * Throughput of the virtio-blk emulation against a null-co backend, at
+ * a given queue depth and with or without an IOThread.  The requests and
+ * their descriptor chains are set up once and then resubmitted, so each
+ * iteration costs only the kicks and the completions.  Every guest memory
+ * access is a qtest round trip, so compare results with each other rather
+ * than with a real guest.
+ */
+typedef struct PerfParams {
+    int queue_depth;
+    bool iothread;
+} PerfParams;
+
+#define PERF_REQ_SIZE   4096
+#define PERF_SECONDS    2.0
+
+static void pci_perf(const void *opaque)
+{
+    const PerfParams *params = opaque;
+    QVirtioPCIDevice *dev;
+    QOSState *qs;
+    QVirtQueuePCI *vqpci;
+    QVirtioBlkReq req;
+    uint64_t *req_addr = g_new(uint64_t, params->queue_depth);
+    uint32_t *head = g_new(uint32_t, params->queue_depth);
+    uint32_t features;
+    uint64_t ops = 0;
+    gint64 start_time;
+    int i, done;
+
+    qs = qtest_pc_boot("-object iothread,id=iothread0 "
+                       "-drive if=none,id=drive0,file=null-co://,format=raw "
+                       "-device virtio-blk-pci,id=drv0,drive=drive0,"
+                       "addr=%x.%x%s", PCI_SLOT, PCI_FN,
+                       params->iothread ? ",iothread=iothread0" : "");
+    dev = virtio_blk_pci_init(qs->pcibus, PCI_SLOT);
+
+    features = qvirtio_get_features(&dev->vdev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(&dev->vdev, features);
+
+    vqpci = (QVirtQueuePCI *)qvirtqueue_setup(&dev->vdev, qs->alloc, 0);
+    g_assert_cmpint(vqpci->vq.size, >=, params->queue_depth * 3);
+    qvirtio_set_driver_ok(&dev->vdev);
+
+    for (i = 0; i < params->queue_depth; i++) {
+        req.type = VIRTIO_BLK_T_IN;
+        req.ioprio = 1;
+        req.sector = i * (PERF_REQ_SIZE / 512);
+        req.data = g_malloc0(PERF_REQ_SIZE);
+        req_addr[i] = virtio_blk_request(qs->alloc, &dev->vdev, &req,
+                                         PERF_REQ_SIZE);
+        g_free(req.data);
+
+        head[i] = qvirtqueue_add(&vqpci->vq, req_addr[i], 16, false, true);
+        qvirtqueue_add(&vqpci->vq, req_addr[i] + 16, PERF_REQ_SIZE,
+                       true, true);
+        qvirtqueue_add(&vqpci->vq, req_addr[i] + 16 + PERF_REQ_SIZE, 1,
+                       true, false);
+    }
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < params->queue_depth; i++) {
+            qvirtqueue_kick(&dev->vdev, &vqpci->vq, head[i]);
+        }
+        start_time = g_get_monotonic_time();
+        for (done = 0; done < params->queue_depth; ) {
+            if (qvirtqueue_get_buf(&vqpci->vq, NULL)) {
+                done++;
+            } else {
+                g_assert(g_get_monotonic_time() - start_time <=
+                         QVIRTIO_BLK_TIMEOUT_US);
+            }
+        }
+        ops += params->queue_depth;
+    } while (g_test_timer_elapsed() < PERF_SECONDS);
+
+    g_test_message("virtio-blk %s queue depth %d: %" PRIu64 " requests "
+                   "in %f s, %.0f IOPS", params->iothread ? "iothread" :
+                   "main loop", params->queue_depth, ops, g_test_timer_last(),
+                   ops / g_test_timer_last());
+
+    for (i = 0; i < params->queue_depth; i++) {
+        g_assert_cmpint(readb(req_addr[i] + 16 + PERF_REQ_SIZE), ==, 0);
+        guest_free(qs->alloc, req_addr[i]);
+    }
+    g_free(req_addr);
+    g_free(head);
+
+    qvirtqueue_cleanup(dev->vdev.bus, &vqpci->vq, qs->alloc);
+    qvirtio_pci_device_disable(dev);
+    qvirtio_pci_device_free(dev);
+    qtest_shutdown(qs);
+}
+
 static void test_nonexistent_virtqueue(void)
 {
     QPCIBar bar0;
@@ -754,6 +853,26 @@ int main(int argc, char **argv)
             qtest_add_func("/virtio/blk/pci/idx", pci_idx);
         }
         qtest_add_func("/virtio/blk/pci/hotplug", pci_hotplug);
+        if (g_test_perf() &&
+            (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0)) {
+            static const PerfParams perf_params[] = {
+                { .queue_depth = 1 },
+                { .queue_depth = 32 },
+                { .queue_depth = 1, .iothread = true },
+                { .queue_depth = 32, .iothread = true },
+            };
+            char *name;
+            int i;
+
+            for (i = 0; i < ARRAY_SIZE(perf_params); i++) {
+                name = g_strdup_printf("/virtio/blk/pci/perf/%s-qd%d",
+                                       perf_params[i].iothread ?
+                                       "iothread" : "main-loop",
+                                       perf_params[i].queue_depth);
+                qtest_add_data_func(name, &perf_params[i], pci_perf);
+                g_free(name);
+            }
+        }
     } else if (strcmp(arch, "arm") == 0) {
         qtest_add_func("/virtio/blk/mmio/basic", mmio_basic);
     }
@@ -109,6 +109,19 @@ void thunk_register_struct(int id, const char *name, const argtype *types)
                i == THUNK_HOST ? "host" : "target", offset, max_align);
 #endif
     }
+
+    /* nested structs are registered before the structs using them */
+    se->identical = se->size[THUNK_TARGET] == se->size[THUNK_HOST];
+    type_ptr = se->field_types;
+    for (j = 0; j < nb_fields && se->identical; j++) {
+        se->identical = (se->field_offsets[THUNK_TARGET][j] ==
+                         se->field_offsets[THUNK_HOST][j] &&
+                         thunk_type_is_identical(type_ptr));
+        type_ptr = thunk_type_next(type_ptr);
+    }
+#ifdef DEBUG
+    printf("%s: identical=%d\n", se->name, se->identical);
+#endif
 }
 
 void thunk_register_struct_direct(int id, const char *name,
@@ -120,6 +133,41 @@ void thunk_register_struct_direct(int id, const char *name,
     se = struct_entries + id;
     *se = *se1;
     se->name = name;
+    se->identical = false;
+}
+
+/* Return true if the target and host representations of the type are
+   the same, so that guest memory can be handed to the host as is.  */
+bool thunk_type_is_identical(const argtype *type_ptr)
+{
+    switch (*type_ptr++) {
+    case TYPE_CHAR:
+        return true;
+    case TYPE_SHORT:
+    case TYPE_INT:
+    case TYPE_LONGLONG:
+    case TYPE_ULONGLONG:
+#ifdef BSWAP_NEEDED
+        return false;
+#else
+        return true;
+#endif
+    case TYPE_LONG:
+    case TYPE_ULONG:
+    case TYPE_PTRVOID:
+#if !defined(BSWAP_NEEDED) && HOST_LONG_BITS == TARGET_ABI_BITS
+        return true;
+#else
+        return false;
+#endif
+    case TYPE_ARRAY:
+        return thunk_type_is_identical(type_ptr + 1);
+    case TYPE_STRUCT:
+        return struct_entries[*type_ptr].identical;
+    default:
+        /* TYPE_PTR and TYPE_OLDDEVT always need converting */
+        return false;
+    }
 }
 
 
@@ -80,13 +80,14 @@ static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size
 
 static void clear_buffer_range(unsigned int idx, size_t len)
 {
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
+    size_t chunk;
+
+    idx %= TRACE_BUF_LEN;
+    while (len > 0) {
+        chunk = MIN(len, TRACE_BUF_LEN - idx);
+        memset(&trace_buf[idx], 0, chunk);
+        len -= chunk;
+        idx = 0;
     }
 }
 /**
@@ -240,38 +241,53 @@ int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
     return 0;
 }
 
+/*
+ * Copy in and out of the ring with at most two memcpy() calls, one up to
+ * the end of trace_buf and one from its start.
+ */
 static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
+    size_t chunk;
+
+    idx %= TRACE_BUF_LEN;
+    while (size > 0) {
+        chunk = MIN(size, TRACE_BUF_LEN - idx);
+        memcpy(data_ptr, &trace_buf[idx], chunk);
+        data_ptr += chunk;
+        size -= chunk;
+        idx = 0;
     }
 }
 
 static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
+    size_t chunk;
+
+    idx %= TRACE_BUF_LEN;
+    while (size > 0) {
+        chunk = MIN(size, TRACE_BUF_LEN - idx);
+        memcpy(&trace_buf[idx], data_ptr, chunk);
+        data_ptr += chunk;
+        size -= chunk;
+        idx += chunk;
+        if (size > 0) {
+            idx = 0;
         }
-        trace_buf[idx++] = data_ptr[x++];
     }
     return idx; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    uint64_t event;
+
+    /* only the event ID carries the valid flag */
+    read_from_buffer(rec->tbuf_idx, &event, sizeof(event));
     smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    event |= TRACE_RECORD_VALID;
+    write_to_buffer(rec->tbuf_idx, &event, sizeof(event));
 
     if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
         > TRACE_BUF_FLUSH_THRESHOLD) {
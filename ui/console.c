@@ -191,7 +191,7 @@ static void text_console_update_cursor(void *opaque);
 
 static void gui_update(void *opaque)
 {
-    uint64_t interval = GUI_REFRESH_INTERVAL_IDLE;
+    uint64_t interval = GUI_REFRESH_INTERVAL_NONE;
     uint64_t dcl_interval;
     DisplayState *ds = opaque;
     DisplayChangeListener *dcl;
@@ -208,6 +208,10 @@ static void gui_update(void *opaque)
             interval = dcl_interval;
         }
     }
+    if (interval != GUI_REFRESH_INTERVAL_NONE &&
+        interval > GUI_REFRESH_INTERVAL_IDLE) {
+        interval = GUI_REFRESH_INTERVAL_IDLE;
+    }
     if (ds->update_interval != interval) {
         ds->update_interval = interval;
         for (i = 0; i < nb_consoles; i++) {
@@ -218,7 +222,9 @@ static void gui_update(void *opaque)
         trace_console_refresh(interval);
     }
     ds->last_update = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
-    timer_mod(ds->gui_timer, ds->last_update + interval);
+    if (interval != GUI_REFRESH_INTERVAL_NONE) {
+        timer_mod(ds->gui_timer, ds->last_update + interval);
+    }
 }
 
 static void gui_setup_refresh(DisplayState *ds)
@@ -243,6 +249,10 @@ static void gui_setup_refresh(DisplayState *ds)
     if (need_timer && ds->gui_timer == NULL) {
         ds->gui_timer = timer_new_ms(QEMU_CLOCK_REALTIME, gui_update, ds);
         timer_mod(ds->gui_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+    } else if (need_timer &&
+               ds->update_interval == GUI_REFRESH_INTERVAL_NONE) {
+        /* The timer was stopped; the new listener may want refreshes */
+        timer_mod(ds->gui_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
     }
     if (!need_timer && ds->gui_timer != NULL) {
         timer_del(ds->gui_timer);
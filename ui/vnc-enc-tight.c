@@ -82,17 +82,23 @@ static const struct {
     double jpeg_freq_threshold; /* Always send JPEG if the freq is above */
     int jpeg_idx;               /* Allow indexed JPEG */
     int jpeg_full;              /* Allow full color JPEG */
+    /*
+     * JPEG quality of regions updated faster than jpeg_freq_threshold,
+     * such as video playback.  They are sent again losslessly once they
+     * stop changing (see VNC_REFRESH_LOSSY).
+     */
+    int jpeg_motion_quality;
 } tight_jpeg_conf[] = {
-    { 0,   8,  1, 1 },
-    { 0,   8,  1, 1 },
-    { 0,   8,  1, 1 },
-    { 0,   8,  1, 1 },
-    { 0,   10, 1, 1 },
-    { 0.1, 10, 1, 1 },
-    { 0.2, 10, 1, 1 },
-    { 0.3, 12, 0, 0 },
-    { 0.4, 14, 0, 0 },
-    { 0.5, 16, 0, 0 },
+    { 0,   8,  1, 1,  5 },
+    { 0,   8,  1, 1,  5 },
+    { 0,   8,  1, 1, 10 },
+    { 0,   8,  1, 1, 15 },
+    { 0,   10, 1, 1, 20 },
+    { 0.1, 10, 1, 1, 30 },
+    { 0.2, 10, 1, 1, 35 },
+    { 0.3, 12, 0, 0, 40 },
+    { 0.4, 14, 0, 0, 45 },
+    { 0.5, 16, 0, 0, 50 },
 };
 #endif
 
@@ -1206,16 +1212,44 @@ static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
     manager.term_destination = jpeg_term_destination;
     cinfo.dest = &manager;
 
-    jpeg_start_compress(&cinfo, true);
+#ifdef JCS_EXTENSIONS
+    /*
+     * libjpeg-turbo reads the server surface format directly, so hand it
+     * all rows of the rectangle at once instead of converting each one.
+     */
+    if (pixman_image_get_format(vs->vd->server) == VNC_SERVER_FB_FORMAT) {
+        JSAMPROW *rows = g_new(JSAMPROW, h);
 
-    linebuf = qemu_pixman_linebuf_create(PIXMAN_BE_r8g8b8, w);
-    buf = (uint8_t *)pixman_image_get_data(linebuf);
-    row[0] = buf;
-    for (dy = 0; dy < h; dy++) {
-        qemu_pixman_linebuf_fill(linebuf, vs->vd->server, w, x, y + dy);
-        jpeg_write_scanlines(&cinfo, row, 1);
+        cinfo.input_components = 4;
+#ifdef HOST_WORDS_BIGENDIAN
+        cinfo.in_color_space = JCS_EXT_XRGB;
+#else
+        cinfo.in_color_space = JCS_EXT_BGRX;
+#endif
+        jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+        jpeg_start_compress(&cinfo, true);
+
+        for (dy = 0; dy < h; dy++) {
+            rows[dy] = vnc_server_fb_ptr(vs->vd, x, y + dy);
+        }
+        for (dy = 0; dy < h; ) {
+            dy += jpeg_write_scanlines(&cinfo, rows + dy, h - dy);
+        }
+        g_free(rows);
+    } else
+#endif
+    {
+        jpeg_start_compress(&cinfo, true);
+
+        linebuf = qemu_pixman_linebuf_create(PIXMAN_BE_r8g8b8, w);
+        buf = (uint8_t *)pixman_image_get_data(linebuf);
+        row[0] = buf;
+        for (dy = 0; dy < h; dy++) {
+            qemu_pixman_linebuf_fill(linebuf, vs->vd->server, w, x, y + dy);
+            jpeg_write_scanlines(&cinfo, row, 1);
+        }
+        qemu_pixman_image_unref(linebuf);
     }
-    qemu_pixman_image_unref(linebuf);
 
     jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
@@ -1423,13 +1457,13 @@ static int send_sub_rect_jpeg(VncState *vs, int x, int y, int w, int h,
                               int bg, int fg, int colors,
                               VncPalette *palette, bool force)
 {
+    int quality = force ? tight_jpeg_conf[vs->tight.quality].jpeg_motion_quality
+                        : tight_conf[vs->tight.quality].jpeg_quality;
     int ret;
 
     if (colors == 0) {
         if (force || (tight_jpeg_conf[vs->tight.quality].jpeg_full &&
                       tight_detect_smooth_image(vs, w, h))) {
-            int quality = tight_conf[vs->tight.quality].jpeg_quality;
-
             ret = send_jpeg_rect(vs, x, y, w, h, quality);
         } else {
             ret = send_full_color_rect(vs, x, y, w, h);
@@ -1442,8 +1476,6 @@ static int send_sub_rect_jpeg(VncState *vs, int x, int y, int w, int h,
         if (force || (colors > 96 &&
                       tight_jpeg_conf[vs->tight.quality].jpeg_idx &&
                       tight_detect_smooth_image(vs, w, h))) {
-            int quality = tight_conf[vs->tight.quality].jpeg_quality;
-
             ret = send_jpeg_rect(vs, x, y, w, h, quality);
         } else {
             ret = send_palette_rect(vs, x, y, w, h, palette);
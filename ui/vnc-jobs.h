@@ -40,18 +40,40 @@ void vnc_jobs_consume_buffer(VncState *vs);
 void vnc_start_worker_thread(void);
 
 /* Locks */
+
+/*
+ * The display lock is taken exclusively by vnc_refresh() while it updates
+ * the server surface, and shared by the encoding workers, which only read
+ * it.  A shared holder does not keep vd->mutex locked; it is only counted
+ * in vd->mutex_readers so that the exclusive trylock fails.
+ */
 static inline int vnc_trylock_display(VncDisplay *vd)
 {
-    return qemu_mutex_trylock(&vd->mutex);
+    int ret = qemu_mutex_trylock(&vd->mutex);
+
+    if (!ret && vd->mutex_readers) {
+        qemu_mutex_unlock(&vd->mutex);
+        ret = EBUSY;
+    }
+    return ret;
+}
+
+static inline void vnc_unlock_display(VncDisplay *vd)
+{
+    qemu_mutex_unlock(&vd->mutex);
 }
 
-static inline void vnc_lock_display(VncDisplay *vd)
+static inline void vnc_lock_display_shared(VncDisplay *vd)
 {
     qemu_mutex_lock(&vd->mutex);
+    vd->mutex_readers++;
+    qemu_mutex_unlock(&vd->mutex);
 }
 
-static inline void vnc_unlock_display(VncDisplay *vd)
+static inline void vnc_unlock_display_shared(VncDisplay *vd)
 {
+    qemu_mutex_lock(&vd->mutex);
+    vd->mutex_readers--;
     qemu_mutex_unlock(&vd->mutex);
 }
 
@@ -2984,7 +2984,8 @@ static void vnc_refresh(DisplayChangeListener *dcl)
     int has_dirty, rects = 0;
 
     if (QTAILQ_EMPTY(&vd->clients)) {
-        update_displaychangelistener(&vd->dcl, VNC_REFRESH_INTERVAL_MAX);
+        /* vnc_connect() asks for refreshes again */
+        update_displaychangelistener(&vd->dcl, GUI_REFRESH_INTERVAL_NONE);
         return;
     }
 
@@ -160,6 +160,7 @@ struct VncDisplay
     int ledstate;
     int key_delay_ms;
     QemuMutex mutex;
+    int mutex_readers; /* encoding workers sharing the lock, see vnc-jobs.h */
 
     QEMUCursor *cursor;
     int cursor_msize;
@@ -247,6 +248,7 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    bool running;
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
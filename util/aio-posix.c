@@ -36,6 +36,13 @@ struct AioHandler
     void *opaque;
     bool is_external;
     QLIST_ENTRY(AioHandler) node;
+
+    /* Busy polling schedule and statistics, see run_poll_handlers_once() */
+    unsigned poll_shift;
+    unsigned poll_skip;
+    unsigned poll_misses;
+    uint64_t poll_calls;
+    uint64_t poll_hits;
 };
 
 #ifdef CONFIG_EPOLL_CREATE1
@@ -211,10 +218,14 @@ void aio_set_fd_handler(AioContext *ctx,
     AioHandler *node;
     bool is_new = false;
     bool deleted = false;
+    int old_events = 0;
 
     qemu_lockcnt_lock(&ctx->list_lock);
 
     node = find_aio_handler(ctx, fd);
+    if (node) {
+        old_events = node->pfd.events;
+    }
 
     /* Are we deleting the fd handler? */
     if (!io_read && !io_write && !io_poll) {
@@ -232,6 +243,9 @@ void aio_set_fd_handler(AioContext *ctx,
             g_source_remove_poll(&ctx->source, &node->pfd);
         }
 
+        /* Clear the events so that aio_epoll_update() unregisters the fd */
+        node->pfd.events = 0;
+
         /* If the lock is held, just mark the node as deleted */
         if (qemu_lockcnt_count(&ctx->list_lock)) {
             node->deleted = 1;
@@ -274,7 +288,12 @@ void aio_set_fd_handler(AioContext *ctx,
         node->pfd.events |= (io_write ? G_IO_OUT | G_IO_ERR : 0);
     }
 
-    aio_epoll_update(ctx, node, is_new);
+    /* Handlers are often re-registered with the same events, for example
+     * when only the opaque changes; that needs no epoll_ctl().
+     */
+    if (is_new || node->pfd.events != old_events) {
+        aio_epoll_update(ctx, node, is_new);
+    }
     qemu_lockcnt_unlock(&ctx->list_lock);
     aio_notify(ctx);
 
@@ -403,6 +422,9 @@ static bool aio_dispatch_handlers(AioContext *ctx)
             (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) &&
             aio_node_check(ctx, node->is_external) &&
             node->io_read) {
+            /* The handler woke up by itself, poll it eagerly again */
+            node->poll_shift = 0;
+            node->poll_skip = 0;
             node->io_read(node->opaque);
 
             /* aio_notify() does not count as progress */
@@ -486,6 +508,17 @@ static void add_pollfd(AioHandler *node)
     npfd++;
 }
 
+/*
+ * A handler that keeps finding nothing to do is polled less often: after
+ * every POLL_BACKOFF_MISSES polls without progress its polling interval
+ * doubles, up to once every 1 << POLL_BACKOFF_MAX_SHIFT iterations.  Any
+ * progress, or its fd becoming readable, makes it polled on every
+ * iteration again.  This keeps a busy queue's latency low when many idle
+ * ones share the AioContext.
+ */
+#define POLL_BACKOFF_MISSES     128
+#define POLL_BACKOFF_MAX_SHIFT  4
+
 static bool run_poll_handlers_once(AioContext *ctx)
 {
     bool progress = false;
@@ -493,9 +526,24 @@ static bool run_poll_handlers_once(AioContext *ctx)
 
     QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
         if (!node->deleted && node->io_poll &&
-            aio_node_check(ctx, node->is_external) &&
-            node->io_poll(node->opaque)) {
-            progress = true;
+            aio_node_check(ctx, node->is_external)) {
+            if (node->poll_skip) {
+                node->poll_skip--;
+                continue;
+            }
+
+            node->poll_calls++;
+            if (node->io_poll(node->opaque)) {
+                progress = true;
+                node->poll_hits++;
+                node->poll_misses = 0;
+                node->poll_shift = 0;
+            } else if (++node->poll_misses == POLL_BACKOFF_MISSES) {
+                node->poll_misses = 0;
+                node->poll_shift = MIN(node->poll_shift + 1,
+                                       POLL_BACKOFF_MAX_SHIFT);
+            }
+            node->poll_skip = (1 << node->poll_shift) - 1;
         }
 
         /* Caller handles freeing deleted nodes.  Don't do it here. */
@@ -539,6 +587,20 @@ static bool run_poll_handlers(AioContext *ctx, int64_t max_ns)
     return progress;
 }
 
+void aio_context_foreach_poll_handler(AioContext *ctx, AioPollStatsFn *fn,
+                                      void *opaque)
+{
+    AioHandler *node;
+
+    qemu_lockcnt_inc(&ctx->list_lock);
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        if (!node->deleted && node->io_poll) {
+            fn(opaque, node->pfd.fd, node->poll_calls, node->poll_hits);
+        }
+    }
+    qemu_lockcnt_dec(&ctx->list_lock);
+}
+
 /* try_poll_mode:
  * @ctx: the AioContext
  * @blocking: busy polling is only attempted when blocking is true
@@ -581,6 +643,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     bool progress;
     int64_t timeout;
     int64_t start = 0;
+    int64_t idle_start = 0;
 
     /* aio_notify can avoid the expensive event_notifier_set if
      * everything (file descriptors, bottom halves, timers) will
@@ -615,6 +678,9 @@ bool aio_poll(AioContext *ctx, bool blocking)
         }
 
         timeout = blocking ? aio_compute_timeout(ctx) : 0;
+        if (timeout) {
+            idle_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        }
 
         /* wait until next event */
         if (aio_epoll_check_poll(ctx, pollfds, npfd, timeout)) {
@@ -628,6 +694,11 @@ bool aio_poll(AioContext *ctx, bool blocking)
         } else  {
             ret = qemu_poll_ns(pollfds, npfd, timeout);
         }
+
+        if (timeout) {
+            atomic_set(&ctx->idle_ns, ctx->idle_ns +
+                       qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - idle_start);
+        }
     }
 
     if (blocking) {
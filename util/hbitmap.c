@@ -446,6 +446,9 @@ void hbitmap_reset_all(HBitmap *hb)
 
     hb->levels[0][0] = 1UL << (BITS_PER_LONG - 1);
     hb->count = 0;
+    if (hb->meta) {
+        hbitmap_set(hb->meta, 0, hb->size << hb->granularity);
+    }
 }
 
 bool hbitmap_is_serializable(const HBitmap *hb)
@@ -569,6 +572,9 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
         buf += sizeof(unsigned long);
         cur++;
     }
+    if (hb->meta) {
+        hbitmap_set(hb->meta, start, count);
+    }
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -586,6 +592,9 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
     serialization_chunk(hb, start, count, &first, &el_count);
 
     memset(first, 0, el_count * sizeof(unsigned long));
+    if (hb->meta) {
+        hbitmap_set(hb->meta, start, count);
+    }
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -603,6 +612,9 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
     serialization_chunk(hb, start, count, &first, &el_count);
 
     memset(first, 0xff, el_count * sizeof(unsigned long));
+    if (hb->meta) {
+        hbitmap_set(hb->meta, start, count);
+    }
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -728,6 +740,7 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
  */
 bool hbitmap_merge(HBitmap *a, const HBitmap *b)
 {
+    const int last = HBITMAP_LEVELS - 1;
     int i;
     uint64_t j;
 
@@ -739,16 +752,31 @@ bool hbitmap_merge(HBitmap *a, const HBitmap *b)
         return true;
     }
 
-    /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+    /* The bits of B's second-to-last level tell which of its last-level
+     * words are non-zero, so only those are ORed in, and the count is
+     * updated from the bits they add instead of being recomputed over the
+     * whole bitmap.  The upper levels are BITS_PER_LONG times smaller and
+     * are simply ORed word by word.
      */
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+    for (j = find_first_bit(b->levels[last - 1], b->sizes[last]);
+         j < b->sizes[last];
+         j = find_next_bit(b->levels[last - 1], b->sizes[last], j + 1)) {
+        unsigned long added = b->levels[last][j] & ~a->levels[last][j];
+
+        a->levels[last][j] |= added;
+        a->count += ctpopl(added);
+    }
+    for (i = last - 1; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             a->levels[i][j] |= b->levels[i][j];
         }
     }
 
+    /* Finding the words that actually changed is not worth it */
+    if (a->meta) {
+        hbitmap_set(a->meta, 0, a->size << a->granularity);
+    }
+
     return true;
 }
 
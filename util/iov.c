@@ -21,6 +21,7 @@
 #include "qemu/iov.h"
 #include "qemu/sockets.h"
 #include "qemu/cutils.h"
+#include "qemu/bswap.h"
 
 size_t iov_from_buf_full(const struct iovec *iov, unsigned int iov_cnt,
                          size_t offset, const void *buf, size_t bytes)
@@ -359,16 +360,21 @@ void qemu_iovec_concat(QEMUIOVector *dst,
 bool qemu_iovec_is_zero(QEMUIOVector *qiov)
 {
     int i;
+
+    /* Data that is not zero usually is not zero at the start of some
+     * element, so look there first; that way a request whose first
+     * elements are zero is rejected without having to scan them whole.
+     */
     for (i = 0; i < qiov->niov; i++) {
-        size_t offs = QEMU_ALIGN_DOWN(qiov->iov[i].iov_len, 4 * sizeof(long));
-        uint8_t *ptr = qiov->iov[i].iov_base;
-        if (offs && !buffer_is_zero(qiov->iov[i].iov_base, offs)) {
+        if (qiov->iov[i].iov_len >= 8 && ldq_he_p(qiov->iov[i].iov_base)) {
             return false;
         }
-        for (; offs < qiov->iov[i].iov_len; offs++) {
-            if (ptr[offs]) {
-                return false;
-            }
+    }
+
+    /* buffer_is_zero() handles any length and alignment */
+    for (i = 0; i < qiov->niov; i++) {
+        if (!buffer_is_zero(qiov->iov[i].iov_base, qiov->iov[i].iov_len)) {
+            return false;
         }
     }
     return true;
@@ -0,0 +1,81 @@
+/*
+ * Log-linear histogram
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/log-histogram.h"
+
+static unsigned log_histogram_index(uint64_t value)
+{
+    unsigned msb;
+
+    if (value < LOG_HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+
+    msb = 63 - clz64(value);
+    return (msb - LOG_HISTOGRAM_SUB_BITS + 1) * LOG_HISTOGRAM_SUB_BUCKETS +
+           ((value >> (msb - LOG_HISTOGRAM_SUB_BITS)) &
+            (LOG_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/* Returns the largest value that falls into bucket @index */
+static uint64_t log_histogram_bucket_max(unsigned index)
+{
+    unsigned msb, shift;
+    uint64_t sub;
+
+    if (index < LOG_HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+
+    msb = index / LOG_HISTOGRAM_SUB_BUCKETS + LOG_HISTOGRAM_SUB_BITS - 1;
+    sub = index % LOG_HISTOGRAM_SUB_BUCKETS;
+    shift = msb - LOG_HISTOGRAM_SUB_BITS;
+
+    return ((LOG_HISTOGRAM_SUB_BUCKETS + sub) << shift) +
+           ((UINT64_C(1) << shift) - 1);
+}
+
+void log_histogram_reset(LogHistogram *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+void log_histogram_account(LogHistogram *hist, uint64_t value)
+{
+    hist->buckets[log_histogram_index(value)]++;
+    hist->count++;
+}
+
+uint64_t log_histogram_count(const LogHistogram *hist)
+{
+    return hist->count;
+}
+
+uint64_t log_histogram_percentile(const LogHistogram *hist, double percentile)
+{
+    uint64_t rank, sum = 0;
+    unsigned i;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    assert(percentile >= 0 && percentile <= 100);
+    rank = MAX(1, (uint64_t) ceil(hist->count * percentile / 100));
+
+    for (i = 0; i < LOG_HISTOGRAM_BUCKETS; i++) {
+        sum += hist->buckets[i];
+        if (sum >= rank) {
+            break;
+        }
+    }
+    assert(i < LOG_HISTOGRAM_BUCKETS);
+
+    return log_histogram_bucket_max(i);
+}
@@ -13,6 +13,17 @@
 #include "qemu/osdep.h"
 #include "qemu/mmap-alloc.h"
 #include "qemu/host-utils.h"
+#include "qemu/error-report.h"
+
+#ifdef CONFIG_LINUX
+/* Linux 4.15 and newer; define them for older headers */
+#ifndef MAP_SHARED_VALIDATE
+#define MAP_SHARED_VALIDATE 0x03
+#endif
+#ifndef MAP_SYNC
+#define MAP_SYNC 0x80000
+#endif
+#endif
 
 #define HUGETLBFS_MAGIC       0x958458f6
 
@@ -73,7 +84,8 @@ size_t qemu_mempath_getpagesize(const char *mem_path)
     return getpagesize();
 }
 
-void *qemu_ram_mmap(int fd, size_t size, size_t align, bool shared)
+void *qemu_ram_mmap(int fd, size_t size, size_t align, bool shared,
+                    bool is_pmem)
 {
     /*
      * Note: this always allocates at least one extra page of virtual address
@@ -107,11 +119,25 @@ void *qemu_ram_mmap(int fd, size_t size, size_t align, bool shared)
     assert(align >= getpagesize());
 
     offset = QEMU_ALIGN_UP((uintptr_t)ptr, align) - (uintptr_t)ptr;
-    ptr1 = mmap(ptr + offset, size, PROT_READ | PROT_WRITE,
-                MAP_FIXED |
-                (fd == -1 ? MAP_ANONYMOUS : 0) |
-                (shared ? MAP_SHARED : MAP_PRIVATE),
-                fd, 0);
+    ptr1 = MAP_FAILED;
+#ifdef CONFIG_LINUX
+    if (is_pmem && shared && fd != -1) {
+        /* Fails with EOPNOTSUPP unless the file is on a DAX filesystem */
+        ptr1 = mmap(ptr + offset, size, PROT_READ | PROT_WRITE,
+                    MAP_FIXED | MAP_SHARED_VALIDATE | MAP_SYNC, fd, 0);
+        if (ptr1 == MAP_FAILED) {
+            warn_report("MAP_SYNC is not supported for this file; writes "
+                        "to persistent memory may need an explicit msync");
+        }
+    }
+#endif
+    if (ptr1 == MAP_FAILED) {
+        ptr1 = mmap(ptr + offset, size, PROT_READ | PROT_WRITE,
+                    MAP_FIXED |
+                    (fd == -1 ? MAP_ANONYMOUS : 0) |
+                    (shared ? MAP_SHARED : MAP_PRIVATE),
+                    fd, 0);
+    }
     if (ptr1 == MAP_FAILED) {
         munmap(ptr, total);
         return MAP_FAILED;
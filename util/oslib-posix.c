@@ -38,9 +38,16 @@
 #include <libgen.h>
 #include <sys/signal.h>
 #include "qemu/cutils.h"
+#include "qemu/bitops.h"
 
 #ifdef CONFIG_LINUX
 #include <sys/syscall.h>
+#include <sched.h>
+
+/* Linux 5.14+; older kernels fail the probe with EINVAL */
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
 #endif
 
 #ifdef __FreeBSD__
@@ -65,6 +72,10 @@ struct MemsetThread {
     char *addr;
     size_t numpages;
     size_t hpagesize;
+    bool populate;
+#ifdef CONFIG_LINUX
+    cpu_set_t *cpus;
+#endif
     QemuThread pgthread;
     sigjmp_buf env;
 };
@@ -130,7 +141,7 @@ void *qemu_memalign(size_t alignment, size_t size)
 void *qemu_anon_ram_alloc(size_t size, uint64_t *alignment)
 {
     size_t align = QEMU_VMALLOC_ALIGN;
-    void *ptr = qemu_ram_mmap(-1, size, align, false);
+    void *ptr = qemu_ram_mmap(-1, size, align, false, false);
 
     if (ptr == MAP_FAILED) {
         return NULL;
@@ -312,6 +323,24 @@ static void *do_touch_pages(void *arg)
     MemsetThread *memset_args = (MemsetThread *)arg;
     sigset_t set, oldset;
 
+#ifdef CONFIG_LINUX
+    /* Best effort: fault the pages in from the nodes that will use them */
+    if (memset_args->cpus) {
+        sched_setaffinity(0, sizeof(cpu_set_t), memset_args->cpus);
+    }
+    if (memset_args->populate) {
+        size_t size = memset_args->numpages * memset_args->hpagesize;
+
+        while (madvise(memset_args->addr, size, MADV_POPULATE_WRITE)) {
+            if (errno != EINTR) {
+                memset_thread_failed = true;
+                break;
+            }
+        }
+        return NULL;
+    }
+#endif
+
     /* unblock SIGBUS */
     sigemptyset(&set);
     sigaddset(&set, SIGBUS);
@@ -345,28 +374,129 @@ static void *do_touch_pages(void *arg)
     return NULL;
 }
 
-static inline int get_memset_num_threads(int smp_cpus)
+#ifdef CONFIG_LINUX
+/* Add the CPUs listed in sysfs for host NUMA node @node to @cpus */
+static void host_node_add_cpus(unsigned long node, cpu_set_t *cpus)
+{
+    char *path = g_strdup_printf("/sys/devices/system/node/node%lu/cpulist",
+                                 node);
+    char *contents;
+    const char *p;
+    unsigned long first, last;
+
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+        g_free(path);
+        return;
+    }
+    /* The format is a comma separated list of ranges, e.g. "0-7,16-23" */
+    p = contents;
+    while (qemu_strtoul(p, &p, 10, &first) == 0) {
+        last = first;
+        if (*p == '-' && qemu_strtoul(p + 1, &p, 10, &last) < 0) {
+            break;
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            CPU_SET(first, cpus);
+        }
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+    g_free(contents);
+    g_free(path);
+}
+
+/*
+ * Return the set of host CPUs that belong to the nodes in @host_nodes,
+ * or NULL if no node is given or sysfs does not describe them.
+ */
+static cpu_set_t *host_nodes_to_cpus(const unsigned long *host_nodes,
+                                     unsigned long max_node)
+{
+    cpu_set_t *cpus;
+    unsigned long node;
+
+    if (!host_nodes || find_first_bit(host_nodes, max_node) == max_node) {
+        return NULL;
+    }
+
+    cpus = g_new0(cpu_set_t, 1);
+    for (node = find_first_bit(host_nodes, max_node); node < max_node;
+         node = find_next_bit(host_nodes, max_node, node + 1)) {
+        host_node_add_cpus(node, cpus);
+    }
+    if (!CPU_COUNT(cpus)) {
+        g_free(cpus);
+        return NULL;
+    }
+    return cpus;
+}
+#endif
+
+int qemu_bind_thread_to_host_nodes(const unsigned long *host_nodes,
+                                   unsigned long max_node)
+{
+#ifdef CONFIG_LINUX
+    cpu_set_t *cpus = host_nodes_to_cpus(host_nodes, max_node);
+    int ret = 0;
+
+    if (cpus && sched_setaffinity(0, sizeof(cpu_set_t), cpus) < 0) {
+        ret = -errno;
+    }
+    g_free(cpus);
+    return ret;
+#else
+    return -ENOSYS;
+#endif
+}
+
+static inline int get_memset_num_threads(int smp_cpus, int node_cpus,
+                                         size_t numpages)
 {
     long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
     int ret = 1;
 
-    if (host_procs > 0) {
+    if (node_cpus > 0) {
+        /*
+         * The memory is bound to some host nodes, so size the pool
+         * after the CPUs that will do the zeroing, not after the guest.
+         */
+        ret = MIN(node_cpus, MAX_MEM_PREALLOC_THREAD_COUNT);
+    } else if (host_procs > 0) {
         ret = MIN(MIN(host_procs, MAX_MEM_PREALLOC_THREAD_COUNT), smp_cpus);
     }
     /* In case sysconf() fails, we fall back to single threaded */
-    return ret;
+    return MAX(MIN(ret, numpages), 1);
 }
 
 static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                            int smp_cpus)
+                            int smp_cpus, const unsigned long *host_nodes,
+                            unsigned long max_node)
 {
     size_t numpages_per_thread;
     size_t size_per_thread;
     char *addr = area;
+    bool populate = false;
+    int node_cpus = 0;
     int i = 0;
+#ifdef CONFIG_LINUX
+    cpu_set_t *cpus = host_nodes_to_cpus(host_nodes, max_node);
+
+    if (cpus) {
+        node_cpus = CPU_COUNT(cpus);
+    }
+    /*
+     * Let the kernel fault the pages in without a round trip to user space
+     * for each of them.  A zero length call only checks that the advice is
+     * known.
+     */
+    populate = madvise(area, 0, MADV_POPULATE_WRITE) == 0;
+#endif
 
     memset_thread_failed = false;
-    memset_num_threads = get_memset_num_threads(smp_cpus);
+    memset_num_threads = get_memset_num_threads(smp_cpus, node_cpus,
+                                                numpages);
     memset_thread = g_new0(MemsetThread, memset_num_threads);
     numpages_per_thread = (numpages / memset_num_threads);
     size_per_thread = (hpagesize * numpages_per_thread);
@@ -375,6 +505,10 @@ static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
         memset_thread[i].numpages = (i == (memset_num_threads - 1)) ?
                                     numpages : numpages_per_thread;
         memset_thread[i].hpagesize = hpagesize;
+        memset_thread[i].populate = populate;
+#ifdef CONFIG_LINUX
+        memset_thread[i].cpus = cpus;
+#endif
         qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
                            do_touch_pages, &memset_thread[i],
                            QEMU_THREAD_JOINABLE);
@@ -386,11 +520,15 @@ static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
     }
     g_free(memset_thread);
     memset_thread = NULL;
+#ifdef CONFIG_LINUX
+    g_free(cpus);
+#endif
 
     return memset_thread_failed;
 }
 
 void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
+                     const unsigned long *host_nodes, unsigned long max_node,
                      Error **errp)
 {
     int ret;
@@ -410,7 +548,8 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 
     /* touch pages simultaneously */
-    if (touch_all_pages(area, hpagesize, numpages, smp_cpus)) {
+    if (touch_all_pages(area, hpagesize, numpages, smp_cpus,
+                        host_nodes, max_node)) {
         error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
             "pages available to allocate guest RAM");
     }
@@ -539,7 +539,14 @@ int getpagesize(void)
     return system_info.dwPageSize;
 }
 
+int qemu_bind_thread_to_host_nodes(const unsigned long *host_nodes,
+                                   unsigned long max_node)
+{
+    return -ENOSYS;
+}
+
 void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
+                     const unsigned long *host_nodes, unsigned long max_node,
                      Error **errp)
 {
     int i;
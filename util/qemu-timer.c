@@ -63,12 +63,20 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
  * used by different AioContexts / threads. Each clock also has
  * a list of the QEMUTimerLists associated with it, in order that
  * reenabling the clock can call all the notifiers.
+ *
+ * The pending timers are kept in a binary min-heap ordered by expiry
+ * time, so that arming or deleting one is O(log n) and the next deadline
+ * is always active_timers[0].  Timers with the same expiry run in the
+ * order they were armed.
  */
 
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+    QEMUTimer **active_timers;
+    unsigned nr_timers;
+    unsigned heap_size;
+    uint64_t timer_seq;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -119,6 +127,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -175,7 +184,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!atomic_read(&timer_list->active_timers);
+    return !!atomic_read(&timer_list->nr_timers);
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -188,16 +197,16 @@ bool timerlist_expired(QEMUTimerList *timer_list)
 {
     int64_t expire_time;
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (!atomic_read(&timer_list->nr_timers)) {
         return false;
     }
 
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
+    if (!timer_list->nr_timers) {
         qemu_mutex_unlock(&timer_list->active_timers_lock);
         return false;
     }
-    expire_time = timer_list->active_timers->expire_time;
+    expire_time = timer_list->active_timers[0]->expire_time;
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     return expire_time <= qemu_clock_get_ns(timer_list->clock->type);
@@ -219,7 +228,7 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     int64_t delta;
     int64_t expire_time;
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (!atomic_read(&timer_list->nr_timers)) {
         return -1;
     }
 
@@ -232,11 +241,11 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
      * the caller should notice the change and there is no race condition.
      */
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
+    if (!timer_list->nr_timers) {
         qemu_mutex_unlock(&timer_list->active_timers_lock);
         return -1;
     }
-    expire_time = timer_list->active_timers->expire_time;
+    expire_time = timer_list->active_timers[0]->expire_time;
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
@@ -356,43 +365,106 @@ void timer_deinit(QEMUTimer *ts)
     ts->timer_list = NULL;
 }
 
-static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+static inline bool timer_before(QEMUTimer *a, QEMUTimer *b)
 {
-    QEMUTimer **pt, *t;
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
 
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            atomic_set(pt, t->next);
+static inline void timer_heap_set(QEMUTimerList *timer_list,
+                                  unsigned idx, QEMUTimer *ts)
+{
+    timer_list->active_timers[idx] = ts;
+    ts->heap_idx = idx;
+}
+
+static void timer_heap_sift_up(QEMUTimerList *timer_list, unsigned idx)
+{
+    QEMUTimer *ts = timer_list->active_timers[idx];
+
+    while (idx > 0) {
+        unsigned parent = (idx - 1) / 2;
+
+        if (!timer_before(ts, timer_list->active_timers[parent])) {
             break;
         }
-        pt = &t->next;
+        timer_heap_set(timer_list, idx, timer_list->active_timers[parent]);
+        idx = parent;
     }
+    timer_heap_set(timer_list, idx, ts);
 }
 
-static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
-                                QEMUTimer *ts, int64_t expire_time)
+static void timer_heap_sift_down(QEMUTimerList *timer_list, unsigned idx)
 {
-    QEMUTimer **pt, *t;
+    QEMUTimer *ts = timer_list->active_timers[idx];
+    unsigned n = timer_list->nr_timers;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
     for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
+        unsigned child = 2 * idx + 1;
+
+        if (child >= n) {
             break;
         }
-        pt = &t->next;
+        if (child + 1 < n &&
+            timer_before(timer_list->active_timers[child + 1],
+                         timer_list->active_timers[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->active_timers[child], ts)) {
+            break;
+        }
+        timer_heap_set(timer_list, idx, timer_list->active_timers[child]);
+        idx = child;
     }
+    timer_heap_set(timer_list, idx, ts);
+}
+
+static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    unsigned idx = ts->heap_idx;
+    unsigned last;
+    QEMUTimer *moved;
+
+    if (ts->expire_time == -1) {
+        return;
+    }
+    ts->expire_time = -1;
+
+    last = timer_list->nr_timers - 1;
+    atomic_set(&timer_list->nr_timers, last);
+    if (idx != last) {
+        /* fill the hole with the last leaf and restore the heap order */
+        moved = timer_list->active_timers[last];
+        timer_heap_set(timer_list, idx, moved);
+        timer_heap_sift_down(timer_list, idx);
+        timer_heap_sift_up(timer_list, moved->heap_idx);
+    }
+}
+
+/* Arm TS, or move it if already pending; return true if it is now first. */
+static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
+                                QEMUTimer *ts, int64_t expire_time)
+{
+    bool pending = ts->expire_time != -1;
+
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    atomic_set(pt, ts);
+    ts->seq = timer_list->timer_seq++;
 
-    return pt == &timer_list->active_timers;
+    if (pending) {
+        timer_heap_sift_down(timer_list, ts->heap_idx);
+    } else {
+        if (timer_list->nr_timers == timer_list->heap_size) {
+            timer_list->heap_size = MAX(16, timer_list->heap_size * 2);
+            timer_list->active_timers = g_renew(QEMUTimer *,
+                                                timer_list->active_timers,
+                                                timer_list->heap_size);
+        }
+        timer_heap_set(timer_list, timer_list->nr_timers, ts);
+        atomic_set(&timer_list->nr_timers, timer_list->nr_timers + 1);
+    }
+    timer_heap_sift_up(timer_list, ts->heap_idx);
+
+    return ts->heap_idx == 0;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -424,7 +496,6 @@ void timer_mod_ns(QEMUTimer *ts, int64_t expire_time)
     bool rearm;
 
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    timer_del_locked(timer_list, ts);
     rearm = timer_mod_ns_locked(timer_list, ts, expire_time);
     qemu_mutex_unlock(&timer_list->active_timers_lock);
 
@@ -443,9 +514,6 @@ void timer_mod_anticipate_ns(QEMUTimer *ts, int64_t expire_time)
 
     qemu_mutex_lock(&timer_list->active_timers_lock);
     if (ts->expire_time == -1 || ts->expire_time > expire_time) {
-        if (ts->expire_time != -1) {
-            timer_del_locked(timer_list, ts);
-        }
         rearm = timer_mod_ns_locked(timer_list, ts, expire_time);
     } else {
         rearm = false;
@@ -485,7 +553,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     QEMUTimerCB *cb;
     void *opaque;
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (!atomic_read(&timer_list->nr_timers)) {
         return false;
     }
 
@@ -518,16 +586,14 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     for(;;) {
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
+        ts = timer_list->nr_timers ? timer_list->active_timers[0] : NULL;
         if (!timer_expired_ns(ts, current_time)) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
             break;
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
         qemu_mutex_unlock(&timer_list->active_timers_lock);
@@ -739,6 +739,26 @@ static void qht_map_copy(struct qht *ht, void *p, uint32_t hash, void *userp)
     qht_insert__locked(ht, new, b, p, hash, NULL);
 }
 
+/*
+ * Copy all entries of @old into @new, taking the bucket locks of @old one
+ * at a time, in the same order as qht_map_lock_buckets(), and keeping them.
+ * Writers to the buckets that the copy has not reached yet can still make
+ * progress, and their updates are picked up when the copy gets there.
+ * Pairs with qht_map_unlock_buckets().
+ */
+static void qht_map_lock_buckets_and_copy(struct qht *ht, struct qht_map *old,
+                                          struct qht_map *new)
+{
+    size_t i;
+
+    for (i = 0; i < old->n_buckets; i++) {
+        struct qht_bucket *b = &old->buckets[i];
+
+        qemu_spin_lock(&b->lock);
+        qht_bucket_iter(ht, b, qht_map_copy, new);
+    }
+}
+
 /*
  * Atomically perform a resize and/or reset.
  * Call with ht->lock held.
@@ -748,19 +768,20 @@ static void qht_do_resize_reset(struct qht *ht, struct qht_map *new, bool reset)
     struct qht_map *old;
 
     old = ht->map;
-    qht_map_lock_buckets(old);
 
     if (reset) {
+        qht_map_lock_buckets(old);
         qht_map_reset__all_locked(old);
+        if (new == NULL) {
+            qht_map_unlock_buckets(old);
+            return;
+        }
+        /* nothing to copy, @old is empty now */
+    } else {
+        g_assert(new);
+        g_assert_cmpuint(new->n_buckets, !=, old->n_buckets);
+        qht_map_lock_buckets_and_copy(ht, old, new);
     }
-
-    if (new == NULL) {
-        qht_map_unlock_buckets(old);
-        return;
-    }
-
-    g_assert_cmpuint(new->n_buckets, !=, old->n_buckets);
-    qht_map_iter__all_locked(ht, old, qht_map_copy, new);
     qht_map_debug__all_locked(new);
 
     atomic_rcu_set(&ht->map, new);
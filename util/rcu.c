@@ -32,6 +32,8 @@
 #include "qemu/atomic.h"
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "trace.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -92,10 +94,12 @@ static void wait_for_readers(void)
             atomic_set(&index->waiting, true);
         }
 
-        /* Here, order the stores to index->waiting before the
-         * loads of index->ctr.
+        /* Here, order the stores to index->waiting before the loads of
+         * index->ctr.  Pairs with smp_mb_placeholder() in rcu_read_lock()
+         * and rcu_read_unlock(), ensuring that the loads of index->ctr are
+         * sequentially consistent.
          */
-        smp_mb();
+        smp_mb_global();
 
         QLIST_FOREACH_SAFE(index, &registry, node, tmp) {
             if (!rcu_gp_ongoing(&index->ctr)) {
@@ -232,6 +236,7 @@ retry:
 static void *call_rcu_thread(void *opaque)
 {
     struct rcu_head *node;
+    int64_t gp_start;
 
     rcu_register_thread();
 
@@ -259,7 +264,9 @@ static void *call_rcu_thread(void *opaque)
         }
 
         atomic_sub(&rcu_call_count, n);
+        gp_start = get_clock();
         synchronize_rcu();
+        trace_call_rcu_batch(n, get_clock() - gp_start);
         qemu_mutex_lock_iothread();
         while (n > 0) {
             node = try_dequeue();
@@ -370,6 +377,7 @@ static void rcu_init_child(void)
 
 static void __attribute__((__constructor__)) rcu_init(void)
 {
+    smp_mb_global_init();
 #ifdef CONFIG_POSIX
     pthread_atfork(rcu_init_lock, rcu_init_unlock, rcu_init_child);
 #endif
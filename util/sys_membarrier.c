@@ -0,0 +1,34 @@
+/*
+ * Process-global memory barriers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/sys_membarrier.h"
+#include "qemu/error-report.h"
+
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+
+static int membarrier(int cmd, int flags)
+{
+    return syscall(__NR_membarrier, cmd, flags);
+}
+
+void smp_mb_global(void)
+{
+    membarrier(MEMBARRIER_CMD_SHARED, 0);
+}
+
+void smp_mb_global_init(void)
+{
+    int ret = membarrier(MEMBARRIER_CMD_QUERY, 0);
+
+    if (ret < 0 || !(ret & MEMBARRIER_CMD_SHARED)) {
+        error_report("This QEMU binary requires the membarrier system call.");
+        error_report("Please upgrade your system to a newer version of Linux");
+        exit(1);
+    }
+}
@@ -49,6 +49,12 @@ struct ThreadPoolElement {
     /* Access to this list is protected by lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
+    /* Pushed atomically by whoever completes the request.  */
+    QSLIST_ENTRY(ThreadPoolElement) done_next;
+
+    /* Only accessed from the pool's AioContext.  */
+    QSIMPLEQ_ENTRY(ThreadPoolElement) completed_next;
+
     /* Access to this list is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
@@ -62,8 +68,12 @@ struct ThreadPool {
     int max_threads;
     QEMUBH *new_thread_bh;
 
+    /* Requests that are done but not yet seen by completion_bh.  */
+    QSLIST_HEAD(, ThreadPoolElement) done_list;
+
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) completed;
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
@@ -109,9 +119,10 @@ static void *worker_thread(void *opaque)
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_mutex_lock(&pool->lock);
-
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->done_list, req, done_next);
         qemu_bh_schedule(pool->completion_bh);
+
+        qemu_mutex_lock(&pool->lock);
     }
 
     pool->cur_threads--;
@@ -160,17 +171,39 @@ static void spawn_thread(ThreadPool *pool)
     }
 }
 
+/* Append the requests finished since the last call, oldest first.  */
+static void thread_pool_collect_done(ThreadPool *pool)
+{
+    QSLIST_HEAD(, ThreadPoolElement) done;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) batch;
+    ThreadPoolElement *elem;
+
+    if (!atomic_read(&pool->done_list.slh_first)) {
+        return;
+    }
+
+    QSLIST_MOVE_ATOMIC(&done, &pool->done_list);
+    QSIMPLEQ_INIT(&batch);
+    while ((elem = QSLIST_FIRST(&done)) != NULL) {
+        QSLIST_REMOVE_HEAD(&done, done_next);
+        QSIMPLEQ_INSERT_HEAD(&batch, elem, completed_next);
+    }
+    QSIMPLEQ_CONCAT(&pool->completed, &batch);
+}
+
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
     aio_context_acquire(pool->ctx);
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
+    for (;;) {
+        thread_pool_collect_done(pool);
+        elem = QSIMPLEQ_FIRST(&pool->completed);
+        if (!elem) {
+            break;
         }
+        QSIMPLEQ_REMOVE_HEAD(&pool->completed, completed_next);
 
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
@@ -190,16 +223,12 @@ restart:
             aio_context_acquire(pool->ctx);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because we collect the
+             * done list again before looking at the next request.
              */
             qemu_bh_cancel(pool->completion_bh);
-
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
     aio_context_release(pool->ctx);
 }
@@ -220,10 +249,11 @@ static void thread_pool_cancel(BlockAIOCB *acb)
          */
         qemu_sem_timedwait(&pool->sem, 0) == 0) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
 
-        elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+        elem->state = THREAD_DONE;
+        QSLIST_INSERT_HEAD_ATOMIC(&pool->done_list, elem, done_next);
+        qemu_bh_schedule(pool->completion_bh);
     }
 
     qemu_mutex_unlock(&pool->lock);
@@ -312,6 +342,7 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
+    QSIMPLEQ_INIT(&pool->completed);
     QTAILQ_INIT(&pool->request_list);
 }
 
@@ -445,6 +445,31 @@ bool throttle_schedule_timer(ThrottleState *ts,
     return true;
 }
 
+static const BucketType bucket_types_size[2][2] = {
+    { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+    { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+};
+
+static const BucketType bucket_types_units[2][2] = {
+    { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+    { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+};
+
+/* compute the number of I/O units an operation counts for
+ *
+ * @op_size:  the configured size of one operation, or 0
+ * @size:     the size of the operation
+ * @ret:      the number of units
+ */
+double throttle_op_units(uint64_t op_size, uint64_t size)
+{
+    /* if op_size is defined and smaller than size we compute unit count */
+    if (op_size && size > op_size) {
+        return (double) size / op_size;
+    }
+    return 1.0;
+}
+
 /* do the accounting for this operation
  *
  * @is_write: the type of operation (read/write)
@@ -452,21 +477,20 @@ bool throttle_schedule_timer(ThrottleState *ts,
  */
 void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
 {
-    const BucketType bucket_types_size[2][2] = {
-        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
-        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
-    };
-    const BucketType bucket_types_units[2][2] = {
-        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
-        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
-    };
-    double units = 1.0;
-    unsigned i;
+    throttle_account_units(ts, is_write, size,
+                           throttle_op_units(ts->cfg.op_size, size));
+}
 
-    /* if cfg.op_size is defined and smaller than size we compute unit count */
-    if (ts->cfg.op_size && size > ts->cfg.op_size) {
-        units = (double) size / ts->cfg.op_size;
-    }
+/* do the accounting for a number of bytes and I/O units at once
+ *
+ * @is_write: the type of operation (read/write)
+ * @size:     the number of bytes
+ * @units:    the number of I/O units
+ */
+void throttle_account_units(ThrottleState *ts, bool is_write, uint64_t size,
+                            double units)
+{
+    unsigned i;
 
     for (i = 0; i < 2; i++) {
         LeakyBucket *bkt;
@@ -485,6 +509,39 @@ void throttle_account(ThrottleState *ts, bool is_write, uint64_t size)
     }
 }
 
+/* compute how much I/O the average limits allow within a period of time,
+ * rounded down
+ *
+ * @is_write: the type of operation (read/write)
+ * @delta_ns: the length of the period
+ * @size:     set to the number of bytes, UINT64_MAX if not limited
+ * @units:    set to the number of I/O units, UINT64_MAX if not limited
+ */
+void throttle_get_budget(ThrottleState *ts, bool is_write, int64_t delta_ns,
+                         uint64_t *size, uint64_t *units)
+{
+    unsigned i;
+
+    *size = UINT64_MAX;
+    *units = UINT64_MAX;
+
+    for (i = 0; i < 2; i++) {
+        LeakyBucket *bkt;
+
+        bkt = &ts->cfg.buckets[bucket_types_size[is_write][i]];
+        if (bkt->avg) {
+            *size = MIN(*size, muldiv64(bkt->avg, delta_ns,
+                                        NANOSECONDS_PER_SECOND));
+        }
+
+        bkt = &ts->cfg.buckets[bucket_types_units[is_write][i]];
+        if (bkt->avg) {
+            *units = MIN(*units, muldiv64(bkt->avg, delta_ns,
+                                          NANOSECONDS_PER_SECOND));
+        }
+    }
+}
+
 /* return a ThrottleConfig based on the options in a ThrottleLimits
  *
  * @arg:    the ThrottleLimits object to read from
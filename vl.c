@@ -3043,6 +3043,17 @@ static void register_global_properties(MachineState *ms)
     user_register_global_props();
 }
 
+/*
+ * Startup profiling: the vl_startup_phase trace event reports how long
+ * after entering main() each phase of the init sequence completed.
+ */
+static int64_t startup_start_ns;
+
+static void startup_phase(const char *phase)
+{
+    trace_vl_startup_phase(phase, (get_clock() - startup_start_ns) / SCALE_US);
+}
+
 int main(int argc, char **argv, char **envp)
 {
     int i;
@@ -3087,6 +3098,7 @@ int main(int argc, char **argv, char **envp)
     QSIMPLEQ_HEAD(, BlockdevOptions_queue) bdo_queue
         = QSIMPLEQ_HEAD_INITIALIZER(bdo_queue);
 
+    startup_start_ns = get_clock();
     module_call_init(MODULE_INIT_TRACE);
 
     qemu_init_cpu_list();
@@ -4157,6 +4169,7 @@ int main(int argc, char **argv, char **envp)
         exit(1);
     }
     trace_init_file(trace_file);
+    startup_phase("options");
 
     /* Open the logfile at this point and set the log mask if necessary.
      */
@@ -4407,6 +4420,7 @@ int main(int argc, char **argv, char **envp)
     }
 
     configure_accelerator(current_machine);
+    startup_phase("accel");
 
     /*
      * Register all the global properties, including accel properties,
@@ -4622,6 +4636,7 @@ int main(int argc, char **argv, char **envp)
     parse_numa_opts(current_machine);
 
     machine_run_board_init(current_machine);
+    startup_phase("board");
 
     realtime_init();
 
@@ -4651,6 +4666,7 @@ int main(int argc, char **argv, char **envp)
                           device_init_func, NULL, NULL)) {
         exit(1);
     }
+    startup_phase("devices");
 
     cpu_synchronize_all_post_init();
 
@@ -4735,6 +4751,7 @@ int main(int argc, char **argv, char **envp)
      * when bus is created by qdev.c */
     qemu_register_reset(qbus_reset_all_fn, sysbus_get_default());
     qemu_run_machine_init_done_notifiers();
+    startup_phase("machine-done");
 
     if (rom_check_and_register_reset() != 0) {
         error_report("rom check and register reset failed");
@@ -4748,6 +4765,7 @@ int main(int argc, char **argv, char **envp)
        clock values from the log. */
     replay_checkpoint(CHECKPOINT_RESET);
     qemu_system_reset(SHUTDOWN_CAUSE_NONE);
+    startup_phase("reset");
     register_global_state();
     if (replay_mode != REPLAY_MODE_NONE) {
         replay_vmstate_init();
@@ -4779,6 +4797,7 @@ int main(int argc, char **argv, char **envp)
 
     os_setup_post();
 
+    startup_phase("main-loop");
     main_loop();
     replay_disable_events();
     iothread_stop_all();